@@ -0,0 +1,294 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+/**
+ * Benchmarks for the C++ core, without any of the overhead of the Python or
+ * Java bindings. Run with --benchmark_filter=<regex> to select benchmarks, and
+ * compare runs with Google Benchmark's tools/compare.py.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <ratio>
+#include <vector>
+
+#include "E4M3.h"
+#include "Euclidean.h"
+#include "InnerProduct.h"
+#include "TypedIndex.h"
+
+namespace {
+constexpr int NUM_DIMENSIONS = 128;
+constexpr int NUM_ELEMENTS = 20000;
+constexpr int NUM_QUERIES = 500;
+constexpr int K = 10;
+
+NDArray<float, 2> randomVectors(int numVectors, int numDimensions,
+                                unsigned int seed) {
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<float> distribution(-1, 1);
+  NDArray<float, 2> vectors({numVectors, numDimensions});
+  for (size_t i = 0; i < vectors.data.size(); i++) {
+    vectors.data[i] = distribution(generator);
+  }
+  return vectors;
+}
+
+/**
+ * The vectors searched by the query and load benchmarks, the queries run
+ * against them, and the true nearest neighbors of each query.
+ */
+struct Dataset {
+  NDArray<float, 2> vectors = randomVectors(NUM_ELEMENTS, NUM_DIMENSIONS, 1);
+  NDArray<float, 2> queries = randomVectors(NUM_QUERIES, NUM_DIMENSIONS, 2);
+  std::vector<std::vector<hnswlib::labeltype>> neighbors;
+
+  Dataset() {
+    for (int q = 0; q < NUM_QUERIES; q++) {
+      std::vector<std::pair<float, hnswlib::labeltype>> distances;
+      for (int i = 0; i < NUM_ELEMENTS; i++) {
+        distances.emplace_back(
+            hnswlib::L2Sqr<float, float>(queries[q], vectors[i],
+                                         NUM_DIMENSIONS),
+            i);
+      }
+      std::partial_sort(distances.begin(), distances.begin() + K,
+                        distances.end());
+      neighbors.emplace_back();
+      for (int i = 0; i < K; i++) {
+        neighbors.back().push_back(distances[i].second);
+      }
+    }
+  }
+
+  static const Dataset &get() {
+    static const Dataset dataset;
+    return dataset;
+  }
+};
+
+/**
+ * A Euclidean index of the dataset's vectors, built once and shared between
+ * every benchmark that doesn't modify it.
+ */
+template <typename data_t, typename scalefactor = std::ratio<1, 1>>
+TypedIndex<float, data_t, scalefactor> &getIndex() {
+  static std::unique_ptr<TypedIndex<float, data_t, scalefactor>> index = [] {
+    auto index = std::make_unique<TypedIndex<float, data_t, scalefactor>>(
+        SpaceType::Euclidean, NUM_DIMENSIONS);
+    index->addItems(Dataset::get().vectors);
+    return index;
+  }();
+  return *index;
+}
+
+template <typename data_t> data_t toStorage(float value) {
+  return (data_t)value;
+}
+template <> int8_t toStorage<int8_t>(float value) {
+  return (int8_t)(value * 127);
+}
+
+/**
+ * Benchmark the distance function chosen for the given space and storage type
+ * on this CPU, with the number of dimensions given by the benchmark's argument.
+ */
+template <typename Space, typename data_t>
+void BM_Distance(benchmark::State &state) {
+  const size_t numDimensions = state.range(0);
+  // Enough vectors to cycle through that they don't all fit in L1:
+  const size_t numVectors = 256;
+  NDArray<float, 2> floats = randomVectors(numVectors, numDimensions, 3);
+  std::vector<data_t> vectors(floats.data.size());
+  for (size_t i = 0; i < vectors.size(); i++) {
+    vectors[i] = toStorage<data_t>(floats.data[i]);
+  }
+
+  Space space(numDimensions);
+  auto distance = space.get_dist_func();
+  size_t i = 0;
+  for (auto _ : state) {
+    const data_t *a = vectors.data() + (i % numVectors) * numDimensions;
+    const data_t *b = vectors.data() + ((i + 1) % numVectors) * numDimensions;
+    benchmark::DoNotOptimize(distance(a, b, numDimensions));
+    i++;
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * 2 * space.get_data_size());
+}
+
+#define DISTANCE_BENCHMARK(Space, data_t)                                      \
+  BENCHMARK_TEMPLATE(BM_Distance, Space, data_t)                               \
+      ->Arg(16)                                                                \
+      ->Arg(64)                                                                \
+      ->Arg(100)                                                               \
+      ->Arg(128)                                                               \
+      ->Arg(256)                                                               \
+      ->Arg(1024)
+
+using Int8Scale = std::ratio<1, 127>;
+using EuclideanFloat = hnswlib::EuclideanSpace<float, float>;
+using InnerProductFloat = hnswlib::InnerProductSpace<float, float>;
+using EuclideanInt8 = hnswlib::EuclideanSpace<float, int8_t, Int8Scale>;
+using InnerProductInt8 = hnswlib::InnerProductSpace<float, int8_t, Int8Scale>;
+using EuclideanE4M3 = hnswlib::EuclideanSpace<float, E4M3>;
+using InnerProductE4M3 = hnswlib::InnerProductSpace<float, E4M3>;
+
+DISTANCE_BENCHMARK(EuclideanFloat, float);
+DISTANCE_BENCHMARK(InnerProductFloat, float);
+DISTANCE_BENCHMARK(EuclideanInt8, int8_t);
+DISTANCE_BENCHMARK(InnerProductInt8, int8_t);
+DISTANCE_BENCHMARK(EuclideanE4M3, E4M3);
+DISTANCE_BENCHMARK(InnerProductE4M3, E4M3);
+
+/**
+ * Benchmark single-threaded queries at the query EF given by the benchmark's
+ * argument, reporting the recall@K of those queries alongside their latency.
+ */
+template <typename data_t, typename scalefactor = std::ratio<1, 1>>
+void BM_Query(benchmark::State &state) {
+  const Dataset &dataset = Dataset::get();
+  auto &index = getIndex<data_t, scalefactor>();
+  const long queryEf = state.range(0);
+
+  std::vector<hnswlib::labeltype> labels(K);
+  std::vector<float> distances(K);
+  size_t q = 0;
+  for (auto _ : state) {
+    index.query(dataset.queries[q % NUM_QUERIES], NUM_DIMENSIONS, K,
+                labels.data(), distances.data(), queryEf);
+    benchmark::DoNotOptimize(labels.data());
+    q++;
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  // Measured outside of the timed loop, so that it doesn't affect latency:
+  size_t matches = 0;
+  for (int i = 0; i < NUM_QUERIES; i++) {
+    index.query(dataset.queries[i], NUM_DIMENSIONS, K, labels.data(),
+                distances.data(), queryEf);
+    for (int j = 0; j < K; j++) {
+      matches += std::count(dataset.neighbors[i].begin(),
+                            dataset.neighbors[i].end(), labels[j]);
+    }
+  }
+  state.counters["recall"] = (double)matches / (NUM_QUERIES * K);
+}
+
+#define QUERY_BENCHMARK(...)                                                   \
+  BENCHMARK_TEMPLATE(BM_Query, __VA_ARGS__)                                    \
+      ->ArgName("ef")                                                          \
+      ->Arg(K)                                                                 \
+      ->Arg(50)                                                                \
+      ->Arg(100)                                                               \
+      ->Arg(200)                                                               \
+      ->Arg(400)
+
+QUERY_BENCHMARK(float);
+QUERY_BENCHMARK(int8_t, Int8Scale);
+QUERY_BENCHMARK(E4M3);
+
+/**
+ * Benchmark exact brute-force queries, in batches of the size given by the
+ * benchmark's argument (which are scanned through the index together).
+ */
+void BM_BruteForceQuery(benchmark::State &state) {
+  const Dataset &dataset = Dataset::get();
+  auto &index = getIndex<float>();
+  const size_t batchSize = state.range(0);
+
+  std::vector<hnswlib::labeltype> labels(batchSize * K);
+  std::vector<float> distances(batchSize * K);
+  size_t start = 0;
+  for (auto _ : state) {
+    index.bruteForceQueryInto(dataset.queries[start], batchSize, K,
+                              labels.data(), distances.data(), 1);
+    benchmark::DoNotOptimize(labels.data());
+    start = (start + batchSize) % (NUM_QUERIES - batchSize + 1);
+  }
+  state.SetItemsProcessed(state.iterations() * batchSize);
+}
+BENCHMARK(BM_BruteForceQuery)->ArgName("batch")->Arg(1)->Arg(32);
+
+/**
+ * Benchmark building an index from scratch with the number of threads given by
+ * the benchmark's argument, with either addItems or bulkAddItems.
+ */
+template <bool bulk> void BM_Build(benchmark::State &state) {
+  const int numElements = 5000;
+  const int numThreads = state.range(0);
+  NDArray<float, 2> vectors = randomVectors(numElements, NUM_DIMENSIONS, 4);
+
+  for (auto _ : state) {
+    TypedIndex<float> index(SpaceType::Euclidean, NUM_DIMENSIONS);
+    if (bulk) {
+      index.bulkAddItems(vectors, {}, numThreads);
+    } else {
+      index.addItems(vectors, {}, numThreads);
+    }
+    benchmark::DoNotOptimize(index.getNumElements());
+  }
+  state.SetItemsProcessed(state.iterations() * numElements);
+}
+
+#define BUILD_BENCHMARK(bulk)                                                  \
+  BENCHMARK_TEMPLATE(BM_Build, bulk)                                           \
+      ->ArgName("threads")                                                     \
+      ->RangeMultiplier(2)                                                     \
+      ->Range(1, 16)                                                           \
+      ->Unit(benchmark::kMillisecond)                                          \
+      ->UseRealTime()
+
+BUILD_BENCHMARK(false);
+BUILD_BENCHMARK(true);
+
+/**
+ * Benchmark loading a serialized index from memory, excluding any file I/O.
+ */
+template <typename data_t, typename scalefactor = std::ratio<1, 1>>
+void BM_Load(benchmark::State &state) {
+  auto output = std::make_shared<MemoryOutputStream>();
+  getIndex<data_t, scalefactor>().saveIndex(output);
+  const std::string serialized = output->getValue();
+  const bool searchOnly = state.range(0);
+
+  for (auto _ : state) {
+    std::unique_ptr<Index> index = loadTypedIndexFromStream(
+        std::make_shared<MemoryInputStream>(serialized), searchOnly);
+    benchmark::DoNotOptimize(index->getNumElements());
+  }
+  state.SetBytesProcessed(state.iterations() * serialized.size());
+}
+
+#define LOAD_BENCHMARK(...)                                                    \
+  BENCHMARK_TEMPLATE(BM_Load, __VA_ARGS__)                                     \
+      ->ArgName("searchOnly")                                                  \
+      ->Arg(0)                                                                 \
+      ->Arg(1)                                                                 \
+      ->Unit(benchmark::kMillisecond)
+
+LOAD_BENCHMARK(float);
+LOAD_BENCHMARK(E4M3);
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,672 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#include "GpuBruteForce.h"
+
+#include <cublas_v2.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+void check(cudaError_t error, const char *what) {
+  if (error != cudaSuccess) {
+    throw std::runtime_error(std::string("CUDA error while ") + what + ": " +
+                             cudaGetErrorString(error));
+  }
+}
+
+void check(cublasStatus_t status, const char *what) {
+  if (status != CUBLAS_STATUS_SUCCESS) {
+    throw std::runtime_error(std::string("cuBLAS error while ") + what +
+                             " (status " + std::to_string((int)status) + ")");
+  }
+}
+
+/**
+ * An array in GPU memory, which is only reallocated when it has to grow.
+ */
+template <typename T> class DeviceBuffer {
+public:
+  DeviceBuffer() {}
+  ~DeviceBuffer() { release(); }
+
+  DeviceBuffer(const DeviceBuffer &) = delete;
+  DeviceBuffer &operator=(const DeviceBuffer &) = delete;
+
+  void reserve(size_t n) {
+    if (n <= capacity) {
+      return;
+    }
+    release();
+    check(cudaMalloc((void **)&pointer, n * sizeof(T)),
+          ("allocating " + std::to_string(n * sizeof(T)) +
+           " bytes of GPU memory")
+              .c_str());
+    capacity = n;
+  }
+
+  void release() {
+    if (pointer) {
+      cudaFree(pointer);
+    }
+    pointer = nullptr;
+    capacity = 0;
+  }
+
+  T *data() const { return pointer; }
+
+private:
+  T *pointer = nullptr;
+  size_t capacity = 0;
+};
+
+/**
+ * An array in page-locked host memory, which (unlike pageable memory) can be
+ * copied to the GPU while the GPU is busy with other work. Only reallocated
+ * when it has to grow.
+ */
+template <typename T> class PinnedBuffer {
+public:
+  PinnedBuffer() {}
+  ~PinnedBuffer() { release(); }
+
+  PinnedBuffer(const PinnedBuffer &) = delete;
+  PinnedBuffer &operator=(const PinnedBuffer &) = delete;
+
+  void reserve(size_t n) {
+    if (n <= capacity) {
+      return;
+    }
+    release();
+    check(cudaMallocHost((void **)&pointer, n * sizeof(T)),
+          ("allocating " + std::to_string(n * sizeof(T)) +
+           " bytes of pinned host memory")
+              .c_str());
+    capacity = n;
+  }
+
+  void release() {
+    if (pointer) {
+      cudaFreeHost(pointer);
+    }
+    pointer = nullptr;
+    capacity = 0;
+  }
+
+  T *data() const { return pointer; }
+
+private:
+  T *pointer = nullptr;
+  size_t capacity = 0;
+};
+
+__host__ __device__ inline float toFloat(float value) { return value; }
+__host__ __device__ inline float toFloat(__half value) {
+  return __half2float(value);
+}
+
+inline void fromFloat(float value, float &output) { output = value; }
+inline void fromFloat(float value, __half &output) {
+  output = __float2half(value);
+}
+
+/**
+ * Convert `numVectors` row-major vectors to the storage type `T` (first
+ * normalizing them, if requested), and compute the squared norm of each
+ * converted vector, so that Euclidean distances are computed consistently
+ * with the rounded vectors.
+ */
+template <typename T>
+void convertVectors(const float *vectors, size_t numVectors, int numDimensions,
+                    bool normalize, T *output, float *squaredNorms) {
+  for (size_t i = 0; i < numVectors; i++) {
+    const float *vector = vectors + i * numDimensions;
+    T *converted = output + i * numDimensions;
+    float scale = 1;
+    if (normalize) {
+      float norm = 0;
+      for (int d = 0; d < numDimensions; d++) {
+        norm += vector[d] * vector[d];
+      }
+      scale = 1.0f / (std::sqrt(norm) + 1e-30f);
+    }
+
+    float squaredNorm = 0;
+    for (int d = 0; d < numDimensions; d++) {
+      fromFloat(vector[d] * scale, converted[d]);
+      float rounded = toFloat(converted[d]);
+      squaredNorm += rounded * rounded;
+    }
+    squaredNorms[i] = squaredNorm;
+  }
+}
+
+struct Candidate {
+  float distance;
+  unsigned int index;
+};
+
+constexpr unsigned int NO_INDEX = 0xFFFFFFFF;
+
+// Distances from each batch of queries are computed against this many
+// vectors at a time, which bounds the size of the distance matrix:
+constexpr size_t VECTORS_PER_TILE = 1 << 16;
+constexpr size_t QUERIES_PER_BATCH = 1024;
+
+constexpr size_t SHARED_MEMORY_PER_BLOCK = 48 * 1024;
+
+/**
+ * The number of threads that select each query's nearest neighbors, which
+ * is limited by how many lists of `k` candidates fit in shared memory.
+ */
+int threadsPerQuery(int k) {
+  int threads = 128;
+  while (threads > 32 &&
+         threads * k * sizeof(Candidate) > SHARED_MEMORY_PER_BLOCK)
+    threads /= 2;
+  return threads;
+}
+
+template <typename T>
+__global__ void computeSquaredNorms(const T *vectors, size_t numVectors,
+                                    int numDimensions, float *norms) {
+  size_t i = blockIdx.x * (size_t)blockDim.x + threadIdx.x;
+  if (i >= numVectors) {
+    return;
+  }
+  const T *vector = vectors + i * numDimensions;
+  float sum = 0;
+  for (int d = 0; d < numDimensions; d++) {
+    float value = toFloat(vector[d]);
+    sum += value * value;
+  }
+  norms[i] = sum;
+}
+
+__global__ void convertToHalf(const float *input, size_t size,
+                              __half *output) {
+  size_t i = blockIdx.x * (size_t)blockDim.x + threadIdx.x;
+  if (i < size) {
+    output[i] = __float2half(input[i]);
+  }
+}
+
+/**
+ * Insert a candidate into a sorted list holding up to `k` of the nearest
+ * candidates seen so far.
+ */
+__device__ void insertCandidate(Candidate *list, int &size, int k,
+                                float distance, unsigned int index) {
+  if (size == k && distance >= list[k - 1].distance) {
+    return;
+  }
+  int i = size < k ? size++ : k - 1;
+  while (i > 0 && list[i - 1].distance > distance) {
+    list[i] = list[i - 1];
+    i--;
+  }
+  list[i] = {distance, index};
+}
+
+/**
+ * Update each query's `k` nearest vectors with those in one tile of vectors,
+ * given the inner products between them (one column per query). One block
+ * handles each query: each thread keeps the nearest vectors from its own
+ * slice of the tile, after which the threads' lists are merged pairwise.
+ */
+__global__ void selectNearest(const float *dots, size_t tileStart,
+                              size_t tileSize, const float *vectorNorms,
+                              const float *queryNorms, const uint8_t *live,
+                              const uint8_t *allowed, bool euclidean, int k,
+                              bool firstTile, Candidate *nearest) {
+  extern __shared__ Candidate lists[];
+  size_t query = blockIdx.x;
+  const float *queryDots = dots + query * tileSize;
+  Candidate *queryNearest = nearest + query * k;
+
+  Candidate local[GpuBruteForce::MAX_K];
+  int size = 0;
+  if (threadIdx.x == 0 && !firstTile) {
+    while (size < k && queryNearest[size].index != NO_INDEX) {
+      local[size] = queryNearest[size];
+      size++;
+    }
+  }
+
+  for (size_t i = threadIdx.x; i < tileSize; i += blockDim.x) {
+    size_t index = tileStart + i;
+    if (!live[index] || (allowed && !allowed[index])) {
+      continue;
+    }
+    float distance =
+        euclidean
+            ? fmaxf(vectorNorms[index] + queryNorms[query] - 2 * queryDots[i],
+                    0.0f)
+            : 1.0f - queryDots[i];
+    insertCandidate(local, size, k, distance, (unsigned int)index);
+  }
+
+  Candidate *own = lists + threadIdx.x * k;
+  for (int i = 0; i < k; i++) {
+    own[i] = i < size ? local[i] : Candidate{INFINITY, NO_INDEX};
+  }
+  __syncthreads();
+
+  for (int stride = blockDim.x / 2; stride > 0; stride /= 2) {
+    if (threadIdx.x < stride) {
+      const Candidate *other = lists + (threadIdx.x + stride) * k;
+      // Both lists are sorted and only the first k of their 2k candidates
+      // are kept, so neither list can run out:
+      int i = 0, j = 0;
+      for (int n = 0; n < k; n++) {
+        local[n] =
+            own[i].distance <= other[j].distance ? own[i++] : other[j++];
+      }
+      for (int n = 0; n < k; n++) {
+        own[n] = local[n];
+      }
+    }
+    __syncthreads();
+  }
+
+  if (threadIdx.x == 0) {
+    for (int i = 0; i < k; i++) {
+      queryNearest[i] = lists[i];
+    }
+  }
+}
+
+} // namespace
+
+struct GpuBruteForce::DeviceState {
+  int device;
+  cublasHandle_t handle = nullptr;
+  // Every copy and kernel is issued on one of these streams, neither of
+  // which waits for the other (or for the legacy default stream) unless
+  // told to by an event:
+  cudaStream_t computeStream = nullptr;
+  cudaStream_t copyStream = nullptr;
+  // For each of the two tile buffers used when vectors aren't resident:
+  // recorded once the buffer has been filled, and once the multiplication
+  // reading it has finished (so it can be filled again).
+  cudaEvent_t tileCopied[2] = {};
+  cudaEvent_t tileRead[2] = {};
+
+  size_t capacity = 0;
+  size_t bytesPerVector = 0;
+  // Whether `vectors` holds every vector, rather than `hostVectors`:
+  bool resident = true;
+  DeviceBuffer<char> vectors;
+  PinnedBuffer<char> hostVectors;
+  DeviceBuffer<char> tiles[2];
+  DeviceBuffer<float> vectorNorms;
+  // Zero for each vector that has been removed with setRemoved:
+  DeviceBuffer<uint8_t> live;
+
+  DeviceBuffer<float> queries;
+  DeviceBuffer<__half> halfQueries;
+  DeviceBuffer<float> queryNorms;
+  DeviceBuffer<float> dots;
+  DeviceBuffer<uint8_t> allowed;
+  DeviceBuffer<Candidate> nearest;
+
+  ~DeviceState() {
+    if (handle) {
+      cublasDestroy(handle);
+    }
+    for (int i = 0; i < 2; i++) {
+      if (tileCopied[i]) {
+        cudaEventDestroy(tileCopied[i]);
+      }
+      if (tileRead[i]) {
+        cudaEventDestroy(tileRead[i]);
+      }
+    }
+    if (computeStream) {
+      cudaStreamDestroy(computeStream);
+    }
+    if (copyStream) {
+      cudaStreamDestroy(copyStream);
+    }
+  }
+};
+
+GpuBruteForce::GpuBruteForce(SpaceType space, int numDimensions, int device,
+                             const GpuStorageOptions &options)
+    : space(space), numDimensions(numDimensions), options(options),
+      state(std::make_unique<DeviceState>()) {
+  int numDevices = 0;
+  check(cudaGetDeviceCount(&numDevices), "counting CUDA devices");
+  if (device < 0 || device >= numDevices) {
+    throw std::runtime_error("CUDA device " + std::to_string(device) +
+                             " does not exist; found " +
+                             std::to_string(numDevices) + " devices.");
+  }
+
+  cudaDeviceProp properties;
+  check(cudaGetDeviceProperties(&properties, device),
+        "reading CUDA device properties");
+  if (properties.major < 7) {
+    throw std::runtime_error(
+        "CUDA device " + std::to_string(device) + " (" + properties.name +
+        ") has compute capability " + std::to_string(properties.major) + "." +
+        std::to_string(properties.minor) + ", but 7.0 or higher is required.");
+  }
+
+  state->device = device;
+  state->bytesPerVector =
+      numDimensions * (options.halfPrecision ? sizeof(__half) : sizeof(float));
+  check(cudaSetDevice(device), "selecting CUDA device");
+  check(cublasCreate(&state->handle), "creating cuBLAS handle");
+  check(cudaStreamCreateWithFlags(&state->computeStream,
+                                  cudaStreamNonBlocking),
+        "creating CUDA stream");
+  check(cudaStreamCreateWithFlags(&state->copyStream, cudaStreamNonBlocking),
+        "creating CUDA stream");
+  check(cublasSetStream(state->handle, state->computeStream),
+        "setting cuBLAS stream");
+  for (int i = 0; i < 2; i++) {
+    check(cudaEventCreateWithFlags(&state->tileCopied[i],
+                                   cudaEventDisableTiming),
+          "creating CUDA event");
+    check(cudaEventCreateWithFlags(&state->tileRead[i],
+                                   cudaEventDisableTiming),
+          "creating CUDA event");
+  }
+}
+
+GpuBruteForce::~GpuBruteForce() {}
+
+void GpuBruteForce::reset(size_t capacity) {
+  if (capacity >= NO_INDEX) {
+    throw std::invalid_argument("GPU queries support at most " +
+                                std::to_string(NO_INDEX - 1) + " vectors.");
+  }
+
+  check(cudaSetDevice(state->device), "selecting CUDA device");
+  labels.clear();
+  labels.reserve(capacity);
+  state->vectors.release();
+  state->hostVectors.release();
+  for (DeviceBuffer<char> &tile : state->tiles) {
+    tile.release();
+  }
+  state->vectorNorms.release();
+  state->live.release();
+
+  size_t maxDeviceMemory = options.maxDeviceMemory;
+  if (maxDeviceMemory == 0) {
+    size_t freeMemory = 0, totalMemory = 0;
+    check(cudaMemGetInfo(&freeMemory, &totalMemory),
+          "reading free GPU memory");
+    maxDeviceMemory = freeMemory / 10 * 8;
+  }
+
+  size_t numVectors = std::max<size_t>(capacity, 1);
+  state->resident = numVectors * state->bytesPerVector <= maxDeviceMemory;
+  if (state->resident) {
+    state->vectors.reserve(numVectors * state->bytesPerVector);
+  } else {
+    state->hostVectors.reserve(numVectors * state->bytesPerVector);
+    for (DeviceBuffer<char> &tile : state->tiles) {
+      tile.reserve(std::min(numVectors, VECTORS_PER_TILE) *
+                   state->bytesPerVector);
+    }
+  }
+  state->vectorNorms.reserve(numVectors);
+  state->live.reserve(numVectors);
+  state->capacity = capacity;
+}
+
+bool GpuBruteForce::isResident() const { return state->resident; }
+
+void GpuBruteForce::addVectors(const float *vectors,
+                               const hnswlib::labeltype *newLabels,
+                               size_t numVectors) {
+  if (labels.size() + numVectors > state->capacity) {
+    throw std::invalid_argument(
+        "Cannot add " + std::to_string(numVectors) +
+        " vectors to the GPU, which only has room for " +
+        std::to_string(state->capacity - labels.size()) + " more.");
+  }
+
+  check(cudaSetDevice(state->device), "selecting CUDA device");
+  cudaStream_t stream = state->computeStream;
+  size_t first = labels.size();
+  size_t bytes = numVectors * state->bytesPerVector;
+  std::vector<char> converted(bytes);
+  std::vector<float> squaredNorms(numVectors);
+  bool normalize = space == SpaceType::Cosine;
+  if (options.halfPrecision) {
+    convertVectors(vectors, numVectors, numDimensions, normalize,
+                   (__half *)converted.data(), squaredNorms.data());
+  } else {
+    convertVectors(vectors, numVectors, numDimensions, normalize,
+                   (float *)converted.data(), squaredNorms.data());
+  }
+
+  if (state->resident) {
+    check(cudaMemcpyAsync(state->vectors.data() + first * state->bytesPerVector,
+                          converted.data(), bytes, cudaMemcpyHostToDevice,
+                          stream),
+          "copying vectors to the GPU");
+  } else if (bytes > 0) {
+    std::memcpy(state->hostVectors.data() + first * state->bytesPerVector,
+                converted.data(), bytes);
+  }
+  check(cudaMemcpyAsync(state->vectorNorms.data() + first,
+                        squaredNorms.data(), numVectors * sizeof(float),
+                        cudaMemcpyHostToDevice, stream),
+        "copying vector norms to the GPU");
+  check(cudaMemsetAsync(state->live.data() + first, 1, numVectors, stream),
+        "marking vectors as live");
+  check(cudaStreamSynchronize(stream), "copying vectors to the GPU");
+
+  labels.insert(labels.end(), newLabels, newLabels + numVectors);
+}
+
+void GpuBruteForce::setRemoved(size_t position, bool removed) {
+  if (position >= labels.size()) {
+    throw std::invalid_argument("Cannot remove vector " +
+                                std::to_string(position) + " of " +
+                                std::to_string(labels.size()) + ".");
+  }
+
+  check(cudaSetDevice(state->device), "selecting CUDA device");
+  uint8_t live = removed ? 0 : 1;
+  check(cudaMemcpyAsync(state->live.data() + position, &live, 1,
+                        cudaMemcpyHostToDevice, state->computeStream),
+        "updating the GPU's mask of removed vectors");
+  check(cudaStreamSynchronize(state->computeStream),
+        "updating the GPU's mask of removed vectors");
+}
+
+void GpuBruteForce::search(const float *queries, size_t numQueries, int k,
+                           const uint8_t *allowed,
+                           hnswlib::labeltype *outputLabels,
+                           float *outputDistances, size_t *numResults) {
+  if (k <= 0 || k > MAX_K) {
+    throw std::invalid_argument("GPU queries can find between 1 and " +
+                                std::to_string(MAX_K) + " neighbors, not " +
+                                std::to_string(k) + ".");
+  }
+
+  size_t numVectors = labels.size();
+  if (numVectors == 0) {
+    std::fill(numResults, numResults + numQueries, 0);
+    return;
+  }
+
+  check(cudaSetDevice(state->device), "selecting CUDA device");
+  cudaStream_t stream = state->computeStream;
+  bool half = options.halfPrecision;
+  size_t batchSize = std::min(numQueries, QUERIES_PER_BATCH);
+  size_t tileSize = std::min(numVectors, VECTORS_PER_TILE);
+  state->queries.reserve(batchSize * numDimensions);
+  if (half) {
+    state->halfQueries.reserve(batchSize * numDimensions);
+  }
+  state->queryNorms.reserve(batchSize);
+  state->dots.reserve(batchSize * tileSize);
+  state->nearest.reserve(batchSize * k);
+
+  const uint8_t *deviceAllowed = nullptr;
+  if (allowed) {
+    state->allowed.reserve(numVectors);
+    check(cudaMemcpyAsync(state->allowed.data(), allowed, numVectors,
+                          cudaMemcpyHostToDevice, stream),
+          "copying the filter to the GPU");
+    deviceAllowed = state->allowed.data();
+  }
+
+  bool euclidean = space == SpaceType::Euclidean;
+  int threads = threadsPerQuery(k);
+  size_t sharedMemory = threads * k * sizeof(Candidate);
+  cudaDataType dataType = half ? CUDA_R_16F : CUDA_R_32F;
+  std::vector<float> batchQueries;
+  std::vector<Candidate> nearest(batchSize * k);
+  const float one = 1, zero = 0;
+
+  for (size_t batchStart = 0; batchStart < numQueries;
+       batchStart += batchSize) {
+    size_t batchQueryCount = std::min(batchSize, numQueries - batchStart);
+    batchQueries.assign(queries + batchStart * numDimensions,
+                        queries + (batchStart + batchQueryCount) *
+                                      numDimensions);
+    if (space == SpaceType::Cosine) {
+      for (size_t i = 0; i < batchQueryCount; i++) {
+        float *query = batchQueries.data() + i * numDimensions;
+        float norm = 0;
+        for (int d = 0; d < numDimensions; d++) {
+          norm += query[d] * query[d];
+        }
+        norm = 1.0f / (std::sqrt(norm) + 1e-30f);
+        for (int d = 0; d < numDimensions; d++) {
+          query[d] *= norm;
+        }
+      }
+    }
+    // Copies from pageable memory return once the source has been read, so
+    // batchQueries can be overwritten by the next batch right away:
+    check(cudaMemcpyAsync(state->queries.data(), batchQueries.data(),
+                          batchQueries.size() * sizeof(float),
+                          cudaMemcpyHostToDevice, stream),
+          "copying queries to the GPU");
+
+    // Queries are rounded like the vectors they're compared against:
+    const void *deviceQueries = state->queries.data();
+    if (half) {
+      size_t size = batchQueries.size();
+      convertToHalf<<<(size + 255) / 256, 256, 0, stream>>>(
+          state->queries.data(), size, state->halfQueries.data());
+      check(cudaGetLastError(), "converting queries to 16-bit floats");
+      deviceQueries = state->halfQueries.data();
+    }
+    if (euclidean) {
+      size_t blocks = (batchQueryCount + 255) / 256;
+      if (half) {
+        computeSquaredNorms<<<blocks, 256, 0, stream>>>(
+            state->halfQueries.data(), batchQueryCount, numDimensions,
+            state->queryNorms.data());
+      } else {
+        computeSquaredNorms<<<blocks, 256, 0, stream>>>(
+            state->queries.data(), batchQueryCount, numDimensions,
+            state->queryNorms.data());
+      }
+      check(cudaGetLastError(), "computing query norms");
+    }
+
+    for (size_t tileStart = 0; tileStart < numVectors;
+         tileStart += tileSize) {
+      size_t tileVectorCount = std::min(tileSize, numVectors - tileStart);
+      const char *tileVectors;
+      int buffer = (tileStart / tileSize) % 2;
+      if (state->resident) {
+        tileVectors = state->vectors.data() + tileStart * state->bytesPerVector;
+      } else {
+        // Tiles alternate between two buffers, so that one can be filled
+        // while the other is being read. Before being filled, each waits for
+        // the last multiplication that read it to finish:
+        check(cudaStreamWaitEvent(state->copyStream, state->tileRead[buffer],
+                                  0),
+              "waiting for a tile to be read");
+        check(cudaMemcpyAsync(
+                  state->tiles[buffer].data(),
+                  state->hostVectors.data() +
+                      tileStart * state->bytesPerVector,
+                  tileVectorCount * state->bytesPerVector,
+                  cudaMemcpyHostToDevice, state->copyStream),
+              "copying a tile of vectors to the GPU");
+        check(cudaEventRecord(state->tileCopied[buffer], state->copyStream),
+              "recording a tile copy");
+        check(cudaStreamWaitEvent(stream, state->tileCopied[buffer], 0),
+              "waiting for a tile to be copied");
+        tileVectors = state->tiles[buffer].data();
+      }
+
+      // Vectors and queries are row-major, which cuBLAS sees as column-major
+      // matrices of one vector per column; this leaves the inner products
+      // with each query in a column of `dots`. Products are accumulated in
+      // 32-bit floats, whatever the storage type.
+      check(cublasGemmEx(state->handle, CUBLAS_OP_T, CUBLAS_OP_N,
+                         (int)tileVectorCount, (int)batchQueryCount,
+                         numDimensions, &one, tileVectors, dataType,
+                         numDimensions, deviceQueries, dataType, numDimensions,
+                         &zero, state->dots.data(), CUDA_R_32F,
+                         (int)tileVectorCount, CUBLAS_COMPUTE_32F,
+                         CUBLAS_GEMM_DEFAULT),
+            "computing inner products");
+      if (!state->resident) {
+        check(cudaEventRecord(state->tileRead[buffer], stream),
+              "recording a tile read");
+      }
+
+      selectNearest<<<batchQueryCount, threads, sharedMemory, stream>>>(
+          state->dots.data(), tileStart, tileVectorCount,
+          state->vectorNorms.data(), state->queryNorms.data(),
+          state->live.data(), deviceAllowed, euclidean, k, tileStart == 0,
+          state->nearest.data());
+      check(cudaGetLastError(), "selecting nearest neighbors");
+    }
+
+    check(cudaMemcpyAsync(nearest.data(), state->nearest.data(),
+                          batchQueryCount * k * sizeof(Candidate),
+                          cudaMemcpyDeviceToHost, stream),
+          "copying results from the GPU");
+    check(cudaStreamSynchronize(stream), "searching on the GPU");
+    for (size_t i = 0; i < batchQueryCount; i++) {
+      size_t row = batchStart + i;
+      size_t found = 0;
+      for (int j = 0; j < k && nearest[i * k + j].index != NO_INDEX; j++) {
+        outputLabels[row * k + j] = labels[nearest[i * k + j].index];
+        outputDistances[row * k + j] = nearest[i * k + j].distance;
+        found++;
+      }
+      numResults[row] = found;
+    }
+  }
+}
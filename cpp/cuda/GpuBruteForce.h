@@ -0,0 +1,136 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Enums.h"
+
+namespace hnswlib {
+// As in hnswlib.h, which (unlike this header) can't be included by more than
+// one translation unit of a program.
+typedef size_t labeltype;
+} // namespace hnswlib
+
+/**
+ * How a GpuBruteForce stores the vectors it searches.
+ */
+struct GpuStorageOptions {
+  // Store vectors as 16-bit floats, halving the memory they take (and the
+  // time taken to read them) at the cost of about three significant digits
+  // of precision. Queries are rounded the same way, but inner products are
+  // still accumulated in 32-bit floats.
+  bool halfPrecision = false;
+
+  // The most GPU memory that vectors may take up, in bytes; or if zero, 80%
+  // of the device's free memory when the vectors are first added. If the
+  // vectors don't all fit, they're kept in pinned host memory instead, and
+  // copied to the GPU one tile at a time for each batch of queries.
+  size_t maxDeviceMemory = 0;
+};
+
+/**
+ * Exact k-nearest-neighbor search over a copy of an index's vectors held in
+ * GPU memory. Distances are computed for a whole batch of queries at a time
+ * as one matrix multiplication, after which each query keeps its `k`
+ * nearest elements.
+ *
+ * Distances match those of the CPU index (squared Euclidean distance, or one
+ * minus the inner product), up to floating-point rounding (and to the
+ * precision of 16-bit floats, if vectors are stored as such).
+ *
+ * This header doesn't depend on CUDA; the implementation (GpuBruteForce.cu)
+ * is only built as part of the optional VoyagerCuda target.
+ */
+class GpuBruteForce {
+public:
+  // The most neighbors that can be found per query; each query's candidates
+  // are merged in shared memory, which limits how many it can keep.
+  static constexpr int MAX_K = 192;
+
+  /**
+   * Use the given CUDA device, which must support compute capability 7.0 or
+   * higher. Throws a std::runtime_error if no such device is available.
+   */
+  GpuBruteForce(SpaceType space, int numDimensions, int device = 0,
+                const GpuStorageOptions &options = {});
+  ~GpuBruteForce();
+
+  GpuBruteForce(const GpuBruteForce &) = delete;
+  GpuBruteForce &operator=(const GpuBruteForce &) = delete;
+
+  /**
+   * Remove every vector, and allocate GPU memory for up to `capacity`
+   * vectors to be added with addVectors.
+   */
+  void reset(size_t capacity);
+
+  /**
+   * Copy the `numVectors` row-major vectors at `vectors` to the GPU, after
+   * any vectors already added. Cosine vectors are normalized first.
+   */
+  void addVectors(const float *vectors, const hnswlib::labeltype *labels,
+                  size_t numVectors);
+
+  /**
+   * Exclude the vector at `position` (in the order vectors were added) from
+   * every search, or include it again, by updating a mask held on the GPU.
+   */
+  void setRemoved(size_t position, bool removed);
+
+  size_t size() const { return labels.size(); }
+
+  /**
+   * Whether every vector is held in GPU memory, rather than being copied
+   * there from host memory for each batch of queries.
+   */
+  bool isResident() const;
+
+  /**
+   * The labels of the vectors added so far, in the order they were added.
+   */
+  const std::vector<hnswlib::labeltype> &getLabels() const { return labels; }
+
+  /**
+   * Find the `k` nearest vectors to each of the `numQueries` row-major
+   * queries, nearest first, considering only vectors `i` for which
+   * `allowed[i]` is non-zero (or every vector, if `allowed` is null). Writes
+   * the number of neighbors found for each query into `numResults`; the rest
+   * of that query's results are left unchanged.
+   *
+   * Calls to any method of this class must not overlap.
+   */
+  void search(const float *queries, size_t numQueries, int k,
+              const uint8_t *allowed, hnswlib::labeltype *labels,
+              float *distances, size_t *numResults);
+
+private:
+  struct DeviceState;
+
+  SpaceType space;
+  int numDimensions;
+  GpuStorageOptions options;
+  std::vector<hnswlib::labeltype> labels;
+  std::unique_ptr<DeviceState> state;
+};
@@ -0,0 +1,612 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GpuBruteForce.h"
+#include "Index.h"
+#include "TypedIndex.h"
+#include "index_utils.h"
+#include "stats.h"
+
+/**
+ * An Index whose brute-force queries run on a CUDA device, for bulk jobs
+ * (i.e.: querying every element of a large index against the rest) that
+ * are better served by exact search on a GPU than by searching the graph.
+ *
+ * Wraps a regular (CPU) index, which is loaded from the usual index format
+ * and handles every other operation, including graph queries. The first
+ * brute-force query copies the index's vectors to the GPU, where they're
+ * kept until the index changes. Deleting elements only updates a mask on the
+ * GPU; other changes copy every vector again before the next query.
+ *
+ * Results match the CPU index's bruteForceQuery for Float32 indices, up to
+ * floating-point rounding of the distances. For other storage data types, the
+ * GPU compares unquantized queries against the vectors returned by getVector
+ * (i.e.: full-precision vectors, if stored), so distances differ from the CPU
+ * index's by up to the precision of the storage data type. The GPU can also
+ * store vectors in half precision, or stream them from host memory if they
+ * don't fit on the device (see GpuStorageOptions).
+ *
+ * Brute-force queries fall back to the CPU index for product-quantized
+ * indices, whose distances are computed from compressed codes, and for more
+ * than GpuBruteForce::MAX_K neighbors.
+ */
+class GpuIndex : public Index {
+public:
+  /**
+   * Run brute-force queries against `index` on the given CUDA device. The
+   * index must not be search-only, as its vectors are read to copy them to
+   * the GPU.
+   */
+  GpuIndex(std::shared_ptr<Index> index, int device = 0,
+           const GpuStorageOptions &options = {})
+      : index(index), gpu(checkIndex(index)->getSpace(),
+                          index->getNumDimensions(), device, options) {}
+
+  std::shared_ptr<Index> getIndex() const { return index; }
+
+  void setEF(size_t ef) { index->setEF(ef); }
+  int getEF() const { return index->getEF(); }
+
+  void setPrefetchDepth(size_t depth) { index->setPrefetchDepth(depth); }
+  size_t getPrefetchDepth() const { return index->getPrefetchDepth(); }
+
+  void setEarlyTerminationPatience(size_t patience) {
+    index->setEarlyTerminationPatience(patience);
+  }
+
+  size_t getEarlyTerminationPatience() const {
+    return index->getEarlyTerminationPatience();
+  }
+
+  size_t calibrateEarlyTermination(NDArray<float, 2> queryVectors, int k,
+                                   float targetRecall, long queryEf = -1,
+                                   int numThreads = -1) {
+    return IndexUtils::calibrateEarlyTermination(*this, queryVectors, k,
+                                                 targetRecall, queryEf,
+                                                 numThreads);
+  }
+
+  SpaceType getSpace() const { return index->getSpace(); }
+  std::string getSpaceName() const { return index->getSpaceName(); }
+
+  StorageDataType getStorageDataType() const {
+    return index->getStorageDataType();
+  }
+
+  std::string getStorageDataTypeName() const {
+    return index->getStorageDataTypeName();
+  }
+
+  int getNumDimensions() const { return index->getNumDimensions(); }
+
+  void setNumThreads(int numThreads) { index->setNumThreads(numThreads); }
+  int getNumThreads() { return index->getNumThreads(); }
+
+  void setThreadPool(std::shared_ptr<ThreadPool> threadPool) {
+    index->setThreadPool(threadPool);
+  }
+
+  std::shared_ptr<ThreadPool> getThreadPool() {
+    return index->getThreadPool();
+  }
+
+  void saveIndex(const std::string &pathToIndex) {
+    index->saveIndex(pathToIndex);
+  }
+
+  void saveIndex(std::shared_ptr<OutputStream> outputStream) {
+    index->saveIndex(outputStream);
+  }
+
+  void saveCompressedIndex(const std::string &pathToIndex,
+                           int compressionLevel = DEFAULT_COMPRESSION_LEVEL) {
+    saveCompressedIndex(std::make_shared<FileOutputStream>(pathToIndex),
+                        compressionLevel);
+  }
+
+  void saveCompressedIndex(std::shared_ptr<OutputStream> outputStream,
+                           int compressionLevel = DEFAULT_COMPRESSION_LEVEL) {
+    IndexUtils::saveCompressedIndex(*this, outputStream, compressionLevel);
+  }
+
+  void loadIndex(const std::string &pathToIndex, bool searchOnly = false) {
+    checkNotSearchOnly(searchOnly);
+    index->loadIndex(pathToIndex);
+    changed = true;
+  }
+
+  void loadIndex(std::shared_ptr<InputStream> inputStream,
+                 bool searchOnly = false) {
+    checkNotSearchOnly(searchOnly);
+    index->loadIndex(inputStream);
+    changed = true;
+  }
+
+  void saveDelta(const std::string &pathToDelta) {
+    index->saveDelta(pathToDelta);
+  }
+
+  void saveDelta(std::shared_ptr<OutputStream> outputStream) {
+    index->saveDelta(outputStream);
+  }
+
+  void applyDelta(const std::string &pathToDelta) {
+    index->applyDelta(pathToDelta);
+    changed = true;
+  }
+
+  void applyDelta(std::shared_ptr<InputStream> inputStream) {
+    index->applyDelta(inputStream);
+    changed = true;
+  }
+
+  float getDistance(std::vector<float> a, std::vector<float> b) {
+    return index->getDistance(a, b);
+  }
+
+  NDArray<float, 2> getDistances(NDArray<float, 2> queries,
+                                 NDArray<float, 2> targets,
+                                 int numThreads = -1) {
+    return index->getDistances(queries, targets, numThreads);
+  }
+
+  hnswlib::labeltype addItem(const std::vector<float> &vector,
+                             std::optional<hnswlib::labeltype> id) {
+    hnswlib::labeltype label = index->addItem(vector, id);
+    changed = true;
+    return label;
+  }
+
+  hnswlib::labeltype addItem(const float *vector, size_t numDimensions,
+                             std::optional<hnswlib::labeltype> id) {
+    hnswlib::labeltype label = index->addItem(vector, numDimensions, id);
+    changed = true;
+    return label;
+  }
+
+  std::vector<hnswlib::labeltype>
+  addItems(std::vector<std::vector<float>> input,
+           std::vector<hnswlib::labeltype> ids = {}, int numThreads = -1) {
+    std::vector<hnswlib::labeltype> labels =
+        index->addItems(input, ids, numThreads);
+    changed = true;
+    return labels;
+  }
+
+  std::vector<hnswlib::labeltype>
+  addItems(NDArray<float, 2> input, std::vector<hnswlib::labeltype> ids = {},
+           int numThreads = -1) {
+    std::vector<hnswlib::labeltype> labels =
+        index->addItems(input, ids, numThreads);
+    changed = true;
+    return labels;
+  }
+
+  std::vector<hnswlib::labeltype>
+  bulkAddItems(NDArray<float, 2> input,
+               std::vector<hnswlib::labeltype> ids = {}, int numThreads = -1) {
+    std::vector<hnswlib::labeltype> labels =
+        index->bulkAddItems(input, ids, numThreads);
+    changed = true;
+    return labels;
+  }
+
+  std::vector<float> getVector(hnswlib::labeltype id) {
+    return index->getVector(id);
+  }
+
+  NDArray<float, 2> getVectors(std::vector<hnswlib::labeltype> ids) {
+    return index->getVectors(ids);
+  }
+
+  size_t getVectorsInto(const hnswlib::labeltype *ids, size_t numIds,
+                        float *output, hnswlib::labeltype *copiedIds) {
+    return index->getVectorsInto(ids, numIds, output, copiedIds);
+  }
+
+  std::vector<hnswlib::labeltype> getIDs() const { return index->getIDs(); }
+
+  long long getIDsCount() const { return index->getIDsCount(); }
+
+  const std::unordered_map<hnswlib::labeltype, hnswlib::tableint> &
+  getIDsMap() const {
+    return index->getIDsMap();
+  }
+
+  void setStoreFullPrecisionVectors(bool enabled) {
+    index->setStoreFullPrecisionVectors(enabled);
+  }
+
+  bool getStoreFullPrecisionVectors() const {
+    return index->getStoreFullPrecisionVectors();
+  }
+
+  void saveFullPrecisionVectors(const std::string &path) {
+    index->saveFullPrecisionVectors(path);
+  }
+
+  void saveFullPrecisionVectors(std::shared_ptr<OutputStream> outputStream) {
+    index->saveFullPrecisionVectors(outputStream);
+  }
+
+  // Full-precision vectors take the place of the index's own vectors (see
+  // Index::getVector), so the GPU's copy has to be updated:
+  void loadFullPrecisionVectors(const std::string &path,
+                                bool memoryMap = false) {
+    index->loadFullPrecisionVectors(path, memoryMap);
+    changed = true;
+  }
+
+  void loadFullPrecisionVectors(std::shared_ptr<InputStream> inputStream,
+                                bool memoryMap = false) {
+    index->loadFullPrecisionVectors(inputStream, memoryMap);
+    changed = true;
+  }
+
+  std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+  query(const std::vector<float> &queryVector, int k = 1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    return index->query(queryVector, k, queryEf, filter, rerankK);
+  }
+
+  void query(const float *queryVector, size_t numDimensions, int k,
+             hnswlib::labeltype *labels, float *distances, long queryEf = -1,
+             const hnswlib::BaseFilterFunctor *filter = nullptr,
+             size_t rerankK = 0) {
+    index->query(queryVector, numDimensions, k, labels, distances, queryEf,
+                 filter, rerankK);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  query(std::vector<std::vector<float>> queryVectors, int k = 1,
+        int numThreads = -1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    return index->query(queryVectors, k, numThreads, queryEf, filter,
+                        rerankK);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  query(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
+        long queryEf = -1, const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    return index->query(queryVectors, k, numThreads, queryEf, filter,
+                        rerankK);
+  }
+
+  void queryInto(const float *queryVectors, size_t numQueries, int k,
+                 hnswlib::labeltype *labels, float *distances,
+                 int numThreads = -1, long queryEf = -1,
+                 const hnswlib::BaseFilterFunctor *filter = nullptr,
+                 size_t rerankK = 0, size_t *numResults = nullptr,
+                 long queryPatience = -1) {
+    index->queryInto(queryVectors, numQueries, k, labels, distances,
+                     numThreads, queryEf, filter, rerankK, numResults,
+                     queryPatience);
+  }
+
+  std::future<std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>>
+  queryAsync(std::vector<float> queryVector, int k = 1, long queryEf = -1,
+             size_t rerankK = 0) {
+    return index->queryAsync(std::move(queryVector), k, queryEf, rerankK);
+  }
+
+  void queryAsync(std::vector<float> queryVector, QueryCallback callback,
+                  int k = 1, long queryEf = -1, size_t rerankK = 0) {
+    index->queryAsync(std::move(queryVector), std::move(callback), k, queryEf,
+                      rerankK);
+  }
+
+  void setAsyncBatchWindow(std::chrono::microseconds window) {
+    index->setAsyncBatchWindow(window);
+  }
+
+  std::chrono::microseconds getAsyncBatchWindow() const {
+    return index->getAsyncBatchWindow();
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  bruteForceQuery(NDArray<float, 2> queryVectors, int k = 1,
+                  int numThreads = -1,
+                  const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    int numRows = std::get<0>(queryVectors.shape);
+    if (std::get<1>(queryVectors.shape) != getNumDimensions()) {
+      throw std::runtime_error(
+          "Query vectors expected to share dimensionality with index.");
+    }
+
+    NDArray<hnswlib::labeltype, 2> labels({numRows, k});
+    NDArray<float, 2> distances({numRows, k});
+    bruteForceQueryInto(queryVectors.data.data(), numRows, k,
+                        labels.data.data(), distances.data.data(), numThreads,
+                        filter);
+    return {labels, distances};
+  }
+
+  /**
+   * As Index::bruteForceQueryInto, but run on the GPU where supported.
+   * `numThreads` is only used if the query falls back to the CPU index.
+   * Queries on the GPU run one batch at a time.
+   */
+  void bruteForceQueryInto(const float *queryVectors, size_t numQueries,
+                           int k, hnswlib::labeltype *labels, float *distances,
+                           int numThreads = -1,
+                           const hnswlib::BaseFilterFunctor *filter = nullptr,
+                           size_t *numResults = nullptr) {
+    if (getStorageDataType() == StorageDataType::PQ ||
+        k > GpuBruteForce::MAX_K) {
+      index->bruteForceQueryInto(queryVectors, numQueries, k, labels,
+                                 distances, numThreads, filter, numResults);
+      return;
+    }
+    if (k <= 0) {
+      throw std::invalid_argument("k must be positive.");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<size_t> numFound(numQueries);
+    {
+      std::unique_lock<std::mutex> lock(gpuLock);
+      copyVectorsToGpuIfChanged();
+
+      std::vector<uint8_t> allowed;
+      if (filter) {
+        const std::vector<hnswlib::labeltype> &gpuLabels = gpu.getLabels();
+        allowed.resize(gpuLabels.size());
+        for (size_t i = 0; i < gpuLabels.size(); i++) {
+          allowed[i] = (*filter)(gpuLabels[i]);
+        }
+      }
+      gpu.search(queryVectors, numQueries, k, filter ? allowed.data() : nullptr,
+                 labels, distances, numFound.data());
+    }
+
+    for (size_t i = 0; i < numQueries; i++) {
+      if (numResults) {
+        numResults[i] = numFound[i];
+      } else {
+        checkNumBruteForceResults(numFound[i], k);
+      }
+    }
+    stats.recordQueries(numQueries, hnswlib::nanosecondsSince(start));
+  }
+
+  void setGroups(const std::vector<hnswlib::labeltype> &ids,
+                 const std::vector<hnswlib::labeltype> &groups) {
+    index->setGroups(ids, groups);
+  }
+
+  hnswlib::labeltype getGroup(hnswlib::labeltype id) {
+    return index->getGroup(id);
+  }
+
+  void groupedQueryInto(const float *queryVectors, size_t numQueries, int k,
+                        hnswlib::labeltype *labels, float *distances,
+                        int numThreads = -1, long queryEf = -1,
+                        const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    index->groupedQueryInto(queryVectors, numQueries, k, labels, distances,
+                            numThreads, queryEf, filter);
+  }
+
+  std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+  groupedQuery(const std::vector<float> &queryVector, int k = 1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return IndexUtils::groupedQuery(*this, queryVector, k, queryEf, filter);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  groupedQuery(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return IndexUtils::groupedQuery(*this, queryVectors, k, numThreads,
+                                    queryEf, filter);
+  }
+
+  void markDeleted(hnswlib::labeltype label) {
+    index->markDeleted(label);
+    std::unique_lock<std::mutex> lock(gpuLock);
+    setRemovedOnGpu(label, true);
+  }
+
+  void unmarkDeleted(hnswlib::labeltype label) {
+    index->unmarkDeleted(label);
+    std::unique_lock<std::mutex> lock(gpuLock);
+    // Elements that were deleted when the vectors were copied aren't on the
+    // GPU at all, so have to be copied along with the rest:
+    if (!setRemovedOnGpu(label, false)) {
+      changed = true;
+    }
+  }
+
+  void resizeIndex(size_t newSize) { index->resizeIndex(newSize); }
+
+  void optimizeLayout() { index->optimizeLayout(); }
+
+  size_t compact() {
+    size_t removed = index->compact();
+    changed = true;
+    return removed;
+  }
+
+  /**
+   * Pack the CPU index for serving (see Index::packForSearch). As a packed
+   * index's vectors can no longer be read, they're copied to the GPU first.
+   */
+  void packForSearch() {
+    std::unique_lock<std::mutex> lock(gpuLock);
+    copyVectorsToGpuIfChanged();
+    index->packForSearch();
+  }
+
+  void savePackedIndex(const std::string &pathToIndex) {
+    index->savePackedIndex(pathToIndex);
+  }
+
+  void savePackedIndex(std::shared_ptr<OutputStream> outputStream) {
+    index->savePackedIndex(outputStream);
+  }
+
+  hnswlib::IndexStats getStats() const {
+    hnswlib::IndexStats total = index->getStats();
+    total += stats.getStats();
+    return total;
+  }
+
+  void resetStats() {
+    index->resetStats();
+    stats.reset();
+  }
+
+  void setQueryCacheSize(size_t maxEntries) {
+    index->setQueryCacheSize(maxEntries);
+  }
+
+  size_t getQueryCacheSize() const { return index->getQueryCacheSize(); }
+
+  size_t getMaxElements() const { return index->getMaxElements(); }
+  size_t getNumElements() const { return index->getNumElements(); }
+  size_t getEfConstruction() const { return index->getEfConstruction(); }
+  size_t getM() const { return index->getM(); }
+
+private:
+  // The number of vectors gathered from the CPU index per copy to the GPU:
+  static constexpr size_t VECTORS_PER_COPY = 1 << 16;
+
+  std::shared_ptr<Index> index;
+
+  // Held while copying vectors to (or searching) the GPU:
+  std::mutex gpuLock;
+  GpuBruteForce gpu;
+  // Set whenever the CPU index might have changed since it was copied:
+  std::atomic<bool> changed{true};
+  // The position of each element's vector on the GPU, as of the last copy:
+  std::unordered_map<hnswlib::labeltype, size_t> gpuPositions;
+
+  // Counts only the queries run on the GPU; the rest are counted by `index`.
+  hnswlib::StatsCollector stats;
+
+  static Index *checkIndex(const std::shared_ptr<Index> &index) {
+    if (!index) {
+      throw std::invalid_argument("An index must be provided.");
+    }
+    return index.get();
+  }
+
+  static void checkNotSearchOnly(bool searchOnly) {
+    if (searchOnly) {
+      throw std::invalid_argument(
+          "GPU indices cannot be loaded in search-only mode, as their vectors "
+          "have to be read to copy them to the GPU.");
+    }
+  }
+
+  /**
+   * Mask out (or back in) the GPU's copy of an element's vector, if the GPU
+   * holds an up-to-date copy of it. Returns false only if the GPU's copy of
+   * the index is up to date, but doesn't include this element. Must hold
+   * gpuLock.
+   */
+  bool setRemovedOnGpu(hnswlib::labeltype label, bool removed) {
+    if (changed) {
+      // Every vector will be copied again before the next query anyway.
+      return true;
+    }
+    auto position = gpuPositions.find(label);
+    if (position == gpuPositions.end()) {
+      return false;
+    }
+    try {
+      gpu.setRemoved(position->second, removed);
+    } catch (...) {
+      changed = true;
+      throw;
+    }
+    return true;
+  }
+
+  /**
+   * Copy every element of the CPU index that isn't deleted to the GPU, if
+   * the index has changed since it was last copied. Must hold gpuLock.
+   */
+  void copyVectorsToGpuIfChanged() {
+    if (!changed.exchange(false)) {
+      return;
+    }
+
+    try {
+      std::vector<hnswlib::labeltype> ids = index->getIDs();
+      gpu.reset(ids.size());
+      gpuPositions.clear();
+      gpuPositions.reserve(ids.size());
+
+      // Vectors are gathered a chunk at a time into the same buffers; deleted
+      // elements are skipped, as they're never returned anyway.
+      size_t chunkSize = std::min(ids.size(), VECTORS_PER_COPY);
+      std::vector<hnswlib::labeltype> chunkLabels(chunkSize);
+      std::vector<float> chunkVectors(chunkSize * getNumDimensions());
+      for (size_t start = 0; start < ids.size(); start += chunkSize) {
+        size_t numCopied = index->getVectorsInto(
+            ids.data() + start, std::min(chunkSize, ids.size() - start),
+            chunkVectors.data(), chunkLabels.data());
+        for (size_t i = 0; i < numCopied; i++) {
+          gpuPositions[chunkLabels[i]] = gpu.size() + i;
+        }
+        gpu.addVectors(chunkVectors.data(), chunkLabels.data(), numCopied);
+      }
+    } catch (...) {
+      changed = true;
+      gpuPositions.clear();
+      throw;
+    }
+  }
+};
+
+/**
+ * Load an index from the usual index format (including its metadata) and run
+ * its brute-force queries on the given CUDA device.
+ */
+std::unique_ptr<GpuIndex>
+loadGpuIndexFromStream(std::shared_ptr<InputStream> inputStream,
+                       int device = 0, const GpuStorageOptions &options = {}) {
+  return std::make_unique<GpuIndex>(loadTypedIndexFromStream(inputStream),
+                                    device, options);
+}
+
+std::unique_ptr<GpuIndex> loadGpuIndex(const std::string &pathToIndex,
+                                       int device = 0,
+                                       const GpuStorageOptions &options = {}) {
+  return loadGpuIndexFromStream(std::make_shared<FileInputStream>(pathToIndex),
+                                device, options);
+}
@@ -0,0 +1,147 @@
+#include "doctest.h"
+
+#include "GpuIndex.h"
+#include "TypedIndex.h"
+#include "test_utils.cpp"
+
+// Compare a GPU index's brute-force results against its CPU index's, allowing
+// for the rounding of distances computed by matrix multiplication.
+void requireSameResults(GpuIndex &index, NDArray<float, 2> queries, int k,
+                        const hnswlib::BaseFilterFunctor *filter = nullptr,
+                        double epsilon = 1e-3) {
+  auto expectedDistances = std::get<1>(
+      index.getIndex()->bruteForceQuery(queries, k, -1, filter));
+  auto distances = std::get<1>(index.bruteForceQuery(queries, k, -1, filter));
+
+  int numQueries = std::get<0>(queries.shape);
+  for (int q = 0; q < numQueries; q++) {
+    for (int i = 0; i < k; i++) {
+      REQUIRE(distances[q][i] ==
+              doctest::Approx(expectedDistances[q][i]).epsilon(epsilon));
+    }
+  }
+}
+
+TEST_CASE("Test GPU brute-force queries match the CPU index") {
+  int numDimensions = 32;
+  int numVectors = 5000;
+  int k = 10;
+  NDArray<float, 2> input =
+      vectorsToNDArray(randomVectors(numVectors, numDimensions));
+
+  for (auto spaceType :
+       {SpaceType::Euclidean, SpaceType::InnerProduct, SpaceType::Cosine}) {
+    CAPTURE(spaceType);
+    auto cpuIndex = std::make_shared<TypedIndex<float>>(spaceType,
+                                                        numDimensions);
+    cpuIndex->addItems(input);
+    GpuIndex index(cpuIndex);
+
+    requireSameResults(index, input, k);
+    if (spaceType != SpaceType::InnerProduct) {
+      // Every element is its own nearest neighbor:
+      auto labels = std::get<0>(index.bruteForceQuery(input, k));
+      for (int i = 0; i < numVectors; i++) {
+        REQUIRE(labels[i][0] == (hnswlib::labeltype)i);
+      }
+    }
+
+    // Changes to the index are copied to the GPU before the next query:
+    index.markDeleted(0);
+    auto labels = std::get<0>(index.bruteForceQuery(input, 1));
+    REQUIRE(labels[0][0] != 0);
+    requireSameResults(index, input, k);
+
+    index.unmarkDeleted(0);
+    requireSameResults(index, input, k);
+    index.markDeleted(0);
+
+    std::vector<hnswlib::labeltype> allowedIds = {1, 2, 3};
+    hnswlib::AllowListFilter filter(allowedIds);
+    requireSameResults(index, input, 2, &filter);
+    REQUIRE_THROWS_AS(index.bruteForceQuery(input, 4, -1, &filter),
+                      RecallError);
+
+    // Too many neighbors for the GPU are found by the CPU index instead:
+    requireSameResults(index, input, GpuBruteForce::MAX_K + 1);
+  }
+}
+
+TEST_CASE("Test GPU indices load the CPU index format") {
+  int numDimensions = 16;
+  int numVectors = 1000;
+  NDArray<float, 2> input =
+      vectorsToNDArray(randomQuantizedVectors(numVectors, numDimensions));
+
+  SUBCASE("Float32") {
+    auto cpuIndex = std::make_shared<TypedIndex<float>>(SpaceType::Euclidean,
+                                                        numDimensions);
+    cpuIndex->addItems(input);
+    auto outputStream = std::make_shared<MemoryOutputStream>();
+    cpuIndex->saveIndex(outputStream);
+
+    std::unique_ptr<GpuIndex> index = loadGpuIndexFromStream(
+        std::make_shared<MemoryInputStream>(outputStream->getValue()));
+    REQUIRE(index->getNumElements() == (size_t)numVectors);
+    requireSameResults(*index, input, 5);
+
+    REQUIRE_THROWS_AS(index->loadIndex(std::make_shared<MemoryInputStream>(
+                                           outputStream->getValue()),
+                                       /* searchOnly= */ true),
+                      std::invalid_argument);
+  }
+
+  SUBCASE("E4M3") {
+    auto cpuIndex = std::make_shared<TypedIndex<float, E4M3>>(
+        SpaceType::Euclidean, numDimensions);
+    cpuIndex->addItems(input);
+    auto outputStream = std::make_shared<MemoryOutputStream>();
+    cpuIndex->saveIndex(outputStream);
+
+    std::unique_ptr<GpuIndex> index = loadGpuIndexFromStream(
+        std::make_shared<MemoryInputStream>(outputStream->getValue()));
+    REQUIRE(index->getStorageDataType() == StorageDataType::E4M3);
+    auto labels = std::get<0>(index->bruteForceQuery(input, 1));
+    for (int i = 0; i < numVectors; i++) {
+      REQUIRE(labels[i][0] == (hnswlib::labeltype)i);
+    }
+  }
+}
+
+TEST_CASE("Test GPU storage options") {
+  int numDimensions = 32;
+  int numVectors = 3000;
+  int k = 10;
+  NDArray<float, 2> input =
+      vectorsToNDArray(randomVectors(numVectors, numDimensions));
+
+  for (auto spaceType : {SpaceType::Euclidean, SpaceType::Cosine}) {
+    CAPTURE(spaceType);
+    auto cpuIndex = std::make_shared<TypedIndex<float>>(spaceType,
+                                                        numDimensions);
+    cpuIndex->addItems(input);
+
+    SUBCASE("Half precision") {
+      GpuStorageOptions options;
+      options.halfPrecision = true;
+      GpuIndex index(cpuIndex, 0, options);
+      // Half-precision vectors only have 11 significant bits:
+      requireSameResults(index, input, k, nullptr, 1e-2);
+    }
+
+    SUBCASE("Streamed from host memory") {
+      GpuStorageOptions options;
+      options.maxDeviceMemory = 1;
+      GpuIndex index(cpuIndex, 0, options);
+      requireSameResults(index, input, k);
+
+      // Deletions only update the mask, wherever the vectors are stored:
+      index.markDeleted(1);
+      auto labels = std::get<0>(index.bruteForceQuery(input, 1));
+      REQUIRE(labels[1][0] != 1);
+      requireSameResults(index, input, k);
+      index.unmarkDeleted(1);
+      requireSameResults(index, input, k);
+    }
+  }
+}
@@ -0,0 +1,323 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "Index.h"
+
+/**
+ * Runs an index's asynchronous queries (see Index::queryAsync) on the index's
+ * thread pool, grouping queries that arrive close together into batches so
+ * that they can share a single traversal of the graph's upper layers.
+ *
+ * Each batch collects queries with the same parameters until it holds
+ * `maxBatchSize` queries, or until the first query in it has waited for the
+ * batching window, whichever comes first. A window of zero runs every query
+ * as soon as it is submitted.
+ *
+ * Must be destroyed before the index it queries: its destructor runs (and
+ * waits for) every query that has already been submitted.
+ */
+class AsyncQueryBatcher {
+public:
+  static constexpr size_t DEFAULT_MAX_BATCH_SIZE = 32;
+
+  explicit AsyncQueryBatcher(Index &index) : index(index) {}
+  AsyncQueryBatcher(const AsyncQueryBatcher &) = delete;
+  AsyncQueryBatcher &operator=(const AsyncQueryBatcher &) = delete;
+
+  ~AsyncQueryBatcher() {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wakeDispatcher.notify_all();
+    if (dispatcher.joinable()) {
+      dispatcher.join();
+    }
+
+    std::vector<std::unique_ptr<Batch>> remaining;
+    std::unique_lock<std::mutex> lock(mutex);
+    remaining.swap(openBatches);
+    lock.unlock();
+    for (auto &batch : remaining) {
+      dispatch(std::move(batch));
+    }
+
+    lock.lock();
+    batchFinished.wait(lock, [&] { return batchesInFlight == 0; });
+  }
+
+  void setWindow(std::chrono::microseconds newWindow) {
+    std::unique_lock<std::mutex> lock(mutex);
+    window = std::max(newWindow, std::chrono::microseconds(0));
+  }
+
+  std::chrono::microseconds getWindow() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return window;
+  }
+
+  void setMaxBatchSize(size_t newMaxBatchSize) {
+    std::unique_lock<std::mutex> lock(mutex);
+    maxBatchSize = std::max<size_t>(newMaxBatchSize, 1);
+  }
+
+  size_t getMaxBatchSize() const {
+    std::unique_lock<std::mutex> lock(mutex);
+    return maxBatchSize;
+  }
+
+  std::future<std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>>
+  submit(std::vector<float> queryVector, int k, long queryEf, size_t rerankK) {
+    auto promise = std::make_shared<std::promise<
+        std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>>>();
+    auto future = promise->get_future();
+    submit(
+        std::move(queryVector),
+        [promise](std::vector<hnswlib::labeltype> labels,
+                  std::vector<float> distances, std::exception_ptr error) {
+          if (error) {
+            promise->set_exception(error);
+          } else {
+            promise->set_value({std::move(labels), std::move(distances)});
+          }
+        },
+        k, queryEf, rerankK);
+    return future;
+  }
+
+  /**
+   * Queue a query, whose results (or error) will be passed to `callback` on
+   * one of the index's worker threads. Throws immediately if the query has
+   * the wrong number of dimensions. Exceptions thrown by `callback` itself
+   * are ignored.
+   */
+  void submit(std::vector<float> queryVector, Index::QueryCallback callback,
+              int k, long queryEf, size_t rerankK) {
+    if ((int)queryVector.size() != index.getNumDimensions()) {
+      throw std::runtime_error(
+          "Query vector expected to share dimensionality with index.");
+    }
+    if (k <= 0) {
+      throw std::invalid_argument("k must be positive.");
+    }
+
+    std::unique_ptr<Batch> fullBatch;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (stopping) {
+        throw std::runtime_error("This index is being destroyed.");
+      }
+
+      Batch *batch = nullptr;
+      for (auto &candidate : openBatches) {
+        if (candidate->k == k && candidate->queryEf == queryEf &&
+            candidate->rerankK == rerankK) {
+          batch = candidate.get();
+          break;
+        }
+      }
+      if (!batch) {
+        openBatches.push_back(std::make_unique<Batch>());
+        batch = openBatches.back().get();
+        batch->k = k;
+        batch->queryEf = queryEf;
+        batch->rerankK = rerankK;
+        batch->deadline = std::chrono::steady_clock::now() + window;
+        if (window.count() > 0) {
+          if (!dispatcher.joinable()) {
+            dispatcher = std::thread([this] { dispatchLoop(); });
+          }
+          wakeDispatcher.notify_one();
+        }
+      }
+      batch->requests.push_back({std::move(queryVector), std::move(callback)});
+
+      if (batch->requests.size() >= maxBatchSize || window.count() == 0) {
+        fullBatch = takeBatchLocked(batch);
+      }
+    }
+
+    if (fullBatch) {
+      dispatch(std::move(fullBatch));
+    }
+  }
+
+private:
+  struct Request {
+    std::vector<float> queryVector;
+    Index::QueryCallback callback;
+  };
+
+  struct Batch {
+    int k;
+    long queryEf;
+    size_t rerankK;
+    std::chrono::steady_clock::time_point deadline;
+    std::vector<Request> requests;
+  };
+
+  Index &index;
+
+  mutable std::mutex mutex;
+  std::condition_variable wakeDispatcher;
+  std::condition_variable batchFinished;
+  std::chrono::microseconds window{100};
+  size_t maxBatchSize = DEFAULT_MAX_BATCH_SIZE;
+  std::vector<std::unique_ptr<Batch>> openBatches;
+  size_t batchesInFlight = 0;
+  bool stopping = false;
+  // Started on demand, as only batches with a non-zero window need it:
+  std::thread dispatcher;
+
+  std::unique_ptr<Batch> takeBatchLocked(Batch *batch) {
+    auto position = std::find_if(
+        openBatches.begin(), openBatches.end(),
+        [&](const std::unique_ptr<Batch> &open) { return open.get() == batch; });
+    std::unique_ptr<Batch> taken = std::move(*position);
+    openBatches.erase(position);
+    return taken;
+  }
+
+  /**
+   * Dispatch each open batch once its window has passed.
+   */
+  void dispatchLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+      if (openBatches.empty()) {
+        wakeDispatcher.wait(lock);
+        continue;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      auto nextDeadline = std::chrono::steady_clock::time_point::max();
+      std::vector<std::unique_ptr<Batch>> due;
+      for (size_t i = 0; i < openBatches.size();) {
+        if (openBatches[i]->deadline <= now) {
+          due.push_back(std::move(openBatches[i]));
+          openBatches.erase(openBatches.begin() + i);
+        } else {
+          nextDeadline = std::min(nextDeadline, openBatches[i]->deadline);
+          i++;
+        }
+      }
+
+      if (due.empty()) {
+        wakeDispatcher.wait_until(lock, nextDeadline);
+        continue;
+      }
+
+      lock.unlock();
+      for (auto &batch : due) {
+        dispatch(std::move(batch));
+      }
+      lock.lock();
+    }
+  }
+
+  void dispatch(std::unique_ptr<Batch> batch) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      batchesInFlight++;
+    }
+
+    // std::function must be copyable, so the batch is shared with the job:
+    std::shared_ptr<Batch> shared(std::move(batch));
+    index.getThreadPool()->submit([this, shared] {
+      run(*shared);
+
+      std::unique_lock<std::mutex> lock(mutex);
+      batchesInFlight--;
+      batchFinished.notify_all();
+    });
+  }
+
+  static void invoke(Index::QueryCallback &callback,
+                     std::vector<hnswlib::labeltype> labels,
+                     std::vector<float> distances, std::exception_ptr error) {
+    try {
+      callback(std::move(labels), std::move(distances), error);
+    } catch (...) {
+    }
+  }
+
+  void run(Batch &batch) {
+    size_t numQueries = batch.requests.size();
+    int numDimensions = index.getNumDimensions();
+    int k = batch.k;
+
+    std::vector<float> queries(numQueries * numDimensions);
+    for (size_t i = 0; i < numQueries; i++) {
+      std::copy(batch.requests[i].queryVector.begin(),
+                batch.requests[i].queryVector.end(),
+                queries.begin() + (i * numDimensions));
+    }
+
+    std::vector<hnswlib::labeltype> labels(numQueries * k);
+    std::vector<float> distances(numQueries * k);
+    try {
+      index.queryInto(queries.data(), numQueries, k, labels.data(),
+                      distances.data(), /* numThreads= */ 1, batch.queryEf,
+                      nullptr, batch.rerankK);
+    } catch (...) {
+      // One query failing (i.e.: with a RecallError) shouldn't fail the rest
+      // of its batch, so retry each query on its own:
+      for (Request &request : batch.requests) {
+        std::vector<hnswlib::labeltype> queryLabels(k);
+        std::vector<float> queryDistances(k);
+        std::exception_ptr error;
+        try {
+          index.query(request.queryVector.data(), numDimensions, k,
+                      queryLabels.data(), queryDistances.data(), batch.queryEf,
+                      nullptr, batch.rerankK);
+        } catch (...) {
+          error = std::current_exception();
+          queryLabels.clear();
+          queryDistances.clear();
+        }
+        invoke(request.callback, std::move(queryLabels),
+               std::move(queryDistances), error);
+      }
+      return;
+    }
+
+    for (size_t i = 0; i < numQueries; i++) {
+      invoke(batch.requests[i].callback,
+             std::vector<hnswlib::labeltype>(labels.begin() + (i * k),
+                                             labels.begin() + ((i + 1) * k)),
+             std::vector<float>(distances.begin() + (i * k),
+                                distances.begin() + ((i + 1) * k)),
+             nullptr);
+    }
+  }
+};
@@ -0,0 +1,356 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "StreamUtils.h"
+
+#ifdef VOYAGER_ENABLE_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * Streams of index data can optionally be compressed on disk, which can
+ * significantly reduce the time taken to download large indices from remote
+ * storage. Compressed streams start with this header, followed by a sequence
+ * of independently-compressed chunks; each chunk is stored as its
+ * uncompressed size (as a uint32), its compressed size (as a uint32), and its
+ * zstd-compressed bytes. A chunk with an uncompressed size of zero marks the
+ * end of the stream.
+ *
+ * Compression support is only available if Voyager is built with
+ * VOYAGER_ENABLE_ZSTD defined (and linked against libzstd).
+ */
+static const char COMPRESSED_STREAM_HEADER[4] = {'V', 'Y', 'Z', 'S'};
+
+// The zstd compression level used unless another is requested.
+static const int DEFAULT_COMPRESSION_LEVEL = 3;
+
+// The limits on the uncompressed size of each chunk of a compressed stream.
+static const size_t DEFAULT_COMPRESSED_CHUNK_SIZE = 4 * 1024 * 1024;
+static const size_t MAX_COMPRESSED_CHUNK_SIZE = 64 * 1024 * 1024;
+
+/**
+ * Returns true if the provided stream (positioned at its start) contains
+ * compressed data written by a CompressedOutputStream.
+ */
+static bool isCompressedStream(std::shared_ptr<InputStream> stream) {
+  uint32_t header = stream->peek();
+  return memcmp(&header, COMPRESSED_STREAM_HEADER, sizeof(header)) == 0;
+}
+
+#ifdef VOYAGER_ENABLE_ZSTD
+/**
+ * Compresses everything written to it in chunks, writing the result to
+ * another stream. The end of the compressed stream is written when close() is
+ * called or (if not called explicitly) when this stream is destroyed.
+ */
+class CompressedOutputStream : public OutputStream {
+public:
+  CompressedOutputStream(std::shared_ptr<OutputStream> output,
+                         int compressionLevel = DEFAULT_COMPRESSION_LEVEL,
+                         size_t chunkSize = DEFAULT_COMPRESSED_CHUNK_SIZE)
+      : output(output), compressionLevel(compressionLevel),
+        chunkSize(chunkSize) {
+    if (chunkSize == 0 || chunkSize > MAX_COMPRESSED_CHUNK_SIZE) {
+      throw std::invalid_argument(
+          "Compressed chunk size must be between 1 and " +
+          std::to_string(MAX_COMPRESSED_CHUNK_SIZE) + " bytes.");
+    }
+    pending.reserve(chunkSize);
+    if (!output->write(COMPRESSED_STREAM_HEADER,
+                       sizeof(COMPRESSED_STREAM_HEADER))) {
+      throw std::runtime_error("Failed to write compressed stream header!");
+    }
+  }
+
+  virtual bool write(const char *buffer, unsigned long long numBytes) {
+    if (closed) {
+      throw std::runtime_error(
+          "Cannot write to a compressed stream that has been closed.");
+    }
+
+    while (numBytes > 0) {
+      size_t n = std::min<unsigned long long>(chunkSize - pending.size(),
+                                              numBytes);
+      pending.insert(pending.end(), buffer, buffer + n);
+      buffer += n;
+      numBytes -= n;
+      if (pending.size() == chunkSize && !writeChunk()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  virtual void flush() {
+    writeChunk();
+    output->flush();
+  }
+
+  /**
+   * Writes any buffered data and the end of the compressed stream. Nothing
+   * can be written to this stream afterwards.
+   */
+  void close() {
+    if (closed) {
+      return;
+    }
+    writeChunk();
+    writeBinaryPOD(output, (uint32_t)0);
+    output->flush();
+    closed = true;
+  }
+
+  virtual ~CompressedOutputStream() {
+    try {
+      close();
+    } catch (std::exception const &) {
+      // Destructors can't throw; callers that need to know if the stream was
+      // written successfully should call close() explicitly.
+    }
+  }
+
+private:
+  std::shared_ptr<OutputStream> output;
+  int compressionLevel;
+  size_t chunkSize;
+  bool closed = false;
+
+  std::vector<char> pending;
+  std::vector<char> compressed;
+
+  bool writeChunk() {
+    if (pending.empty()) {
+      return true;
+    }
+
+    compressed.resize(ZSTD_compressBound(pending.size()));
+    size_t compressedSize =
+        ZSTD_compress(compressed.data(), compressed.size(), pending.data(),
+                      pending.size(), compressionLevel);
+    if (ZSTD_isError(compressedSize)) {
+      throw std::runtime_error("Failed to compress " +
+                               std::to_string(pending.size()) +
+                               " bytes: " + ZSTD_getErrorName(compressedSize));
+    }
+
+    writeBinaryPOD(output, (uint32_t)pending.size());
+    writeBinaryPOD(output, (uint32_t)compressedSize);
+    bool success = output->write(compressed.data(), compressedSize);
+    pending.clear();
+    return success;
+  }
+};
+
+/**
+ * Decompresses a stream written by a CompressedOutputStream, one chunk at a
+ * time. Compressed streams can only be read sequentially.
+ */
+class CompressedInputStream : public InputStream {
+public:
+  CompressedInputStream(std::shared_ptr<InputStream> input) : input(input) {
+    char header[sizeof(COMPRESSED_STREAM_HEADER)];
+    if (input->read(header, sizeof(header)) != sizeof(header) ||
+        memcmp(header, COMPRESSED_STREAM_HEADER, sizeof(header)) != 0) {
+      throw std::domain_error(
+          "The provided stream does not contain compressed index data.");
+    }
+  }
+
+  virtual bool isSeekable() { return false; }
+  virtual long long getTotalLength() { return -1; }
+
+  virtual long long read(char *buffer, long long bytesToRead) {
+    long long bytesRead = 0;
+    while (bytesRead < bytesToRead) {
+      if (bufferOffset == decompressed.size() && !readNextChunk()) {
+        break;
+      }
+
+      size_t n = std::min<long long>(decompressed.size() - bufferOffset,
+                                     bytesToRead - bytesRead);
+      std::memcpy(buffer + bytesRead, decompressed.data() + bufferOffset, n);
+      bufferOffset += n;
+      bytesRead += n;
+    }
+    position += bytesRead;
+    return bytesRead;
+  }
+
+  virtual bool isExhausted() {
+    return bufferOffset == decompressed.size() && !readNextChunk();
+  }
+
+  virtual long long getPosition() { return position; }
+
+  virtual bool setPosition(long long newPosition) {
+    return newPosition == position;
+  }
+
+  virtual bool advanceBy(long long numBytes) {
+    if (numBytes < 0) {
+      return false;
+    }
+
+    char scratch[4096];
+    while (numBytes > 0) {
+      long long n = std::min<long long>(sizeof(scratch), numBytes);
+      if (read(scratch, n) != n) {
+        return false;
+      }
+      numBytes -= n;
+    }
+    return true;
+  }
+
+  virtual uint32_t peek() {
+    uint32_t result = 0;
+    while (decompressed.size() - bufferOffset < sizeof(result)) {
+      if (!readNextChunk()) {
+        throw std::runtime_error(
+            "Failed to peek " + std::to_string(sizeof(result)) +
+            " bytes from compressed stream at index " +
+            std::to_string(position) + ".");
+      }
+    }
+    std::memcpy(&result, decompressed.data() + bufferOffset, sizeof(result));
+    return result;
+  }
+
+private:
+  std::shared_ptr<InputStream> input;
+  long long position = 0;
+  bool finished = false;
+
+  // Decompressed data that has not been read yet starts at `bufferOffset`:
+  std::vector<char> decompressed;
+  size_t bufferOffset = 0;
+  std::vector<char> compressed;
+
+  /**
+   * Decompresses the next chunk of the underlying stream and appends it to
+   * any unread decompressed data. Returns false at the end of the stream.
+   */
+  bool readNextChunk() {
+    if (finished) {
+      return false;
+    }
+
+    uint32_t rawSize;
+    readBinaryPOD(input, rawSize);
+    if (rawSize == 0) {
+      finished = true;
+      return false;
+    }
+
+    uint32_t compressedSize;
+    readBinaryPOD(input, compressedSize);
+    if (rawSize > MAX_COMPRESSED_CHUNK_SIZE ||
+        compressedSize > ZSTD_compressBound(MAX_COMPRESSED_CHUNK_SIZE)) {
+      throw std::domain_error(
+          "Compressed stream seems to be corrupted; found a chunk of " +
+          std::to_string(compressedSize) + " compressed bytes (" +
+          std::to_string(rawSize) + " bytes uncompressed).");
+    }
+
+    compressed.resize(compressedSize);
+    size_t bytesRead = 0;
+    while (bytesRead < compressedSize) {
+      long long n = input->read(compressed.data() + bytesRead,
+                                compressedSize - bytesRead);
+      if (n <= 0) {
+        throw std::runtime_error(
+            "Compressed stream ended after " + std::to_string(bytesRead) +
+            " of " + std::to_string(compressedSize) + " bytes of a chunk.");
+      }
+      bytesRead += n;
+    }
+
+    decompressed.erase(decompressed.begin(),
+                       decompressed.begin() + bufferOffset);
+    bufferOffset = 0;
+    size_t unread = decompressed.size();
+    decompressed.resize(unread + rawSize);
+
+    size_t result = ZSTD_decompress(decompressed.data() + unread, rawSize,
+                                    compressed.data(), compressedSize);
+    if (ZSTD_isError(result) || result != rawSize) {
+      throw std::domain_error(
+          "Failed to decompress a chunk of " + std::to_string(compressedSize) +
+          " bytes: " +
+          (ZSTD_isError(result) ? ZSTD_getErrorName(result)
+                                : "unexpected decompressed size"));
+    }
+    return true;
+  }
+};
+#endif
+
+/**
+ * Returns a stream of the decompressed contents of `stream` if it contains
+ * compressed data, or `stream` itself otherwise.
+ */
+static std::shared_ptr<InputStream>
+decompressIfNeeded(std::shared_ptr<InputStream> stream) {
+  if (!isCompressedStream(stream)) {
+    return stream;
+  }
+
+#ifdef VOYAGER_ENABLE_ZSTD
+  return std::make_shared<CompressedInputStream>(stream);
+#else
+  throw std::domain_error(
+      "The provided index data is compressed, but this build of Voyager was "
+      "compiled without compression support (VOYAGER_ENABLE_ZSTD).");
+#endif
+}
+
+/**
+ * Calls `write` with a stream that compresses everything written to it (at
+ * the given zstd compression level) into `output`, then writes the end of the
+ * compressed stream.
+ */
+static void writeCompressed(
+    std::shared_ptr<OutputStream> output, int compressionLevel,
+    const std::function<void(std::shared_ptr<OutputStream>)> &write) {
+#ifdef VOYAGER_ENABLE_ZSTD
+  auto compressed =
+      std::make_shared<CompressedOutputStream>(output, compressionLevel);
+  write(compressed);
+  compressed->close();
+#else
+  (void)output;
+  (void)compressionLevel;
+  (void)write;
+  throw std::domain_error(
+      "Unable to write compressed index data, as this build of Voyager was "
+      "compiled without compression support (VOYAGER_ENABLE_ZSTD).");
+#endif
+}
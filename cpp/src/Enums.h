@@ -1,5 +1,6 @@
 #pragma once
 
+#include <ostream>
 #include <string>
 
 /**
@@ -23,6 +24,23 @@ enum class StorageDataType : unsigned char {
   // four bits for exponent, 3 bits for mantissa,
   // allowing representation of values from 2e-9 to 448.
   E4M3 = 3 << 4,
+
+  // Product quantization: each vector is split into equally-sized subspaces,
+  // each of which is replaced by a one-byte index into a learned codebook.
+  PQ = 4 << 4,
+};
+
+/**
+ * How a ShardedIndex spreads its elements across its shards.
+ */
+enum class ShardingMode : unsigned char {
+  // Each element is stored in exactly one shard, and queries search every
+  // shard and merge their results.
+  Partitioned = 0,
+
+  // Every shard holds a full copy of the index, and each query is answered by
+  // a single replica.
+  Replicated = 1,
 };
 
 inline const std::string toString(StorageDataType sdt) {
@@ -33,6 +51,8 @@ inline const std::string toString(StorageDataType sdt) {
     return "Float32";
   case StorageDataType::E4M3:
     return "E4M3";
+  case StorageDataType::PQ:
+    return "PQ";
   default:
     return "Unknown storage data type (value " + std::to_string((int)sdt) + ")";
   }
@@ -51,12 +71,24 @@ inline const std::string toString(SpaceType space) {
   }
 }
 
-std::ostream &operator<<(std::ostream &os, const SpaceType space) {
+inline const std::string toString(ShardingMode mode) {
+  switch (mode) {
+  case ShardingMode::Partitioned:
+    return "Partitioned";
+  case ShardingMode::Replicated:
+    return "Replicated";
+  default:
+    return "Unknown sharding mode (value " + std::to_string((int)mode) + ")";
+  }
+}
+
+inline std::ostream &operator<<(std::ostream &os, const SpaceType space) {
   os << toString(space);
   return os;
 }
 
-std::ostream &operator<<(std::ostream &os, const StorageDataType sdt) {
+inline std::ostream &operator<<(std::ostream &os,
+                                const StorageDataType sdt) {
   os << toString(sdt);
   return os;
 }
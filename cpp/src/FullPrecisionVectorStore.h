@@ -0,0 +1,507 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Enums.h"
+#include "StreamUtils.h"
+#include "hnswlib.h"
+#include "segmented_array.h"
+
+/**
+ * A side store of full-precision (32-bit float) copies of the vectors in an
+ * index, kept outside of the index's graph. Indices that store compact
+ * representations of their vectors (i.e.: Float8, E4M3 or PQ) can use these
+ * copies to re-score the best candidates found by a query, recovering most of
+ * the recall lost to quantization while only touching a handful of
+ * full-precision vectors per query.
+ *
+ * Vectors are stored as passed to set(), so callers are responsible for
+ * normalizing them first if using the Cosine space.
+ *
+ * Vectors are stored in a SegmentedArray, and labels are mapped to rows by
+ * NUM_SHARDS independently-locked shards, so that threads adding vectors in
+ * parallel only contend when their labels share a shard.
+ *
+ * A store can be saved to its own file and later loaded back into memory, or
+ * memory-mapped so that vectors are only paged in from disk when used for
+ * re-ranking. Memory-mapped stores are copied into memory the first time a
+ * vector is added or replaced.
+ */
+class FullPrecisionVectorStore {
+public:
+  FullPrecisionVectorStore(const int dimensions, const SpaceType space)
+      : dimensions(dimensions) {
+    std::unique_ptr<hnswlib::Space<float>> spaceImpl;
+    if (space == SpaceType::Euclidean) {
+      spaceImpl = std::make_unique<hnswlib::EuclideanSpace<float>>(dimensions);
+    } else {
+      spaceImpl =
+          std::make_unique<hnswlib::InnerProductSpace<float>>(dimensions);
+    }
+    distanceFunction = spaceImpl->get_dist_func();
+    vectors.reset(VECTORS_PER_SEGMENT, dimensions);
+  }
+
+  size_t size() const { return numRows.load(std::memory_order_acquire); }
+
+  bool empty() const { return size() == 0; }
+
+  void clear() {
+    std::unique_lock<std::shared_mutex> lock(storeLock);
+    for (Shard &shard : shards) {
+      shard.rows.clear();
+    }
+    resetVectors();
+  }
+
+  /**
+   * Store a full-precision copy of `vector` for the element with the given
+   * label, replacing any vector already stored for that label. May be called
+   * concurrently with any method other than clear, erase and loadFromStream.
+   */
+  void set(hnswlib::labeltype label, const float *vector) {
+    {
+      std::shared_lock<std::shared_mutex> lock(storeLock);
+      if (!mappedFile) {
+        setLocked(label, vector);
+        return;
+      }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(storeLock);
+    if (mappedFile) {
+      copyMappedVectorsIntoMemory();
+    }
+    setLocked(label, vector);
+  }
+
+  /**
+   * Remove the vectors stored for each of the given labels, if any. The
+   * remaining vectors keep their relative order.
+   */
+  void erase(const std::vector<hnswlib::labeltype> &labels) {
+    std::unique_lock<std::shared_mutex> lock(storeLock);
+    size_t count = size();
+    std::vector<bool> erased(count, false);
+    for (hnswlib::labeltype label : labels) {
+      Shard &shard = shardFor(label);
+      auto existing = shard.rows.find(label);
+      if (existing != shard.rows.end()) {
+        erased[existing->second] = true;
+        shard.rows.erase(existing);
+      }
+    }
+
+    std::vector<size_t> newRows(count);
+    std::vector<float> kept;
+    kept.reserve(count * dimensions);
+    for (size_t row = 0; row < count; row++) {
+      if (!erased[row]) {
+        newRows[row] = kept.size() / dimensions;
+        kept.insert(kept.end(), vectors.at(row), vectors.at(row) + dimensions);
+      }
+    }
+    for (Shard &shard : shards) {
+      for (auto &kv : shard.rows) {
+        kv.second = newRows[kv.second];
+      }
+    }
+    replaceVectors(kept.data(), kept.size() / dimensions);
+  }
+
+  /**
+   * Copy the vector stored for the given label into `output`. Returns false
+   * (leaving `output` untouched) if no vector is stored for this label.
+   */
+  bool get(hnswlib::labeltype label, float *output) const {
+    std::shared_lock<std::shared_mutex> lock(storeLock);
+    const Shard &shard = shardFor(label);
+    std::shared_lock<std::shared_mutex> shardLock(shard.lock);
+    auto row = shard.rows.find(label);
+    if (row == shard.rows.end()) {
+      return false;
+    }
+    const float *vector = vectors.at(row->second);
+    std::copy(vector, vector + dimensions, output);
+    return true;
+  }
+
+  /**
+   * Re-score `numCandidates` search candidates against their full-precision
+   * vectors, then write the best `k` of them to `labels` and `distances` in
+   * ascending order of distance.
+   *
+   * Exact and quantized distances aren't comparable, so candidates are only
+   * re-scored if every one of them has a stored vector. Otherwise, the best
+   * `k` candidates are written by their original distances. Returns true if
+   * the candidates were re-scored.
+   */
+  template <typename dist_t>
+  bool rerank(const float *query, const hnswlib::labeltype *candidateLabels,
+              const dist_t *candidateDistances, size_t numCandidates, size_t k,
+              hnswlib::labeltype *labels, dist_t *distances) const {
+    thread_local std::vector<std::pair<dist_t, hnswlib::labeltype>> candidates;
+    candidates.clear();
+
+    bool rescored = true;
+    {
+      std::shared_lock<std::shared_mutex> lock(storeLock);
+      for (size_t i = 0; i < numCandidates && rescored; i++) {
+        const Shard &shard = shardFor(candidateLabels[i]);
+        std::shared_lock<std::shared_mutex> shardLock(shard.lock);
+        auto row = shard.rows.find(candidateLabels[i]);
+        if (row == shard.rows.end()) {
+          rescored = false;
+          break;
+        }
+        candidates.emplace_back(
+            distanceFunction(query, vectors.at(row->second), dimensions),
+            candidateLabels[i]);
+      }
+    }
+
+    if (!rescored) {
+      candidates.clear();
+      for (size_t i = 0; i < numCandidates; i++) {
+        candidates.emplace_back(candidateDistances[i], candidateLabels[i]);
+      }
+    }
+
+    k = std::min(k, numCandidates);
+    std::partial_sort(candidates.begin(), candidates.begin() + k,
+                      candidates.end());
+    for (size_t i = 0; i < k; i++) {
+      distances[i] = candidates[i].first;
+      labels[i] = candidates[i].second;
+    }
+    return rescored;
+  }
+
+  void serializeToStream(std::shared_ptr<OutputStream> stream) const {
+    // Exclusive, so that no vector is written while being added:
+    std::unique_lock<std::shared_mutex> lock(storeLock);
+    size_t count = size();
+    stream->write("VYFP", 4);
+    writeBinaryPOD(stream, serializationVersion);
+    writeBinaryPOD(stream, dimensions);
+    writeBinaryPOD(stream, (uint64_t)count);
+
+    // Labels are written in row order so that the vectors that follow can be
+    // memory-mapped as one contiguous array:
+    std::vector<uint64_t> labels(count);
+    for (const Shard &shard : shards) {
+      for (auto const &kv : shard.rows) {
+        labels[kv.second] = kv.first;
+      }
+    }
+    stream->write((const char *)labels.data(),
+                  labels.size() * sizeof(uint64_t));
+    for (size_t row = 0; row < count;) {
+      size_t contiguous =
+          std::min(vectors.contiguousElementsFrom(row), count - row);
+      stream->write((const char *)vectors.at(row),
+                    contiguous * dimensions * sizeof(float));
+      row += contiguous;
+    }
+  }
+
+  /**
+   * Replace the contents of this store with a store previously written by
+   * serializeToStream. If `memoryMap` is true and the stream supports it, the
+   * vectors are memory-mapped rather than read into memory.
+   */
+  void loadFromStream(std::shared_ptr<InputStream> stream,
+                      bool memoryMap = false) {
+    char header[4];
+    readExactly(stream, header, sizeof(header));
+    if (memcmp(header, "VYFP", sizeof(header)) != 0) {
+      throw std::domain_error(
+          "The provided stream does not contain full-precision vectors.");
+    }
+
+    int version;
+    readBinaryPOD(stream, version);
+    if (version != serializationVersion) {
+      throw std::domain_error(
+          "Unable to read full-precision vectors with version " +
+          std::to_string(version) + ".");
+    }
+
+    int storedDimensions;
+    readBinaryPOD(stream, storedDimensions);
+    if (storedDimensions != dimensions) {
+      throw std::domain_error(
+          "The provided full-precision vectors have " +
+          std::to_string(storedDimensions) +
+          " dimensions, but this index expects vectors with " +
+          std::to_string(dimensions) + " dimensions.");
+    }
+
+    uint64_t count;
+    readBinaryPOD(stream, count);
+    std::vector<uint64_t> labels(count);
+    readExactly(stream, (char *)labels.data(), count * sizeof(uint64_t));
+
+    size_t vectorBytes = count * dimensions * sizeof(float);
+    std::shared_ptr<MemoryMappedFile> newMappedFile;
+    std::vector<float> newVectors;
+    const float *newMappedVectors = nullptr;
+
+    if (memoryMap && count > 0) {
+      newMappedFile = stream->memoryMap();
+    }
+
+    long long position = stream->getPosition();
+    if (newMappedFile && position >= 0 &&
+        newMappedFile->size() >= (size_t)position + vectorBytes) {
+      newMappedVectors = (const float *)(newMappedFile->data() + position);
+      stream->advanceBy(vectorBytes);
+    } else {
+      newMappedFile = nullptr;
+      newVectors.resize(count * dimensions);
+      readExactly(stream, (char *)newVectors.data(), vectorBytes);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(storeLock);
+    for (Shard &shard : shards) {
+      shard.rows.clear();
+    }
+    for (size_t row = 0; row < count; row++) {
+      shardFor(labels[row]).rows[labels[row]] = row;
+    }
+
+    if (newMappedFile) {
+      // Mapped vectors are never written to; set() copies them first.
+      vectors.map((float *)newMappedVectors, count);
+      mappedFile = newMappedFile;
+      allocatedRows.store(count, std::memory_order_relaxed);
+      numRows.store(count, std::memory_order_release);
+    } else {
+      replaceVectors(newVectors.data(), count);
+    }
+  }
+
+  /**
+   * Write the vector stored for each of `labels` (or that none is stored), so
+   * that applyDelta can bring a copy of this store up to date with it. Writes
+   * no vectors at all if this store is empty.
+   */
+  void serializeDeltaToStream(
+      std::shared_ptr<OutputStream> stream,
+      const std::vector<hnswlib::labeltype> &labels) const {
+    std::unique_lock<std::shared_mutex> lock(storeLock);
+    uint64_t count = size() > 0 ? labels.size() : 0;
+    stream->write("VYFP", 4);
+    writeBinaryPOD(stream, serializationVersion);
+    writeBinaryPOD(stream, dimensions);
+    writeBinaryPOD(stream, count);
+
+    // Each label is followed by whether a vector is stored for it, and if so
+    // by that vector:
+    std::vector<char> chunk;
+    auto append = [&](const void *data, size_t size) {
+      chunk.insert(chunk.end(), (const char *)data, (const char *)data + size);
+    };
+    for (size_t i = 0; i < count; i++) {
+      uint64_t label = labels[i];
+      const Shard &shard = shardFor(labels[i]);
+      auto row = shard.rows.find(labels[i]);
+      uint8_t stored = row != shard.rows.end();
+      append(&label, sizeof(label));
+      append(&stored, sizeof(stored));
+      if (stored) {
+        append(vectors.at(row->second), dimensions * sizeof(float));
+      }
+      if (chunk.size() >= DELTA_CHUNK_SIZE) {
+        stream->write(chunk.data(), chunk.size());
+        chunk.clear();
+      }
+    }
+    if (!chunk.empty()) {
+      stream->write(chunk.data(), chunk.size());
+    }
+  }
+
+  /**
+   * Read the vectors written by serializeDeltaToStream, storing (or removing)
+   * each of them if `update` is true. Stores that aren't updated still read
+   * past the vectors, so the stream can be read further.
+   */
+  void applyDelta(std::shared_ptr<InputStream> stream, bool update) {
+    char header[4];
+    readExactly(stream, header, sizeof(header));
+    if (memcmp(header, "VYFP", sizeof(header)) != 0) {
+      throw std::domain_error(
+          "Index delta is missing its full-precision vectors.");
+    }
+
+    int version, storedDimensions;
+    uint64_t count;
+    readBinaryPOD(stream, version);
+    readBinaryPOD(stream, storedDimensions);
+    readBinaryPOD(stream, count);
+    if (version != serializationVersion || storedDimensions != dimensions) {
+      throw std::domain_error(
+          "Index delta contains full-precision vectors with version " +
+          std::to_string(version) + " and " +
+          std::to_string(storedDimensions) +
+          " dimensions, which this index can't read.");
+    }
+
+    std::vector<float> vector(dimensions);
+    std::vector<hnswlib::labeltype> removed;
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t label;
+      uint8_t stored;
+      readExactly(stream, (char *)&label, sizeof(label));
+      readExactly(stream, (char *)&stored, sizeof(stored));
+      if (stored) {
+        readExactly(stream, (char *)vector.data(),
+                    dimensions * sizeof(float));
+        if (update) {
+          set(label, vector.data());
+        }
+      } else if (update) {
+        removed.push_back(label);
+      }
+    }
+    if (!removed.empty()) {
+      erase(removed);
+    }
+  }
+
+private:
+  static constexpr int serializationVersion = 1;
+  static constexpr size_t DELTA_CHUNK_SIZE = 1 << 20;
+  static constexpr size_t NUM_SHARDS = 64;
+  static constexpr size_t VECTORS_PER_SEGMENT = 4096;
+
+  struct alignas(64) Shard {
+    mutable std::shared_mutex lock;
+    std::unordered_map<hnswlib::labeltype, size_t> rows;
+  };
+
+  int dimensions;
+  hnswlib::DISTFUNC<float> distanceFunction;
+
+  // Held exclusively only to replace or reorder every vector at once (and
+  // while serializing); adding vectors only holds it shared:
+  mutable std::shared_mutex storeLock;
+  std::array<Shard, NUM_SHARDS> shards;
+
+  hnswlib::SegmentedArray<float> vectors;
+  // Rows are handed out in order by `numRows`; `allocatedRows` is the number
+  // of rows `vectors` has room for, and only grows under `growthLock`.
+  std::atomic<size_t> numRows{0};
+  std::atomic<size_t> allocatedRows{0};
+  std::mutex growthLock;
+
+  // If set, `vectors` points into this mapping:
+  std::shared_ptr<MemoryMappedFile> mappedFile;
+
+  Shard &shardFor(hnswlib::labeltype label) {
+    return shards[std::hash<hnswlib::labeltype>()(label) % NUM_SHARDS];
+  }
+
+  const Shard &shardFor(hnswlib::labeltype label) const {
+    return shards[std::hash<hnswlib::labeltype>()(label) % NUM_SHARDS];
+  }
+
+  /** Must hold storeLock (shared or exclusive), and not be memory-mapped. */
+  void setLocked(hnswlib::labeltype label, const float *vector) {
+    Shard &shard = shardFor(label);
+    std::unique_lock<std::shared_mutex> shardLock(shard.lock);
+    size_t row;
+    auto existing = shard.rows.find(label);
+    if (existing != shard.rows.end()) {
+      row = existing->second;
+    } else {
+      row = numRows.fetch_add(1, std::memory_order_acq_rel);
+      reserveRows(row + 1);
+      shard.rows[label] = row;
+    }
+    std::copy(vector, vector + dimensions, vectors.at(row));
+  }
+
+  void reserveRows(size_t count) {
+    if (allocatedRows.load(std::memory_order_acquire) >= count) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(growthLock);
+    if (allocatedRows.load(std::memory_order_relaxed) < count) {
+      vectors.grow(count);
+      allocatedRows.store(vectors.capacity(), std::memory_order_release);
+    }
+  }
+
+  /** Must hold storeLock exclusively. */
+  void resetVectors() {
+    vectors.reset(VECTORS_PER_SEGMENT, dimensions);
+    mappedFile = nullptr;
+    allocatedRows.store(0, std::memory_order_relaxed);
+    numRows.store(0, std::memory_order_release);
+  }
+
+  /**
+   * Replace every stored vector with `count` contiguous vectors, copied into
+   * memory. Must hold storeLock exclusively.
+   */
+  void replaceVectors(const float *newVectors, size_t count) {
+    resetVectors();
+    reserveRows(count);
+    for (size_t row = 0; row < count; row++) {
+      std::copy(newVectors + row * dimensions,
+                newVectors + (row + 1) * dimensions, vectors.at(row));
+    }
+    numRows.store(count, std::memory_order_release);
+  }
+
+  /** Must hold storeLock exclusively. */
+  void copyMappedVectorsIntoMemory() {
+    size_t count = size();
+    std::vector<float> copy(count * dimensions);
+    for (size_t row = 0; row < count; row++) {
+      std::copy(vectors.at(row), vectors.at(row) + dimensions,
+                &copy[row * dimensions]);
+    }
+    replaceVectors(copy.data(), count);
+  }
+
+  static void readExactly(std::shared_ptr<InputStream> stream, char *buffer,
+                          size_t numBytes) {
+    if (numBytes > 0 &&
+        stream->read(buffer, numBytes) != (long long)numBytes) {
+      throw std::runtime_error("Failed to read " + std::to_string(numBytes) +
+                               " bytes of full-precision vectors from stream.");
+    }
+  }
+};
@@ -20,15 +20,33 @@
 
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <optional>
 #include <ratio>
+#include <stdexcept>
 #include <stdlib.h>
 
+#include "CompressedStream.h"
 #include "Enums.h"
 #include "StreamUtils.h"
 #include "array_utils.h"
 #include "hnswlib.h"
+#include "stats.h"
+#include "std_utils.h"
+
+/**
+ * Thrown by Index::query when fewer than the requested number of neighbors
+ * could be found.
+ */
+class RecallError : public std::runtime_error {
+public:
+  RecallError(const std::string &what) : std::runtime_error(what) {}
+};
 
 /**
  * A C++ wrapper class for a Voyager index, which accepts
@@ -49,6 +67,41 @@ public:
   virtual void setEF(size_t ef) = 0;
   virtual int getEF() const = 0;
 
+  /**
+   * Set how many neighbors ahead of the one currently being compared have
+   * their vectors prefetched from memory during a query. Zero disables
+   * prefetching.
+   */
+  virtual void setPrefetchDepth(size_t depth) = 0;
+  virtual size_t getPrefetchDepth() const = 0;
+
+  /**
+   * Set how many nodes in a row a query may expand without finding a better
+   * candidate before it stops searching, even if it has not yet used all of
+   * its `ef` budget. Zero (the default) disables early termination. See
+   * calibrateEarlyTermination() to choose a value for a target recall.
+   */
+  virtual void setEarlyTerminationPatience(size_t patience) = 0;
+  virtual size_t getEarlyTerminationPatience() const = 0;
+
+  /**
+   * Choose (and set) the smallest early termination patience at which
+   * queries for the `k` nearest neighbors of `queryVectors` are expected to
+   * find at least `targetRecall` (on [0, 1]) of the neighbors found without
+   * early termination, where each query is given a budget of `queryEf`.
+   * `queryVectors` should be a representative sample of future queries.
+   *
+   * Each candidate patience is tried by queries of their own, so this index
+   * can keep answering other queries (with its current patience) throughout.
+   * Returns the chosen patience, which is zero (disabling early termination)
+   * if only a patience that never stops a search early reaches
+   * `targetRecall`.
+   */
+  virtual size_t calibrateEarlyTermination(NDArray<float, 2> queryVectors,
+                                           int k, float targetRecall,
+                                           long queryEf = -1,
+                                           int numThreads = -1) = 0;
+
   virtual SpaceType getSpace() const = 0;
   virtual std::string getSpaceName() const = 0;
 
@@ -60,16 +113,81 @@ public:
   virtual void setNumThreads(int numThreads) = 0;
   virtual int getNumThreads() = 0;
 
+  /**
+   * Set the pool of worker threads used by addItems and query. By default,
+   * all indices share a single process-wide pool; pass a dedicated pool to
+   * isolate one index's work from others.
+   */
+  virtual void setThreadPool(std::shared_ptr<ThreadPool> threadPool) = 0;
+  virtual std::shared_ptr<ThreadPool> getThreadPool() = 0;
+
   virtual void saveIndex(const std::string &pathToIndex) = 0;
   virtual void saveIndex(std::shared_ptr<OutputStream> outputStream) = 0;
+
+  /**
+   * Save this index with each chunk compressed by zstd at the given level,
+   * which can make indices much faster to download from remote storage.
+   * Compressed indices are decompressed automatically when loaded by
+   * loadTypedIndexFromStream (or the Python and Java loaders), but can't be
+   * memory-mapped. Requires Voyager to be built with VOYAGER_ENABLE_ZSTD.
+   */
+  virtual void
+  saveCompressedIndex(const std::string &pathToIndex,
+                      int compressionLevel = DEFAULT_COMPRESSION_LEVEL) = 0;
+  virtual void
+  saveCompressedIndex(std::shared_ptr<OutputStream> outputStream,
+                      int compressionLevel = DEFAULT_COMPRESSION_LEVEL) = 0;
+
   virtual void loadIndex(const std::string &pathToIndex,
                          bool searchOnly = false) = 0;
   virtual void loadIndex(std::shared_ptr<InputStream> inputStream,
                          bool searchOnly = false) = 0;
 
+  /**
+   * Save only the elements added, updated or deleted since this index was
+   * last saved (or loaded) in full with saveIndex or loadIndex. Applying the
+   * delta with applyDelta to an index loaded from that full save brings it up
+   * to date with this one, while writing far less data than saveIndex would.
+   *
+   * Each delta contains every change since the last full save, so a copy
+   * only needs the most recent delta applied. Compacting or reordering an
+   * index changes every element, and so makes its next delta a full copy.
+   * The full-precision vectors of changed elements are included, and are
+   * applied to copies that have loaded full-precision vectors of their own.
+   */
+  virtual void saveDelta(const std::string &pathToDelta) = 0;
+  virtual void saveDelta(std::shared_ptr<OutputStream> outputStream) = 0;
+
+  /**
+   * Apply a delta written by saveDelta. This index must hold the contents of
+   * the full save that the delta was taken relative to, and can't be in
+   * search-only mode. Queries wait until the delta has been applied; if it
+   * can't be, this index may be left partially updated and should be
+   * reloaded.
+   */
+  virtual void applyDelta(const std::string &pathToDelta) = 0;
+  virtual void applyDelta(std::shared_ptr<InputStream> inputStream) = 0;
+
   virtual float getDistance(std::vector<float> a, std::vector<float> b) = 0;
 
-  virtual hnswlib::labeltype addItem(std::vector<float> vector,
+  /**
+   * Compute the distance from each of the given queries to each of the given
+   * targets, as query() would report if the target were in this index. Row
+   * `i` of the result holds the distances from query `i` to every target.
+   */
+  virtual NDArray<float, 2> getDistances(NDArray<float, 2> queries,
+                                         NDArray<float, 2> targets,
+                                         int numThreads = -1) = 0;
+
+  virtual hnswlib::labeltype addItem(const std::vector<float> &vector,
+                                     std::optional<hnswlib::labeltype> id) = 0;
+
+  /**
+   * Add the `numDimensions` floats at `vector` to this index, converting them
+   * in scratch space owned by the calling thread rather than copying them
+   * into a new std::vector first. `numDimensions` must match this index.
+   */
+  virtual hnswlib::labeltype addItem(const float *vector, size_t numDimensions,
                                      std::optional<hnswlib::labeltype> id) = 0;
 
   virtual std::vector<hnswlib::labeltype>
@@ -80,31 +198,321 @@ public:
   addItems(NDArray<float, 2> input, std::vector<hnswlib::labeltype> ids = {},
            int numThreads = -1) = 0;
 
+  /**
+   * Add many vectors at once as an offline bulk build, which scales to many
+   * more threads than addItems by inserting vectors in batches rather than
+   * one at a time. The resulting index is saved in the usual format, and does
+   * not depend on `numThreads`.
+   *
+   * Every ID must be new to the index. Queries and other additions wait
+   * until the build has finished.
+   */
+  virtual std::vector<hnswlib::labeltype>
+  bulkAddItems(NDArray<float, 2> input,
+               std::vector<hnswlib::labeltype> ids = {},
+               int numThreads = -1) = 0;
+
   virtual std::vector<float> getVector(hnswlib::labeltype id) = 0;
   virtual NDArray<float, 2> getVectors(std::vector<hnswlib::labeltype> ids) = 0;
 
+  /**
+   * Copy the vectors of the `numIds` given IDs into `output` one after the
+   * other, as getVector would return them, skipping any IDs that aren't in
+   * the index or are marked as deleted. The IDs of the vectors copied are
+   * written to `copiedIds`, and their count is returned. Unlike getVectors,
+   * nothing is allocated per vector.
+   */
+  virtual size_t getVectorsInto(const hnswlib::labeltype *ids, size_t numIds,
+                                float *output,
+                                hnswlib::labeltype *copiedIds) = 0;
+
   virtual std::vector<hnswlib::labeltype> getIDs() const = 0;
   virtual long long getIDsCount() const = 0;
   virtual const std::unordered_map<hnswlib::labeltype, hnswlib::tableint> &
   getIDsMap() const = 0;
 
+  /**
+   * Keep a full-precision (32-bit float) copy of each vector added from now
+   * on, outside of the graph, so that queries can re-rank their candidates by
+   * exact distance (see `rerankK` below). This is most useful with compact
+   * storage data types, whose graphs can then be searched quickly while still
+   * returning Float32-quality results.
+   *
+   * These copies are not written by saveIndex; they must be saved and loaded
+   * separately with saveFullPrecisionVectors and loadFullPrecisionVectors.
+   */
+  virtual void setStoreFullPrecisionVectors(bool enabled) = 0;
+  virtual bool getStoreFullPrecisionVectors() const = 0;
+
+  virtual void saveFullPrecisionVectors(const std::string &path) = 0;
+  virtual void
+  saveFullPrecisionVectors(std::shared_ptr<OutputStream> outputStream) = 0;
+
+  /**
+   * Replace this index's full-precision vectors with those previously saved
+   * with saveFullPrecisionVectors. If `memoryMap` is true, the vectors are
+   * memory-mapped where supported, and only read from disk when re-ranking.
+   */
+  virtual void loadFullPrecisionVectors(const std::string &path,
+                                        bool memoryMap = false) = 0;
+  virtual void
+  loadFullPrecisionVectors(std::shared_ptr<InputStream> inputStream,
+                           bool memoryMap = false) = 0;
+
+  /**
+   * Query this index for the k nearest neighbors of the given vector(s).
+   *
+   * If provided, only elements accepted by the given filter will be returned.
+   * The filter is not copied, and must outlive the call to query().
+   *
+   * If `rerankK` is greater than `k`, the best `rerankK` candidates found in
+   * the graph are re-scored against their full-precision vectors (if any are
+   * stored) and the best `k` of those are returned.
+   */
   virtual std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
-  query(std::vector<float> queryVector, int k = 1, long queryEf = -1) = 0;
+  query(const std::vector<float> &queryVector, int k = 1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) = 0;
+
+  /**
+   * Query this index for the k nearest neighbors of the `numDimensions` floats
+   * at `queryVector`, writing them to `labels` and `distances` (which must
+   * each have room for `k` values). The query is converted in scratch space
+   * owned by the calling thread, so neither it nor its results are copied.
+   */
+  virtual void query(const float *queryVector, size_t numDimensions, int k,
+                     hnswlib::labeltype *labels, float *distances,
+                     long queryEf = -1,
+                     const hnswlib::BaseFilterFunctor *filter = nullptr,
+                     size_t rerankK = 0) = 0;
 
   virtual std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
   query(std::vector<std::vector<float>> queryVectors, int k = 1,
-        int numThreads = -1, long queryEf = -1) = 0;
+        int numThreads = -1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) = 0;
 
   virtual std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
   query(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
-        long queryEf = -1) = 0;
+        long queryEf = -1, const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) = 0;
+
+  /**
+   * Query this index for the k nearest neighbors of `numQueries` vectors,
+   * stored contiguously in row-major order at `queryVectors`. Results are
+   * written directly to `labels` and `distances`, which must each have room
+   * for `numQueries * k` values; the results for query `i` start at `i * k`.
+   *
+   * If `numResults` is provided, queries that find fewer than `k` neighbors
+   * don't throw a RecallError. Instead, the number of neighbors found by
+   * query `i` is written to `numResults[i]`, and the rest of its results are
+   * left unspecified.
+   *
+   * If `queryPatience` is non-negative, it overrides this index's early
+   * termination patience for these queries only (and zero disables early
+   * termination). Such queries bypass the query cache.
+   */
+  virtual void queryInto(const float *queryVectors, size_t numQueries, int k,
+                         hnswlib::labeltype *labels, float *distances,
+                         int numThreads = -1, long queryEf = -1,
+                         const hnswlib::BaseFilterFunctor *filter = nullptr,
+                         size_t rerankK = 0, size_t *numResults = nullptr,
+                         long queryPatience = -1) = 0;
+
+  /**
+   * Called with the results of an asynchronous query, or with the exception
+   * that it threw (in which case `labels` and `distances` are empty).
+   */
+  using QueryCallback = std::function<void(
+      std::vector<hnswlib::labeltype> labels, std::vector<float> distances,
+      std::exception_ptr error)>;
+
+  /**
+   * Query this index without blocking the calling thread. Queries with the
+   * same parameters that are submitted at around the same time (within the
+   * window set by setAsyncBatchWindow) are searched together as one batch on
+   * this index's thread pool.
+   *
+   * Throws immediately if the query vector has the wrong number of
+   * dimensions; any other error (i.e.: a RecallError) is delivered through
+   * the returned future.
+   */
+  virtual std::future<
+      std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>>
+  queryAsync(std::vector<float> queryVector, int k = 1, long queryEf = -1,
+             size_t rerankK = 0) = 0;
+
+  /**
+   * As above, but passing the results to `callback` on one of this index's
+   * worker threads. The callback should return quickly, as other queries
+   * can't use that worker until it does.
+   */
+  virtual void queryAsync(std::vector<float> queryVector,
+                          QueryCallback callback, int k = 1, long queryEf = -1,
+                          size_t rerankK = 0) = 0;
+
+  /**
+   * How long an asynchronous query may wait for others to batch with before
+   * it is searched. Longer windows allow for larger batches (and higher
+   * throughput) at the expense of latency; a window of zero searches every
+   * query as soon as it is submitted. Defaults to 100 microseconds.
+   */
+  virtual void setAsyncBatchWindow(std::chrono::microseconds window) = 0;
+  virtual std::chrono::microseconds getAsyncBatchWindow() const = 0;
+
+  /**
+   * Find the exact k nearest neighbors of each of the given vectors by
+   * comparing them against every element in this index, rather than by
+   * searching the graph. Elements are compared as stored (i.e.: after any
+   * quantization), so results match what query() would find with perfect
+   * recall. Best suited to small indices, or to computing ground truth.
+   *
+   * Throws a RecallError if fewer than `k` elements (that aren't deleted and
+   * are accepted by `filter`) exist in the index.
+   */
+  virtual std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  bruteForceQuery(NDArray<float, 2> queryVectors, int k = 1,
+                  int numThreads = -1,
+                  const hnswlib::BaseFilterFunctor *filter = nullptr) = 0;
+
+  /**
+   * As bruteForceQuery, with queries, results and `numResults` handled as in
+   * queryInto.
+   */
+  virtual void
+  bruteForceQueryInto(const float *queryVectors, size_t numQueries, int k,
+                      hnswlib::labeltype *labels, float *distances,
+                      int numThreads = -1,
+                      const hnswlib::BaseFilterFunctor *filter = nullptr,
+                      size_t *numResults = nullptr) = 0;
+
+  /**
+   * Assign each of `ids` to the corresponding group in `groups` (i.e.: the
+   * item that several of this index's vectors belong to), so that grouped
+   * queries return at most one ID from each group. IDs that haven't been
+   * assigned a group are each in a group of their own. Group assignments are
+   * saved with this index, and included in its deltas.
+   */
+  virtual void setGroups(const std::vector<hnswlib::labeltype> &ids,
+                         const std::vector<hnswlib::labeltype> &groups) = 0;
+  virtual hnswlib::labeltype getGroup(hnswlib::labeltype id) = 0;
+
+  /**
+   * Like query, but find the `k` nearest groups (see setGroups) to each query
+   * rather than the `k` nearest elements. Each group is represented by the ID
+   * of (and distance to) its nearest element. Up to max(queryEf, k) distinct
+   * groups are searched for, no matter how many elements each group has.
+   *
+   * Throws a RecallError if fewer than `k` groups were found. Grouped queries
+   * are neither re-ranked nor cached.
+   */
+  virtual std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+  groupedQuery(const std::vector<float> &queryVector, int k = 1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) = 0;
+
+  virtual std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  groupedQuery(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) = 0;
+
+  /**
+   * As groupedQuery, with queries and results laid out as in queryInto.
+   */
+  virtual void
+  groupedQueryInto(const float *queryVectors, size_t numQueries, int k,
+                   hnswlib::labeltype *labels, float *distances,
+                   int numThreads = -1, long queryEf = -1,
+                   const hnswlib::BaseFilterFunctor *filter = nullptr) = 0;
 
   virtual void markDeleted(hnswlib::labeltype label) = 0;
   virtual void unmarkDeleted(hnswlib::labeltype label) = 0;
 
   virtual void resizeIndex(size_t newSize) = 0;
+
+  /**
+   * Reorder the elements of this index in memory so that neighboring
+   * elements are stored close together, which speeds up queries on large
+   * indices. Does not change the results of any query.
+   */
+  virtual void optimizeLayout() = 0;
+
+  /**
+   * Permanently remove every element marked as deleted from this index,
+   * reconnecting their neighbors to one another and freeing their space for
+   * new elements. Queries on indices with many deleted elements become
+   * faster afterwards. Returns the number of elements removed.
+   */
+  virtual size_t compact() = 0;
+
+  /**
+   * Store this index in a smaller, read-only form for serving: each element's
+   * links are stored without padding, and its ID takes 4 bytes rather than 8
+   * if every ID fits. Query results are unchanged and the index is saved in
+   * the usual format, but as in search-only mode, it can no longer be
+   * modified and its IDs can no longer be listed. Best called right after
+   * loading an index with `searchOnly = true`, which releases the memory
+   * mapping it was loaded from; or, to avoid packing at load time, see
+   * savePackedIndex.
+   */
+  virtual void packForSearch() = 0;
+
+  /**
+   * Save this index in packed form (see packForSearch), whether or not it
+   * has been packed itself. Loading the result reads it straight into packed
+   * storage, without the memory needed to unpack it first. Packed indices
+   * can only be loaded with `searchOnly = true`; loading one otherwise throws
+   * std::invalid_argument.
+   */
+  virtual void savePackedIndex(const std::string &pathToIndex) = 0;
+  virtual void
+  savePackedIndex(std::shared_ptr<OutputStream> outputStream) = 0;
+
+  /**
+   * Counters describing the queries and insertions made on this index since
+   * it was created (or since resetStats() was last called), including
+   * histograms of their latencies. Cheap enough to be left enabled, and safe
+   * to call while other threads are querying.
+   */
+  virtual hnswlib::IndexStats getStats() const = 0;
+  virtual void resetStats() = 0;
+
+  /**
+   * Cache the results of up to `maxEntries` recent unfiltered queries, so
+   * that repeated queries for the same vector (with the same parameters) are
+   * answered without searching the index. Cached results are discarded
+   * whenever this index changes. A size of 0 (the default) disables the
+   * cache. Hits and misses are counted in getStats().
+   */
+  virtual void setQueryCacheSize(size_t maxEntries) = 0;
+  virtual size_t getQueryCacheSize() const = 0;
+
   virtual size_t getMaxElements() const = 0;
   virtual size_t getNumElements() const = 0;
   virtual size_t getEfConstruction() const = 0;
   virtual size_t getM() const = 0;
+
+protected:
+  static void checkNumBruteForceResults(size_t numResults, int k) {
+    if (numResults < (size_t)k) {
+      throw RecallError(
+          "Fewer than expected results were retrieved; only found " +
+          std::to_string(numResults) + " of " + std::to_string(k) +
+          " requested neighbors, as the index contains fewer than " +
+          std::to_string(k) + " elements that aren't deleted and match the "
+          "filter (if any).");
+    }
+  }
+
+  static void checkNumGroupedResults(size_t numResults, int k) {
+    if (numResults < (size_t)k) {
+      throw RecallError(
+          "Fewer than expected results were retrieved; only found " +
+          std::to_string(numResults) + " of " + std::to_string(k) +
+          " requested groups. Increase queryEf, or check that the index "
+          "contains at least " +
+          std::to_string(k) + " groups with elements that aren't deleted and "
+          "match the filter (if any).");
+    }
+  }
 };
@@ -22,7 +22,10 @@
  * -/-/-
  */
 
+#pragma once
+
 #include "Enums.h"
+#include "ProductQuantizer.h"
 #include "StreamUtils.h"
 
 namespace voyager {
@@ -42,7 +45,7 @@ public:
   V1() {}
   virtual ~V1() {}
 
-  int version() const { return 1; }
+  virtual int version() const { return 1; }
 
   int getNumDimensions() { return numDimensions; }
 
@@ -98,6 +101,85 @@ private:
   bool useOrderPreservingTransform;
 };
 
+/**
+ * @brief Metadata for product-quantized indices, which adds the codebooks
+ * needed to encode vectors and to compute distances to them.
+ */
+class V2 : public V1 {
+public:
+  V2(int numDimensions, SpaceType spaceType, StorageDataType storageDataType,
+     float maxNorm, bool useOrderPreservingTransform,
+     const ProductQuantizer &quantizer)
+      : V1(numDimensions, spaceType, storageDataType, maxNorm,
+           useOrderPreservingTransform),
+        quantizer(quantizer) {}
+
+  V2() {}
+  virtual ~V2() {}
+
+  int version() const override { return 2; }
+
+  const ProductQuantizer &getProductQuantizer() const { return quantizer; }
+
+  void setProductQuantizer(const ProductQuantizer &newQuantizer) {
+    quantizer = newQuantizer;
+  }
+
+  void serializeToStream(std::shared_ptr<OutputStream> stream) override {
+    V1::serializeToStream(stream);
+    quantizer.serializeToStream(stream);
+  };
+
+  void loadFromStream(std::shared_ptr<InputStream> stream) override {
+    V1::loadFromStream(stream);
+    quantizer.loadFromStream(stream);
+  };
+
+private:
+  ProductQuantizer quantizer;
+};
+
+/**
+ * @brief The header of an index delta (see Index::saveDelta), which is
+ * followed by the metadata of the index it was saved from and by the
+ * elements that changed since that index was last saved in full.
+ */
+class DeltaHeader {
+public:
+  static constexpr int CURRENT_VERSION = 1;
+  // The bytes "VYDL", as read by InputStream::peek:
+  static constexpr uint32_t TAG =
+      'V' | ('Y' << 8) | ('D' << 16) | ((uint32_t)'L' << 24);
+
+  int version() const { return deltaVersion; }
+
+  void serializeToStream(std::shared_ptr<OutputStream> stream) {
+    stream->write("VYDL", 4);
+    writeBinaryPOD(stream, deltaVersion);
+  }
+
+  void loadFromStream(std::shared_ptr<InputStream> stream) {
+    uint32_t header = stream->peek();
+    if (header != TAG) {
+      throw std::domain_error(
+          "The provided data does not appear to be a Voyager index delta.");
+    }
+    stream->read((char *)&header, sizeof(header));
+
+    readBinaryPOD(stream, deltaVersion);
+    if (deltaVersion < 1 || deltaVersion > CURRENT_VERSION) {
+      throw std::domain_error(
+          "Unable to read index delta with unsupported version " +
+          std::to_string(deltaVersion) +
+          ". A newer version of the Voyager library may be able to read "
+          "this delta.");
+    }
+  }
+
+private:
+  int deltaVersion = CURRENT_VERSION;
+};
+
 static std::unique_ptr<Metadata::V1>
 loadFromStream(std::shared_ptr<InputStream> inputStream) {
   uint32_t header = inputStream->peek();
@@ -117,6 +199,11 @@ loadFromStream(std::shared_ptr<InputStream> inputStream) {
     metadata->loadFromStream(inputStream);
     return metadata;
   }
+  case 2: {
+    std::unique_ptr<Metadata::V1> metadata = std::make_unique<Metadata::V2>();
+    metadata->loadFromStream(inputStream);
+    return metadata;
+  }
   default: {
     std::stringstream stream;
     stream << std::hex << version;
@@ -0,0 +1,1036 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+#include "AsyncQueryBatcher.h"
+#include "Enums.h"
+#include "FullPrecisionVectorStore.h"
+#include "Index.h"
+#include "Metadata.h"
+#include "ProductQuantizer.h"
+#include "QueryCache.h"
+#include "Spaces/ProductQuantized.h"
+#include "array_utils.h"
+#include "hnswlib.h"
+#include "index_utils.h"
+#include "std_utils.h"
+
+/**
+ * An index that stores product-quantized codes in its graph rather than
+ * vectors, using `numSubspaces` bytes per element regardless of the number of
+ * dimensions.
+ *
+ * The quantizer's codebooks are learned from (a sample of) the vectors passed
+ * to the first call to addItems, unless train() is called beforehand. Queries
+ * are compared to stored codes through a per-query lookup table.
+ *
+ * If constructed with `storeFullPrecisionVectors`, each vector is also kept
+ * at full precision outside of the graph, and queries that pass a `rerankK`
+ * re-score their best candidates against those vectors.
+ */
+class PQIndex : public Index {
+private:
+  // The maximum number of vectors used to train the quantizer's codebooks.
+  static constexpr size_t maxTrainingSampleSize = 65536;
+  static constexpr size_t numTrainingIterations = 16;
+
+  SpaceType space;
+  int dimensions;
+  size_t seed;
+  size_t defaultEF = 10;
+  bool normalize;
+
+  int numThreadsDefault;
+  std::shared_ptr<ThreadPool> threadPool = ThreadPool::getDefault();
+  std::atomic<hnswlib::labeltype> currentLabel{0};
+
+  ProductQuantizer quantizer;
+  std::mutex trainingLock;
+  // Set (with release ordering) once `quantizer` has been trained, so that
+  // threads adding vectors can check it without holding trainingLock:
+  std::atomic<bool> trained{false};
+
+  std::unique_ptr<hnswlib::ProductQuantizedSpace> spaceImpl;
+  std::unique_ptr<hnswlib::HierarchicalNSW<float, uint8_t>> algorithmImpl;
+  std::unique_ptr<voyager::Metadata::V2> metadata;
+
+  bool storeFullPrecisionVectors;
+  FullPrecisionVectorStore fullPrecisionVectors;
+  QueryCache queryCache;
+
+  hnswlib::MemoryPolicy memoryPolicy;
+  hnswlib::StatsCollector stats;
+
+  // Declared last, so that it's destroyed (finishing any queries still in
+  // flight) before anything those queries use:
+  AsyncQueryBatcher asyncQueries{*this};
+
+public:
+  /**
+   * Create an empty index with the given parameters. If `numSubspaces` is
+   * zero, a default is chosen based on the number of dimensions.
+   */
+  PQIndex(const SpaceType space, const int dimensions,
+          const int numSubspaces = 0, const size_t M = 12,
+          const size_t efConstruction = 200, const size_t randomSeed = 1,
+          const size_t maxElements = 1,
+          const bool storeFullPrecisionVectors = false,
+          const hnswlib::MemoryPolicy &memoryPolicy = {})
+      : space(space), dimensions(dimensions), seed(randomSeed),
+        normalize(space == SpaceType::Cosine),
+        numThreadsDefault(std::thread::hardware_concurrency()),
+        quantizer(dimensions,
+                  numSubspaces > 0
+                      ? numSubspaces
+                      : ProductQuantizer::getDefaultNumSubspaces(dimensions),
+                  space),
+        spaceImpl(std::make_unique<hnswlib::ProductQuantizedSpace>(quantizer)),
+        storeFullPrecisionVectors(storeFullPrecisionVectors),
+        fullPrecisionVectors(dimensions, space), memoryPolicy(memoryPolicy) {
+    if (space != SpaceType::Euclidean && space != SpaceType::InnerProduct &&
+        space != SpaceType::Cosine) {
+      throw std::runtime_error(
+          "Space must be one of Euclidean, InnerProduct, or Cosine.");
+    }
+
+    algorithmImpl = std::make_unique<hnswlib::HierarchicalNSW<float, uint8_t>>(
+        spaceImpl.get(), maxElements, M, efConstruction, randomSeed,
+        memoryPolicy);
+    algorithmImpl->ef_ = defaultEF;
+    metadata = std::make_unique<voyager::Metadata::V2>(
+        dimensions, space, StorageDataType::PQ, 0.0, false, quantizer);
+  }
+
+  /**
+   * Load an index from the given input stream, whose metadata (including the
+   * quantizer's codebooks) has already been read.
+   */
+  PQIndex(std::unique_ptr<voyager::Metadata::V2> metadata,
+          std::shared_ptr<InputStream> inputStream, bool searchOnly = false,
+          const hnswlib::MemoryPolicy &memoryPolicy = {})
+      : PQIndex(metadata->getSpaceType(), metadata->getNumDimensions(),
+                metadata->getProductQuantizer().getNumSubspaces(),
+                /* M */ 12, /* efConstruction */ 200, /* randomSeed */ 1,
+                /* maxElements */ 1, /* storeFullPrecisionVectors */ false,
+                memoryPolicy) {
+    quantizer = metadata->getProductQuantizer();
+    trained.store(quantizer.isTrained(), std::memory_order_release);
+    algorithmImpl = std::make_unique<hnswlib::HierarchicalNSW<float, uint8_t>>(
+        spaceImpl.get(), inputStream, 0, searchOnly, memoryPolicy);
+    algorithmImpl->ef_ = defaultEF;
+    this->metadata = std::move(metadata);
+    currentLabel = algorithmImpl->cur_element_count;
+  }
+
+  int getNumDimensions() const { return dimensions; }
+
+  SpaceType getSpace() const { return space; }
+
+  std::string getSpaceName() const { return toString(space); }
+
+  StorageDataType getStorageDataType() const { return StorageDataType::PQ; }
+
+  std::string getStorageDataTypeName() const { return "PQ"; }
+
+  int getNumSubspaces() const { return quantizer.getNumSubspaces(); }
+
+  bool isTrained() const { return trained.load(std::memory_order_acquire); }
+
+  /**
+   * Learn the quantizer's codebooks from the given sample of vectors, rather
+   * than from the first vectors added. Must be called before adding vectors.
+   */
+  void train(NDArray<float, 2> sample) {
+    std::lock_guard<std::mutex> lock(trainingLock);
+    if (getNumElements() > 0) {
+      throw std::runtime_error(
+          "Cannot retrain the product quantizer of a non-empty index.");
+    }
+    trainLocked(sample);
+  }
+
+  void setEF(size_t ef) {
+    defaultEF = ef;
+    algorithmImpl->ef_ = ef;
+    queryCache.invalidate();
+  }
+
+  int getEF() const { return algorithmImpl->ef_; }
+
+  void setPrefetchDepth(size_t depth) {
+    algorithmImpl->setPrefetchDepth(depth);
+  }
+
+  size_t getPrefetchDepth() const { return algorithmImpl->getPrefetchDepth(); }
+
+  void setEarlyTerminationPatience(size_t patience) {
+    algorithmImpl->setEarlyTerminationPatience(patience);
+    queryCache.invalidate();
+  }
+
+  size_t getEarlyTerminationPatience() const {
+    return algorithmImpl->getEarlyTerminationPatience();
+  }
+
+  size_t calibrateEarlyTermination(NDArray<float, 2> queryVectors, int k,
+                                   float targetRecall, long queryEf = -1,
+                                   int numThreads = -1) {
+    return IndexUtils::calibrateEarlyTermination(*this, queryVectors, k,
+                                                 targetRecall, queryEf,
+                                                 numThreads);
+  }
+
+  void setNumThreads(int numThreads) { numThreadsDefault = numThreads; }
+
+  int getNumThreads() { return numThreadsDefault; }
+
+  void setThreadPool(std::shared_ptr<ThreadPool> threadPool) {
+    if (!threadPool) {
+      throw std::invalid_argument("A thread pool must be provided.");
+    }
+    this->threadPool = threadPool;
+  }
+
+  std::shared_ptr<ThreadPool> getThreadPool() { return threadPool; }
+
+  void saveIndex(const std::string &pathToIndex) {
+    saveIndex(std::make_shared<FileOutputStream>(pathToIndex));
+  }
+
+  void saveIndex(std::shared_ptr<OutputStream> outputStream) {
+    metadata->setProductQuantizer(quantizer);
+    metadata->serializeToStream(outputStream);
+    algorithmImpl->saveIndex(outputStream);
+  }
+
+  void saveCompressedIndex(const std::string &pathToIndex,
+                           int compressionLevel = DEFAULT_COMPRESSION_LEVEL) {
+    saveCompressedIndex(std::make_shared<FileOutputStream>(pathToIndex),
+                        compressionLevel);
+  }
+
+  void saveCompressedIndex(std::shared_ptr<OutputStream> outputStream,
+                           int compressionLevel = DEFAULT_COMPRESSION_LEVEL) {
+    IndexUtils::saveCompressedIndex(*this, outputStream, compressionLevel);
+  }
+
+  void loadIndex(const std::string &pathToIndex, bool searchOnly = false) {
+    loadIndex(std::make_shared<FileInputStream>(pathToIndex), searchOnly);
+  }
+
+  void loadIndex(std::shared_ptr<InputStream> inputStream,
+                 bool searchOnly = false) {
+    std::unique_ptr<voyager::Metadata::V1> loadedMetadata =
+        voyager::Metadata::loadFromStream(inputStream);
+    voyager::Metadata::V2 *v2 = checkLoadedMetadata(loadedMetadata.get());
+
+    quantizer = v2->getProductQuantizer();
+    trained.store(quantizer.isTrained(), std::memory_order_release);
+    algorithmImpl = std::make_unique<hnswlib::HierarchicalNSW<float, uint8_t>>(
+        spaceImpl.get(), inputStream, 0, searchOnly, memoryPolicy);
+    algorithmImpl->ef_ = defaultEF;
+    loadedMetadata.release();
+    metadata.reset(v2);
+    currentLabel = algorithmImpl->cur_element_count;
+    fullPrecisionVectors.clear();
+    queryCache.invalidate();
+  }
+
+  void saveDelta(const std::string &pathToDelta) {
+    saveDelta(std::make_shared<FileOutputStream>(pathToDelta));
+  }
+
+  void saveDelta(std::shared_ptr<OutputStream> outputStream) {
+    voyager::Metadata::DeltaHeader().serializeToStream(outputStream);
+    metadata->setProductQuantizer(quantizer);
+    metadata->serializeToStream(outputStream);
+    algorithmImpl->saveDelta(outputStream);
+    fullPrecisionVectors.serializeDeltaToStream(
+        outputStream, algorithmImpl->getChangedLabels());
+  }
+
+  void applyDelta(const std::string &pathToDelta) {
+    applyDelta(std::make_shared<FileInputStream>(pathToDelta));
+  }
+
+  void applyDelta(std::shared_ptr<InputStream> inputStream) {
+    voyager::Metadata::DeltaHeader().loadFromStream(inputStream);
+    std::unique_ptr<voyager::Metadata::V1> loadedMetadata =
+        voyager::Metadata::loadFromStream(inputStream);
+    voyager::Metadata::V2 *v2 = checkLoadedMetadata(loadedMetadata.get());
+
+    algorithmImpl->applyDelta(inputStream);
+    // Copies that haven't loaded full-precision vectors don't re-rank, so
+    // they have no use for the vectors in the delta either:
+    fullPrecisionVectors.applyDelta(
+        inputStream, /* update= */ !fullPrecisionVectors.empty());
+
+    // The quantizer may have been trained since the full save:
+    quantizer = v2->getProductQuantizer();
+    trained.store(quantizer.isTrained(), std::memory_order_release);
+    loadedMetadata.release();
+    metadata.reset(v2);
+    currentLabel = algorithmImpl->cur_element_count;
+    queryCache.invalidate();
+  }
+
+  void setStoreFullPrecisionVectors(bool enabled) {
+    storeFullPrecisionVectors = enabled;
+  }
+
+  bool getStoreFullPrecisionVectors() const {
+    return storeFullPrecisionVectors;
+  }
+
+  void saveFullPrecisionVectors(const std::string &path) {
+    saveFullPrecisionVectors(std::make_shared<FileOutputStream>(path));
+  }
+
+  void saveFullPrecisionVectors(std::shared_ptr<OutputStream> outputStream) {
+    fullPrecisionVectors.serializeToStream(outputStream);
+    outputStream->flush();
+  }
+
+  void loadFullPrecisionVectors(const std::string &path,
+                                bool memoryMap = false) {
+    loadFullPrecisionVectors(std::make_shared<FileInputStream>(path),
+                             memoryMap);
+  }
+
+  void loadFullPrecisionVectors(std::shared_ptr<InputStream> inputStream,
+                                bool memoryMap = false) {
+    fullPrecisionVectors.loadFromStream(inputStream, memoryMap);
+    queryCache.invalidate();
+  }
+
+  float getDistance(std::vector<float> a, std::vector<float> b) {
+    if ((int)a.size() != dimensions || (int)b.size() != dimensions) {
+      throw std::runtime_error("Index has " + std::to_string(dimensions) +
+                               " dimensions, but received vectors of size: " +
+                               std::to_string(a.size()) + " and " +
+                               std::to_string(b.size()) + ".");
+    }
+    prepareVector(a.data(), a.data());
+    prepareVector(b.data(), b.data());
+    return exactDistance(a.data(), b.data());
+  }
+
+  NDArray<float, 2> getDistances(NDArray<float, 2> queries,
+                                 NDArray<float, 2> targets,
+                                 int numThreads = -1) {
+    int numQueries = std::get<0>(queries.shape);
+    int numTargets = std::get<0>(targets.shape);
+    if (std::get<1>(queries.shape) != dimensions ||
+        std::get<1>(targets.shape) != dimensions) {
+      throw std::runtime_error(
+          "Index has " + std::to_string(dimensions) +
+          " dimensions, but received vectors of size: " +
+          std::to_string(std::get<1>(queries.shape)) + " and " +
+          std::to_string(std::get<1>(targets.shape)) + ".");
+    }
+    if (numThreads <= 0) {
+      numThreads = numThreadsDefault;
+    }
+
+    threadPool->parallelFor(0, numQueries + numTargets, numThreads,
+                            [&](size_t row, size_t) {
+                              float *vector = row < (size_t)numQueries
+                                                  ? queries[row]
+                                                  : targets[row - numQueries];
+                              prepareVector(vector, vector);
+                            });
+
+    NDArray<float, 2> distances({numQueries, numTargets});
+    threadPool->parallelFor(0, numQueries, numThreads, [&](size_t q, size_t) {
+      for (int t = 0; t < numTargets; t++) {
+        distances[q][t] = exactDistance(queries[q], targets[t]);
+      }
+    });
+    return distances;
+  }
+
+  hnswlib::labeltype addItem(const std::vector<float> &vector,
+                             std::optional<hnswlib::labeltype> id) {
+    return addItem(vector.data(), vector.size(), id);
+  }
+
+  /**
+   * Goes through addItems, as the first vector added to an index is also
+   * used to train its quantizer.
+   */
+  hnswlib::labeltype addItem(const float *vector, size_t numDimensions,
+                             std::optional<hnswlib::labeltype> id) {
+    std::vector<hnswlib::labeltype> ids;
+    if (id) {
+      ids.push_back(*id);
+    }
+    return addItems(NDArray<float, 2>(vector, {1, (int)numDimensions}),
+                    ids)[0];
+  }
+
+  std::vector<hnswlib::labeltype>
+  addItems(const std::vector<std::vector<float>> vectors,
+           std::vector<hnswlib::labeltype> ids = {}, int numThreads = -1) {
+    return addItems(vectorsToNDArray(vectors), ids, numThreads);
+  }
+
+  std::vector<hnswlib::labeltype>
+  addItems(NDArray<float, 2> floatInput,
+           std::vector<hnswlib::labeltype> ids = {}, int numThreads = -1) {
+    if (numThreads <= 0)
+      numThreads = numThreadsDefault;
+
+    size_t rows = std::get<0>(floatInput.shape);
+    prepareToAdd(floatInput, ids);
+    QueryCache::ScopedInvalidation invalidateCache(queryCache);
+
+    std::vector<hnswlib::labeltype> idsToReturn(rows);
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(rows, 1));
+
+    size_t codeSize = quantizer.getCodeSize();
+    std::vector<float> inputArray(numThreads * dimensions);
+    std::vector<uint8_t> codeArray(numThreads * codeSize);
+    threadPool->parallelFor(
+        0, rows, numThreads, [&](size_t row, size_t threadId) {
+          float *vector = &inputArray[threadId * dimensions];
+          uint8_t *codes = &codeArray[threadId * codeSize];
+          prepareVector(floatInput[row], vector);
+          quantizer.encode(vector, codes);
+
+          size_t id = ids.size() ? ids.at(row) : (currentLabel.fetch_add(1));
+          if (storeFullPrecisionVectors) {
+            fullPrecisionVectors.set(id, vector);
+          }
+
+          hnswlib::StatsCollector::takeThreadCounters();
+          auto insertStart = std::chrono::steady_clock::now();
+          while (true) {
+            try {
+              algorithmImpl->addPoint(codes, id);
+              stats.recordInsert(hnswlib::nanosecondsSince(insertStart));
+              break;
+            } catch (IndexFullError &e) {
+              try {
+                resizeIndex(getNumElements() + rows);
+              } catch (IndexCannotBeShrunkError &e) {
+                // Another thread has already resized the index.
+              }
+            }
+          }
+          idsToReturn[row] = id;
+        });
+
+    return idsToReturn;
+  }
+
+  std::vector<hnswlib::labeltype>
+  bulkAddItems(NDArray<float, 2> floatInput,
+               std::vector<hnswlib::labeltype> ids = {}, int numThreads = -1) {
+    if (numThreads <= 0)
+      numThreads = numThreadsDefault;
+
+    size_t rows = std::get<0>(floatInput.shape);
+    prepareToAdd(floatInput, ids);
+    QueryCache::ScopedInvalidation invalidateCache(queryCache);
+    if (ids.empty()) {
+      ids.resize(rows);
+      for (size_t row = 0; row < rows; row++) {
+        ids[row] = currentLabel.fetch_add(1);
+      }
+    }
+
+    size_t codeSize = quantizer.getCodeSize();
+    std::vector<float> inputArray(numThreads * dimensions);
+    std::vector<uint8_t> codeArray(rows * codeSize);
+    threadPool->parallelFor(
+        0, rows, numThreads, [&](size_t row, size_t threadId) {
+          float *vector = &inputArray[threadId * dimensions];
+          prepareVector(floatInput[row], vector);
+          quantizer.encode(vector, &codeArray[row * codeSize]);
+          if (storeFullPrecisionVectors) {
+            fullPrecisionVectors.set(ids[row], vector);
+          }
+        });
+
+    hnswlib::StatsCollector::takeThreadCounters();
+    auto start = std::chrono::steady_clock::now();
+    algorithmImpl->addPointsInBulk(
+        codeArray.data(), ids.data(), rows,
+        [&](size_t begin, size_t end, auto fn) {
+          threadPool->parallelFor(begin, end, numThreads,
+                                  [&](size_t i, size_t) { fn(i); });
+        });
+    stats.recordInserts(rows, hnswlib::nanosecondsSince(start));
+    return ids;
+  }
+
+  std::vector<float> getVector(hnswlib::labeltype id) {
+    std::vector<float> vector(dimensions);
+    if (fullPrecisionVectors.get(id, vector.data())) {
+      return vector;
+    }
+
+    std::vector<uint8_t> codes = algorithmImpl->getDataByLabel(id);
+    quantizer.decode(codes.data(), vector.data());
+    return vector;
+  }
+
+  NDArray<float, 2> getVectors(std::vector<hnswlib::labeltype> ids) {
+    NDArray<float, 2> output = NDArray<float, 2>({(int)ids.size(), dimensions});
+    for (unsigned long i = 0; i < ids.size(); i++) {
+      std::vector<float> vector = getVector(ids[i]);
+      std::copy(vector.begin(), vector.end(),
+                output.data.data() + (i * dimensions));
+    }
+    return output;
+  }
+
+  size_t getVectorsInto(const hnswlib::labeltype *ids, size_t numIds,
+                        float *output, hnswlib::labeltype *copiedIds) {
+    size_t numCopied = 0;
+    for (size_t i = 0; i < numIds; i++) {
+      const uint8_t *codes = algorithmImpl->findDataByLabel(ids[i]);
+      if (!codes) {
+        continue;
+      }
+      float *vector = output + numCopied * dimensions;
+      if (!fullPrecisionVectors.get(ids[i], vector)) {
+        quantizer.decode(codes, vector);
+      }
+      copiedIds[numCopied++] = ids[i];
+    }
+    return numCopied;
+  }
+
+  std::vector<hnswlib::labeltype> getIDs() const {
+    std::vector<hnswlib::labeltype> ids;
+    ids.reserve(algorithmImpl->label_lookup_.size());
+    for (auto const &kv : algorithmImpl->label_lookup_) {
+      ids.push_back(kv.first);
+    }
+    return ids;
+  }
+
+  long long getIDsCount() const { return algorithmImpl->label_lookup_.size(); }
+
+  const std::unordered_map<hnswlib::labeltype, hnswlib::tableint> &
+  getIDsMap() const {
+    return algorithmImpl->label_lookup_;
+  }
+
+  std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+  query(const std::vector<float> &queryVector, int k = 1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    std::vector<hnswlib::labeltype> labels(k);
+    std::vector<float> distances(k);
+    query(queryVector.data(), queryVector.size(), k, labels.data(),
+          distances.data(), queryEf, filter, rerankK);
+    return {labels, distances};
+  }
+
+  void query(const float *queryVector, size_t numDimensions, int k,
+             hnswlib::labeltype *labels, float *distances, long queryEf = -1,
+             const hnswlib::BaseFilterFunctor *filter = nullptr,
+             size_t rerankK = 0) {
+    if (numDimensions != (size_t)dimensions) {
+      throw std::runtime_error(
+          "Query vector expected to share dimensionality with index.");
+    }
+
+    search(queryVector, k, queryEf, filter, rerankK, labels, distances);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  query(std::vector<std::vector<float>> queryVectors, int k = 1,
+        int numThreads = -1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    return query(vectorsToNDArray(queryVectors), k, numThreads, queryEf,
+                 filter, rerankK);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  query(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
+        long queryEf = -1, const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    int numRows = std::get<0>(queryVectors.shape);
+    if (std::get<1>(queryVectors.shape) != dimensions) {
+      throw std::runtime_error(
+          "Query vectors expected to share dimensionality with index.");
+    }
+
+    NDArray<hnswlib::labeltype, 2> labels({numRows, k});
+    NDArray<float, 2> distances({numRows, k});
+    queryInto(queryVectors.data.data(), numRows, k, labels.data.data(),
+              distances.data.data(), numThreads, queryEf, filter, rerankK);
+    return {labels, distances};
+  }
+
+  void queryInto(const float *queryVectors, size_t numRows, int k,
+                 hnswlib::labeltype *labels, float *distances,
+                 int numThreads = -1, long queryEf = -1,
+                 const hnswlib::BaseFilterFunctor *filter = nullptr,
+                 size_t rerankK = 0, size_t *numResults = nullptr,
+                 long queryPatience = -1) {
+    if (numThreads <= 0) {
+      numThreads = numThreadsDefault;
+    }
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(numRows, 1));
+
+    threadPool->parallelFor(0, numRows, numThreads, [&](size_t row, size_t) {
+      search(queryVectors + (row * dimensions), k, queryEf, filter, rerankK,
+             labels + (row * k), distances + (row * k),
+             numResults ? numResults + row : nullptr, queryPatience);
+    });
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  bruteForceQuery(NDArray<float, 2> queryVectors, int k = 1,
+                  int numThreads = -1,
+                  const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    int numRows = std::get<0>(queryVectors.shape);
+    if (std::get<1>(queryVectors.shape) != dimensions) {
+      throw std::runtime_error(
+          "Query vectors expected to share dimensionality with index.");
+    }
+
+    NDArray<hnswlib::labeltype, 2> labels({numRows, k});
+    NDArray<float, 2> distances({numRows, k});
+    bruteForceQueryInto(queryVectors.data.data(), numRows, k,
+                        labels.data.data(), distances.data.data(), numThreads,
+                        filter);
+    return {labels, distances};
+  }
+
+  /**
+   * Compares each query's distance table against every element's code, so
+   * results match query() with perfect recall (but without re-ranking).
+   */
+  void bruteForceQueryInto(const float *queryVectors, size_t numRows, int k,
+                           hnswlib::labeltype *labels, float *distances,
+                           int numThreads = -1,
+                           const hnswlib::BaseFilterFunctor *filter = nullptr,
+                           size_t *numResults = nullptr) {
+    if (numThreads <= 0) {
+      numThreads = numThreadsDefault;
+    }
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(numRows, 1));
+
+    size_t tableSize =
+        quantizer.getCodeSize() * ProductQuantizer::NUM_CENTROIDS;
+    std::vector<float> tables(numThreads * tableSize);
+    std::vector<float> queries(numThreads * dimensions);
+    threadPool->parallelFor(
+        0, numRows, numThreads, [&](size_t row, size_t threadId) {
+          hnswlib::StatsCollector::takeThreadCounters();
+          auto queryStart = std::chrono::steady_clock::now();
+          float *query = &queries[threadId * dimensions];
+          float *table = &tables[threadId * tableSize];
+          prepareVector(queryVectors + (row * dimensions), query);
+          quantizer.computeDistanceTable(query, table);
+
+          size_t rowNumResults;
+          algorithmImpl->bruteForceSearchWithDistances(
+              [&](hnswlib::tableint id, float *distance) {
+                *distance = quantizer.distance(
+                    table, algorithmImpl->getDataByInternalId(id));
+              },
+              1, k, labels + (row * k), distances + (row * k), &rowNumResults,
+              filter);
+          if (numResults) {
+            numResults[row] = rowNumResults;
+          } else {
+            checkNumBruteForceResults(rowNumResults, k);
+          }
+          stats.recordQuery(hnswlib::nanosecondsSince(queryStart));
+        });
+  }
+
+  void setGroups(const std::vector<hnswlib::labeltype> &ids,
+                 const std::vector<hnswlib::labeltype> &groups) {
+    if (ids.size() != groups.size()) {
+      throw std::invalid_argument(
+          "Expected one group per ID, but got " + std::to_string(ids.size()) +
+          " IDs and " + std::to_string(groups.size()) + " groups.");
+    }
+    algorithmImpl->setGroups(ids.data(), groups.data(), ids.size());
+  }
+
+  hnswlib::labeltype getGroup(hnswlib::labeltype id) {
+    return algorithmImpl->getGroup(id);
+  }
+
+  void groupedQueryInto(const float *queryVectors, size_t numRows, int k,
+                        hnswlib::labeltype *labels, float *distances,
+                        int numThreads = -1, long queryEf = -1,
+                        const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    if (queryEf > 0 && queryEf < k) {
+      throw std::runtime_error("queryEf must be equal to or greater than the "
+                               "requested number of neighbors");
+    }
+    if (numThreads <= 0) {
+      numThreads = numThreadsDefault;
+    }
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(numRows, 1));
+
+    size_t tableSize =
+        quantizer.getCodeSize() * ProductQuantizer::NUM_CENTROIDS;
+    std::vector<float> tables(numThreads * tableSize);
+    std::vector<float> queries(numThreads * dimensions);
+    threadPool->parallelFor(
+        0, numRows, numThreads, [&](size_t row, size_t threadId) {
+          hnswlib::StatsCollector::takeThreadCounters();
+          auto queryStart = std::chrono::steady_clock::now();
+          float *query = &queries[threadId * dimensions];
+          float *table = &tables[threadId * tableSize];
+          prepareVector(queryVectors + (row * dimensions), query);
+          quantizer.computeDistanceTable(query, table);
+
+          size_t numResults = algorithmImpl->searchKnnGroupedWithDistanceInto(
+              [&](hnswlib::tableint id) {
+                return quantizer.distance(
+                    table, algorithmImpl->getDataByInternalId(id));
+              },
+              k, labels + (row * k), distances + (row * k), queryEf, filter);
+          checkNumGroupedResults(numResults, k);
+          stats.recordQuery(hnswlib::nanosecondsSince(queryStart));
+        });
+  }
+
+  std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+  groupedQuery(const std::vector<float> &queryVector, int k = 1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return IndexUtils::groupedQuery(*this, queryVector, k, queryEf, filter);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  groupedQuery(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return IndexUtils::groupedQuery(*this, queryVectors, k, numThreads,
+                                    queryEf, filter);
+  }
+
+  void markDeleted(hnswlib::labeltype label) {
+    algorithmImpl->markDelete(label);
+    queryCache.invalidate();
+  }
+
+  void unmarkDeleted(hnswlib::labeltype label) {
+    algorithmImpl->unmarkDelete(label);
+    queryCache.invalidate();
+  }
+
+  void resizeIndex(size_t newSize) {
+    algorithmImpl->resizeIndex(newSize);
+    queryCache.invalidate();
+  }
+
+  void optimizeLayout() { algorithmImpl->reorderForLocality(); }
+
+  void packForSearch() { algorithmImpl->packForSearch(); }
+
+  void savePackedIndex(const std::string &pathToIndex) {
+    savePackedIndex(std::make_shared<FileOutputStream>(pathToIndex));
+  }
+
+  void savePackedIndex(std::shared_ptr<OutputStream> outputStream) {
+    metadata->setProductQuantizer(quantizer);
+    metadata->serializeToStream(outputStream);
+    algorithmImpl->savePackedIndex(outputStream);
+  }
+
+  size_t compact() {
+    std::vector<hnswlib::labeltype> removedLabels =
+        algorithmImpl->compactDeletedElements();
+    fullPrecisionVectors.erase(removedLabels);
+    queryCache.invalidate();
+    return removedLabels.size();
+  }
+
+  void setQueryCacheSize(size_t maxEntries) {
+    queryCache.setMaxEntries(maxEntries);
+  }
+
+  size_t getQueryCacheSize() const { return queryCache.getMaxEntries(); }
+
+  std::future<std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>>
+  queryAsync(std::vector<float> queryVector, int k = 1, long queryEf = -1,
+             size_t rerankK = 0) {
+    return asyncQueries.submit(std::move(queryVector), k, queryEf, rerankK);
+  }
+
+  void queryAsync(std::vector<float> queryVector, QueryCallback callback,
+                  int k = 1, long queryEf = -1, size_t rerankK = 0) {
+    asyncQueries.submit(std::move(queryVector), std::move(callback), k,
+                        queryEf, rerankK);
+  }
+
+  void setAsyncBatchWindow(std::chrono::microseconds window) {
+    asyncQueries.setWindow(window);
+  }
+
+  std::chrono::microseconds getAsyncBatchWindow() const {
+    return asyncQueries.getWindow();
+  }
+
+  hnswlib::IndexStats getStats() const { return stats.getStats(); }
+
+  void resetStats() { stats.reset(); }
+
+  size_t getMaxElements() const { return algorithmImpl->max_elements_; }
+
+  size_t getNumElements() const { return algorithmImpl->cur_element_count; }
+
+  size_t getEfConstruction() const { return algorithmImpl->ef_construction_; }
+
+  size_t getM() const { return algorithmImpl->M_; }
+
+private:
+  /**
+   * Throw unless metadata read from a stream describes a PQ index that can be
+   * loaded into (or applied to) this one.
+   */
+  voyager::Metadata::V2 *
+  checkLoadedMetadata(voyager::Metadata::V1 *loadedMetadata) {
+    voyager::Metadata::V2 *v2 =
+        dynamic_cast<voyager::Metadata::V2 *>(loadedMetadata);
+    if (!v2 || v2->getStorageDataType() != StorageDataType::PQ) {
+      throw std::domain_error(
+          "The loaded index is not a product-quantized (PQ) index.");
+    }
+    if (v2->getSpaceType() != space) {
+      throw std::domain_error(
+          "Space type of this index (" + toString(space) +
+          ") does not match the space type used in the loaded index (" +
+          toString(v2->getSpaceType()) + ").");
+    }
+    if (v2->getNumDimensions() != dimensions) {
+      throw std::domain_error(
+          "Number of dimensions of this index (" + std::to_string(dimensions) +
+          ") does not match the number of dimensions used in the loaded "
+          "index (" +
+          std::to_string(v2->getNumDimensions()) + ").");
+    }
+    return v2;
+  }
+
+  /**
+   * Check that `floatInput` and `ids` can be added to this index, training
+   * the quantizer on `floatInput` if it hasn't been trained yet and making
+   * room for every vector.
+   */
+  void prepareToAdd(NDArray<float, 2> &floatInput,
+                    const std::vector<hnswlib::labeltype> &ids) {
+    size_t rows = std::get<0>(floatInput.shape);
+    size_t features = std::get<1>(floatInput.shape);
+
+    if (features != (size_t)dimensions) {
+      throw std::domain_error(
+          "The provided vector(s) have " + std::to_string(features) +
+          " dimensions, but this index expects vectors with " +
+          std::to_string(dimensions) + " dimensions.");
+    }
+
+    if (!ids.empty() && (unsigned long)ids.size() != rows) {
+      throw std::runtime_error(
+          std::to_string(rows) + " vectors were provided, but " +
+          std::to_string(ids.size()) +
+          " IDs were provided. If providing IDs along with vectors, the number "
+          "of provided IDs must match the number of vectors.");
+    }
+
+    // Threads that find the quantizer untrained wait here until whichever
+    // of them trains it is done, rather than encoding with it mid-training:
+    if (!trained.load(std::memory_order_acquire)) {
+      std::lock_guard<std::mutex> lock(trainingLock);
+      if (!trained.load(std::memory_order_relaxed)) {
+        trainLocked(floatInput);
+      }
+    }
+
+    while (getNumElements() + rows > getMaxElements()) {
+      try {
+        resizeIndex(getNumElements() + rows);
+      } catch (IndexCannotBeShrunkError &e) {
+        // Retry with a larger size; some other thread may have resized
+        // behind our back.
+      }
+    }
+  }
+
+  void trainLocked(NDArray<float, 2> &input) {
+    size_t rows = std::get<0>(input.shape);
+    size_t sampleSize = std::min(rows, maxTrainingSampleSize);
+    if (sampleSize == 0) {
+      throw std::invalid_argument(
+          "At least one vector is required to train a product quantizer.");
+    }
+
+    // Take an evenly-spaced sample, in case the input is sorted somehow:
+    std::vector<float> sample(sampleSize * dimensions);
+    for (size_t i = 0; i < sampleSize; i++) {
+      prepareVector(input[(i * rows) / sampleSize], &sample[i * dimensions]);
+    }
+    quantizer.train(sample.data(), sampleSize, numTrainingIterations, seed,
+                    *threadPool);
+    trained.store(true, std::memory_order_release);
+  }
+
+  /** Copies `input` to `output`, normalizing it if using Cosine distance. */
+  void prepareVector(const float *input, float *output) const {
+    if (normalize) {
+      normalizeVector<float>(input, output, dimensions);
+    } else if (input != output) {
+      std::copy(input, input + dimensions, output);
+    }
+  }
+
+  float exactDistance(const float *a, const float *b) const {
+    float total = 0;
+    if (space == SpaceType::Euclidean) {
+      for (int i = 0; i < dimensions; i++) {
+        float difference = a[i] - b[i];
+        total += difference * difference;
+      }
+      return total;
+    }
+
+    for (int i = 0; i < dimensions; i++) {
+      total += a[i] * b[i];
+    }
+    return 1.0f - total;
+  }
+
+  /**
+   * Buffers used by each query, reused by every query on the same thread so
+   * that they are only allocated once.
+   */
+  struct Scratch {
+    std::vector<float> query;
+    std::vector<float> table;
+    std::vector<hnswlib::labeltype> candidateLabels;
+    std::vector<float> candidateDistances;
+  };
+
+  static Scratch &getScratch() {
+    thread_local Scratch scratch;
+    return scratch;
+  }
+
+  /**
+   * Finds the k nearest neighbors of a single query, writing them to
+   * `labels` and `distances` in ascending order of distance. Throws a
+   * RecallError if fewer than k are found, unless `numResultsFound` is
+   * provided, in which case it receives the number found.
+   */
+  void search(const float *floatQuery, int k, long queryEf,
+              const hnswlib::BaseFilterFunctor *filter, size_t rerankK,
+              hnswlib::labeltype *labels, float *distances,
+              size_t *numResultsFound = nullptr,
+              long queryPatience = -1) {
+    if (queryEf > 0 && queryEf < k) {
+      throw std::runtime_error("queryEf must be equal to or greater than the "
+                               "requested number of neighbors");
+    }
+
+    hnswlib::StatsCollector::takeThreadCounters();
+    auto queryStart = std::chrono::steady_clock::now();
+
+    Scratch &scratch = getScratch();
+    std::vector<float> &query = scratch.query;
+    query.resize(dimensions);
+    prepareVector(floatQuery, query.data());
+
+    bool rerank = rerankK > (size_t)k && !fullPrecisionVectors.empty();
+    size_t numCandidates = rerank ? rerankK : k;
+    if (rerank && queryEf > 0 && (size_t)queryEf < numCandidates) {
+      queryEf = numCandidates;
+    }
+
+    // Filtered queries are never cached, as their results depend on the
+    // filter too (as are queries with their own patience):
+    std::string cacheKey;
+    uint64_t cacheGeneration = 0;
+    if (!filter && queryPatience < 0 && queryCache.isEnabled()) {
+      cacheKey = QueryCache::makeKey(query.data(), dimensions * sizeof(float),
+                                     k, queryEf > 0 ? queryEf : -1,
+                                     rerank ? numCandidates : 0);
+      cacheGeneration = queryCache.getGeneration();
+      if (queryCache.lookup(cacheKey, k, labels, distances)) {
+        if (numResultsFound) {
+          *numResultsFound = k;
+        }
+        stats.recordQuery(hnswlib::nanosecondsSince(queryStart));
+        return;
+      }
+    }
+
+    std::vector<float> &table = scratch.table;
+    table.resize(quantizer.getCodeSize() * ProductQuantizer::NUM_CENTROIDS);
+    quantizer.computeDistanceTable(query.data(), table.data());
+
+    auto distanceToQuery = [&](hnswlib::tableint id) {
+      return quantizer.distance(table.data(),
+                                algorithmImpl->getDataByInternalId(id));
+    };
+
+    std::vector<hnswlib::labeltype> &candidateLabels = scratch.candidateLabels;
+    std::vector<float> &candidateDistances = scratch.candidateDistances;
+    if (rerank) {
+      candidateLabels.resize(numCandidates);
+      candidateDistances.resize(numCandidates);
+    }
+
+    size_t numResults = algorithmImpl->searchKnnWithDistanceInto(
+        distanceToQuery, numCandidates,
+        rerank ? candidateLabels.data() : labels,
+        rerank ? candidateDistances.data() : distances, queryEf, filter,
+        queryPatience);
+
+    if (numResultsFound) {
+      *numResultsFound = std::min<size_t>(numResults, k);
+    } else if (numResults < (unsigned long)k) {
+      throw RecallError(
+          "Fewer than expected results were retrieved; only found " +
+          std::to_string(numResults) + " of " + std::to_string(k) +
+          " requested neighbors. Reconstruct the index with a higher M value "
+          "to increase recall.");
+    }
+
+    if (rerank) {
+      fullPrecisionVectors.rerank(query.data(), candidateLabels.data(),
+                                  candidateDistances.data(), numResults, k,
+                                  labels, distances);
+    }
+
+    if (!cacheKey.empty() && numResults >= (size_t)k) {
+      queryCache.insert(cacheKey, cacheGeneration, k, labels, distances);
+    }
+    stats.recordQuery(hnswlib::nanosecondsSince(queryStart));
+  }
+};
@@ -0,0 +1,334 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Enums.h"
+#include "StreamUtils.h"
+#include "std_utils.h"
+
+/**
+ * A product quantizer, which compresses vectors by splitting them into
+ * `numSubspaces` equally-sized chunks and replacing each chunk with the index
+ * of its nearest centroid (one byte) in a per-subspace codebook.
+ *
+ * Distances between a full-precision query and an encoded vector are computed
+ * asymmetrically ("ADC"), by summing entries of a per-query lookup table.
+ * Distances between two encoded vectors (needed while building the graph) are
+ * computed symmetrically ("SDC"), from precomputed centroid-to-centroid tables.
+ */
+class ProductQuantizer {
+public:
+  static constexpr size_t NUM_CENTROIDS = 256;
+
+  ProductQuantizer() {}
+
+  ProductQuantizer(int numDimensions, int numSubspaces, SpaceType space)
+      : numDimensions(numDimensions), numSubspaces(numSubspaces),
+        space(space) {
+    if (numSubspaces <= 0 || numDimensions <= 0 ||
+        numDimensions % numSubspaces != 0) {
+      throw std::invalid_argument(
+          "The number of dimensions (" + std::to_string(numDimensions) +
+          ") must be a positive multiple of the number of product quantizer "
+          "subspaces (" +
+          std::to_string(numSubspaces) + ").");
+    }
+    subspaceDimensions = numDimensions / numSubspaces;
+  }
+
+  /**
+   * Returns a reasonable number of subspaces for the given dimensionality:
+   * the largest divisor of `numDimensions` that gives subspaces of at least
+   * four dimensions each (i.e.: at least 16x compression over Float32).
+   */
+  static int getDefaultNumSubspaces(int numDimensions) {
+    for (int numSubspaces = numDimensions / 4; numSubspaces > 1;
+         numSubspaces--) {
+      if (numDimensions % numSubspaces == 0)
+        return numSubspaces;
+    }
+    return 1;
+  }
+
+  bool isTrained() const { return !centroids.empty(); }
+
+  int getNumDimensions() const { return numDimensions; }
+  int getNumSubspaces() const { return numSubspaces; }
+
+  /** The number of bytes used to store each encoded vector. */
+  size_t getCodeSize() const { return numSubspaces; }
+
+  /**
+   * Learns a codebook for each subspace by running k-means over the given
+   * sample of `numVectors` row-major vectors.
+   */
+  void train(const float *vectors, size_t numVectors, size_t numIterations = 16,
+             size_t seed = 1, ThreadPool &pool = *ThreadPool::getDefault()) {
+    if (numVectors == 0) {
+      throw std::invalid_argument(
+          "At least one vector is required to train a product quantizer.");
+    }
+
+    centroids.assign(numSubspaces * NUM_CENTROIDS * subspaceDimensions, 0.0f);
+    pool.parallelFor(0, numSubspaces, pool.getNumWorkers() + 1,
+                     [&](size_t subspace, size_t) {
+                       trainSubspace(vectors, numVectors, subspace,
+                                     numIterations, seed + subspace);
+                     });
+    computeSymmetricDistanceTables();
+  }
+
+  /** Replaces each subspace of `vector` with the index of its centroid. */
+  void encode(const float *vector, uint8_t *codes) const {
+    for (int subspace = 0; subspace < numSubspaces; subspace++) {
+      codes[subspace] = findNearestCentroid(
+          subspace, vector + subspace * subspaceDimensions);
+    }
+  }
+
+  /** Reconstructs an approximation of the vector that produced `codes`. */
+  void decode(const uint8_t *codes, float *vector) const {
+    for (int subspace = 0; subspace < numSubspaces; subspace++) {
+      const float *centroid = getCentroid(subspace, codes[subspace]);
+      std::copy(centroid, centroid + subspaceDimensions,
+                vector + subspace * subspaceDimensions);
+    }
+  }
+
+  /**
+   * Fills `table` (which must hold `numSubspaces * NUM_CENTROIDS` floats) with
+   * the contribution of each centroid of each subspace to the distance from
+   * `query`. The query must already be normalized if using Cosine distance.
+   */
+  void computeDistanceTable(const float *query, float *table) const {
+    for (int subspace = 0; subspace < numSubspaces; subspace++) {
+      const float *querySubvector = query + subspace * subspaceDimensions;
+      for (size_t c = 0; c < NUM_CENTROIDS; c++) {
+        table[subspace * NUM_CENTROIDS + c] =
+            subspaceDistance(querySubvector, getCentroid(subspace, c));
+      }
+    }
+  }
+
+  /** The distance between a query (via its table) and an encoded vector. */
+  inline float distance(const float *table, const uint8_t *codes) const {
+    float total = 0;
+    for (int subspace = 0; subspace < numSubspaces; subspace++) {
+      total += table[subspace * NUM_CENTROIDS + codes[subspace]];
+    }
+    return offset() + total;
+  }
+
+  /** The approximate distance between two encoded vectors. */
+  inline float symmetricDistance(const uint8_t *a, const uint8_t *b) const {
+    const float *table = symmetricDistanceTables.data();
+    float total = 0;
+    for (int subspace = 0; subspace < numSubspaces; subspace++) {
+      total += table[(subspace * NUM_CENTROIDS + a[subspace]) * NUM_CENTROIDS +
+                     b[subspace]];
+    }
+    return offset() + total;
+  }
+
+  void serializeToStream(std::shared_ptr<OutputStream> stream) const {
+    writeBinaryPOD(stream, numDimensions);
+    writeBinaryPOD(stream, numSubspaces);
+    writeBinaryPOD(stream, space);
+    uint64_t numCentroidValues = centroids.size();
+    writeBinaryPOD(stream, numCentroidValues);
+    if (numCentroidValues &&
+        !stream->write((const char *)centroids.data(),
+                       numCentroidValues * sizeof(float))) {
+      throw std::runtime_error("Failed to write product quantizer codebooks.");
+    }
+  }
+
+  void loadFromStream(std::shared_ptr<InputStream> stream) {
+    readBinaryPOD(stream, numDimensions);
+    readBinaryPOD(stream, numSubspaces);
+    readBinaryPOD(stream, space);
+    *this = ProductQuantizer(numDimensions, numSubspaces, space);
+
+    uint64_t numCentroidValues;
+    readBinaryPOD(stream, numCentroidValues);
+    if (numCentroidValues != 0 &&
+        numCentroidValues != numDimensions * NUM_CENTROIDS) {
+      throw std::domain_error(
+          "Product quantizer codebooks are corrupted; expected " +
+          std::to_string(numDimensions * NUM_CENTROIDS) + " values, found " +
+          std::to_string(numCentroidValues) + ".");
+    }
+
+    centroids.resize(numCentroidValues);
+    if (numCentroidValues) {
+      long long bytes = numCentroidValues * sizeof(float);
+      if (stream->read((char *)centroids.data(), bytes) != bytes) {
+        throw std::runtime_error("Failed to read product quantizer codebooks.");
+      }
+      computeSymmetricDistanceTables();
+    }
+  }
+
+private:
+  int numDimensions = 0;
+  int numSubspaces = 0;
+  int subspaceDimensions = 0;
+  SpaceType space = SpaceType::Euclidean;
+
+  // [numSubspaces][NUM_CENTROIDS][subspaceDimensions]
+  std::vector<float> centroids;
+  // [numSubspaces][NUM_CENTROIDS][NUM_CENTROIDS]
+  std::vector<float> symmetricDistanceTables;
+
+  // Inner product distances are 1 - <a, b>, which decomposes into a sum of
+  // negated per-subspace dot products plus this constant.
+  inline float offset() const {
+    return space == SpaceType::Euclidean ? 0.0f : 1.0f;
+  }
+
+  inline const float *getCentroid(size_t subspace, size_t centroid) const {
+    return centroids.data() +
+           (subspace * NUM_CENTROIDS + centroid) * subspaceDimensions;
+  }
+
+  inline float subspaceDistance(const float *a, const float *b) const {
+    float total = 0;
+    if (space == SpaceType::Euclidean) {
+      for (int i = 0; i < subspaceDimensions; i++) {
+        float difference = a[i] - b[i];
+        total += difference * difference;
+      }
+    } else {
+      for (int i = 0; i < subspaceDimensions; i++) {
+        total -= a[i] * b[i];
+      }
+    }
+    return total;
+  }
+
+  static inline float squaredDistance(const float *a, const float *b,
+                                      int dimensions) {
+    float total = 0;
+    for (int i = 0; i < dimensions; i++) {
+      float difference = a[i] - b[i];
+      total += difference * difference;
+    }
+    return total;
+  }
+
+  uint8_t findNearestCentroid(size_t subspace, const float *subvector) const {
+    // Codebooks are always learned (and searched) by Euclidean distance, which
+    // minimizes reconstruction error regardless of the index's space.
+    size_t best = 0;
+    float bestDistance = std::numeric_limits<float>::max();
+    for (size_t c = 0; c < NUM_CENTROIDS; c++) {
+      float distance = squaredDistance(subvector, getCentroid(subspace, c),
+                                       subspaceDimensions);
+      if (distance < bestDistance) {
+        bestDistance = distance;
+        best = c;
+      }
+    }
+    return (uint8_t)best;
+  }
+
+  void trainSubspace(const float *vectors, size_t numVectors, size_t subspace,
+                     size_t numIterations, size_t seed) {
+    size_t offset = subspace * subspaceDimensions;
+    float *codebook =
+        centroids.data() + subspace * NUM_CENTROIDS * subspaceDimensions;
+    std::default_random_engine generator(seed);
+
+    // Initialize centroids from a random selection of the sample. If there
+    // are fewer samples than centroids, some centroids will be duplicated.
+    std::vector<size_t> order(numVectors);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), generator);
+    for (size_t c = 0; c < NUM_CENTROIDS; c++) {
+      const float *sample =
+          vectors + order[c % numVectors] * numDimensions + offset;
+      std::copy(sample, sample + subspaceDimensions,
+                codebook + c * subspaceDimensions);
+    }
+
+    std::vector<uint8_t> assignments(numVectors);
+    std::vector<float> sums(NUM_CENTROIDS * subspaceDimensions);
+    std::vector<size_t> counts(NUM_CENTROIDS);
+    std::uniform_int_distribution<size_t> randomSample(0, numVectors - 1);
+
+    for (size_t iteration = 0; iteration < numIterations; iteration++) {
+      for (size_t i = 0; i < numVectors; i++) {
+        assignments[i] =
+            findNearestCentroid(subspace, vectors + i * numDimensions + offset);
+      }
+
+      std::fill(sums.begin(), sums.end(), 0.0f);
+      std::fill(counts.begin(), counts.end(), 0);
+      for (size_t i = 0; i < numVectors; i++) {
+        const float *sample = vectors + i * numDimensions + offset;
+        float *sum = sums.data() + assignments[i] * subspaceDimensions;
+        for (int d = 0; d < subspaceDimensions; d++) {
+          sum[d] += sample[d];
+        }
+        counts[assignments[i]]++;
+      }
+
+      for (size_t c = 0; c < NUM_CENTROIDS; c++) {
+        float *centroid = codebook + c * subspaceDimensions;
+        if (counts[c] == 0) {
+          // Re-seed empty clusters from a random sample:
+          const float *sample =
+              vectors + randomSample(generator) * numDimensions + offset;
+          std::copy(sample, sample + subspaceDimensions, centroid);
+          continue;
+        }
+        for (int d = 0; d < subspaceDimensions; d++) {
+          centroid[d] = sums[c * subspaceDimensions + d] / counts[c];
+        }
+      }
+    }
+  }
+
+  void computeSymmetricDistanceTables() {
+    symmetricDistanceTables.resize(numSubspaces * NUM_CENTROIDS *
+                                   NUM_CENTROIDS);
+    for (int subspace = 0; subspace < numSubspaces; subspace++) {
+      for (size_t a = 0; a < NUM_CENTROIDS; a++) {
+        for (size_t b = 0; b < NUM_CENTROIDS; b++) {
+          symmetricDistanceTables[(subspace * NUM_CENTROIDS + a) *
+                                      NUM_CENTROIDS +
+                                  b] =
+              subspaceDistance(getCentroid(subspace, a),
+                               getCentroid(subspace, b));
+        }
+      }
+    }
+  }
+};
@@ -0,0 +1,252 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "hnswlib.h"
+#include "stats.h"
+
+/**
+ * A bounded cache of query results, for workloads in which the same query
+ * vectors (i.e.: the same user or seed embedding) are searched for repeatedly
+ * within a short period of time.
+ *
+ * Results are keyed on the bytes of a query vector (as converted to the
+ * index's storage data type) along with every other parameter that affects
+ * the results of a query. Entries are split between several independently
+ * locked shards, each of which evicts its least-recently-used entries once
+ * full, so that concurrent queries rarely contend for the same lock.
+ *
+ * Anything that changes the results a query could return (i.e.: adding or
+ * deleting elements) must call invalidate(), which bumps a generation counter.
+ * Entries from older generations are never returned, and are discarded when
+ * next looked up or evicted.
+ *
+ * The cache is disabled (and costs nothing more than an atomic load per
+ * query) until setMaxEntries() is called with a non-zero size.
+ */
+class QueryCache {
+public:
+  QueryCache() = default;
+  QueryCache(const QueryCache &) = delete;
+  QueryCache &operator=(const QueryCache &) = delete;
+
+  /**
+   * Build the key identifying a query: the bytes of its (converted) vector,
+   * followed by the other parameters that determine its results.
+   */
+  static std::string makeKey(const void *vector, size_t vectorBytes, size_t k,
+                             long queryEf, size_t rerankK) {
+    std::string key(vectorBytes + sizeof(k) + sizeof(queryEf) + sizeof(rerankK),
+                    '\0');
+    char *output = key.data();
+    std::memcpy(output, vector, vectorBytes);
+    output += vectorBytes;
+    std::memcpy(output, &k, sizeof(k));
+    output += sizeof(k);
+    std::memcpy(output, &queryEf, sizeof(queryEf));
+    output += sizeof(queryEf);
+    std::memcpy(output, &rerankK, sizeof(rerankK));
+    return key;
+  }
+
+  bool isEnabled() const {
+    return maxEntries.load(std::memory_order_relaxed) > 0;
+  }
+
+  size_t getMaxEntries() const {
+    return maxEntries.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Set the maximum number of query results to keep (split evenly between
+   * shards), evicting entries if necessary. A size of 0 disables the cache
+   * and frees all of its entries.
+   */
+  void setMaxEntries(size_t newMaxEntries) {
+    size_t entriesPerShard = (newMaxEntries + NUM_SHARDS - 1) / NUM_SHARDS;
+    for (Shard &shard : shards) {
+      std::unique_lock<std::mutex> lock(shard.lock);
+      shard.maxEntries = entriesPerShard;
+      shard.evictLocked();
+    }
+    maxEntries.store(newMaxEntries, std::memory_order_relaxed);
+    // Changes made while the cache was disabled didn't invalidate it, so any
+    // query that started before then must not insert its results:
+    generation.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  /**
+   * The current generation, which must be read before a query is searched
+   * and passed to insert() along with its results.
+   */
+  uint64_t getGeneration() const {
+    return generation.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Mark every cached result as stale. Does nothing while the cache is
+   * disabled, as nothing can be cached then.
+   */
+  void invalidate() {
+    if (isEnabled()) {
+      generation.fetch_add(1, std::memory_order_acq_rel);
+    }
+  }
+
+  /**
+   * Invalidates the cache once when destroyed, so that a batch of changes
+   * (i.e.: every insertion made by one call to addItems, even if it throws)
+   * doesn't invalidate it once per change.
+   */
+  class ScopedInvalidation {
+  public:
+    explicit ScopedInvalidation(QueryCache &cache) : cache(cache) {}
+    ScopedInvalidation(const ScopedInvalidation &) = delete;
+    ScopedInvalidation &operator=(const ScopedInvalidation &) = delete;
+    ~ScopedInvalidation() { cache.invalidate(); }
+
+  private:
+    QueryCache &cache;
+  };
+
+  /**
+   * If results for `key` are cached (and not stale), copy its `k` results
+   * into `labels` and `distances` and return true. Hits and misses are counted
+   * on the calling thread's stats counters.
+   */
+  bool lookup(const std::string &key, size_t k, hnswlib::labeltype *labels,
+              float *distances) {
+    hnswlib::ThreadCounters &counters = hnswlib::ThreadCounters::get();
+    Shard &shard = getShard(key);
+    std::unique_lock<std::mutex> lock(shard.lock);
+    auto it = shard.entries.find(key);
+    if (it == shard.entries.end()) {
+      counters.queryCacheMisses++;
+      return false;
+    }
+
+    auto entry = it->second;
+    if (entry->generation != getGeneration() || entry->labels.size() != k) {
+      shard.entries.erase(it);
+      shard.order.erase(entry);
+      counters.queryCacheMisses++;
+      return false;
+    }
+
+    shard.order.splice(shard.order.begin(), shard.order, entry);
+    std::copy(entry->labels.begin(), entry->labels.end(), labels);
+    std::copy(entry->distances.begin(), entry->distances.end(), distances);
+    counters.queryCacheHits++;
+    return true;
+  }
+
+  /**
+   * Cache the `k` results of the query identified by `key`, which was
+   * searched in the given generation. Results from a generation that has
+   * since been invalidated are dropped.
+   */
+  void insert(const std::string &key, uint64_t queryGeneration, size_t k,
+              const hnswlib::labeltype *labels, const float *distances) {
+    if (queryGeneration != getGeneration()) {
+      return;
+    }
+
+    Shard &shard = getShard(key);
+    std::unique_lock<std::mutex> lock(shard.lock);
+    if (shard.maxEntries == 0) {
+      return;
+    }
+
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+      // The map's key points into the entry, so must be erased first:
+      auto entry = it->second;
+      shard.entries.erase(it);
+      shard.order.erase(entry);
+    }
+
+    shard.order.push_front(Entry{key, queryGeneration,
+                                 std::vector<hnswlib::labeltype>(labels,
+                                                                 labels + k),
+                                 std::vector<float>(distances, distances + k)});
+    shard.entries[shard.order.front().key] = shard.order.begin();
+    shard.evictLocked();
+  }
+
+  /**
+   * The number of entries currently cached, including any stale entries that
+   * have yet to be discarded.
+   */
+  size_t size() const {
+    size_t total = 0;
+    for (const Shard &shard : shards) {
+      std::unique_lock<std::mutex> lock(shard.lock);
+      total += shard.order.size();
+    }
+    return total;
+  }
+
+private:
+  static constexpr size_t NUM_SHARDS = 16;
+
+  struct Entry {
+    std::string key;
+    uint64_t generation;
+    std::vector<hnswlib::labeltype> labels;
+    std::vector<float> distances;
+  };
+
+  struct alignas(64) Shard {
+    mutable std::mutex lock;
+    size_t maxEntries = 0;
+    // Most-recently-used first. Each entry's key is owned by the entry
+    // itself and referenced from `entries`:
+    std::list<Entry> order;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> entries;
+
+    void evictLocked() {
+      while (order.size() > maxEntries) {
+        entries.erase(order.back().key);
+        order.pop_back();
+      }
+    }
+  };
+
+  std::atomic<size_t> maxEntries{0};
+  std::atomic<uint64_t> generation{0};
+  std::array<Shard, NUM_SHARDS> shards;
+
+  Shard &getShard(const std::string &key) {
+    return shards[std::hash<std::string>()(key) % NUM_SHARDS];
+  }
+};
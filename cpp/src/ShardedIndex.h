@@ -0,0 +1,1095 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AsyncQueryBatcher.h"
+#include "Enums.h"
+#include "Index.h"
+#include "PQIndex.h"
+#include "TypedIndex.h"
+#include "index_utils.h"
+#include "numa_topology.h"
+#include "stats.h"
+#include "std_utils.h"
+
+/**
+ * An Index made up of several smaller indices ("shards"), each of which can
+ * live on its own NUMA node: its memory is bound to that node, and its work
+ * runs on a pool of threads pinned to that node's CPUs. This avoids queries
+ * loading vectors across the interconnect between sockets.
+ *
+ * With ShardingMode::Partitioned, each element is stored in the shard chosen
+ * by its ID, and queries search all shards at once before merging their
+ * results. With ShardingMode::Replicated, every shard stores every element,
+ * and each query is answered by a replica on the caller's NUMA node.
+ *
+ * On machines without NUMA, shards use the same memory and threads as any
+ * other index.
+ */
+class ShardedIndex : public Index {
+public:
+  /**
+   * Create an empty index with `numShards` shards (or one per NUMA node, if
+   * zero), each created with the given parameters. Shard `i` is placed on NUMA
+   * node `i % numNodes`.
+   *
+   * `maxElements` is the expected size of the whole index, and is divided
+   * among the shards of a partitioned index.
+   */
+  ShardedIndex(const SpaceType space, const int dimensions,
+               const ShardingMode mode, size_t numShards = 0,
+               const size_t M = 12, const size_t efConstruction = 200,
+               const size_t randomSeed = 1, const size_t maxElements = 1,
+               const StorageDataType storageDataType = StorageDataType::Float32,
+               const int numSubspaces = 0)
+      : mode(mode) {
+    const NumaTopology &topology = NumaTopology::get();
+    if (numShards == 0) {
+      numShards = topology.getNumNodes();
+    }
+
+    size_t maxElementsPerShard =
+        mode == ShardingMode::Partitioned
+            ? (maxElements + numShards - 1) / numShards
+            : maxElements;
+
+    for (size_t i = 0; i < numShards; i++) {
+      size_t node = i % topology.getNumNodes();
+      hnswlib::MemoryPolicy memoryPolicy;
+      memoryPolicy.numaNode = topology.getNodeId(node);
+
+      std::shared_ptr<Index> shard = createShard(
+          space, dimensions, M, efConstruction, randomSeed,
+          std::max<size_t>(maxElementsPerShard, 1), storageDataType,
+          numSubspaces, memoryPolicy);
+      if (topology.getNumNodes() > 1) {
+        shard->setThreadPool(getNodeThreadPool(node));
+        shard->setNumThreads(topology.getCpus(node).size());
+      }
+      shards.push_back(shard);
+      shardNodes.push_back(node);
+    }
+  }
+
+  /**
+   * Combine existing indices (i.e.: shards previously saved individually
+   * with getShard(i)->saveIndex(...)) into one. All shards must share the
+   * same space and number of dimensions; replicas must hold the same
+   * elements, and partitions must have been filled by a ShardedIndex with the
+   * same number of shards.
+   */
+  ShardedIndex(std::vector<std::shared_ptr<Index>> shards,
+               const ShardingMode mode)
+      : mode(mode), shards(shards), shardNodes(shards.size(), 0) {
+    if (shards.empty()) {
+      throw std::invalid_argument("At least one shard must be provided.");
+    }
+    for (const std::shared_ptr<Index> &shard : shards) {
+      if (!shard) {
+        throw std::invalid_argument("Shards must not be null.");
+      }
+      if (shard->getSpace() != shards[0]->getSpace() ||
+          shard->getNumDimensions() != shards[0]->getNumDimensions()) {
+        throw std::invalid_argument(
+            "All shards must use the same space and number of dimensions.");
+      }
+    }
+    resetCurrentLabel();
+  }
+
+  ShardingMode getShardingMode() const { return mode; }
+
+  size_t getNumShards() const { return shards.size(); }
+
+  std::shared_ptr<Index> getShard(size_t i) const { return shards.at(i); }
+
+  void setEF(size_t ef) {
+    for (auto &shard : shards)
+      shard->setEF(ef);
+  }
+
+  int getEF() const { return shards[0]->getEF(); }
+
+  void setPrefetchDepth(size_t depth) {
+    for (auto &shard : shards)
+      shard->setPrefetchDepth(depth);
+  }
+
+  size_t getPrefetchDepth() const { return shards[0]->getPrefetchDepth(); }
+
+  void setEarlyTerminationPatience(size_t patience) {
+    for (auto &shard : shards)
+      shard->setEarlyTerminationPatience(patience);
+  }
+
+  size_t getEarlyTerminationPatience() const {
+    return shards[0]->getEarlyTerminationPatience();
+  }
+
+  size_t calibrateEarlyTermination(NDArray<float, 2> queryVectors, int k,
+                                   float targetRecall, long queryEf = -1,
+                                   int numThreads = -1) {
+    return IndexUtils::calibrateEarlyTermination(*this, queryVectors, k,
+                                                 targetRecall, queryEf,
+                                                 numThreads);
+  }
+
+  /**
+   * Each shard keeps its own cache of up to `maxEntries` results. Queries of
+   * a partitioned index look up (and count hits and misses in) every shard.
+   */
+  void setQueryCacheSize(size_t maxEntries) {
+    for (auto &shard : shards)
+      shard->setQueryCacheSize(maxEntries);
+  }
+
+  size_t getQueryCacheSize() const { return shards[0]->getQueryCacheSize(); }
+
+  std::future<std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>>
+  queryAsync(std::vector<float> queryVector, int k = 1, long queryEf = -1,
+             size_t rerankK = 0) {
+    return asyncQueries.submit(std::move(queryVector), k, queryEf, rerankK);
+  }
+
+  void queryAsync(std::vector<float> queryVector, QueryCallback callback,
+                  int k = 1, long queryEf = -1, size_t rerankK = 0) {
+    asyncQueries.submit(std::move(queryVector), std::move(callback), k,
+                        queryEf, rerankK);
+  }
+
+  void setAsyncBatchWindow(std::chrono::microseconds window) {
+    asyncQueries.setWindow(window);
+  }
+
+  std::chrono::microseconds getAsyncBatchWindow() const {
+    return asyncQueries.getWindow();
+  }
+
+  SpaceType getSpace() const { return shards[0]->getSpace(); }
+
+  std::string getSpaceName() const { return shards[0]->getSpaceName(); }
+
+  StorageDataType getStorageDataType() const {
+    return shards[0]->getStorageDataType();
+  }
+
+  std::string getStorageDataTypeName() const {
+    return shards[0]->getStorageDataTypeName();
+  }
+
+  int getNumDimensions() const { return shards[0]->getNumDimensions(); }
+
+  /**
+   * Set the number of threads used by each shard.
+   */
+  void setNumThreads(int numThreads) {
+    for (auto &shard : shards)
+      shard->setNumThreads(numThreads);
+  }
+
+  int getNumThreads() { return shards[0]->getNumThreads(); }
+
+  /**
+   * Run the work of every shard on the given pool, rather than on pools
+   * pinned to each shard's NUMA node.
+   */
+  void setThreadPool(std::shared_ptr<ThreadPool> threadPool) {
+    for (auto &shard : shards)
+      shard->setThreadPool(threadPool);
+  }
+
+  std::shared_ptr<ThreadPool> getThreadPool() {
+    return shards[0]->getThreadPool();
+  }
+
+  /**
+   * Save this index as a single regular index file. Only supported for
+   * replicated indices; the shards of a partitioned index must be saved
+   * individually with getShard(i)->saveIndex(...).
+   */
+  void saveIndex(const std::string &pathToIndex) {
+    getReplicaToSave("indices")->saveIndex(pathToIndex);
+  }
+
+  void saveIndex(std::shared_ptr<OutputStream> outputStream) {
+    getReplicaToSave("indices")->saveIndex(outputStream);
+  }
+
+  void saveCompressedIndex(const std::string &pathToIndex,
+                           int compressionLevel = DEFAULT_COMPRESSION_LEVEL) {
+    saveCompressedIndex(std::make_shared<FileOutputStream>(pathToIndex),
+                        compressionLevel);
+  }
+
+  void saveCompressedIndex(std::shared_ptr<OutputStream> outputStream,
+                           int compressionLevel = DEFAULT_COMPRESSION_LEVEL) {
+    IndexUtils::saveCompressedIndex(*this, outputStream, compressionLevel);
+  }
+
+  /**
+   * Replace the contents of every replica with the given index. Only
+   * supported for replicated indices.
+   */
+  void loadIndex(const std::string &pathToIndex, bool searchOnly = false) {
+    getReplicaToSave("indices");
+    forEachShard([&](size_t shard) {
+      shards[shard]->loadIndex(pathToIndex, searchOnly);
+    });
+    resetCurrentLabel();
+  }
+
+  void loadIndex(std::shared_ptr<InputStream> inputStream,
+                 bool searchOnly = false) {
+    getReplicaToSave("indices");
+    shards[0]->loadIndex(inputStream, searchOnly);
+    copyFirstReplica(
+        [](Index &index, std::shared_ptr<OutputStream> output) {
+          index.saveIndex(output);
+        },
+        [&](Index &index, std::shared_ptr<InputStream> input) {
+          index.loadIndex(input, searchOnly);
+        });
+    resetCurrentLabel();
+  }
+
+  void saveDelta(const std::string &pathToDelta) {
+    getReplicaToSave("index deltas")->saveDelta(pathToDelta);
+  }
+
+  void saveDelta(std::shared_ptr<OutputStream> outputStream) {
+    getReplicaToSave("index deltas")->saveDelta(outputStream);
+  }
+
+  /**
+   * Apply the given delta to every replica. Only supported for replicated
+   * indices.
+   */
+  void applyDelta(const std::string &pathToDelta) {
+    getReplicaToSave("index deltas");
+    forEachShard(
+        [&](size_t shard) { shards[shard]->applyDelta(pathToDelta); });
+    resetCurrentLabel();
+  }
+
+  void applyDelta(std::shared_ptr<InputStream> inputStream) {
+    getReplicaToSave("index deltas");
+    // Each replica reads the delta separately, so read it only once:
+    std::string delta;
+    std::vector<char> chunk(1024 * 1024);
+    long long bytesRead;
+    while ((bytesRead = inputStream->read(chunk.data(), chunk.size())) > 0) {
+      delta.append(chunk.data(), bytesRead);
+    }
+    forEachShard([&](size_t shard) {
+      shards[shard]->applyDelta(std::make_shared<MemoryInputStream>(delta));
+    });
+    resetCurrentLabel();
+  }
+
+  float getDistance(std::vector<float> a, std::vector<float> b) {
+    return shards[0]->getDistance(a, b);
+  }
+
+  NDArray<float, 2> getDistances(NDArray<float, 2> queries,
+                                 NDArray<float, 2> targets,
+                                 int numThreads = -1) {
+    return shards[0]->getDistances(queries, targets, numThreads);
+  }
+
+  hnswlib::labeltype addItem(const std::vector<float> &vector,
+                             std::optional<hnswlib::labeltype> id) {
+    return addItem(vector.data(), vector.size(), id);
+  }
+
+  hnswlib::labeltype addItem(const float *vector, size_t numDimensions,
+                             std::optional<hnswlib::labeltype> id) {
+    hnswlib::labeltype label = id ? *id : currentLabel.fetch_add(1);
+    if (mode == ShardingMode::Partitioned) {
+      getShardFor(label).addItem(vector, numDimensions, label);
+    } else {
+      forEachShard([&](size_t shard) {
+        shards[shard]->addItem(vector, numDimensions, label);
+      });
+    }
+    return label;
+  }
+
+  std::vector<hnswlib::labeltype>
+  addItems(std::vector<std::vector<float>> input,
+           std::vector<hnswlib::labeltype> ids = {}, int numThreads = -1) {
+    return addItems(vectorsToNDArray(input), ids, numThreads);
+  }
+
+  std::vector<hnswlib::labeltype> addItems(NDArray<float, 2> input,
+                                           std::vector<hnswlib::labeltype> ids,
+                                           int numThreads = -1) {
+    return addItemsToShards(input, ids, numThreads, &Index::addItems);
+  }
+
+  /**
+   * Bulk-builds each shard (concurrently) from the vectors that belong to
+   * it.
+   */
+  std::vector<hnswlib::labeltype>
+  bulkAddItems(NDArray<float, 2> input,
+               std::vector<hnswlib::labeltype> ids = {}, int numThreads = -1) {
+    return addItemsToShards(input, ids, numThreads, &Index::bulkAddItems);
+  }
+
+  std::vector<float> getVector(hnswlib::labeltype id) {
+    if (mode == ShardingMode::Partitioned) {
+      return getShardFor(id).getVector(id);
+    }
+    return shards[pickReplica()]->getVector(id);
+  }
+
+  NDArray<float, 2> getVectors(std::vector<hnswlib::labeltype> ids) {
+    int dimensions = getNumDimensions();
+    NDArray<float, 2> output({(int)ids.size(), dimensions});
+    for (size_t i = 0; i < ids.size(); i++) {
+      std::vector<float> vector = getVector(ids[i]);
+      std::copy(vector.begin(), vector.end(), output[i]);
+    }
+    return output;
+  }
+
+  size_t getVectorsInto(const hnswlib::labeltype *ids, size_t numIds,
+                        float *output, hnswlib::labeltype *copiedIds) {
+    if (mode == ShardingMode::Replicated) {
+      return shards[pickReplica()]->getVectorsInto(ids, numIds, output,
+                                                   copiedIds);
+    }
+
+    int dimensions = getNumDimensions();
+    size_t numCopied = 0;
+    for (size_t i = 0; i < numIds; i++) {
+      numCopied += getShardFor(ids[i]).getVectorsInto(
+          ids + i, 1, output + numCopied * dimensions, copiedIds + numCopied);
+    }
+    return numCopied;
+  }
+
+  std::vector<hnswlib::labeltype> getIDs() const {
+    if (mode == ShardingMode::Replicated) {
+      return shards[0]->getIDs();
+    }
+
+    std::vector<hnswlib::labeltype> ids;
+    for (auto &shard : shards) {
+      std::vector<hnswlib::labeltype> shardIds = shard->getIDs();
+      ids.insert(ids.end(), shardIds.begin(), shardIds.end());
+    }
+    return ids;
+  }
+
+  long long getIDsCount() const {
+    if (mode == ShardingMode::Replicated) {
+      return shards[0]->getIDsCount();
+    }
+
+    long long count = 0;
+    for (auto &shard : shards)
+      count += shard->getIDsCount();
+    return count;
+  }
+
+  /**
+   * For partitioned indices, the returned map is a snapshot of the IDs in
+   * every shard. Its values are internal IDs within each element's shard.
+   */
+  const std::unordered_map<hnswlib::labeltype, hnswlib::tableint> &
+  getIDsMap() const {
+    if (mode == ShardingMode::Replicated) {
+      return shards[0]->getIDsMap();
+    }
+
+    std::unique_lock<std::mutex> lock(idsMapLock);
+    idsMap.clear();
+    for (auto &shard : shards) {
+      const auto &shardMap = shard->getIDsMap();
+      idsMap.insert(shardMap.begin(), shardMap.end());
+    }
+    return idsMap;
+  }
+
+  void setStoreFullPrecisionVectors(bool enabled) {
+    for (auto &shard : shards)
+      shard->setStoreFullPrecisionVectors(enabled);
+  }
+
+  bool getStoreFullPrecisionVectors() const {
+    return shards[0]->getStoreFullPrecisionVectors();
+  }
+
+  void saveFullPrecisionVectors(const std::string &path) {
+    getReplicaToSave("full-precision vectors")->saveFullPrecisionVectors(path);
+  }
+
+  void saveFullPrecisionVectors(std::shared_ptr<OutputStream> outputStream) {
+    getReplicaToSave("full-precision vectors")
+        ->saveFullPrecisionVectors(outputStream);
+  }
+
+  void loadFullPrecisionVectors(const std::string &path,
+                                bool memoryMap = false) {
+    getReplicaToSave("full-precision vectors");
+    forEachShard([&](size_t shard) {
+      shards[shard]->loadFullPrecisionVectors(path, memoryMap);
+    });
+  }
+
+  void loadFullPrecisionVectors(std::shared_ptr<InputStream> inputStream,
+                                bool memoryMap = false) {
+    getReplicaToSave("full-precision vectors");
+    shards[0]->loadFullPrecisionVectors(inputStream, memoryMap);
+    copyFirstReplica(
+        [](Index &index, std::shared_ptr<OutputStream> output) {
+          index.saveFullPrecisionVectors(output);
+        },
+        [](Index &index, std::shared_ptr<InputStream> input) {
+          index.loadFullPrecisionVectors(input);
+        });
+  }
+
+  std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+  query(const std::vector<float> &queryVector, int k = 1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    std::vector<hnswlib::labeltype> labels(k);
+    std::vector<float> distances(k);
+    query(queryVector.data(), queryVector.size(), k, labels.data(),
+          distances.data(), queryEf, filter, rerankK);
+    return {labels, distances};
+  }
+
+  void query(const float *queryVector, size_t numDimensions, int k,
+             hnswlib::labeltype *labels, float *distances, long queryEf = -1,
+             const hnswlib::BaseFilterFunctor *filter = nullptr,
+             size_t rerankK = 0) {
+    if (mode == ShardingMode::Replicated) {
+      shards[pickReplica()]->query(queryVector, numDimensions, k, labels,
+                                   distances, queryEf, filter, rerankK);
+      return;
+    }
+
+    if (numDimensions != (size_t)getNumDimensions()) {
+      throw std::runtime_error(
+          "Query vector expected to share dimensionality with index.");
+    }
+    queryInto(queryVector, 1, k, labels, distances, 1, queryEf, filter,
+              rerankK);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  query(std::vector<std::vector<float>> queryVectors, int k = 1,
+        int numThreads = -1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    return query(vectorsToNDArray(queryVectors), k, numThreads, queryEf,
+                 filter, rerankK);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  query(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
+        long queryEf = -1, const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    int numRows = std::get<0>(queryVectors.shape);
+    int numFeatures = std::get<1>(queryVectors.shape);
+
+    if (numFeatures != getNumDimensions()) {
+      throw std::runtime_error(
+          "Query vectors expected to share dimensionality with index.");
+    }
+
+    NDArray<hnswlib::labeltype, 2> labels({numRows, k});
+    NDArray<float, 2> distances({numRows, k});
+    queryInto(queryVectors.data.data(), numRows, k, labels.data.data(),
+              distances.data.data(), numThreads, queryEf, filter, rerankK);
+    return {labels, distances};
+  }
+
+  /**
+   * Replicated indices split the queries between their replicas, which
+   * search concurrently. Partitioned indices search every shard for the
+   * nearest `k` neighbors of every query, then merge each query's results;
+   * any shard may find fewer than `k`, so long as `k` are found in total.
+   */
+  void queryInto(const float *queryVectors, size_t numQueries, int k,
+                 hnswlib::labeltype *labels, float *distances,
+                 int numThreads = -1, long queryEf = -1,
+                 const hnswlib::BaseFilterFunctor *filter = nullptr,
+                 size_t rerankK = 0, size_t *numResults = nullptr,
+                 long queryPatience = -1) {
+    size_t dimensions = getNumDimensions();
+
+    if (mode == ShardingMode::Replicated) {
+      size_t numReplicas =
+          std::min(shards.size(), std::max<size_t>(1, numQueries));
+      size_t first = pickReplica();
+      forEachShard(numReplicas, [&](size_t i) {
+        size_t start = (numQueries * i) / numReplicas;
+        size_t end = (numQueries * (i + 1)) / numReplicas;
+        if (end > start) {
+          shards[(first + i) % shards.size()]->queryInto(
+              queryVectors + (start * dimensions), end - start, k,
+              labels + (start * k), distances + (start * k), numThreads,
+              queryEf, filter, rerankK,
+              numResults ? numResults + start : nullptr, queryPatience);
+        }
+      });
+      return;
+    }
+
+    searchPartitions(
+        numQueries, k, labels, distances, numThreads, numResults,
+        checkNumMergedResults,
+        [&](Index &shard, int shardK, hnswlib::labeltype *labels,
+            float *distances, size_t *shardNumResults) {
+          shard.queryInto(queryVectors, numQueries, shardK, labels, distances,
+                          numThreads, queryEf, filter, rerankK,
+                          shardNumResults, queryPatience);
+        });
+  }
+
+  /**
+   * Replicated indices search a single replica. Partitioned indices search
+   * every shard and merge the results, as in queryInto.
+   */
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  bruteForceQuery(NDArray<float, 2> queryVectors, int k = 1,
+                  int numThreads = -1,
+                  const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    int numRows = std::get<0>(queryVectors.shape);
+    if (std::get<1>(queryVectors.shape) != getNumDimensions()) {
+      throw std::runtime_error(
+          "Query vectors expected to share dimensionality with index.");
+    }
+
+    NDArray<hnswlib::labeltype, 2> labels({numRows, k});
+    NDArray<float, 2> distances({numRows, k});
+    bruteForceQueryInto(queryVectors.data.data(), numRows, k,
+                        labels.data.data(), distances.data.data(), numThreads,
+                        filter);
+    return {labels, distances};
+  }
+
+  void bruteForceQueryInto(const float *queryVectors, size_t numQueries, int k,
+                           hnswlib::labeltype *labels, float *distances,
+                           int numThreads = -1,
+                           const hnswlib::BaseFilterFunctor *filter = nullptr,
+                           size_t *numResults = nullptr) {
+    if (mode == ShardingMode::Replicated) {
+      shards[pickReplica()]->bruteForceQueryInto(queryVectors, numQueries, k,
+                                                 labels, distances, numThreads,
+                                                 filter, numResults);
+      return;
+    }
+
+    searchPartitions(
+        numQueries, k, labels, distances, numThreads, numResults,
+        checkNumBruteForceResults,
+        [&](Index &shard, int shardK, hnswlib::labeltype *labels,
+            float *distances, size_t *shardNumResults) {
+          shard.bruteForceQueryInto(queryVectors, numQueries, shardK, labels,
+                                    distances, numThreads, filter,
+                                    shardNumResults);
+        });
+  }
+
+  /**
+   * Partitioned indices assign each ID's group in the shard holding that ID.
+   */
+  void setGroups(const std::vector<hnswlib::labeltype> &ids,
+                 const std::vector<hnswlib::labeltype> &groups) {
+    if (ids.size() != groups.size()) {
+      throw std::invalid_argument(
+          "Expected one group per ID, but got " + std::to_string(ids.size()) +
+          " IDs and " + std::to_string(groups.size()) + " groups.");
+    }
+    if (mode == ShardingMode::Replicated) {
+      forEachShard(
+          [&](size_t shard) { shards[shard]->setGroups(ids, groups); });
+      return;
+    }
+
+    std::vector<std::vector<hnswlib::labeltype>> shardIds(shards.size());
+    std::vector<std::vector<hnswlib::labeltype>> shardGroups(shards.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+      shardIds[ids[i] % shards.size()].push_back(ids[i]);
+      shardGroups[ids[i] % shards.size()].push_back(groups[i]);
+    }
+    forEachShard([&](size_t shard) {
+      shards[shard]->setGroups(shardIds[shard], shardGroups[shard]);
+    });
+  }
+
+  hnswlib::labeltype getGroup(hnswlib::labeltype id) {
+    if (mode == ShardingMode::Partitioned) {
+      return getShardFor(id).getGroup(id);
+    }
+    return shards[0]->getGroup(id);
+  }
+
+  /**
+   * Only supported by replicated indices, which search a single replica: a
+   * group's elements may be spread across the shards of a partitioned index,
+   * any of which may hold fewer than `k` groups.
+   */
+  void groupedQueryInto(const float *queryVectors, size_t numQueries, int k,
+                        hnswlib::labeltype *labels, float *distances,
+                        int numThreads = -1, long queryEf = -1,
+                        const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    if (mode != ShardingMode::Replicated) {
+      throw std::runtime_error(
+          "Grouped queries are not supported by partitioned indices; query "
+          "each shard individually instead.");
+    }
+    shards[pickReplica()]->groupedQueryInto(queryVectors, numQueries, k,
+                                            labels, distances, numThreads,
+                                            queryEf, filter);
+  }
+
+  std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+  groupedQuery(const std::vector<float> &queryVector, int k = 1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return IndexUtils::groupedQuery(*this, queryVector, k, queryEf, filter);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  groupedQuery(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return IndexUtils::groupedQuery(*this, queryVectors, k, numThreads,
+                                    queryEf, filter);
+  }
+
+  void markDeleted(hnswlib::labeltype label) {
+    if (mode == ShardingMode::Partitioned) {
+      getShardFor(label).markDeleted(label);
+    } else {
+      for (auto &shard : shards)
+        shard->markDeleted(label);
+    }
+  }
+
+  void unmarkDeleted(hnswlib::labeltype label) {
+    if (mode == ShardingMode::Partitioned) {
+      getShardFor(label).unmarkDeleted(label);
+    } else {
+      for (auto &shard : shards)
+        shard->unmarkDeleted(label);
+    }
+  }
+
+  /**
+   * Resize this index to hold `newSize` elements in total. Partitioned
+   * indices divide the new size evenly among their shards.
+   */
+  void resizeIndex(size_t newSize) {
+    size_t newShardSize = mode == ShardingMode::Partitioned
+                              ? (newSize + shards.size() - 1) / shards.size()
+                              : newSize;
+    forEachShard([&](size_t shard) {
+      shards[shard]->resizeIndex(
+          std::max(newShardSize, shards[shard]->getNumElements()));
+    });
+  }
+
+  void optimizeLayout() {
+    forEachShard([&](size_t shard) { shards[shard]->optimizeLayout(); });
+  }
+
+  void packForSearch() {
+    forEachShard([&](size_t shard) { shards[shard]->packForSearch(); });
+  }
+
+  /**
+   * Save this index as a single packed index file. As with saveIndex, only
+   * supported for replicated indices.
+   */
+  void savePackedIndex(const std::string &pathToIndex) {
+    getReplicaToSave("indices")->savePackedIndex(pathToIndex);
+  }
+
+  void savePackedIndex(std::shared_ptr<OutputStream> outputStream) {
+    getReplicaToSave("indices")->savePackedIndex(outputStream);
+  }
+
+  size_t compact() {
+    std::vector<size_t> removed(shards.size());
+    forEachShard(
+        [&](size_t shard) { removed[shard] = shards[shard]->compact(); });
+    if (mode == ShardingMode::Replicated) {
+      return removed[0];
+    }
+
+    size_t total = 0;
+    for (size_t n : removed)
+      total += n;
+    return total;
+  }
+
+  /**
+   * The sum of every shard's stats, except that each query (of a partitioned
+   * index) or insertion (into a replicated index) is only counted once, even
+   * though every shard does some of the work.
+   */
+  hnswlib::IndexStats getStats() const {
+    hnswlib::IndexStats total;
+    for (auto &shard : shards)
+      total += shard->getStats();
+
+    if (mode == ShardingMode::Replicated) {
+      hnswlib::IndexStats firstReplica = shards[0]->getStats();
+      total.numInserts = firstReplica.numInserts;
+      total.insertLatency = firstReplica.insertLatency;
+    } else {
+      hnswlib::IndexStats merged = stats.getStats();
+      total.numQueries = merged.numQueries;
+      total.queryLatency = merged.queryLatency;
+    }
+    return total;
+  }
+
+  void resetStats() {
+    stats.reset();
+    for (auto &shard : shards)
+      shard->resetStats();
+  }
+
+  size_t getMaxElements() const {
+    return sumOverPartitions(&Index::getMaxElements);
+  }
+
+  size_t getNumElements() const {
+    return sumOverPartitions(&Index::getNumElements);
+  }
+
+  size_t getEfConstruction() const { return shards[0]->getEfConstruction(); }
+
+  size_t getM() const { return shards[0]->getM(); }
+
+private:
+  const ShardingMode mode;
+  std::vector<std::shared_ptr<Index>> shards;
+  // The index (into NumaTopology's nodes) of the node each shard lives on:
+  std::vector<size_t> shardNodes;
+
+  std::atomic<hnswlib::labeltype> currentLabel{0};
+  std::atomic<size_t> nextReplica{0};
+
+  // The latencies of queries on a partitioned index, including the merge:
+  hnswlib::StatsCollector stats;
+
+  mutable std::mutex idsMapLock;
+  mutable std::unordered_map<hnswlib::labeltype, hnswlib::tableint> idsMap;
+
+  // Declared last, so that it's destroyed (finishing any queries still in
+  // flight) before anything those queries use:
+  AsyncQueryBatcher asyncQueries{*this};
+
+  static std::shared_ptr<Index>
+  createShard(const SpaceType space, const int dimensions, const size_t M,
+              const size_t efConstruction, const size_t randomSeed,
+              const size_t maxElements, const StorageDataType storageDataType,
+              const int numSubspaces,
+              const hnswlib::MemoryPolicy &memoryPolicy) {
+    switch (storageDataType) {
+    case StorageDataType::Float32:
+      return std::make_shared<TypedIndex<float>>(
+          space, dimensions, M, efConstruction, randomSeed, maxElements, true,
+          memoryPolicy);
+    case StorageDataType::Float8:
+      return std::make_shared<TypedIndex<float, int8_t, std::ratio<1, 127>>>(
+          space, dimensions, M, efConstruction, randomSeed, maxElements, true,
+          memoryPolicy);
+    case StorageDataType::E4M3:
+      return std::make_shared<TypedIndex<float, E4M3>>(
+          space, dimensions, M, efConstruction, randomSeed, maxElements, true,
+          memoryPolicy);
+    case StorageDataType::PQ:
+      return std::make_shared<PQIndex>(space, dimensions, numSubspaces, M,
+                                       efConstruction, randomSeed, maxElements,
+                                       false, memoryPolicy);
+    default:
+      throw std::runtime_error("Unknown storage data type received!");
+    }
+  }
+
+  /**
+   * The pool of workers pinned to the given NUMA node, shared by every
+   * ShardedIndex in the process.
+   */
+  static std::shared_ptr<ThreadPool> getNodeThreadPool(size_t node) {
+    static std::mutex poolsLock;
+    // Intentionally leaked, for the same reason as ThreadPool::getDefault():
+    static auto *pools = new std::vector<std::shared_ptr<ThreadPool>>(
+        NumaTopology::get().getNumNodes());
+
+    std::unique_lock<std::mutex> lock(poolsLock);
+    std::shared_ptr<ThreadPool> &pool = pools->at(node);
+    if (!pool) {
+      pool = std::make_shared<ThreadPool>(0, NumaTopology::get().getCpus(node));
+    }
+    return pool;
+  }
+
+  Index &getShardFor(hnswlib::labeltype label) const {
+    return *shards[label % shards.size()];
+  }
+
+  /**
+   * Choose the replica to answer a query: preferably one on the caller's
+   * NUMA node, otherwise the next one in turn.
+   */
+  size_t pickReplica() {
+    size_t start = nextReplica.fetch_add(1) % shards.size();
+    size_t node = NumaTopology::get().getCurrentNode();
+    for (size_t i = 0; i < shards.size(); i++) {
+      size_t replica = (start + i) % shards.size();
+      if (shardNodes[replica] == node) {
+        return replica;
+      }
+    }
+    return start;
+  }
+
+  using AddItemsFunction = std::vector<hnswlib::labeltype> (Index::*)(
+      NDArray<float, 2>, std::vector<hnswlib::labeltype>, int);
+
+  /**
+   * Add `input` to every replica, or each of its rows to the partition it
+   * belongs to, by calling `add` on each shard.
+   */
+  std::vector<hnswlib::labeltype>
+  addItemsToShards(NDArray<float, 2> &input,
+                   std::vector<hnswlib::labeltype> ids, int numThreads,
+                   AddItemsFunction add) {
+    size_t rows = std::get<0>(input.shape);
+    size_t dimensions = std::get<1>(input.shape);
+    if (!ids.empty() && ids.size() != rows) {
+      throw std::runtime_error(
+          std::to_string(rows) + " vectors were provided, but " +
+          std::to_string(ids.size()) +
+          " IDs were provided. If providing IDs along with vectors, the number "
+          "of provided IDs must match the number of vectors.");
+    }
+    if (ids.empty()) {
+      ids.resize(rows);
+      for (size_t row = 0; row < rows; row++) {
+        ids[row] = currentLabel.fetch_add(1);
+      }
+    }
+
+    if (mode == ShardingMode::Replicated) {
+      forEachShard([&](size_t shard) {
+        (*shards[shard].*add)(input, ids, numThreads);
+      });
+      return ids;
+    }
+
+    std::vector<std::vector<size_t>> rowsByShard(shards.size());
+    for (size_t row = 0; row < rows; row++) {
+      rowsByShard[ids[row] % shards.size()].push_back(row);
+    }
+
+    forEachShard([&](size_t shard) {
+      const std::vector<size_t> &shardRows = rowsByShard[shard];
+      if (shardRows.empty()) {
+        return;
+      }
+
+      NDArray<float, 2> shardInput({(int)shardRows.size(), (int)dimensions});
+      std::vector<hnswlib::labeltype> shardIds(shardRows.size());
+      for (size_t i = 0; i < shardRows.size(); i++) {
+        std::copy(input[shardRows[i]], input[shardRows[i]] + dimensions,
+                  shardInput[i]);
+        shardIds[i] = ids[shardRows[i]];
+      }
+      (*shards[shard].*add)(shardInput, shardIds, numThreads);
+    });
+    return ids;
+  }
+
+  static void checkNumMergedResults(size_t numResults, int k) {
+    if (numResults < (size_t)k) {
+      throw RecallError(
+          "Fewer than expected results were retrieved; only found " +
+          std::to_string(numResults) + " of " + std::to_string(k) +
+          " requested neighbors. Reconstruct the index with a higher M value "
+          "to increase recall.");
+    }
+  }
+
+  /**
+   * Find up to `k` nearest neighbors of every query in every partition, by
+   * calling `searchShard(shard, shardK, labels, distances, numResults)`, then
+   * merge each query's results into `labels` and `distances`.
+   *
+   * Shards may each find fewer than `k` neighbors (i.e.: if most of their
+   * elements are deleted or rejected by a filter); only queries that find
+   * fewer than `k` in total are passed to `checkNumResults`, unless the
+   * caller provided `numResults` to receive the number each query found.
+   */
+  template <typename SearchShard>
+  void searchPartitions(size_t numQueries, int k, hnswlib::labeltype *labels,
+                        float *distances, int numThreads, size_t *numResults,
+                        void (*checkNumResults)(size_t, int),
+                        SearchShard searchShard) {
+    auto queryStart = std::chrono::steady_clock::now();
+
+    // Partitions smaller than `k` can return, at most, all of their elements:
+    std::vector<size_t> shardK(shards.size());
+    std::vector<std::vector<hnswlib::labeltype>> shardLabels(shards.size());
+    std::vector<std::vector<float>> shardDistances(shards.size());
+    std::vector<std::vector<size_t>> shardNumResults(shards.size());
+    for (size_t shard = 0; shard < shards.size(); shard++) {
+      shardK[shard] = std::min<size_t>(k, shards[shard]->getNumElements());
+      shardLabels[shard].resize(numQueries * shardK[shard]);
+      shardDistances[shard].resize(numQueries * shardK[shard]);
+      shardNumResults[shard].resize(numQueries, 0);
+    }
+
+    forEachShard([&](size_t shard) {
+      if (shardK[shard] > 0) {
+        searchShard(*shards[shard], shardK[shard], shardLabels[shard].data(),
+                    shardDistances[shard].data(),
+                    shardNumResults[shard].data());
+      }
+    });
+
+    // Each shard's results are sorted by distance, so a k-way merge of them
+    // yields the overall nearest neighbors:
+    ThreadPool::getDefault()->parallelFor(
+        0, numQueries, numThreads > 0 ? numThreads : getNumThreads(),
+        [&](size_t query, size_t) {
+          thread_local std::vector<size_t> positions;
+          positions.assign(shards.size(), 0);
+          int found = 0;
+          for (; found < k; found++) {
+            size_t best = shards.size();
+            float bestDistance = 0;
+            for (size_t shard = 0; shard < shards.size(); shard++) {
+              if (positions[shard] == shardNumResults[shard][query]) {
+                continue;
+              }
+              float distance =
+                  shardDistances[shard][query * shardK[shard] +
+                                        positions[shard]];
+              if (best == shards.size() || distance < bestDistance) {
+                best = shard;
+                bestDistance = distance;
+              }
+            }
+            if (best == shards.size()) {
+              break;
+            }
+
+            size_t offset = query * shardK[best] + positions[best]++;
+            labels[query * k + found] = shardLabels[best][offset];
+            distances[query * k + found] = bestDistance;
+          }
+
+          if (numResults) {
+            numResults[query] = found;
+          } else {
+            checkNumResults(found, k);
+          }
+        });
+    stats.recordQueries(numQueries, hnswlib::nanosecondsSince(queryStart));
+  }
+
+  /**
+   * Run `fn(shard)` for the first `numShards` shards concurrently.
+   */
+  template <typename Function>
+  void forEachShard(size_t numShards, Function fn) {
+    ThreadPool::getDefault()->parallelFor(
+        0, numShards, numShards, [&](size_t shard, size_t) { fn(shard); });
+  }
+
+  template <typename Function> void forEachShard(Function fn) {
+    forEachShard(shards.size(), fn);
+  }
+
+  /**
+   * Sharded indices can only be saved as (or loaded from) one file if
+   * they're replicated, in which case any replica can be saved.
+   */
+  Index *getReplicaToSave(const std::string &what) const {
+    if (mode != ShardingMode::Replicated) {
+      throw std::runtime_error(
+          "Partitioned indices cannot save or load " + what +
+          " as a single file; save or load each shard individually instead.");
+    }
+    return shards[0].get();
+  }
+
+  /**
+   * Copy the contents of the first replica into every other replica, by
+   * saving it with `save` and reading it back with `load`.
+   */
+  template <typename SaveFunction, typename LoadFunction>
+  void copyFirstReplica(SaveFunction save, LoadFunction load) {
+    if (shards.size() == 1) {
+      return;
+    }
+    auto output = std::make_shared<MemoryOutputStream>();
+    save(*shards[0], output);
+    std::string contents = output->getValue();
+    forEachShard(shards.size() - 1, [&](size_t i) {
+      load(*shards[i + 1], std::make_shared<MemoryInputStream>(contents));
+    });
+  }
+
+  size_t sumOverPartitions(size_t (Index::*getter)() const) const {
+    if (mode == ShardingMode::Replicated) {
+      return (*shards[0].*getter)();
+    }
+
+    size_t total = 0;
+    for (auto &shard : shards)
+      total += (*shard.*getter)();
+    return total;
+  }
+
+  /**
+   * Continue assigning IDs after the largest ID already in this index.
+   */
+  void resetCurrentLabel() {
+    hnswlib::labeltype next = 0;
+    for (hnswlib::labeltype id : getIDs()) {
+      next = std::max(next, id + 1);
+    }
+    currentLabel = next;
+  }
+};
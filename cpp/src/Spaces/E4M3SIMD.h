@@ -0,0 +1,112 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+#include "../E4M3.h"
+#include "../cpu_features.h"
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Helpers to decode runs of E4M3 values into SIMD registers of floats, used by
+ * the vectorized E4M3 distance functions in Euclidean.h and InnerProduct.h.
+ */
+namespace hnswlib {
+#if defined(USE_SSE)
+VOYAGER_TARGET("avx512f")
+static inline __m512 loadE4M3x16(const E4M3 *p) {
+  __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+  // The masked forms avoid GCC's _mm512_undefined_* placeholders, which
+  // trip -Wuninitialized in its own headers:
+  __m512i indices = _mm512_maskz_cvtepu8_epi32((__mmask16)0xFFFF, bytes);
+  return _mm512_mask_i32gather_ps(_mm512_setzero_ps(), (__mmask16)0xFFFF,
+                                  indices, ALL_E4M3_VALUES, 4);
+}
+
+VOYAGER_TARGET("avx2")
+static inline __m256 loadE4M3x8(const E4M3 *p) {
+  __m128i bytes = _mm_loadl_epi64((const __m128i *)p);
+  return _mm256_i32gather_ps(ALL_E4M3_VALUES, _mm256_cvtepu8_epi32(bytes), 4);
+}
+#endif
+
+#if defined(USE_NEON)
+/**
+ * NEON has no gather instruction, but every E4M3 value is exactly
+ * representable as a bfloat16 (i.e.: only the top 16 bits of its float32
+ * representation are ever set). This allows rebuilding each float from two
+ * byte-wide table lookups on the value's seven magnitude bits.
+ */
+struct E4M3NeonTables {
+  uint8x16x4_t high[2];
+  uint8x16x4_t low[2];
+
+  E4M3NeonTables() {
+    uint8_t highBytes[128];
+    uint8_t lowBytes[128];
+    for (int i = 0; i < 128; i++) {
+      // The sign is stored in the lowest bit, so even entries are positive:
+      uint32_t bits;
+      memcpy(&bits, &ALL_E4M3_VALUES[i << 1], sizeof(bits));
+      highBytes[i] = (bits >> 24) & 0xFF;
+      lowBytes[i] = (bits >> 16) & 0xFF;
+    }
+
+    for (int t = 0; t < 2; t++) {
+      for (int j = 0; j < 4; j++) {
+        high[t].val[j] = vld1q_u8(highBytes + (t * 64) + (j * 16));
+        low[t].val[j] = vld1q_u8(lowBytes + (t * 64) + (j * 16));
+      }
+    }
+  }
+
+  static const E4M3NeonTables &get() {
+    static const E4M3NeonTables tables;
+    return tables;
+  }
+};
+
+static inline float32x4x4_t loadE4M3x16(const E4M3 *p,
+                                        const E4M3NeonTables &tables) {
+  uint8x16_t bytes = vld1q_u8((const uint8_t *)p);
+  uint8x16_t index = vshrq_n_u8(bytes, 1);
+
+  // TBL returns zero for out-of-range indices and TBX leaves them untouched,
+  // so the two halves of each 128-entry table can be chained together:
+  uint8x16_t upperIndex = vsubq_u8(index, vdupq_n_u8(64));
+  uint8x16_t high = vqtbx4q_u8(vqtbl4q_u8(tables.high[0], index),
+                               tables.high[1], upperIndex);
+  uint8x16_t low = vqtbx4q_u8(vqtbl4q_u8(tables.low[0], index), tables.low[1],
+                              upperIndex);
+  high = vorrq_u8(high, vshlq_n_u8(vandq_u8(bytes, vdupq_n_u8(1)), 7));
+
+  uint8x16x2_t halves = vzipq_u8(low, high);
+  uint16x8_t first = vreinterpretq_u16_u8(halves.val[0]);
+  uint16x8_t second = vreinterpretq_u16_u8(halves.val[1]);
+
+  float32x4x4_t result;
+  result.val[0] = vreinterpretq_f32_u32(vshll_n_u16(vget_low_u16(first), 16));
+  result.val[1] = vreinterpretq_f32_u32(vshll_high_n_u16(first, 16));
+  result.val[2] = vreinterpretq_f32_u32(vshll_n_u16(vget_low_u16(second), 16));
+  result.val[3] = vreinterpretq_f32_u32(vshll_high_n_u16(second, 16));
+  return result;
+}
+#endif
+} // namespace hnswlib
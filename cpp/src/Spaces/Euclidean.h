@@ -22,8 +22,13 @@
  */
 
 #pragma once
+#include "E4M3SIMD.h"
+#include "ManyToOne.h"
 #include "Space.h"
+#include <algorithm>
+#include <cstdint>
 #include <ratio>
+#include <type_traits>
 
 namespace hnswlib {
 /**
@@ -62,11 +67,11 @@ static dist_t L2SqrAtLeast(const data_t *__restrict pVect1,
                                                remainder);
 }
 
-#if defined(USE_AVX512)
+#if defined(USE_SSE)
 
-// Favor using AVX512 if available.
-static float L2SqrSIMD16Ext(const float *pVect1, const float *pVect2,
-                            const size_t qty) {
+VOYAGER_TARGET("avx512f")
+static float L2SqrSIMD16ExtAVX512(const float *pVect1, const float *pVect2,
+                                  const size_t qty) {
   float PORTABLE_ALIGN64 TmpRes[16];
   size_t qty16 = qty >> 4;
 
@@ -94,11 +99,9 @@ static float L2SqrSIMD16Ext(const float *pVect1, const float *pVect2,
   return (res);
 }
 
-#elif defined(USE_AVX)
-
-// Favor using AVX if available.
-static float L2SqrSIMD16Ext(const float *pVect1, const float *pVect2,
-                            const size_t qty) {
+VOYAGER_TARGET("avx")
+static float L2SqrSIMD16ExtAVX(const float *pVect1, const float *pVect2,
+                               const size_t qty) {
   float PORTABLE_ALIGN32 TmpRes[8];
   size_t qty16 = qty >> 4;
 
@@ -128,10 +131,8 @@ static float L2SqrSIMD16Ext(const float *pVect1, const float *pVect2,
          TmpRes[6] + TmpRes[7];
 }
 
-#elif defined(USE_SSE)
-
-static float L2SqrSIMD16Ext(const float *pVect1, const float *pVect2,
-                            const size_t qty) {
+static float L2SqrSIMD16ExtSSE(const float *pVect1, const float *pVect2,
+                               const size_t qty) {
   float PORTABLE_ALIGN32 TmpRes[8];
   size_t qty16 = qty >> 4;
 
@@ -174,24 +175,9 @@ static float L2SqrSIMD16Ext(const float *pVect1, const float *pVect2,
   _mm_store_ps(TmpRes, sum);
   return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
 }
-#endif
-
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
-static float L2SqrSIMD16ExtResiduals(const float *pVect1, const float *pVect2,
-                                     const size_t qty) {
-  size_t qty16 = qty >> 4 << 4;
-  float res = L2SqrSIMD16Ext(pVect1, pVect2, qty16);
-
-  size_t qty_left = qty - qty16;
-  float res_tail =
-      L2Sqr<float, float>(pVect1 + qty16, pVect2 + qty16, qty_left);
-  return (res + res_tail);
-}
-#endif
 
-#ifdef USE_SSE
-static float L2SqrSIMD4Ext(const float *pVect1, const float *pVect2,
-                           const size_t qty) {
+static float L2SqrSIMD4ExtSSE(const float *pVect1, const float *pVect2,
+                              const size_t qty) {
   float PORTABLE_ALIGN32 TmpRes[8];
   size_t qty4 = qty >> 2;
 
@@ -212,28 +198,347 @@ static float L2SqrSIMD4Ext(const float *pVect1, const float *pVect2,
   return TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
 }
 
-static float L2SqrSIMD4ExtResiduals(const float *pVect1, const float *pVect2,
-                                    const size_t qty) {
-  size_t qty4 = qty >> 2 << 2;
+#elif defined(USE_NEON)
+
+static float L2SqrSIMD16ExtNEON(const float *pVect1, const float *pVect2,
+                                const size_t qty) {
+  size_t qty16 = qty >> 4;
+
+  const float *pEnd1 = pVect1 + (qty16 << 4);
+
+  float32x4_t sum1 = vdupq_n_f32(0);
+  float32x4_t sum2 = vdupq_n_f32(0);
+
+  while (pVect1 < pEnd1) {
+    float32x4_t diff = vsubq_f32(vld1q_f32(pVect1), vld1q_f32(pVect2));
+    sum1 = vfmaq_f32(sum1, diff, diff);
+    diff = vsubq_f32(vld1q_f32(pVect1 + 4), vld1q_f32(pVect2 + 4));
+    sum2 = vfmaq_f32(sum2, diff, diff);
+    diff = vsubq_f32(vld1q_f32(pVect1 + 8), vld1q_f32(pVect2 + 8));
+    sum1 = vfmaq_f32(sum1, diff, diff);
+    diff = vsubq_f32(vld1q_f32(pVect1 + 12), vld1q_f32(pVect2 + 12));
+    sum2 = vfmaq_f32(sum2, diff, diff);
+    pVect1 += 16;
+    pVect2 += 16;
+  }
+
+  return vaddvq_f32(vaddq_f32(sum1, sum2));
+}
+
+static float L2SqrSIMD4ExtNEON(const float *pVect1, const float *pVect2,
+                               const size_t qty) {
+  size_t qty4 = qty >> 2;
+
+  const float *pEnd1 = pVect1 + (qty4 << 2);
+
+  float32x4_t sum = vdupq_n_f32(0);
+
+  while (pVect1 < pEnd1) {
+    float32x4_t diff = vsubq_f32(vld1q_f32(pVect1), vld1q_f32(pVect2));
+    sum = vfmaq_f32(sum, diff, diff);
+    pVect1 += 4;
+    pVect2 += 4;
+  }
+
+  return vaddvq_f32(sum);
+}
 
-  float res = L2SqrSIMD4Ext(pVect1, pVect2, qty4);
-  size_t qty_left = qty - qty4;
+#endif
 
-  float res_tail = L2Sqr<float, float>(pVect1 + qty4, pVect2 + qty4, qty_left);
+#if defined(USE_SSE) || defined(USE_NEON)
+/**
+ * Apply a SIMD kernel that handles multiples of `Stride` elements to the start
+ * of each vector, and handle any remaining elements with the scalar code.
+ */
+template <DISTFUNC_PTR<float> kernel, size_t Stride>
+static float L2SqrSIMDExtResiduals(const float *pVect1, const float *pVect2,
+                                   const size_t qty) {
+  size_t qtyStride = qty / Stride * Stride;
+  float res = kernel(pVect1, pVect2, qtyStride);
 
+  size_t qty_left = qty - qtyStride;
+  float res_tail =
+      L2Sqr<float, float>(pVect1 + qtyStride, pVect2 + qtyStride, qty_left);
   return (res + res_tail);
 }
+
+/**
+ * Choose between the provided float SIMD kernels (which handle multiples of 16
+ * and 4 elements respectively) for vectors of the given dimensionality.
+ */
+template <DISTFUNC_PTR<float> simd16, DISTFUNC_PTR<float> simd4>
+static DISTFUNC_PTR<float> selectL2SqrSIMD(size_t dim) {
+  if (dim % 16 == 0)
+    return simd16;
+  else if (dim % 4 == 0)
+    return simd4;
+  else if (dim > 16)
+    return L2SqrSIMDExtResiduals<simd16, 16>;
+  else if (dim > 4)
+    return L2SqrSIMDExtResiduals<simd4, 4>;
+  return L2Sqr<float, float>;
+}
+
+/**
+ * The largest number of int8 elements whose squared differences can be summed
+ * without overflowing a 32-bit accumulator: 32768 * (255 ** 2) < 2 ** 31.
+ */
+static constexpr size_t L2_SQR_INT8_BLOCK_SIZE = 32768;
+
+/**
+ * The L2SqrInt8Block* functions calculate the exact (unscaled) L2 squared
+ * distance between two int8 vectors of at most L2_SQR_INT8_BLOCK_SIZE
+ * elements. Differences between two int8 values don't fit in eight bits, so
+ * each lane is widened to 16 bits (or, with the NEON dot product extension, to
+ * an unsigned absolute difference) first. Any leftover elements are handled
+ * here:
+ */
+static int32_t L2SqrInt8Scalar(const int8_t *pVect1, const int8_t *pVect2,
+                               const size_t qty) {
+  int32_t res = 0;
+  for (size_t i = 0; i < qty; i++) {
+    int32_t diff = (int32_t)pVect1[i] - (int32_t)pVect2[i];
+    res += diff * diff;
+  }
+  return res;
+}
+#endif
+
+#if defined(USE_SSE)
+VOYAGER_TARGET("avx512f,avx512bw,avx512vnni")
+static int32_t L2SqrInt8BlockAVX512VNNI(const int8_t *pVect1,
+                                        const int8_t *pVect2,
+                                        const size_t qty) {
+  size_t i = 0;
+  __m512i sum = _mm512_setzero_si512();
+  for (; i + 32 <= qty; i += 32) {
+    __m512i v1 =
+        _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(pVect1 + i)));
+    __m512i v2 =
+        _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(pVect2 + i)));
+    __m512i diff = _mm512_sub_epi16(v1, v2);
+    sum = _mm512_dpwssd_epi32(sum, diff, diff);
+  }
+  return sumLanesAVX512(sum) +
+         L2SqrInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+
+VOYAGER_TARGET("avx512f,avx512bw")
+static int32_t L2SqrInt8BlockAVX512BW(const int8_t *pVect1,
+                                      const int8_t *pVect2, const size_t qty) {
+  size_t i = 0;
+  __m512i sum = _mm512_setzero_si512();
+  for (; i + 32 <= qty; i += 32) {
+    __m512i v1 =
+        _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(pVect1 + i)));
+    __m512i v2 =
+        _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(pVect2 + i)));
+    __m512i diff = _mm512_sub_epi16(v1, v2);
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(diff, diff));
+  }
+  return sumLanesAVX512(sum) +
+         L2SqrInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+
+VOYAGER_TARGET("avx2")
+static int32_t L2SqrInt8BlockAVX2(const int8_t *pVect1, const int8_t *pVect2,
+                                  const size_t qty) {
+  size_t i = 0;
+  __m256i sum = _mm256_setzero_si256();
+  for (; i + 16 <= qty; i += 16) {
+    __m256i v1 =
+        _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(pVect1 + i)));
+    __m256i v2 =
+        _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(pVect2 + i)));
+    __m256i diff = _mm256_sub_epi16(v1, v2);
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(diff, diff));
+  }
+  __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                 _mm256_extracti128_si256(sum, 1));
+  sum128 = _mm_hadd_epi32(sum128, sum128);
+  sum128 = _mm_hadd_epi32(sum128, sum128);
+  return _mm_cvtsi128_si32(sum128) +
+         L2SqrInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+
+VOYAGER_TARGET("avx512f")
+static float L2SqrE4M3AVX512(const E4M3 *pVect1, const E4M3 *pVect2,
+                             const size_t qty) {
+  size_t i = 0;
+  __m512 sum = _mm512_set1_ps(0);
+  for (; i + 16 <= qty; i += 16) {
+    __m512 diff =
+        _mm512_sub_ps(loadE4M3x16(pVect1 + i), loadE4M3x16(pVect2 + i));
+    sum = _mm512_add_ps(sum, _mm512_mul_ps(diff, diff));
+  }
+  float res = sumLanesAVX512(sum);
+
+  return res + L2Sqr<float, E4M3>(pVect1 + i, pVect2 + i, qty - i);
+}
+
+VOYAGER_TARGET("avx2")
+static float L2SqrE4M3AVX2(const E4M3 *pVect1, const E4M3 *pVect2,
+                           const size_t qty) {
+  float PORTABLE_ALIGN32 TmpRes[8];
+  size_t i = 0;
+  __m256 sum = _mm256_set1_ps(0);
+  for (; i + 8 <= qty; i += 8) {
+    __m256 diff = _mm256_sub_ps(loadE4M3x8(pVect1 + i), loadE4M3x8(pVect2 + i));
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+  }
+  _mm256_store_ps(TmpRes, sum);
+  float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] +
+              TmpRes[5] + TmpRes[6] + TmpRes[7];
+
+  return res + L2Sqr<float, E4M3>(pVect1 + i, pVect2 + i, qty - i);
+}
+
+#elif defined(USE_NEON)
+
+#if defined(USE_NEON_DOTPROD)
+VOYAGER_TARGET_NEON_DOTPROD
+static int32_t L2SqrInt8BlockNEONDotProd(const int8_t *pVect1,
+                                         const int8_t *pVect2,
+                                         const size_t qty) {
+  size_t i = 0;
+  uint32x4_t sum = vdupq_n_u32(0);
+  for (; i + 16 <= qty; i += 16) {
+    uint8x16_t diff = vreinterpretq_u8_s8(
+        vabdq_s8(vld1q_s8(pVect1 + i), vld1q_s8(pVect2 + i)));
+    sum = vdotq_u32(sum, diff, diff);
+  }
+  return (int32_t)vaddvq_u32(sum) +
+         L2SqrInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+#endif
+
+static int32_t L2SqrInt8BlockNEON(const int8_t *pVect1, const int8_t *pVect2,
+                                  const size_t qty) {
+  size_t i = 0;
+  int32x4_t sum = vdupq_n_s32(0);
+  for (; i + 16 <= qty; i += 16) {
+    int8x16_t v1 = vld1q_s8(pVect1 + i);
+    int8x16_t v2 = vld1q_s8(pVect2 + i);
+    int16x8_t low = vsubl_s8(vget_low_s8(v1), vget_low_s8(v2));
+    int16x8_t high = vsubl_high_s8(v1, v2);
+    sum = vmlal_s16(sum, vget_low_s16(low), vget_low_s16(low));
+    sum = vmlal_high_s16(sum, low, low);
+    sum = vmlal_s16(sum, vget_low_s16(high), vget_low_s16(high));
+    sum = vmlal_high_s16(sum, high, high);
+  }
+  return vaddvq_s32(sum) + L2SqrInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+
+static float L2SqrE4M3NEON(const E4M3 *pVect1, const E4M3 *pVect2,
+                           const size_t qty) {
+  const E4M3NeonTables &tables = E4M3NeonTables::get();
+  size_t i = 0;
+  float32x4_t sum = vdupq_n_f32(0);
+  for (; i + 16 <= qty; i += 16) {
+    float32x4x4_t v1 = loadE4M3x16(pVect1 + i, tables);
+    float32x4x4_t v2 = loadE4M3x16(pVect2 + i, tables);
+    for (int j = 0; j < 4; j++) {
+      float32x4_t diff = vsubq_f32(v1.val[j], v2.val[j]);
+      sum = vfmaq_f32(sum, diff, diff);
+    }
+  }
+  float res = vaddvq_f32(sum);
+
+  return res + L2Sqr<float, E4M3>(pVect1 + i, pVect2 + i, qty - i);
+}
+
+#endif
+
+#if defined(USE_SSE) || defined(USE_NEON)
+template <typename scalefactor, DISTFUNC_PTR<int32_t, int8_t> kernel>
+static float L2SqrInt8SIMD(const int8_t *pVect1, const int8_t *pVect2,
+                           const size_t qty) {
+  int64_t res = 0;
+  for (size_t i = 0; i < qty; i += L2_SQR_INT8_BLOCK_SIZE) {
+    res += kernel(pVect1 + i, pVect2 + i,
+                  std::min(L2_SQR_INT8_BLOCK_SIZE, qty - i));
+  }
+
+  constexpr float scale = (float)scalefactor::num / (float)scalefactor::den;
+  return ((float)res * scale * scale);
+}
+
+/**
+ * Choose the fastest int8 L2 distance function supported by this CPU.
+ */
+template <typename scalefactor>
+static DISTFUNC_PTR<float, int8_t> selectL2SqrInt8() {
+  const CPUFeatures &cpu = CPUFeatures::get();
+#if defined(USE_SSE)
+  if (cpu.avx512vnni)
+    return L2SqrInt8SIMD<scalefactor, L2SqrInt8BlockAVX512VNNI>;
+  if (cpu.avx512bw)
+    return L2SqrInt8SIMD<scalefactor, L2SqrInt8BlockAVX512BW>;
+  if (cpu.avx2)
+    return L2SqrInt8SIMD<scalefactor, L2SqrInt8BlockAVX2>;
+#elif defined(USE_NEON)
+#if defined(USE_NEON_DOTPROD)
+  if (cpu.neonDotProd)
+    return L2SqrInt8SIMD<scalefactor, L2SqrInt8BlockNEONDotProd>;
+#endif
+  return L2SqrInt8SIMD<scalefactor, L2SqrInt8BlockNEON>;
+#endif
+  (void)cpu;
+  return nullptr;
+}
+
+template <typename scalefactor, DISTFUNC_PTR<float, E4M3> kernel>
+static float L2SqrE4M3SIMD(const E4M3 *pVect1, const E4M3 *pVect2,
+                           const size_t qty) {
+  constexpr float scale = (float)scalefactor::num / (float)scalefactor::den;
+  return (kernel(pVect1, pVect2, qty) * scale * scale);
+}
+
+/**
+ * Choose the fastest E4M3 L2 distance function supported by this CPU.
+ */
+template <typename scalefactor>
+static DISTFUNC_PTR<float, E4M3> selectL2SqrE4M3() {
+#if defined(USE_SSE)
+  const CPUFeatures &cpu = CPUFeatures::get();
+  if (cpu.avx512f)
+    return L2SqrE4M3SIMD<scalefactor, L2SqrE4M3AVX512>;
+  if (cpu.avx2)
+    return L2SqrE4M3SIMD<scalefactor, L2SqrE4M3AVX2>;
+  return nullptr;
+#elif defined(USE_NEON)
+  return L2SqrE4M3SIMD<scalefactor, L2SqrE4M3NEON>;
+#endif
+}
 #endif
 
 template <typename dist_t, typename data_t = dist_t,
           typename scalefactor = std::ratio<1, 1>>
 class EuclideanSpace : public Space<dist_t, data_t> {
   DISTFUNC<dist_t, data_t> fstdistfunc_;
+  // Only set for spaces with a dedicated many-to-one kernel:
+  MULTIDISTFUNC<dist_t, data_t> fstmultidistfunc_;
   size_t data_size_;
   size_t dim_;
 
 public:
   EuclideanSpace(size_t dim) : data_size_(dim * sizeof(data_t)), dim_(dim) {
+#if defined(USE_SSE) || defined(USE_NEON)
+    DISTFUNC_PTR<dist_t, data_t> simdDistFunc = nullptr;
+    if constexpr (std::is_same<dist_t, float>::value &&
+                  std::is_same<data_t, int8_t>::value) {
+      simdDistFunc = selectL2SqrInt8<scalefactor>();
+    } else if constexpr (std::is_same<dist_t, float>::value &&
+                         std::is_same<data_t, E4M3>::value) {
+      simdDistFunc = selectL2SqrE4M3<scalefactor>();
+    }
+
+    if (simdDistFunc) {
+      fstdistfunc_ = simdDistFunc;
+      return;
+    }
+#endif
+
     if (dim % 128 == 0)
       fstdistfunc_ = L2Sqr<dist_t, data_t, 128, scalefactor>;
     else if (dim % 64 == 0)
@@ -267,6 +572,13 @@ public:
 
   DISTFUNC<dist_t, data_t> get_dist_func() { return fstdistfunc_; }
 
+  MULTIDISTFUNC<dist_t, data_t> get_multi_dist_func() {
+    if (fstmultidistfunc_) {
+      return fstmultidistfunc_;
+    }
+    return Space<dist_t, data_t>::get_multi_dist_func();
+  }
+
   size_t get_dist_func_param() { return dim_; }
 
   ~EuclideanSpace() {}
@@ -275,16 +587,19 @@ public:
 template <>
 EuclideanSpace<float, float>::EuclideanSpace(size_t dim)
     : data_size_(dim * sizeof(float)), dim_(dim) {
+  fstmultidistfunc_ = selectManyToOne</* Squared= */ true>();
   fstdistfunc_ = L2Sqr<float, float>;
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
-  if (dim % 16 == 0)
-    fstdistfunc_ = L2SqrSIMD16Ext;
-  else if (dim % 4 == 0)
-    fstdistfunc_ = L2SqrSIMD4Ext;
-  else if (dim > 16)
-    fstdistfunc_ = L2SqrSIMD16ExtResiduals;
-  else if (dim > 4)
-    fstdistfunc_ = L2SqrSIMD4ExtResiduals;
+#if defined(USE_SSE)
+  const CPUFeatures &cpu = CPUFeatures::get();
+  if (cpu.avx512f)
+    fstdistfunc_ = selectL2SqrSIMD<L2SqrSIMD16ExtAVX512, L2SqrSIMD4ExtSSE>(dim);
+  else if (cpu.avx)
+    fstdistfunc_ = selectL2SqrSIMD<L2SqrSIMD16ExtAVX, L2SqrSIMD4ExtSSE>(dim);
+  else
+    fstdistfunc_ = selectL2SqrSIMD<L2SqrSIMD16ExtSSE, L2SqrSIMD4ExtSSE>(dim);
+#elif defined(USE_NEON)
+  fstdistfunc_ = selectL2SqrSIMD<L2SqrSIMD16ExtNEON, L2SqrSIMD4ExtNEON>(dim);
 #endif
 }
+
 } // namespace hnswlib
@@ -22,8 +22,13 @@
  */
 
 #pragma once
+#include "E4M3SIMD.h"
+#include "ManyToOne.h"
 #include "Space.h"
+#include <algorithm>
+#include <cstdint>
 #include <ratio>
+#include <type_traits>
 
 namespace hnswlib {
 /**
@@ -79,18 +84,47 @@ static dist_t InnerProductAtLeast(const data_t *__restrict pVect1,
   return res;
 }
 
-#if defined(USE_AVX)
+#if defined(USE_SSE)
 
-// Favor using AVX if available.
-static float InnerProductSIMD4Ext(const float *pVect1, const float *pVect2,
-                                  const size_t qty) {
+VOYAGER_TARGET("avx512f")
+static float InnerProductSIMD16ExtAVX512(const float *pVect1,
+                                         const float *pVect2,
+                                         const size_t qty) {
+  float PORTABLE_ALIGN64 TmpRes[16];
+
+  size_t qty16 = qty / 16;
+
+  const float *pEnd1 = pVect1 + 16 * qty16;
+
+  __m512 sum512 = _mm512_set1_ps(0);
+
+  while (pVect1 < pEnd1) {
+    //_mm_prefetch((char*)(pVect2 + 16), _MM_HINT_T0);
+
+    __m512 v1 = _mm512_loadu_ps(pVect1);
+    pVect1 += 16;
+    __m512 v2 = _mm512_loadu_ps(pVect2);
+    pVect2 += 16;
+    sum512 = _mm512_add_ps(sum512, _mm512_mul_ps(v1, v2));
+  }
+
+  _mm512_store_ps(TmpRes, sum512);
+  float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] +
+              TmpRes[5] + TmpRes[6] + TmpRes[7] + TmpRes[8] + TmpRes[9] +
+              TmpRes[10] + TmpRes[11] + TmpRes[12] + TmpRes[13] + TmpRes[14] +
+              TmpRes[15];
+
+  return 1.0f - sum;
+}
+
+VOYAGER_TARGET("avx")
+static float InnerProductSIMD16ExtAVX(const float *pVect1, const float *pVect2,
+                                      const size_t qty) {
   float PORTABLE_ALIGN32 TmpRes[8];
 
   size_t qty16 = qty / 16;
-  size_t qty4 = qty / 4;
 
   const float *pEnd1 = pVect1 + 16 * qty16;
-  const float *pEnd2 = pVect1 + 4 * qty4;
 
   __m256 sum256 = _mm256_set1_ps(0);
 
@@ -110,35 +144,19 @@ static float InnerProductSIMD4Ext(const float *pVect1, const float *pVect2,
     sum256 = _mm256_add_ps(sum256, _mm256_mul_ps(v1, v2));
   }
 
-  __m128 v1, v2;
-  __m128 sum_prod = _mm_add_ps(_mm256_extractf128_ps(sum256, 0),
-                               _mm256_extractf128_ps(sum256, 1));
-
-  while (pVect1 < pEnd2) {
-    v1 = _mm_loadu_ps(pVect1);
-    pVect1 += 4;
-    v2 = _mm_loadu_ps(pVect2);
-    pVect2 += 4;
-    sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
-  }
+  _mm256_store_ps(TmpRes, sum256);
+  float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] +
+              TmpRes[5] + TmpRes[6] + TmpRes[7];
 
-  _mm_store_ps(TmpRes, sum_prod);
-  float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
-  ;
   return 1.0f - sum;
 }
 
-#elif defined(USE_SSE)
-
-static float InnerProductSIMD4Ext(const float *pVect1, const float *pVect2,
-                                  const size_t qty) {
+static float InnerProductSIMD16ExtSSE(const float *pVect1, const float *pVect2,
+                                      const size_t qty) {
   float PORTABLE_ALIGN32 TmpRes[8];
-
   size_t qty16 = qty / 16;
-  size_t qty4 = qty / 4;
 
   const float *pEnd1 = pVect1 + 16 * qty16;
-  const float *pEnd2 = pVect1 + 4 * qty4;
 
   __m128 v1, v2;
   __m128 sum_prod = _mm_set1_ps(0);
@@ -168,63 +186,22 @@ static float InnerProductSIMD4Ext(const float *pVect1, const float *pVect2,
     pVect2 += 4;
     sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
   }
-
-  while (pVect1 < pEnd2) {
-    v1 = _mm_loadu_ps(pVect1);
-    pVect1 += 4;
-    v2 = _mm_loadu_ps(pVect2);
-    pVect2 += 4;
-    sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
-  }
-
   _mm_store_ps(TmpRes, sum_prod);
   float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
 
   return 1.0f - sum;
 }
 
-#endif
-
-#if defined(USE_AVX512)
-
-static float InnerProductSIMD16Ext(const float *pVect1, const float *pVect2,
-                                   const size_t qty) {
-  float PORTABLE_ALIGN64 TmpRes[16];
-
-  size_t qty16 = qty / 16;
-
-  const float *pEnd1 = pVect1 + 16 * qty16;
-
-  __m512 sum512 = _mm512_set1_ps(0);
-
-  while (pVect1 < pEnd1) {
-    //_mm_prefetch((char*)(pVect2 + 16), _MM_HINT_T0);
-
-    __m512 v1 = _mm512_loadu_ps(pVect1);
-    pVect1 += 16;
-    __m512 v2 = _mm512_loadu_ps(pVect2);
-    pVect2 += 16;
-    sum512 = _mm512_add_ps(sum512, _mm512_mul_ps(v1, v2));
-  }
-
-  _mm512_store_ps(TmpRes, sum512);
-  float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] +
-              TmpRes[5] + TmpRes[6] + TmpRes[7] + TmpRes[8] + TmpRes[9] +
-              TmpRes[10] + TmpRes[11] + TmpRes[12] + TmpRes[13] + TmpRes[14] +
-              TmpRes[15];
-
-  return 1.0f - sum;
-}
-
-#elif defined(USE_AVX)
-
-static float InnerProductSIMD16Ext(const float *pVect1, const float *pVect2,
-                                   const size_t qty) {
+VOYAGER_TARGET("avx")
+static float InnerProductSIMD4ExtAVX(const float *pVect1, const float *pVect2,
+                                     const size_t qty) {
   float PORTABLE_ALIGN32 TmpRes[8];
 
   size_t qty16 = qty / 16;
+  size_t qty4 = qty / 4;
 
   const float *pEnd1 = pVect1 + 16 * qty16;
+  const float *pEnd2 = pVect1 + 4 * qty4;
 
   __m256 sum256 = _mm256_set1_ps(0);
 
@@ -244,21 +221,33 @@ static float InnerProductSIMD16Ext(const float *pVect1, const float *pVect2,
     sum256 = _mm256_add_ps(sum256, _mm256_mul_ps(v1, v2));
   }
 
-  _mm256_store_ps(TmpRes, sum256);
-  float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] +
-              TmpRes[5] + TmpRes[6] + TmpRes[7];
+  __m128 v1, v2;
+  __m128 sum_prod = _mm_add_ps(_mm256_extractf128_ps(sum256, 0),
+                               _mm256_extractf128_ps(sum256, 1));
 
+  while (pVect1 < pEnd2) {
+    v1 = _mm_loadu_ps(pVect1);
+    pVect1 += 4;
+    v2 = _mm_loadu_ps(pVect2);
+    pVect2 += 4;
+    sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
+  }
+
+  _mm_store_ps(TmpRes, sum_prod);
+  float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
+  ;
   return 1.0f - sum;
 }
 
-#elif defined(USE_SSE)
-
-static float InnerProductSIMD16Ext(const float *pVect1, const float *pVect2,
-                                   const size_t qty) {
+static float InnerProductSIMD4ExtSSE(const float *pVect1, const float *pVect2,
+                                     const size_t qty) {
   float PORTABLE_ALIGN32 TmpRes[8];
+
   size_t qty16 = qty / 16;
+  size_t qty4 = qty / 4;
 
   const float *pEnd1 = pVect1 + 16 * qty16;
+  const float *pEnd2 = pVect1 + 4 * qty4;
 
   __m128 v1, v2;
   __m128 sum_prod = _mm_set1_ps(0);
@@ -288,51 +277,349 @@ static float InnerProductSIMD16Ext(const float *pVect1, const float *pVect2,
     pVect2 += 4;
     sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
   }
+
+  while (pVect1 < pEnd2) {
+    v1 = _mm_loadu_ps(pVect1);
+    pVect1 += 4;
+    v2 = _mm_loadu_ps(pVect2);
+    pVect2 += 4;
+    sum_prod = _mm_add_ps(sum_prod, _mm_mul_ps(v1, v2));
+  }
+
   _mm_store_ps(TmpRes, sum_prod);
   float sum = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3];
 
   return 1.0f - sum;
 }
 
-#endif
+#elif defined(USE_NEON)
 
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
-static float InnerProductSIMD16ExtResiduals(const float *pVect1,
-                                            const float *pVect2,
-                                            const size_t qty) {
-  size_t qty16 = qty >> 4 << 4;
-  float res = InnerProductSIMD16Ext(pVect1, pVect2, qty16);
+static float InnerProductSIMD16ExtNEON(const float *pVect1, const float *pVect2,
+                                       const size_t qty) {
+  size_t qty16 = qty / 16;
 
-  size_t qty_left = qty - qty16;
-  float res_tail =
-      InnerProduct<float, float>(pVect1 + qty16, pVect2 + qty16, qty_left);
-  return res + res_tail - 1.0f;
+  const float *pEnd1 = pVect1 + 16 * qty16;
+
+  float32x4_t sum1 = vdupq_n_f32(0);
+  float32x4_t sum2 = vdupq_n_f32(0);
+
+  while (pVect1 < pEnd1) {
+    sum1 = vfmaq_f32(sum1, vld1q_f32(pVect1), vld1q_f32(pVect2));
+    sum2 = vfmaq_f32(sum2, vld1q_f32(pVect1 + 4), vld1q_f32(pVect2 + 4));
+    sum1 = vfmaq_f32(sum1, vld1q_f32(pVect1 + 8), vld1q_f32(pVect2 + 8));
+    sum2 = vfmaq_f32(sum2, vld1q_f32(pVect1 + 12), vld1q_f32(pVect2 + 12));
+    pVect1 += 16;
+    pVect2 += 16;
+  }
+
+  return 1.0f - vaddvq_f32(vaddq_f32(sum1, sum2));
 }
 
-static float InnerProductSIMD4ExtResiduals(const float *pVect1,
-                                           const float *pVect2,
-                                           const size_t qty) {
-  size_t qty4 = qty >> 2 << 2;
+static float InnerProductSIMD4ExtNEON(const float *pVect1, const float *pVect2,
+                                      const size_t qty) {
+  size_t qty4 = qty / 4;
+
+  const float *pEnd1 = pVect1 + 4 * qty4;
 
-  float res = InnerProductSIMD4Ext(pVect1, pVect2, qty4);
-  size_t qty_left = qty - qty4;
+  float32x4_t sum = vdupq_n_f32(0);
 
-  float res_tail =
-      InnerProduct<float, float>(pVect1 + qty4, pVect2 + qty4, qty_left);
+  while (pVect1 < pEnd1) {
+    sum = vfmaq_f32(sum, vld1q_f32(pVect1), vld1q_f32(pVect2));
+    pVect1 += 4;
+    pVect2 += 4;
+  }
+
+  return 1.0f - vaddvq_f32(sum);
+}
 
+#endif
+
+#if defined(USE_SSE) || defined(USE_NEON)
+// As with L2SqrSIMDExtResiduals, but each partial result is offset by one:
+template <DISTFUNC_PTR<float> kernel, size_t Stride>
+static float InnerProductSIMDExtResiduals(const float *pVect1,
+                                          const float *pVect2,
+                                          const size_t qty) {
+  size_t qtyStride = qty / Stride * Stride;
+  float res = kernel(pVect1, pVect2, qtyStride);
+
+  size_t qty_left = qty - qtyStride;
+  float res_tail = InnerProduct<float, float>(pVect1 + qtyStride,
+                                              pVect2 + qtyStride, qty_left);
   return res + res_tail - 1.0f;
 }
+
+// See selectL2SqrSIMD:
+template <DISTFUNC_PTR<float> simd16, DISTFUNC_PTR<float> simd4>
+static DISTFUNC_PTR<float> selectInnerProductSIMD(size_t dim) {
+  if (dim % 16 == 0)
+    return simd16;
+  else if (dim % 4 == 0)
+    return simd4;
+  else if (dim > 16)
+    return InnerProductSIMDExtResiduals<simd16, 16>;
+  else if (dim > 4)
+    return InnerProductSIMDExtResiduals<simd4, 4>;
+  return InnerProduct<float, float>;
+}
+
+/**
+ * The largest number of int8 elements whose products can be summed without
+ * overflowing a 32-bit accumulator: 65536 * (128 ** 2) < 2 ** 31.
+ */
+static constexpr size_t INNER_PRODUCT_INT8_BLOCK_SIZE = 65536;
+
+/**
+ * The InnerProductInt8Block* functions calculate the exact (unscaled) dot
+ * product of two int8 vectors of at most INNER_PRODUCT_INT8_BLOCK_SIZE
+ * elements. On x86, each lane is sign-extended to 16 bits before multiplying;
+ * the unsigned-by-signed `maddubs` and `dpbusd` instructions would need the
+ * sign of one input to be moved onto the other, which overflows when either
+ * input is -128. Any leftover elements are handled here:
+ */
+static int32_t InnerProductInt8Scalar(const int8_t *pVect1,
+                                      const int8_t *pVect2, const size_t qty) {
+  int32_t res = 0;
+  for (size_t i = 0; i < qty; i++) {
+    res += (int32_t)pVect1[i] * (int32_t)pVect2[i];
+  }
+  return res;
+}
+#endif
+
+#if defined(USE_SSE)
+VOYAGER_TARGET("avx512f,avx512bw,avx512vnni")
+static int32_t InnerProductInt8BlockAVX512VNNI(const int8_t *pVect1,
+                                               const int8_t *pVect2,
+                                               const size_t qty) {
+  size_t i = 0;
+  __m512i sum = _mm512_setzero_si512();
+  for (; i + 32 <= qty; i += 32) {
+    __m512i v1 =
+        _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(pVect1 + i)));
+    __m512i v2 =
+        _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(pVect2 + i)));
+    sum = _mm512_dpwssd_epi32(sum, v1, v2);
+  }
+  return sumLanesAVX512(sum) +
+         InnerProductInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+
+VOYAGER_TARGET("avx512f,avx512bw")
+static int32_t InnerProductInt8BlockAVX512BW(const int8_t *pVect1,
+                                             const int8_t *pVect2,
+                                             const size_t qty) {
+  size_t i = 0;
+  __m512i sum = _mm512_setzero_si512();
+  for (; i + 32 <= qty; i += 32) {
+    __m512i v1 =
+        _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(pVect1 + i)));
+    __m512i v2 =
+        _mm512_cvtepi8_epi16(_mm256_loadu_si256((const __m256i *)(pVect2 + i)));
+    sum = _mm512_add_epi32(sum, _mm512_madd_epi16(v1, v2));
+  }
+  return sumLanesAVX512(sum) +
+         InnerProductInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+
+VOYAGER_TARGET("avx2")
+static int32_t InnerProductInt8BlockAVX2(const int8_t *pVect1,
+                                         const int8_t *pVect2,
+                                         const size_t qty) {
+  size_t i = 0;
+  __m256i sum = _mm256_setzero_si256();
+  for (; i + 16 <= qty; i += 16) {
+    __m256i v1 =
+        _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(pVect1 + i)));
+    __m256i v2 =
+        _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)(pVect2 + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(v1, v2));
+  }
+  __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                                 _mm256_extracti128_si256(sum, 1));
+  sum128 = _mm_hadd_epi32(sum128, sum128);
+  sum128 = _mm_hadd_epi32(sum128, sum128);
+  return _mm_cvtsi128_si32(sum128) +
+         InnerProductInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+
+VOYAGER_TARGET("avx512f")
+static float InnerProductE4M3AVX512(const E4M3 *pVect1, const E4M3 *pVect2,
+                                    const size_t qty) {
+  size_t i = 0;
+  __m512 sum = _mm512_set1_ps(0);
+  for (; i + 16 <= qty; i += 16) {
+    sum = _mm512_add_ps(
+        sum, _mm512_mul_ps(loadE4M3x16(pVect1 + i), loadE4M3x16(pVect2 + i)));
+  }
+  float res = sumLanesAVX512(sum);
+
+  return res + InnerProductWithoutScale<float, E4M3>(pVect1 + i, pVect2 + i,
+                                                     qty - i);
+}
+
+VOYAGER_TARGET("avx2")
+static float InnerProductE4M3AVX2(const E4M3 *pVect1, const E4M3 *pVect2,
+                                  const size_t qty) {
+  float PORTABLE_ALIGN32 TmpRes[8];
+  size_t i = 0;
+  __m256 sum = _mm256_set1_ps(0);
+  for (; i + 8 <= qty; i += 8) {
+    sum = _mm256_add_ps(
+        sum, _mm256_mul_ps(loadE4M3x8(pVect1 + i), loadE4M3x8(pVect2 + i)));
+  }
+  _mm256_store_ps(TmpRes, sum);
+  float res = TmpRes[0] + TmpRes[1] + TmpRes[2] + TmpRes[3] + TmpRes[4] +
+              TmpRes[5] + TmpRes[6] + TmpRes[7];
+
+  return res + InnerProductWithoutScale<float, E4M3>(pVect1 + i, pVect2 + i,
+                                                     qty - i);
+}
+
+#elif defined(USE_NEON)
+
+#if defined(USE_NEON_DOTPROD)
+VOYAGER_TARGET_NEON_DOTPROD
+static int32_t InnerProductInt8BlockNEONDotProd(const int8_t *pVect1,
+                                                const int8_t *pVect2,
+                                                const size_t qty) {
+  size_t i = 0;
+  int32x4_t sum = vdupq_n_s32(0);
+  for (; i + 16 <= qty; i += 16) {
+    sum = vdotq_s32(sum, vld1q_s8(pVect1 + i), vld1q_s8(pVect2 + i));
+  }
+  return vaddvq_s32(sum) +
+         InnerProductInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+#endif
+
+static int32_t InnerProductInt8BlockNEON(const int8_t *pVect1,
+                                         const int8_t *pVect2,
+                                         const size_t qty) {
+  size_t i = 0;
+  int32x4_t sum = vdupq_n_s32(0);
+  for (; i + 16 <= qty; i += 16) {
+    int8x16_t v1 = vld1q_s8(pVect1 + i);
+    int8x16_t v2 = vld1q_s8(pVect2 + i);
+    sum = vpadalq_s16(sum, vmull_s8(vget_low_s8(v1), vget_low_s8(v2)));
+    sum = vpadalq_s16(sum, vmull_high_s8(v1, v2));
+  }
+  return vaddvq_s32(sum) +
+         InnerProductInt8Scalar(pVect1 + i, pVect2 + i, qty - i);
+}
+
+static float InnerProductE4M3NEON(const E4M3 *pVect1, const E4M3 *pVect2,
+                                  const size_t qty) {
+  const E4M3NeonTables &tables = E4M3NeonTables::get();
+  size_t i = 0;
+  float32x4_t sum = vdupq_n_f32(0);
+  for (; i + 16 <= qty; i += 16) {
+    float32x4x4_t v1 = loadE4M3x16(pVect1 + i, tables);
+    float32x4x4_t v2 = loadE4M3x16(pVect2 + i, tables);
+    for (int j = 0; j < 4; j++) {
+      sum = vfmaq_f32(sum, v1.val[j], v2.val[j]);
+    }
+  }
+  float res = vaddvq_f32(sum);
+
+  return res + InnerProductWithoutScale<float, E4M3>(pVect1 + i, pVect2 + i,
+                                                     qty - i);
+}
+
+#endif
+
+#if defined(USE_SSE) || defined(USE_NEON)
+template <typename scalefactor, DISTFUNC_PTR<int32_t, int8_t> kernel>
+static float InnerProductInt8SIMD(const int8_t *pVect1, const int8_t *pVect2,
+                                  const size_t qty) {
+  int64_t res = 0;
+  for (size_t i = 0; i < qty; i += INNER_PRODUCT_INT8_BLOCK_SIZE) {
+    res += kernel(pVect1 + i, pVect2 + i,
+                  std::min(INNER_PRODUCT_INT8_BLOCK_SIZE, qty - i));
+  }
+
+  constexpr float scale = (float)scalefactor::num / (float)scalefactor::den;
+  return 1.0f - ((float)res * scale * scale);
+}
+
+template <typename scalefactor, DISTFUNC_PTR<float, E4M3> kernel>
+static float InnerProductE4M3SIMD(const E4M3 *pVect1, const E4M3 *pVect2,
+                                  const size_t qty) {
+  constexpr float scale = (float)scalefactor::num / (float)scalefactor::den;
+  return 1.0f - (kernel(pVect1, pVect2, qty) * scale * scale);
+}
+
+/**
+ * Choose the fastest int8 inner product distance function supported by this
+ * CPU.
+ */
+template <typename scalefactor>
+static DISTFUNC_PTR<float, int8_t> selectInnerProductInt8() {
+  const CPUFeatures &cpu = CPUFeatures::get();
+#if defined(USE_SSE)
+  if (cpu.avx512vnni)
+    return InnerProductInt8SIMD<scalefactor, InnerProductInt8BlockAVX512VNNI>;
+  if (cpu.avx512bw)
+    return InnerProductInt8SIMD<scalefactor, InnerProductInt8BlockAVX512BW>;
+  if (cpu.avx2)
+    return InnerProductInt8SIMD<scalefactor, InnerProductInt8BlockAVX2>;
+#elif defined(USE_NEON)
+#if defined(USE_NEON_DOTPROD)
+  if (cpu.neonDotProd)
+    return InnerProductInt8SIMD<scalefactor, InnerProductInt8BlockNEONDotProd>;
+#endif
+  return InnerProductInt8SIMD<scalefactor, InnerProductInt8BlockNEON>;
+#endif
+  (void)cpu;
+  return nullptr;
+}
+
+/**
+ * Choose the fastest E4M3 inner product distance function supported by this
+ * CPU.
+ */
+template <typename scalefactor>
+static DISTFUNC_PTR<float, E4M3> selectInnerProductE4M3() {
+#if defined(USE_SSE)
+  const CPUFeatures &cpu = CPUFeatures::get();
+  if (cpu.avx512f)
+    return InnerProductE4M3SIMD<scalefactor, InnerProductE4M3AVX512>;
+  if (cpu.avx2)
+    return InnerProductE4M3SIMD<scalefactor, InnerProductE4M3AVX2>;
+  return nullptr;
+#elif defined(USE_NEON)
+  return InnerProductE4M3SIMD<scalefactor, InnerProductE4M3NEON>;
+#endif
+}
 #endif
 
 template <typename dist_t, typename data_t = dist_t,
           typename scalefactor = std::ratio<1, 1>>
 class InnerProductSpace : public Space<dist_t, data_t> {
   DISTFUNC<dist_t, data_t> fstdistfunc_;
+  // Only set for spaces with a dedicated many-to-one kernel:
+  MULTIDISTFUNC<dist_t, data_t> fstmultidistfunc_;
   size_t data_size_;
   size_t dim_;
 
 public:
   InnerProductSpace(size_t dim) : data_size_(dim * sizeof(data_t)), dim_(dim) {
+#if defined(USE_SSE) || defined(USE_NEON)
+    DISTFUNC_PTR<dist_t, data_t> simdDistFunc = nullptr;
+    if constexpr (std::is_same<dist_t, float>::value &&
+                  std::is_same<data_t, int8_t>::value) {
+      simdDistFunc = selectInnerProductInt8<scalefactor>();
+    } else if constexpr (std::is_same<dist_t, float>::value &&
+                         std::is_same<data_t, E4M3>::value) {
+      simdDistFunc = selectInnerProductE4M3<scalefactor>();
+    }
+
+    if (simdDistFunc) {
+      fstdistfunc_ = simdDistFunc;
+      return;
+    }
+#endif
+
     if (dim % 128 == 0)
       fstdistfunc_ = InnerProduct<dist_t, data_t, 128, scalefactor>;
     else if (dim % 64 == 0)
@@ -366,6 +653,13 @@ public:
 
   DISTFUNC<dist_t, data_t> get_dist_func() { return fstdistfunc_; }
 
+  MULTIDISTFUNC<dist_t, data_t> get_multi_dist_func() {
+    if (fstmultidistfunc_) {
+      return fstmultidistfunc_;
+    }
+    return Space<dist_t, data_t>::get_multi_dist_func();
+  }
+
   size_t get_dist_func_param() { return dim_; }
   ~InnerProductSpace() {}
 };
@@ -373,16 +667,22 @@ public:
 template <>
 InnerProductSpace<float, float>::InnerProductSpace(size_t dim)
     : data_size_(dim * sizeof(float)), dim_(dim) {
+  fstmultidistfunc_ = selectManyToOne</* Squared= */ false>();
   fstdistfunc_ = InnerProduct<float, float>;
-#if defined(USE_SSE) || defined(USE_AVX) || defined(USE_AVX512)
-  if (dim % 16 == 0)
-    fstdistfunc_ = InnerProductSIMD16Ext;
-  else if (dim % 4 == 0)
-    fstdistfunc_ = InnerProductSIMD4Ext;
-  else if (dim > 16)
-    fstdistfunc_ = InnerProductSIMD16ExtResiduals;
-  else if (dim > 4)
-    fstdistfunc_ = InnerProductSIMD4ExtResiduals;
+#if defined(USE_SSE)
+  const CPUFeatures &cpu = CPUFeatures::get();
+  if (cpu.avx512f)
+    fstdistfunc_ = selectInnerProductSIMD<InnerProductSIMD16ExtAVX512,
+                                          InnerProductSIMD4ExtAVX>(dim);
+  else if (cpu.avx)
+    fstdistfunc_ = selectInnerProductSIMD<InnerProductSIMD16ExtAVX,
+                                          InnerProductSIMD4ExtAVX>(dim);
+  else
+    fstdistfunc_ = selectInnerProductSIMD<InnerProductSIMD16ExtSSE,
+                                          InnerProductSIMD4ExtSSE>(dim);
+#elif defined(USE_NEON)
+  fstdistfunc_ = selectInnerProductSIMD<InnerProductSIMD16ExtNEON,
+                                        InnerProductSIMD4ExtNEON>(dim);
 #endif
 }
 
@@ -0,0 +1,344 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+#include "../cpu_features.h"
+#include "Space.h"
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Many-to-one float kernels (see MULTIDISTFUNC), used by the float32
+ * Euclidean and InnerProduct spaces. With `Squared`, each computes squared
+ * Euclidean distances; otherwise, one minus the inner product.
+ *
+ * Each block of the element's vector is loaded once and compared against
+ * four queries before moving on to the next block, so that one element's
+ * distances to a batch of queries cost one pass over the element rather
+ * than one per query. Any remaining queries are compared one at a time, and
+ * any remaining dimensions with scalar code.
+ */
+namespace hnswlib {
+template <bool Squared>
+static inline float manyToOneTail(const float *element, const float *query,
+                                  size_t start, size_t qty) {
+  float res = 0;
+  for (size_t i = start; i < qty; i++) {
+    if constexpr (Squared) {
+      float diff = element[i] - query[i];
+      res += diff * diff;
+    } else {
+      res += element[i] * query[i];
+    }
+  }
+  return res;
+}
+
+template <bool Squared> static inline float manyToOneResult(float sum) {
+  if constexpr (Squared) {
+    return sum;
+  } else {
+    return 1.0f - sum;
+  }
+}
+
+template <bool Squared>
+static void manyToOneScalar(const float *element, const float *const *queries,
+                            const size_t numQueries, const size_t qty,
+                            float *distances) {
+  for (size_t q = 0; q < numQueries; q++) {
+    distances[q] =
+        manyToOneResult<Squared>(manyToOneTail<Squared>(element, queries[q],
+                                                        0, qty));
+  }
+}
+
+#if defined(USE_SSE)
+template <bool Squared>
+VOYAGER_TARGET("avx512f")
+static inline __m512 accumulateAVX512(__m512 sum, __m512 element,
+                                      const float *query) {
+  __m512 v = _mm512_loadu_ps(query);
+  if constexpr (Squared) {
+    __m512 diff = _mm512_sub_ps(element, v);
+    return _mm512_add_ps(sum, _mm512_mul_ps(diff, diff));
+  } else {
+    return _mm512_add_ps(sum, _mm512_mul_ps(element, v));
+  }
+}
+
+// Horizontal sums are done through memory rather than with
+// _mm512_reduce_add_*, which trips -Wuninitialized in GCC's own headers.
+VOYAGER_TARGET("avx512f")
+static inline float sumLanesAVX512(__m512 sum) {
+  float PORTABLE_ALIGN64 lanes[16];
+  _mm512_store_ps(lanes, sum);
+  float res = 0;
+  for (int i = 0; i < 16; i++) {
+    res += lanes[i];
+  }
+  return res;
+}
+
+VOYAGER_TARGET("avx512f")
+static inline int32_t sumLanesAVX512(__m512i sum) {
+  int32_t PORTABLE_ALIGN64 lanes[16];
+  _mm512_store_si512(lanes, sum);
+  int32_t res = 0;
+  for (int i = 0; i < 16; i++) {
+    res += lanes[i];
+  }
+  return res;
+}
+
+template <bool Squared>
+VOYAGER_TARGET("avx512f")
+static void manyToOneAVX512(const float *element, const float *const *queries,
+                            const size_t numQueries, const size_t qty,
+                            float *distances) {
+  size_t qty16 = qty / 16 * 16;
+  size_t q = 0;
+  for (; q + 4 <= numQueries; q += 4) {
+    const float *q0 = queries[q], *q1 = queries[q + 1];
+    const float *q2 = queries[q + 2], *q3 = queries[q + 3];
+    __m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps();
+    __m512 sum2 = _mm512_setzero_ps(), sum3 = _mm512_setzero_ps();
+    for (size_t i = 0; i < qty16; i += 16) {
+      __m512 e = _mm512_loadu_ps(element + i);
+      sum0 = accumulateAVX512<Squared>(sum0, e, q0 + i);
+      sum1 = accumulateAVX512<Squared>(sum1, e, q1 + i);
+      sum2 = accumulateAVX512<Squared>(sum2, e, q2 + i);
+      sum3 = accumulateAVX512<Squared>(sum3, e, q3 + i);
+    }
+    distances[q] = manyToOneResult<Squared>(
+        sumLanesAVX512(sum0) + manyToOneTail<Squared>(element, q0, qty16, qty));
+    distances[q + 1] = manyToOneResult<Squared>(
+        sumLanesAVX512(sum1) + manyToOneTail<Squared>(element, q1, qty16, qty));
+    distances[q + 2] = manyToOneResult<Squared>(
+        sumLanesAVX512(sum2) + manyToOneTail<Squared>(element, q2, qty16, qty));
+    distances[q + 3] = manyToOneResult<Squared>(
+        sumLanesAVX512(sum3) + manyToOneTail<Squared>(element, q3, qty16, qty));
+  }
+
+  for (; q < numQueries; q++) {
+    __m512 sum = _mm512_setzero_ps();
+    for (size_t i = 0; i < qty16; i += 16) {
+      sum = accumulateAVX512<Squared>(sum, _mm512_loadu_ps(element + i),
+                                      queries[q] + i);
+    }
+    distances[q] = manyToOneResult<Squared>(
+        sumLanesAVX512(sum) +
+        manyToOneTail<Squared>(element, queries[q], qty16, qty));
+  }
+}
+
+template <bool Squared>
+VOYAGER_TARGET("avx")
+static inline __m256 accumulateAVX(__m256 sum, __m256 element,
+                                   const float *query) {
+  __m256 v = _mm256_loadu_ps(query);
+  if constexpr (Squared) {
+    __m256 diff = _mm256_sub_ps(element, v);
+    return _mm256_add_ps(sum, _mm256_mul_ps(diff, diff));
+  } else {
+    return _mm256_add_ps(sum, _mm256_mul_ps(element, v));
+  }
+}
+
+VOYAGER_TARGET("avx")
+static inline float sumLanesAVX(__m256 sum) {
+  float PORTABLE_ALIGN32 lanes[8];
+  _mm256_store_ps(lanes, sum);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] +
+         lanes[6] + lanes[7];
+}
+
+template <bool Squared>
+VOYAGER_TARGET("avx")
+static void manyToOneAVX(const float *element, const float *const *queries,
+                         const size_t numQueries, const size_t qty,
+                         float *distances) {
+  size_t qty8 = qty / 8 * 8;
+  size_t q = 0;
+  for (; q + 4 <= numQueries; q += 4) {
+    const float *q0 = queries[q], *q1 = queries[q + 1];
+    const float *q2 = queries[q + 2], *q3 = queries[q + 3];
+    __m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+    __m256 sum2 = _mm256_setzero_ps(), sum3 = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8) {
+      __m256 e = _mm256_loadu_ps(element + i);
+      sum0 = accumulateAVX<Squared>(sum0, e, q0 + i);
+      sum1 = accumulateAVX<Squared>(sum1, e, q1 + i);
+      sum2 = accumulateAVX<Squared>(sum2, e, q2 + i);
+      sum3 = accumulateAVX<Squared>(sum3, e, q3 + i);
+    }
+    distances[q] = manyToOneResult<Squared>(
+        sumLanesAVX(sum0) + manyToOneTail<Squared>(element, q0, qty8, qty));
+    distances[q + 1] = manyToOneResult<Squared>(
+        sumLanesAVX(sum1) + manyToOneTail<Squared>(element, q1, qty8, qty));
+    distances[q + 2] = manyToOneResult<Squared>(
+        sumLanesAVX(sum2) + manyToOneTail<Squared>(element, q2, qty8, qty));
+    distances[q + 3] = manyToOneResult<Squared>(
+        sumLanesAVX(sum3) + manyToOneTail<Squared>(element, q3, qty8, qty));
+  }
+
+  for (; q < numQueries; q++) {
+    __m256 sum = _mm256_setzero_ps();
+    for (size_t i = 0; i < qty8; i += 8) {
+      sum = accumulateAVX<Squared>(sum, _mm256_loadu_ps(element + i),
+                                   queries[q] + i);
+    }
+    distances[q] = manyToOneResult<Squared>(
+        sumLanesAVX(sum) +
+        manyToOneTail<Squared>(element, queries[q], qty8, qty));
+  }
+}
+
+template <bool Squared>
+static inline __m128 accumulateSSE(__m128 sum, __m128 element,
+                                   const float *query) {
+  __m128 v = _mm_loadu_ps(query);
+  if constexpr (Squared) {
+    __m128 diff = _mm_sub_ps(element, v);
+    return _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+  } else {
+    return _mm_add_ps(sum, _mm_mul_ps(element, v));
+  }
+}
+
+static inline float sumLanesSSE(__m128 sum) {
+  float PORTABLE_ALIGN32 lanes[4];
+  _mm_store_ps(lanes, sum);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+template <bool Squared>
+static void manyToOneSSE(const float *element, const float *const *queries,
+                         const size_t numQueries, const size_t qty,
+                         float *distances) {
+  size_t qty4 = qty / 4 * 4;
+  size_t q = 0;
+  for (; q + 4 <= numQueries; q += 4) {
+    const float *q0 = queries[q], *q1 = queries[q + 1];
+    const float *q2 = queries[q + 2], *q3 = queries[q + 3];
+    __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+    __m128 sum2 = _mm_setzero_ps(), sum3 = _mm_setzero_ps();
+    for (size_t i = 0; i < qty4; i += 4) {
+      __m128 e = _mm_loadu_ps(element + i);
+      sum0 = accumulateSSE<Squared>(sum0, e, q0 + i);
+      sum1 = accumulateSSE<Squared>(sum1, e, q1 + i);
+      sum2 = accumulateSSE<Squared>(sum2, e, q2 + i);
+      sum3 = accumulateSSE<Squared>(sum3, e, q3 + i);
+    }
+    distances[q] = manyToOneResult<Squared>(
+        sumLanesSSE(sum0) + manyToOneTail<Squared>(element, q0, qty4, qty));
+    distances[q + 1] = manyToOneResult<Squared>(
+        sumLanesSSE(sum1) + manyToOneTail<Squared>(element, q1, qty4, qty));
+    distances[q + 2] = manyToOneResult<Squared>(
+        sumLanesSSE(sum2) + manyToOneTail<Squared>(element, q2, qty4, qty));
+    distances[q + 3] = manyToOneResult<Squared>(
+        sumLanesSSE(sum3) + manyToOneTail<Squared>(element, q3, qty4, qty));
+  }
+
+  for (; q < numQueries; q++) {
+    __m128 sum = _mm_setzero_ps();
+    for (size_t i = 0; i < qty4; i += 4) {
+      sum = accumulateSSE<Squared>(sum, _mm_loadu_ps(element + i),
+                                   queries[q] + i);
+    }
+    distances[q] = manyToOneResult<Squared>(
+        sumLanesSSE(sum) +
+        manyToOneTail<Squared>(element, queries[q], qty4, qty));
+  }
+}
+#endif
+
+#if defined(USE_NEON)
+template <bool Squared>
+static inline float32x4_t accumulateNEON(float32x4_t sum, float32x4_t element,
+                                         const float *query) {
+  float32x4_t v = vld1q_f32(query);
+  if constexpr (Squared) {
+    float32x4_t diff = vsubq_f32(element, v);
+    return vfmaq_f32(sum, diff, diff);
+  } else {
+    return vfmaq_f32(sum, element, v);
+  }
+}
+
+template <bool Squared>
+static void manyToOneNEON(const float *element, const float *const *queries,
+                          const size_t numQueries, const size_t qty,
+                          float *distances) {
+  size_t qty4 = qty / 4 * 4;
+  size_t q = 0;
+  for (; q + 4 <= numQueries; q += 4) {
+    const float *q0 = queries[q], *q1 = queries[q + 1];
+    const float *q2 = queries[q + 2], *q3 = queries[q + 3];
+    float32x4_t sum0 = vdupq_n_f32(0), sum1 = vdupq_n_f32(0);
+    float32x4_t sum2 = vdupq_n_f32(0), sum3 = vdupq_n_f32(0);
+    for (size_t i = 0; i < qty4; i += 4) {
+      float32x4_t e = vld1q_f32(element + i);
+      sum0 = accumulateNEON<Squared>(sum0, e, q0 + i);
+      sum1 = accumulateNEON<Squared>(sum1, e, q1 + i);
+      sum2 = accumulateNEON<Squared>(sum2, e, q2 + i);
+      sum3 = accumulateNEON<Squared>(sum3, e, q3 + i);
+    }
+    distances[q] = manyToOneResult<Squared>(
+        vaddvq_f32(sum0) + manyToOneTail<Squared>(element, q0, qty4, qty));
+    distances[q + 1] = manyToOneResult<Squared>(
+        vaddvq_f32(sum1) + manyToOneTail<Squared>(element, q1, qty4, qty));
+    distances[q + 2] = manyToOneResult<Squared>(
+        vaddvq_f32(sum2) + manyToOneTail<Squared>(element, q2, qty4, qty));
+    distances[q + 3] = manyToOneResult<Squared>(
+        vaddvq_f32(sum3) + manyToOneTail<Squared>(element, q3, qty4, qty));
+  }
+
+  for (; q < numQueries; q++) {
+    float32x4_t sum = vdupq_n_f32(0);
+    for (size_t i = 0; i < qty4; i += 4) {
+      sum = accumulateNEON<Squared>(sum, vld1q_f32(element + i),
+                                    queries[q] + i);
+    }
+    distances[q] = manyToOneResult<Squared>(
+        vaddvq_f32(sum) +
+        manyToOneTail<Squared>(element, queries[q], qty4, qty));
+  }
+}
+#endif
+
+/**
+ * Choose the fastest many-to-one kernel supported by this CPU.
+ */
+template <bool Squared> static MULTIDISTFUNC_PTR<float> selectManyToOne() {
+#if defined(USE_SSE)
+  const CPUFeatures &cpu = CPUFeatures::get();
+  if (cpu.avx512f)
+    return manyToOneAVX512<Squared>;
+  else if (cpu.avx)
+    return manyToOneAVX<Squared>;
+  return manyToOneSSE<Squared>;
+#elif defined(USE_NEON)
+  return manyToOneNEON<Squared>;
+#else
+  return manyToOneScalar<Squared>;
+#endif
+}
+} // namespace hnswlib
@@ -0,0 +1,52 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+#include "../ProductQuantizer.h"
+#include "Space.h"
+#include <cstdint>
+
+namespace hnswlib {
+/**
+ * A space over product-quantized codes, in which the distance between two
+ * stored elements is the symmetric (code-to-code) distance given by the
+ * quantizer. The quantizer is not owned, and must outlive this space.
+ */
+class ProductQuantizedSpace : public Space<float, uint8_t> {
+  const ProductQuantizer &quantizer;
+
+public:
+  ProductQuantizedSpace(const ProductQuantizer &quantizer)
+      : quantizer(quantizer) {}
+
+  size_t get_data_size() { return quantizer.getCodeSize(); }
+
+  DISTFUNC<float, uint8_t> get_dist_func() {
+    const ProductQuantizer *pq = &quantizer;
+    return [pq](const uint8_t *a, const uint8_t *b, const size_t) {
+      return pq->symmetricDistance(a, b);
+    };
+  }
+
+  size_t get_dist_func_param() { return quantizer.getCodeSize(); }
+
+  ~ProductQuantizedSpace() {}
+};
+} // namespace hnswlib
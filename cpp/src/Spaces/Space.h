@@ -29,6 +29,28 @@ template <typename MTYPE, typename data_t = MTYPE>
 using DISTFUNC =
     std::function<MTYPE(const data_t *, const data_t *, const size_t)>;
 
+/**
+ * A plain function pointer with the same signature as DISTFUNC, used to pass
+ * SIMD kernels around as template arguments.
+ */
+template <typename MTYPE, typename data_t = MTYPE>
+using DISTFUNC_PTR = MTYPE (*)(const data_t *, const data_t *, const size_t);
+
+/**
+ * Computes the distance between one vector (`element`) and each of
+ * `numQueries` others (`queries`), writing them to `distances`. Many-to-one
+ * kernels load each block of the element once and compare it against several
+ * queries before moving on, rather than reloading it for every query.
+ */
+template <typename MTYPE, typename data_t = MTYPE>
+using MULTIDISTFUNC =
+    std::function<void(const data_t *, const data_t *const *, const size_t,
+                       const size_t, MTYPE *)>;
+
+template <typename MTYPE, typename data_t = MTYPE>
+using MULTIDISTFUNC_PTR = void (*)(const data_t *, const data_t *const *,
+                                   const size_t, const size_t, MTYPE *);
+
 /**
  * An abstract class representing a type of space to search through,
  * and encapsulating the data required to search that space.
@@ -43,6 +65,21 @@ public:
 
   virtual size_t get_dist_func_param() = 0;
 
+  /**
+   * A many-to-one version of get_dist_func(). Spaces without a dedicated
+   * kernel call their one-to-one distance function once per query.
+   */
+  virtual MULTIDISTFUNC<MTYPE, data_t> get_multi_dist_func() {
+    DISTFUNC<MTYPE, data_t> distance = get_dist_func();
+    return [distance](const data_t *element, const data_t *const *queries,
+                      const size_t numQueries, const size_t qty,
+                      MTYPE *distances) {
+      for (size_t i = 0; i < numQueries; i++) {
+        distances[i] = distance(queries[i], element, qty);
+      }
+    };
+  }
+
   virtual ~Space() {}
 };
 }; // namespace hnswlib
@@ -19,6 +19,8 @@
  */
 
 #pragma once
+#include <algorithm>
+#include <cstring>
 #include <exception>
 #include <iostream>
 #include <memory>
@@ -27,6 +29,57 @@
 #include <string>
 #include <sys/stat.h>
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+/**
+ * A read-only view of an entire file, mapped directly into this process's
+ * address space. Pages are loaded lazily from the operating system's page
+ * cache, which allows multiple processes mapping the same file to share the
+ * same physical memory.
+ */
+class MemoryMappedFile {
+public:
+  MemoryMappedFile(int fileDescriptor, size_t sizeInBytes)
+      : sizeInBytes(sizeInBytes) {
+#ifdef _WIN32
+    throw std::runtime_error(
+        "Memory-mapped files are not supported on this platform.");
+#else
+    if (sizeInBytes == 0) {
+      throw std::runtime_error("Cannot memory-map an empty file.");
+    }
+
+    void *mapping = mmap(nullptr, sizeInBytes, PROT_READ, MAP_SHARED,
+                         fileDescriptor, 0);
+    if (mapping == MAP_FAILED) {
+      throw std::runtime_error("Failed to memory-map file of " +
+                               std::to_string(sizeInBytes) + " bytes.");
+    }
+    pointer = static_cast<const char *>(mapping);
+#endif
+  }
+
+  MemoryMappedFile(const MemoryMappedFile &) = delete;
+  MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
+  ~MemoryMappedFile() {
+#ifndef _WIN32
+    if (pointer) {
+      munmap(const_cast<char *>(pointer), sizeInBytes);
+    }
+#endif
+  }
+
+  const char *data() const { return pointer; }
+  size_t size() const { return sizeInBytes; }
+
+private:
+  const char *pointer = nullptr;
+  size_t sizeInBytes = 0;
+};
+
 /**
  * Like std::istream, but custom with fewer methods to implement.
  */
@@ -43,6 +96,13 @@ public:
     return setPosition(getPosition() + numBytes);
   }
   virtual uint32_t peek() = 0;
+
+  /**
+   * Map the entire contents of this stream into memory, if supported.
+   * Returns nullptr if this stream cannot be memory-mapped, in which case
+   * callers should fall back to read().
+   */
+  virtual std::shared_ptr<MemoryMappedFile> memoryMap() { return nullptr; }
 };
 
 class FileInputStream : public InputStream {
@@ -90,6 +150,18 @@ public:
     }
   }
 
+  virtual std::shared_ptr<MemoryMappedFile> memoryMap() {
+    if (!isRegularFile || sizeInBytes <= 0) {
+      return nullptr;
+    }
+
+    try {
+      return std::make_shared<MemoryMappedFile>(fileno(handle), sizeInBytes);
+    } catch (std::runtime_error const &) {
+      return nullptr;
+    }
+  }
+
   virtual ~FileInputStream() {
     if (handle) {
       fclose(handle);
@@ -161,6 +233,44 @@ private:
   std::ostringstream outputStream;
 };
 
+/**
+ * Reads from an in-memory copy of a stream's contents (i.e.: the value of a
+ * MemoryOutputStream).
+ */
+class MemoryInputStream : public InputStream {
+public:
+  MemoryInputStream(std::string data) : data(std::move(data)) {}
+
+  virtual bool isSeekable() { return true; }
+  virtual long long getTotalLength() { return data.size(); }
+  virtual long long read(char *buffer, long long bytesToRead) {
+    long long n = std::min<long long>(bytesToRead, data.size() - position);
+    std::memcpy(buffer, data.data() + position, n);
+    position += n;
+    return n;
+  }
+  virtual bool isExhausted() { return position == data.size(); }
+  virtual long long getPosition() { return position; }
+  virtual bool setPosition(long long newPosition) {
+    if (newPosition < 0 || (size_t)newPosition > data.size()) {
+      return false;
+    }
+    position = newPosition;
+    return true;
+  }
+  virtual uint32_t peek() {
+    uint32_t result = 0;
+    if (data.size() - position < sizeof(result))
+      throw std::runtime_error("Failed to peek from stream.");
+    std::memcpy(&result, data.data() + position, sizeof(result));
+    return result;
+  }
+
+private:
+  std::string data;
+  size_t position = 0;
+};
+
 template <typename T>
 static void writeBinaryPOD(std::shared_ptr<OutputStream> out, const T &podRef) {
   if (!out->write((char *)&podRef, sizeof(T))) {
@@ -28,19 +28,20 @@
 #include <optional>
 #include <ratio>
 
+#include "AsyncQueryBatcher.h"
+#include "CompressedStream.h"
 #include "E4M3.h"
 #include "Enums.h"
+#include "FullPrecisionVectorStore.h"
 #include "Index.h"
 #include "Metadata.h"
+#include "PQIndex.h"
+#include "QueryCache.h"
 #include "array_utils.h"
 #include "hnswlib.h"
+#include "index_utils.h"
 #include "std_utils.h"
 
-class RecallError : public std::runtime_error {
-public:
-  RecallError(const std::string &what) : std::runtime_error(what) {}
-};
-
 template <typename T> inline const StorageDataType storageDataType();
 template <typename T> inline const std::string storageDataTypeName();
 
@@ -71,6 +72,9 @@ class TypedIndex : public Index {
 private:
   static const int ser_version = 1; // serialization version
 
+  // The maximum number of queries to search through the graph together.
+  static constexpr size_t maxQueriesPerBlock = 32;
+
   SpaceType space;
   int dimensions;
 
@@ -81,25 +85,43 @@ private:
   bool normalize = false;
   bool useOrderPreservingTransform = false;
   int numThreadsDefault;
+  std::shared_ptr<ThreadPool> threadPool = ThreadPool::getDefault();
   std::atomic<hnswlib::labeltype> currentLabel;
   std::unique_ptr<hnswlib::HierarchicalNSW<dist_t, data_t>> algorithmImpl;
   std::unique_ptr<hnswlib::Space<dist_t, data_t>> spaceImpl;
   std::unique_ptr<voyager::Metadata::V1> metadata;
 
+  bool storeFullPrecisionVectors = false;
+  FullPrecisionVectorStore fullPrecisionVectors;
+  QueryCache queryCache;
+
+  hnswlib::MemoryPolicy memoryPolicy;
+  hnswlib::StatsCollector stats;
+
   mutable std::atomic<float> max_norm = 0.0;
 
+  // Declared last, so that it's destroyed (finishing any queries still in
+  // flight) before anything those queries use:
+  AsyncQueryBatcher asyncQueries{*this};
+
 public:
   /**
    * Create an empty index with the given parameters.
+   *
+   * The memory holding the index's elements is allocated according to
+   * `memoryPolicy`, which is also used for any index later loaded into this
+   * object with loadIndex.
    */
   TypedIndex(const SpaceType space, const int dimensions, const size_t M = 12,
              const size_t efConstruction = 200, const size_t randomSeed = 1,
              const size_t maxElements = 1,
-             const bool enableOrderPreservingTransform = true)
+             const bool enableOrderPreservingTransform = true,
+             const hnswlib::MemoryPolicy &memoryPolicy = {})
       : space(space), dimensions(dimensions),
         metadata(std::make_unique<voyager::Metadata::V1>(
             dimensions, space, getStorageDataType(), 0.0,
-            space == InnerProduct)) {
+            space == InnerProduct)),
+        fullPrecisionVectors(dimensions, space), memoryPolicy(memoryPolicy) {
     switch (space) {
     case Euclidean:
       spaceImpl = std::make_unique<
@@ -128,7 +150,8 @@ public:
 
     currentLabel = 0;
     algorithmImpl = std::make_unique<hnswlib::HierarchicalNSW<dist_t, data_t>>(
-        spaceImpl.get(), maxElements, M, efConstruction, randomSeed);
+        spaceImpl.get(), maxElements, M, efConstruction, randomSeed,
+        memoryPolicy);
 
     ep_added = false;
     algorithmImpl->ef_ = defaultEF;
@@ -150,7 +173,8 @@ public:
                    /* randomSeed */ 1, /* maxElements */ 1,
                    /* enableOrderPreservingTransform */ false) {
     algorithmImpl = std::make_unique<hnswlib::HierarchicalNSW<dist_t, data_t>>(
-        spaceImpl.get(), indexFilename, 0, searchOnly);
+        spaceImpl.get(), std::make_shared<FileInputStream>(indexFilename), 0,
+        searchOnly);
     currentLabel = algorithmImpl->cur_element_count;
   }
 
@@ -175,14 +199,15 @@ public:
    * it as the given Space and number of dimensions.
    */
   TypedIndex(std::unique_ptr<voyager::Metadata::V1> metadata,
-             std::shared_ptr<InputStream> inputStream, bool searchOnly = false)
+             std::shared_ptr<InputStream> inputStream, bool searchOnly = false,
+             const hnswlib::MemoryPolicy &memoryPolicy = {})
       : TypedIndex(metadata->getSpaceType(), metadata->getNumDimensions(),
                    /* M */ 12, /* efConstruction */ 200,
                    /* randomSeed */ 1, /* maxElements */ 1,
                    /* enableOrderPreservingTransform */
-                   metadata->getUseOrderPreservingTransform()) {
+                   metadata->getUseOrderPreservingTransform(), memoryPolicy) {
     algorithmImpl = std::make_unique<hnswlib::HierarchicalNSW<dist_t, data_t>>(
-        spaceImpl.get(), inputStream, 0, searchOnly);
+        spaceImpl.get(), inputStream, 0, searchOnly, memoryPolicy);
     max_norm = metadata->getMaxNorm();
     currentLabel = algorithmImpl->cur_element_count;
   }
@@ -217,17 +242,105 @@ public:
     defaultEF = ef;
     if (algorithmImpl)
       algorithmImpl->ef_ = ef;
+    queryCache.invalidate();
+  }
+
+  void setPrefetchDepth(size_t depth) {
+    algorithmImpl->setPrefetchDepth(depth);
+  }
+
+  size_t getPrefetchDepth() const { return algorithmImpl->getPrefetchDepth(); }
+
+  void setEarlyTerminationPatience(size_t patience) {
+    algorithmImpl->setEarlyTerminationPatience(patience);
+    queryCache.invalidate();
+  }
+
+  size_t getEarlyTerminationPatience() const {
+    return algorithmImpl->getEarlyTerminationPatience();
+  }
+
+  size_t calibrateEarlyTermination(NDArray<float, 2> queryVectors, int k,
+                                   float targetRecall, long queryEf = -1,
+                                   int numThreads = -1) {
+    return IndexUtils::calibrateEarlyTermination(*this, queryVectors, k,
+                                                 targetRecall, queryEf,
+                                                 numThreads);
   }
 
   void setNumThreads(int numThreads) { numThreadsDefault = numThreads; }
 
+  void setThreadPool(std::shared_ptr<ThreadPool> threadPool) {
+    if (!threadPool) {
+      throw std::invalid_argument("A thread pool must be provided.");
+    }
+    this->threadPool = threadPool;
+  }
+
+  /**
+   * Replace the contents of this index with the index stored in the given
+   * .hnsw file on disk.
+   *
+   * If searchOnly is true, the index will be memory-mapped rather than copied
+   * into memory where the platform supports it.
+   */
   void loadIndex(const std::string &pathToIndex, bool searchOnly = false) {
-    throw std::runtime_error("Not implemented.");
+    loadIndex(std::make_shared<FileInputStream>(pathToIndex), searchOnly);
   }
 
+  /**
+   * Replace the contents of this index with the index read from the given
+   * input stream. The stream's parameters (if present) must match this index.
+   */
   void loadIndex(std::shared_ptr<InputStream> inputStream,
                  bool searchOnly = false) {
-    throw std::runtime_error("Not implemented.");
+    std::unique_ptr<voyager::Metadata::V1> loadedMetadata =
+        voyager::Metadata::loadFromStream(inputStream);
+
+    if (loadedMetadata) {
+      checkLoadedMetadata(*loadedMetadata);
+    }
+
+    algorithmImpl = std::make_unique<hnswlib::HierarchicalNSW<dist_t, data_t>>(
+        spaceImpl.get(), inputStream, 0, searchOnly, memoryPolicy);
+    algorithmImpl->ef_ = defaultEF;
+
+    if (loadedMetadata) {
+      max_norm = loadedMetadata->getMaxNorm();
+      metadata = std::move(loadedMetadata);
+    }
+    currentLabel = algorithmImpl->cur_element_count;
+    fullPrecisionVectors.clear();
+    queryCache.invalidate();
+  }
+
+  void setStoreFullPrecisionVectors(bool enabled) {
+    storeFullPrecisionVectors = enabled;
+  }
+
+  bool getStoreFullPrecisionVectors() const {
+    return storeFullPrecisionVectors;
+  }
+
+  void saveFullPrecisionVectors(const std::string &path) {
+    saveFullPrecisionVectors(std::make_shared<FileOutputStream>(path));
+  }
+
+  void saveFullPrecisionVectors(std::shared_ptr<OutputStream> outputStream) {
+    fullPrecisionVectors.serializeToStream(outputStream);
+    outputStream->flush();
+  }
+
+  void loadFullPrecisionVectors(const std::string &path,
+                                bool memoryMap = false) {
+    loadFullPrecisionVectors(std::make_shared<FileInputStream>(path),
+                             memoryMap);
+  }
+
+  void loadFullPrecisionVectors(std::shared_ptr<InputStream> inputStream,
+                                bool memoryMap = false) {
+    fullPrecisionVectors.loadFromStream(inputStream, memoryMap);
+    queryCache.invalidate();
   }
 
   /**
@@ -250,6 +363,56 @@ public:
     algorithmImpl->saveIndex(outputStream);
   }
 
+  void saveCompressedIndex(const std::string &pathToIndex,
+                           int compressionLevel = DEFAULT_COMPRESSION_LEVEL) {
+    saveCompressedIndex(std::make_shared<FileOutputStream>(pathToIndex),
+                        compressionLevel);
+  }
+
+  void saveCompressedIndex(std::shared_ptr<OutputStream> outputStream,
+                           int compressionLevel = DEFAULT_COMPRESSION_LEVEL) {
+    IndexUtils::saveCompressedIndex(*this, outputStream, compressionLevel);
+  }
+
+  void saveDelta(const std::string &pathToDelta) {
+    saveDelta(std::make_shared<FileOutputStream>(pathToDelta));
+  }
+
+  void saveDelta(std::shared_ptr<OutputStream> outputStream) {
+    voyager::Metadata::DeltaHeader().serializeToStream(outputStream);
+    metadata->setMaxNorm(max_norm);
+    metadata->setUseOrderPreservingTransform(useOrderPreservingTransform);
+    metadata->serializeToStream(outputStream);
+    algorithmImpl->saveDelta(outputStream);
+    fullPrecisionVectors.serializeDeltaToStream(
+        outputStream, algorithmImpl->getChangedLabels());
+  }
+
+  void applyDelta(const std::string &pathToDelta) {
+    applyDelta(std::make_shared<FileInputStream>(pathToDelta));
+  }
+
+  void applyDelta(std::shared_ptr<InputStream> inputStream) {
+    voyager::Metadata::DeltaHeader().loadFromStream(inputStream);
+    std::unique_ptr<voyager::Metadata::V1> loadedMetadata =
+        voyager::Metadata::loadFromStream(inputStream);
+    if (!loadedMetadata) {
+      throw std::domain_error("Index delta is missing its index metadata.");
+    }
+    checkLoadedMetadata(*loadedMetadata);
+
+    algorithmImpl->applyDelta(inputStream);
+    // Copies that haven't loaded full-precision vectors don't re-rank, so
+    // they have no use for the vectors in the delta either:
+    fullPrecisionVectors.applyDelta(
+        inputStream, /* update= */ !fullPrecisionVectors.empty());
+
+    max_norm = loadedMetadata->getMaxNorm();
+    metadata = std::move(loadedMetadata);
+    currentLabel = algorithmImpl->cur_element_count;
+    queryCache.invalidate();
+  }
+
   float getDistance(std::vector<float> _a, std::vector<float> _b) {
     if ((int)_a.size() != dimensions || (int)_b.size() != dimensions) {
       throw std::runtime_error("Index has " + std::to_string(dimensions) +
@@ -284,15 +447,123 @@ public:
     return spaceImpl->get_dist_func()(a.data(), b.data(), actualDimensions);
   }
 
-  hnswlib::labeltype addItem(std::vector<float> vector,
+  /**
+   * Both queries and targets are converted as query vectors are, so with the
+   * order-preserving transform, these are plain inner product distances.
+   */
+  NDArray<dist_t, 2> getDistances(NDArray<float, 2> queries,
+                                  NDArray<float, 2> targets,
+                                  int numThreads = -1) {
+    int numQueries = std::get<0>(queries.shape);
+    int numTargets = std::get<0>(targets.shape);
+    if (std::get<1>(queries.shape) != dimensions ||
+        std::get<1>(targets.shape) != dimensions) {
+      throw std::runtime_error(
+          "Index has " + std::to_string(dimensions) +
+          " dimensions, but received vectors of size: " +
+          std::to_string(std::get<1>(queries.shape)) + " and " +
+          std::to_string(std::get<1>(targets.shape)) + ".");
+    }
+
+    if (numThreads <= 0) {
+      numThreads = numThreadsDefault;
+    }
+
+    size_t actualDimensions =
+        useOrderPreservingTransform ? dimensions + 1 : dimensions;
+    std::vector<float> inputArray(numThreads * actualDimensions, 0.0f);
+    std::vector<data_t> convertedQueries(numQueries * actualDimensions);
+    std::vector<data_t> convertedTargets(numTargets * actualDimensions);
+    threadPool->parallelFor(
+        0, numQueries + numTargets, numThreads,
+        [&](size_t row, size_t threadId) {
+          float *input = &inputArray[threadId * actualDimensions];
+          if (row < (size_t)numQueries) {
+            prepareQuery(queries[row], input,
+                         &convertedQueries[row * actualDimensions]);
+          } else {
+            row -= numQueries;
+            prepareQuery(targets[row], input,
+                         &convertedTargets[row * actualDimensions]);
+          }
+        });
+
+    // Distances are computed in tiles of queries and targets, so that every
+    // target in a tile is loaded once and compared against all of its queries:
+    const size_t queriesPerTile = maxQueriesPerBlock;
+    const size_t targetsPerTile = 1024;
+    size_t numQueryTiles = (numQueries + queriesPerTile - 1) / queriesPerTile;
+    size_t numTargetTiles = (numTargets + targetsPerTile - 1) / targetsPerTile;
+
+    NDArray<dist_t, 2> distances({numQueries, numTargets});
+    hnswlib::DISTFUNC<dist_t, data_t> distance = spaceImpl->get_dist_func();
+    threadPool->parallelFor(
+        0, numQueryTiles * numTargetTiles, numThreads,
+        [&](size_t tile, size_t) {
+          size_t startQuery = (tile / numTargetTiles) * queriesPerTile;
+          size_t endQuery =
+              std::min<size_t>(startQuery + queriesPerTile, numQueries);
+          size_t startTarget = (tile % numTargetTiles) * targetsPerTile;
+          size_t endTarget =
+              std::min<size_t>(startTarget + targetsPerTile, numTargets);
+
+          for (size_t t = startTarget; t < endTarget; t++) {
+            const data_t *target = &convertedTargets[t * actualDimensions];
+            for (size_t q = startQuery; q < endQuery; q++) {
+              distances[q][t] = distance(
+                  &convertedQueries[q * actualDimensions], target,
+                  actualDimensions);
+            }
+          }
+        });
+    return distances;
+  }
+
+  hnswlib::labeltype addItem(const std::vector<float> &vector,
+                             std::optional<hnswlib::labeltype> id) {
+    return addItem(vector.data(), vector.size(), id);
+  }
+
+  hnswlib::labeltype addItem(const float *vector, size_t numDimensions,
                              std::optional<hnswlib::labeltype> id) {
-    std::vector<size_t> ids;
+    checkNumDimensions(numDimensions);
+    hnswlib::labeltype label = id ? *id : currentLabel.fetch_add(1);
 
-    if (id) {
-      ids.push_back(*id);
+    int actualDimensions =
+        useOrderPreservingTransform ? dimensions + 1 : dimensions;
+    Scratch &scratch = getScratch();
+    scratch.input.resize(actualDimensions);
+    scratch.converted.resize(actualDimensions);
+    std::memcpy(scratch.input.data(), vector, dimensions * sizeof(float));
+    if (useOrderPreservingTransform) {
+      scratch.input[dimensions] = getDotFactorAndUpdateNorm(vector);
     }
 
-    return addItems(NDArray<float, 2>(vector, {1, (int)vector.size()}), ids)[0];
+    if (normalize) {
+      normalizeVector<dist_t, data_t, scalefactor>(
+          scratch.input.data(), scratch.converted.data(), actualDimensions);
+    } else {
+      floatToDataType<data_t, scalefactor>(
+          scratch.input.data(), scratch.converted.data(), actualDimensions);
+    }
+
+    QueryCache::ScopedInvalidation invalidateCache(queryCache);
+    if (storeFullPrecisionVectors) {
+      storeFullPrecisionVector(label, vector);
+    }
+
+    reserveSpaceFor(1);
+    while (true) {
+      try {
+        addPoint(scratch.converted.data(), label);
+        break;
+      } catch (IndexFullError &e) {
+        // Another thread filled the space we reserved:
+        reserveSpaceFor(1);
+      }
+    }
+    ep_added = true;
+    return label;
   }
 
   std::vector<hnswlib::labeltype>
@@ -308,40 +579,14 @@ public:
       numThreads = numThreadsDefault;
 
     size_t rows = std::get<0>(floatInput.shape);
-    size_t features = std::get<1>(floatInput.shape);
-
-    if (features != (size_t)dimensions) {
-      throw std::domain_error(
-          "The provided vector(s) have " + std::to_string(features) +
-          " dimensions, but this index expects vectors with " +
-          std::to_string(dimensions) + " dimensions.");
-    }
+    validateNewItems(floatInput, ids);
+    QueryCache::ScopedInvalidation invalidateCache(queryCache);
 
     std::vector<hnswlib::labeltype> idsToReturn(rows);
 
-    // avoid using threads when the number of searches is small:
-    if (rows <= ((size_t)numThreads * 4)) {
-      numThreads = 1;
-    }
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(rows, 1));
 
-    if (!ids.empty() && (unsigned long)ids.size() != rows) {
-      throw std::runtime_error(
-          std::to_string(rows) + " vectors were provided, but " +
-          std::to_string(ids.size()) +
-          " IDs were provided. If providing IDs along with vectors, the number "
-          "of provided IDs must match the number of vectors.");
-    }
-
-    // TODO: Should we always double the number of elements instead? Maybe use
-    // an adaptive algorithm to minimize both reallocations and memory usage?
-    while (getNumElements() + rows > getMaxElements()) {
-      try {
-        resizeIndex(getNumElements() + rows);
-      } catch (IndexCannotBeShrunkError &e) {
-        // Retry with a larger size; some other thread may have resized
-        // behind our back.
-      }
-    }
+    reserveSpaceFor(rows);
 
     int actualDimensions =
         useOrderPreservingTransform ? dimensions + 1 : dimensions;
@@ -368,7 +613,10 @@ public:
             inputVector.data(), convertedVector.data(), convertedVector.size());
       }
 
-      algorithmImpl->addPoint(convertedVector.data(), (size_t)id);
+      if (storeFullPrecisionVectors) {
+        storeFullPrecisionVector(id, floatInput[0]);
+      }
+      addPoint(convertedVector.data(), (size_t)id);
       start = 1;
       ep_added = true;
       idsToReturn[0] = id;
@@ -377,80 +625,158 @@ public:
     if (!normalize) {
       std::vector<float> inputArray(numThreads * actualDimensions);
       std::vector<data_t> convertedArray(numThreads * actualDimensions);
-      ParallelFor(start, rows, numThreads, [&](size_t row, size_t threadId) {
-        size_t startIndex = threadId * actualDimensions;
-        std::memcpy(&inputArray[startIndex], floatInput[row],
-                    dimensions * sizeof(float));
-
-        if (useOrderPreservingTransform) {
-          inputArray[startIndex + dimensions] =
-              getDotFactorAndUpdateNorm(floatInput[row]);
-        }
-
-        floatToDataType<data_t, scalefactor>(&inputArray[startIndex],
-                                             &convertedArray[startIndex],
-                                             actualDimensions);
-        size_t id = ids.size() ? ids.at(row) : (currentLabel.fetch_add(1));
-        try {
-          algorithmImpl->addPoint(convertedArray.data() + startIndex, id);
-        } catch (IndexFullError &e) {
-          // Resize the index and try again:
-          while (getNumElements() + rows > getMaxElements()) {
+      threadPool->parallelFor(
+          start, rows, numThreads, [&](size_t row, size_t threadId) {
+            size_t startIndex = threadId * actualDimensions;
+            std::memcpy(&inputArray[startIndex], floatInput[row],
+                        dimensions * sizeof(float));
+
+            if (useOrderPreservingTransform) {
+              inputArray[startIndex + dimensions] =
+                  getDotFactorAndUpdateNorm(floatInput[row]);
+            }
+
+            floatToDataType<data_t, scalefactor>(&inputArray[startIndex],
+                                                 &convertedArray[startIndex],
+                                                 actualDimensions);
+            size_t id = ids.size() ? ids.at(row) : (currentLabel.fetch_add(1));
+            if (storeFullPrecisionVectors) {
+              storeFullPrecisionVector(id, floatInput[row]);
+            }
             try {
-              // NOTE: This will resize the index to be at least as large as
-              // the number of elements we're trying to add, but may
-              // allocate more space than necessary.
-              resizeIndex(getNumElements() + rows);
-            } catch (IndexCannotBeShrunkError &e) {
-              // Retry with a larger size; some other thread may have resized
-              // behind our back.
+              addPoint(convertedArray.data() + startIndex, id);
+            } catch (IndexFullError &e) {
+              // Resize the index and try again:
+              while (getNumElements() + rows > getMaxElements()) {
+                try {
+                  // NOTE: This will resize the index to be at least as large
+                  // as the number of elements we're trying to add, but may
+                  // allocate more space than necessary.
+                  resizeIndex(getNumElements() + rows);
+                } catch (IndexCannotBeShrunkError &e) {
+                  // Retry with a larger size; some other thread may have
+                  // resized behind our back.
+                }
+              }
             }
-          }
-        }
-        idsToReturn[row] = id;
-      });
+            idsToReturn[row] = id;
+          });
     } else {
       std::vector<float> inputArray(numThreads * actualDimensions);
       std::vector<data_t> normalizedArray(numThreads * actualDimensions);
-      ParallelFor(start, rows, numThreads, [&](size_t row, size_t threadId) {
-        size_t startIndex = threadId * actualDimensions;
+      threadPool->parallelFor(
+          start, rows, numThreads, [&](size_t row, size_t threadId) {
+            size_t startIndex = threadId * actualDimensions;
 
-        std::memcpy(&inputArray[startIndex], floatInput[row],
-                    dimensions * sizeof(float));
+            std::memcpy(&inputArray[startIndex], floatInput[row],
+                        dimensions * sizeof(float));
 
-        if (useOrderPreservingTransform) {
-          inputArray[startIndex + dimensions] =
-              getDotFactorAndUpdateNorm(floatInput[row]);
-        }
+            if (useOrderPreservingTransform) {
+              inputArray[startIndex + dimensions] =
+                  getDotFactorAndUpdateNorm(floatInput[row]);
+            }
+
+            normalizeVector<dist_t, data_t, scalefactor>(
+                &inputArray[startIndex], &normalizedArray[startIndex],
+                actualDimensions);
+            size_t id = ids.size() ? ids.at(row) : (currentLabel.fetch_add(1));
+            if (storeFullPrecisionVectors) {
+              storeFullPrecisionVector(id, &inputArray[startIndex]);
+            }
 
-        normalizeVector<dist_t, data_t, scalefactor>(
-            &inputArray[startIndex], &normalizedArray[startIndex],
-            actualDimensions);
-        size_t id = ids.size() ? ids.at(row) : (currentLabel.fetch_add(1));
-
-        try {
-          algorithmImpl->addPoint(normalizedArray.data() + startIndex, id);
-        } catch (IndexFullError &e) {
-          // Resize the index and try again:
-          while (getNumElements() + rows > getMaxElements()) {
             try {
-              // NOTE: This will resize the index to be at least as large as
-              // the number of elements we're trying to add, but may
-              // allocate more space than necessary.
-              resizeIndex(getNumElements() + rows);
-            } catch (IndexCannotBeShrunkError &e) {
-              // Retry with a larger size; some other thread may have resized
-              // behind our back.
+              addPoint(normalizedArray.data() + startIndex, id);
+            } catch (IndexFullError &e) {
+              // Resize the index and try again:
+              while (getNumElements() + rows > getMaxElements()) {
+                try {
+                  // NOTE: This will resize the index to be at least as large
+                  // as the number of elements we're trying to add, but may
+                  // allocate more space than necessary.
+                  resizeIndex(getNumElements() + rows);
+                } catch (IndexCannotBeShrunkError &e) {
+                  // Retry with a larger size; some other thread may have
+                  // resized behind our back.
+                }
+              }
             }
-          }
-        }
-        idsToReturn[row] = id;
-      });
+            idsToReturn[row] = id;
+          });
     };
 
     return idsToReturn;
   }
 
+  std::vector<hnswlib::labeltype>
+  bulkAddItems(NDArray<float, 2> floatInput,
+               std::vector<hnswlib::labeltype> ids = {}, int numThreads = -1) {
+    if (numThreads <= 0)
+      numThreads = numThreadsDefault;
+
+    size_t rows = std::get<0>(floatInput.shape);
+    validateNewItems(floatInput, ids);
+    QueryCache::ScopedInvalidation invalidateCache(queryCache);
+    if (ids.empty()) {
+      ids.resize(rows);
+      for (size_t row = 0; row < rows; row++) {
+        ids[row] = currentLabel.fetch_add(1);
+      }
+    }
+    reserveSpaceFor(rows);
+
+    int actualDimensions =
+        useOrderPreservingTransform ? dimensions + 1 : dimensions;
+
+    // With the whole dataset known up front, every vector's dot factor can be
+    // computed from the final maximum norm:
+    if (useOrderPreservingTransform) {
+      threadPool->parallelFor(0, rows, numThreads, [&](size_t row, size_t) {
+        getDotFactorAndUpdateNorm(floatInput[row]);
+      });
+    }
+
+    std::vector<float> inputArray(numThreads * actualDimensions);
+    std::vector<data_t> convertedArray(rows * actualDimensions);
+    threadPool->parallelFor(
+        0, rows, numThreads, [&](size_t row, size_t threadId) {
+          float *input = &inputArray[threadId * actualDimensions];
+          std::memcpy(input, floatInput[row], dimensions * sizeof(float));
+          if (useOrderPreservingTransform) {
+            input[dimensions] =
+                getDotFactor(getNorm<dist_t, dist_t, scalefactor>(
+                    floatInput[row], dimensions));
+          }
+
+          if (normalize) {
+            normalizeVector<dist_t, data_t, scalefactor>(
+                input, &convertedArray[row * actualDimensions],
+                actualDimensions);
+          } else {
+            floatToDataType<data_t, scalefactor>(
+                input, &convertedArray[row * actualDimensions],
+                actualDimensions);
+          }
+        });
+
+    hnswlib::StatsCollector::takeThreadCounters();
+    auto start = std::chrono::steady_clock::now();
+    algorithmImpl->addPointsInBulk(
+        convertedArray.data(), ids.data(), rows,
+        [&](size_t begin, size_t end, auto fn) {
+          threadPool->parallelFor(begin, end, numThreads,
+                                  [&](size_t i, size_t) { fn(i); });
+        });
+    stats.recordInserts(rows, hnswlib::nanosecondsSince(start));
+    ep_added = true;
+
+    if (storeFullPrecisionVectors) {
+      for (size_t row = 0; row < rows; row++) {
+        storeFullPrecisionVector(ids[row], floatInput[row]);
+      }
+    }
+    return ids;
+  }
+
   dist_t getDotFactorAndUpdateNorm(const dist_t *data) {
     dist_t norm = getNorm<dist_t, dist_t, scalefactor>(data, dimensions);
     dist_t prevMaxNorm = max_norm;
@@ -478,6 +804,11 @@ public:
   }
 
   std::vector<float> getVector(hnswlib::labeltype id) {
+    std::vector<float> fullPrecisionVector(dimensions);
+    if (fullPrecisionVectors.get(id, fullPrecisionVector.data())) {
+      return fullPrecisionVector;
+    }
+
     std::vector<data_t> rawData = getRawVector(id);
     NDArray<data_t, 2> output(rawData.data(), {1, (int)dimensions});
     return dataTypeToFloat<data_t, scalefactor>(output).data;
@@ -495,6 +826,23 @@ public:
     return output;
   }
 
+  size_t getVectorsInto(const hnswlib::labeltype *ids, size_t numIds,
+                        float *output, hnswlib::labeltype *copiedIds) {
+    size_t numCopied = 0;
+    for (size_t i = 0; i < numIds; i++) {
+      const data_t *data = algorithmImpl->findDataByLabel(ids[i]);
+      if (!data) {
+        continue;
+      }
+      float *vector = output + numCopied * dimensions;
+      if (!fullPrecisionVectors.get(ids[i], vector)) {
+        dataTypeToFloat<data_t, scalefactor>(data, vector, dimensions);
+      }
+      copiedIds[numCopied++] = ids[i];
+    }
+    return numCopied;
+  }
+
   std::vector<hnswlib::labeltype> getIDs() const {
     std::vector<hnswlib::labeltype> ids;
     ids.reserve(algorithmImpl->label_lookup_.size());
@@ -515,17 +863,17 @@ public:
 
   std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<dist_t, 2>>
   query(std::vector<std::vector<float>> floatQueryVectors, int k = 1,
-        int numThreads = -1, long queryEf = -1) {
-    return query(vectorsToNDArray(floatQueryVectors), k, numThreads, queryEf);
+        int numThreads = -1, long queryEf = -1,
+        const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    return query(vectorsToNDArray(floatQueryVectors), k, numThreads, queryEf,
+                 filter, rerankK);
   }
 
   std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<dist_t, 2>>
   query(NDArray<float, 2> floatQueryVectors, int k = 1, int numThreads = -1,
-        long queryEf = -1) {
-    if (queryEf > 0 && queryEf < k) {
-      throw std::runtime_error("queryEf must be equal to or greater than the "
-                               "requested number of neighbors");
-    }
+        long queryEf = -1, const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
     int numRows = std::get<0>(floatQueryVectors.shape);
     int numFeatures = std::get<1>(floatQueryVectors.shape);
 
@@ -536,189 +884,486 @@ public:
 
     NDArray<hnswlib::labeltype, 2> labels({numRows, k});
     NDArray<dist_t, 2> distances({numRows, k});
+    queryInto(floatQueryVectors.data.data(), numRows, k, labels.data.data(),
+              distances.data.data(), numThreads, queryEf, filter, rerankK);
+    return {labels, distances};
+  }
 
-    hnswlib::labeltype *labelPointer = labels.data.data();
-    dist_t *distancePointer = distances.data.data();
+  void queryInto(const float *floatQueryVectors, size_t numRows, int k,
+                 hnswlib::labeltype *labelPointer, dist_t *distancePointer,
+                 int numThreads = -1, long queryEf = -1,
+                 const hnswlib::BaseFilterFunctor *filter = nullptr,
+                 size_t rerankK = 0, size_t *numResults = nullptr,
+                 long queryPatience = -1) {
+    if (queryEf > 0 && queryEf < k) {
+      throw std::runtime_error("queryEf must be equal to or greater than the "
+                               "requested number of neighbors");
+    }
 
     if (numThreads <= 0) {
       numThreads = numThreadsDefault;
     }
 
-    // avoid using threads when the number of searches is small:
-
-    if (numRows <= numThreads * 4) {
-      numThreads = 1;
-    }
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(numRows, 1));
 
     int actualDimensions =
         useOrderPreservingTransform ? dimensions + 1 : dimensions;
 
-    if (normalize == false) {
-      std::vector<float> inputArray(numThreads * actualDimensions);
-      std::vector<data_t> convertedArray(numThreads * actualDimensions);
-      ParallelFor(0, numRows, numThreads, [&](size_t row, size_t threadId) {
-        size_t start_idx = threadId * actualDimensions;
-
-        // Only copy at most `dimensions` from the input; if we're using
-        // the order-preserving transform, the remaining dimension will be 0
-        // anyways.
-        std::memcpy(&inputArray[start_idx], floatQueryVectors[row],
-                    dimensions * sizeof(float));
-
-        floatToDataType<data_t, scalefactor>(&inputArray[start_idx],
-                                             &convertedArray[start_idx],
-                                             actualDimensions);
-
-        std::priority_queue<std::pair<dist_t, hnswlib::labeltype>> result =
-            algorithmImpl->searchKnn((convertedArray.data() + start_idx), k,
-                                     nullptr, queryEf);
-
-        if (result.size() != (unsigned long)k) {
-          throw RecallError(
-              "Fewer than expected results were retrieved; only found " +
-              std::to_string(result.size()) + " of " + std::to_string(k) +
-              " requested neighbors. Reconstruct the index with a higher M "
-              "value to increase recall.");
-        }
-
-        for (int i = k - 1; i >= 0; i--) {
-          auto &result_tuple = result.top();
-
-          dist_t distance = result_tuple.first;
-          hnswlib::labeltype label = result_tuple.second;
-
-          distancePointer[row * k + i] = distance;
-          labelPointer[row * k + i] = label;
-          result.pop();
-        }
-      });
-    } else {
-      std::vector<float> inputArray(numThreads * actualDimensions);
-      std::vector<data_t> norm_array(numThreads * numFeatures);
-      ParallelFor(0, numRows, numThreads, [&](size_t row, size_t threadId) {
-        size_t start_idx = threadId * actualDimensions;
+    bool rerank = shouldRerank(k, rerankK);
+    size_t numCandidates = rerank ? rerankK : k;
+    if (rerank && queryEf > 0 && (size_t)queryEf < numCandidates) {
+      queryEf = numCandidates;
+    }
 
-        // Only copy at most `dimensions` from the input; if we're using
-        // the order-preserving transform, the remaining dimension will be 0
-        // anyways.
-        std::memcpy(&inputArray[start_idx], floatQueryVectors[row],
-                    dimensions * sizeof(float));
+    // Queries are searched in blocks, which allows the upper layers of the
+    // graph to be traversed once per block rather than once per query:
+    size_t queriesPerBlock = std::max<size_t>(
+        1, std::min<size_t>(maxQueriesPerBlock, numRows / numThreads));
+    size_t numBlocks = (numRows + queriesPerBlock - 1) / queriesPerBlock;
+    size_t blockSize = queriesPerBlock * actualDimensions;
+
+    // Any dimensions beyond `dimensions` (i.e.: if we're using the
+    // order-preserving transform) are zero-initialized here and never written.
+    std::vector<float> inputArray(numThreads * blockSize, 0.0f);
+    std::vector<data_t> convertedArray(numThreads * blockSize);
+    std::vector<size_t> numResultsArray(numThreads * queriesPerBlock);
+    size_t rerankCandidates = rerank ? numThreads * queriesPerBlock : 0;
+    std::vector<hnswlib::labeltype> candidateLabelArray(rerankCandidates *
+                                                        numCandidates);
+    std::vector<dist_t> candidateDistanceArray(rerankCandidates *
+                                               numCandidates);
+    std::vector<float> rerankArray(rerank ? numThreads * dimensions : 0);
+
+    // Filtered queries are never cached, as their results depend on the
+    // filter too (as are queries with their own patience):
+    bool useCache = !filter && queryPatience < 0 && queryCache.isEnabled();
+    uint64_t cacheGeneration = queryCache.getGeneration();
+    size_t cachedQueries = useCache ? numThreads * queriesPerBlock : 0;
+    std::vector<std::string> cacheKeys(cachedQueries);
+    std::vector<size_t> searchedRowsArray(cachedQueries);
+    std::vector<hnswlib::labeltype> scratchLabelArray(
+        rerank ? 0 : cachedQueries * k);
+    std::vector<dist_t> scratchDistanceArray(rerank ? 0 : cachedQueries * k);
+
+    threadPool->parallelFor(
+        0, numBlocks, numThreads, [&](size_t block, size_t threadId) {
+          hnswlib::StatsCollector::takeThreadCounters();
+          auto blockStart = std::chrono::steady_clock::now();
+          size_t startRow = block * queriesPerBlock;
+          size_t endRow = std::min<size_t>(startRow + queriesPerBlock, numRows);
+          float *blockInput = &inputArray[threadId * blockSize];
+          data_t *blockConverted = &convertedArray[threadId * blockSize];
+
+          for (size_t row = startRow; row < endRow; row++) {
+            size_t offset = (row - startRow) * actualDimensions;
+            prepareQuery(floatQueryVectors + (row * dimensions),
+                         blockInput + offset, blockConverted + offset);
+          }
 
-        normalizeVector<dist_t, data_t, scalefactor>(
-            &inputArray[start_idx], &norm_array[start_idx], actualDimensions);
-
-        std::priority_queue<std::pair<dist_t, hnswlib::labeltype>> result =
-            algorithmImpl->searchKnn(norm_array.data() + start_idx, k, nullptr,
-                                     queryEf);
-
-        if (result.size() != (unsigned long)k) {
-          throw RecallError(
-              "Fewer than expected results were retrieved; only found " +
-              std::to_string(result.size()) + " of " + std::to_string(k) +
-              " requested neighbors. Reconstruct the index with a higher M "
-              "value to increase recall.");
-        }
-
-        for (int i = k - 1; i >= 0; i--) {
-          auto &result_tuple = result.top();
-
-          dist_t distance = result_tuple.first;
-          hnswlib::labeltype label = result_tuple.second;
-
-          distancePointer[row * k + i] = distance;
-          labelPointer[row * k + i] = label;
-          result.pop();
-        }
-      });
-    }
+          size_t blockRows = endRow - startRow;
+          hnswlib::labeltype *blockOutputLabels = labelPointer + (startRow * k);
+          dist_t *blockOutputDistances = distancePointer + (startRow * k);
+
+          // Queries with cached results are answered immediately, and the
+          // rest are moved to the front of the block to be searched;
+          // `blockSearchedRows[i]` is the row of the i-th query searched.
+          size_t numSearched = blockRows;
+          std::string *blockKeys = nullptr;
+          size_t *blockSearchedRows = nullptr;
+          if (useCache) {
+            blockKeys = &cacheKeys[threadId * queriesPerBlock];
+            blockSearchedRows = &searchedRowsArray[threadId * queriesPerBlock];
+            numSearched = 0;
+            for (size_t i = 0; i < blockRows; i++) {
+              data_t *converted = blockConverted + (i * actualDimensions);
+              std::string key = getQueryCacheKey(converted, k, queryEf,
+                                                 rerank ? numCandidates : 0);
+              if (queryCache.lookup(key, k, blockOutputLabels + (i * k),
+                                    blockOutputDistances + (i * k))) {
+                if (numResults) {
+                  numResults[startRow + i] = k;
+                }
+                stats.recordQuery(hnswlib::nanosecondsSince(blockStart));
+                continue;
+              }
+              if (numSearched != i) {
+                size_t offset = numSearched * actualDimensions;
+                std::copy(converted, converted + actualDimensions,
+                          blockConverted + offset);
+                std::copy(blockInput + (i * actualDimensions),
+                          blockInput + ((i + 1) * actualDimensions),
+                          blockInput + offset);
+              }
+              blockKeys[numSearched] = std::move(key);
+              blockSearchedRows[numSearched++] = i;
+            }
+          }
+          auto outputRow = [&](size_t i) {
+            return blockSearchedRows ? blockSearchedRows[i] : i;
+          };
+
+          size_t *blockNumResults =
+              &numResultsArray[threadId * queriesPerBlock];
+          // Queries may only find fewer than k results if the caller asked
+          // how many each query found:
+          auto checkBlockResults = [&](size_t i) {
+            if (numResults) {
+              numResults[startRow + outputRow(i)] =
+                  std::min<size_t>(blockNumResults[i], k);
+            } else {
+              checkNumResults(blockNumResults[i], k);
+            }
+          };
+          if (!rerank) {
+            // Results are written straight into the output rows, unless some
+            // were answered by the cache and the rows no longer line up:
+            bool inPlace = numSearched == blockRows;
+            hnswlib::labeltype *searchLabels =
+                inPlace ? blockOutputLabels
+                        : &scratchLabelArray[threadId * queriesPerBlock * k];
+            dist_t *searchDistances =
+                inPlace ? blockOutputDistances
+                        : &scratchDistanceArray[threadId * queriesPerBlock * k];
+            algorithmImpl->searchKnnBatch(
+                blockConverted, numSearched, actualDimensions, k, searchLabels,
+                searchDistances, blockNumResults, queryEf, filter,
+                queryPatience);
+            for (size_t i = 0; i < numSearched; i++) {
+              checkBlockResults(i);
+              if (!inPlace) {
+                std::copy(searchLabels + (i * k), searchLabels + ((i + 1) * k),
+                          blockOutputLabels + (outputRow(i) * k));
+                std::copy(searchDistances + (i * k),
+                          searchDistances + ((i + 1) * k),
+                          blockOutputDistances + (outputRow(i) * k));
+              }
+            }
+          } else {
+            size_t candidatesPerBlock = queriesPerBlock * numCandidates;
+            hnswlib::labeltype *blockLabels =
+                &candidateLabelArray[threadId * candidatesPerBlock];
+            dist_t *blockDistances =
+                &candidateDistanceArray[threadId * candidatesPerBlock];
+            algorithmImpl->searchKnnBatch(
+                blockConverted, numSearched, actualDimensions, numCandidates,
+                blockLabels, blockDistances, blockNumResults, queryEf, filter,
+                queryPatience);
+
+            for (size_t i = 0; i < numSearched; i++) {
+              checkBlockResults(i);
+              const float *rerankQuery =
+                  prepareRerankQuery(blockInput + (i * actualDimensions),
+                                     &rerankArray[threadId * dimensions]);
+              fullPrecisionVectors.rerank(
+                  rerankQuery, blockLabels + (i * numCandidates),
+                  blockDistances + (i * numCandidates), blockNumResults[i], k,
+                  blockOutputLabels + (outputRow(i) * k),
+                  blockOutputDistances + (outputRow(i) * k));
+            }
+          }
 
-    return {labels, distances};
+          // Incomplete results are never cached, as lookups expect k. Each
+          // query's latency runs from the start of its block until its own
+          // results are complete:
+          for (size_t i = 0; i < numSearched; i++) {
+            if (useCache && blockNumResults[i] >= (size_t)k) {
+              queryCache.insert(blockKeys[i], cacheGeneration, k,
+                                blockOutputLabels + (outputRow(i) * k),
+                                blockOutputDistances + (outputRow(i) * k));
+            }
+            stats.recordQuery(hnswlib::nanosecondsSince(blockStart));
+          }
+        });
   }
 
   std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
-  query(std::vector<float> floatQueryVector, int k = 1, long queryEf = -1) {
+  query(const std::vector<float> &floatQueryVector, int k = 1,
+        long queryEf = -1, const hnswlib::BaseFilterFunctor *filter = nullptr,
+        size_t rerankK = 0) {
+    std::vector<hnswlib::labeltype> labels(k);
+    std::vector<dist_t> distances(k);
+    query(floatQueryVector.data(), floatQueryVector.size(), k, labels.data(),
+          distances.data(), queryEf, filter, rerankK);
+    return {labels, distances};
+  }
+
+  void query(const float *floatQueryVector, size_t numDimensions, int k,
+             hnswlib::labeltype *labels, dist_t *distances, long queryEf = -1,
+             const hnswlib::BaseFilterFunctor *filter = nullptr,
+             size_t rerankK = 0) {
     if (queryEf > 0 && queryEf < k) {
       throw std::runtime_error("queryEf must be equal to or greater than the "
                                "requested number of neighbors");
     }
 
-    int numFeatures = floatQueryVector.size();
-
-    if (numFeatures != dimensions) {
+    if (numDimensions != (size_t)dimensions) {
       throw std::runtime_error(
           "Query vector expected to share dimensionality with index.");
     }
 
-    int actualDimensions = dimensions;
-    if (useOrderPreservingTransform) {
-      actualDimensions = dimensions + 1;
-      floatQueryVector.push_back(0.0);
+    hnswlib::StatsCollector::takeThreadCounters();
+    auto queryStart = std::chrono::steady_clock::now();
+
+    bool rerank = shouldRerank(k, rerankK);
+    size_t numCandidates = rerank ? rerankK : k;
+    if (rerank && queryEf > 0 && (size_t)queryEf < numCandidates) {
+      queryEf = numCandidates;
     }
 
-    std::vector<hnswlib::labeltype> labels(k);
-    std::vector<dist_t> distances(k);
+    // Any dimension beyond `dimensions` (i.e.: if we're using the
+    // order-preserving transform) must be zero for prepareQuery:
+    int actualDimensions =
+        useOrderPreservingTransform ? dimensions + 1 : dimensions;
+    Scratch &scratch = getScratch();
+    scratch.input.assign(actualDimensions, 0.0f);
+    scratch.converted.resize(actualDimensions);
+    prepareQuery(floatQueryVector, scratch.input.data(),
+                 scratch.converted.data());
+
+    // Filtered queries are never cached, as their results depend on the
+    // filter too:
+    std::string cacheKey;
+    uint64_t cacheGeneration = 0;
+    if (!filter && queryCache.isEnabled()) {
+      cacheKey = getQueryCacheKey(scratch.converted.data(), k, queryEf,
+                                  rerank ? numCandidates : 0);
+      cacheGeneration = queryCache.getGeneration();
+      if (queryCache.lookup(cacheKey, k, labels, distances)) {
+        stats.recordQuery(hnswlib::nanosecondsSince(queryStart));
+        return;
+      }
+    }
 
-    hnswlib::labeltype *labelPointer = labels.data();
-    dist_t *distancePointer = distances.data();
+    if (!rerank) {
+      size_t numResults = algorithmImpl->searchKnnInto(
+          scratch.converted.data(), k, labels, distances, queryEf, filter);
+      checkNumResults(numResults, k);
+    } else {
+      scratch.candidateLabels.resize(numCandidates);
+      scratch.candidateDistances.resize(numCandidates);
+      size_t numResults = algorithmImpl->searchKnnInto(
+          scratch.converted.data(), numCandidates,
+          scratch.candidateLabels.data(), scratch.candidateDistances.data(),
+          queryEf, filter);
+      checkNumResults(numResults, k);
+
+      scratch.rerank.resize(dimensions);
+      fullPrecisionVectors.rerank(
+          prepareRerankQuery(floatQueryVector, scratch.rerank.data()),
+          scratch.candidateLabels.data(), scratch.candidateDistances.data(),
+          numResults, k, labels, distances);
+    }
 
-    if (normalize == false) {
-      const std::vector<data_t> queryVector =
-          floatToDataType<data_t, scalefactor>(floatQueryVector);
+    if (!cacheKey.empty()) {
+      queryCache.insert(cacheKey, cacheGeneration, k, labels, distances);
+    }
+    stats.recordQuery(hnswlib::nanosecondsSince(queryStart));
+  }
 
-      std::priority_queue<std::pair<dist_t, hnswlib::labeltype>> result =
-          algorithmImpl->searchKnn(queryVector.data(), k, nullptr, queryEf);
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<dist_t, 2>>
+  bruteForceQuery(NDArray<float, 2> floatQueryVectors, int k = 1,
+                  int numThreads = -1,
+                  const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    int numRows = std::get<0>(floatQueryVectors.shape);
+    if (std::get<1>(floatQueryVectors.shape) != dimensions) {
+      throw std::runtime_error(
+          "Query vectors expected to share dimensionality with index.");
+    }
 
-      if (result.size() != (unsigned long)k) {
-        throw RecallError(
-            "Fewer than expected results were retrieved; only found " +
-            std::to_string(result.size()) + " of " + std::to_string(k) +
-            " requested neighbors. Reconstruct the index with a higher M value "
-            "to increase recall.");
-      }
+    NDArray<hnswlib::labeltype, 2> labels({numRows, k});
+    NDArray<dist_t, 2> distances({numRows, k});
+    bruteForceQueryInto(floatQueryVectors.data.data(), numRows, k,
+                        labels.data.data(), distances.data.data(), numThreads,
+                        filter);
+    return {labels, distances};
+  }
 
-      for (int i = k - 1; i >= 0; i--) {
-        auto &result_tuple = result.top();
-        distancePointer[i] = result_tuple.first;
-        labelPointer[i] = result_tuple.second;
-        result.pop();
-      }
-    } else {
-      std::vector<data_t> norm_array(numFeatures);
-      normalizeVector<dist_t, data_t, scalefactor>(
-          floatQueryVector.data(), norm_array.data(), actualDimensions);
+  void bruteForceQueryInto(const float *floatQueryVectors, size_t numRows,
+                           int k, hnswlib::labeltype *labelPointer,
+                           dist_t *distancePointer, int numThreads = -1,
+                           const hnswlib::BaseFilterFunctor *filter = nullptr,
+                           size_t *numResults = nullptr) {
+    if (numThreads <= 0) {
+      numThreads = numThreadsDefault;
+    }
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(numRows, 1));
+
+    int actualDimensions =
+        useOrderPreservingTransform ? dimensions + 1 : dimensions;
 
-      std::priority_queue<std::pair<dist_t, hnswlib::labeltype>> result =
-          algorithmImpl->searchKnn(norm_array.data(), k, nullptr, queryEf);
+    // Every block of queries scans the whole index, so blocks are kept as
+    // large as possible while still giving each thread some work:
+    size_t queriesPerBlock = std::max<size_t>(
+        1, std::min<size_t>(maxQueriesPerBlock, numRows / numThreads));
+    size_t numBlocks = (numRows + queriesPerBlock - 1) / queriesPerBlock;
+    size_t blockSize = queriesPerBlock * actualDimensions;
+
+    std::vector<float> inputArray(numThreads * actualDimensions, 0.0f);
+    std::vector<data_t> convertedArray(numThreads * blockSize);
+    std::vector<size_t> numResultsArray(numThreads * queriesPerBlock);
+    threadPool->parallelFor(
+        0, numBlocks, numThreads, [&](size_t block, size_t threadId) {
+          hnswlib::StatsCollector::takeThreadCounters();
+          auto blockStart = std::chrono::steady_clock::now();
+          size_t startRow = block * queriesPerBlock;
+          size_t endRow = std::min<size_t>(startRow + queriesPerBlock, numRows);
+          data_t *blockConverted = &convertedArray[threadId * blockSize];
+          for (size_t row = startRow; row < endRow; row++) {
+            prepareQuery(floatQueryVectors + (row * dimensions),
+                         &inputArray[threadId * actualDimensions],
+                         blockConverted + (row - startRow) * actualDimensions);
+          }
 
-      if (result.size() != (unsigned long)k) {
-        throw RecallError(
-            "Fewer than expected results were retrieved; only found " +
-            std::to_string(result.size()) + " of " + std::to_string(k) +
-            " requested neighbors. Reconstruct the index with a higher M value "
-            "to increase recall.");
-      }
+          size_t blockRows = endRow - startRow;
+          size_t *blockNumResults =
+              &numResultsArray[threadId * queriesPerBlock];
+          algorithmImpl->bruteForceSearchBatch(
+              blockConverted, blockRows, actualDimensions, k,
+              labelPointer + (startRow * k), distancePointer + (startRow * k),
+              blockNumResults, filter);
+          for (size_t i = 0; i < blockRows; i++) {
+            if (numResults) {
+              numResults[startRow + i] = blockNumResults[i];
+            } else {
+              checkNumBruteForceResults(blockNumResults[i], k);
+            }
+          }
+          // Every query in the block is scanned against the index at once,
+          // so they all finish together:
+          stats.recordQueries(blockRows,
+                              hnswlib::nanosecondsSince(blockStart));
+        });
+  }
 
-      for (int i = k - 1; i >= 0; i--) {
-        auto &result_tuple = result.top();
+  void setGroups(const std::vector<hnswlib::labeltype> &ids,
+                 const std::vector<hnswlib::labeltype> &groups) {
+    if (ids.size() != groups.size()) {
+      throw std::invalid_argument(
+          "Expected one group per ID, but got " + std::to_string(ids.size()) +
+          " IDs and " + std::to_string(groups.size()) + " groups.");
+    }
+    algorithmImpl->setGroups(ids.data(), groups.data(), ids.size());
+  }
 
-        distancePointer[i] = result_tuple.first;
-        labelPointer[i] = result_tuple.second;
-        result.pop();
-      }
+  hnswlib::labeltype getGroup(hnswlib::labeltype id) {
+    return algorithmImpl->getGroup(id);
+  }
+
+  void groupedQueryInto(const float *floatQueryVectors, size_t numRows, int k,
+                        hnswlib::labeltype *labelPointer,
+                        dist_t *distancePointer, int numThreads = -1,
+                        long queryEf = -1,
+                        const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    if (queryEf > 0 && queryEf < k) {
+      throw std::runtime_error("queryEf must be equal to or greater than the "
+                               "requested number of neighbors");
+    }
+    if (numThreads <= 0) {
+      numThreads = numThreadsDefault;
     }
+    numThreads = std::min<size_t>(numThreads, std::max<size_t>(numRows, 1));
 
-    return {labels, distances};
+    int actualDimensions =
+        useOrderPreservingTransform ? dimensions + 1 : dimensions;
+    std::vector<float> inputArray(numThreads * actualDimensions, 0.0f);
+    std::vector<data_t> convertedArray(numThreads * actualDimensions);
+    threadPool->parallelFor(
+        0, numRows, numThreads, [&](size_t row, size_t threadId) {
+          hnswlib::StatsCollector::takeThreadCounters();
+          auto queryStart = std::chrono::steady_clock::now();
+          data_t *converted = &convertedArray[threadId * actualDimensions];
+          prepareQuery(floatQueryVectors + (row * dimensions),
+                       &inputArray[threadId * actualDimensions], converted);
+          size_t numResults = algorithmImpl->searchKnnGroupedInto(
+              converted, k, labelPointer + (row * k),
+              distancePointer + (row * k), queryEf, filter);
+          checkNumGroupedResults(numResults, k);
+          stats.recordQuery(hnswlib::nanosecondsSince(queryStart));
+        });
+  }
+
+  std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+  groupedQuery(const std::vector<float> &queryVector, int k = 1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return IndexUtils::groupedQuery(*this, queryVector, k, queryEf, filter);
+  }
+
+  std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+  groupedQuery(NDArray<float, 2> queryVectors, int k = 1, int numThreads = -1,
+               long queryEf = -1,
+               const hnswlib::BaseFilterFunctor *filter = nullptr) {
+    return IndexUtils::groupedQuery(*this, queryVectors, k, numThreads,
+                                    queryEf, filter);
   }
 
   void markDeleted(hnswlib::labeltype label) {
     algorithmImpl->markDelete(label);
+    queryCache.invalidate();
   }
 
   void unmarkDeleted(hnswlib::labeltype label) {
     algorithmImpl->unmarkDelete(label);
+    queryCache.invalidate();
+  }
+
+  void resizeIndex(size_t new_size) {
+    algorithmImpl->resizeIndex(new_size);
+    queryCache.invalidate();
+  }
+
+  void optimizeLayout() { algorithmImpl->reorderForLocality(); }
+
+  void packForSearch() { algorithmImpl->packForSearch(); }
+
+  void savePackedIndex(const std::string &pathToIndex) {
+    savePackedIndex(std::make_shared<FileOutputStream>(pathToIndex));
   }
 
-  void resizeIndex(size_t new_size) { algorithmImpl->resizeIndex(new_size); }
+  void savePackedIndex(std::shared_ptr<OutputStream> outputStream) {
+    metadata->setMaxNorm(max_norm);
+    metadata->setUseOrderPreservingTransform(useOrderPreservingTransform);
+    metadata->serializeToStream(outputStream);
+    algorithmImpl->savePackedIndex(outputStream);
+  }
+
+  size_t compact() {
+    std::vector<hnswlib::labeltype> removedLabels =
+        algorithmImpl->compactDeletedElements();
+    fullPrecisionVectors.erase(removedLabels);
+    queryCache.invalidate();
+    return removedLabels.size();
+  }
+
+  void setQueryCacheSize(size_t maxEntries) {
+    queryCache.setMaxEntries(maxEntries);
+  }
+
+  size_t getQueryCacheSize() const { return queryCache.getMaxEntries(); }
+
+  std::future<std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>>
+  queryAsync(std::vector<float> queryVector, int k = 1, long queryEf = -1,
+             size_t rerankK = 0) {
+    return asyncQueries.submit(std::move(queryVector), k, queryEf, rerankK);
+  }
+
+  void queryAsync(std::vector<float> queryVector, QueryCallback callback,
+                  int k = 1, long queryEf = -1, size_t rerankK = 0) {
+    asyncQueries.submit(std::move(queryVector), std::move(callback), k,
+                        queryEf, rerankK);
+  }
+
+  void setAsyncBatchWindow(std::chrono::microseconds window) {
+    asyncQueries.setWindow(window);
+  }
+
+  std::chrono::microseconds getAsyncBatchWindow() const {
+    return asyncQueries.getWindow();
+  }
+
+  hnswlib::IndexStats getStats() const { return stats.getStats(); }
+
+  void resetStats() { stats.reset(); }
 
   size_t getMaxElements() const { return algorithmImpl->max_elements_; }
 
@@ -733,14 +1378,191 @@ public:
 
   int getNumThreads() { return numThreadsDefault; }
 
+  std::shared_ptr<ThreadPool> getThreadPool() { return threadPool; }
+
   size_t getEfConstruction() const { return algorithmImpl->ef_construction_; }
 
   size_t getM() const { return algorithmImpl->M_; }
+
+private:
+  /**
+   * Throw if metadata read from a stream describes an index that can't be
+   * loaded into (or applied to) this one.
+   */
+  void checkLoadedMetadata(voyager::Metadata::V1 &loadedMetadata) {
+    if (loadedMetadata.getStorageDataType() != getStorageDataType()) {
+      throw std::domain_error(
+          "Storage data type of this index (" + getStorageDataTypeName() +
+          ") does not match the data type used in the loaded index (" +
+          toString(loadedMetadata.getStorageDataType()) + ").");
+    }
+    if (loadedMetadata.getSpaceType() != space) {
+      throw std::domain_error(
+          "Space type of this index (" + toString(space) +
+          ") does not match the space type used in the loaded index (" +
+          toString(loadedMetadata.getSpaceType()) + ").");
+    }
+    if (loadedMetadata.getNumDimensions() != dimensions) {
+      throw std::domain_error(
+          "Number of dimensions of this index (" + std::to_string(dimensions) +
+          ") does not match the number of dimensions used in the loaded "
+          "index (" +
+          std::to_string(loadedMetadata.getNumDimensions()) + ").");
+    }
+    if (loadedMetadata.getUseOrderPreservingTransform() !=
+        useOrderPreservingTransform) {
+      throw std::domain_error(
+          "The loaded index does not use the same order-preserving "
+          "transform setting as this index.");
+    }
+  }
+
+  void validateNewItems(const NDArray<float, 2> &floatInput,
+                        const std::vector<hnswlib::labeltype> &ids) const {
+    size_t rows = std::get<0>(floatInput.shape);
+    checkNumDimensions(std::get<1>(floatInput.shape));
+
+    if (!ids.empty() && (unsigned long)ids.size() != rows) {
+      throw std::runtime_error(
+          std::to_string(rows) + " vectors were provided, but " +
+          std::to_string(ids.size()) +
+          " IDs were provided. If providing IDs along with vectors, the number "
+          "of provided IDs must match the number of vectors.");
+    }
+  }
+
+  void checkNumDimensions(size_t features) const {
+    if (features != (size_t)dimensions) {
+      throw std::domain_error(
+          "The provided vector(s) have " + std::to_string(features) +
+          " dimensions, but this index expects vectors with " +
+          std::to_string(dimensions) + " dimensions.");
+    }
+  }
+
+  void reserveSpaceFor(size_t rows) {
+    // TODO: Should we always double the number of elements instead? Maybe use
+    // an adaptive algorithm to minimize both reallocations and memory usage?
+    while (getNumElements() + rows > getMaxElements()) {
+      try {
+        resizeIndex(getNumElements() + rows);
+      } catch (IndexCannotBeShrunkError &e) {
+        // Retry with a larger size; some other thread may have resized
+        // behind our back.
+      }
+    }
+  }
+
+  /**
+   * Buffers used to convert single vectors (for addItem and query), reused by
+   * every call on the same thread so that they are only allocated once.
+   */
+  struct Scratch {
+    std::vector<float> input;
+    std::vector<data_t> converted;
+    std::vector<hnswlib::labeltype> candidateLabels;
+    std::vector<dist_t> candidateDistances;
+    std::vector<float> rerank;
+  };
+
+  static Scratch &getScratch() {
+    thread_local Scratch scratch;
+    return scratch;
+  }
+
+  /**
+   * Add an already-converted vector to the graph, recording the insertion in
+   * this index's stats. The caller must invalidate the query cache.
+   */
+  void addPoint(const data_t *vector, hnswlib::labeltype id) {
+    hnswlib::StatsCollector::takeThreadCounters();
+    auto start = std::chrono::steady_clock::now();
+    algorithmImpl->addPoint(vector, id);
+    stats.recordInsert(hnswlib::nanosecondsSince(start));
+  }
+
+  /**
+   * Whether a query for `k` neighbors should re-rank `rerankK` candidates
+   * against their full-precision vectors.
+   */
+  bool shouldRerank(int k, size_t rerankK) const {
+    return rerankK > (size_t)k && !fullPrecisionVectors.empty();
+  }
+
+  /**
+   * Returns the form of `query` used to compute exact distances against
+   * full-precision vectors, normalizing it into `buffer` if necessary.
+   */
+  const float *prepareRerankQuery(const float *query, float *buffer) const {
+    if (!normalize) {
+      return query;
+    }
+    normalizeVector<float>(query, buffer, dimensions);
+    return buffer;
+  }
+
+  /**
+   * Store the full-precision form of a vector being added, for re-ranking.
+   * The caller must invalidate the query cache.
+   */
+  void storeFullPrecisionVector(hnswlib::labeltype id, const float *vector) {
+    if (normalize) {
+      std::vector<float> normalized(dimensions);
+      normalizeVector<float>(vector, normalized.data(), dimensions);
+      fullPrecisionVectors.set(id, normalized.data());
+    } else {
+      fullPrecisionVectors.set(id, vector);
+    }
+  }
+
+  /**
+   * The key under which the results of a query for the given (converted)
+   * vector and parameters are cached.
+   */
+  std::string getQueryCacheKey(const data_t *query, int k, long queryEf,
+                               size_t rerankK) const {
+    size_t actualDimensions =
+        useOrderPreservingTransform ? dimensions + 1 : dimensions;
+    return QueryCache::makeKey(query, actualDimensions * sizeof(data_t), k,
+                               queryEf > 0 ? queryEf : -1, rerankK);
+  }
+
+  /**
+   * Convert a query vector of `dimensions` floats to this index's storage
+   * data type (normalizing it if necessary), via `input`, which must have room
+   * for the index's actual number of dimensions. Any dimensions beyond
+   * `dimensions` (i.e.: if we're using the order-preserving transform) must
+   * already be zero in `input`, and are never written.
+   */
+  void prepareQuery(const float *query, float *input, data_t *output) const {
+    int actualDimensions =
+        useOrderPreservingTransform ? dimensions + 1 : dimensions;
+    std::memcpy(input, query, dimensions * sizeof(float));
+
+    if (normalize) {
+      normalizeVector<dist_t, data_t, scalefactor>(input, output,
+                                                   actualDimensions);
+    } else {
+      floatToDataType<data_t, scalefactor>(input, output, actualDimensions);
+    }
+  }
+
+  void checkNumResults(size_t numResults, int k) const {
+    if (numResults < (unsigned long)k) {
+      throw RecallError(
+          "Fewer than expected results were retrieved; only found " +
+          std::to_string(numResults) + " of " + std::to_string(k) +
+          " requested neighbors. Reconstruct the index with a higher M value "
+          "to increase recall.");
+    }
+  }
 };
 
 std::unique_ptr<Index>
 loadTypedIndexFromMetadata(std::unique_ptr<voyager::Metadata::V1> metadata,
-                           std::shared_ptr<InputStream> inputStream) {
+                           std::shared_ptr<InputStream> inputStream,
+                           bool searchOnly = false,
+                           const hnswlib::MemoryPolicy &memoryPolicy = {}) {
   if (!metadata) {
     throw std::domain_error(
         "The provided file contains no Voyager parameter metadata. Please "
@@ -754,19 +1576,30 @@ loadTypedIndexFromMetadata(std::unique_ptr<voyager::Metadata::V1> metadata,
       return std::make_unique<TypedIndex<float>>(
           std::unique_ptr<voyager::Metadata::V1>(
               (voyager::Metadata::V1 *)metadata.release()),
-          inputStream);
+          inputStream, searchOnly, memoryPolicy);
       break;
     case StorageDataType::Float8:
       return std::make_unique<TypedIndex<float, int8_t, std::ratio<1, 127>>>(
           std::unique_ptr<voyager::Metadata::V1>(
               (voyager::Metadata::V1 *)metadata.release()),
-          inputStream);
+          inputStream, searchOnly, memoryPolicy);
       break;
     case StorageDataType::E4M3:
       return std::make_unique<TypedIndex<float, E4M3>>(
           std::unique_ptr<voyager::Metadata::V1>(
               (voyager::Metadata::V1 *)metadata.release()),
-          inputStream);
+          inputStream, searchOnly, memoryPolicy);
+      break;
+    case StorageDataType::PQ:
+      if (!dynamic_cast<voyager::Metadata::V2 *>(v1)) {
+        throw std::domain_error("Product-quantized indices require version 2 "
+                                "metadata, but found version " +
+                                std::to_string(v1->version()) + ".");
+      }
+      return std::make_unique<PQIndex>(
+          std::unique_ptr<voyager::Metadata::V2>(
+              (voyager::Metadata::V2 *)metadata.release()),
+          inputStream, searchOnly, memoryPolicy);
       break;
     default:
       throw std::domain_error("Unknown storage data type: " +
@@ -778,7 +1611,11 @@ loadTypedIndexFromMetadata(std::unique_ptr<voyager::Metadata::V1> metadata,
 }
 
 std::unique_ptr<Index>
-loadTypedIndexFromStream(std::shared_ptr<InputStream> inputStream) {
+loadTypedIndexFromStream(std::shared_ptr<InputStream> inputStream,
+                         bool searchOnly = false,
+                         const hnswlib::MemoryPolicy &memoryPolicy = {}) {
+  inputStream = decompressIfNeeded(inputStream);
   return loadTypedIndexFromMetadata(
-      voyager::Metadata::loadFromStream(inputStream), inputStream);
+      voyager::Metadata::loadFromStream(inputStream), inputStream, searchOnly,
+      memoryPolicy);
 }
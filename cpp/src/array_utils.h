@@ -49,7 +49,7 @@ public:
   NDArray(std::vector<T> data, std::array<int, Dims> shape)
       : data(data), shape(shape), strides(computeStrides()) {}
 
-  NDArray(T *inputPointer, std::array<int, Dims> shape)
+  NDArray(const T *inputPointer, std::array<int, Dims> shape)
       : data(computeNumElements(shape)), shape(shape),
         strides(computeStrides()) {
     std::memcpy(data.data(), inputPointer, data.size() * sizeof(T));
@@ -195,6 +195,26 @@ std::vector<data_t> floatToDataType(const std::vector<float> input) {
   return output;
 }
 
+template <typename data_t, typename scalefactor = std::ratio<1, 1>>
+void dataTypeToFloat(const data_t *inputPointer, float *outputPointer,
+                     int dimensions) {
+  if constexpr (std::is_same_v<data_t, float>) {
+    if constexpr (scalefactor::num != scalefactor::den) {
+      throw std::runtime_error(
+          "Index has a non-unity scale factor set, but is using float32 data "
+          "storage. This combination is not yet implemented.");
+    }
+
+    std::memcpy(outputPointer, inputPointer, sizeof(float) * dimensions);
+  } else {
+    // Re-scale the input values by multiplying by `scalefactor`:
+    for (int i = 0; i < dimensions; i++) {
+      outputPointer[i] = ((float)inputPointer[i] * (float)scalefactor::num) /
+                         (float)scalefactor::den;
+    }
+  }
+}
+
 template <typename data_t, typename scalefactor = std::ratio<1, 1>>
 NDArray<float, 2> dataTypeToFloat(NDArray<data_t, 2> input) {
   // Handle rescaling to integer storage values if necessary:
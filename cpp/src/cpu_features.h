@@ -0,0 +1,140 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+#if defined(__aarch64__) && defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+/**
+ * Compiles a single function for a specific set of instruction set
+ * extensions, regardless of the flags the rest of the translation unit was
+ * compiled with. Functions marked this way must only be called after checking
+ * `CPUFeatures` for support.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define VOYAGER_TARGET(features) __attribute__((target(features)))
+#else
+#define VOYAGER_TARGET(features)
+#endif
+
+#if defined(__clang__)
+#define VOYAGER_TARGET_NEON_DOTPROD VOYAGER_TARGET("dotprod")
+#else
+#define VOYAGER_TARGET_NEON_DOTPROD VOYAGER_TARGET("+dotprod")
+#endif
+
+/**
+ * Hints to the CPU that the cache line containing `address` will soon be read,
+ * so that it can be fetched from memory while other work is being done.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define VOYAGER_PREFETCH(address) __builtin_prefetch((address), 0, 3)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define VOYAGER_PREFETCH(address)                                              \
+  _mm_prefetch((const char *)(address), _MM_HINT_T0)
+#else
+#define VOYAGER_PREFETCH(address) ((void)(address))
+#endif
+
+namespace hnswlib {
+
+/**
+ * The SIMD instruction set extensions supported by the CPU (and operating
+ * system) that we're currently running on, detected once per process via
+ * cpuid on x86 and via HWCAP (or sysctl on macOS) on aarch64.
+ */
+struct CPUFeatures {
+  bool avx = false;
+  bool avx2 = false;
+  bool avx512f = false;
+  bool avx512bw = false;
+  bool avx512vnni = false;
+  bool neonDotProd = false;
+
+  static const CPUFeatures &get() {
+    static const CPUFeatures features = detect();
+    return features;
+  }
+
+private:
+  static CPUFeatures detect() {
+    CPUFeatures features;
+
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      return features;
+    }
+
+    // AVX registers can only be used if the OS saves them on context
+    // switches, which it advertises through XCR0:
+    bool osxsave = ecx & (1 << 27);
+    bool cpuAVX = ecx & (1 << 28);
+    if (!osxsave) {
+      return features;
+    }
+
+    uint32_t xcr0Low, xcr0High;
+    __asm__ volatile("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    bool osAVX = (xcr0Low & 0x6) == 0x6;
+    bool osAVX512 = (xcr0Low & 0xE6) == 0xE6;
+
+    features.avx = cpuAVX && osAVX;
+    if (!features.avx || __get_cpuid_max(0, nullptr) < 7) {
+      return features;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    features.avx2 = ebx & (1 << 5);
+    features.avx512f = osAVX512 && (ebx & (1 << 16));
+    features.avx512bw = features.avx512f && (ebx & (1 << 30));
+    features.avx512vnni = features.avx512bw && (ecx & (1 << 11));
+#elif defined(__aarch64__) && defined(__linux__)
+    // HWCAP_ASIMDDP:
+    features.neonDotProd = getauxval(AT_HWCAP) & (1 << 20);
+#elif defined(__aarch64__) && defined(__APPLE__)
+    int64_t value = 0;
+    size_t size = sizeof(value);
+    if (sysctlbyname("hw.optional.arm.FEAT_DotProd", &value, &size, nullptr,
+                     0) == 0) {
+      features.neonDotProd = value != 0;
+    }
+#endif
+
+    return features;
+  }
+};
+} // namespace hnswlib
@@ -25,16 +25,26 @@
 
 #include "Spaces/Space.h"
 #include "hnswlib.h"
+#include "memory_policy.h"
+#include "search_heap.h"
+#include "segmented_array.h"
+#include "stats.h"
 #include "visited_list_pool.h"
+#include <algorithm>
 #include <assert.h>
 #include <atomic>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
+#include <future>
+#include <limits>
 #include <list>
+#include <numeric>
 #include <random>
 #include <shared_mutex>
 #include <stdlib.h>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -58,23 +68,64 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t, data_t> {
 public:
   static const tableint max_update_element_locks = 65536;
 
+  // In VisitedSetMode::Auto, searches that are expected to visit fewer than
+  // 1/COMPACT_VISITED_SET_RATIO of the index use a VisitedHashSet.
+  static const size_t COMPACT_VISITED_SET_RATIO = 32;
+
+  // How many neighbors ahead of the one being scored are prefetched by
+  // default while searching, and the maximum number of cache lines of each
+  // neighbor's vector to prefetch.
+  static const size_t DEFAULT_PREFETCH_DEPTH = 4;
+  static const size_t MAX_PREFETCH_LINES = 16;
+
+  // Index data is written to and read from streams in chunks of this size,
+  // which amortizes the per-call overhead of streams backed by Python or Java
+  // objects.
+  static const size_t STREAM_CHUNK_SIZE = 16 * 1024 * 1024;
+
+  // Index data written by savePackedIndex begins with the bytes "VYPK" and a
+  // version number. Other index data begins with offsetLevel0_, which is
+  // always zero, so the two can't be confused.
+  static constexpr uint32_t PACKED_FORMAT_TAG =
+      'V' | ('Y' << 8) | ('P' << 16) | ((uint32_t)'K' << 24);
+  static constexpr int PACKED_FORMAT_VERSION = 1;
+
+  // Indices with group assignments (see setGroups) write them before the rest
+  // of their data, beginning with the bytes "VYGR" and a version number. The
+  // stream readers below read ahead in chunks, so this can't follow the index
+  // data; indices without groups are saved exactly as before. Deltas always
+  // end with the same section, holding every assignment changed since the
+  // last full save.
+  static constexpr uint32_t GROUPS_SECTION_TAG =
+      'V' | ('Y' << 8) | ('G' << 16) | ((uint32_t)'R' << 24);
+  static constexpr int GROUPS_SECTION_VERSION = 1;
+
+  // The bounds on the number of elements in each segment of element storage.
+  // Segments are sized to fit the index's initial capacity, so that small
+  // indices don't allocate much more than they need and large indices don't
+  // need many segments.
+  static const size_t MIN_SEGMENT_ELEMENTS = 1024;
+  static const size_t MAX_SEGMENT_ELEMENTS = 1024 * 1024;
+
   HierarchicalNSW(Space<dist_t, data_t> *s,
                   std::shared_ptr<InputStream> inputStream,
-                  size_t max_elements = 0, bool search_only = false)
-      : search_only_(search_only) {
+                  size_t max_elements = 0, bool search_only = false,
+                  const MemoryPolicy &memory_policy = {})
+      : search_only_(search_only), memory_policy_(memory_policy) {
     loadIndex(inputStream, s, max_elements);
   }
 
   HierarchicalNSW(Space<dist_t, data_t> *s, size_t max_elements, size_t M = 16,
-                  size_t ef_construction = 200, size_t random_seed = 100)
-      : link_list_locks_(max_elements),
-        link_list_update_locks_(max_update_element_locks),
-        element_levels_(max_elements) {
+                  size_t ef_construction = 200, size_t random_seed = 100,
+                  const MemoryPolicy &memory_policy = {})
+      : link_list_update_locks_(max_update_element_locks),
+        memory_policy_(memory_policy) {
     max_elements_ = max_elements;
 
     num_deleted_ = 0;
     data_size_ = s->get_data_size();
     fstdistfunc_ = s->get_dist_func();
+    fstmultidistfunc_ = s->get_multi_dist_func();
     dist_func_param_ = s->get_dist_func_param();
     M_ = M;
     maxM_ = M_;
@@ -92,10 +143,12 @@ public:
     label_offset_ = size_links_level0_ + data_size_;
     offsetLevel0_ = 0;
 
-    data_level0_memory_ =
-        (char *)malloc(max_elements_ * size_data_per_element_);
-    if (data_level0_memory_ == nullptr)
-      throw std::runtime_error("Not enough memory");
+    initializeElementStorage(max_elements_);
+    data_level0_memory_.grow(max_elements_);
+    linkLists_.grow(max_elements_);
+    element_levels_.grow(max_elements_);
+    link_list_locks_.grow(max_elements_);
+    dirty_elements_.grow(numDirtyWords(max_elements_));
 
     cur_element_count = 0;
 
@@ -105,10 +158,6 @@ public:
     enterpoint_node_ = -1;
     maxlevel_ = -1;
 
-    linkLists_ = (char **)malloc(sizeof(void *) * max_elements_);
-    if (linkLists_ == nullptr)
-      throw std::runtime_error(
-          "Not enough memory: HierarchicalNSW failed to allocate linklists");
     size_links_per_element_ =
         maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
     mult_ = 1 / log(1.0 * M_);
@@ -123,13 +172,20 @@ public:
     }
   };
 
+  // A reusable heap of (distance, internal ID) pairs, ordered like the
+  // std::priority_queues used throughout this class.
+  typedef SearchHeap<std::pair<dist_t, tableint>, CompareByFirst> CandidateHeap;
+  typedef GroupedSearchResults<dist_t, tableint, labeltype> GroupedCandidates;
+
   ~HierarchicalNSW() {
-    free(data_level0_memory_);
-    for (tableint i = 0; i < cur_element_count; i++) {
-      if (element_levels_[i] > 0)
-        free(linkLists_[i]);
+    // Memory-mapped data is owned by memory_mapped_file_, and arena-allocated
+    // link lists by link_list_arena_, not by us.
+    if (!memory_mapped_file_ && !memory_policy_.arenaLinkLists && !packed_) {
+      for (tableint i = 0; i < cur_element_count; i++) {
+        if (element_levels_[i] > 0)
+          free(linkLists_[i]);
+      }
     }
-    free(linkLists_);
     delete visited_list_pool_;
   }
 
@@ -147,11 +203,18 @@ public:
   double mult_, revSize_;
   int maxlevel_;
 
+  // Held exclusively only by operations that move elements around in memory
+  // (i.e.: permuteInternalIds); growing the index does not move elements.
   std::shared_mutex resizeLock;
+  // Serializes the allocation of new element storage in resizeIndex:
+  std::mutex growth_guard_;
   VisitedListPool *visited_list_pool_;
+  VisitedSetMode visited_set_mode_ = VisitedSetMode::Dense;
+  size_t prefetch_depth_ = DEFAULT_PREFETCH_DEPTH;
+  size_t early_termination_patience_ = 0;
   std::mutex cur_element_count_guard_;
 
-  std::vector<std::mutex> link_list_locks_;
+  SegmentedArray<std::mutex> link_list_locks_;
 
   // Locks to prevent race condition during update/insert of an element at same
   // time. Note: Locks for additions can also be used to prevent this race
@@ -163,48 +226,96 @@ public:
   size_t size_links_level0_;
   size_t offsetData_, offsetLevel0_;
 
-  char *data_level0_memory_;
-  char **linkLists_;
-  std::vector<int> element_levels_;
+  // Storage for each element's bottom-layer block (its links, vector and
+  // label), pointers to its upper-layer link lists, and its level. These
+  // grow in segments, so existing elements never move as the index grows.
+  SegmentedArray<char> data_level0_memory_;
+  SegmentedArray<char *> linkLists_;
+  SegmentedArray<int> element_levels_;
+  // One bit per element, set whenever its block or link lists change, so that
+  // saveDelta can write only the elements changed since the last full save.
+  // Not allocated in search-only mode, as search-only indices never change.
+  SegmentedArray<std::atomic<uint64_t>> dirty_elements_;
 
   size_t data_size_;
 
   bool search_only_ = false;
 
+  // Set by packForSearch, after which each element's bottom-layer links,
+  // vector and label are stored in the packed_* arrays below rather than in
+  // data_level0_memory_, and linkLists_ points into packed_upper_links_.
+  bool packed_ = false;
+  // Each element's bottom-layer link list: its header, followed by exactly
+  // as many links as it holds. Lists start at packed_link_offsets_[i]:
+  std::vector<linklistsizeint> packed_links_;
+  std::vector<uint32_t> packed_link_offsets_;
+  std::vector<char> packed_vectors_;
+  // Only one of these is used; labels take 4 bytes each if they all fit:
+  std::vector<uint32_t> packed_labels32_;
+  std::vector<labeltype> packed_labels64_;
+  std::vector<char> packed_upper_links_;
+
+  // If non-null, data_level0_memory_ and linkLists_ point into this mapping.
+  std::shared_ptr<MemoryMappedFile> memory_mapped_file_;
+
+  MemoryPolicy memory_policy_;
+  // Upper-layer link lists are allocated from here if
+  // memory_policy_.arenaLinkLists is set:
+  LinkListArena link_list_arena_;
+
   size_t label_offset_;
   DISTFUNC<dist_t, data_t> fstdistfunc_;
+  MULTIDISTFUNC<dist_t, data_t> fstmultidistfunc_;
   size_t dist_func_param_;
   std::unordered_map<labeltype, tableint> label_lookup_;
+  // The group that each label belongs to, for grouped searches. Labels that
+  // aren't in this map are each in a group of their own:
+  std::unordered_map<labeltype, labeltype> label_groups_;
+  // The labels whose group assignments have changed since the last full save,
+  // for saveDelta to write:
+  std::unordered_set<labeltype> changed_groups_;
 
   std::default_random_engine level_generator_;
   std::default_random_engine update_probability_generator_;
 
   inline labeltype getExternalLabel(tableint internal_id) const {
+    if (packed_) {
+      return packed_labels64_.empty() ? packed_labels32_[internal_id]
+                                      : packed_labels64_[internal_id];
+    }
+
     labeltype return_label;
-    memcpy(&return_label,
-           (data_level0_memory_ + internal_id * size_data_per_element_ +
-            label_offset_),
+    memcpy(&return_label, getElementBlock(internal_id) + label_offset_,
            sizeof(labeltype));
     return return_label;
   }
 
   inline void setExternalLabel(tableint internal_id, labeltype label) const {
-    memcpy((data_level0_memory_ + internal_id * size_data_per_element_ +
-            label_offset_),
-           &label, sizeof(labeltype));
+    memcpy(getElementBlock(internal_id) + label_offset_, &label,
+           sizeof(labeltype));
   }
 
   inline labeltype *getExternalLabeLp(tableint internal_id) const {
-    return (labeltype *)(data_level0_memory_ +
-                         internal_id * size_data_per_element_ + label_offset_);
+    return (labeltype *)(getElementBlock(internal_id) + label_offset_);
   }
 
   inline data_t *getDataByInternalId(tableint internal_id) const {
-    return reinterpret_cast<data_t *>(data_level0_memory_ +
-                                      internal_id * size_data_per_element_ +
+    if (packed_) {
+      return (data_t *)(packed_vectors_.data() + internal_id * data_size_);
+    }
+    return reinterpret_cast<data_t *>(getElementBlock(internal_id) +
                                       offsetData_);
   }
 
+  inline void prefetchData(tableint internal_id) const {
+    const char *data = (const char *)getDataByInternalId(internal_id);
+    size_t bytes = std::min(data_size_, MAX_PREFETCH_LINES * 64);
+    for (size_t offset = 0; offset < bytes; offset += 64)
+      VOYAGER_PREFETCH(data + offset);
+    // The vector may not start on a cache line boundary:
+    VOYAGER_PREFETCH(data + bytes - 1);
+  }
+
   int getRandomLevel(double reverse_size) {
     std::uniform_real_distribution<double> distribution(0.0, 1.0);
     double r = -log(distribution(level_generator_)) * reverse_size;
@@ -214,7 +325,7 @@ public:
   std::priority_queue<std::pair<dist_t, tableint>,
                       std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
   searchBaseLayer(tableint ep_id, const data_t *data_point, int layer,
-                  VisitedList *vl = nullptr) {
+                  VisitedList *vl = nullptr, bool lockLinks = true) {
     bool wasPassedVisitedList = vl != nullptr;
     if (!wasPassedVisitedList) {
       vl = visited_list_pool_->getFreeVisitedList();
@@ -222,6 +333,7 @@ public:
       vl->reset();
     }
 
+    ThreadCounters &counters = ThreadCounters::get();
     vl_type *visited_array = vl->mass;
     vl_type visited_array_tag = vl->curV;
 
@@ -257,7 +369,10 @@ public:
 
       tableint curNodeNum = curr_el_pair.second;
 
-      std::unique_lock<std::mutex> lock(link_list_locks_[curNodeNum]);
+      std::unique_lock<std::mutex> lock(link_list_locks_[curNodeNum],
+                                        std::defer_lock);
+      if (lockLinks)
+        lockAndCountWait(lock);
 
       int *data; // = (int *)(linkList0_ + curNodeNum *
                  // size_links_per_element0_);
@@ -270,11 +385,26 @@ public:
       }
       size_t size = getListCount((linklistsizeint *)data);
       tableint *datal = (tableint *)(data + 1);
+      counters.hops++;
+      counters.distanceComputations += size;
+
+      size_t depth = std::min(prefetch_depth_, size);
+      for (size_t j = 0; j < depth; j++) {
+        VOYAGER_PREFETCH(visited_array + datal[j]);
+        prefetchData(datal[j]);
+      }
 
       for (size_t j = 0; j < size; j++) {
         tableint candidate_id = *(datal + j);
+        if (depth > 0 && j + depth < size) {
+          VOYAGER_PREFETCH(visited_array + datal[j + depth]);
+          prefetchData(datal[j + depth]);
+        }
         //                    if (candidate_id == 0) continue;
-        if (visited_array[candidate_id] == visited_array_tag)
+        // Elements added after our visited list was allocated (if the index
+        // grew while we were searching) are skipped:
+        if (candidate_id >= vl->numelements ||
+            visited_array[candidate_id] == visited_array_tag)
           continue;
         visited_array[candidate_id] = visited_array_tag;
         data_t *currObj1 = getDataByInternalId(candidate_id);
@@ -302,37 +432,116 @@ public:
     return top_candidates;
   }
 
-  mutable std::atomic<long> metric_distance_computations;
-  mutable std::atomic<long> metric_hops;
+  /**
+   * Returns true if a bottom-layer search with the given ef should track
+   * visited elements in a VisitedHashSet rather than in a VisitedList.
+   */
+  bool shouldUseCompactVisitedSet(size_t ef) const {
+    switch (visited_set_mode_) {
+    case VisitedSetMode::Dense:
+      return false;
+    case VisitedSetMode::Compact:
+      return true;
+    case VisitedSetMode::Auto:
+    default:
+      // A search visits roughly ef * maxM0_ elements; if that's a small
+      // fraction of the index, a hash set stays in cache where a VisitedList
+      // (two bytes per element in the index) would not.
+      return ef * maxM0_ * COMPACT_VISITED_SET_RATIO < cur_element_count;
+    }
+  }
 
   template <bool has_deletions, bool collect_metrics = false>
   std::priority_queue<std::pair<dist_t, tableint>,
                       std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
   searchBaseLayerST(tableint ep_id, const data_t *data_point, size_t ef,
-                    VisitedList *vl = nullptr) const {
-    bool wasPassedVisitedList = vl != nullptr;
-    if (!wasPassedVisitedList) {
-      vl = visited_list_pool_->getFreeVisitedList();
-    } else {
+                    VisitedList *vl = nullptr,
+                    const BaseFilterFunctor *filter = nullptr) const {
+    CandidateHeap top_candidates;
+    searchBaseLayerSTWithDistance<has_deletions, collect_metrics>(
+        [&](tableint id) {
+          return fstdistfunc_(data_point, getDataByInternalId(id),
+                              dist_func_param_);
+        },
+        ep_id, ef, vl, filter, top_candidates);
+    return std::priority_queue<std::pair<dist_t, tableint>,
+                               std::vector<std::pair<dist_t, tableint>>,
+                               CompareByFirst>(CompareByFirst(),
+                                               top_candidates.release());
+  }
+
+  /**
+   * Searches the bottom layer of the graph, using `distanceToQuery(id)` to
+   * compute the distance between the query and each visited element. This
+   * allows queries to be represented differently from stored elements (e.g.:
+   * as a lookup table of distances to quantized codes).
+   *
+   * The (up to) `ef` best elements found are left in `top_candidates`, which
+   * must be empty when passed in. If `patience` is non-zero, the search stops
+   * once that many nodes in a row have been expanded without improving a full
+   * list of candidates.
+   */
+  template <bool has_deletions, bool collect_metrics = false,
+            typename DistanceToQuery>
+  void searchBaseLayerSTWithDistance(const DistanceToQuery &distanceToQuery,
+                                     tableint ep_id, size_t ef,
+                                     VisitedList *vl,
+                                     const BaseFilterFunctor *filter,
+                                     CandidateHeap &top_candidates,
+                                     size_t patience = 0) const {
+    // Each thread reuses its own candidate heap across searches, so that
+    // searches stop allocating once this heap has grown large enough:
+    thread_local CandidateHeap candidate_set;
+    candidate_set.clear();
+    top_candidates.reserve(ef + 1);
+
+    if (vl != nullptr) {
       vl->reset();
+      DenseVisitedSet visited(vl);
+      searchBaseLayerST<has_deletions, collect_metrics>(
+          visited, distanceToQuery, ep_id, ef, filter, top_candidates,
+          candidate_set, patience);
+      return;
     }
 
-    vl_type *visited_array = vl->mass;
-    vl_type visited_array_tag = vl->curV;
+    if (shouldUseCompactVisitedSet(ef)) {
+      // Each thread reuses its own hash set across searches (and indices),
+      // so its storage only grows to the size of the largest search it ran:
+      thread_local VisitedHashSet compactVisited;
+      compactVisited.reset();
+      searchBaseLayerST<has_deletions, collect_metrics>(
+          compactVisited, distanceToQuery, ep_id, ef, filter, top_candidates,
+          candidate_set, patience);
+      return;
+    }
 
-    std::priority_queue<std::pair<dist_t, tableint>,
-                        std::vector<std::pair<dist_t, tableint>>,
-                        CompareByFirst>
-        top_candidates;
-    std::priority_queue<std::pair<dist_t, tableint>,
-                        std::vector<std::pair<dist_t, tableint>>,
-                        CompareByFirst>
-        candidate_set;
+    vl = visited_list_pool_->getFreeVisitedList();
+    DenseVisitedSet visited(vl);
+    try {
+      searchBaseLayerST<has_deletions, collect_metrics>(
+          visited, distanceToQuery, ep_id, ef, filter, top_candidates,
+          candidate_set, patience);
+      visited_list_pool_->releaseVisitedList(vl);
+    } catch (...) {
+      visited_list_pool_->releaseVisitedList(vl);
+      throw;
+    }
+  }
 
+  template <bool has_deletions, bool collect_metrics, typename VisitedSet,
+            typename DistanceToQuery>
+  void searchBaseLayerST(VisitedSet &visited,
+                         const DistanceToQuery &distanceToQuery,
+                         tableint ep_id, size_t ef,
+                         const BaseFilterFunctor *filter,
+                         CandidateHeap &top_candidates,
+                         CandidateHeap &candidate_set,
+                         size_t patience = 0) const {
+    ThreadCounters &counters = ThreadCounters::get();
+    size_t expansionsWithoutImprovement = 0;
     dist_t lowerBound;
-    if (!has_deletions || !isMarkedDeleted(ep_id)) {
-      dist_t dist = fstdistfunc_(data_point, getDataByInternalId(ep_id),
-                                 dist_func_param_);
+    if (!has_deletions || isAllowedInResults(ep_id, filter)) {
+      dist_t dist = distanceToQuery(ep_id);
       lowerBound = dist;
       top_candidates.emplace(dist, ep_id);
       candidate_set.emplace(-dist, ep_id);
@@ -341,7 +550,7 @@ public:
       candidate_set.emplace(-lowerBound, ep_id);
     }
 
-    visited_array[ep_id] = visited_array_tag;
+    visited.insert(ep_id);
 
     while (!candidate_set.empty()) {
 
@@ -359,24 +568,40 @@ public:
       //                bool cur_node_deleted =
       //                isMarkedDeleted(current_node_id);
       if (collect_metrics) {
-        metric_hops++;
-        metric_distance_computations += size;
+        counters.hops++;
+        counters.distanceComputations += size;
+      }
+
+      // Keep the vectors and visited entries of the next `depth` neighbors in
+      // flight while scoring the current one, and start fetching the link
+      // list of the candidate most likely to be expanded next:
+      size_t depth = std::min(prefetch_depth_, size);
+      if (depth > 0) {
+        if (!candidate_set.empty())
+          VOYAGER_PREFETCH(get_linklist0(candidate_set.top().second));
+        for (size_t j = 1; j <= depth; j++) {
+          visited.prefetch(data[j]);
+          prefetchData(data[j]);
+        }
       }
 
+      bool improved = false;
       for (size_t j = 1; j <= size; j++) {
         int candidate_id = *(data + j);
+        if (depth > 0 && j + depth <= size) {
+          visited.prefetch(data[j + depth]);
+          prefetchData(data[j + depth]);
+        }
         //                    if (candidate_id == 0) continue;
-        if (!(visited_array[candidate_id] == visited_array_tag)) {
-
-          visited_array[candidate_id] = visited_array_tag;
-
-          data_t *currObj1 = (getDataByInternalId(candidate_id));
-          dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
+        if (visited.insert(candidate_id)) {
+          dist_t dist = distanceToQuery(candidate_id);
 
           if (top_candidates.size() < ef || lowerBound > dist) {
             candidate_set.emplace(-dist, candidate_id);
-            if (!has_deletions || !isMarkedDeleted(candidate_id))
+            if (!has_deletions || isAllowedInResults(candidate_id, filter)) {
               top_candidates.emplace(dist, candidate_id);
+              improved = true;
+            }
 
             if (top_candidates.size() > ef)
               top_candidates.pop();
@@ -386,12 +611,27 @@ public:
           }
         }
       }
-    }
 
-    if (!wasPassedVisitedList) {
-      visited_list_pool_->releaseVisitedList(vl);
+      // Only full candidate lists can stop early, so that at least `ef`
+      // results are always returned if the graph has that many:
+      if (patience > 0 && top_candidates.size() == ef) {
+        expansionsWithoutImprovement =
+            improved ? 0 : expansionsWithoutImprovement + 1;
+        if (expansionsWithoutImprovement >= patience) {
+          break;
+        }
+      }
     }
-    return top_candidates;
+  }
+
+  /**
+   * Returns true if the given element may be returned from a search; i.e.: it
+   * is not marked as deleted, and is accepted by the filter (if provided).
+   */
+  inline bool isAllowedInResults(tableint internalId,
+                                 const BaseFilterFunctor *filter) const {
+    return !isMarkedDeleted(internalId) &&
+           (!filter || (*filter)(getExternalLabel(internalId)));
   }
 
   void getNeighborsByHeuristic2(
@@ -440,16 +680,11 @@ public:
   }
 
   linklistsizeint *get_linklist0(tableint internal_id) const {
-    return (linklistsizeint *)(data_level0_memory_ +
-                               internal_id * size_data_per_element_ +
-                               offsetLevel0_);
-  };
-
-  linklistsizeint *get_linklist0(tableint internal_id,
-                                 char *data_level0_memory_) const {
-    return (linklistsizeint *)(data_level0_memory_ +
-                               internal_id * size_data_per_element_ +
-                               offsetLevel0_);
+    if (packed_) {
+      return (linklistsizeint *)packed_links_.data() +
+             packed_link_offsets_[internal_id];
+    }
+    return (linklistsizeint *)(getElementBlock(internal_id) + offsetLevel0_);
   };
 
   linklistsizeint *get_linklist(tableint internal_id, int level) const {
@@ -496,6 +731,7 @@ public:
             "The newly inserted element should have blank link list");
       }
       setListCount(ll_cur, selectedNeighbors.size());
+      markDirty(cur_c);
       tableint *data = (tableint *)(ll_cur + 1);
       for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
         if (data[idx] && !isUpdate)
@@ -511,7 +747,8 @@ public:
     for (size_t idx = 0; idx < selectedNeighbors.size(); idx++) {
 
       std::unique_lock<std::mutex> lock(
-          link_list_locks_[selectedNeighbors[idx]]);
+          link_list_locks_[selectedNeighbors[idx]], std::defer_lock);
+      lockAndCountWait(lock);
 
       linklistsizeint *ll_other;
       if (level == 0)
@@ -545,6 +782,7 @@ public:
       // `selectedNeighbors[idx]` then no need to modify any connections or run
       // the heuristics.
       if (!is_cur_c_present) {
+        markDirty(selectedNeighbors[idx]);
         if (sz_link_list_other < Mcurmax) {
           data[sz_link_list_other] = cur_c;
           setListCount(ll_other, sz_link_list_other + 1);
@@ -602,6 +840,38 @@ public:
 
   void setEf(size_t ef) { ef_ = ef; }
 
+  void setVisitedSetMode(VisitedSetMode mode) { visited_set_mode_ = mode; }
+  VisitedSetMode getVisitedSetMode() const { return visited_set_mode_; }
+
+  /**
+   * Sets how many neighbors ahead of the current one have their vectors and
+   * visited entries prefetched while searching. Zero disables prefetching.
+   */
+  void setPrefetchDepth(size_t depth) { prefetch_depth_ = depth; }
+  size_t getPrefetchDepth() const { return prefetch_depth_; }
+
+  /**
+   * Sets how many consecutive nodes a query may expand without improving its
+   * list of `ef` best candidates before it stops searching early. Easy
+   * queries converge quickly and stop well before exhausting their `ef`
+   * budget; hard queries keep improving and use all of it. Zero disables
+   * early termination.
+   */
+  void setEarlyTerminationPatience(size_t patience) {
+    early_termination_patience_ = patience;
+  }
+  size_t getEarlyTerminationPatience() const {
+    return early_termination_patience_;
+  }
+
+  /**
+   * The early termination patience of a search; i.e.: `queryPatience` if it
+   * is non-negative, or this index's patience otherwise.
+   */
+  size_t getEarlyTerminationPatience(long queryPatience) const {
+    return queryPatience >= 0 ? queryPatience : early_termination_patience_;
+  }
+
   std::priority_queue<std::pair<dist_t, tableint>>
   searchKnnInternal(data_t *query_data, int k, VisitedList *vl = nullptr) {
     std::priority_queue<std::pair<dist_t, tableint>> top_candidates;
@@ -651,292 +921,1097 @@ public:
     return top_candidates;
   };
 
+  /**
+   * Change the maximum number of elements this index can hold.
+   *
+   * Growing the index allocates new segments of element storage without
+   * moving any existing elements, so searches and insertions can continue
+   * while the index grows. Shrinking the index only lowers its maximum size;
+   * memory already allocated is kept until the index is destroyed.
+   */
   void resizeIndex(size_t new_max_elements) {
     if (search_only_)
       throw std::runtime_error(
           "resizeIndex is not supported in search only mode");
-    std::unique_lock<std::shared_mutex> lock(resizeLock);
+    std::shared_lock<std::shared_mutex> lock(resizeLock);
+    std::unique_lock<std::mutex> growthLock(growth_guard_);
 
-    if (new_max_elements < cur_element_count)
-      throw IndexCannotBeShrunkError(
-          "Cannot resize to " + std::to_string(new_max_elements) +
-          " elements, as this index already contains " +
-          std::to_string(cur_element_count) + " elements.");
+    auto checkNotShrunk = [&]() {
+      if (new_max_elements < cur_element_count)
+        throw IndexCannotBeShrunkError(
+            "Cannot resize to " + std::to_string(new_max_elements) +
+            " elements, as this index already contains " +
+            std::to_string(cur_element_count) + " elements.");
+    };
 
-    delete visited_list_pool_;
-    visited_list_pool_ = new VisitedListPool(1, new_max_elements);
+    {
+      std::unique_lock<std::mutex> countLock(cur_element_count_guard_);
+      checkNotShrunk();
+    }
 
-    element_levels_.resize(new_max_elements);
+    data_level0_memory_.grow(new_max_elements);
+    linkLists_.grow(new_max_elements);
+    element_levels_.grow(new_max_elements);
+    link_list_locks_.grow(new_max_elements);
+    dirty_elements_.grow(numDirtyWords(new_max_elements));
+    visited_list_pool_->growTo(data_level0_memory_.capacity());
 
-    std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
+    // Elements may have been added while we were allocating:
+    std::unique_lock<std::mutex> countLock(cur_element_count_guard_);
+    checkNotShrunk();
+    max_elements_ = new_max_elements;
+  }
 
-    // Reallocate base layer
-    char *data_level0_memory_new = (char *)realloc(
-        data_level0_memory_, new_max_elements * size_data_per_element_);
-    if (data_level0_memory_new == nullptr)
+  /**
+   * Renumbers the internal IDs of this index so that neighbors in the graph
+   * are stored near each other in memory, reducing cache and TLB misses while
+   * searching. Elements are ordered by a breadth-first traversal of the
+   * bottom layer, starting from the entry point.
+   *
+   * Labels, distances, and search results are unchanged, and the index is
+   * saved in the usual format afterwards.
+   */
+  void reorderForLocality() {
+    if (search_only_)
       throw std::runtime_error(
-          "Not enough memory: resizeIndex failed to allocate base layer");
-    data_level0_memory_ = data_level0_memory_new;
+          "reorderForLocality is not supported in search only mode");
 
-    // Reallocate all other layers
-    char **linkLists_new =
-        (char **)realloc(linkLists_, sizeof(void *) * new_max_elements);
-    if (linkLists_new == nullptr)
-      throw std::runtime_error(
-          "Not enough memory: resizeIndex failed to allocate other layers");
-    linkLists_ = linkLists_new;
+    std::unique_lock<std::shared_mutex> lock(resizeLock);
+    size_t numElements = cur_element_count;
+    if (numElements == 0)
+      return;
 
-    max_elements_ = new_max_elements;
-  }
+    std::vector<tableint> order;
+    order.reserve(numElements);
+    std::vector<bool> seen(numElements, false);
+
+    auto traverseFrom = [&](tableint start) {
+      if (seen[start])
+        return;
+      seen[start] = true;
+      // `order` doubles as the BFS queue:
+      size_t head = order.size();
+      order.push_back(start);
+      for (; head < order.size(); head++) {
+        linklistsizeint *ll = get_linklist0(order[head]);
+        size_t size = getListCount(ll);
+        tableint *links = (tableint *)(ll + 1);
+        for (size_t j = 0; j < size; j++) {
+          if (!seen[links[j]]) {
+            seen[links[j]] = true;
+            order.push_back(links[j]);
+          }
+        }
+      }
+    };
 
-  void saveIndex(const std::string &filename) {
-    saveIndex(std::make_shared<FileOutputStream>(filename));
+    traverseFrom(enterpoint_node_);
+    for (tableint i = 0; i < numElements; i++)
+      traverseFrom(i);
+
+    std::vector<tableint> newIds(numElements);
+    for (size_t i = 0; i < numElements; i++)
+      newIds[order[i]] = i;
+
+    permuteInternalIdsLocked(newIds);
   }
 
-  void saveIndex(std::shared_ptr<OutputStream> output) {
-    writeBinaryPOD(output, offsetLevel0_);
-    writeBinaryPOD(output, max_elements_);
-    writeBinaryPOD(output, cur_element_count);
-    writeBinaryPOD(output, size_data_per_element_);
-    writeBinaryPOD(output, label_offset_);
-    writeBinaryPOD(output, offsetData_);
-    writeBinaryPOD(output, maxlevel_);
-    writeBinaryPOD(output, enterpoint_node_);
-    writeBinaryPOD(output, maxM_);
+  /**
+   * Moves each element with internal ID `i` to internal ID `newIds[i]`,
+   * rewriting every link list, the label lookup table and the element levels
+   * to match. `newIds` must be a permutation of [0, cur_element_count).
+   */
+  void permuteInternalIds(const std::vector<tableint> &newIds) {
+    if (search_only_)
+      throw std::runtime_error(
+          "permuteInternalIds is not supported in search only mode");
+    std::unique_lock<std::shared_mutex> lock(resizeLock);
+    permuteInternalIdsLocked(newIds);
+  }
 
-    writeBinaryPOD(output, maxM0_);
-    writeBinaryPOD(output, M_);
-    writeBinaryPOD(output, mult_);
-    writeBinaryPOD(output, ef_construction_);
+  void permuteInternalIdsLocked(const std::vector<tableint> &newIds) {
+    size_t numElements = cur_element_count;
+    if (newIds.size() != numElements)
+      throw std::invalid_argument(
+          "Expected a permutation of " + std::to_string(numElements) +
+          " internal IDs, but got " + std::to_string(newIds.size()) + ".");
+
+    std::vector<bool> isTarget(numElements, false);
+    for (tableint newId : newIds) {
+      if (newId >= numElements || isTarget[newId])
+        throw std::invalid_argument(
+            "The provided internal IDs are not a permutation of [0, " +
+            std::to_string(numElements) + ").");
+      isTarget[newId] = true;
+    }
 
-    output->write(data_level0_memory_,
-                  cur_element_count * size_data_per_element_);
+    auto remapLinks = [&](linklistsizeint *ll) {
+      size_t size = getListCount(ll);
+      tableint *links = (tableint *)(ll + 1);
+      for (size_t j = 0; j < size; j++)
+        links[j] = newIds[links[j]];
+    };
+
+    for (tableint i = 0; i < numElements; i++) {
+      remapLinks(get_linklist0(i));
+      for (int level = 1; level <= element_levels_[i]; level++)
+        remapLinks(get_linklist(i, level));
+    }
 
-    for (size_t i = 0; i < cur_element_count; i++) {
-      unsigned int linkListSize =
-          element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i]
-                                 : 0;
-      writeBinaryPOD(output, linkListSize);
-      if (linkListSize)
-        output->write(linkLists_[i], linkListSize);
+    // Move each element's bottom-layer block into place by following the
+    // cycles of the permutation, to avoid a second copy of the whole index:
+    std::vector<char> carried(size_data_per_element_);
+    std::vector<char> displaced(size_data_per_element_);
+    std::vector<bool> placed(numElements, false);
+    for (tableint start = 0; start < numElements; start++) {
+      if (placed[start])
+        continue;
+      memcpy(carried.data(), getElementBlock(start), size_data_per_element_);
+      tableint current = start;
+      do {
+        placed[current] = true;
+        tableint destination = newIds[current];
+        memcpy(displaced.data(), getElementBlock(destination),
+               size_data_per_element_);
+        memcpy(getElementBlock(destination), carried.data(),
+               size_data_per_element_);
+        carried.swap(displaced);
+        current = destination;
+      } while (current != start);
     }
-  }
 
-  void loadIndex(std::shared_ptr<InputStream> inputStream,
-                 Space<dist_t, data_t> *s, size_t max_elements_i = 0) {
-    size_t totalFileSize = 0;
-    if (inputStream->isSeekable()) {
-      totalFileSize = inputStream->getTotalLength();
+    std::vector<char *> newLinkLists(numElements);
+    std::vector<int> newElementLevels(numElements);
+    for (tableint i = 0; i < numElements; i++) {
+      newLinkLists[newIds[i]] = linkLists_[i];
+      newElementLevels[newIds[i]] = element_levels_[i];
     }
-    readBinaryPOD(inputStream, offsetLevel0_);
-    if (totalFileSize > 0 && offsetLevel0_ > totalFileSize) {
-      throw std::domain_error("Index appears to contain corrupted data; level "
-                              "0 offset parameter (" +
-                              std::to_string(offsetLevel0_) +
-                              ") exceeded size of index file (" +
-                              std::to_string(totalFileSize) + ").");
+    for (tableint i = 0; i < numElements; i++) {
+      linkLists_[i] = newLinkLists[i];
+      element_levels_[i] = newElementLevels[i];
     }
 
-    readBinaryPOD(inputStream, max_elements_);
-    readBinaryPOD(inputStream, cur_element_count);
+    for (auto &entry : label_lookup_)
+      entry.second = newIds[entry.second];
 
-    size_t max_elements = max_elements_i;
-    if (max_elements < cur_element_count)
-      max_elements = max_elements_;
-    max_elements_ = max_elements;
-    readBinaryPOD(inputStream, size_data_per_element_);
-    readBinaryPOD(inputStream, label_offset_);
-    readBinaryPOD(inputStream, offsetData_);
-    readBinaryPOD(inputStream, maxlevel_);
-    readBinaryPOD(inputStream, enterpoint_node_);
+    if (enterpoint_node_ != (tableint)-1)
+      enterpoint_node_ = newIds[enterpoint_node_];
 
-    if (enterpoint_node_ >= cur_element_count) {
+    // Elements (and the links to them) have moved, so a delta has to
+    // rewrite every one of them:
+    setAllDirty(true);
+  }
+
+  /**
+   * Permanently removes every element marked as deleted from this index.
+   * Links to each deleted element are replaced with links to its surviving
+   * neighbors (chosen with the same heuristic used during insertion), and the
+   * remaining elements are renumbered densely so that their slots can be
+   * reused by new elements and so that queries no longer skip tombstones.
+   *
+   * Labels of the remaining elements are unchanged. Returns the labels of the
+   * elements that were removed.
+   */
+  std::vector<labeltype> compactDeletedElements() {
+    if (search_only_)
       throw std::runtime_error(
-          "Index seems to be corrupted or unsupported. "
-          "Entry point into HNSW data structure was at element index " +
-          std::to_string(enterpoint_node_) + ", but only " +
-          std::to_string(cur_element_count) +
-          " elements are present in the index.");
-    }
+          "compactDeletedElements is not supported in search only mode");
 
-    readBinaryPOD(inputStream, maxM_);
-    readBinaryPOD(inputStream, maxM0_);
-    readBinaryPOD(inputStream, M_);
-    readBinaryPOD(inputStream, mult_);
-    readBinaryPOD(inputStream, ef_construction_);
+    std::unique_lock<std::shared_mutex> lock(resizeLock);
+    std::vector<labeltype> removedLabels;
+    if (num_deleted_ == 0)
+      return removedLabels;
 
-    data_size_ = s->get_data_size();
-    fstdistfunc_ = s->get_dist_func();
-    dist_func_param_ = s->get_dist_func_param();
+    size_t numElements = cur_element_count;
+    for (tableint i = 0; i < numElements; i++) {
+      if (isMarkedDeleted(i))
+        continue;
+      for (int level = 0; level <= element_levels_[i]; level++)
+        relinkAroundDeletedElements(i, level);
+    }
 
-    size_links_per_element_ =
-        maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+    // Keep the remaining elements in their current (possibly optimized)
+    // order, and move every deleted element past the end of the index:
+    std::vector<tableint> newIds(numElements);
+    tableint numRemaining = 0;
+    for (tableint i = 0; i < numElements; i++)
+      if (!isMarkedDeleted(i))
+        newIds[i] = numRemaining++;
+    tableint nextRemoved = numRemaining;
+    for (tableint i = 0; i < numElements; i++) {
+      if (isMarkedDeleted(i)) {
+        newIds[i] = nextRemoved++;
+        removedLabels.push_back(getExternalLabel(i));
+      }
+    }
 
-    size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+    // Each deleted element's links are still intact at this point, but no
+    // longer have to be: nothing links to a deleted element any more.
+    enterpoint_node_ = -1;
+    maxlevel_ = -1;
+    for (tableint i = 0; i < numElements; i++) {
+      if (!isMarkedDeleted(i) && element_levels_[i] > maxlevel_) {
+        enterpoint_node_ = i;
+        maxlevel_ = element_levels_[i];
+      }
+    }
 
-    size_t expected_size_per_element =
-        size_links_level0_ + data_size_ + sizeof(labeltype);
-    if (size_data_per_element_ != expected_size_per_element) {
-      throw std::domain_error(
-          "Storage data type does not match the index data being loaded; "
-          "expected " +
-          std::to_string(expected_size_per_element) +
-          " bytes per element, but loaded data contains " +
-          std::to_string(size_data_per_element_) +
-          " bytes per element. Data being loaded might not be a Voyager index, "
-          "may be corrupt, or may be using a different storage data type.");
+    permuteInternalIdsLocked(newIds);
+
+    for (tableint i = numRemaining; i < numElements; i++) {
+      freeLinkLists(i);
+      linkLists_[i] = nullptr;
+      element_levels_[i] = 0;
+      memset(getElementBlock(i), 0, size_data_per_element_);
+    }
+    for (labeltype label : removedLabels) {
+      label_lookup_.erase(label);
+      if (label_groups_.erase(label) && !search_only_)
+        changed_groups_.insert(label);
     }
 
-    long long position = inputStream->getPosition();
+    cur_element_count = numRemaining;
+    num_deleted_ = 0;
+    return removedLabels;
+  }
 
-    if (inputStream->isSeekable()) {
-      inputStream->advanceBy(cur_element_count * size_data_per_element_);
-      for (size_t i = 0; i < cur_element_count; i++) {
-        if (inputStream->getPosition() < 0 ||
-            inputStream->getPosition() >= (long long)totalFileSize) {
-          throw std::runtime_error(
-              "Index seems to be corrupted or unsupported. Seeked to " +
-              std::to_string(position +
-                             (cur_element_count * size_data_per_element_) +
-                             (sizeof(unsigned int) * i)) +
-              " bytes to read linked list, but resulting stream position was " +
-              std::to_string(inputStream->getPosition()) +
-              " (of total file size " + std::to_string(totalFileSize) +
-              " bytes).");
-        }
+  /**
+   * Replaces any links from `internalId` to deleted elements at the given
+   * level with links chosen from its other neighbors and from the neighbors of
+   * the deleted elements it was linked to.
+   */
+  void relinkAroundDeletedElements(tableint internalId, int level) {
+    linklistsizeint *ll = get_linklist_at_level(internalId, level);
+    size_t size = getListCount(ll);
+    tableint *links = (tableint *)(ll + 1);
+
+    bool linksToDeletedElement = false;
+    for (size_t j = 0; j < size && !linksToDeletedElement; j++)
+      linksToDeletedElement = isMarkedDeleted(links[j]);
+    if (!linksToDeletedElement)
+      return;
 
-        unsigned int linkListSize;
-        readBinaryPOD(inputStream, linkListSize);
-        if (linkListSize != 0) {
-          if ((size_t)inputStream->getPosition() + linkListSize >
-              totalFileSize) {
-            throw std::runtime_error(
-                "Index seems to be corrupted or unsupported. Advancing to the "
-                "next linked list requires " +
-                std::to_string(linkListSize) +
-                " additional bytes (from position " +
-                std::to_string(inputStream->getPosition()) +
-                "), but index data only has " + std::to_string(totalFileSize) +
-                " bytes in total.");
-          }
-          inputStream->advanceBy(linkListSize);
-        }
+    std::priority_queue<std::pair<dist_t, tableint>,
+                        std::vector<std::pair<dist_t, tableint>>,
+                        CompareByFirst>
+        candidates;
+    std::unordered_set<tableint> considered = {internalId};
+    auto consider = [&](tableint candidate) {
+      if (isMarkedDeleted(candidate) || !considered.insert(candidate).second)
+        return;
+      candidates.emplace(fstdistfunc_(getDataByInternalId(internalId),
+                                      getDataByInternalId(candidate),
+                                      dist_func_param_),
+                         candidate);
+    };
+
+    for (size_t j = 0; j < size; j++) {
+      if (!isMarkedDeleted(links[j])) {
+        consider(links[j]);
+        continue;
       }
+      linklistsizeint *deletedLinkList = get_linklist_at_level(links[j], level);
+      size_t deletedSize = getListCount(deletedLinkList);
+      tableint *deletedLinks = (tableint *)(deletedLinkList + 1);
+      for (size_t k = 0; k < deletedSize; k++)
+        consider(deletedLinks[k]);
+    }
 
-      if (inputStream->getPosition() != (long long)totalFileSize)
-        throw std::runtime_error(
-            "Index seems to be corrupted or unsupported. After reading all "
-            "linked lists, extra data remained at the end of the index.");
+    getNeighborsByHeuristic2(candidates, level == 0 ? maxM0_ : maxM_);
 
-      inputStream->setPosition(position);
+    setListCount(ll, candidates.size());
+    for (size_t j = 0; !candidates.empty(); j++) {
+      links[j] = candidates.top().second;
+      candidates.pop();
     }
+  }
 
-    data_level0_memory_ = (char *)malloc(max_elements * size_data_per_element_);
-    if (data_level0_memory_ == nullptr) {
-      throw std::runtime_error(
-          "Not enough memory: loadIndex failed to allocate level0 (" +
-          std::to_string(max_elements * size_data_per_element_) + " bytes)");
-    }
+  inline char *getElementBlock(tableint internalId) const {
+    return data_level0_memory_.at(internalId);
+  }
 
-    {
-      size_t bytes_to_read = cur_element_count * size_data_per_element_;
-      size_t bytes_read = inputStream->read(data_level0_memory_, bytes_to_read);
-      if (bytes_read != bytes_to_read) {
-        throw std::runtime_error("Tried to read " +
-                                 std::to_string(bytes_to_read) +
-                                 " bytes from stream, but only received " +
-                                 std::to_string(bytes_read) + " bytes!");
-      }
+  /**
+   * Reset this index's element storage, sizing its segments for an index
+   * that's expected to hold about `expected_elements` elements.
+   */
+  void initializeElementStorage(size_t expected_elements) {
+    size_t elementsPerSegment =
+        std::min(std::max(expected_elements, MIN_SEGMENT_ELEMENTS),
+                 MAX_SEGMENT_ELEMENTS);
+    linkLists_.reset(elementsPerSegment);
+    element_levels_.reset(elementsPerSegment);
+    link_list_locks_.reset(elementsPerSegment);
+    dirty_elements_.reset(numDirtyWords(elementsPerSegment));
+
+    // Memory is allocated in whole (possibly huge) pages, so make sure each
+    // bottom-layer segment fills at least one of them:
+    if (!memory_policy_.usesSystemAllocator()) {
+      size_t pageSize = memory_policy_.getPageSize();
+      elementsPerSegment =
+          std::max(elementsPerSegment,
+                   (pageSize + size_data_per_element_ - 1) /
+                       size_data_per_element_);
     }
+    data_level0_memory_.reset(elementsPerSegment, size_data_per_element_,
+                              memory_policy_);
+    link_list_arena_.reset(memory_policy_);
+  }
 
-    linkLists_ = (char **)malloc(sizeof(void *) * max_elements);
-    if (linkLists_ == nullptr)
-      throw std::runtime_error(
-          "Not enough memory: loadIndex failed to allocate linklists (" +
-          std::to_string(sizeof(void *) * max_elements) + " bytes)");
+  static size_t numDirtyWords(size_t elements) { return (elements + 63) / 64; }
 
-    size_t linkListBufferSize = sizeof(void *) * max_elements;
-    std::vector<char> linkListBuffer(linkListBufferSize);
-    {
-      size_t bytes_read = 0;
+  /**
+   * Record that an element's block or link lists have changed, so that the
+   * next delta (see saveDelta) will include it.
+   */
+  inline void markDirty(tableint internalId) {
+    std::atomic<uint64_t> &word = dirty_elements_[internalId / 64];
+    uint64_t bit = (uint64_t)1 << (internalId % 64);
+    // Most elements are changed many times between saves (i.e.: by each
+    // insertion that links to them), so avoid writing to shared cache lines
+    // unless the bit isn't already set:
+    if (!(word.load(std::memory_order_relaxed) & bit))
+      word.fetch_or(bit, std::memory_order_relaxed);
+  }
 
-      while (true) {
-        long long bytes_to_read = linkListBuffer.size() - bytes_read;
+  bool isDirty(tableint internalId) const {
+    return dirty_elements_[internalId / 64].load(std::memory_order_relaxed) &
+           ((uint64_t)1 << (internalId % 64));
+  }
 
-        long long bytes_read_this_iteration = inputStream->read(
-            linkListBuffer.data() + bytes_read, bytes_to_read);
+  void setAllDirty(bool dirty) {
+    if (search_only_)
+      return;
+    for (size_t i = 0; i < numDirtyWords(cur_element_count); i++)
+      dirty_elements_[i].store(dirty ? ~(uint64_t)0 : 0,
+                               std::memory_order_relaxed);
+  }
 
-        if (bytes_read_this_iteration > 0) {
-          bytes_read += bytes_read_this_iteration;
-        }
+  /**
+   * The labels of every element that the next delta will include.
+   */
+  std::vector<labeltype> getChangedLabels() const {
+    std::vector<labeltype> labels;
+    if (search_only_)
+      return labels;
+    for (tableint i = 0; i < cur_element_count; i++)
+      if (isDirty(i))
+        labels.push_back(getExternalLabel(i));
+    return labels;
+  }
 
-        if (bytes_read_this_iteration == bytes_to_read) {
-          // The link list data will usually be smaller than the buffer we've
-          // allocated, but in case it's not, enlarge the buffer and keep
-          // reading:
-          try {
-            linkListBuffer.resize(linkListBuffer.size() * 2);
-          } catch (std::exception const &e) {
-            throw std::runtime_error(
-                "Failed to resize linked list buffer to "
-                "double its previous size (from " +
-                std::to_string(linkListBuffer.size()) + " to " +
-                std::to_string(linkListBuffer.size() * 2) + ")");
-          }
-        } else {
-          // We've hit the end of the stream (as we read fewer bytes than asked
-          // for) so stop reading.
-          try {
-            linkListBuffer.resize(bytes_read);
-          } catch (std::exception const &e) {
-            throw std::runtime_error("Failed to resize linked list buffer to "
-                                     "the number of bytes read (" +
-                                     std::to_string(bytes_read) + ")");
-          }
-          break;
-        }
+  size_t getNumDirtyElements() const {
+    if (search_only_)
+      return 0;
+    size_t count = 0;
+    for (tableint i = 0; i < cur_element_count; i++)
+      count += isDirty(i);
+    return count;
+  }
+
+  /**
+   * Allocate zeroed memory for the upper-layer link lists of an element at
+   * the given level.
+   */
+  char *allocateLinkLists(int level) {
+    size_t size = size_links_per_element_ * level + 1;
+    if (memory_policy_.arenaLinkLists)
+      return link_list_arena_.allocate(size);
+
+    char *linkLists = (char *)calloc(size, 1);
+    if (linkLists == nullptr)
+      throw std::runtime_error(
+          "Not enough memory: failed to allocate " + std::to_string(size) +
+          " bytes for an element's link lists");
+    return linkLists;
+  }
+
+  void freeLinkLists(tableint internalId) {
+    int level = element_levels_[internalId];
+    if (level <= 0)
+      return;
+    if (memory_policy_.arenaLinkLists) {
+      link_list_arena_.release(linkLists_[internalId],
+                               size_links_per_element_ * level + 1);
+    } else {
+      free(linkLists_[internalId]);
+    }
+  }
+
+  /**
+   * Store this index's bottom layer in a smaller, read-only form: each
+   * element's links are stored without padding them out to maxM0_ entries,
+   * and its label takes 4 bytes rather than 8 if every label fits. Upper
+   * layers are gathered into a single allocation, after which any
+   * memory-mapped file backing this index is released. As in search-only
+   * mode, the label lookup table and per-element locks are freed.
+   *
+   * Search results are unchanged and saveIndex still writes the usual format
+   * (savePackedIndex writes this one), but it can no longer be modified.
+   */
+  void packForSearch() {
+    std::unique_lock<std::shared_mutex> lock(resizeLock);
+    if (packed_)
+      return;
+
+    size_t numElements = cur_element_count;
+    size_t numLinks = 0;
+    size_t upperLinkBytes = 0;
+    labeltype maxLabel = 0;
+    for (tableint i = 0; i < numElements; i++) {
+      numLinks += 1 + getListCount(get_linklist0(i));
+      if (element_levels_[i] > 0)
+        upperLinkBytes += size_links_per_element_ * element_levels_[i];
+      maxLabel = std::max(maxLabel, getExternalLabel(i));
+    }
+    if (numLinks > std::numeric_limits<uint32_t>::max())
+      throw std::runtime_error(
+          "This index has too many links (" + std::to_string(numLinks) +
+          ") to be packed.");
+
+    std::vector<linklistsizeint> links;
+    links.reserve(numLinks);
+    std::vector<uint32_t> linkOffsets(numElements);
+    std::vector<char> vectors(numElements * data_size_);
+    std::vector<uint32_t> labels32;
+    std::vector<labeltype> labels64;
+    if (maxLabel <= std::numeric_limits<uint32_t>::max())
+      labels32.resize(numElements);
+    else
+      labels64.resize(numElements);
+
+    for (tableint i = 0; i < numElements; i++) {
+      linklistsizeint *ll = get_linklist0(i);
+      linkOffsets[i] = links.size();
+      links.insert(links.end(), ll, ll + 1 + getListCount(ll));
+      memcpy(vectors.data() + i * data_size_, getDataByInternalId(i),
+             data_size_);
+      if (labels64.empty())
+        labels32[i] = getExternalLabel(i);
+      else
+        labels64[i] = getExternalLabel(i);
+    }
+
+    std::vector<char> upperLinks(upperLinkBytes);
+    for (size_t i = 0, offset = 0; i < numElements; i++) {
+      if (element_levels_[i] <= 0)
+        continue;
+      size_t size = size_links_per_element_ * element_levels_[i];
+      memcpy(upperLinks.data() + offset, linkLists_[i], size);
+      offset += size;
+    }
+
+    // Everything has been copied, so release the original storage:
+    if (!memory_mapped_file_ && !memory_policy_.arenaLinkLists) {
+      for (tableint i = 0; i < numElements; i++) {
+        if (element_levels_[i] > 0)
+          free(linkLists_[i]);
       }
     }
+    link_list_arena_.reset(memory_policy_);
+    data_level0_memory_.reset(data_level0_memory_.getElementsPerSegment(),
+                              size_data_per_element_, memory_policy_);
+    memory_mapped_file_.reset();
+    link_list_locks_.reset();
+    std::vector<std::mutex>().swap(link_list_update_locks_);
+    std::unordered_map<labeltype, tableint>().swap(label_lookup_);
+
+    adoptPackedData(std::move(links), std::move(linkOffsets),
+                    std::move(vectors), std::move(labels32),
+                    std::move(labels64), std::move(upperLinks));
+  }
 
-    if (!search_only_) {
-      std::vector<std::mutex>(max_elements).swap(link_list_locks_);
-      std::vector<std::mutex>(max_update_element_locks)
-          .swap(link_list_update_locks_);
+  /**
+   * Take ownership of packed bottom-layer data, pointing each element's
+   * upper-layer link lists into `upperLinks` in order of internal ID. Each
+   * element's level must already be set in element_levels_.
+   */
+  void adoptPackedData(std::vector<linklistsizeint> links,
+                       std::vector<uint32_t> linkOffsets,
+                       std::vector<char> vectors,
+                       std::vector<uint32_t> labels32,
+                       std::vector<labeltype> labels64,
+                       std::vector<char> upperLinks) {
+    packed_links_ = std::move(links);
+    packed_link_offsets_ = std::move(linkOffsets);
+    packed_vectors_ = std::move(vectors);
+    packed_labels32_ = std::move(labels32);
+    packed_labels64_ = std::move(labels64);
+    packed_upper_links_ = std::move(upperLinks);
+
+    for (size_t i = 0, offset = 0; i < cur_element_count; i++) {
+      if (element_levels_[i] <= 0) {
+        linkLists_[i] = nullptr;
+        continue;
+      }
+      linkLists_[i] = packed_upper_links_.data() + offset;
+      offset += size_links_per_element_ * element_levels_[i];
     }
+    packed_ = true;
+    search_only_ = true;
+  }
 
-    visited_list_pool_ = new VisitedListPool(1, max_elements);
+  bool isPacked() const { return packed_; }
 
-    element_levels_ = std::vector<int>(max_elements);
-    revSize_ = 1.0 / mult_;
-    ef_ = 10;
+  /**
+   * Write the bottom-layer block of every element in a packed index, in the
+   * same layout as an unpacked index would have stored them.
+   */
+  void savePackedElementBlocks(std::shared_ptr<OutputStream> output) {
+    size_t elementsPerChunk =
+        std::max<size_t>(1, STREAM_CHUNK_SIZE / size_data_per_element_);
+    std::vector<char> chunk;
+    for (size_t i = 0; i < cur_element_count;) {
+      size_t n = std::min(elementsPerChunk, cur_element_count - i);
+      chunk.assign(n * size_data_per_element_, 0);
+      for (size_t j = 0; j < n; j++) {
+        char *block = chunk.data() + j * size_data_per_element_;
+        linklistsizeint *ll = get_linklist0(i + j);
+        memcpy(block + offsetLevel0_, ll,
+               (1 + getListCount(ll)) * sizeof(linklistsizeint));
+        memcpy(block + offsetData_, getDataByInternalId(i + j), data_size_);
+        labeltype label = getExternalLabel(i + j);
+        memcpy(block + label_offset_, &label, sizeof(labeltype));
+      }
+      output->write(chunk.data(), chunk.size());
+      i += n;
+    }
+  }
+
+  void saveIndex(const std::string &filename) {
+    saveIndex(std::make_shared<FileOutputStream>(filename));
+  }
+
+  void saveIndex(std::shared_ptr<OutputStream> output) {
+    if (!label_groups_.empty())
+      saveGroups(output, /* changedOnly= */ false);
+    writeBinaryPOD(output, offsetLevel0_);
+    writeBinaryPOD(output, max_elements_);
+    writeBinaryPOD(output, cur_element_count);
+    writeBinaryPOD(output, size_data_per_element_);
+    writeBinaryPOD(output, label_offset_);
+    writeBinaryPOD(output, offsetData_);
+    writeBinaryPOD(output, maxlevel_);
+    writeBinaryPOD(output, enterpoint_node_);
+    writeBinaryPOD(output, maxM_);
+
+    writeBinaryPOD(output, maxM0_);
+    writeBinaryPOD(output, M_);
+    writeBinaryPOD(output, mult_);
+    writeBinaryPOD(output, ef_construction_);
 
-    size_t indexInLinkListBuffer = 0;
+    if (packed_) {
+      savePackedElementBlocks(output);
+    } else {
+      for (size_t i = 0; i < cur_element_count;) {
+        size_t n = std::min(data_level0_memory_.contiguousElementsFrom(i),
+                            cur_element_count - i);
+        output->write(getElementBlock(i), n * size_data_per_element_);
+        i += n;
+      }
+    }
+
+    // Each link list is preceded by its size; rather than writing each of
+    // these separately, they're gathered into chunk-sized writes.
+    std::vector<char> chunk;
+    chunk.reserve(STREAM_CHUNK_SIZE);
     for (size_t i = 0; i < cur_element_count; i++) {
-      if (!search_only_)
-        label_lookup_[getExternalLabel(i)] = i;
-      unsigned int linkListSize;
+      unsigned int linkListSize =
+          element_levels_[i] > 0 ? size_links_per_element_ * element_levels_[i]
+                                 : 0;
+      if (!chunk.empty() &&
+          chunk.size() + sizeof(linkListSize) + linkListSize >
+              STREAM_CHUNK_SIZE) {
+        output->write(chunk.data(), chunk.size());
+        chunk.clear();
+      }
 
-      linkListSize = *((int *)(linkListBuffer.data() + indexInLinkListBuffer));
-      indexInLinkListBuffer += sizeof(int);
+      const char *sizeBytes = (const char *)&linkListSize;
+      chunk.insert(chunk.end(), sizeBytes, sizeBytes + sizeof(linkListSize));
+      if (linkListSize)
+        chunk.insert(chunk.end(), linkLists_[i], linkLists_[i] + linkListSize);
+    }
+    if (!chunk.empty())
+      output->write(chunk.data(), chunk.size());
 
-      if (linkListSize == 0) {
-        element_levels_[i] = 0;
+    // Deltas are relative to the last full save:
+    setAllDirty(false);
+    changed_groups_.clear();
+  }
 
-        linkLists_[i] = nullptr;
+  /**
+   * Write a section of group assignments (see GROUPS_SECTION_TAG): either all
+   * of them, or those changed since the last full save. Labels whose groups
+   * were removed are written as being in their own group.
+   */
+  void saveGroups(std::shared_ptr<OutputStream> output,
+                  bool changedOnly) const {
+    std::vector<std::pair<labeltype, labeltype>> groups;
+    if (changedOnly) {
+      groups.reserve(changed_groups_.size());
+      for (labeltype label : changed_groups_)
+        groups.emplace_back(label, getGroupLocked(label));
+    } else {
+      groups.assign(label_groups_.begin(), label_groups_.end());
+    }
+
+    writeBinaryPOD(output, GROUPS_SECTION_TAG);
+    writeBinaryPOD(output, GROUPS_SECTION_VERSION);
+    writeBinaryPOD(output, groups.size());
+    for (size_t i = 0; i < groups.size(); i += STREAM_CHUNK_SIZE / 16) {
+      size_t n = std::min(groups.size() - i, STREAM_CHUNK_SIZE / 16);
+      std::vector<labeltype> chunk;
+      chunk.reserve(n * 2);
+      for (size_t j = i; j < i + n; j++) {
+        chunk.push_back(groups[j].first);
+        chunk.push_back(groups[j].second);
+      }
+      output->write((const char *)chunk.data(),
+                    chunk.size() * sizeof(labeltype));
+    }
+  }
+
+  /**
+   * Read a section written by saveGroups, applying its assignments on top of
+   * this index's current ones.
+   */
+  void loadGroups(std::shared_ptr<InputStream> input, bool markChanged) {
+    uint32_t tag;
+    int version;
+    size_t count;
+    readBinaryPOD(input, tag);
+    if (tag != GROUPS_SECTION_TAG)
+      throw std::domain_error("Index data appears to be corrupted; expected "
+                              "a section of group assignments.");
+    readBinaryPOD(input, version);
+    if (version != GROUPS_SECTION_VERSION)
+      throw std::domain_error(
+          "Unable to load group assignments with version " +
+          std::to_string(version) +
+          "; this version of Voyager only supports version " +
+          std::to_string(GROUPS_SECTION_VERSION) + ".");
+    readBinaryPOD(input, count);
+
+    std::vector<labeltype> chunk;
+    for (size_t i = 0; i < count; i += STREAM_CHUNK_SIZE / 16) {
+      size_t n = std::min(count - i, STREAM_CHUNK_SIZE / 16);
+      chunk.resize(n * 2);
+      size_t bytes = chunk.size() * sizeof(labeltype);
+      if (readChunk(input, (char *)chunk.data(), bytes) != bytes)
+        throw std::domain_error("Index data appears to be corrupted; it "
+                                "ended partway through its group "
+                                "assignments.");
+      for (size_t j = 0; j < n; j++) {
+        labeltype label = chunk[j * 2], group = chunk[j * 2 + 1];
+        if (group == label) {
+          label_groups_.erase(label);
+        } else {
+          label_groups_[label] = group;
+        }
+        if (markChanged)
+          changed_groups_.insert(label);
+      }
+    }
+  }
+
+  /**
+   * Save this index in the layout used by packForSearch, so that it can be
+   * loaded straight into packed storage without padding out each element's
+   * bottom-layer links or rebuilding the label lookup table. Indices saved
+   * this way can only be loaded in search-only mode. This index is left
+   * unchanged, and need not be packed itself.
+   */
+  void savePackedIndex(std::shared_ptr<OutputStream> output) {
+    std::shared_lock<std::shared_mutex> lock(resizeLock);
+    size_t numElements = cur_element_count;
+    size_t numLinks = 0;
+    size_t upperLinkBytes = 0;
+    labeltype maxLabel = 0;
+    for (tableint i = 0; i < numElements; i++) {
+      numLinks += 1 + getListCount(get_linklist0(i));
+      if (element_levels_[i] > 0)
+        upperLinkBytes += size_links_per_element_ * element_levels_[i];
+      maxLabel = std::max(maxLabel, getExternalLabel(i));
+    }
+    if (numLinks > std::numeric_limits<uint32_t>::max())
+      throw std::runtime_error(
+          "This index has too many links (" + std::to_string(numLinks) +
+          ") to be packed.");
+    uint8_t labelBytes = maxLabel <= std::numeric_limits<uint32_t>::max()
+                             ? sizeof(uint32_t)
+                             : sizeof(labeltype);
+
+    if (!label_groups_.empty())
+      saveGroups(output, /* changedOnly= */ false);
+    writeBinaryPOD(output, PACKED_FORMAT_TAG);
+    writeBinaryPOD(output, PACKED_FORMAT_VERSION);
+    writeBinaryPOD(output, offsetLevel0_);
+    writeBinaryPOD(output, max_elements_);
+    writeBinaryPOD(output, cur_element_count);
+    writeBinaryPOD(output, size_data_per_element_);
+    writeBinaryPOD(output, label_offset_);
+    writeBinaryPOD(output, offsetData_);
+    writeBinaryPOD(output, maxlevel_);
+    writeBinaryPOD(output, enterpoint_node_);
+    writeBinaryPOD(output, maxM_);
+    writeBinaryPOD(output, maxM0_);
+    writeBinaryPOD(output, M_);
+    writeBinaryPOD(output, mult_);
+    writeBinaryPOD(output, ef_construction_);
+    writeBinaryPOD(output, labelBytes);
+    writeBinaryPOD(output, numLinks);
+    writeBinaryPOD(output, upperLinkBytes);
+
+    // Each of the packed arrays follows in turn, gathered into chunk-sized
+    // writes:
+    std::vector<char> chunk;
+    chunk.reserve(STREAM_CHUNK_SIZE);
+    auto append = [&](const void *data, size_t size) {
+      if (!chunk.empty() && chunk.size() + size > STREAM_CHUNK_SIZE) {
+        output->write(chunk.data(), chunk.size());
+        chunk.clear();
+      }
+      chunk.insert(chunk.end(), (const char *)data, (const char *)data + size);
+    };
+
+    for (tableint i = 0, offset = 0; i < numElements; i++) {
+      append(&offset, sizeof(offset));
+      offset += 1 + getListCount(get_linklist0(i));
+    }
+    for (tableint i = 0; i < numElements; i++) {
+      linklistsizeint *ll = get_linklist0(i);
+      append(ll, (1 + getListCount(ll)) * sizeof(linklistsizeint));
+    }
+    for (tableint i = 0; i < numElements; i++)
+      append(getDataByInternalId(i), data_size_);
+    for (tableint i = 0; i < numElements; i++) {
+      labeltype label = getExternalLabel(i);
+      uint32_t label32 = label;
+      append(labelBytes == sizeof(label32) ? (const void *)&label32 : &label,
+             labelBytes);
+    }
+    for (tableint i = 0; i < numElements; i++) {
+      int level = element_levels_[i];
+      append(&level, sizeof(level));
+    }
+    for (tableint i = 0; i < numElements; i++) {
+      if (element_levels_[i] > 0)
+        append(linkLists_[i], size_links_per_element_ * element_levels_[i]);
+    }
+    if (!chunk.empty())
+      output->write(chunk.data(), chunk.size());
+  }
+
+  /**
+   * Write only the elements whose blocks or link lists have changed since
+   * this index was last saved (or loaded) in full, along with the new element
+   * count and entry point. Applying the result with applyDelta to a copy of
+   * that full save brings the copy up to date with this index.
+   *
+   * Deltas are cumulative: each contains every change since the last full
+   * save, so only the most recent delta needs to be applied to a copy. As
+   * with saveIndex, the index must not be modified while this runs.
+   */
+  void saveDelta(std::shared_ptr<OutputStream> output) {
+    if (search_only_)
+      throw std::runtime_error(
+          "saveDelta is not supported in search only mode");
+    std::shared_lock<std::shared_mutex> lock(resizeLock);
+
+    // The layout of each element, which must match the index being updated:
+    writeBinaryPOD(output, size_data_per_element_);
+    writeBinaryPOD(output, size_links_per_element_);
+    writeBinaryPOD(output, offsetData_);
+    writeBinaryPOD(output, label_offset_);
+
+    writeBinaryPOD(output, max_elements_);
+    writeBinaryPOD(output, cur_element_count);
+    writeBinaryPOD(output, maxlevel_);
+    writeBinaryPOD(output, enterpoint_node_);
+
+    size_t numChanged = getNumDirtyElements();
+    writeBinaryPOD(output, numChanged);
+
+    // Each changed element is written as its ID, its level, its block and its
+    // upper-layer link lists, gathered into chunk-sized writes:
+    std::vector<char> chunk;
+    chunk.reserve(STREAM_CHUNK_SIZE);
+    auto append = [&](const void *data, size_t size) {
+      chunk.insert(chunk.end(), (const char *)data, (const char *)data + size);
+    };
+    for (tableint i = 0; i < cur_element_count; i++) {
+      if (!isDirty(i))
+        continue;
+
+      int level = element_levels_[i];
+      size_t linkListSize = level > 0 ? size_links_per_element_ * level : 0;
+      size_t recordSize = sizeof(i) + sizeof(level) + size_data_per_element_ +
+                          linkListSize;
+      if (!chunk.empty() && chunk.size() + recordSize > STREAM_CHUNK_SIZE) {
+        output->write(chunk.data(), chunk.size());
+        chunk.clear();
+      }
+
+      append(&i, sizeof(i));
+      append(&level, sizeof(level));
+      append(getElementBlock(i), size_data_per_element_);
+      if (linkListSize)
+        append(linkLists_[i], linkListSize);
+    }
+    if (!chunk.empty())
+      output->write(chunk.data(), chunk.size());
+
+    saveGroups(output, /* changedOnly= */ true);
+  }
+
+  /**
+   * Apply a delta written by saveDelta to this index, which must hold the
+   * contents of the full save that the delta was taken relative to (or of an
+   * earlier delta taken relative to the same full save). If this throws,
+   * the index may have been partially updated and should be reloaded.
+   */
+  void applyDelta(std::shared_ptr<InputStream> input) {
+    if (search_only_)
+      throw std::runtime_error(
+          "applyDelta is not supported in search only mode");
+    std::unique_lock<std::shared_mutex> lock(resizeLock);
+
+    auto checkLayout = [&](size_t expected, const std::string &name) {
+      size_t value;
+      readBinaryPOD(input, value);
+      if (value != expected)
+        throw std::domain_error(
+            "Index delta does not match the layout of this index; expected " +
+            std::to_string(expected) + " for " + name + ", but found " +
+            std::to_string(value) + ".");
+    };
+    checkLayout(size_data_per_element_, "the size of each element");
+    checkLayout(size_links_per_element_, "the size of each link list");
+    checkLayout(offsetData_, "the offset of each vector");
+    checkLayout(label_offset_, "the offset of each label");
+
+    size_t newMaxElements, newElementCount, numChanged;
+    int newMaxLevel;
+    tableint newEntryPoint;
+    readBinaryPOD(input, newMaxElements);
+    readBinaryPOD(input, newElementCount);
+    readBinaryPOD(input, newMaxLevel);
+    readBinaryPOD(input, newEntryPoint);
+    readBinaryPOD(input, numChanged);
+
+    auto corrupted = [](const std::string &reason) {
+      return std::domain_error("Index delta appears to be corrupted; " +
+                               reason);
+    };
+    if (newElementCount > newMaxElements || numChanged > newElementCount)
+      throw corrupted("it contains more elements than its maximum size.");
+    if (newElementCount > 0 ? newEntryPoint >= newElementCount
+                            : newEntryPoint != (tableint)-1)
+      throw corrupted("its entry point (" + std::to_string(newEntryPoint) +
+                      ") is not one of its elements.");
+
+    if (newMaxElements > max_elements_) {
+      data_level0_memory_.grow(newMaxElements);
+      linkLists_.grow(newMaxElements);
+      element_levels_.grow(newMaxElements);
+      link_list_locks_.grow(newMaxElements);
+      dirty_elements_.grow(numDirtyWords(newMaxElements));
+      visited_list_pool_->growTo(data_level0_memory_.capacity());
+      max_elements_ = newMaxElements;
+    }
+
+    size_t oldElementCount = cur_element_count;
+    auto removeElement = [&](tableint id) {
+      auto search = label_lookup_.find(getExternalLabel(id));
+      if (search != label_lookup_.end() && search->second == id)
+        label_lookup_.erase(search);
+      if (isMarkedDeleted(id))
+        num_deleted_--;
+      freeLinkLists(id);
+      linkLists_[id] = nullptr;
+      element_levels_[id] = 0;
+    };
+
+    size_t numAdded = 0;
+    for (size_t i = 0; i < numChanged; i++) {
+      tableint id;
+      int level;
+      readBinaryPOD(input, id);
+      readBinaryPOD(input, level);
+      if (id >= newElementCount || level < 0 || level > newMaxLevel)
+        throw corrupted("element " + std::to_string(id) + " at level " +
+                        std::to_string(level) + " is out of bounds.");
+
+      if (id < oldElementCount) {
+        removeElement(id);
       } else {
-        element_levels_[i] = linkListSize / size_links_per_element_;
-        linkLists_[i] = (char *)malloc(linkListSize);
-        if (linkLists_[i] == nullptr)
-          throw std::runtime_error(
-              "Not enough memory: loadIndex failed to allocate linklist");
+        numAdded++;
+      }
 
-        std::memcpy(linkLists_[i],
-                    (linkListBuffer.data() + indexInLinkListBuffer),
-                    linkListSize);
-        indexInLinkListBuffer += linkListSize;
+      if (readChunk(input, getElementBlock(id), size_data_per_element_) !=
+          size_data_per_element_)
+        throw corrupted("it ended partway through element " +
+                        std::to_string(id) + ".");
+      element_levels_[id] = level;
+      if (level > 0) {
+        size_t linkListSize = size_links_per_element_ * level;
+        linkLists_[id] = allocateLinkLists(level);
+        if (readChunk(input, linkLists_[id], linkListSize) != linkListSize)
+          throw corrupted("it ended partway through the links of element " +
+                          std::to_string(id) + ".");
       }
+
+      label_lookup_[getExternalLabel(id)] = id;
+      if (isMarkedDeleted(id))
+        num_deleted_++;
+      markDirty(id);
+    }
+
+    if (newElementCount > oldElementCount &&
+        numAdded != newElementCount - oldElementCount)
+      throw std::domain_error(
+          "Index delta was not saved relative to the contents of this index; "
+          "it adds " +
+          std::to_string(newElementCount - oldElementCount) +
+          " elements, but only contains " + std::to_string(numAdded) +
+          " of them.");
+
+    for (tableint id = newElementCount; id < oldElementCount; id++) {
+      auto search = label_lookup_.find(getExternalLabel(id));
+      if (search != label_lookup_.end() && search->second == id &&
+          label_groups_.erase(getExternalLabel(id)))
+        changed_groups_.insert(getExternalLabel(id));
+      removeElement(id);
+      memset(getElementBlock(id), 0, size_data_per_element_);
     }
 
+    cur_element_count = newElementCount;
+    maxlevel_ = newMaxLevel;
+    enterpoint_node_ = newEntryPoint;
+
+    // As with elements, assignments changed by the delta count as changed
+    // here too, so that deltas taken from this index include them:
+    loadGroups(input, /* markChanged= */ true);
+  }
+
+  void loadIndex(std::shared_ptr<InputStream> inputStream,
+                 Space<dist_t, data_t> *s, size_t max_elements_i = 0) {
+    size_t totalFileSize = 0;
+    if (inputStream->isSeekable()) {
+      totalFileSize = inputStream->getTotalLength();
+    }
+    if (inputStream->peek() == GROUPS_SECTION_TAG)
+      loadGroups(inputStream, /* markChanged= */ false);
+    bool packed = inputStream->peek() == PACKED_FORMAT_TAG;
+    if (packed) {
+      uint32_t tag;
+      int version;
+      readBinaryPOD(inputStream, tag);
+      readBinaryPOD(inputStream, version);
+      if (version != PACKED_FORMAT_VERSION)
+        throw std::domain_error(
+            "Unable to load packed index data with version " +
+            std::to_string(version) +
+            "; this version of Voyager only supports version " +
+            std::to_string(PACKED_FORMAT_VERSION) + ".");
+      if (!search_only_)
+        throw std::invalid_argument(
+            "This index was saved packed for search, and can only be loaded "
+            "with searchOnly = true.");
+    }
+
+    readBinaryPOD(inputStream, offsetLevel0_);
+    if (totalFileSize > 0 && offsetLevel0_ > totalFileSize) {
+      throw std::domain_error("Index appears to contain corrupted data; level "
+                              "0 offset parameter (" +
+                              std::to_string(offsetLevel0_) +
+                              ") exceeded size of index file (" +
+                              std::to_string(totalFileSize) + ").");
+    }
+
+    readBinaryPOD(inputStream, max_elements_);
+    readBinaryPOD(inputStream, cur_element_count);
+
+    size_t max_elements = max_elements_i;
+    if (max_elements < cur_element_count)
+      max_elements = max_elements_;
+    max_elements_ = max_elements;
+    readBinaryPOD(inputStream, size_data_per_element_);
+    readBinaryPOD(inputStream, label_offset_);
+    readBinaryPOD(inputStream, offsetData_);
+    readBinaryPOD(inputStream, maxlevel_);
+    readBinaryPOD(inputStream, enterpoint_node_);
+
+    if (enterpoint_node_ >= cur_element_count) {
+      throw std::runtime_error(
+          "Index seems to be corrupted or unsupported. "
+          "Entry point into HNSW data structure was at element index " +
+          std::to_string(enterpoint_node_) + ", but only " +
+          std::to_string(cur_element_count) +
+          " elements are present in the index.");
+    }
+
+    readBinaryPOD(inputStream, maxM_);
+    readBinaryPOD(inputStream, maxM0_);
+    readBinaryPOD(inputStream, M_);
+    readBinaryPOD(inputStream, mult_);
+    readBinaryPOD(inputStream, ef_construction_);
+
+    data_size_ = s->get_data_size();
+    fstdistfunc_ = s->get_dist_func();
+    fstmultidistfunc_ = s->get_multi_dist_func();
+    dist_func_param_ = s->get_dist_func_param();
+
+    size_links_per_element_ =
+        maxM_ * sizeof(tableint) + sizeof(linklistsizeint);
+
+    size_links_level0_ = maxM0_ * sizeof(tableint) + sizeof(linklistsizeint);
+
+    size_t expected_size_per_element =
+        size_links_level0_ + data_size_ + sizeof(labeltype);
+    if (size_data_per_element_ != expected_size_per_element) {
+      throw std::domain_error(
+          "Storage data type does not match the index data being loaded; "
+          "expected " +
+          std::to_string(expected_size_per_element) +
+          " bytes per element, but loaded data contains " +
+          std::to_string(size_data_per_element_) +
+          " bytes per element. Data being loaded might not be a Voyager index, "
+          "may be corrupt, or may be using a different storage data type.");
+    }
+
+    long long position = inputStream->getPosition();
+
+    // Search-only indices are never modified after loading, so if the
+    // underlying stream supports it, we can point directly into a read-only
+    // memory mapping of the index instead of copying the data onto the heap.
+    if (search_only_ && !packed) {
+      memory_mapped_file_ = inputStream->memoryMap();
+    }
+
+    initializeElementStorage(max_elements);
+    linkLists_.grow(max_elements);
+    element_levels_.grow(max_elements);
+
+    if (packed) {
+      readPackedIndexData(inputStream, totalFileSize);
+    } else if (memory_mapped_file_) {
+      mapIndexData(position);
+    } else {
+      readIndexData(inputStream, position, totalFileSize, max_elements);
+    }
+
+    if (!search_only_) {
+      link_list_locks_.grow(max_elements);
+      dirty_elements_.grow(numDirtyWords(max_elements));
+      std::vector<std::mutex>(max_update_element_locks)
+          .swap(link_list_update_locks_);
+    }
+
+    visited_list_pool_ = new VisitedListPool(1, max_elements);
+
+    revSize_ = 1.0 / mult_;
+    ef_ = 10;
+
     if (enterpoint_node_ > 0 && enterpoint_node_ != (tableint)-1 &&
         !linkLists_[enterpoint_node_]) {
       throw std::runtime_error(
@@ -954,6 +2029,412 @@ public:
     return;
   }
 
+  /**
+   * Rebuild `label_lookup_` from the labels stored in level 0. Labels are
+   * split by hash across several threads, each of which builds its own map;
+   * the nodes of those maps are then spliced into `label_lookup_` without
+   * being reallocated. As when added, later elements take precedence over
+   * earlier ones with the same label.
+   */
+  void rebuildLabelLookup() {
+    static const size_t MIN_LABELS_PER_THREAD = 1 << 12;
+    size_t numThreads = std::max<size_t>(
+        1, std::min<size_t>(std::thread::hardware_concurrency(),
+                            cur_element_count / MIN_LABELS_PER_THREAD));
+
+    // Gather the labels first, so that each thread only scans a contiguous
+    // array rather than every element's (much larger) level 0 data:
+    std::vector<labeltype> labels(cur_element_count);
+    auto inParallel = [&](auto fn) {
+      std::vector<std::future<void>> futures;
+      for (size_t t = 1; t < numThreads; t++)
+        futures.push_back(std::async(std::launch::async, fn, t));
+      fn(0);
+      for (auto &future : futures)
+        future.get();
+    };
+    inParallel([&](size_t t) {
+      size_t end = cur_element_count * (t + 1) / numThreads;
+      for (size_t i = cur_element_count * t / numThreads; i < end; i++)
+        labels[i] = getExternalLabel(i);
+    });
+
+    std::vector<std::unordered_map<labeltype, tableint>> partitions(
+        numThreads);
+    inParallel([&](size_t t) {
+      std::hash<labeltype> hash;
+      partitions[t].reserve(cur_element_count / numThreads + 1);
+      for (size_t i = 0; i < cur_element_count; i++) {
+        if (hash(labels[i]) % numThreads == t)
+          partitions[t][labels[i]] = i;
+      }
+    });
+
+    label_lookup_.clear();
+    label_lookup_.reserve(cur_element_count);
+    for (auto &partition : partitions)
+      label_lookup_.merge(partition);
+  }
+
+  /**
+   * Point this index's level 0 data and link lists directly into the
+   * memory-mapped index file, without copying any data.
+   */
+  void mapIndexData(size_t position) {
+    const char *mappedData = memory_mapped_file_->data();
+    size_t totalFileSize = memory_mapped_file_->size();
+
+    size_t level0Size = cur_element_count * size_data_per_element_;
+    if (position > totalFileSize ||
+        cur_element_count > totalFileSize / size_data_per_element_ ||
+        level0Size > totalFileSize - position) {
+      throw std::runtime_error(
+          "Index seems to be corrupted or unsupported. Level 0 data requires " +
+          std::to_string(level0Size) + " bytes (from position " +
+          std::to_string(position) + "), but index data only has " +
+          std::to_string(totalFileSize) + " bytes in total.");
+    }
+
+    // The mapping is read-only; search-only mode guarantees we never write
+    // through these pointers.
+    data_level0_memory_.map(const_cast<char *>(mappedData + position),
+                            cur_element_count);
+
+    size_t offset = position + level0Size;
+    for (size_t i = 0; i < cur_element_count; i++) {
+      unsigned int linkListSize;
+      if (totalFileSize - offset < sizeof(linkListSize)) {
+        throw std::runtime_error(
+            "Index seems to be corrupted or unsupported. Expected to read "
+            "linked list size at position " +
+            std::to_string(offset) + ", but index data only has " +
+            std::to_string(totalFileSize) + " bytes in total.");
+      }
+      std::memcpy(&linkListSize, mappedData + offset, sizeof(linkListSize));
+      offset += sizeof(linkListSize);
+
+      if (linkListSize == 0) {
+        element_levels_[i] = 0;
+        linkLists_[i] = nullptr;
+      } else {
+        if (totalFileSize - offset < linkListSize) {
+          throw std::runtime_error(
+              "Index seems to be corrupted or unsupported. Advancing to the "
+              "next linked list requires " +
+              std::to_string(linkListSize) +
+              " additional bytes (from position " + std::to_string(offset) +
+              "), but index data only has " + std::to_string(totalFileSize) +
+              " bytes in total.");
+        }
+        element_levels_[i] = linkListSize / size_links_per_element_;
+        linkLists_[i] = const_cast<char *>(mappedData + offset);
+        offset += linkListSize;
+      }
+    }
+
+    if (offset != totalFileSize)
+      throw std::runtime_error(
+          "Index seems to be corrupted or unsupported. After reading all "
+          "linked lists, extra data remained at the end of the index.");
+  }
+
+  /**
+   * Copy this index's level 0 data and link lists out of the provided stream
+   * and onto the heap, rebuilding `label_lookup_` (if necessary) as we go.
+   *
+   * The stream is only ever read from the calling thread (as streams backed by
+   * Python or Java objects require), but in large chunks: while the next chunk
+   * of link lists is being read, the previous chunk is decoded on another
+   * thread, and the label lookup table is rebuilt (by rebuildLabelLookup) on
+   * others.
+   */
+  void readIndexData(std::shared_ptr<InputStream> inputStream,
+                     long long position, size_t totalFileSize,
+                     size_t max_elements) {
+    size_t level0Size = cur_element_count * size_data_per_element_;
+    if (totalFileSize > 0 &&
+        ((size_t)position > totalFileSize ||
+         cur_element_count > totalFileSize / size_data_per_element_ ||
+         level0Size > totalFileSize - position)) {
+      throw std::runtime_error(
+          "Index seems to be corrupted or unsupported. Level 0 data requires " +
+          std::to_string(level0Size) + " bytes (from position " +
+          std::to_string(position) + "), but index data only has " +
+          std::to_string(totalFileSize) + " bytes in total.");
+    }
+
+    data_level0_memory_.grow(max_elements);
+
+    size_t elementsPerChunk =
+        std::max<size_t>(1, STREAM_CHUNK_SIZE / size_data_per_element_);
+    for (size_t i = 0; i < cur_element_count;) {
+      size_t n = std::min({elementsPerChunk, cur_element_count - i,
+                           data_level0_memory_.contiguousElementsFrom(i)});
+      size_t bytes_to_read = n * size_data_per_element_;
+      size_t bytes_read =
+          readChunk(inputStream, getElementBlock(i), bytes_to_read);
+      if (bytes_read != bytes_to_read) {
+        throw std::runtime_error(
+            "Tried to read " + std::to_string(level0Size) +
+            " bytes from stream, but only received " +
+            std::to_string(i * size_data_per_element_ + bytes_read) +
+            " bytes!");
+      }
+      i += n;
+    }
+
+    // Each link list is preceded by its size, and either may be split across
+    // chunks, so decoding keeps track of how far into each it has gotten:
+    size_t element = 0;
+    unsigned int linkListSize = 0;
+    size_t sizeBytesRead = 0;
+    size_t linkListBytesRead = 0;
+    size_t linkListOffset = position + level0Size;
+    bool extraData = false;
+
+    auto decode = [&](const char *data, size_t size) {
+      while (size > 0) {
+        if (element == cur_element_count) {
+          extraData = true;
+          return;
+        }
+
+        if (sizeBytesRead < sizeof(linkListSize)) {
+          size_t n = std::min(sizeof(linkListSize) - sizeBytesRead, size);
+          std::memcpy((char *)&linkListSize + sizeBytesRead, data, n);
+          sizeBytesRead += n;
+          data += n;
+          size -= n;
+          linkListOffset += n;
+          if (sizeBytesRead < sizeof(linkListSize))
+            return;
+
+          if (linkListSize == 0) {
+            element_levels_[element] = 0;
+            element++;
+            sizeBytesRead = 0;
+            continue;
+          }
+
+          if (linkListSize % size_links_per_element_ != 0) {
+            throw std::runtime_error(
+                "Index seems to be corrupted or unsupported. Linked list at "
+                "position " +
+                std::to_string(linkListOffset) + " has a size of " +
+                std::to_string(linkListSize) +
+                " bytes, which is not a multiple of the size of each level (" +
+                std::to_string(size_links_per_element_) + " bytes).");
+          }
+
+          if (totalFileSize > 0 &&
+              linkListOffset + linkListSize > totalFileSize) {
+            throw std::runtime_error(
+                "Index seems to be corrupted or unsupported. Advancing to the "
+                "next linked list requires " +
+                std::to_string(linkListSize) +
+                " additional bytes (from position " +
+                std::to_string(linkListOffset) +
+                "), but index data only has " + std::to_string(totalFileSize) +
+                " bytes in total.");
+          }
+
+          element_levels_[element] = linkListSize / size_links_per_element_;
+          linkLists_[element] = allocateLinkLists(element_levels_[element]);
+          linkListBytesRead = 0;
+        }
+
+        size_t n = std::min<size_t>(linkListSize - linkListBytesRead, size);
+        std::memcpy(linkLists_[element] + linkListBytesRead, data, n);
+        linkListBytesRead += n;
+        data += n;
+        size -= n;
+        linkListOffset += n;
+        if (linkListBytesRead == linkListSize) {
+          element++;
+          sizeBytesRead = 0;
+        }
+      }
+    };
+
+    // The futures below must be destroyed (and so waited on) before any of
+    // the state they reference, should reading fail partway through.
+    std::vector<char> chunks[2] = {std::vector<char>(STREAM_CHUNK_SIZE),
+                                   std::vector<char>(STREAM_CHUNK_SIZE)};
+    std::future<void> labelsRebuilt;
+    if (!search_only_) {
+      labelsRebuilt = std::async(std::launch::async,
+                                 [this]() { rebuildLabelLookup(); });
+    }
+
+    std::future<void> chunkDecoded;
+    for (int current = 0;; current ^= 1) {
+      size_t bytes_read =
+          readChunk(inputStream, chunks[current].data(), STREAM_CHUNK_SIZE);
+      if (chunkDecoded.valid())
+        chunkDecoded.get();
+      if (bytes_read == 0)
+        break;
+
+      chunkDecoded = std::async(std::launch::async, decode,
+                                chunks[current].data(), bytes_read);
+      if (bytes_read < STREAM_CHUNK_SIZE) {
+        chunkDecoded.get();
+        break;
+      }
+    }
+
+    if (labelsRebuilt.valid())
+      labelsRebuilt.get();
+
+    if (element != cur_element_count) {
+      throw std::runtime_error(
+          "Index seems to be corrupted or unsupported. Index data ended after "
+          "reading " +
+          std::to_string(element) + " of " + std::to_string(cur_element_count) +
+          " linked lists.");
+    }
+
+    // Trailing data can only be detected reliably when the stream's length is
+    // known; other streams may legitimately continue past the index.
+    if (extraData && totalFileSize > 0)
+      throw std::runtime_error(
+          "Index seems to be corrupted or unsupported. After reading all "
+          "linked lists, extra data remained at the end of the index.");
+  }
+
+  /**
+   * Read the arrays written by savePackedIndex straight into packed storage,
+   * checking that every link they contain is valid.
+   */
+  void readPackedIndexData(std::shared_ptr<InputStream> inputStream,
+                           size_t totalFileSize) {
+    auto corrupted = [](const std::string &reason) {
+      return std::runtime_error(
+          "Index seems to be corrupted or unsupported. Packed index data " +
+          reason);
+    };
+
+    uint8_t labelBytes;
+    size_t numLinks;
+    size_t upperLinkBytes;
+    readBinaryPOD(inputStream, labelBytes);
+    readBinaryPOD(inputStream, numLinks);
+    readBinaryPOD(inputStream, upperLinkBytes);
+
+    size_t numElements = cur_element_count;
+    if (labelBytes != sizeof(uint32_t) && labelBytes != sizeof(labeltype))
+      throw corrupted("has labels of " + std::to_string(labelBytes) +
+                      " bytes each.");
+    if (numLinks < numElements ||
+        numLinks > std::numeric_limits<uint32_t>::max())
+      throw corrupted("has " + std::to_string(numLinks) + " links for " +
+                      std::to_string(numElements) + " elements.");
+
+    if (totalFileSize > 0) {
+      size_t position = inputStream->getPosition();
+      size_t remaining = totalFileSize - std::min(position, totalFileSize);
+      size_t arrayBytes =
+          numElements *
+              (sizeof(uint32_t) + data_size_ + labelBytes + sizeof(int)) +
+          numLinks * sizeof(linklistsizeint);
+      if (arrayBytes > remaining || upperLinkBytes != remaining - arrayBytes)
+        throw corrupted("requires " + std::to_string(arrayBytes) + " + " +
+                        std::to_string(upperLinkBytes) +
+                        " bytes, but the index has " +
+                        std::to_string(remaining) + " bytes remaining.");
+    }
+
+    auto readArray = [&](auto &array, size_t size, const std::string &name) {
+      array.resize(size);
+      size_t bytes = size * sizeof(array[0]);
+      if (readChunk(inputStream, (char *)array.data(), bytes) != bytes)
+        throw corrupted("ended partway through its " + name + ".");
+    };
+    std::vector<uint32_t> linkOffsets;
+    std::vector<linklistsizeint> links;
+    std::vector<char> vectors;
+    std::vector<uint32_t> labels32;
+    std::vector<labeltype> labels64;
+    std::vector<int> levels;
+    std::vector<char> upperLinks;
+    readArray(linkOffsets, numElements, "link offsets");
+    readArray(links, numLinks, "links");
+    readArray(vectors, numElements * data_size_, "vectors");
+    if (labelBytes == sizeof(uint32_t))
+      readArray(labels32, numElements, "labels");
+    else
+      readArray(labels64, numElements, "labels");
+    readArray(levels, numElements, "levels");
+    readArray(upperLinks, upperLinkBytes, "upper-layer links");
+
+    size_t expectedOffset = 0;
+    size_t expectedUpperLinkBytes = 0;
+    for (size_t i = 0; i < numElements; i++) {
+      if (linkOffsets[i] != expectedOffset || expectedOffset >= numLinks)
+        throw corrupted("has misplaced links for element " +
+                        std::to_string(i) + ".");
+      linklistsizeint *ll = links.data() + expectedOffset;
+      size_t count = getListCount(ll);
+      if (count > maxM0_ || count >= numLinks - expectedOffset)
+        throw corrupted("has too many links for element " + std::to_string(i) +
+                        ".");
+      for (size_t j = 1; j <= count; j++) {
+        if (ll[j] >= numElements)
+          throw corrupted("links element " + std::to_string(i) +
+                          " to nonexistent element " + std::to_string(ll[j]) +
+                          ".");
+      }
+      expectedOffset += 1 + count;
+
+      if (levels[i] < 0 || levels[i] > maxlevel_)
+        throw corrupted("places element " + std::to_string(i) +
+                        " at level " + std::to_string(levels[i]) + ".");
+      element_levels_[i] = levels[i];
+      expectedUpperLinkBytes += size_links_per_element_ * levels[i];
+    }
+    if (expectedOffset != numLinks || expectedUpperLinkBytes != upperLinkBytes)
+      throw corrupted("contains more links than its elements use.");
+
+    adoptPackedData(std::move(links), std::move(linkOffsets),
+                    std::move(vectors), std::move(labels32),
+                    std::move(labels64), std::move(upperLinks));
+
+    for (tableint i = 0; i < numElements; i++) {
+      for (int level = 1; level <= element_levels_[i]; level++) {
+        linklistsizeint *ll = get_linklist(i, level);
+        size_t count = getListCount(ll);
+        tableint *data = (tableint *)(ll + 1);
+        if (count > maxM_)
+          throw corrupted("has too many links for element " +
+                          std::to_string(i) + " at level " +
+                          std::to_string(level) + ".");
+        for (size_t j = 0; j < count; j++) {
+          if (data[j] >= numElements)
+            throw corrupted("links element " + std::to_string(i) +
+                            " to nonexistent element " +
+                            std::to_string(data[j]) + ".");
+        }
+      }
+    }
+  }
+
+  /**
+   * Read up to `size` bytes from the provided stream, stopping early only if
+   * the stream is exhausted, and return the number of bytes read.
+   */
+  static size_t readChunk(std::shared_ptr<InputStream> inputStream,
+                          char *buffer, size_t size) {
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+      long long bytes_read_this_iteration =
+          inputStream->read(buffer + bytes_read, size - bytes_read);
+      if (bytes_read_this_iteration <= 0)
+        break;
+      bytes_read += bytes_read_this_iteration;
+    }
+    return bytes_read;
+  }
+
   size_t getDimensionality() { return dist_func_param_; }
 
   std::vector<data_t> getDataByLabel(labeltype label) const {
@@ -979,6 +2460,22 @@ public:
     return data;
   }
 
+  /**
+   * The vector of the element with the given label, or null if there is no
+   * such element or it's marked as deleted. Unlike getDataByLabel, nothing
+   * is copied or thrown for missing labels.
+   */
+  const data_t *findDataByLabel(labeltype label) const {
+    if (search_only_)
+      throw std::runtime_error(
+          "findDataByLabel is not supported in search only mode");
+
+    auto search = label_lookup_.find(label);
+    if (search == label_lookup_.end() || isMarkedDeleted(search->second))
+      return nullptr;
+    return getDataByInternalId(search->second);
+  }
+
   data_t *getRawDataPointerByLabel(labeltype label) {
     tableint label_c;
     auto search = label_lookup_.find(label);
@@ -1020,6 +2517,8 @@ public:
       throw std::runtime_error(
           "markDelete is not supported in search only mode");
 
+    // Compaction renumbers elements, so must not run while marking them:
+    std::shared_lock<std::shared_mutex> lock(resizeLock);
     auto search = label_lookup_.find(label);
     if (search == label_lookup_.end()) {
       throw std::runtime_error("Label not found");
@@ -1040,6 +2539,7 @@ public:
       unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
       *ll_cur |= DELETE_MARK;
       num_deleted_ += 1;
+      markDirty(internalId);
     } else {
       throw std::runtime_error(
           "The requested to delete element is already deleted");
@@ -1052,6 +2552,11 @@ public:
    * @param label
    */
   void unmarkDelete(labeltype label) {
+    if (search_only_)
+      throw std::runtime_error(
+          "unmarkDelete is not supported in search only mode");
+
+    std::shared_lock<std::shared_mutex> lock(resizeLock);
     auto search = label_lookup_.find(label);
     if (search == label_lookup_.end()) {
       throw std::runtime_error("Label not found");
@@ -1070,6 +2575,7 @@ public:
       unsigned char *ll_cur = ((unsigned char *)get_linklist0(internalId)) + 2;
       *ll_cur &= ~DELETE_MARK;
       num_deleted_ -= 1;
+      markDirty(internalId);
     } else {
       throw std::runtime_error(
           "The requested to undelete element is not deleted");
@@ -1106,6 +2612,7 @@ public:
                    float updateNeighborProbability) {
     // update the feature vector associated with existing point with new vector
     memcpy(getDataByInternalId(internalId), dataPoint, data_size_);
+    markDirty(internalId);
 
     int maxLevelCopy = maxlevel_;
     tableint entryPointCopy = enterpoint_node_;
@@ -1179,6 +2686,7 @@ public:
           std::unique_lock<std::mutex> lock(link_list_locks_[neigh]);
           linklistsizeint *ll_cur;
           ll_cur = get_linklist_at_level(neigh, layer);
+          markDirty(neigh);
           size_t candSize = candidates.size();
           setListCount(ll_cur, candSize);
           tableint *data = (tableint *)(ll_cur + 1);
@@ -1278,12 +2786,15 @@ public:
   };
 
   tableint addPoint(const data_t *data_point, labeltype label, int level) {
-    std::shared_lock<std::shared_mutex> lock(resizeLock);
+    std::shared_lock<std::shared_mutex> lock(resizeLock, std::defer_lock);
+    lockAndCountWait(lock);
     tableint cur_c = 0;
     {
       // Checking if the element with the same label already exists
       // if so, updating it *instead* of creating a new element.
-      std::unique_lock<std::mutex> templock_curr(cur_element_count_guard_);
+      std::unique_lock<std::mutex> templock_curr(cur_element_count_guard_,
+                                                 std::defer_lock);
+      lockAndCountWait(templock_curr);
       auto search = label_lookup_.find(label);
       if (search != label_lookup_.end()) {
         tableint existingInternalId = search->second;
@@ -1326,27 +2837,23 @@ public:
 
     element_levels_[cur_c] = curlevel;
 
-    std::unique_lock<std::mutex> templock(global);
+    std::unique_lock<std::mutex> templock(global, std::defer_lock);
+    lockAndCountWait(templock);
     int maxlevelcopy = maxlevel_;
     if (curlevel <= maxlevelcopy)
       templock.unlock();
     tableint currObj = enterpoint_node_;
     tableint enterpoint_copy = enterpoint_node_;
 
-    memset(data_level0_memory_ + cur_c * size_data_per_element_ + offsetLevel0_,
-           0, size_data_per_element_);
+    memset(getElementBlock(cur_c) + offsetLevel0_, 0, size_data_per_element_);
+    markDirty(cur_c);
 
     // Initialisation of the data and label
     memcpy(getExternalLabeLp(cur_c), &label, sizeof(labeltype));
     memcpy(getDataByInternalId(cur_c), data_point, data_size_);
 
     if (curlevel) {
-      linkLists_[cur_c] =
-          (char *)malloc(size_links_per_element_ * curlevel + 1);
-      if (linkLists_[cur_c] == nullptr)
-        throw std::runtime_error(
-            "Not enough memory: addPoint failed to allocate linklist");
-      memset(linkLists_[cur_c], 0, size_links_per_element_ * curlevel + 1);
+      linkLists_[cur_c] = allocateLinkLists(curlevel);
     }
 
     if ((signed)currObj != -1) {
@@ -1417,17 +2924,553 @@ public:
     return cur_c;
   };
 
+  /**
+   * The largest batch of a bulk build, relative to the size of the graph it
+   * is linked into. Each batch only finds neighbors in the graph built before
+   * it (and within itself), so batches must stay small relative to it.
+   */
+  static constexpr double BULK_BUILD_MAX_BATCH_FRACTION = 1.0 / 16;
+
+  /**
+   * The most elements in any one batch of a bulk build, as every element is
+   * compared against every other element in its batch.
+   */
+  static constexpr size_t BULK_BUILD_MAX_BATCH_SIZE = 512;
+
+  /**
+   * Add `numPoints` new elements at once as an offline bulk build, reading
+   * each element's data (`data_size_` bytes) contiguously from `dataPoints`.
+   * `parallelFor(start, end, fn)` must call `fn(i)` for every `i` in [start,
+   * end), and may do so concurrently.
+   *
+   * Elements are inserted in a shuffled order (so that sorted or clustered
+   * input doesn't put similar elements into the same batch), in batches that
+   * grow along with the graph up to a fixed size. Each element in a batch
+   * searches the graph built by the previous batches (which nothing is
+   * writing to, so no locks are taken), compares itself against the rest of
+   * its batch, and links itself to the best neighbors among both; then each
+   * of those neighbors has its links back to the batch added (and pruned) by
+   * a single thread. The resulting graph does not depend on the number of
+   * threads used. Queries and any other insertions wait until the whole
+   * build has finished.
+   *
+   * Every label must be new to the index, and the index must already have
+   * room for every new element.
+   */
+  template <typename ParallelFor>
+  void addPointsInBulk(const data_t *dataPoints, const labeltype *labels,
+                       size_t numPoints, ParallelFor parallelFor) {
+    if (numPoints == 0) {
+      return;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(resizeLock);
+    if (cur_element_count + numPoints > max_elements_) {
+      throw IndexFullError(
+          "Cannot insert " + std::to_string(numPoints) +
+          " elements; this index already contains " +
+          std::to_string(cur_element_count) +
+          " elements, and its maximum size is " +
+          std::to_string(max_elements_) +
+          ". Call resizeIndex first to increase the maximum size of the "
+          "index.");
+    }
+
+    std::unordered_set<labeltype> newLabels;
+    for (size_t i = 0; i < numPoints; i++) {
+      if (label_lookup_.count(labels[i]) ||
+          !newLabels.insert(labels[i]).second) {
+        throw std::invalid_argument(
+            "Cannot bulk-add an element with ID " + std::to_string(labels[i]) +
+            ", as that ID is already in use. Bulk additions cannot update "
+            "existing elements.");
+      }
+    }
+
+    // Levels are drawn on this thread, so that they (and so the resulting
+    // graph) don't depend on how the work below is scheduled:
+    tableint first = cur_element_count;
+    for (size_t i = 0; i < numPoints; i++) {
+      element_levels_[first + i] = getRandomLevel(mult_);
+      label_lookup_[labels[i]] = first + i;
+    }
+
+    parallelFor(0, numPoints, [&](size_t i) {
+      tableint id = first + i;
+      memset(getElementBlock(id) + offsetLevel0_, 0, size_data_per_element_);
+      markDirty(id);
+      memcpy(getExternalLabeLp(id), &labels[i], sizeof(labeltype));
+      memcpy(getDataByInternalId(id),
+             (const char *)dataPoints + (i * data_size_), data_size_);
+      if (element_levels_[id])
+        linkLists_[id] = allocateLinkLists(element_levels_[id]);
+    });
+    cur_element_count += numPoints;
+
+    // The highest element is inserted first (and alone), so that every later
+    // batch can be searched from an entry point at least as high as any of
+    // the batch's elements:
+    std::vector<tableint> order(numPoints);
+    std::iota(order.begin(), order.end(), first);
+    std::iter_swap(order.begin(),
+                   std::max_element(order.begin(), order.end(),
+                                    [&](tableint a, tableint b) {
+                                      return element_levels_[a] <
+                                             element_levels_[b];
+                                    }));
+    std::default_random_engine orderGenerator(level_generator_());
+    std::shuffle(order.begin() + 1, order.end(), orderGenerator);
+
+    size_t start = 0;
+    if ((signed)enterpoint_node_ == -1) {
+      enterpoint_node_ = order[0];
+      maxlevel_ = element_levels_[order[0]];
+      start = 1;
+    }
+
+    // Whether each new element is in the batch being linked:
+    std::vector<char> inBatch(numPoints, false);
+    std::vector<std::tuple<int, tableint, tableint>> reverseLinks;
+    std::vector<size_t> groupStarts;
+    while (start < numPoints) {
+      size_t batchSize = 1;
+      if (start > 0) {
+        size_t graphSize = first + start;
+        batchSize = std::min(
+            {BULK_BUILD_MAX_BATCH_SIZE,
+             std::max<size_t>(1, graphSize * BULK_BUILD_MAX_BATCH_FRACTION),
+             numPoints - start});
+      }
+      size_t end = start + batchSize;
+      int maxLevelCopy = maxlevel_;
+      tableint entryPoint = enterpoint_node_;
+
+      for (size_t i = start; i < end; i++) {
+        inBatch[order[i] - first] = true;
+      }
+      parallelFor(start, end, [&](size_t i) {
+        linkToFrozenGraph(order[i], entryPoint, maxLevelCopy,
+                          order.data() + start, batchSize, [&](tableint id) {
+                            return id >= first && inBatch[id - first];
+                          });
+      });
+      for (size_t i = start; i < end; i++) {
+        inBatch[order[i] - first] = false;
+      }
+
+      // Group the links from the batch's elements by the (level, neighbor)
+      // they point to, so that each neighbor's list is updated only once:
+      reverseLinks.clear();
+      for (size_t i = start; i < end; i++) {
+        tableint id = order[i];
+        int topLevel = std::min(element_levels_[id], maxLevelCopy);
+        for (int level = 0; level <= topLevel; level++) {
+          linklistsizeint *ll = get_linklist_at_level(id, level);
+          tableint *links = (tableint *)(ll + 1);
+          for (size_t j = 0; j < getListCount(ll); j++) {
+            reverseLinks.emplace_back(level, links[j], id);
+          }
+        }
+      }
+      std::sort(reverseLinks.begin(), reverseLinks.end());
+
+      groupStarts.clear();
+      for (size_t i = 0; i < reverseLinks.size(); i++) {
+        if (i == 0 ||
+            std::get<0>(reverseLinks[i]) != std::get<0>(reverseLinks[i - 1]) ||
+            std::get<1>(reverseLinks[i]) != std::get<1>(reverseLinks[i - 1])) {
+          groupStarts.push_back(i);
+        }
+      }
+      groupStarts.push_back(reverseLinks.size());
+      parallelFor(0, groupStarts.size() - 1, [&](size_t group) {
+        addReverseLinks(reverseLinks.data() + groupStarts[group],
+                        groupStarts[group + 1] - groupStarts[group]);
+      });
+
+      for (size_t i = start; i < end; i++) {
+        if (element_levels_[order[i]] > maxlevel_) {
+          maxlevel_ = element_levels_[order[i]];
+          enterpoint_node_ = order[i];
+        }
+      }
+      start = end;
+    }
+  }
+
+  /**
+   * Search for the neighbors of an element added by addPointsInBulk, among
+   * both the graph and the `batchSize` elements of its own `batch`, and link
+   * it to them (but not them to it) on each of its levels. No locks are
+   * taken: nothing else may be modifying the graph, and only the element's
+   * own links are written. `isInBatch(id)` must return whether the given
+   * element is in `batch`, as their links can't be read.
+   */
+  template <typename IsInBatch>
+  void linkToFrozenGraph(tableint id, tableint entryPoint, int maxLevel,
+                         const tableint *batch, size_t batchSize,
+                         const IsInBatch &isInBatch) {
+    const data_t *dataPoint = getDataByInternalId(id);
+    int elementLevel = element_levels_[id];
+    tableint currObj = entryPoint;
+
+    if (elementLevel < maxLevel) {
+      dist_t curdist = fstdistfunc_(dataPoint, getDataByInternalId(currObj),
+                                    dist_func_param_);
+      for (int level = maxLevel; level > elementLevel; level--) {
+        bool changed = true;
+        while (changed) {
+          changed = false;
+          linklistsizeint *data = get_linklist(currObj, level);
+          int size = getListCount(data);
+          tableint *datal = (tableint *)(data + 1);
+          for (int i = 0; i < size; i++) {
+            dist_t d = fstdistfunc_(dataPoint, getDataByInternalId(datal[i]),
+                                    dist_func_param_);
+            if (d < curdist) {
+              curdist = d;
+              currObj = datal[i];
+              changed = true;
+            }
+          }
+        }
+      }
+    }
+
+    bool entryPointDeleted = isMarkedDeleted(entryPoint);
+    for (int level = std::min(elementLevel, maxLevel); level >= 0; level--) {
+      std::priority_queue<std::pair<dist_t, tableint>,
+                          std::vector<std::pair<dist_t, tableint>>,
+                          CompareByFirst>
+          top_candidates = searchBaseLayer(currObj, dataPoint, level, nullptr,
+                                           /* lockLinks= */ false);
+      if (entryPointDeleted) {
+        top_candidates.emplace(
+            fstdistfunc_(dataPoint, getDataByInternalId(entryPoint),
+                         dist_func_param_),
+            entryPoint);
+        if (top_candidates.size() > ef_construction_)
+          top_candidates.pop();
+      }
+
+      // The rest of the batch isn't linked into the graph yet, so can only be
+      // found by comparing against it directly:
+      for (size_t i = 0; i < batchSize; i++) {
+        tableint other = batch[i];
+        if (other == id || element_levels_[other] < level)
+          continue;
+        dist_t d = fstdistfunc_(dataPoint, getDataByInternalId(other),
+                                dist_func_param_);
+        if (top_candidates.size() < ef_construction_ ||
+            d < top_candidates.top().first) {
+          top_candidates.emplace(d, other);
+          if (top_candidates.size() > ef_construction_)
+            top_candidates.pop();
+        }
+      }
+      getNeighborsByHeuristic2(top_candidates, M_);
+
+      // The heuristic leaves the farthest neighbor on top, so the closest
+      // neighbor already in the graph (the entry point for the next level
+      // down) is written last:
+      linklistsizeint *ll = get_linklist_at_level(id, level);
+      tableint *data = (tableint *)(ll + 1);
+      setListCount(ll, top_candidates.size());
+      for (size_t idx = 0; !top_candidates.empty(); idx++) {
+        data[idx] = top_candidates.top().second;
+        if (!isInBatch(data[idx]))
+          currObj = data[idx];
+        top_candidates.pop();
+      }
+    }
+  }
+
+  /**
+   * Add links from one element to each of `numLinks` new elements, given as
+   * (level, element, new element) tuples that all share the same level and
+   * element. If the element's list overflows, it is pruned with the same
+   * heuristic as regular insertions use.
+   */
+  void addReverseLinks(const std::tuple<int, tableint, tableint> *links,
+                       size_t numLinks) {
+    int level = std::get<0>(links[0]);
+    tableint element = std::get<1>(links[0]);
+    size_t maxLinks = level ? maxM_ : maxM0_;
+
+    linklistsizeint *ll = get_linklist_at_level(element, level);
+    size_t size = getListCount(ll);
+    tableint *data = (tableint *)(ll + 1);
+    markDirty(element);
+
+    // Elements of the same batch may already link to one another:
+    thread_local std::vector<tableint> newElements;
+    newElements.clear();
+    for (size_t i = 0; i < numLinks; i++) {
+      tableint newElement = std::get<2>(links[i]);
+      if (std::find(data, data + size, newElement) == data + size) {
+        newElements.push_back(newElement);
+      }
+    }
+
+    if (size + newElements.size() <= maxLinks) {
+      std::copy(newElements.begin(), newElements.end(), data + size);
+      setListCount(ll, size + newElements.size());
+      return;
+    }
+
+    const data_t *elementData = getDataByInternalId(element);
+    std::priority_queue<std::pair<dist_t, tableint>,
+                        std::vector<std::pair<dist_t, tableint>>,
+                        CompareByFirst>
+        candidates;
+    for (size_t j = 0; j < size; j++) {
+      candidates.emplace(fstdistfunc_(getDataByInternalId(data[j]),
+                                      elementData, dist_func_param_),
+                         data[j]);
+    }
+    for (tableint newElement : newElements) {
+      candidates.emplace(fstdistfunc_(getDataByInternalId(newElement),
+                                      elementData, dist_func_param_),
+                         newElement);
+    }
+
+    getNeighborsByHeuristic2(candidates, maxLinks);
+    size_t indx = 0;
+    while (!candidates.empty()) {
+      data[indx++] = candidates.top().second;
+      candidates.pop();
+    }
+    setListCount(ll, indx);
+  }
+
   std::priority_queue<std::pair<dist_t, labeltype>>
   searchKnn(const data_t *query_data, size_t k, VisitedList *vl = nullptr,
-            long queryEf = -1) {
-    std::shared_lock<std::shared_mutex> lock(resizeLock);
+            long queryEf = -1, const BaseFilterFunctor *filter = nullptr) {
+    return searchKnnWithDistance(
+        [&](tableint id) {
+          return fstdistfunc_(query_data, getDataByInternalId(id),
+                              dist_func_param_);
+        },
+        k, vl, queryEf, filter);
+  }
+
+  /**
+   * Like searchKnn, but writes the (up to) k nearest neighbors found directly
+   * to `labels` and `distances` in ascending order of distance, and returns
+   * the number of neighbors found. All intermediate storage is reused across
+   * calls on the same thread, so this does not allocate once warmed up.
+   */
+  size_t searchKnnInto(const data_t *query_data, size_t k, labeltype *labels,
+                       dist_t *distances, long queryEf = -1,
+                       const BaseFilterFunctor *filter = nullptr) {
+    return searchKnnWithDistanceInto(
+        [&](tableint id) {
+          return fstdistfunc_(query_data, getDataByInternalId(id),
+                              dist_func_param_);
+        },
+        k, labels, distances, queryEf, filter);
+  }
+
+  /**
+   * Searches for the k nearest neighbors of a query whose distance to each
+   * element is computed by `distanceToQuery(internalId)`.
+   */
+  template <typename DistanceToQuery>
+  std::priority_queue<std::pair<dist_t, labeltype>>
+  searchKnnWithDistance(const DistanceToQuery &distanceToQuery, size_t k,
+                        VisitedList *vl = nullptr, long queryEf = -1,
+                        const BaseFilterFunctor *filter = nullptr) {
+    std::shared_lock<std::shared_mutex> lock(resizeLock, std::defer_lock);
+    lockAndCountWait(lock);
     std::priority_queue<std::pair<dist_t, labeltype>> result;
     if (cur_element_count == 0)
       return result;
 
+    CandidateHeap top_candidates;
+    searchCandidates(distanceToQuery, k, vl, queryEf, filter, top_candidates);
+    while (top_candidates.size() > k) {
+      top_candidates.pop();
+    }
+    while (top_candidates.size() > 0) {
+      std::pair<dist_t, tableint> rez = top_candidates.top();
+      result.push(std::pair<dist_t, labeltype>(rez.first,
+                                               getExternalLabel(rez.second)));
+      top_candidates.pop();
+    }
+    return result;
+  };
+
+  /**
+   * Like searchKnnWithDistance, but writes its results directly to `labels`
+   * and `distances` in the same way as searchKnnInto.
+   */
+  template <typename DistanceToQuery>
+  size_t searchKnnWithDistanceInto(const DistanceToQuery &distanceToQuery,
+                                   size_t k, labeltype *labels,
+                                   dist_t *distances, long queryEf = -1,
+                                   const BaseFilterFunctor *filter = nullptr,
+                                   long queryPatience = -1) {
+    std::shared_lock<std::shared_mutex> lock(resizeLock, std::defer_lock);
+    lockAndCountWait(lock);
+    if (cur_element_count == 0)
+      return 0;
+
+    thread_local CandidateHeap top_candidates;
+    top_candidates.clear();
+    searchCandidates(distanceToQuery, k, nullptr, queryEf, filter,
+                     top_candidates, queryPatience);
+    return writeResults(top_candidates, k, labels, distances);
+  }
+
+  /**
+   * Assign each of the `count` given labels to the corresponding group, for
+   * grouped searches to return at most one label from. Assigning a label to
+   * its own group (the default) removes its assignment. Assignments are saved
+   * with the index, and included in deltas.
+   */
+  void setGroups(const labeltype *labels, const labeltype *groups,
+                 size_t count) {
+    std::unique_lock<std::shared_mutex> lock(resizeLock);
+    for (size_t i = 0; i < count; i++) {
+      if (groups[i] == labels[i]) {
+        label_groups_.erase(labels[i]);
+      } else {
+        label_groups_[labels[i]] = groups[i];
+      }
+      if (!search_only_)
+        changed_groups_.insert(labels[i]);
+    }
+  }
+
+  labeltype getGroup(labeltype label) {
+    std::shared_lock<std::shared_mutex> lock(resizeLock);
+    return getGroupLocked(label);
+  }
+
+  inline labeltype getGroupLocked(labeltype label) const {
+    if (label_groups_.empty())
+      return label;
+    auto search = label_groups_.find(label);
+    return search == label_groups_.end() ? label : search->second;
+  }
+
+  /**
+   * Like searchKnnInto, but returns (up to) the k nearest groups rather than
+   * the k nearest elements, each represented by the nearest of its elements.
+   * The search continues until (up to) max(queryEf, k) distinct groups have
+   * been found, rather than stopping at that many elements.
+   */
+  size_t searchKnnGroupedInto(const data_t *query_data, size_t k,
+                              labeltype *labels, dist_t *distances,
+                              long queryEf = -1,
+                              const BaseFilterFunctor *filter = nullptr) {
+    return searchKnnGroupedWithDistanceInto(
+        [&](tableint id) {
+          return fstdistfunc_(query_data, getDataByInternalId(id),
+                              dist_func_param_);
+        },
+        k, labels, distances, queryEf, filter);
+  }
+
+  template <typename DistanceToQuery>
+  size_t
+  searchKnnGroupedWithDistanceInto(const DistanceToQuery &distanceToQuery,
+                                   size_t k, labeltype *labels,
+                                   dist_t *distances, long queryEf = -1,
+                                   const BaseFilterFunctor *filter = nullptr) {
+    std::shared_lock<std::shared_mutex> lock(resizeLock, std::defer_lock);
+    lockAndCountWait(lock);
+    if (cur_element_count == 0)
+      return 0;
+
+    tableint currObj = searchUpperLayers(distanceToQuery);
+    size_t effective_ef = queryEf > 0 ? queryEf : ef_;
+
+    thread_local GroupedCandidates top_groups;
+    top_groups.reset(std::max(effective_ef, k));
+    VisitedList *vl = visited_list_pool_->getFreeVisitedList();
+    try {
+      DenseVisitedSet visited(vl);
+      searchBaseLayerGrouped(visited, distanceToQuery, currObj, filter,
+                             top_groups);
+      visited_list_pool_->releaseVisitedList(vl);
+    } catch (...) {
+      visited_list_pool_->releaseVisitedList(vl);
+      throw;
+    }
+
+    const auto &results = top_groups.sortedResults();
+    size_t numResults = std::min(k, results.size());
+    for (size_t i = 0; i < numResults; i++) {
+      distances[i] = results[i].distance;
+      labels[i] = getExternalLabel(results[i].id);
+    }
+    return numResults;
+  }
+
+  /**
+   * Searches the bottom layer of the graph as searchBaseLayerST does, but
+   * keeps only the nearest element of each group in `top_groups`. As elements
+   * of groups already found don't fill up the list of candidates, the search
+   * goes on until `top_groups` holds its capacity of distinct groups. The
+   * caller must hold `resizeLock`.
+   */
+  template <typename VisitedSet, typename DistanceToQuery>
+  void searchBaseLayerGrouped(VisitedSet &visited,
+                              const DistanceToQuery &distanceToQuery,
+                              tableint ep_id, const BaseFilterFunctor *filter,
+                              GroupedCandidates &top_groups) const {
+    ThreadCounters &counters = ThreadCounters::get();
+    thread_local CandidateHeap candidate_set;
+    candidate_set.clear();
+
+    auto offer = [&](tableint id, dist_t dist) {
+      if (isAllowedInResults(id, filter)) {
+        top_groups.offer(dist, id, getGroupLocked(getExternalLabel(id)));
+      }
+    };
+
+    dist_t ep_dist = distanceToQuery(ep_id);
+    offer(ep_id, ep_dist);
+    candidate_set.emplace(-ep_dist, ep_id);
+    visited.insert(ep_id);
+
+    while (!candidate_set.empty()) {
+      std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
+      if (top_groups.full() &&
+          (-current_node_pair.first) > top_groups.furthestDistance()) {
+        break;
+      }
+      candidate_set.pop();
+
+      int *data = (int *)get_linklist0(current_node_pair.second);
+      size_t size = getListCount((linklistsizeint *)data);
+      counters.hops++;
+      counters.distanceComputations += size;
+
+      for (size_t j = 1; j <= size; j++) {
+        int candidate_id = *(data + j);
+        if (visited.insert(candidate_id)) {
+          dist_t dist = distanceToQuery(candidate_id);
+          if (!top_groups.full() || dist < top_groups.furthestDistance()) {
+            candidate_set.emplace(-dist, candidate_id);
+            offer(candidate_id, dist);
+          }
+        }
+      }
+    }
+  }
+
+  /**
+   * Greedily descends the upper layers of the graph towards the query, and
+   * returns the element of the bottom layer to start searching from. The
+   * caller must hold `resizeLock`.
+   */
+  template <typename DistanceToQuery>
+  tableint searchUpperLayers(const DistanceToQuery &distanceToQuery) const {
+    ThreadCounters &counters = ThreadCounters::get();
     tableint currObj = enterpoint_node_;
-    dist_t curdist = fstdistfunc_(
-        query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+    dist_t curdist = distanceToQuery(enterpoint_node_);
 
     for (int level = maxlevel_; level > 0; level--) {
       bool changed = true;
@@ -1437,16 +3480,15 @@ public:
 
         data = (unsigned int *)get_linklist(currObj, level);
         int size = getListCount(data);
-        metric_hops++;
-        metric_distance_computations += size;
+        counters.hops++;
+        counters.distanceComputations += size;
 
         tableint *datal = (tableint *)(data + 1);
         for (int i = 0; i < size; i++) {
           tableint cand = datal[i];
           if (cand < 0 || cand > max_elements_)
             throw std::runtime_error("cand error");
-          dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand),
-                                  dist_func_param_);
+          dist_t d = distanceToQuery(cand);
 
           if (d < curdist) {
             curdist = d;
@@ -1457,30 +3499,302 @@ public:
       }
     }
 
-    std::priority_queue<std::pair<dist_t, tableint>,
-                        std::vector<std::pair<dist_t, tableint>>,
-                        CompareByFirst>
-        top_candidates;
+    return currObj;
+  }
+
+  /**
+   * Descends the upper layers of the graph towards the query, then searches
+   * the bottom layer, leaving at least the k best elements found (if that
+   * many exist) in `top_candidates`. The caller must hold `resizeLock`.
+   */
+  template <typename DistanceToQuery>
+  void searchCandidates(const DistanceToQuery &distanceToQuery, size_t k,
+                        VisitedList *vl, long queryEf,
+                        const BaseFilterFunctor *filter,
+                        CandidateHeap &top_candidates,
+                        long queryPatience = -1) {
+    tableint currObj = searchUpperLayers(distanceToQuery);
+
     size_t effective_ef = queryEf > 0 ? queryEf : ef_;
-    if (num_deleted_) {
-      top_candidates = searchBaseLayerST<true, true>(
-          currObj, query_data, std::max(effective_ef, k), vl);
+    size_t patience = getEarlyTerminationPatience(queryPatience);
+    // Filtered searches are handled the same way as searches over an index
+    // with deletions: every element is traversed, but only some are returned.
+    if (num_deleted_ || filter) {
+      searchBaseLayerSTWithDistance<true, true>(
+          distanceToQuery, currObj, std::max(effective_ef, k), vl, filter,
+          top_candidates, patience);
     } else {
-      top_candidates = searchBaseLayerST<false, true>(
-          currObj, query_data, std::max(effective_ef, k), vl);
+      searchBaseLayerSTWithDistance<false, true>(
+          distanceToQuery, currObj, std::max(effective_ef, k), vl, nullptr,
+          top_candidates, patience);
     }
+  }
 
+  /**
+   * Writes the best k elements in `top_candidates` to `labels` and
+   * `distances` in ascending order of distance (breaking ties by label, as
+   * searchKnn's priority queue does), then clears `top_candidates`. Returns
+   * the number of results written.
+   */
+  size_t writeResults(CandidateHeap &top_candidates, size_t k,
+                      labeltype *labels, dist_t *distances) const {
     while (top_candidates.size() > k) {
       top_candidates.pop();
     }
-    while (top_candidates.size() > 0) {
-      std::pair<dist_t, tableint> rez = top_candidates.top();
-      result.push(std::pair<dist_t, labeltype>(rez.first,
-                                               getExternalLabel(rez.second)));
-      top_candidates.pop();
+
+    thread_local std::vector<std::pair<dist_t, labeltype>> sorted;
+    sorted.clear();
+    for (size_t i = 0; i < top_candidates.size(); i++) {
+      sorted.emplace_back(top_candidates[i].first,
+                          getExternalLabel(top_candidates[i].second));
     }
-    return result;
-  };
+    top_candidates.clear();
+    std::sort(sorted.begin(), sorted.end());
+
+    for (size_t i = 0; i < sorted.size(); i++) {
+      distances[i] = sorted[i].first;
+      labels[i] = sorted[i].second;
+    }
+    return sorted.size();
+  }
+
+  /**
+   * Search for the k nearest neighbors of each of a block of query vectors.
+   *
+   * The provided queries are stored contiguously, each queryStride elements
+   * apart. Rather than walking the upper layers of the graph independently for
+   * each query, the queries are descended together: at each step, queries
+   * currently positioned at the same node share a single fetch of that node's
+   * link list, and each neighbor's vector is loaded once and compared against
+   * all of those queries at once. As queries in a batch usually start from the
+   * same entry point and pass through the same hub nodes, this avoids most of
+   * the redundant memory traffic in the upper layers. The base layer is then
+   * searched for each query individually.
+   *
+   * The results for the q-th query are written to `labels + q * k` and
+   * `distances + q * k` as by searchKnnInto, and the number of results found
+   * for it to `numResults[q]`. Results are identical to calling
+   * searchKnnInto() on each query in turn.
+   */
+  void searchKnnBatch(const data_t *queries, size_t numQueries,
+                      size_t queryStride, size_t k, labeltype *labels,
+                      dist_t *distances, size_t *numResults,
+                      long queryEf = -1,
+                      const BaseFilterFunctor *filter = nullptr,
+                      long queryPatience = -1) {
+    std::shared_lock<std::shared_mutex> lock(resizeLock, std::defer_lock);
+    lockAndCountWait(lock);
+    ThreadCounters &counters = ThreadCounters::get();
+    std::fill(numResults, numResults + numQueries, 0);
+    if (cur_element_count == 0 || numQueries == 0)
+      return;
+
+    std::vector<const data_t *> queryPointers(numQueries);
+    for (size_t q = 0; q < numQueries; q++) {
+      queryPointers[q] = queries + q * queryStride;
+    }
+
+    std::vector<tableint> currObj(numQueries, enterpoint_node_);
+    std::vector<dist_t> curdist(numQueries);
+    distancesToElement(enterpoint_node_, queryPointers.data(), numQueries,
+                       curdist.data());
+
+    // Indices of the queries that are still moving on the current level, and
+    // scratch space for the queries (and their distances) that share a node:
+    std::vector<size_t> active;
+    std::vector<size_t> stillActive;
+    std::vector<const data_t *> groupQueries;
+    std::vector<dist_t> groupDistances;
+    std::vector<char> groupChanged;
+    active.reserve(numQueries);
+    stillActive.reserve(numQueries);
+    groupQueries.reserve(numQueries);
+    groupDistances.reserve(numQueries);
+    groupChanged.reserve(numQueries);
+
+    for (int level = maxlevel_; level > 0; level--) {
+      active.resize(numQueries);
+      for (size_t q = 0; q < numQueries; q++) {
+        active[q] = q;
+      }
+
+      while (!active.empty()) {
+        // Group queries by the node they're currently positioned at, so that
+        // each node's link list and neighbors are only fetched once:
+        std::sort(active.begin(), active.end(), [&](size_t a, size_t b) {
+          return currObj[a] < currObj[b] || (currObj[a] == currObj[b] && a < b);
+        });
+
+        stillActive.clear();
+        for (size_t groupStart = 0; groupStart < active.size();) {
+          tableint node = currObj[active[groupStart]];
+          size_t groupEnd = groupStart;
+          while (groupEnd < active.size() && currObj[active[groupEnd]] == node)
+            groupEnd++;
+          size_t groupSize = groupEnd - groupStart;
+
+          unsigned int *data = (unsigned int *)get_linklist(node, level);
+          int size = getListCount(data);
+          counters.hops += groupSize;
+          counters.distanceComputations += size * groupSize;
+
+          groupQueries.resize(groupSize);
+          groupDistances.resize(groupSize);
+          groupChanged.assign(groupSize, false);
+          for (size_t i = 0; i < groupSize; i++) {
+            groupQueries[i] = queryPointers[active[groupStart + i]];
+          }
+
+          tableint *datal = (tableint *)(data + 1);
+          for (int j = 0; j < size; j++) {
+            tableint cand = datal[j];
+            if (cand > max_elements_)
+              throw std::runtime_error("cand error");
+
+            distancesToElement(cand, groupQueries.data(), groupSize,
+                               groupDistances.data());
+
+            for (size_t i = 0; i < groupSize; i++) {
+              size_t q = active[groupStart + i];
+              if (groupDistances[i] < curdist[q]) {
+                curdist[q] = groupDistances[i];
+                currObj[q] = cand;
+                groupChanged[i] = true;
+              }
+            }
+          }
+
+          for (size_t i = 0; i < groupSize; i++) {
+            if (groupChanged[i])
+              stillActive.push_back(active[groupStart + i]);
+          }
+          groupStart = groupEnd;
+        }
+
+        active.swap(stillActive);
+      }
+    }
+
+    size_t effective_ef = queryEf > 0 ? queryEf : ef_;
+    size_t patience = getEarlyTerminationPatience(queryPatience);
+    thread_local CandidateHeap top_candidates;
+    for (size_t q = 0; q < numQueries; q++) {
+      const data_t *query = queryPointers[q];
+      auto distanceToQuery = [&](tableint id) {
+        return fstdistfunc_(query, getDataByInternalId(id), dist_func_param_);
+      };
+
+      top_candidates.clear();
+      if (num_deleted_ || filter) {
+        searchBaseLayerSTWithDistance<true, true>(
+            distanceToQuery, currObj[q], std::max(effective_ef, k), nullptr,
+            filter, top_candidates, patience);
+      } else {
+        searchBaseLayerSTWithDistance<false, true>(
+            distanceToQuery, currObj[q], std::max(effective_ef, k), nullptr,
+            nullptr, top_candidates, patience);
+      }
+      numResults[q] = writeResults(top_candidates, k, labels + (q * k),
+                                   distances + (q * k));
+    }
+  }
+
+  /**
+   * Find the exact k nearest neighbors of each of a block of query vectors by
+   * comparing every query against every element in the index (skipping
+   * deleted elements, and those rejected by `filter`) rather than searching
+   * the graph.
+   *
+   * Queries and results are laid out as in searchKnnBatch. Elements are
+   * scanned in memory order, and each element's vector is compared against
+   * every query in the block while it's in cache, so the index is streamed
+   * from memory once per block rather than once per query.
+   *
+   * Elements being added concurrently may be compared before their vectors
+   * have been fully written, so this shouldn't be called during insertion.
+   */
+  void bruteForceSearchBatch(const data_t *queries, size_t numQueries,
+                             size_t queryStride, size_t k, labeltype *labels,
+                             dist_t *distances, size_t *numResults,
+                             const BaseFilterFunctor *filter = nullptr) {
+    std::vector<const data_t *> queryPointers(numQueries);
+    for (size_t q = 0; q < numQueries; q++) {
+      queryPointers[q] = queries + q * queryStride;
+    }
+    bruteForceSearchWithDistances(
+        [&](tableint id, dist_t *elementDistances) {
+          distancesToElement(id, queryPointers.data(), numQueries,
+                             elementDistances);
+        },
+        numQueries, k, labels, distances, numResults, filter);
+  }
+
+  /**
+   * As bruteForceSearchBatch, but with distances computed by
+   * `distancesTo(id, distances)`, which must write the distance between the
+   * element with the given internal ID and each of the `numQueries` queries.
+   */
+  template <typename DistancesToQueries>
+  void bruteForceSearchWithDistances(DistancesToQueries distancesTo,
+                                     size_t numQueries, size_t k,
+                                     labeltype *labels, dist_t *distances,
+                                     size_t *numResults,
+                                     const BaseFilterFunctor *filter) {
+    std::shared_lock<std::shared_mutex> lock(resizeLock, std::defer_lock);
+    lockAndCountWait(lock);
+    std::fill(numResults, numResults + numQueries, 0);
+    if (numQueries == 0 || k == 0)
+      return;
+
+    std::vector<CandidateHeap> topCandidates(numQueries);
+    std::vector<dist_t> elementDistances(numQueries);
+    size_t numElements = cur_element_count;
+    size_t numCompared = 0;
+    size_t depth = std::min(prefetch_depth_, numElements);
+    for (size_t id = 0; id < depth; id++) {
+      prefetchData(id);
+    }
+
+    for (size_t id = 0; id < numElements; id++) {
+      if (id + depth < numElements) {
+        prefetchData(id + depth);
+      }
+      if (isMarkedDeleted(id) || (filter && !(*filter)(getExternalLabel(id)))) {
+        continue;
+      }
+
+      distancesTo(id, elementDistances.data());
+      numCompared++;
+      for (size_t q = 0; q < numQueries; q++) {
+        CandidateHeap &heap = topCandidates[q];
+        if (heap.size() < k || elementDistances[q] < heap.top().first) {
+          heap.emplace(elementDistances[q], id);
+          if (heap.size() > k) {
+            heap.pop();
+          }
+        }
+      }
+    }
+
+    ThreadCounters::get().distanceComputations += numCompared * numQueries;
+    for (size_t q = 0; q < numQueries; q++) {
+      numResults[q] = writeResults(topCandidates[q], k, labels + (q * k),
+                                   distances + (q * k));
+    }
+  }
+
+  /**
+   * Compute the distance between one element's vector and each of the
+   * provided query vectors (a many-to-one comparison) with the space's
+   * many-to-one kernel, which loads each block of the element once and scores
+   * several queries against it per pass.
+   */
+  inline void distancesToElement(tableint internal_id,
+                                 const data_t *const *queries,
+                                 size_t numQueries, dist_t *distances) const {
+    fstmultidistfunc_(getDataByInternalId(internal_id), queries, numQueries,
+                      dist_func_param_, distances);
+  }
 
   void checkIntegrity() {
     int connections_checked = 0;
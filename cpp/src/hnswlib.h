@@ -22,28 +22,38 @@
  */
 
 #pragma once
+/**
+ * SIMD distance functions are compiled for every instruction set extension
+ * supported by the target architecture (i.e.: SSE, AVX, AVX2 and AVX512 on
+ * x86, or NEON and the NEON dot product extension on aarch64), regardless of
+ * the flags passed to the compiler. The fastest variant supported by the host
+ * CPU is then chosen at runtime, when each Space is constructed. This allows
+ * one binary to run at full speed on new CPUs while still working on old ones.
+ */
 #ifndef NO_MANUAL_VECTORIZATION
-#ifdef __SSE__
+#if defined(__SSE__) && (defined(__GNUC__) || defined(__clang__))
 #define USE_SSE
-#ifdef __AVX__
-#define USE_AVX
-#ifdef __AVX512F__
-#define USE_AVX512
 #endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define USE_NEON
+// The dot product intrinsics are only declared for use in target-attributed
+// functions by newer compilers:
+#if defined(__ARM_FEATURE_DOTPROD) ||                                          \
+    (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 10) ||            \
+    (defined(__apple_build_version__) && __clang_major__ >= 15) ||             \
+    (defined(__clang__) && !defined(__apple_build_version__) &&                \
+     __clang_major__ >= 16)
+#define USE_NEON_DOTPROD
 #endif
 #endif
 #endif
 
-#if defined(USE_AVX) || defined(USE_SSE)
-#ifdef _MSC_VER
-#include <intrin.h>
-#include <stdexcept>
-#else
-#include <x86intrin.h>
+#if defined(USE_SSE)
+#include <immintrin.h>
 #endif
 
-#if defined(USE_AVX512)
-#include <immintrin.h>
+#if defined(USE_NEON)
+#include <arm_neon.h>
 #endif
 
 #if defined(__GNUC__)
@@ -53,15 +63,17 @@
 #define PORTABLE_ALIGN32 __declspec(align(32))
 #define PORTABLE_ALIGN64 __declspec(align(64))
 #endif
-#endif
 
 #include "StreamUtils.h"
+#include "cpu_features.h"
 #include "visited_list_pool.h"
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <queue>
 #include <string.h>
+#include <unordered_set>
 #include <vector>
 
 namespace hnswlib {
@@ -72,12 +84,66 @@ public:
   bool operator()(const T &p1, const T &p2) { return p1.first > p2.first; }
 };
 
+/**
+ * A per-query predicate that decides which elements may be returned by a
+ * search. Elements rejected by a filter are still traversed (so that the rest
+ * of the graph stays reachable) but never enter the search results, in the
+ * same way that elements marked as deleted are treated.
+ *
+ * Filters may be called concurrently from multiple threads.
+ */
+class BaseFilterFunctor {
+public:
+  virtual bool operator()(labeltype label) const = 0;
+  virtual ~BaseFilterFunctor() {}
+};
+
+/**
+ * A filter that only allows elements whose labels are in the provided list.
+ *
+ * Labels are assigned sequentially by default, so most allow-lists are dense
+ * and are stored as a bitmap over label values; sparse allow-lists (i.e.: with
+ * very large label values) are stored in a hash set instead.
+ */
+class AllowListFilter : public BaseFilterFunctor {
+public:
+  AllowListFilter(const std::vector<labeltype> &labels) {
+    labeltype maxLabel = 0;
+    for (labeltype label : labels) {
+      maxLabel = std::max(maxLabel, label);
+    }
+
+    // A hash set costs roughly 32 bytes (256 bits) per label:
+    if (labels.empty() || maxLabel / 256 <= labels.size()) {
+      bitmap.resize(maxLabel + 1, false);
+      for (labeltype label : labels) {
+        bitmap[label] = true;
+      }
+    } else {
+      useHashSet = true;
+      hashSet.insert(labels.begin(), labels.end());
+    }
+  }
+
+  bool operator()(labeltype label) const {
+    if (useHashSet) {
+      return hashSet.find(label) != hashSet.end();
+    }
+    return label < bitmap.size() && bitmap[label];
+  }
+
+private:
+  bool useHashSet = false;
+  std::vector<bool> bitmap;
+  std::unordered_set<labeltype> hashSet;
+};
+
 template <typename dist_t, typename data_t = dist_t> class AlgorithmInterface {
 public:
   virtual void addPoint(const data_t *datapoint, labeltype label) = 0;
   virtual std::priority_queue<std::pair<dist_t, labeltype>>
   searchKnn(const data_t *, size_t, VisitedList *a = nullptr,
-            long queryEf = -1) = 0;
+            long queryEf = -1, const BaseFilterFunctor *filter = nullptr) = 0;
 
   // Return k nearest neighbor in the order of closer fist
   virtual std::vector<std::pair<dist_t, labeltype>>
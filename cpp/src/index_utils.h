@@ -0,0 +1,153 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <vector>
+
+#include "CompressedStream.h"
+#include "Index.h"
+
+/**
+ * Implementations of Index methods that are written purely in terms of the
+ * rest of the Index interface, shared by each of its subclasses.
+ */
+namespace IndexUtils {
+
+/**
+ * See Index::calibrateEarlyTermination.
+ */
+static size_t calibrateEarlyTermination(Index &index,
+                                        NDArray<float, 2> queryVectors, int k,
+                                        float targetRecall, long queryEf,
+                                        int numThreads) {
+  if (targetRecall < 0 || targetRecall > 1) {
+    throw std::invalid_argument("targetRecall must be between 0 and 1.");
+  }
+  if (std::get<1>(queryVectors.shape) != index.getNumDimensions()) {
+    throw std::runtime_error(
+        "Query vectors expected to share dimensionality with index.");
+  }
+
+  size_t numQueries = std::get<0>(queryVectors.shape);
+  std::vector<hnswlib::labeltype> expected(numQueries * k);
+  std::vector<hnswlib::labeltype> actual(numQueries * k);
+  std::vector<float> distances(numQueries * k);
+  auto queryWithPatience = [&](size_t patience, hnswlib::labeltype *labels) {
+    index.queryInto(queryVectors.data.data(), numQueries, k, labels,
+                    distances.data(), numThreads, queryEf, nullptr, 0, nullptr,
+                    (long)patience);
+  };
+  queryWithPatience(0, expected.data());
+
+  auto recallWithPatience = [&](size_t patience) {
+    queryWithPatience(patience, actual.data());
+    size_t found = 0;
+    for (size_t row = 0; row < numQueries; row++) {
+      const hnswlib::labeltype *expectedRow = &expected[row * k];
+      for (int i = 0; i < k; i++) {
+        if (std::find(expectedRow, expectedRow + k, actual[row * k + i]) !=
+            expectedRow + k) {
+          found++;
+        }
+      }
+    }
+    return numQueries ? (float)found / (numQueries * k) : 1.0f;
+  };
+
+  // A search expands each node at most once, so one with a patience of at
+  // least the number of elements never stops early and finds exactly the
+  // expected neighbors. Starting from the search budget, the upper bound
+  // doubles until it reaches the target recall (or that patience):
+  size_t maxPatience = std::max<size_t>(index.getNumElements(), 1);
+  size_t low = 1;
+  size_t high = std::min<size_t>(
+      std::max<size_t>(queryEf > 0 ? queryEf : index.getEF(), k), maxPatience);
+  while (high < maxPatience && recallWithPatience(high) < targetRecall) {
+    low = high + 1;
+    high = std::min(high * 2, maxPatience);
+  }
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (recallWithPatience(middle) >= targetRecall) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+
+  size_t patience = low < maxPatience ? low : 0;
+  index.setEarlyTerminationPatience(patience);
+  return patience;
+}
+
+/**
+ * See Index::saveCompressedIndex.
+ */
+static void saveCompressedIndex(Index &index,
+                                std::shared_ptr<OutputStream> outputStream,
+                                int compressionLevel) {
+  writeCompressed(outputStream, compressionLevel,
+                  [&index](std::shared_ptr<OutputStream> stream) {
+                    index.saveIndex(stream);
+                  });
+}
+
+/**
+ * See Index::groupedQuery.
+ */
+static std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
+groupedQuery(Index &index, const std::vector<float> &queryVector, int k,
+             long queryEf, const hnswlib::BaseFilterFunctor *filter) {
+  if ((int)queryVector.size() != index.getNumDimensions()) {
+    throw std::runtime_error(
+        "Query vector expected to share dimensionality with index.");
+  }
+
+  std::vector<hnswlib::labeltype> labels(k);
+  std::vector<float> distances(k);
+  index.groupedQueryInto(queryVector.data(), 1, k, labels.data(),
+                         distances.data(), 1, queryEf, filter);
+  return {labels, distances};
+}
+
+static std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+groupedQuery(Index &index, NDArray<float, 2> queryVectors, int k,
+             int numThreads, long queryEf,
+             const hnswlib::BaseFilterFunctor *filter) {
+  int numRows = std::get<0>(queryVectors.shape);
+  if (std::get<1>(queryVectors.shape) != index.getNumDimensions()) {
+    throw std::runtime_error(
+        "Query vectors expected to share dimensionality with index.");
+  }
+
+  NDArray<hnswlib::labeltype, 2> labels({numRows, k});
+  NDArray<float, 2> distances({numRows, k});
+  index.groupedQueryInto(queryVectors.data.data(), numRows, k,
+                         labels.data.data(), distances.data.data(), numThreads,
+                         queryEf, filter);
+  return {labels, distances};
+}
+
+} // namespace IndexUtils
@@ -0,0 +1,305 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace hnswlib {
+enum class HugePageMode {
+  // Use the system allocator, with whatever page size it chooses.
+  None,
+  // Align large allocations to 2 MB and ask the kernel to back them with
+  // transparent huge pages. The kernel may still use regular pages if no huge
+  // pages are available.
+  Transparent,
+  // Back large allocations with pages from the kernel's pool of reserved 2 MB
+  // huge pages. Allocation fails if not enough have been reserved (i.e.: via
+  // /proc/sys/vm/nr_hugepages).
+  Explicit2MB,
+  // As Explicit2MB, but allocations of at least 1 GB are backed by reserved
+  // 1 GB huge pages instead.
+  Explicit1GB,
+};
+
+/**
+ * Controls how an index allocates the memory that holds its elements: the
+ * bottom layer of the graph (including each element's vector), and the link
+ * lists of its upper layers.
+ *
+ * Huge pages and NUMA binding are only supported on Linux; requesting either
+ * elsewhere throws when the index's memory is first allocated.
+ */
+struct MemoryPolicy {
+  HugePageMode hugePages = HugePageMode::None;
+
+  // If non-negative, bind element memory to the given NUMA node.
+  int numaNode = -1;
+
+  // If true, allocate upper-layer link lists from large blocks of memory,
+  // rather than with one call to malloc per element.
+  bool arenaLinkLists = false;
+
+  bool usesSystemAllocator() const {
+    return hugePages == HugePageMode::None && numaNode < 0;
+  }
+
+  /**
+   * The smallest granularity at which this policy allocates memory, and so
+   * the smallest allocation that can benefit from it.
+   */
+  size_t getPageSize() const {
+    switch (hugePages) {
+    case HugePageMode::Transparent:
+    case HugePageMode::Explicit2MB:
+    case HugePageMode::Explicit1GB:
+      return HUGE_PAGE_SIZE;
+    default:
+      return 4096;
+    }
+  }
+
+  /**
+   * The size of the pages used for an allocation of `numBytes`. 1 GB pages
+   * are only used for allocations that fill at least one of them.
+   */
+  size_t getPageSize(size_t numBytes) const {
+    if (hugePages == HugePageMode::Explicit1GB && numBytes >= GIANT_PAGE_SIZE) {
+      return GIANT_PAGE_SIZE;
+    }
+    return getPageSize();
+  }
+
+  /**
+   * Allocate `numBytes` of zero-filled memory according to this policy.
+   * Memory must be released by calling deallocate() with the same size.
+   */
+  void *allocate(size_t numBytes) const {
+    if (usesSystemAllocator()) {
+      void *memory = calloc(numBytes, 1);
+      if (!memory) {
+        throw std::runtime_error("Not enough memory: failed to allocate " +
+                                 std::to_string(numBytes) + " bytes");
+      }
+      return memory;
+    }
+
+#ifdef __linux__
+    size_t length = getAllocatedSize(numBytes);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    if (hugePages == HugePageMode::Explicit2MB ||
+        hugePages == HugePageMode::Explicit1GB) {
+      int pageShift = getPageSize(numBytes) == GIANT_PAGE_SIZE ? 30 : 21;
+      flags |= MAP_HUGETLB | (pageShift << HUGE_PAGE_SHIFT);
+    }
+
+    // Transparent huge pages can only back 2 MB-aligned ranges, so map an
+    // extra page and trim the unaligned ends off:
+    bool align = hugePages == HugePageMode::Transparent;
+    size_t mappedLength = align ? length + getPageSize() : length;
+    void *mapping = mmap(nullptr, mappedLength, PROT_READ | PROT_WRITE, flags,
+                         -1, 0);
+    if (mapping == MAP_FAILED) {
+      throw std::runtime_error(
+          "Failed to allocate " + std::to_string(length) + " bytes" +
+          (flags & MAP_HUGETLB ? " of huge pages; are enough huge pages "
+                                 "reserved by the kernel?"
+                               : "."));
+    }
+
+    char *memory = (char *)mapping;
+    if (align) {
+      uintptr_t address = (uintptr_t)mapping;
+      uintptr_t aligned =
+          (address + getPageSize() - 1) & ~(uintptr_t)(getPageSize() - 1);
+      memory = (char *)aligned;
+      if (aligned > address) {
+        munmap(mapping, aligned - address);
+      }
+      size_t tail = (address + mappedLength) - (aligned + length);
+      if (tail > 0) {
+        munmap(memory + length, tail);
+      }
+      madvise(memory, length, MADV_HUGEPAGE);
+    }
+
+    if (numaNode >= 0) {
+      bindToNumaNode(memory, length);
+    }
+    return memory;
+#else
+    throw std::runtime_error(
+        "Huge pages and NUMA binding are not supported on this platform.");
+#endif
+  }
+
+  void deallocate(void *memory, size_t numBytes) const {
+    if (!memory) {
+      return;
+    }
+    if (usesSystemAllocator()) {
+      free(memory);
+      return;
+    }
+#ifdef __linux__
+    munmap(memory, getAllocatedSize(numBytes));
+#endif
+  }
+
+  /**
+   * The number of bytes actually allocated for a request of `numBytes`.
+   */
+  size_t getAllocatedSize(size_t numBytes) const {
+    if (usesSystemAllocator()) {
+      return numBytes;
+    }
+    size_t pageSize = getPageSize(numBytes);
+    return ((numBytes + pageSize - 1) / pageSize) * pageSize;
+  }
+
+private:
+  static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+  static const size_t GIANT_PAGE_SIZE = 1024 * 1024 * 1024;
+
+#ifdef __linux__
+  // Equal to MAP_HUGE_SHIFT, which older kernel headers don't define.
+  static const int HUGE_PAGE_SHIFT = 26;
+  // Equal to MPOL_BIND, from <numaif.h> (which requires libnuma).
+  static const int MEMORY_POLICY_BIND = 2;
+
+  void bindToNumaNode(void *memory, size_t length) const {
+    const int maxNodes = sizeof(unsigned long) * 8;
+    if (numaNode >= maxNodes) {
+      throw std::invalid_argument("NUMA node must be less than " +
+                                  std::to_string(maxNodes) + ".");
+    }
+    unsigned long nodeMask = 1UL << numaNode;
+    // The kernel ignores the last of the `maxnode` bits it's told about, so
+    // (like libnuma) pass one more than the number of bits in the mask:
+    if (syscall(SYS_mbind, memory, length, MEMORY_POLICY_BIND, &nodeMask,
+                maxNodes + 1, 0) != 0) {
+      munmap(memory, length);
+      throw std::runtime_error("Failed to bind memory to NUMA node " +
+                               std::to_string(numaNode) + ".");
+    }
+  }
+#endif
+};
+
+/**
+ * A bump allocator for link lists, which hands out pieces of large blocks of
+ * memory rather than making one allocation per element. Link lists released
+ * back to the arena are kept on a free list (per size) for reuse; blocks are
+ * only returned to the system when the arena is reset or destroyed.
+ */
+class LinkListArena {
+public:
+  LinkListArena() = default;
+  LinkListArena(const LinkListArena &) = delete;
+  LinkListArena &operator=(const LinkListArena &) = delete;
+
+  ~LinkListArena() { reset(); }
+
+  void reset(const MemoryPolicy &newPolicy = {}) {
+    std::unique_lock<std::mutex> lock(arenaLock);
+    for (auto &block : blocks) {
+      policy.deallocate(block.first, block.second);
+    }
+    blocks.clear();
+    freeLists.clear();
+    cursor = nullptr;
+    remaining = 0;
+    policy = newPolicy;
+    blockSize = std::max(DEFAULT_BLOCK_SIZE, policy.getPageSize());
+  }
+
+  /**
+   * Returns `numBytes` of zero-filled memory, aligned to 8 bytes.
+   */
+  char *allocate(size_t numBytes) {
+    size_t size = roundUp(numBytes);
+    std::unique_lock<std::mutex> lock(arenaLock);
+    if (size / ALIGNMENT < freeLists.size() &&
+        !freeLists[size / ALIGNMENT].empty()) {
+      char *reused = freeLists[size / ALIGNMENT].back();
+      freeLists[size / ALIGNMENT].pop_back();
+      std::fill(reused, reused + size, 0);
+      return reused;
+    }
+
+    if (size > remaining) {
+      size_t newBlockSize = std::max(blockSize, policy.getAllocatedSize(size));
+      cursor = (char *)policy.allocate(newBlockSize);
+      blocks.emplace_back(cursor, newBlockSize);
+      remaining = newBlockSize;
+    }
+
+    char *result = cursor;
+    cursor += size;
+    remaining -= size;
+    return result;
+  }
+
+  /**
+   * Make memory previously returned by allocate(numBytes) available for
+   * reuse by later allocations of the same size.
+   */
+  void release(char *memory, size_t numBytes) {
+    size_t size = roundUp(numBytes);
+    std::unique_lock<std::mutex> lock(arenaLock);
+    if (size / ALIGNMENT >= freeLists.size()) {
+      freeLists.resize(size / ALIGNMENT + 1);
+    }
+    freeLists[size / ALIGNMENT].push_back(memory);
+  }
+
+private:
+  static const size_t ALIGNMENT = 8;
+  static const size_t DEFAULT_BLOCK_SIZE = 4 * 1024 * 1024;
+
+  std::mutex arenaLock;
+  MemoryPolicy policy;
+  size_t blockSize = DEFAULT_BLOCK_SIZE;
+
+  std::vector<std::pair<char *, size_t>> blocks;
+  char *cursor = nullptr;
+  size_t remaining = 0;
+
+  // Released link lists, indexed by their size divided by ALIGNMENT:
+  std::vector<std::vector<char *>> freeLists;
+
+  static size_t roundUp(size_t numBytes) {
+    return ((numBytes + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+  }
+};
+} // namespace hnswlib
@@ -0,0 +1,127 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/**
+ * The NUMA nodes of this machine, and the CPUs that belong to each of them,
+ * as reported by Linux's sysfs.
+ *
+ * Machines without NUMA (and platforms other than Linux) are reported as a
+ * single node with an empty CPU list, which means "any CPU".
+ */
+class NumaTopology {
+public:
+  static const NumaTopology &get() {
+    static const NumaTopology topology = NumaTopology::detect();
+    return topology;
+  }
+
+  size_t getNumNodes() const { return nodeCpus.size(); }
+
+  const std::vector<int> &getCpus(size_t node) const {
+    return nodeCpus.at(node);
+  }
+
+  /**
+   * The ID the kernel uses for the given node (i.e.: when binding memory to
+   * it), or -1 on machines without NUMA.
+   */
+  int getNodeId(size_t node) const { return nodeIds.at(node); }
+
+  /**
+   * The node of the CPU that the calling thread is currently running on, or 0
+   * if unknown.
+   */
+  size_t getCurrentNode() const {
+#ifdef __linux__
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && (size_t)cpu < cpuNodes.size()) {
+      return cpuNodes[cpu];
+    }
+#endif
+    return 0;
+  }
+
+private:
+  std::vector<std::vector<int>> nodeCpus;
+  std::vector<int> nodeIds;
+  std::vector<size_t> cpuNodes;
+
+  static NumaTopology detect() {
+    NumaTopology topology;
+#ifdef __linux__
+    for (int node : readCpuList("/sys/devices/system/node/online")) {
+      std::vector<int> cpus = readCpuList("/sys/devices/system/node/node" +
+                                          std::to_string(node) + "/cpulist");
+      if (cpus.empty()) {
+        // Memory-only nodes have no CPUs to run workers on.
+        continue;
+      }
+      for (int cpu : cpus) {
+        if ((size_t)cpu >= topology.cpuNodes.size()) {
+          topology.cpuNodes.resize(cpu + 1, 0);
+        }
+        topology.cpuNodes[cpu] = topology.nodeCpus.size();
+      }
+      topology.nodeCpus.push_back(cpus);
+      topology.nodeIds.push_back(node);
+    }
+#endif
+    if (topology.nodeCpus.size() <= 1) {
+      topology.nodeCpus = {{}};
+      topology.nodeIds = {-1};
+      topology.cpuNodes.clear();
+    }
+    return topology;
+  }
+
+  /**
+   * Parse a sysfs list of CPUs or nodes (i.e.: "0-3,8-11"). Returns an empty
+   * list if the file can't be read.
+   */
+  static std::vector<int> readCpuList(const std::string &path) {
+    std::vector<int> values;
+    std::ifstream file(path);
+    std::string range;
+    while (std::getline(file, range, ',')) {
+      int first, last;
+      char dash;
+      std::istringstream parser(range);
+      if (!(parser >> first)) {
+        continue;
+      }
+      last = (parser >> dash >> last) ? last : first;
+      for (int value = first; value <= last; value++) {
+        values.push_back(value);
+      }
+    }
+    return values;
+  }
+};
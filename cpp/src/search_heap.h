@@ -0,0 +1,265 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace hnswlib {
+/**
+ * A binary max-heap with the same ordering semantics as std::priority_queue,
+ * but whose storage is kept when cleared. A heap reused across searches (i.e.:
+ * one per thread) stops allocating once it has grown to the size of the
+ * largest search it has performed.
+ *
+ * Unlike std::priority_queue, the contents of the heap can also be read
+ * directly, without popping (and re-heapifying after) each element.
+ */
+template <typename T, typename Compare = std::less<T>> class SearchHeap {
+public:
+  SearchHeap() = default;
+
+  bool empty() const { return items.empty(); }
+  size_t size() const { return items.size(); }
+  const T &top() const { return items.front(); }
+
+  void clear() { items.clear(); }
+  void reserve(size_t capacity) { items.reserve(capacity); }
+
+  void push(const T &item) {
+    items.push_back(item);
+    std::push_heap(items.begin(), items.end(), compare);
+  }
+
+  template <typename... Args> void emplace(Args &&...args) {
+    items.emplace_back(std::forward<Args>(args)...);
+    std::push_heap(items.begin(), items.end(), compare);
+  }
+
+  void pop() {
+    std::pop_heap(items.begin(), items.end(), compare);
+    items.pop_back();
+  }
+
+  /** Read the contents of this heap directly, in heap order. */
+  const T &operator[](size_t i) const { return items[i]; }
+
+  /**
+   * Move the contents of this heap out into a (heap-ordered) container,
+   * leaving this heap empty; i.e.: to build a std::priority_queue.
+   */
+  std::vector<T> release() {
+    std::vector<T> released;
+    released.swap(items);
+    return released;
+  }
+
+private:
+  std::vector<T> items;
+  Compare compare;
+};
+
+/**
+ * The (up to) `capacity` best results of a search that returns at most one
+ * element per group: each group is represented by the nearest of its elements
+ * found so far, and only the `capacity` nearest groups are kept.
+ *
+ * Results are kept in a flat binary max-heap, and each group's position in
+ * that heap in an open-addressing hash table with linear probing. Both keep
+ * their storage when reset, so like SearchHeap, an instance reused across
+ * searches (i.e.: one per thread) stops allocating once it has grown to the
+ * size of the largest search it has performed. Groups must be integers.
+ */
+template <typename dist_t, typename id_t, typename group_t>
+class GroupedSearchResults {
+public:
+  struct Result {
+    dist_t distance;
+    id_t id;
+    // The slot of the hash table holding this result's group:
+    uint32_t slot;
+
+    bool operator<(const Result &other) const {
+      return distance < other.distance ||
+             (distance == other.distance && id < other.id);
+    }
+  };
+
+  void reset(size_t newCapacity) {
+    capacity = newCapacity;
+    heap.clear();
+    heap.reserve(capacity);
+
+    // Keeping the table at most half full keeps probe sequences short:
+    tableBits = MIN_TABLE_BITS;
+    while (((size_t)1 << tableBits) < 2 * capacity)
+      tableBits++;
+    if (slots.size() < ((size_t)1 << tableBits))
+      slots.resize((size_t)1 << tableBits);
+
+    // Slots are only occupied if stamped with the current generation, so the
+    // whole table is emptied at once, without touching any of it:
+    if (++generation == 0) {
+      for (Slot &slot : slots)
+        slot.generation = 0;
+      generation = 1;
+    }
+  }
+
+  size_t size() const { return heap.size(); }
+  bool full() const { return heap.size() >= capacity; }
+
+  /** The distance of the furthest group kept. Only valid if non-empty. */
+  dist_t furthestDistance() const { return heap.front().distance; }
+
+  /**
+   * Offer an element of `group` at the given distance. It's kept (and true is
+   * returned) if it's nearer than its group's current representative, or if
+   * its group is new and nearer than the furthest group kept, which is then
+   * evicted if there are more than `capacity` groups.
+   */
+  bool offer(dist_t distance, id_t id, group_t group) {
+    size_t slot = findSlot(group);
+    if (slots[slot].generation == generation) {
+      size_t i = slots[slot].heapIndex;
+      if (!(distance < heap[i].distance))
+        return false;
+      heap[i].distance = distance;
+      heap[i].id = id;
+      siftDown(i);
+      return true;
+    }
+
+    if (capacity == 0 || (full() && !(distance < furthestDistance())))
+      return false;
+    if (full()) {
+      // The furthest group is evicted, and its place in the heap reused:
+      eraseSlot(heap.front().slot);
+      slot = findSlot(group);
+      heap.front() = {distance, id, (uint32_t)slot};
+      claimSlot(slot, group, 0);
+      siftDown(0);
+    } else {
+      heap.push_back({distance, id, (uint32_t)slot});
+      claimSlot(slot, group, heap.size() - 1);
+      siftUp(heap.size() - 1);
+    }
+    return true;
+  }
+
+  /**
+   * Sort the groups kept nearest first, and return them. Nothing more can be
+   * offered until this is reset.
+   */
+  const std::vector<Result> &sortedResults() {
+    std::sort_heap(heap.begin(), heap.end());
+    return heap;
+  }
+
+private:
+  static const int MIN_TABLE_BITS = 4;
+
+  struct Slot {
+    group_t group;
+    uint32_t heapIndex;
+    uint32_t generation = 0;
+  };
+
+  size_t mask() const { return ((size_t)1 << tableBits) - 1; }
+
+  size_t homeSlot(group_t group) const {
+    // Fibonacci hashing spreads out sequential and strided groups alike:
+    return (size_t)(((uint64_t)group * 0x9E3779B97F4A7C15ull) >>
+                    (64 - tableBits));
+  }
+
+  /** The slot holding `group`, or the empty slot it would be stored in. */
+  size_t findSlot(group_t group) const {
+    size_t i = homeSlot(group);
+    while (slots[i].generation == generation && !(slots[i].group == group))
+      i = (i + 1) & mask();
+    return i;
+  }
+
+  void claimSlot(size_t slot, group_t group, size_t heapIndex) {
+    slots[slot].group = group;
+    slots[slot].heapIndex = heapIndex;
+    slots[slot].generation = generation;
+  }
+
+  /**
+   * Empty a slot, shifting back any later slots in its probe sequence so that
+   * every group can still be found without tombstones.
+   */
+  void eraseSlot(size_t i) {
+    for (size_t j = (i + 1) & mask(); slots[j].generation == generation;
+         j = (j + 1) & mask()) {
+      // Slot j stays put if its home lies cyclically within (i, j]:
+      size_t home = homeSlot(slots[j].group);
+      bool stays = i < j ? (i < home && home <= j) : (i < home || home <= j);
+      if (!stays) {
+        slots[i] = slots[j];
+        heap[slots[i].heapIndex].slot = i;
+        i = j;
+      }
+    }
+    slots[i].generation = 0;
+  }
+
+  void place(size_t i, const Result &result) {
+    heap[i] = result;
+    slots[result.slot].heapIndex = i;
+  }
+
+  void siftUp(size_t i) {
+    Result result = heap[i];
+    while (i > 0 && heap[(i - 1) / 2] < result) {
+      place(i, heap[(i - 1) / 2]);
+      i = (i - 1) / 2;
+    }
+    place(i, result);
+  }
+
+  void siftDown(size_t i) {
+    Result result = heap[i];
+    size_t n = heap.size();
+    while (2 * i + 1 < n) {
+      size_t child = 2 * i + 1;
+      if (child + 1 < n && heap[child] < heap[child + 1])
+        child++;
+      if (!(result < heap[child]))
+        break;
+      place(i, heap[child]);
+      i = child;
+    }
+    place(i, result);
+  }
+
+  size_t capacity = 0;
+  std::vector<Result> heap;
+  std::vector<Slot> slots;
+  int tableBits = MIN_TABLE_BITS;
+  uint32_t generation = 0;
+};
+} // namespace hnswlib
@@ -0,0 +1,208 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "memory_policy.h"
+
+namespace hnswlib {
+/**
+ * An array that grows by adding fixed-size segments, rather than by
+ * reallocating (and copying) its contents. Elements never move once
+ * allocated, so growing the array never blocks, nor invalidates pointers held
+ * by, concurrent readers.
+ *
+ * Segments are found through a table of segment pointers. Growing past the
+ * capacity of that table publishes a new, twice-as-large copy of it with a
+ * single atomic store; replaced tables are only freed when the array itself
+ * is destroyed, as readers may still be using them. (As each table is twice
+ * the size of the last, retired tables never take up more space than the
+ * current one.)
+ *
+ * Each element of the array can span multiple consecutive values of T (the
+ * array's `stride`), which allows storing variable-sized blocks of bytes.
+ * Segments of trivially-constructible types are allocated according to the
+ * array's MemoryPolicy (i.e.: to back them with huge pages).
+ * Reads may happen concurrently with growth, but calls to grow() must be
+ * serialized by the caller.
+ */
+template <typename T> class SegmentedArray {
+public:
+  SegmentedArray() = default;
+  SegmentedArray(const SegmentedArray &) = delete;
+  SegmentedArray &operator=(const SegmentedArray &) = delete;
+
+  ~SegmentedArray() { reset(); }
+
+  /**
+   * Discard the contents of this array, and configure it to grow by
+   * segments of (at least) `elementsPerSegment` elements of `stride` Ts each.
+   */
+  void reset(size_t elementsPerSegment = 1, size_t stride = 1,
+             const MemoryPolicy &policy = {}) {
+    for (T *segment : ownedSegments)
+      freeSegment(segment);
+    ownedSegments.clear();
+    tables.clear();
+    table.store(nullptr, std::memory_order_relaxed);
+    tableCapacity = 0;
+    numSegments = 0;
+    mappedElements = 0;
+    mapped = false;
+
+    shift = 0;
+    while (((size_t)1 << shift) < elementsPerSegment)
+      shift++;
+    mask = ((size_t)1 << shift) - 1;
+    this->stride = stride;
+    this->policy = policy;
+  }
+
+  inline T *at(size_t i) const {
+    std::atomic<T *> *segments = table.load(std::memory_order_acquire);
+    return segments[i >> shift].load(std::memory_order_relaxed) +
+           (i & mask) * stride;
+  }
+
+  inline T &operator[](size_t i) const { return *at(i); }
+
+  size_t capacity() const {
+    return mapped ? mappedElements : numSegments << shift;
+  }
+
+  size_t getElementsPerSegment() const { return mask + 1; }
+
+  /**
+   * The number of consecutive elements, starting at element `i`, that are
+   * stored contiguously in memory (i.e.: up to the end of i's segment).
+   */
+  size_t contiguousElementsFrom(size_t i) const {
+    return std::min(getElementsPerSegment() - (i & mask), capacity() - i);
+  }
+
+  /**
+   * Allocate segments until this array can hold at least `numElements`
+   * elements. Newly allocated elements are value-initialized.
+   */
+  void grow(size_t numElements) {
+    if (mapped && numElements > mappedElements)
+      throw std::runtime_error(
+          "Cannot grow an array backed by externally-owned memory.");
+
+    while (capacity() < numElements) {
+      T *segment = allocateSegment();
+      if (numSegments == tableCapacity) {
+        try {
+          growTable();
+        } catch (...) {
+          freeSegment(segment);
+          throw;
+        }
+      }
+      ownedSegments.push_back(segment);
+      table.load(std::memory_order_relaxed)[numSegments].store(
+          segment, std::memory_order_release);
+      numSegments++;
+    }
+  }
+
+  /**
+   * Point this array at `numElements` elements stored contiguously in
+   * externally-owned memory (i.e.: a memory-mapped file) without copying
+   * them. Arrays set up this way cannot grow beyond `numElements`.
+   */
+  void map(T *data, size_t numElements) {
+    size_t elementsPerSegment = getElementsPerSegment();
+    reset(elementsPerSegment, stride, policy);
+    size_t n = (numElements + elementsPerSegment - 1) / elementsPerSegment;
+    while (tableCapacity < n)
+      growTable();
+    for (size_t i = 0; i < n; i++)
+      table.load(std::memory_order_relaxed)[i].store(
+          data + i * elementsPerSegment * stride, std::memory_order_relaxed);
+    numSegments = n;
+    mappedElements = numElements;
+    mapped = true;
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+private:
+  std::atomic<std::atomic<T *> *> table{nullptr};
+  size_t tableCapacity = 0;
+  size_t numSegments = 0;
+  size_t shift = 0;
+  size_t mask = 0;
+  size_t stride = 1;
+  MemoryPolicy policy;
+
+  bool mapped = false;
+  size_t mappedElements = 0;
+
+  std::vector<T *> ownedSegments;
+  // Every table this array has used, including the current one:
+  std::vector<std::unique_ptr<std::atomic<T *>[]>> tables;
+
+  void growTable() {
+    size_t newCapacity = std::max<size_t>(4, tableCapacity * 2);
+    std::unique_ptr<std::atomic<T *>[]> newTable(
+        new std::atomic<T *>[newCapacity]);
+    std::atomic<T *> *oldTable = table.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < newCapacity; i++) {
+      newTable[i].store(i < numSegments
+                            ? oldTable[i].load(std::memory_order_relaxed)
+                            : nullptr,
+                        std::memory_order_relaxed);
+    }
+    table.store(newTable.get(), std::memory_order_release);
+    tables.push_back(std::move(newTable));
+    tableCapacity = newCapacity;
+  }
+
+  T *allocateSegment() {
+    size_t n = getElementsPerSegment() * stride;
+    if constexpr (std::is_trivially_default_constructible_v<T>) {
+      // Both calloc and mmap let the OS hand us lazily-zeroed pages, so
+      // segments allocated before they're needed don't take up physical
+      // memory.
+      return (T *)policy.allocate(n * sizeof(T));
+    } else {
+      return new T[n]();
+    }
+  }
+
+  void freeSegment(T *segment) {
+    if constexpr (std::is_trivially_default_constructible_v<T>) {
+      policy.deallocate(segment, getElementsPerSegment() * stride * sizeof(T));
+    } else {
+      delete[] segment;
+    }
+  }
+};
+} // namespace hnswlib
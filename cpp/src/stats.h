@@ -0,0 +1,390 @@
+/*-
+ * -\-\-
+ * voyager
+ * --
+ * Copyright (C) 2016 - 2023 Spotify AB
+ * --
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ * -/-/-
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace hnswlib {
+/**
+ * A histogram of latencies, with buckets whose bounds are powers of two
+ * microseconds: bucket 0 counts latencies under 1us, bucket i counts
+ * latencies in [2^(i-1), 2^i) microseconds, and the last bucket counts every
+ * latency too large for the others.
+ */
+struct LatencyHistogram {
+  static constexpr size_t NUM_BUCKETS = 28;
+
+  std::array<uint64_t, NUM_BUCKETS> counts{};
+  uint64_t totalNanoseconds = 0;
+
+  static size_t getBucket(uint64_t nanoseconds) {
+    uint64_t microseconds = nanoseconds / 1000;
+    size_t bucket = 0;
+    while (microseconds > 0 && bucket < NUM_BUCKETS - 1) {
+      microseconds >>= 1;
+      bucket++;
+    }
+    return bucket;
+  }
+
+  /**
+   * The (exclusive) upper bound of the given bucket, in seconds.
+   */
+  static double getBucketUpperBound(size_t bucket) {
+    if (bucket >= NUM_BUCKETS - 1) {
+      return std::numeric_limits<double>::infinity();
+    }
+    return (double)((uint64_t)1 << bucket) / 1e6;
+  }
+
+  uint64_t getCount() const {
+    uint64_t count = 0;
+    for (uint64_t n : counts)
+      count += n;
+    return count;
+  }
+
+  LatencyHistogram &operator+=(const LatencyHistogram &other) {
+    for (size_t i = 0; i < NUM_BUCKETS; i++)
+      counts[i] += other.counts[i];
+    totalNanoseconds += other.totalNanoseconds;
+    return *this;
+  }
+
+  LatencyHistogram &operator-=(const LatencyHistogram &other) {
+    for (size_t i = 0; i < NUM_BUCKETS; i++)
+      counts[i] -= other.counts[i];
+    totalNanoseconds -= other.totalNanoseconds;
+    return *this;
+  }
+};
+
+/**
+ * Counters describing the work done by an index's queries and insertions.
+ */
+struct IndexStats {
+  uint64_t numQueries = 0;
+  uint64_t numInserts = 0;
+
+  // The number of distances computed, and nodes expanded, by graph searches
+  // (during both queries and insertions):
+  uint64_t distanceComputations = 0;
+  uint64_t hops = 0;
+
+  // The number of times a visited list had to be cleared in full (rather
+  // than invalidated in constant time) before a search could use it:
+  uint64_t visitedListResets = 0;
+
+  // Time spent waiting to acquire locks held by other threads:
+  uint64_t lockWaitNanoseconds = 0;
+
+  // The number of queries answered from (or not found in) the query cache,
+  // if enabled:
+  uint64_t queryCacheHits = 0;
+  uint64_t queryCacheMisses = 0;
+
+  LatencyHistogram queryLatency;
+  LatencyHistogram insertLatency;
+
+  IndexStats &operator+=(const IndexStats &other) {
+    numQueries += other.numQueries;
+    numInserts += other.numInserts;
+    distanceComputations += other.distanceComputations;
+    hops += other.hops;
+    visitedListResets += other.visitedListResets;
+    lockWaitNanoseconds += other.lockWaitNanoseconds;
+    queryCacheHits += other.queryCacheHits;
+    queryCacheMisses += other.queryCacheMisses;
+    queryLatency += other.queryLatency;
+    insertLatency += other.insertLatency;
+    return *this;
+  }
+
+  IndexStats &operator-=(const IndexStats &other) {
+    numQueries -= other.numQueries;
+    numInserts -= other.numInserts;
+    distanceComputations -= other.distanceComputations;
+    hops -= other.hops;
+    visitedListResets -= other.visitedListResets;
+    lockWaitNanoseconds -= other.lockWaitNanoseconds;
+    queryCacheHits -= other.queryCacheHits;
+    queryCacheMisses -= other.queryCacheMisses;
+    queryLatency -= other.queryLatency;
+    insertLatency -= other.insertLatency;
+    return *this;
+  }
+};
+
+/**
+ * Counters incremented by the graph search on the current thread, with no
+ * synchronization at all. These are moved into an index's StatsCollector once
+ * each query or insertion completes.
+ */
+struct ThreadCounters {
+  uint64_t distanceComputations = 0;
+  uint64_t hops = 0;
+  uint64_t visitedListResets = 0;
+  uint64_t lockWaitNanoseconds = 0;
+  uint64_t queryCacheHits = 0;
+  uint64_t queryCacheMisses = 0;
+
+  static ThreadCounters &get() {
+    thread_local ThreadCounters counters;
+    return counters;
+  }
+};
+
+inline uint64_t nanosecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/**
+ * Acquire `lock`, adding the time spent waiting for it (if it was contended)
+ * to this thread's counters. Uncontended locks are not timed.
+ */
+template <typename Lock> void lockAndCountWait(Lock &lock) {
+  if (lock.try_lock()) {
+    return;
+  }
+  auto start = std::chrono::steady_clock::now();
+  lock.lock();
+  ThreadCounters::get().lockWaitNanoseconds += nanosecondsSince(start);
+}
+
+/**
+ * Collects an index's stats from many threads without contention: each thread
+ * records into its own cache line, and reads sum over every thread's stats.
+ */
+class StatsCollector {
+public:
+  StatsCollector() : id(nextId()) {}
+
+  // Every thread that recorded into this collector forgets about it, so that
+  // short-lived indices don't leave entries behind in long-lived threads:
+  ~StatsCollector() {
+    for (const std::weak_ptr<ThreadStatsMap> &weakMap : threadMaps) {
+      if (std::shared_ptr<ThreadStatsMap> map = weakMap.lock()) {
+        std::unique_lock<std::mutex> lock(map->lock);
+        map->statsById.erase(id);
+      }
+    }
+  }
+
+  StatsCollector(const StatsCollector &) = delete;
+  StatsCollector &operator=(const StatsCollector &) = delete;
+
+  /**
+   * Record one query that took `nanoseconds`, along with the work counted on
+   * this thread since takeThreadCounters() was last called.
+   */
+  void recordQuery(uint64_t nanoseconds) { recordQueries(1, nanoseconds); }
+
+  /**
+   * Record `numQueries` queries that were answered together (i.e.: by one
+   * call that returns every result at once), each of which took
+   * `nanoseconds`. Queries whose results are ready at different times should
+   * be recorded individually with recordQuery() instead.
+   */
+  void recordQueries(size_t numQueries, uint64_t nanoseconds) {
+    if (numQueries == 0) {
+      return;
+    }
+    ThreadStats &stats = getThreadStats();
+    stats.numQueries.add(numQueries);
+    stats.queryLatencyNanoseconds.add(numQueries * nanoseconds);
+    size_t bucket = LatencyHistogram::getBucket(nanoseconds);
+    stats.queryLatencyBuckets[bucket].add(numQueries);
+    stats.addCounters(takeThreadCounters());
+  }
+
+  void recordInsert(uint64_t nanoseconds) { recordInserts(1, nanoseconds); }
+
+  /**
+   * Record `numInserts` insertions that took `nanoseconds` in total (i.e.: a
+   * bulk build), each of which is counted with the average latency.
+   */
+  void recordInserts(size_t numInserts, uint64_t nanoseconds) {
+    if (numInserts == 0) {
+      return;
+    }
+    ThreadStats &stats = getThreadStats();
+    stats.numInserts.add(numInserts);
+    stats.insertLatencyNanoseconds.add(nanoseconds);
+    size_t bucket = LatencyHistogram::getBucket(nanoseconds / numInserts);
+    stats.insertLatencyBuckets[bucket].add(numInserts);
+    stats.addCounters(takeThreadCounters());
+  }
+
+  /**
+   * Discard (and return) whatever has been counted on this thread so far, so
+   * that work done outside of an index's queries isn't attributed to them.
+   */
+  static ThreadCounters takeThreadCounters() {
+    ThreadCounters &counters = ThreadCounters::get();
+    ThreadCounters result = counters;
+    counters = ThreadCounters();
+    return result;
+  }
+
+  IndexStats getStats() const {
+    std::unique_lock<std::mutex> lock(threadStatsLock);
+    IndexStats total = getTotalLocked();
+    total -= baseline;
+    return total;
+  }
+
+  void reset() {
+    std::unique_lock<std::mutex> lock(threadStatsLock);
+    baseline = getTotalLocked();
+  }
+
+private:
+  /**
+   * A counter written by only one thread, which can be read from any thread.
+   * Avoids the cost of an atomic read-modify-write.
+   */
+  class Counter {
+  public:
+    void add(uint64_t n) {
+      value.store(value.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+    }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> value{0};
+  };
+
+  struct alignas(64) ThreadStats {
+    Counter numQueries;
+    Counter numInserts;
+    Counter distanceComputations;
+    Counter hops;
+    Counter visitedListResets;
+    Counter lockWaitNanoseconds;
+    Counter queryCacheHits;
+    Counter queryCacheMisses;
+    Counter queryLatencyNanoseconds;
+    Counter insertLatencyNanoseconds;
+    std::array<Counter, LatencyHistogram::NUM_BUCKETS> queryLatencyBuckets;
+    std::array<Counter, LatencyHistogram::NUM_BUCKETS> insertLatencyBuckets;
+
+    void addCounters(const ThreadCounters &counters) {
+      distanceComputations.add(counters.distanceComputations);
+      hops.add(counters.hops);
+      visitedListResets.add(counters.visitedListResets);
+      lockWaitNanoseconds.add(counters.lockWaitNanoseconds);
+      queryCacheHits.add(counters.queryCacheHits);
+      queryCacheMisses.add(counters.queryCacheMisses);
+    }
+  };
+
+  /**
+   * The ThreadStats that one thread records into, for every collector it has
+   * recorded into. Only read and written by its own thread, except by the
+   * destructors of collectors (which may run on any thread).
+   */
+  struct ThreadStatsMap {
+    std::mutex lock;
+    std::unordered_map<uint64_t, ThreadStats *> statsById;
+  };
+
+  // Unique for the lifetime of the process, so that threads never mistake a
+  // new collector for one that has been destroyed:
+  const uint64_t id;
+
+  mutable std::mutex threadStatsLock;
+  std::deque<ThreadStats> threadStats;
+  // The maps of every thread that has recorded into this collector (which
+  // expire when their threads exit):
+  std::vector<std::weak_ptr<ThreadStatsMap>> threadMaps;
+  // Totals as of the last call to reset(), subtracted from future reads
+  // (as other threads' stats can't safely be zeroed):
+  IndexStats baseline;
+
+  static uint64_t nextId() {
+    static std::atomic<uint64_t> next{0};
+    return next++;
+  }
+
+  static const std::shared_ptr<ThreadStatsMap> &getThreadStatsMap() {
+    thread_local std::shared_ptr<ThreadStatsMap> map =
+        std::make_shared<ThreadStatsMap>();
+    return map;
+  }
+
+  ThreadStats &getThreadStats() {
+    // The last collector used on this thread skips the map (and its lock),
+    // which is safe even once that collector is gone as IDs are never reused:
+    thread_local uint64_t cachedId = std::numeric_limits<uint64_t>::max();
+    thread_local ThreadStats *cached = nullptr;
+    if (cachedId == id) {
+      return *cached;
+    }
+
+    const std::shared_ptr<ThreadStatsMap> &map = getThreadStatsMap();
+    std::unique_lock<std::mutex> mapLock(map->lock);
+    ThreadStats *&stats = map->statsById[id];
+    if (!stats) {
+      std::unique_lock<std::mutex> lock(threadStatsLock);
+      stats = &threadStats.emplace_back();
+      threadMaps.push_back(map);
+    }
+    cachedId = id;
+    cached = stats;
+    return *stats;
+  }
+
+  IndexStats getTotalLocked() const {
+    IndexStats total;
+    for (const ThreadStats &stats : threadStats) {
+      total.numQueries += stats.numQueries.get();
+      total.numInserts += stats.numInserts.get();
+      total.distanceComputations += stats.distanceComputations.get();
+      total.hops += stats.hops.get();
+      total.visitedListResets += stats.visitedListResets.get();
+      total.lockWaitNanoseconds += stats.lockWaitNanoseconds.get();
+      total.queryCacheHits += stats.queryCacheHits.get();
+      total.queryCacheMisses += stats.queryCacheMisses.get();
+      total.queryLatency.totalNanoseconds +=
+          stats.queryLatencyNanoseconds.get();
+      total.insertLatency.totalNanoseconds +=
+          stats.insertLatencyNanoseconds.get();
+      for (size_t i = 0; i < LatencyHistogram::NUM_BUCKETS; i++) {
+        total.queryLatency.counts[i] += stats.queryLatencyBuckets[i].get();
+        total.insertLatency.counts[i] += stats.insertLatencyBuckets[i].get();
+      }
+    }
+    return total;
+  }
+};
+} // namespace hnswlib
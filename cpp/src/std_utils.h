@@ -23,74 +23,302 @@
 
 #pragma once
 
+#include <algorithm>
 #include <assert.h>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <ratio>
 #include <set>
 #include <stdlib.h>
 #include <thread>
+#include <vector>
 
-/*
- * replacement for the openmp '#pragma omp parallel for' directive
- * only handles a subset of functionality (no reductions etc)
- * Process ids from start (inclusive) to end (EXCLUSIVE)
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/**
+ * A long-lived pool of worker threads that parallel loops can be run on,
+ * avoiding the cost of creating and joining threads on every call.
+ *
+ * Each call to `parallelFor` splits its range into one contiguous slice per
+ * participant: the calling thread (which always participates) plus any idle
+ * workers. Participants take small chunks from the front of their own slice,
+ * then steal chunks from other slices once theirs is exhausted, so the loop
+ * finishes even if no workers are free (e.g.: when called from within another
+ * parallel loop, or concurrently from many threads).
  *
- * The method is borrowed from nmslib
+ * A single pool can safely be shared between many indices and many callers.
  */
-template <class Function>
-inline void ParallelFor(size_t start, size_t end, size_t numThreads,
-                        Function fn) {
-  if (numThreads <= 0) {
-    numThreads = std::thread::hardware_concurrency();
+class ThreadPool {
+public:
+  /**
+   * Create a pool with `numWorkers` threads. More workers are started on
+   * demand whenever a loop asks for more threads than the pool has.
+   *
+   * If `cpus` is non-empty, every worker is pinned to that set of CPUs (i.e.:
+   * those of one NUMA node). Pinning is only supported on Linux, and is
+   * silently skipped elsewhere.
+   */
+  ThreadPool(size_t numWorkers = 0, std::vector<int> cpus = {})
+      : cpus(cpus) {
+    ensureWorkers(numWorkers);
+  }
+
+  ~ThreadPool() {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  size_t getNumWorkers() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return workers.size();
+  }
+
+  /**
+   * Call `fn(id, threadId)` for every id from start (inclusive) to end
+   * (EXCLUSIVE), using up to `numThreads` threads (including the calling
+   * thread). `threadId` is always less than `numThreads`, and no two
+   * concurrent calls to `fn` share the same threadId, so it can be used to
+   * index into per-thread buffers.
+   *
+   * If `fn` throws, the remaining ids are skipped and the first exception is
+   * rethrown on the calling thread.
+   */
+  template <class Function>
+  void parallelFor(size_t start, size_t end, size_t numThreads, Function fn) {
+    if (numThreads <= 0) {
+      numThreads = std::thread::hardware_concurrency();
+    }
+
+    if (end <= start) {
+      return;
+    }
+
+    size_t numParticipants = std::min(numThreads, end - start);
+    if (numParticipants <= 1) {
+      for (size_t id = start; id < end; id++) {
+        fn(id, 0);
+      }
+      return;
+    }
+
+    ensureWorkers(numParticipants - 1);
+
+    auto job = std::make_shared<Job>(
+        start, end, numParticipants,
+        [&fn](size_t begin, size_t rangeEnd, size_t threadId) {
+          for (size_t id = begin; id < rangeEnd; id++) {
+            fn(id, threadId);
+          }
+        });
+
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      pendingJobs.push_back(job);
+      job->claimedParticipants = 1;
+    }
+    for (size_t i = 1; i < numParticipants; i++) {
+      workAvailable.notify_one();
+    }
+
+    job->run(0);
+
+    // Once the calling thread runs out of work to steal, every chunk has been
+    // claimed; stop any more workers from joining and wait for those that did:
+    std::unique_lock<std::mutex> lock(mutex);
+    auto position = std::find(pendingJobs.begin(), pendingJobs.end(), job);
+    if (position != pendingJobs.end()) {
+      pendingJobs.erase(position);
+    }
+    job->activeParticipants--;
+    jobFinished.wait(lock, [&] { return job->activeParticipants == 0; });
+    lock.unlock();
+
+    if (job->exception) {
+      std::rethrow_exception(job->exception);
+    }
   }
 
-  if (numThreads == 1) {
-    for (size_t id = start; id < end; id++) {
-      fn(id, 0);
+  /**
+   * Run `fn` once on one of this pool's workers, without waiting for it to
+   * finish. Unlike parallelFor, the calling thread doesn't participate, so the
+   * pool is grown to one worker per CPU core the first time this is called.
+   *
+   * `fn` must not throw; any exception it throws is discarded.
+   */
+  void submit(std::function<void()> fn) {
+    ensureWorkers(std::max(1u, std::thread::hardware_concurrency()));
+
+    auto job = std::make_shared<Job>(
+        0, 1, 1, [fn = std::move(fn)](size_t, size_t, size_t) { fn(); });
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      // Nobody waits for this job, so only the worker that runs it counts:
+      job->activeParticipants = 0;
+      pendingJobs.push_back(job);
     }
-  } else {
-    std::vector<std::thread> threads;
-    std::atomic<size_t> current(start);
+    workAvailable.notify_one();
+  }
+
+  /**
+   * The pool used by default by all indices, shared across the process.
+   */
+  static std::shared_ptr<ThreadPool> getDefault() {
+    // Intentionally leaked, as joining threads from a static destructor can
+    // deadlock while a shared library is being unloaded:
+    static std::shared_ptr<ThreadPool> *pool =
+        new std::shared_ptr<ThreadPool>(std::make_shared<ThreadPool>());
+    return *pool;
+  }
+
+private:
+  struct alignas(64) Slice {
+    std::atomic<size_t> next;
+    size_t end;
+  };
 
-    // keep track of exceptions in threads
-    // https://stackoverflow.com/a/32428427/1713196
-    std::exception_ptr lastException = nullptr;
-    std::mutex lastExceptMutex;
+  struct Job {
+    Job(size_t start, size_t end, size_t numParticipants,
+        std::function<void(size_t, size_t, size_t)> runRange)
+        : slices(numParticipants), numParticipants(numParticipants),
+          runRange(runRange) {
+      size_t total = end - start;
+      for (size_t i = 0; i < numParticipants; i++) {
+        slices[i].next = start + (total * i) / numParticipants;
+        slices[i].end = start + (total * (i + 1)) / numParticipants;
+      }
 
-    for (size_t threadId = 0; threadId < numThreads; ++threadId) {
-      threads.push_back(std::thread([&, threadId] {
-        while (true) {
-          size_t id = current.fetch_add(1);
+      // Small chunks keep participants balanced when some ids take longer
+      // than others, while still amortizing the cost of each atomic:
+      chunkSize = std::max<size_t>(1, total / (numParticipants * 16));
+    }
 
-          if ((id >= end)) {
+    void run(size_t participant) {
+      for (size_t i = 0; i < numParticipants && !cancelled; i++) {
+        Slice &slice = slices[(participant + i) % numParticipants];
+        while (!cancelled) {
+          size_t begin = slice.next.fetch_add(chunkSize);
+          if (begin >= slice.end) {
             break;
           }
 
           try {
-            fn(id, threadId);
+            runRange(begin, std::min(begin + chunkSize, slice.end),
+                     participant);
           } catch (...) {
-            std::unique_lock<std::mutex> lastExcepLock(lastExceptMutex);
-            lastException = std::current_exception();
-            /*
-             * This will work even when current is the largest value that
-             * size_t can fit, because fetch_add returns the previous value
-             * before the increment (what will result in overflow
-             * and produce 0 instead of current + 1).
-             */
-            current = end;
-            break;
+            std::unique_lock<std::mutex> lock(exceptionMutex);
+            if (!exception) {
+              exception = std::current_exception();
+            }
+            cancelled = true;
           }
         }
-      }));
+      }
+    }
+
+    std::vector<Slice> slices;
+    size_t numParticipants;
+    size_t chunkSize;
+    std::function<void(size_t, size_t, size_t)> runRange;
+
+    std::atomic<bool> cancelled{false};
+    std::mutex exceptionMutex;
+    std::exception_ptr exception = nullptr;
+
+    // Guarded by the pool's mutex:
+    size_t claimedParticipants = 0;
+    size_t activeParticipants = 1;
+  };
+
+  void ensureWorkers(size_t numWorkers) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (workers.size() < numWorkers) {
+      workers.emplace_back([this] {
+        pinToCpus();
+        workerLoop();
+      });
+    }
+  }
+
+  void pinToCpus() {
+#ifdef __linux__
+    if (cpus.empty()) {
+      return;
     }
-    for (auto &thread : threads) {
-      thread.join();
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu : cpus) {
+      CPU_SET(cpu, &cpuSet);
     }
-    if (lastException) {
-      std::rethrow_exception(lastException);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+  }
+
+  void workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      workAvailable.wait(lock,
+                         [&] { return stopping || !pendingJobs.empty(); });
+      if (stopping) {
+        return;
+      }
+
+      std::shared_ptr<Job> job = pendingJobs.front();
+      size_t participant = job->claimedParticipants++;
+      job->activeParticipants++;
+      if (job->claimedParticipants == job->numParticipants) {
+        pendingJobs.pop_front();
+      }
+
+      lock.unlock();
+      job->run(participant);
+      lock.lock();
+
+      job->activeParticipants--;
+      if (job->activeParticipants == 0) {
+        jobFinished.notify_all();
+      }
     }
   }
+
+  std::mutex mutex;
+  std::condition_variable workAvailable;
+  std::condition_variable jobFinished;
+  std::deque<std::shared_ptr<Job>> pendingJobs;
+  std::vector<std::thread> workers;
+  bool stopping = false;
+  const std::vector<int> cpus;
+};
+
+/*
+ * replacement for the openmp '#pragma omp parallel for' directive
+ * only handles a subset of functionality (no reductions etc)
+ * Process ids from start (inclusive) to end (EXCLUSIVE)
+ *
+ * Runs on the process-wide default ThreadPool.
+ */
+template <class Function>
+inline void ParallelFor(size_t start, size_t end, size_t numThreads,
+                        Function fn) {
+  ThreadPool::getDefault()->parallelFor(start, end, numThreads, fn);
 }
 
 /**
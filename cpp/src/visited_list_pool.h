@@ -23,12 +23,27 @@
 
 #pragma once
 
+#include "cpu_features.h"
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
 #include <deque>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <string.h>
+#include <thread>
+#include <vector>
 
 namespace hnswlib {
-typedef unsigned short int vl_type;
+// Each search stamps the elements it visits with a new tag, so that a list
+// only has to be cleared in full once its tags run out. With 32-bit tags,
+// that takes over four billion searches of one list, so the O(max_elements)
+// memset at wraparound is practically never paid, in exchange for twice the
+// memory per element of hnswlib's 16-bit tags.
+typedef uint32_t vl_type;
 
 class VisitedList {
 public:
@@ -37,9 +52,13 @@ public:
   unsigned int numelements;
 
   VisitedList(int numelements1) {
-    curV = -1;
+    // calloc lets the OS hand us lazily-zeroed pages, so a new list doesn't
+    // need to be touched (and faulted in) all at once before its first use.
+    curV = 0;
     numelements = numelements1;
-    mass = new vl_type[numelements];
+    mass = (vl_type *)calloc(numelements, sizeof(vl_type));
+    if (mass == nullptr && numelements > 0)
+      throw std::bad_alloc();
   }
 
   void reset() {
@@ -47,50 +66,236 @@ public:
     if (curV == 0) {
       memset(mass, 0, sizeof(vl_type) * numelements);
       curV++;
+      ThreadCounters::get().visitedListResets++;
     }
   };
 
-  ~VisitedList() { delete[] mass; }
+  ~VisitedList() { free(mass); }
 };
+
+/**
+ * Adapts a VisitedList to the interface shared with VisitedHashSet, so that
+ * the graph search can be templated on the kind of visited set it uses.
+ */
+class DenseVisitedSet {
+public:
+  DenseVisitedSet(VisitedList *list)
+      : mass(list->mass), tag(list->curV), numelements(list->numelements) {}
+
+  /**
+   * Marks the given ID as visited, returning false if it already was. IDs
+   * beyond the end of the list (i.e.: of elements added while the index grew
+   * during a search) are treated as already visited.
+   */
+  inline bool insert(unsigned int id) {
+    if (id >= numelements || mass[id] == tag)
+      return false;
+    mass[id] = tag;
+    return true;
+  }
+
+  inline void prefetch(unsigned int id) const { VOYAGER_PREFETCH(mass + id); }
+
+private:
+  vl_type *mass;
+  vl_type tag;
+  unsigned int numelements;
+};
+
+/**
+ * A visited set whose size is proportional to the number of elements visited
+ * rather than to the number of elements in the index. Low-ef queries on very
+ * large indices only touch a tiny fraction of the graph, so an open-addressed
+ * hash table stays in cache where a full VisitedList would not.
+ *
+ * Each slot is stamped with the epoch in which it was written, so reset() is
+ * O(1) rather than O(capacity).
+ */
+class VisitedHashSet {
+public:
+  VisitedHashSet(size_t initialCapacity = 1024) {
+    size_t capacity = 16;
+    while (capacity < initialCapacity)
+      capacity <<= 1;
+    slots.resize(capacity);
+  }
+
+  void reset() {
+    size = 0;
+    epoch++;
+    if (epoch == 0) {
+      std::fill(slots.begin(), slots.end(), Slot());
+      epoch++;
+      ThreadCounters::get().visitedListResets++;
+    }
+  }
+
+  /** Marks the given ID as visited, returning false if it already was. */
+  inline bool insert(unsigned int id) {
+    // Keep the load factor at or below 50% to keep probe sequences short:
+    if ((size + 1) * 2 > slots.size())
+      grow();
+
+    size_t mask = slots.size() - 1;
+    for (size_t i = hash(id) & mask;; i = (i + 1) & mask) {
+      Slot &slot = slots[i];
+      if (slot.epoch != epoch) {
+        slot.id = id;
+        slot.epoch = epoch;
+        size++;
+        return true;
+      }
+      if (slot.id == id)
+        return false;
+    }
+  }
+
+  inline void prefetch(unsigned int id) const {
+    VOYAGER_PREFETCH(&slots[hash(id) & (slots.size() - 1)]);
+  }
+
+  size_t getCapacity() const { return slots.size(); }
+
+private:
+  struct Slot {
+    uint32_t id = 0;
+    uint32_t epoch = 0;
+  };
+
+  static inline size_t hash(uint32_t id) {
+    // Fibonacci hashing; element IDs are dense, so spread them out:
+    return (size_t)((id * 0x9E3779B97F4A7C15ull) >> 32);
+  }
+
+  void grow() {
+    std::vector<Slot> old(slots.size() * 2);
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (const Slot &slot : old) {
+      if (slot.epoch != epoch)
+        continue;
+      size_t i = hash(slot.id) & mask;
+      while (slots[i].epoch == epoch)
+        i = (i + 1) & mask;
+      slots[i] = slot;
+    }
+  }
+
+  std::vector<Slot> slots;
+  size_t size = 0;
+  uint32_t epoch = 0;
+};
+
+/**
+ * Chooses which kind of visited set is used when searching the bottom layer
+ * of the graph. Defaults to Dense.
+ */
+enum class VisitedSetMode {
+  /**
+   * Use a compact hash set when a query is expected to visit only a small
+   * fraction of the index, and a full VisitedList otherwise. The threshold
+   * (see HierarchicalNSW::COMPACT_VISITED_SET_RATIO) hasn't been tuned
+   * against benchmarks, so this is opt-in.
+   */
+  Auto,
+  /** Always use a VisitedList with one entry per element (the default). */
+  Dense,
+  /** Always use a VisitedHashSet. */
+  Compact,
+};
+
 ///////////////////////////////////////////////////////////
 //
 // Class for multi-threaded pool-management of VisitedLists
 //
 /////////////////////////////////////////////////////////
 
+/**
+ * Each thread that searches the index has a slot in which it caches the last
+ * VisitedList it used, which it can take and return with a single atomic
+ * operation. The mutex-protected deque is only used when threads outnumber
+ * slots, or while the pool is still warming up.
+ */
 class VisitedListPool {
   std::deque<VisitedList *> pool;
   std::mutex poolguard;
-  int numelements;
+  std::atomic<int> numelements;
+
+  size_t numSlots;
+  std::unique_ptr<std::atomic<VisitedList *>[]> slots;
+
+  static size_t getThreadSlot() {
+    static std::atomic<size_t> nextThreadSlot{0};
+    thread_local size_t threadSlot = nextThreadSlot++;
+    return threadSlot;
+  }
 
 public:
   VisitedListPool(int initmaxpools, int numelements1) {
     numelements = numelements1;
+    numSlots = std::max(1u, std::thread::hardware_concurrency()) * 2;
+    slots.reset(new std::atomic<VisitedList *>[numSlots]);
+    for (size_t i = 0; i < numSlots; i++)
+      slots[i].store(nullptr, std::memory_order_relaxed);
+
     for (int i = 0; i < initmaxpools; i++)
       pool.push_front(new VisitedList(numelements));
   }
 
   VisitedList *getFreeVisitedList() {
-    VisitedList *rez;
-    {
+    std::atomic<VisitedList *> &slot = slots[getThreadSlot() % numSlots];
+    VisitedList *rez = slot.exchange(nullptr, std::memory_order_acquire);
+
+    if (rez == nullptr) {
       std::unique_lock<std::mutex> lock(poolguard);
       if (pool.size() > 0) {
         rez = pool.front();
         pool.pop_front();
-      } else {
-        rez = new VisitedList(numelements);
       }
     }
+
+    // Lists checked out before the pool grew are too small to reuse:
+    int currentNumElements = numelements.load(std::memory_order_relaxed);
+    if (rez != nullptr && (int)rez->numelements < currentNumElements) {
+      delete rez;
+      rez = nullptr;
+    }
+
+    if (rez == nullptr)
+      rez = new VisitedList(currentNumElements);
+
     rez->reset();
     return rez;
   };
 
+  /**
+   * Make every list handed out from now on large enough to hold
+   * `numelements1` elements. Lists already handed out keep their size.
+   */
+  void growTo(int numelements1) {
+    int current = numelements.load(std::memory_order_relaxed);
+    while (current < numelements1 &&
+           !numelements.compare_exchange_weak(current, numelements1,
+                                              std::memory_order_relaxed)) {
+    }
+  }
+
   void releaseVisitedList(VisitedList *vl) {
+    std::atomic<VisitedList *> &slot = slots[getThreadSlot() % numSlots];
+    VisitedList *expected = nullptr;
+    if (slot.compare_exchange_strong(expected, vl, std::memory_order_release,
+                                     std::memory_order_relaxed)) {
+      return;
+    }
+
     std::unique_lock<std::mutex> lock(poolguard);
     pool.push_front(vl);
   };
 
   ~VisitedListPool() {
+    for (size_t i = 0; i < numSlots; i++)
+      delete slots[i].load(std::memory_order_relaxed);
+
     while (pool.size()) {
       VisitedList *rez = pool.front();
       pool.pop_front();
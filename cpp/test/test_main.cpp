@@ -1,7 +1,17 @@
 #include "doctest.h"
 
+#include "ShardedIndex.h"
 #include "TypedIndex.h"
 #include "test_utils.cpp"
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <future>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <thread>
 #include <tuple>
 #include <type_traits>
 
@@ -216,3 +226,2204 @@ TEST_CASE(
       {1.0f}, {5.0f, 6.0f, 7.0f}, {9.0f, 10.0f, 11.0f}};
   REQUIRE_THROWS_AS(vectorsToNDArray(vectors2), std::invalid_argument);
 }
+
+TEST_CASE("Test search-only indices loaded from a file return the same "
+          "results as the index they were saved from") {
+  int numDimensions = 16;
+  int numVectors = 500;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+  std::vector<hnswlib::labeltype> ids(numVectors);
+  for (int i = 0; i < numVectors; i++) {
+    ids[i] = i;
+  }
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(inputData, ids, -1);
+
+  std::string filename =
+      (std::filesystem::temp_directory_path() / "voyager_search_only.hnsw")
+          .string();
+  index.saveIndex(filename);
+
+  auto expected = index.query(inputData, /* k= */ 5, /* numThreads= */ 1,
+                              /* queryEf= */ 50);
+
+  SUBCASE("Using loadTypedIndexFromStream") {
+    std::unique_ptr<Index> searchOnlyIndex = loadTypedIndexFromStream(
+        std::make_shared<FileInputStream>(filename), /* searchOnly= */ true);
+    auto actual = searchOnlyIndex->query(inputData, 5, 1, 50);
+    REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+    REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+    REQUIRE_THROWS(searchOnlyIndex->markDeleted(0));
+    REQUIRE_THROWS(searchOnlyIndex->addItem(inputData[0], numVectors));
+  }
+
+  SUBCASE("Using TypedIndex::loadIndex") {
+    auto searchOnlyIndex =
+        TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+    searchOnlyIndex.loadIndex(filename, /* searchOnly= */ true);
+    auto actual = searchOnlyIndex.query(inputData, 5, 1, 50);
+    REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+    REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+  }
+
+  std::filesystem::remove(filename);
+}
+
+TEST_CASE("Test packed indices return the same results as unpacked ones") {
+  int numDimensions = 16;
+  int numVectors = 1000;
+  int k = 5;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  // IDs above 2^32 can't be packed into 4 bytes:
+  for (hnswlib::labeltype firstId :
+       {(hnswlib::labeltype)0, (hnswlib::labeltype)1 << 40}) {
+    CAPTURE(firstId);
+    std::vector<hnswlib::labeltype> ids(numVectors);
+    std::iota(ids.begin(), ids.end(), firstId);
+
+    auto index = TypedIndex<float, int8_t, std::ratio<1, 127>>(
+        SpaceType::Euclidean, numDimensions, /* M= */ 32);
+    index.addItems(inputData, ids, -1);
+    index.markDeleted(firstId + 3);
+    auto expected = index.query(inputData, k, 1, 50);
+    hnswlib::AllowListFilter filter({firstId + 1, firstId + 2, firstId + 3});
+    auto expectedFiltered = index.query(inputData[1], 2, 50, &filter);
+
+    auto output = std::make_shared<MemoryOutputStream>();
+    index.saveIndex(output);
+    std::string saved = output->getValue();
+
+    auto requirePackedMatches = [&](Index &packed) {
+      auto actual = packed.query(inputData, k, 1, 50);
+      REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+      REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+      REQUIRE(packed.query(inputData[1], 2, 50, &filter) == expectedFiltered);
+      REQUIRE_THROWS(packed.addItem(inputData[0], firstId + numVectors));
+      REQUIRE_THROWS(packed.markDeleted(firstId));
+    };
+
+    SUBCASE("Packing a search-only index") {
+      std::unique_ptr<Index> packed = loadTypedIndexFromStream(
+          std::make_shared<MemoryInputStream>(saved), /* searchOnly= */ true);
+      packed->packForSearch();
+      requirePackedMatches(*packed);
+    }
+
+    SUBCASE("Saving an index packed, then loading it as search-only") {
+      std::unique_ptr<Index> packedAfterLoading = loadTypedIndexFromStream(
+          std::make_shared<MemoryInputStream>(saved), /* searchOnly= */ true);
+      packedAfterLoading->packForSearch();
+
+      // Packed and unpacked indices save the same packed data:
+      auto output = std::make_shared<MemoryOutputStream>();
+      index.savePackedIndex(output);
+      std::string savedPacked = output->getValue();
+      auto repacked = std::make_shared<MemoryOutputStream>();
+      packedAfterLoading->savePackedIndex(repacked);
+      REQUIRE(repacked->getValue() == savedPacked);
+      REQUIRE(savedPacked.size() < saved.size());
+
+      std::unique_ptr<Index> packed = loadTypedIndexFromStream(
+          std::make_shared<MemoryInputStream>(savedPacked),
+          /* searchOnly= */ true);
+      requirePackedMatches(*packed);
+
+      REQUIRE_THROWS_AS(loadTypedIndexFromStream(
+                            std::make_shared<MemoryInputStream>(savedPacked)),
+                        std::invalid_argument);
+      REQUIRE_THROWS_AS(
+          loadTypedIndexFromStream(
+              std::make_shared<MemoryInputStream>(
+                  savedPacked.substr(0, savedPacked.size() - 1)),
+              /* searchOnly= */ true),
+          std::runtime_error);
+    }
+
+    SUBCASE("Packing an index, then saving and reloading it") {
+      index.packForSearch();
+      index.packForSearch();
+      requirePackedMatches(index);
+
+      auto repacked = std::make_shared<MemoryOutputStream>();
+      index.saveIndex(repacked);
+      REQUIRE(repacked->getValue().size() == saved.size());
+      std::unique_ptr<Index> reloaded = loadTypedIndexFromStream(
+          std::make_shared<MemoryInputStream>(repacked->getValue()));
+      auto actual = reloaded->query(inputData, k, 1, 50);
+      REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+      REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+      reloaded->addItem(inputData[0], firstId + numVectors);
+    }
+  }
+}
+
+/**
+ * An in-memory stream that can only be read sequentially, like a socket.
+ */
+class SequentialInputStream : public InputStream {
+public:
+  SequentialInputStream(std::string data) : data(std::move(data)) {}
+
+  virtual bool isSeekable() { return false; }
+  virtual long long getTotalLength() { return -1; }
+  virtual long long read(char *buffer, long long bytesToRead) {
+    long long n = std::min<long long>(bytesToRead, data.size() - position);
+    std::memcpy(buffer, data.data() + position, n);
+    position += n;
+    return n;
+  }
+  virtual bool isExhausted() { return position == data.size(); }
+  virtual long long getPosition() { return position; }
+  virtual bool setPosition(long long newPosition) {
+    return newPosition == (long long)position;
+  }
+  virtual uint32_t peek() {
+    uint32_t result = 0;
+    if (data.size() - position < sizeof(result))
+      throw std::runtime_error("Failed to peek from stream.");
+    std::memcpy(&result, data.data() + position, sizeof(result));
+    return result;
+  }
+
+private:
+  std::string data;
+  size_t position = 0;
+};
+
+TEST_CASE("Test indices loaded from streams match the saved index") {
+  int numDimensions = 16;
+  int numVectors = 2000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(inputData);
+  index.markDeleted(5);
+  auto expected = index.query(inputData, /* k= */ 5, /* numThreads= */ 1,
+                              /* queryEf= */ 50);
+
+  auto output = std::make_shared<MemoryOutputStream>();
+  index.saveIndex(output);
+  std::string data = output->getValue();
+
+  auto requireSameResults = [&](Index &loaded) {
+    REQUIRE(loaded.getNumElements() == (size_t)numVectors);
+    REQUIRE(loaded.getIDsCount() == numVectors);
+    auto actual = loaded.query(inputData, 5, 1, 50);
+    REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+    REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+  };
+
+  SUBCASE("From a sequential stream") {
+    std::unique_ptr<Index> loaded =
+        loadTypedIndexFromStream(std::make_shared<SequentialInputStream>(data));
+    requireSameResults(*loaded);
+    REQUIRE(loaded->getVector(10) == inputData[10]);
+  }
+
+  SUBCASE("From a file") {
+    std::string filename =
+        (std::filesystem::temp_directory_path() / "voyager_stream.hnsw")
+            .string();
+    std::make_shared<FileOutputStream>(filename)->write(data.data(),
+                                                        data.size());
+    std::unique_ptr<Index> loaded =
+        loadTypedIndexFromStream(std::make_shared<FileInputStream>(filename));
+    requireSameResults(*loaded);
+
+    // Extra data at the end of a file indicates corruption:
+    std::make_shared<FileOutputStream>(filename)->write(
+        (data + "extra").data(), data.size() + 5);
+    REQUIRE_THROWS(
+        loadTypedIndexFromStream(std::make_shared<FileInputStream>(filename)));
+    std::filesystem::remove(filename);
+  }
+
+  SUBCASE("From a truncated stream") {
+    std::string truncated = data.substr(0, data.size() - 3);
+    REQUIRE_THROWS(loadTypedIndexFromStream(
+        std::make_shared<SequentialInputStream>(truncated)));
+  }
+
+#ifdef VOYAGER_ENABLE_ZSTD
+  SUBCASE("From a compressed stream") {
+    auto compressedOutput = std::make_shared<MemoryOutputStream>();
+    {
+      // A small chunk size splits the index across many chunks:
+      CompressedOutputStream compressed(compressedOutput, 3, 1000);
+      compressed.write(data.data(), data.size());
+      compressed.close();
+    }
+    std::string compressedData = compressedOutput->getValue();
+    REQUIRE(compressedData.size() < data.size());
+
+    std::unique_ptr<Index> loaded = loadTypedIndexFromStream(
+        std::make_shared<SequentialInputStream>(compressedData));
+    requireSameResults(*loaded);
+
+    auto savedCompressed = std::make_shared<MemoryOutputStream>();
+    index.saveCompressedIndex(savedCompressed);
+    loaded = loadTypedIndexFromStream(
+        std::make_shared<SequentialInputStream>(savedCompressed->getValue()));
+    requireSameResults(*loaded);
+  }
+#else
+  SUBCASE("Compressed streams require compression support") {
+    REQUIRE_THROWS_AS(loadTypedIndexFromStream(
+                          std::make_shared<SequentialInputStream>("VYZS....")),
+                      std::domain_error);
+    REQUIRE_THROWS_AS(
+        index.saveCompressedIndex(std::make_shared<MemoryOutputStream>()),
+        std::domain_error);
+  }
+#endif
+}
+
+TEST_CASE("Test loading large indices rebuilds every label") {
+  int numDimensions = 4;
+  int numVectors = 20000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+  std::vector<hnswlib::labeltype> ids(numVectors);
+  for (int i = 0; i < numVectors; i++) {
+    ids[i] = (hnswlib::labeltype)i * 7919;
+  }
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(inputData, ids);
+  auto output = std::make_shared<MemoryOutputStream>();
+  index.saveIndex(output);
+
+  // Labels are rebuilt by several threads, each handling a subset of them:
+  std::unique_ptr<Index> loaded = loadTypedIndexFromStream(
+      std::make_shared<SequentialInputStream>(output->getValue()));
+  REQUIRE(loaded->getIDsMap().size() == (size_t)numVectors);
+  for (int i = 0; i < numVectors; i++) {
+    REQUIRE(loaded->getVector(ids[i]) == inputData[i]);
+  }
+}
+
+TEST_CASE("Test batch queries return the same results as single queries") {
+  int numDimensions = 16;
+  int numVectors = 2000;
+  int k = 10;
+  std::vector<SpaceType> spaceTypesSet = {
+      SpaceType::Euclidean, SpaceType::InnerProduct, SpaceType::Cosine};
+
+  for (auto spaceType : spaceTypesSet) {
+    SUBCASE("Test batch query") {
+      CAPTURE(spaceType);
+      std::vector<std::vector<float>> inputData =
+          randomVectors(numVectors, numDimensions);
+
+      auto index = TypedIndex<float>(spaceType, numDimensions);
+      index.addItems(inputData);
+
+      auto batchResults = index.query(inputData, k, /* numThreads= */ -1,
+                                      /* queryEf= */ 50);
+      NDArray<hnswlib::labeltype, 2> labels = std::get<0>(batchResults);
+      NDArray<float, 2> distances = std::get<1>(batchResults);
+
+      // Batches use the many-to-one distance kernels, which sum in a different
+      // order, so distances may differ in their last bits and (near-)tied
+      // labels may swap places:
+      for (int i = 0; i < numVectors; i++) {
+        auto [singleLabels, singleDistances] =
+            index.query(inputData[i], k, /* queryEf= */ 50);
+        for (int j = 0; j < k; j++) {
+          REQUIRE(distances[i][j] ==
+                  doctest::Approx(singleDistances[j]).epsilon(1e-5));
+          if (labels[i][j] == singleLabels[j]) {
+            continue;
+          }
+          auto match = std::find(singleLabels.begin(), singleLabels.end(),
+                                 labels[i][j]);
+          if (match == singleLabels.end()) {
+            // Only the last result can be displaced by a tie outside the k:
+            REQUIRE(j == k - 1);
+          } else {
+            REQUIRE(distances[i][j] ==
+                    doctest::Approx(singleDistances[match -
+                                                    singleLabels.begin()])
+                        .epsilon(1e-5));
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Test filtered queries only return allowed labels") {
+  int numDimensions = 16;
+  int numVectors = 1000;
+  int k = 10;
+
+  // Use both small labels (stored in a bitmap) and large labels (stored in a
+  // hash set) to exercise both AllowListFilter representations:
+  std::vector<hnswlib::labeltype> labelMultipliers = {1, 1000000000};
+
+  for (auto labelMultiplier : labelMultipliers) {
+    SUBCASE("Test filtered query") {
+      CAPTURE(labelMultiplier);
+      std::vector<std::vector<float>> inputData =
+          randomVectors(numVectors, numDimensions);
+      std::vector<hnswlib::labeltype> ids(numVectors);
+      std::vector<hnswlib::labeltype> allowedIds;
+      for (int i = 0; i < numVectors; i++) {
+        ids[i] = i * labelMultiplier;
+        if (i % 3 == 0) {
+          allowedIds.push_back(ids[i]);
+        }
+      }
+
+      auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+      index.addItems(inputData, ids);
+
+      hnswlib::AllowListFilter filter(allowedIds);
+      std::unordered_set<hnswlib::labeltype> allowedSet(allowedIds.begin(),
+                                                       allowedIds.end());
+
+      auto batchResults = index.query(inputData, k, /* numThreads= */ -1,
+                                      /* queryEf= */ 50, &filter);
+      NDArray<hnswlib::labeltype, 2> labels = std::get<0>(batchResults);
+
+      for (int i = 0; i < numVectors; i++) {
+        auto singleResult =
+            index.query(inputData[i], k, /* queryEf= */ 50, &filter);
+        for (int j = 0; j < k; j++) {
+          REQUIRE(allowedSet.count(labels[i][j]));
+          REQUIRE(allowedSet.count(std::get<0>(singleResult)[j]));
+        }
+
+        if (i % 3 == 0) {
+          REQUIRE(labels[i][0] == ids[i]);
+        }
+      }
+
+      // Asking for more neighbors than are allowed should fail:
+      std::vector<hnswlib::labeltype> tooFewIds = {ids[0], ids[1]};
+      hnswlib::AllowListFilter tooFewFilter(tooFewIds);
+      REQUIRE_THROWS_AS(index.query(inputData[0], 3, -1, &tooFewFilter),
+                        RecallError);
+      auto result = index.query(inputData[0], 2, -1, &tooFewFilter);
+      REQUIRE(std::get<0>(result)[0] == ids[0]);
+      REQUIRE(std::get<0>(result)[1] == ids[1]);
+    }
+  }
+}
+
+TEST_CASE("Test Float8 and E4M3 distance functions match the scalar "
+          "implementations") {
+  std::mt19937 generator(1234);
+  std::uniform_int_distribution<int> byteDistribution(0, 255);
+
+  for (size_t numDimensions :
+       {1, 3, 4, 7, 8, 15, 16, 17, 31, 32, 33, 63, 64, 100, 128, 256, 1000}) {
+    CAPTURE(numDimensions);
+    std::vector<int8_t> int8A(numDimensions), int8B(numDimensions);
+    std::vector<E4M3> e4m3A(numDimensions), e4m3B(numDimensions);
+    for (size_t i = 0; i < numDimensions; i++) {
+      int8A[i] = (int8_t)(byteDistribution(generator) - 128);
+      int8B[i] = (int8_t)(byteDistribution(generator) - 128);
+      // Avoid NaN, which never compares equal to itself:
+      do {
+        e4m3A[i] = E4M3((uint8_t)byteDistribution(generator));
+      } while (std::isnan((float)e4m3A[i]));
+      do {
+        e4m3B[i] = E4M3((uint8_t)byteDistribution(generator));
+      } while (std::isnan((float)e4m3B[i]));
+    }
+
+    using Float8Scale = std::ratio<1, 127>;
+    float expected = hnswlib::L2Sqr<float, int8_t, 1, Float8Scale>(
+        int8A.data(), int8B.data(), numDimensions);
+    float actual =
+        hnswlib::EuclideanSpace<float, int8_t, Float8Scale>(numDimensions)
+            .get_dist_func()(int8A.data(), int8B.data(), numDimensions);
+    REQUIRE(actual == doctest::Approx(expected).epsilon(1e-5));
+
+    expected = hnswlib::InnerProduct<float, int8_t, 1, Float8Scale>(
+        int8A.data(), int8B.data(), numDimensions);
+    actual =
+        hnswlib::InnerProductSpace<float, int8_t, Float8Scale>(numDimensions)
+            .get_dist_func()(int8A.data(), int8B.data(), numDimensions);
+    REQUIRE(actual == doctest::Approx(expected).epsilon(1e-5));
+
+    expected = hnswlib::L2Sqr<float, E4M3>(e4m3A.data(), e4m3B.data(),
+                                           numDimensions);
+    actual = hnswlib::EuclideanSpace<float, E4M3>(numDimensions)
+                 .get_dist_func()(e4m3A.data(), e4m3B.data(), numDimensions);
+    REQUIRE(actual == doctest::Approx(expected).epsilon(1e-5));
+
+    expected = hnswlib::InnerProduct<float, E4M3>(e4m3A.data(), e4m3B.data(),
+                                                  numDimensions);
+    actual = hnswlib::InnerProductSpace<float, E4M3>(numDimensions)
+                 .get_dist_func()(e4m3A.data(), e4m3B.data(), numDimensions);
+    REQUIRE(actual == doctest::Approx(expected).epsilon(1e-5));
+  }
+}
+
+#if defined(USE_SSE)
+TEST_CASE("Test each distance kernel supported by this CPU matches the "
+          "scalar implementations") {
+  const hnswlib::CPUFeatures &cpu = hnswlib::CPUFeatures::get();
+  std::mt19937 generator(1234);
+  std::uniform_int_distribution<int> int8Distribution(-128, 127);
+  std::uniform_real_distribution<float> floatDistribution(-1, 1);
+
+  for (size_t numDimensions : {4, 16, 17, 32, 100, 256}) {
+    CAPTURE(numDimensions);
+    std::vector<float> floatA(numDimensions), floatB(numDimensions);
+    std::vector<int8_t> int8A(numDimensions), int8B(numDimensions);
+    for (size_t i = 0; i < numDimensions; i++) {
+      floatA[i] = floatDistribution(generator);
+      floatB[i] = floatDistribution(generator);
+      int8A[i] = (int8_t)int8Distribution(generator);
+      int8B[i] = (int8_t)int8Distribution(generator);
+    }
+
+    float expectedL2 = hnswlib::L2Sqr<float, float>(
+        floatA.data(), floatB.data(), numDimensions);
+    float expectedIP = hnswlib::InnerProduct<float, float>(
+        floatA.data(), floatB.data(), numDimensions);
+    float expectedInt8L2 =
+        hnswlib::L2SqrInt8Scalar(int8A.data(), int8B.data(), numDimensions);
+    float expectedInt8IP = hnswlib::InnerProductInt8Scalar(
+        int8A.data(), int8B.data(), numDimensions);
+
+    std::vector<hnswlib::DISTFUNC_PTR<float>> l2Kernels = {
+        hnswlib::selectL2SqrSIMD<hnswlib::L2SqrSIMD16ExtSSE,
+                                 hnswlib::L2SqrSIMD4ExtSSE>(numDimensions)};
+    std::vector<hnswlib::DISTFUNC_PTR<float>> ipKernels = {
+        hnswlib::selectInnerProductSIMD<hnswlib::InnerProductSIMD16ExtSSE,
+                                        hnswlib::InnerProductSIMD4ExtSSE>(
+            numDimensions)};
+    std::vector<hnswlib::DISTFUNC_PTR<int32_t, int8_t>> int8L2Kernels,
+        int8IPKernels;
+
+    if (cpu.avx) {
+      l2Kernels.push_back(
+          hnswlib::selectL2SqrSIMD<hnswlib::L2SqrSIMD16ExtAVX,
+                                   hnswlib::L2SqrSIMD4ExtSSE>(numDimensions));
+      ipKernels.push_back(
+          hnswlib::selectInnerProductSIMD<hnswlib::InnerProductSIMD16ExtAVX,
+                                          hnswlib::InnerProductSIMD4ExtAVX>(
+              numDimensions));
+    }
+    if (cpu.avx2) {
+      int8L2Kernels.push_back(hnswlib::L2SqrInt8BlockAVX2);
+      int8IPKernels.push_back(hnswlib::InnerProductInt8BlockAVX2);
+    }
+    if (cpu.avx512f) {
+      l2Kernels.push_back(
+          hnswlib::selectL2SqrSIMD<hnswlib::L2SqrSIMD16ExtAVX512,
+                                   hnswlib::L2SqrSIMD4ExtSSE>(numDimensions));
+      ipKernels.push_back(
+          hnswlib::selectInnerProductSIMD<hnswlib::InnerProductSIMD16ExtAVX512,
+                                          hnswlib::InnerProductSIMD4ExtAVX>(
+              numDimensions));
+    }
+    if (cpu.avx512bw) {
+      int8L2Kernels.push_back(hnswlib::L2SqrInt8BlockAVX512BW);
+      int8IPKernels.push_back(hnswlib::InnerProductInt8BlockAVX512BW);
+    }
+    if (cpu.avx512vnni) {
+      int8L2Kernels.push_back(hnswlib::L2SqrInt8BlockAVX512VNNI);
+      int8IPKernels.push_back(hnswlib::InnerProductInt8BlockAVX512VNNI);
+    }
+
+    for (auto kernel : l2Kernels) {
+      REQUIRE(kernel(floatA.data(), floatB.data(), numDimensions) ==
+              doctest::Approx(expectedL2).epsilon(1e-5));
+    }
+    for (auto kernel : ipKernels) {
+      REQUIRE(kernel(floatA.data(), floatB.data(), numDimensions) ==
+              doctest::Approx(expectedIP).epsilon(1e-5));
+    }
+    for (auto kernel : int8L2Kernels) {
+      REQUIRE(kernel(int8A.data(), int8B.data(), numDimensions) ==
+              expectedInt8L2);
+    }
+    for (auto kernel : int8IPKernels) {
+      REQUIRE(kernel(int8A.data(), int8B.data(), numDimensions) ==
+              expectedInt8IP);
+    }
+  }
+}
+#endif
+
+TEST_CASE("Test many-to-one distance kernels match one-to-one distances") {
+  std::mt19937 generator(1234);
+  std::uniform_real_distribution<float> floatDistribution(-1, 1);
+
+  for (size_t numDimensions : {3, 4, 16, 17, 32, 100, 256}) {
+    CAPTURE(numDimensions);
+    std::vector<float> element(numDimensions);
+    for (float &value : element) {
+      value = floatDistribution(generator);
+    }
+
+    // Cover both full groups of four queries and leftover queries:
+    for (size_t numQueries : {1, 4, 7}) {
+      CAPTURE(numQueries);
+      std::vector<std::vector<float>> queries(
+          numQueries, std::vector<float>(numDimensions));
+      std::vector<const float *> queryPointers;
+      for (auto &query : queries) {
+        for (float &value : query) {
+          value = floatDistribution(generator);
+        }
+        queryPointers.push_back(query.data());
+      }
+
+      hnswlib::EuclideanSpace<float> l2(numDimensions);
+      hnswlib::InnerProductSpace<float> ip(numDimensions);
+      for (hnswlib::Space<float> *space :
+           std::initializer_list<hnswlib::Space<float> *>{&l2, &ip}) {
+        std::vector<float> distances(numQueries);
+        space->get_multi_dist_func()(element.data(), queryPointers.data(),
+                                     numQueries, numDimensions,
+                                     distances.data());
+        for (size_t q = 0; q < numQueries; q++) {
+          REQUIRE(distances[q] ==
+                  doctest::Approx(space->get_dist_func()(
+                                      queries[q].data(), element.data(),
+                                      numDimensions))
+                      .epsilon(1e-5));
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Test ThreadPool runs every id exactly once") {
+  auto pool = std::make_shared<ThreadPool>();
+
+  for (size_t numThreads : {1, 2, 7, 16}) {
+    for (size_t numIds : {0, 1, 5, 1000}) {
+      CAPTURE(numThreads);
+      CAPTURE(numIds);
+      std::vector<std::atomic<int>> calls(numIds);
+      std::atomic<bool> threadIdInRange(true);
+      pool->parallelFor(0, numIds, numThreads,
+                        [&](size_t id, size_t threadId) {
+                          calls[id]++;
+                          if (threadId >= numThreads) {
+                            threadIdInRange = false;
+                          }
+                        });
+
+      for (size_t i = 0; i < numIds; i++) {
+        REQUIRE(calls[i] == 1);
+      }
+      REQUIRE(threadIdInRange);
+    }
+  }
+
+  // Nested loops should complete even though all workers are busy:
+  std::atomic<size_t> total(0);
+  pool->parallelFor(0, 8, 8, [&](size_t, size_t) {
+    pool->parallelFor(0, 100, 8, [&](size_t, size_t) { total++; });
+  });
+  REQUIRE(total == 800);
+
+  // Exceptions thrown on worker threads are rethrown to the caller:
+  REQUIRE_THROWS_AS(pool->parallelFor(0, 1000, 4,
+                                      [&](size_t id, size_t) {
+                                        if (id == 500) {
+                                          throw std::runtime_error("Oops");
+                                        }
+                                      }),
+                    std::runtime_error);
+
+  // Indices can share a pool:
+  auto index = TypedIndex<float>(SpaceType::Euclidean, 16);
+  index.setThreadPool(pool);
+  REQUIRE(index.getThreadPool() == pool);
+  std::vector<std::vector<float>> inputData = randomVectors(100, 16);
+  index.addItems(inputData);
+  auto labels = std::get<0>(index.query(inputData, 1, 8));
+  for (int i = 0; i < 100; i++) {
+    REQUIRE(labels[i][0] == (hnswlib::labeltype)i);
+  }
+}
+
+TEST_CASE("Test compact visited sets return the same results as dense ones") {
+  hnswlib::VisitedHashSet set(16);
+  set.reset();
+  for (unsigned int i = 0; i < 1000; i++) {
+    REQUIRE(set.insert(i * 7919));
+  }
+  REQUIRE(set.getCapacity() >= 2000);
+  for (unsigned int i = 0; i < 1000; i++) {
+    REQUIRE(!set.insert(i * 7919));
+  }
+  set.reset();
+  REQUIRE(set.insert(7919));
+
+  int numDimensions = 16;
+  int numVectors = 2000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  hnswlib::EuclideanSpace<float, float> space(numDimensions);
+  hnswlib::HierarchicalNSW<float, float> index(&space, numVectors);
+  for (int i = 0; i < numVectors; i++) {
+    index.addPoint(inputData[i].data(), i);
+  }
+  index.markDelete(0);
+
+  for (size_t ef : {10, 100}) {
+    for (int i = 0; i < numVectors; i += 10) {
+      CAPTURE(ef);
+      CAPTURE(i);
+      index.setVisitedSetMode(hnswlib::VisitedSetMode::Dense);
+      auto dense = index.searchKnn(inputData[i].data(), 10, nullptr, ef);
+      index.setVisitedSetMode(hnswlib::VisitedSetMode::Compact);
+      auto compact = index.searchKnn(inputData[i].data(), 10, nullptr, ef);
+
+      REQUIRE(dense.size() == compact.size());
+      while (!dense.empty()) {
+        REQUIRE(dense.top() == compact.top());
+        dense.pop();
+        compact.pop();
+      }
+    }
+  }
+}
+
+TEST_CASE("Test searching into output buffers matches searchKnn") {
+  hnswlib::SearchHeap<int> heap;
+  std::priority_queue<int> expectedHeap;
+  std::vector<int> values = {5, 1, 9, 3, 7, 3, 8};
+  for (int value : values) {
+    heap.push(value);
+    expectedHeap.push(value);
+  }
+  while (!expectedHeap.empty()) {
+    REQUIRE(heap.top() == expectedHeap.top());
+    heap.pop();
+    expectedHeap.pop();
+  }
+  REQUIRE(heap.empty());
+
+  int numDimensions = 16;
+  int numVectors = 1000;
+  size_t k = 10;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  hnswlib::EuclideanSpace<float, float> space(numDimensions);
+  hnswlib::HierarchicalNSW<float, float> index(&space, numVectors);
+  for (int i = 0; i < numVectors; i++) {
+    index.addPoint(inputData[i].data(), i);
+  }
+  index.markDelete(1);
+
+  std::vector<float> queries(numVectors * numDimensions);
+  for (int i = 0; i < numVectors; i++) {
+    std::copy(inputData[i].begin(), inputData[i].end(),
+              queries.begin() + (i * numDimensions));
+  }
+  std::vector<hnswlib::labeltype> batchLabels(numVectors * k);
+  std::vector<float> batchDistances(numVectors * k);
+  std::vector<size_t> batchNumResults(numVectors);
+  index.searchKnnBatch(queries.data(), numVectors, numDimensions, k,
+                       batchLabels.data(), batchDistances.data(),
+                       batchNumResults.data(), /* queryEf= */ 50);
+
+  std::vector<hnswlib::labeltype> labels(k);
+  std::vector<float> distances(k);
+  for (int i = 0; i < numVectors; i++) {
+    CAPTURE(i);
+    auto expected = index.searchKnn(inputData[i].data(), k, nullptr, 50);
+    size_t numResults = index.searchKnnInto(
+        inputData[i].data(), k, labels.data(), distances.data(), 50);
+    REQUIRE(numResults == expected.size());
+    REQUIRE(batchNumResults[i] == numResults);
+    for (size_t j = numResults; j-- > 0;) {
+      REQUIRE(labels[j] == expected.top().second);
+      REQUIRE(distances[j] == expected.top().first);
+      REQUIRE(batchLabels[i * k + j] == labels[j]);
+      REQUIRE(batchDistances[i * k + j] == distances[j]);
+      expected.pop();
+    }
+  }
+}
+
+TEST_CASE("Test pointer queries and insertions match vector-based ones") {
+  int numDimensions = 16;
+  int numVectors = 500;
+  int k = 5;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  for (auto spaceType : {SpaceType::Euclidean, SpaceType::InnerProduct,
+                         SpaceType::Cosine}) {
+    CAPTURE(spaceType);
+    auto expected = TypedIndex<float, int8_t, std::ratio<1, 127>>(
+        spaceType, numDimensions);
+    auto actual = TypedIndex<float, int8_t, std::ratio<1, 127>>(
+        spaceType, numDimensions);
+    for (int i = 0; i < numVectors; i++) {
+      expected.addItems(NDArray<float, 2>(inputData[i], {1, numDimensions}),
+                        {(hnswlib::labeltype)i});
+      REQUIRE(actual.addItem(inputData[i].data(), numDimensions, i) ==
+              (hnswlib::labeltype)i);
+    }
+    REQUIRE(actual.getNumElements() == (size_t)numVectors);
+    REQUIRE_THROWS(actual.addItem(inputData[0].data(), numDimensions - 1, {}));
+
+    std::vector<hnswlib::labeltype> labels(k);
+    std::vector<float> distances(k);
+    for (int i = 0; i < numVectors; i += 7) {
+      CAPTURE(i);
+      auto [expectedLabels, expectedDistances] =
+          expected.query(inputData[i], k, 50);
+      actual.query(inputData[i].data(), numDimensions, k, labels.data(),
+                   distances.data(), 50);
+      REQUIRE(labels == expectedLabels);
+      REQUIRE(distances == expectedDistances);
+      REQUIRE(actual.getVector(i) == expected.getVector(i));
+    }
+    REQUIRE_THROWS(actual.query(inputData[0].data(), numDimensions + 1, k,
+                                labels.data(), distances.data()));
+  }
+}
+
+TEST_CASE("Test asynchronous queries match synchronous ones") {
+  int numDimensions = 16;
+  int numVectors = 500;
+  int k = 5;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  TypedIndex<float> index(SpaceType::Euclidean, numDimensions);
+  index.addItems(inputData);
+
+  for (long windowMicroseconds : {0, 100, 10000}) {
+    CAPTURE(windowMicroseconds);
+    index.setAsyncBatchWindow(std::chrono::microseconds(windowMicroseconds));
+    REQUIRE(index.getAsyncBatchWindow().count() == windowMicroseconds);
+
+    std::vector<std::future<
+        std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>>>
+        futures(numVectors);
+    std::vector<std::vector<hnswlib::labeltype>> callbackLabels(numVectors);
+    std::atomic<int> callbacksRemaining{numVectors};
+    std::atomic<int> callbackErrors{0};
+    std::mutex callbacksLock;
+    std::condition_variable callbacksDone;
+
+    // Submit from several threads at once, so that batches fill up:
+    std::vector<std::thread> submitters;
+    for (int thread = 0; thread < 4; thread++) {
+      submitters.emplace_back([&, thread] {
+        for (int i = thread; i < numVectors; i += 4) {
+          futures[i] = index.queryAsync(inputData[i], k, 50);
+          index.queryAsync(
+              inputData[i],
+              [&, i](std::vector<hnswlib::labeltype> labels,
+                     std::vector<float>, std::exception_ptr error) {
+                if (error) {
+                  callbackErrors++;
+                }
+                callbackLabels[i] = labels;
+                if (--callbacksRemaining == 0) {
+                  std::unique_lock<std::mutex> lock(callbacksLock);
+                  callbacksDone.notify_all();
+                }
+              },
+              k, 50);
+        }
+      });
+    }
+    for (auto &submitter : submitters) {
+      submitter.join();
+    }
+
+    for (int i = 0; i < numVectors; i++) {
+      CAPTURE(i);
+      auto [expectedLabels, expectedDistances] =
+          index.query(inputData[i], k, 50);
+      auto [labels, distances] = futures[i].get();
+      REQUIRE(labels == expectedLabels);
+      REQUIRE(distances == expectedDistances);
+    }
+
+    std::unique_lock<std::mutex> lock(callbacksLock);
+    callbacksDone.wait(lock, [&] { return callbacksRemaining == 0; });
+    REQUIRE(callbackErrors == 0);
+    for (int i = 0; i < numVectors; i++) {
+      REQUIRE(callbackLabels[i] ==
+              std::get<0>(index.query(inputData[i], k, 50)));
+    }
+  }
+
+  // Errors are delivered through the future, without failing other queries:
+  auto tooMany = index.queryAsync(inputData[0], numVectors + 1);
+  auto fine = index.queryAsync(inputData[1], k);
+  REQUIRE_THROWS_AS(tooMany.get(), RecallError);
+  REQUIRE(std::get<0>(fine.get())[0] == 1);
+
+  REQUIRE_THROWS(index.queryAsync(std::vector<float>(numDimensions + 1), k));
+}
+
+TEST_CASE("Test indices can be searched while they grow") {
+  hnswlib::SegmentedArray<int> array;
+  array.reset(/* elementsPerSegment= */ 1000);
+  REQUIRE(array.getElementsPerSegment() == 1024);
+  array.grow(10);
+  REQUIRE(array.capacity() == 1024);
+  array[5] = 123;
+  int *fifth = array.at(5);
+  array.grow(100000);
+  REQUIRE(array.capacity() >= 100000);
+  REQUIRE(array.at(5) == fifth);
+  REQUIRE(array[5] == 123);
+  REQUIRE(array[99999] == 0);
+  REQUIRE(array.contiguousElementsFrom(1000) == 24);
+
+  int numDimensions = 16;
+  int numVectors = 5000;
+  int initialVectors = 100;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  hnswlib::EuclideanSpace<float, float> space(numDimensions);
+  hnswlib::HierarchicalNSW<float, float> index(&space, initialVectors);
+  for (int i = 0; i < initialVectors; i++) {
+    index.addPoint(inputData[i].data(), i);
+  }
+  const float *firstVector = index.getDataByInternalId(0);
+
+  // Concurrent insertions can make results briefly approximate, but readers
+  // should always see valid elements, no matter how often the index grows:
+  std::atomic<bool> done{false};
+  std::atomic<int> invalidResults{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&, t]() {
+      for (int i = t; !done; i = (i + 1) % initialVectors) {
+        auto result = index.searchKnn(inputData[i].data(), 1, nullptr, 50);
+        if (result.size() != 1 ||
+            result.top().second >= (hnswlib::labeltype)numVectors)
+          invalidResults++;
+      }
+    });
+  }
+
+  for (int i = initialVectors; i < numVectors; i++) {
+    if ((size_t)i == index.max_elements_)
+      index.resizeIndex(i + 100);
+    index.addPoint(inputData[i].data(), i);
+  }
+  done = true;
+  for (auto &reader : readers)
+    reader.join();
+
+  REQUIRE(invalidResults == 0);
+  REQUIRE(index.getDataByInternalId(0) == firstVector);
+  for (int i = 0; i < numVectors; i += 37) {
+    auto result = index.searchKnn(inputData[i].data(), 1, nullptr, 50);
+    REQUIRE(result.top().second == (hnswlib::labeltype)i);
+  }
+  REQUIRE_THROWS_AS(index.resizeIndex(10), IndexCannotBeShrunkError);
+}
+
+TEST_CASE("Test optimizing an index's layout does not change its results") {
+  int numDimensions = 16;
+  int numVectors = 1000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(inputData);
+  index.markDeleted(3);
+
+  auto expected = index.query(inputData, /* k= */ 10, /* numThreads= */ 1,
+                              /* queryEf= */ 50);
+  index.optimizeLayout();
+  auto actual = index.query(inputData, 10, 1, 50);
+  REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+  REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+
+  for (int i = 0; i < numVectors; i += 97) {
+    REQUIRE(index.getVector(i) == inputData[i]);
+  }
+
+  // The reordered index should still accept new elements:
+  std::vector<float> extra = randomVectors(1, numDimensions)[0];
+  hnswlib::labeltype extraId = index.addItem(extra, {});
+  REQUIRE(std::get<0>(index.query(extra, 1))[0] == extraId);
+
+  std::string filename =
+      (std::filesystem::temp_directory_path() / "voyager_reordered.hnsw")
+          .string();
+  index.saveIndex(filename);
+  auto reloaded = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  reloaded.loadIndex(filename, /* searchOnly= */ true);
+  auto reloadedResults = reloaded.query(inputData, 10, 1, 50);
+  REQUIRE(std::get<0>(reloadedResults).data ==
+          std::get<0>(index.query(inputData, 10, 1, 50)).data);
+  REQUIRE_THROWS(reloaded.optimizeLayout());
+  std::filesystem::remove(filename);
+}
+
+TEST_CASE("Test memory policies do not change query results") {
+  int numDimensions = 16;
+  int numVectors = 2000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  auto reference = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  reference.addItems(inputData, {}, /* numThreads= */ 1);
+  auto expected = reference.query(inputData, 10, 1, 50);
+
+  std::vector<hnswlib::MemoryPolicy> policies(1);
+  policies[0].arenaLinkLists = true;
+#ifdef __linux__
+  policies.emplace_back();
+  policies.back().hugePages = hnswlib::HugePageMode::Transparent;
+  policies.back().arenaLinkLists = true;
+#endif
+
+  for (const hnswlib::MemoryPolicy &policy : policies) {
+    CAPTURE((int)policy.hugePages);
+    auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions, 12,
+                                   200, 1, 1, true, policy);
+    index.addItems(inputData, {}, /* numThreads= */ 1);
+    auto actual = index.query(inputData, 10, 1, 50);
+    REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+    REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+
+    // Link lists released by compaction are reused by new elements:
+    for (int i = 0; i < numVectors; i += 2) {
+      index.markDeleted(i);
+    }
+    REQUIRE(index.compact() == (size_t)numVectors / 2);
+    std::vector<hnswlib::labeltype> newIds(numVectors / 2);
+    for (size_t i = 0; i < newIds.size(); i++) {
+      newIds[i] = numVectors + i;
+    }
+    index.addItems(randomVectors(numVectors / 2, numDimensions), newIds);
+    for (int i = 1; i < numVectors; i += 98) {
+      REQUIRE(std::get<0>(index.query(inputData[i], 1, 50))[0] ==
+              (hnswlib::labeltype)i);
+    }
+
+    auto output = std::make_shared<MemoryOutputStream>();
+    index.saveIndex(output);
+    std::unique_ptr<Index> reloaded = loadTypedIndexFromStream(
+        std::make_shared<SequentialInputStream>(output->getValue()), false,
+        policy);
+    REQUIRE(std::get<0>(reloaded->query(inputData, 10, 1, 50)).data ==
+            std::get<0>(index.query(inputData, 10, 1, 50)).data);
+  }
+}
+
+TEST_CASE("Test 1 GB huge pages are only used for large allocations") {
+  hnswlib::MemoryPolicy policy;
+  policy.hugePages = hnswlib::HugePageMode::Explicit1GB;
+  size_t hugePage = 2 * 1024 * 1024, giantPage = 1024 * 1024 * 1024;
+
+  REQUIRE(policy.getPageSize() == hugePage);
+  REQUIRE(policy.getAllocatedSize(4096) == hugePage);
+  REQUIRE(policy.getAllocatedSize(giantPage - 1) == giantPage);
+  REQUIRE(policy.getPageSize(giantPage - 1) == hugePage);
+  REQUIRE(policy.getPageSize(giantPage) == giantPage);
+  REQUIRE(policy.getAllocatedSize(giantPage + 1) == 2 * giantPage);
+}
+
+TEST_CASE("Test compacting an index removes deleted elements") {
+  int numDimensions = 16;
+  int numVectors = 2000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(inputData);
+  REQUIRE(index.compact() == 0);
+
+  for (int i = 0; i < numVectors; i += 5) {
+    index.markDeleted(i);
+  }
+  REQUIRE(index.compact() == (size_t)numVectors / 5);
+  REQUIRE(index.getNumElements() == (size_t)numVectors * 4 / 5);
+  REQUIRE(index.getIDsCount() == numVectors * 4 / 5);
+  REQUIRE_THROWS(index.getVector(0));
+  REQUIRE_THROWS(index.markDeleted(5));
+  REQUIRE(index.compact() == 0);
+
+  // Every remaining element should still be reachable from the graph:
+  int found = 0;
+  for (int i = 0; i < numVectors; i++) {
+    if (i % 5 == 0) {
+      continue;
+    }
+    REQUIRE(index.getVector(i) == inputData[i]);
+    auto [labels, distances] = index.query(inputData[i], 1, 50);
+    if (labels[0] == (hnswlib::labeltype)i) {
+      found++;
+    }
+  }
+  REQUIRE(found >= numVectors * 4 / 5 * 0.99);
+
+  // Freed slots should be reused by new elements:
+  size_t maxElements = index.getMaxElements();
+  std::vector<std::vector<float>> newData = randomVectors(100, numDimensions);
+  std::vector<hnswlib::labeltype> newIds = index.addItems(newData);
+  REQUIRE(index.getMaxElements() == maxElements);
+  for (size_t i = 0; i < newData.size(); i++) {
+    REQUIRE(std::get<0>(index.query(newData[i], 1, 50))[0] == newIds[i]);
+  }
+
+  for (hnswlib::labeltype id : index.getIDs()) {
+    index.markDeleted(id);
+  }
+  REQUIRE(index.compact() == (size_t)numVectors * 4 / 5 + newData.size());
+  REQUIRE(index.getNumElements() == 0);
+  REQUIRE(index.getIDsCount() == 0);
+  hnswlib::labeltype onlyId = index.addItem(inputData[0], {});
+  REQUIRE(std::get<0>(index.query(inputData[0], 1))[0] == onlyId);
+}
+
+TEST_CASE("Test applying deltas brings a copy of an index up to date") {
+  int numDimensions = 16;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(3000, numDimensions);
+
+  auto save = [](Index &index) {
+    auto output = std::make_shared<MemoryOutputStream>();
+    index.saveIndex(output);
+    return output->getValue();
+  };
+  auto saveDelta = [](Index &index) {
+    auto output = std::make_shared<MemoryOutputStream>();
+    index.saveDelta(output);
+    return output->getValue();
+  };
+  auto loadCopy = [&](const std::string &contents) {
+    auto copy = std::make_unique<TypedIndex<float>>(SpaceType::Euclidean,
+                                                    numDimensions);
+    copy->loadIndex(std::make_shared<MemoryInputStream>(contents));
+    return copy;
+  };
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(std::vector<std::vector<float>>(inputData.begin(),
+                                                 inputData.begin() + 2000),
+                 {}, 1);
+  std::string base = save(index);
+  auto copy = loadCopy(base);
+
+  // Additions (past the copy's maximum size), updates and deletions:
+  index.resizeIndex(index.getMaxElements() + 1000);
+  index.addItems(std::vector<std::vector<float>>(inputData.begin() + 2000,
+                                                 inputData.begin() + 2010),
+                 {}, 1);
+  index.addItem(inputData[2500], 7);
+  index.markDeleted(11);
+  std::string firstDelta = saveDelta(index);
+  REQUIRE(firstDelta.size() < base.size() / 2);
+
+  copy->applyDelta(std::make_shared<MemoryInputStream>(firstDelta));
+  REQUIRE(copy->getIDsCount() == index.getIDsCount());
+  REQUIRE(copy->getVector(7) == inputData[2500]);
+  REQUIRE_THROWS(copy->getVector(11));
+  REQUIRE(copy->getMaxElements() == index.getMaxElements());
+  REQUIRE(std::get<0>(copy->query(inputData[2005], 1))[0] == 2005);
+
+  // Deltas are cumulative, so the latest one can be applied to either the
+  // full save or a copy that already has an earlier delta applied:
+  index.unmarkDeleted(11);
+  index.markDeleted(12);
+  std::string secondDelta = saveDelta(index);
+  REQUIRE(secondDelta.size() >= firstDelta.size());
+  copy->applyDelta(std::make_shared<MemoryInputStream>(secondDelta));
+  auto secondCopy = loadCopy(base);
+  secondCopy->applyDelta(std::make_shared<MemoryInputStream>(secondDelta));
+
+  // Compacting shrinks the index, and so changes every element:
+  index.compact();
+  std::string compactedDelta = saveDelta(index);
+  copy->applyDelta(std::make_shared<MemoryInputStream>(compactedDelta));
+  REQUIRE(copy->getNumElements() == index.getNumElements());
+
+  std::string full = save(index);
+  REQUIRE(save(*copy) == full);
+  secondCopy->applyDelta(std::make_shared<MemoryInputStream>(compactedDelta));
+  REQUIRE(save(*secondCopy) == full);
+
+  // A full save resets the changes that deltas include:
+  REQUIRE(saveDelta(index).size() < firstDelta.size() / 10);
+
+  auto otherIndex = TypedIndex<float>(SpaceType::Cosine, numDimensions);
+  REQUIRE_THROWS_AS(
+      otherIndex.applyDelta(std::make_shared<MemoryInputStream>(firstDelta)),
+      std::domain_error);
+  REQUIRE_THROWS_AS(
+      copy->applyDelta(std::make_shared<MemoryInputStream>(base)),
+      std::domain_error);
+
+  // Deltas carry the full-precision vectors of the elements they change:
+  auto quantized = TypedIndex<float, E4M3>(SpaceType::Euclidean, numDimensions);
+  quantized.setStoreFullPrecisionVectors(true);
+  quantized.addItems(std::vector<std::vector<float>>(inputData.begin(),
+                                                     inputData.begin() + 1000),
+                     {}, 1);
+  auto quantizedBase = std::make_shared<MemoryOutputStream>();
+  auto vectorsBase = std::make_shared<MemoryOutputStream>();
+  quantized.saveIndex(quantizedBase);
+  quantized.saveFullPrecisionVectors(vectorsBase);
+  auto loadQuantizedCopy = [&](bool withVectors) {
+    auto copy = std::make_unique<TypedIndex<float, E4M3>>(SpaceType::Euclidean,
+                                                          numDimensions);
+    copy->loadIndex(
+        std::make_shared<MemoryInputStream>(quantizedBase->getValue()));
+    if (withVectors) {
+      copy->loadFullPrecisionVectors(
+          std::make_shared<MemoryInputStream>(vectorsBase->getValue()));
+    }
+    return copy;
+  };
+  auto reranking = loadQuantizedCopy(true);
+  auto notReranking = loadQuantizedCopy(false);
+
+  quantized.addItems(std::vector<std::vector<float>>(inputData.begin() + 1000,
+                                                     inputData.begin() + 1100),
+                     {}, 1);
+  quantized.addItem(inputData[2500], 7);
+  std::string quantizedDelta = saveDelta(quantized);
+  reranking->applyDelta(std::make_shared<MemoryInputStream>(quantizedDelta));
+  notReranking->applyDelta(
+      std::make_shared<MemoryInputStream>(quantizedDelta));
+  REQUIRE(notReranking->getNumElements() == quantized.getNumElements());
+
+  auto queries = std::vector<std::vector<float>>(inputData.begin() + 2500,
+                                                 inputData.begin() + 2600);
+  auto expected = quantized.query(queries, 10, -1, 50, nullptr,
+                                  /* rerankK= */ 50);
+  auto reranked =
+      reranking->query(queries, 10, -1, 50, nullptr, /* rerankK= */ 50);
+  REQUIRE(std::get<0>(reranked).data == std::get<0>(expected).data);
+  REQUIRE(std::get<1>(reranked).data == std::get<1>(expected).data);
+
+  // Copies without full-precision vectors of their own don't gain any:
+  auto vectorsAfter = std::make_shared<MemoryOutputStream>();
+  notReranking->saveFullPrecisionVectors(vectorsAfter);
+  auto empty = std::make_shared<MemoryOutputStream>();
+  TypedIndex<float, E4M3>(SpaceType::Euclidean, numDimensions)
+      .saveFullPrecisionVectors(empty);
+  REQUIRE(vectorsAfter->getValue() == empty->getValue());
+}
+
+TEST_CASE("Test prefetch depth does not change query results") {
+  int numDimensions = 32;
+  int numVectors = 1000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.setPrefetchDepth(0);
+  index.addItems(inputData);
+  auto expected = index.query(inputData, /* k= */ 10, /* numThreads= */ 1,
+                              /* queryEf= */ 50);
+
+  for (size_t depth : {1, 4, 64}) {
+    CAPTURE(depth);
+    index.setPrefetchDepth(depth);
+    REQUIRE(index.getPrefetchDepth() == depth);
+    auto actual = index.query(inputData, 10, 1, 50);
+    REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+    REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+  }
+}
+
+TEST_CASE("Test early termination trades recall for less work") {
+  int numDimensions = 16;
+  int numVectors = 2000;
+  int k = 10;
+  long queryEf = 200;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(inputData);
+  index.resetStats();
+  auto expected = std::get<0>(index.query(inputData, k, -1, queryEf));
+  uint64_t fullSearchHops = index.getStats().hops;
+
+  // A patience larger than any search never stops early:
+  index.setEarlyTerminationPatience(numVectors);
+  REQUIRE(std::get<0>(index.query(inputData, k, -1, queryEf)).data ==
+          expected.data);
+
+  // Queries may use their own patience without changing the index's:
+  index.setEarlyTerminationPatience(1);
+  std::vector<hnswlib::labeltype> labels(numVectors * k);
+  std::vector<float> distances(numVectors * k);
+  index.queryInto(vectorsToNDArray(inputData).data.data(), numVectors, k,
+                  labels.data(), distances.data(), -1, queryEf, nullptr, 0,
+                  nullptr, /* queryPatience= */ 0);
+  REQUIRE(labels == expected.data);
+  REQUIRE(index.getEarlyTerminationPatience() == 1);
+
+  size_t patience = index.calibrateEarlyTermination(
+      vectorsToNDArray(inputData), k, /* targetRecall= */ 0.95, queryEf);
+  REQUIRE(patience > 0);
+  REQUIRE(patience < (size_t)numVectors);
+  REQUIRE(index.getEarlyTerminationPatience() == patience);
+
+  // Cached results (found with a different patience) aren't used while
+  // calibrating:
+  index.setQueryCacheSize(numVectors);
+  index.query(inputData, k, -1, queryEf);
+  REQUIRE(index.calibrateEarlyTermination(vectorsToNDArray(inputData), k,
+                                          0.95, queryEf) == patience);
+  index.setQueryCacheSize(0);
+
+  // Perfect recall may need more patience than the search budget, but never
+  // more than a search that can't stop early:
+  size_t perfectPatience = index.calibrateEarlyTermination(
+      vectorsToNDArray(inputData), k, /* targetRecall= */ 1.0, queryEf);
+  REQUIRE(perfectPatience < (size_t)numVectors);
+  REQUIRE(std::get<0>(index.query(inputData, k, -1, queryEf)).data ==
+          expected.data);
+  index.setEarlyTerminationPatience(patience);
+
+  index.resetStats();
+  auto actual = std::get<0>(index.query(inputData, k, -1, queryEf));
+  REQUIRE(index.getStats().hops < fullSearchHops);
+
+  size_t found = 0;
+  for (int row = 0; row < numVectors; row++) {
+    std::set<hnswlib::labeltype> expectedRow(expected[row], expected[row] + k);
+    for (int i = 0; i < k; i++) {
+      found += expectedRow.count(actual[row][i]);
+    }
+  }
+  REQUIRE((float)found / (numVectors * k) >= 0.95);
+
+  REQUIRE_THROWS_AS(
+      index.calibrateEarlyTermination(vectorsToNDArray(inputData), k, 1.5),
+      std::invalid_argument);
+}
+
+TEST_CASE("Test brute-force queries find the exact nearest neighbors") {
+  int numDimensions = 16;
+  int numVectors = 1000;
+  int numQueries = 50;
+  int k = 5;
+  NDArray<float, 2> input =
+      vectorsToNDArray(randomVectors(numVectors, numDimensions));
+  NDArray<float, 2> queries =
+      vectorsToNDArray(randomVectors(numQueries, numDimensions));
+
+  for (auto spaceType : {SpaceType::Euclidean, SpaceType::Cosine}) {
+    CAPTURE(spaceType);
+    auto index = TypedIndex<float>(spaceType, numDimensions);
+    index.addItems(input);
+
+    // Distances between every pair should match getDistance:
+    NDArray<float, 2> distances = index.getDistances(queries, input);
+    REQUIRE(std::get<0>(distances.shape) == numQueries);
+    REQUIRE(std::get<1>(distances.shape) == numVectors);
+    for (int q = 0; q < numQueries; q += 7) {
+      for (int i = 0; i < numVectors; i += 13) {
+        std::vector<float> a(queries[q], queries[q] + numDimensions);
+        std::vector<float> b(input[i], input[i] + numDimensions);
+        REQUIRE(distances[q][i] ==
+                doctest::Approx(index.getDistance(a, b)).epsilon(1e-4));
+      }
+    }
+
+    // ...and sorting a row of them should give a brute-force query's results:
+    auto [labels, resultDistances] = index.bruteForceQuery(queries, k);
+    for (int q = 0; q < numQueries; q++) {
+      std::vector<hnswlib::labeltype> expected(numVectors);
+      std::iota(expected.begin(), expected.end(), 0);
+      std::partial_sort(expected.begin(), expected.begin() + k, expected.end(),
+                        [&](hnswlib::labeltype a, hnswlib::labeltype b) {
+                          return distances[q][a] < distances[q][b];
+                        });
+      for (int i = 0; i < k; i++) {
+        REQUIRE(labels[q][i] == expected[i]);
+        REQUIRE(resultDistances[q][i] ==
+                doctest::Approx(distances[q][expected[i]]).epsilon(1e-4));
+      }
+    }
+
+    // Brute-force results are never worse than the graph's:
+    auto graphDistances = std::get<1>(index.query(queries, k, -1, 10));
+    for (int q = 0; q < numQueries; q++) {
+      REQUIRE(resultDistances[q][k - 1] <= graphDistances[q][k - 1]);
+    }
+
+    index.markDeleted(labels[0][0]);
+    std::vector<hnswlib::labeltype> allowedIds = {labels[0][1], labels[0][2],
+                                                  labels[0][3]};
+    hnswlib::AllowListFilter filter(allowedIds);
+    auto filtered = std::get<0>(index.bruteForceQuery(queries, 2, -1, &filter));
+    REQUIRE(filtered[0][0] == labels[0][1]);
+    REQUIRE(filtered[0][1] == labels[0][2]);
+    REQUIRE_THROWS_AS(index.bruteForceQuery(queries, 4, -1, &filter),
+                      RecallError);
+  }
+
+  SUBCASE("Test PQ and sharded indices") {
+    PQIndex pq(SpaceType::Euclidean, numDimensions, /* numSubspaces= */ 8);
+    pq.addItems(input);
+    auto pqDistances = std::get<1>(pq.bruteForceQuery(queries, k));
+    auto pqGraphDistances = std::get<1>(pq.query(queries, k, -1, 10));
+    for (int q = 0; q < numQueries; q++) {
+      REQUIRE(pqDistances[q][k - 1] <= pqGraphDistances[q][k - 1]);
+    }
+    REQUIRE(pq.getDistances(queries, input)[3][4] ==
+            doctest::Approx(pq.getDistance(
+                std::vector<float>(queries[3], queries[3] + numDimensions),
+                std::vector<float>(input[4], input[4] + numDimensions))));
+
+    auto single = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+    single.addItems(input);
+    ShardedIndex sharded(SpaceType::Euclidean, numDimensions,
+                         ShardingMode::Partitioned, /* numShards= */ 3);
+    sharded.addItems(input, {});
+    auto expected = std::get<0>(single.bruteForceQuery(queries, k));
+    auto actual = std::get<0>(sharded.bruteForceQuery(queries, k));
+    REQUIRE(actual.data == expected.data);
+  }
+}
+
+TEST_CASE("Test grouped search results keep the nearest groups") {
+  std::mt19937 generator(1234);
+  std::uniform_real_distribution<float> distanceDistribution(0, 1);
+  hnswlib::GroupedSearchResults<float, uint32_t, uint64_t> results;
+
+  // Shrinking the capacity between searches reuses the same table:
+  for (size_t capacity : {100, 10, 1, 37}) {
+    CAPTURE(capacity);
+    results.reset(capacity);
+
+    // Strided groups all share a home slot unless they're hashed well:
+    std::map<uint64_t, std::pair<float, uint32_t>> nearestByGroup;
+    for (uint32_t id = 0; id < 5000; id++) {
+      uint64_t group = (generator() % 300) << 20;
+      float distance = distanceDistribution(generator);
+      results.offer(distance, id, group);
+      auto existing = nearestByGroup.find(group);
+      if (existing == nearestByGroup.end() ||
+          distance < existing->second.first) {
+        nearestByGroup[group] = {distance, id};
+      }
+    }
+
+    std::vector<std::pair<float, uint32_t>> expected;
+    for (auto &entry : nearestByGroup)
+      expected.push_back(entry.second);
+    std::sort(expected.begin(), expected.end());
+    expected.resize(std::min(expected.size(), capacity));
+
+    REQUIRE(results.size() == expected.size());
+    const auto &sorted = results.sortedResults();
+    for (size_t i = 0; i < expected.size(); i++) {
+      REQUIRE(sorted[i].distance == expected[i].first);
+      REQUIRE(sorted[i].id == expected[i].second);
+    }
+  }
+}
+
+TEST_CASE("Test grouped queries return the nearest element of each group") {
+  int numDimensions = 16;
+  int numVectors = 1000;
+  int numQueries = 50;
+  int elementsPerGroup = 5;
+  int k = 10;
+  NDArray<float, 2> input =
+      vectorsToNDArray(randomVectors(numVectors, numDimensions));
+  NDArray<float, 2> queries =
+      vectorsToNDArray(randomVectors(numQueries, numDimensions));
+
+  std::vector<hnswlib::labeltype> ids(numVectors);
+  std::iota(ids.begin(), ids.end(), 0);
+  std::vector<hnswlib::labeltype> groups(numVectors);
+  for (int i = 0; i < numVectors; i++) {
+    groups[i] = 100000 + (i / elementsPerGroup);
+  }
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(input);
+  REQUIRE(index.getGroup(7) == 7);
+  index.setGroups(ids, groups);
+  REQUIRE(index.getGroup(7) == groups[7]);
+
+  // The exact answer is the first `k` distinct groups in order of distance:
+  auto [exact, exactDistances] = index.bruteForceQuery(queries, numVectors);
+  auto [labels, distances] = index.groupedQuery(queries, k, -1, 100);
+  size_t found = 0;
+  for (int q = 0; q < numQueries; q++) {
+    std::set<hnswlib::labeltype> expectedGroups;
+    for (int i = 0; i < numVectors && (int)expectedGroups.size() < k; i++) {
+      expectedGroups.insert(groups[exact[q][i]]);
+    }
+
+    std::set<hnswlib::labeltype> resultGroups;
+    for (int i = 0; i < k; i++) {
+      resultGroups.insert(index.getGroup(labels[q][i]));
+      found += expectedGroups.count(index.getGroup(labels[q][i]));
+      if (i > 0) {
+        REQUIRE(distances[q][i - 1] <= distances[q][i]);
+      }
+    }
+    REQUIRE(resultGroups.size() == (size_t)k);
+  }
+  REQUIRE((float)found / (numQueries * k) > 0.9);
+
+  // Single queries, deletions and filters behave as they do in query():
+  std::vector<float> query(queries[0], queries[0] + numDimensions);
+  auto [singleLabels, singleDistances] = index.groupedQuery(query, k, 100);
+  REQUIRE(singleLabels ==
+          std::vector<hnswlib::labeltype>(labels[0], labels[0] + k));
+
+  // Of the four allowed elements (one deleted, one in the same group as the
+  // deleted one, and two sharing another group), only two groups remain:
+  hnswlib::labeltype deleted = singleLabels[0];
+  hnswlib::labeltype sameGroup =
+      deleted % elementsPerGroup == 0 ? deleted + 1 : deleted - 1;
+  hnswlib::labeltype otherGroup = groups[deleted] == groups[0] ? 500 : 0;
+  index.markDeleted(deleted);
+  hnswlib::AllowListFilter filter(
+      {deleted, sameGroup, otherGroup, otherGroup + 1});
+  auto filtered = std::get<0>(index.groupedQuery(query, 2, 100, &filter));
+  REQUIRE(index.getGroup(filtered[0]) != index.getGroup(filtered[1]));
+  for (hnswlib::labeltype label : filtered) {
+    REQUIRE(label != deleted);
+    REQUIRE((label == sameGroup || groups[label] == groups[otherGroup]));
+  }
+  REQUIRE_THROWS_AS(index.groupedQuery(query, 3, 100, &filter), RecallError);
+
+  SUBCASE("Test group assignments are saved and included in deltas") {
+    auto expected = std::get<0>(index.groupedQuery(queries, k, -1, 100)).data;
+    auto saved = std::make_shared<MemoryOutputStream>();
+    index.saveIndex(saved);
+    auto reloaded = loadTypedIndexFromStream(
+        std::make_shared<MemoryInputStream>(saved->getValue()));
+    REQUIRE(reloaded->getGroup(7) == groups[7]);
+    REQUIRE(std::get<0>(reloaded->groupedQuery(queries, k, -1, 100)).data ==
+            expected);
+
+    auto packed = std::make_shared<MemoryOutputStream>();
+    index.savePackedIndex(packed);
+    auto searchOnly = loadTypedIndexFromStream(
+        std::make_shared<MemoryInputStream>(packed->getValue()),
+        /* searchOnly= */ true);
+    REQUIRE(std::get<0>(searchOnly->groupedQuery(queries, k, -1, 100)).data ==
+            expected);
+
+    // Removed, changed and new assignments are all carried by a delta:
+    index.setGroups({7, 8}, {7, 42});
+    hnswlib::labeltype added =
+        index.addItem(std::vector<float>(numDimensions, 0.5), {});
+    index.setGroups({added}, {groups[0]});
+    auto delta = std::make_shared<MemoryOutputStream>();
+    index.saveDelta(delta);
+    reloaded->applyDelta(std::make_shared<MemoryInputStream>(delta->getValue()));
+    REQUIRE(reloaded->getGroup(7) == 7);
+    REQUIRE(reloaded->getGroup(8) == 42);
+    REQUIRE(reloaded->getGroup(added) == groups[0]);
+    REQUIRE(reloaded->getGroup(9) == groups[9]);
+    REQUIRE(std::get<0>(reloaded->groupedQuery(queries, k, -1, 100)).data ==
+            std::get<0>(index.groupedQuery(queries, k, -1, 100)).data);
+  }
+
+  SUBCASE("Test PQ and sharded indices") {
+    PQIndex pq(SpaceType::Euclidean, numDimensions, /* numSubspaces= */ 8);
+    pq.addItems(input);
+    pq.setGroups(ids, groups);
+    auto pqLabels = std::get<0>(pq.groupedQuery(queries, k, -1, 100));
+    std::set<hnswlib::labeltype> pqGroups;
+    for (int i = 0; i < k; i++) {
+      pqGroups.insert(groups[pqLabels[0][i]]);
+    }
+    REQUIRE(pqGroups.size() == (size_t)k);
+
+    auto reference = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+    reference.addItems(input, ids, /* numThreads= */ 1);
+    reference.setGroups(ids, groups);
+    ShardedIndex replicated(SpaceType::Euclidean, numDimensions,
+                            ShardingMode::Replicated, /* numShards= */ 2);
+    replicated.addItems(input, ids, /* numThreads= */ 1);
+    replicated.setGroups(ids, groups);
+    REQUIRE(std::get<0>(replicated.groupedQuery(queries, k, -1, 100)).data ==
+            std::get<0>(reference.groupedQuery(queries, k, -1, 100)).data);
+
+    ShardedIndex partitioned(SpaceType::Euclidean, numDimensions,
+                             ShardingMode::Partitioned, /* numShards= */ 2);
+    partitioned.addItems(input, ids);
+    partitioned.setGroups(ids, groups);
+    REQUIRE(partitioned.getGroup(7) == groups[7]);
+    REQUIRE_THROWS(partitioned.groupedQuery(queries, k));
+  }
+}
+
+TEST_CASE("Test bulk-built indices find the neighbors of clustered data") {
+  int numDimensions = 16;
+  int k = 10;
+  long queryEf = 100;
+  // Clustered data given in cluster order is the hardest case for a bulk
+  // build, as each batch of elements would otherwise be far from the graph
+  // built before it:
+  std::vector<std::vector<float>> inputData =
+      clusteredVectors(/* numClusters= */ 50, /* vectorsPerCluster= */ 200,
+                       numDimensions);
+  int numVectors = inputData.size();
+  NDArray<float, 2> input = vectorsToNDArray(inputData);
+
+  std::vector<std::vector<float>> queryData;
+  for (int i = 0; i < numVectors; i += 37) {
+    queryData.push_back(inputData[i]);
+  }
+  NDArray<float, 2> queries = vectorsToNDArray(queryData);
+  int numQueries = queryData.size();
+
+  auto incremental = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  incremental.addItems(input);
+  auto expected = std::get<0>(incremental.bruteForceQuery(queries, k));
+
+  auto recall = [&](Index &index) {
+    auto labels = std::get<0>(index.query(queries, k, -1, queryEf));
+    size_t found = 0;
+    for (int row = 0; row < numQueries; row++) {
+      std::set<hnswlib::labeltype> expectedRow(expected[row],
+                                               expected[row] + k);
+      for (int i = 0; i < k; i++) {
+        found += expectedRow.count(labels[row][i]);
+      }
+    }
+    return (float)found / (numQueries * k);
+  };
+  float incrementalRecall = recall(incremental);
+
+  auto bulk = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  std::vector<hnswlib::labeltype> ids = bulk.bulkAddItems(input, {}, 8);
+  REQUIRE(ids.size() == (size_t)numVectors);
+  REQUIRE(ids[7] == 7);
+  REQUIRE(bulk.getNumElements() == (size_t)numVectors);
+  REQUIRE(bulk.getStats().numInserts == (uint64_t)numVectors);
+  float bulkRecall = recall(bulk);
+  CAPTURE(incrementalRecall);
+  CAPTURE(bulkRecall);
+  REQUIRE(bulkRecall >= 0.95);
+  REQUIRE(bulkRecall >= incrementalRecall - 0.02);
+
+  // Bulk builds don't depend on the number of threads used:
+  auto singleThreaded = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  singleThreaded.bulkAddItems(input, {}, 1);
+  auto output = std::make_shared<MemoryOutputStream>();
+  auto singleThreadedOutput = std::make_shared<MemoryOutputStream>();
+  bulk.saveIndex(output);
+  singleThreaded.saveIndex(singleThreadedOutput);
+  REQUIRE(output->getValue() == singleThreadedOutput->getValue());
+
+  // ...and are saved in the usual format:
+  std::unique_ptr<Index> reloaded = loadTypedIndexFromStream(
+      std::make_shared<MemoryInputStream>(output->getValue()));
+  REQUIRE(recall(*reloaded) == bulkRecall);
+
+  // Bulk additions can extend existing indices, but can't update elements:
+  auto extended = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  extended.addItems(vectorsToNDArray(std::vector<std::vector<float>>(
+      inputData.begin(), inputData.begin() + numVectors / 4)));
+  extended.bulkAddItems(vectorsToNDArray(std::vector<std::vector<float>>(
+      inputData.begin() + numVectors / 4, inputData.end())));
+  REQUIRE(extended.getNumElements() == (size_t)numVectors);
+  REQUIRE(recall(extended) >= incrementalRecall - 0.02);
+  REQUIRE_THROWS_AS(extended.bulkAddItems(vectorsToNDArray({inputData[0]}),
+                                          {(hnswlib::labeltype)3}),
+                    std::invalid_argument);
+  REQUIRE(extended.getNumElements() == (size_t)numVectors);
+
+  ShardedIndex sharded(SpaceType::Euclidean, numDimensions,
+                       ShardingMode::Partitioned, /* numShards= */ 2);
+  sharded.bulkAddItems(input);
+  REQUIRE(sharded.getNumElements() == (size_t)numVectors);
+  REQUIRE(recall(sharded) >= incrementalRecall - 0.02);
+}
+
+TEST_CASE("Test product-quantized indices find approximate neighbors") {
+  int numDimensions = 32;
+  int numVectors = 2000;
+  int k = 10;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  for (auto spaceType : {SpaceType::Euclidean, SpaceType::Cosine}) {
+    SUBCASE("Test PQ index") {
+      CAPTURE(spaceType);
+      PQIndex index(spaceType, numDimensions, /* numSubspaces= */ 16,
+                    /* M= */ 12, /* efConstruction= */ 200,
+                    /* randomSeed= */ 1, /* maxElements= */ 1,
+                    /* storeFullPrecisionVectors= */ true);
+      REQUIRE(index.getStorageDataType() == StorageDataType::PQ);
+      index.addItems(inputData);
+      REQUIRE(index.isTrained());
+      REQUIRE(index.getNumElements() == (size_t)numVectors);
+
+      auto reference = TypedIndex<float>(spaceType, numDimensions);
+      reference.addItems(inputData);
+      auto expected = std::get<0>(reference.query(inputData, k, -1, 200));
+
+      auto recallOf = [&](const NDArray<hnswlib::labeltype, 2> &labels) {
+        size_t hits = 0;
+        for (int i = 0; i < numVectors; i++) {
+          std::unordered_set<hnswlib::labeltype> truth(
+              expected[i], expected[i] + k);
+          for (int j = 0; j < k; j++) {
+            hits += truth.count(labels[i][j]);
+          }
+        }
+        return (float)hits / (numVectors * k);
+      };
+
+      float pqRecall =
+          recallOf(std::get<0>(index.query(inputData, k, -1, 200)));
+      auto reranked = index.query(inputData, k, -1, 200, nullptr,
+                                  /* rerankK= */ 100);
+      float rerankedRecall = recallOf(std::get<0>(reranked));
+      CAPTURE(pqRecall);
+      CAPTURE(rerankedRecall);
+      REQUIRE(pqRecall > 0.3);
+      REQUIRE(rerankedRecall > pqRecall);
+      REQUIRE(rerankedRecall > 0.8);
+
+      // Re-ranked distances are exact, so each vector should find itself:
+      for (int i = 0; i < numVectors; i += 100) {
+        REQUIRE(std::get<0>(reranked)[i][0] == (hnswlib::labeltype)i);
+        REQUIRE(std::get<1>(reranked)[i][0] ==
+                doctest::Approx(0).epsilon(1e-5));
+      }
+
+      std::string filename =
+          (std::filesystem::temp_directory_path() / "voyager_pq.hnsw").string();
+      index.saveIndex(filename);
+      std::unique_ptr<Index> reloaded = loadTypedIndexFromStream(
+          std::make_shared<FileInputStream>(filename));
+      REQUIRE(reloaded->getStorageDataType() == StorageDataType::PQ);
+      auto before = index.query(inputData, k, 1, 50);
+      auto after = reloaded->query(inputData, k, 1, 50);
+      REQUIRE(std::get<0>(after).data == std::get<0>(before).data);
+      REQUIRE(std::get<1>(after).data == std::get<1>(before).data);
+      std::filesystem::remove(filename);
+    }
+  }
+
+  SUBCASE("Test concurrent insertions into an untrained index") {
+    // Every thread but one waits for the first batch to train the quantizer:
+    PQIndex index(SpaceType::Euclidean, numDimensions, /* numSubspaces= */ 8);
+    std::vector<std::thread> threads;
+    int numThreads = 4;
+    int rowsPerThread = numVectors / numThreads;
+    for (int t = 0; t < numThreads; t++) {
+      threads.emplace_back([&, t]() {
+        std::vector<std::vector<float>> rows(
+            inputData.begin() + t * rowsPerThread,
+            inputData.begin() + (t + 1) * rowsPerThread);
+        std::vector<hnswlib::labeltype> ids(rowsPerThread);
+        std::iota(ids.begin(), ids.end(), t * rowsPerThread);
+        index.addItems(rows, ids, /* numThreads= */ 1);
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    REQUIRE(index.isTrained());
+    REQUIRE(index.getNumElements() == (size_t)numVectors);
+    auto labels = std::get<0>(index.query(inputData, 1, -1, 100));
+    size_t foundSelf = 0;
+    for (int i = 0; i < numVectors; i++) {
+      foundSelf += labels[i][0] == (hnswlib::labeltype)i;
+    }
+    REQUIRE(foundSelf > (size_t)numVectors / 2);
+  }
+}
+
+TEST_CASE("Test re-ranking with full-precision vectors improves recall") {
+  int numDimensions = 32;
+  int numVectors = 2000;
+  int k = 10;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  for (auto spaceType : {SpaceType::Euclidean, SpaceType::Cosine}) {
+    SUBCASE("Test E4M3 index") {
+      CAPTURE(spaceType);
+      auto reference = TypedIndex<float>(spaceType, numDimensions);
+      reference.addItems(inputData);
+      auto exact = reference.query(inputData, k, -1, 200);
+
+      auto index = TypedIndex<float, E4M3>(spaceType, numDimensions);
+      index.setStoreFullPrecisionVectors(true);
+      index.addItems(inputData);
+
+      auto approximate = index.query(inputData, k, -1, 200);
+      auto reranked = index.query(inputData, k, -1, 200, nullptr,
+                                  /* rerankK= */ 50);
+
+      // The re-ranked distances should match those of a Float32 index:
+      size_t approximateMatches = 0, rerankedMatches = 0;
+      for (int i = 0; i < numVectors; i++) {
+        std::unordered_set<hnswlib::labeltype> truth(
+            std::get<0>(exact)[i], std::get<0>(exact)[i] + k);
+        for (int j = 0; j < k; j++) {
+          approximateMatches += truth.count(std::get<0>(approximate)[i][j]);
+          rerankedMatches += truth.count(std::get<0>(reranked)[i][j]);
+        }
+        REQUIRE(std::get<0>(reranked)[i][0] == std::get<0>(exact)[i][0]);
+        REQUIRE(std::get<1>(reranked)[i][0] ==
+                doctest::Approx(std::get<1>(exact)[i][0]).epsilon(1e-4));
+      }
+      CAPTURE(approximateMatches);
+      CAPTURE(rerankedMatches);
+      REQUIRE(rerankedMatches > approximateMatches);
+
+      auto single = index.query(inputData[7], k, 200, nullptr, 50);
+      for (int j = 0; j < k; j++) {
+        REQUIRE(std::get<0>(single)[j] == std::get<0>(reranked)[7][j]);
+      }
+
+      // Full-precision vectors can be saved and memory-mapped separately:
+      std::string filename =
+          (std::filesystem::temp_directory_path() / "voyager_rerank.fp32")
+              .string();
+      index.saveFullPrecisionVectors(filename);
+      auto reloaded = TypedIndex<float, E4M3>(spaceType, numDimensions);
+      reloaded.addItems(inputData);
+      reloaded.loadFullPrecisionVectors(filename, /* memoryMap= */ true);
+      auto reloadedResults = reloaded.query(inputData, k, -1, 200, nullptr, 50);
+      REQUIRE(std::get<0>(reloadedResults).data ==
+              std::get<0>(reranked).data);
+      REQUIRE(reloaded.getVector(3) == index.getVector(3));
+      std::filesystem::remove(filename);
+    }
+  }
+}
+
+TEST_CASE("Test full-precision vector stores") {
+  int numDimensions = 8;
+  int numVectors = 5000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  SUBCASE("Test concurrent insertions") {
+    FullPrecisionVectorStore store(numDimensions, SpaceType::Euclidean);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&, t]() {
+        for (int i = t; i < numVectors; i += 4) {
+          store.set(i, inputData[i].data());
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    REQUIRE(store.size() == (size_t)numVectors);
+    std::vector<float> vector(numDimensions);
+    for (int i = 0; i < numVectors; i++) {
+      REQUIRE(store.get(i, vector.data()));
+      REQUIRE(vector == inputData[i]);
+    }
+
+    store.erase({0, 17});
+    REQUIRE(store.size() == (size_t)numVectors - 2);
+    REQUIRE_FALSE(store.get(17, vector.data()));
+    REQUIRE(store.get(18, vector.data()));
+    REQUIRE(vector == inputData[18]);
+
+    auto outputStream = std::make_shared<MemoryOutputStream>();
+    store.serializeToStream(outputStream);
+    FullPrecisionVectorStore reloaded(numDimensions, SpaceType::Euclidean);
+    reloaded.loadFromStream(
+        std::make_shared<MemoryInputStream>(outputStream->getValue()));
+    REQUIRE(reloaded.size() == (size_t)numVectors - 2);
+    REQUIRE(reloaded.get(numVectors - 1, vector.data()));
+    REQUIRE(vector == inputData[numVectors - 1]);
+  }
+
+  SUBCASE("Test re-ranking never mixes exact and quantized distances") {
+    FullPrecisionVectorStore store(numDimensions, SpaceType::Euclidean);
+    store.set(0, inputData[0].data());
+    store.set(1, inputData[1].data());
+    const float *query = inputData[0].data();
+
+    // Candidate 2 has no stored vector, so its distance isn't comparable with
+    // the exact distances of candidates 0 and 1:
+    std::vector<hnswlib::labeltype> candidateLabels = {1, 2, 0};
+    std::vector<float> candidateDistances = {0.5, 0.1, 0.7};
+    std::vector<hnswlib::labeltype> labels(2);
+    std::vector<float> distances(2);
+    REQUIRE_FALSE(store.rerank(query, candidateLabels.data(),
+                               candidateDistances.data(), 3, 2, labels.data(),
+                               distances.data()));
+    REQUIRE(labels == std::vector<hnswlib::labeltype>({2, 1}));
+    REQUIRE(distances == std::vector<float>({0.1, 0.5}));
+
+    // With every vector stored, candidates are ordered by exact distance:
+    candidateLabels = {1, 0};
+    REQUIRE(store.rerank(query, candidateLabels.data(),
+                         candidateDistances.data(), 2, 2, labels.data(),
+                         distances.data()));
+    REQUIRE(labels == std::vector<hnswlib::labeltype>({0, 1}));
+    REQUIRE(distances[0] == 0);
+  }
+}
+
+TEST_CASE("Test partitioned indices merge the results of every shard") {
+  int numDimensions = 16;
+  int numVectors = 2000;
+  int k = 10;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  ShardedIndex index(SpaceType::Euclidean, numDimensions,
+                     ShardingMode::Partitioned, /* numShards= */ 4);
+  std::vector<hnswlib::labeltype> ids = index.addItems(inputData);
+  REQUIRE(index.getNumShards() == 4);
+  REQUIRE(index.getNumElements() == (size_t)numVectors);
+  REQUIRE(index.getIDsCount() == numVectors);
+  REQUIRE(index.getIDsMap().size() == (size_t)numVectors);
+  for (size_t shard = 0; shard < index.getNumShards(); shard++) {
+    REQUIRE(index.getShard(shard)->getNumElements() ==
+            (size_t)numVectors / 4);
+  }
+  REQUIRE(index.getVector(ids[123]) == inputData[123]);
+
+  // Merging must return the best k results found by any of the shards:
+  auto [labels, distances] = index.query(inputData, k, -1, 50);
+  for (int i = 0; i < numVectors; i += 101) {
+    std::vector<std::pair<float, hnswlib::labeltype>> expected;
+    for (size_t shard = 0; shard < index.getNumShards(); shard++) {
+      auto [shardLabels, shardDistances] =
+          index.getShard(shard)->query(inputData[i], k, 50);
+      for (int j = 0; j < k; j++) {
+        expected.emplace_back(shardDistances[j], shardLabels[j]);
+      }
+    }
+    std::sort(expected.begin(), expected.end());
+    for (int j = 0; j < k; j++) {
+      REQUIRE(distances[i][j] == expected[j].first);
+    }
+    REQUIRE(labels[i][0] == ids[i]);
+  }
+
+  auto [singleLabels, singleDistances] = index.query(inputData[5], k, 50);
+  REQUIRE(singleLabels == std::vector<hnswlib::labeltype>(
+                              labels[5], labels[5] + k));
+
+  index.markDeleted(ids[5]);
+  REQUIRE(std::get<0>(index.query(inputData[5], 1, 50))[0] != ids[5]);
+
+  // Gathering vectors in bulk skips deleted (and missing) elements:
+  std::vector<hnswlib::labeltype> gatherIds = {ids[4], ids[5], 999999, ids[6]};
+  std::vector<hnswlib::labeltype> copiedIds(gatherIds.size());
+  std::vector<float> gathered(gatherIds.size() * numDimensions);
+  REQUIRE(index.getVectorsInto(gatherIds.data(), gatherIds.size(),
+                               gathered.data(), copiedIds.data()) == 2);
+  REQUIRE(copiedIds[0] == ids[4]);
+  REQUIRE(copiedIds[1] == ids[6]);
+  REQUIRE(std::vector<float>(gathered.begin() + numDimensions,
+                             gathered.begin() + 2 * numDimensions) ==
+          inputData[6]);
+
+  REQUIRE(index.compact() == 1);
+  REQUIRE(index.getNumElements() == (size_t)numVectors - 1);
+
+  // Partitioned indices can only be saved shard-by-shard:
+  REQUIRE_THROWS(index.saveIndex(std::make_shared<MemoryOutputStream>()));
+  std::vector<std::shared_ptr<Index>> shards;
+  for (size_t shard = 0; shard < index.getNumShards(); shard++) {
+    auto output = std::make_shared<MemoryOutputStream>();
+    index.getShard(shard)->saveIndex(output);
+    shards.push_back(loadTypedIndexFromStream(
+        std::make_shared<MemoryInputStream>(output->getValue())));
+  }
+  ShardedIndex reloaded(shards, ShardingMode::Partitioned);
+  REQUIRE(std::get<0>(reloaded.query(inputData, k, -1, 50)).data ==
+          std::get<0>(index.query(inputData, k, -1, 50)).data);
+  REQUIRE(reloaded.addItem(inputData[5], {}) == (hnswlib::labeltype)numVectors);
+}
+
+TEST_CASE("Test partitioned queries only need k results across all shards") {
+  int numDimensions = 16;
+  int k = 5;
+
+  SUBCASE("When a filter rejects every element of a shard") {
+    int numVectors = 200;
+    std::vector<std::vector<float>> inputData =
+        randomVectors(numVectors, numDimensions);
+    ShardedIndex index(SpaceType::Euclidean, numDimensions,
+                       ShardingMode::Partitioned, /* numShards= */ 2);
+    index.addItems(inputData);
+
+    // IDs are partitioned by their value modulo the number of shards, so
+    // only the first shard holds even IDs:
+    std::vector<hnswlib::labeltype> evenIds;
+    for (int i = 0; i < numVectors; i += 2) {
+      evenIds.push_back(i);
+    }
+    hnswlib::AllowListFilter filter(evenIds);
+    auto labels = std::get<0>(index.query(inputData, k, -1, 50, &filter));
+    auto exact = std::get<0>(
+        index.bruteForceQuery(vectorsToNDArray(inputData), k, -1, &filter));
+    for (int i = 0; i < numVectors; i++) {
+      for (int j = 0; j < k; j++) {
+        REQUIRE(labels[i][j] % 2 == 0);
+        REQUIRE(exact[i][j] % 2 == 0);
+      }
+    }
+  }
+
+  SUBCASE("When deleted elements leave a shard with fewer than k") {
+    int numVectors = 10;
+    std::vector<std::vector<float>> inputData =
+        randomVectors(numVectors, numDimensions);
+    ShardedIndex index(SpaceType::Euclidean, numDimensions,
+                       ShardingMode::Partitioned, /* numShards= */ 2);
+    index.addItems(inputData);
+    index.markDeleted(3);
+
+    auto labels = std::get<0>(index.query(inputData, 8, -1, 50));
+    auto exact =
+        std::get<0>(index.bruteForceQuery(vectorsToNDArray(inputData), 8));
+    for (int i = 0; i < numVectors; i++) {
+      for (int j = 0; j < 8; j++) {
+        REQUIRE(labels[i][j] != 3);
+        REQUIRE(exact[i][j] != 3);
+      }
+    }
+
+    // Queries still fail if fewer than k are found in total:
+    REQUIRE_THROWS_AS(index.query(inputData, 10, -1, 50), RecallError);
+    REQUIRE_THROWS_AS(index.bruteForceQuery(vectorsToNDArray(inputData), 10),
+                      RecallError);
+  }
+}
+
+TEST_CASE("Test replicated indices match a single index") {
+  int numDimensions = 16;
+  int numVectors = 1000;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  auto reference = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  reference.addItems(inputData, {}, /* numThreads= */ 1);
+  auto expected = reference.query(inputData, 10, -1, 50);
+
+  ShardedIndex index(SpaceType::Euclidean, numDimensions,
+                     ShardingMode::Replicated, /* numShards= */ 3);
+  index.addItems(inputData, {}, /* numThreads= */ 1);
+  REQUIRE(index.getNumElements() == (size_t)numVectors);
+  for (size_t shard = 0; shard < index.getNumShards(); shard++) {
+    REQUIRE(index.getShard(shard)->getNumElements() == (size_t)numVectors);
+  }
+
+  auto actual = index.query(inputData, 10, -1, 50);
+  REQUIRE(std::get<0>(actual).data == std::get<0>(expected).data);
+  REQUIRE(std::get<1>(actual).data == std::get<1>(expected).data);
+  REQUIRE(std::get<0>(index.query(inputData[3], 10, 50)) ==
+          std::get<0>(reference.query(inputData[3], 10, 50)));
+
+  // Replicated indices are saved as, and loaded from, regular index files:
+  auto output = std::make_shared<MemoryOutputStream>();
+  index.saveIndex(output);
+  std::unique_ptr<Index> saved = loadTypedIndexFromStream(
+      std::make_shared<MemoryInputStream>(output->getValue()));
+  REQUIRE(std::get<0>(saved->query(inputData, 10, -1, 50)).data ==
+          std::get<0>(expected).data);
+
+  ShardedIndex reloaded(SpaceType::Euclidean, numDimensions,
+                        ShardingMode::Replicated, /* numShards= */ 2);
+  reloaded.loadIndex(std::make_shared<MemoryInputStream>(output->getValue()));
+  for (size_t shard = 0; shard < reloaded.getNumShards(); shard++) {
+    REQUIRE(std::get<0>(reloaded.getShard(shard)->query(inputData, 10, -1, 50))
+                .data == std::get<0>(expected).data);
+  }
+  REQUIRE(reloaded.addItem(inputData[0], {}) == (hnswlib::labeltype)numVectors);
+}
+
+TEST_CASE("Test stats count the queries and insertions made on an index") {
+  int numDimensions = 16;
+  int numVectors = 500;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+
+  auto index = TypedIndex<float>(SpaceType::Euclidean, numDimensions);
+  index.addItems(inputData, {}, /* numThreads= */ 4);
+  hnswlib::IndexStats stats = index.getStats();
+  REQUIRE(stats.numInserts == (uint64_t)numVectors);
+  REQUIRE(stats.insertLatency.getCount() == (uint64_t)numVectors);
+  REQUIRE(stats.numQueries == 0);
+  REQUIRE(stats.distanceComputations > 0);
+
+  index.resetStats();
+  index.query(inputData, 10, /* numThreads= */ 4, 50);
+  index.query(inputData[0], 10, 50);
+  stats = index.getStats();
+  REQUIRE(stats.numInserts == 0);
+  REQUIRE(stats.numQueries == (uint64_t)numVectors + 1);
+  REQUIRE(stats.queryLatency.getCount() == (uint64_t)numVectors + 1);
+  REQUIRE(stats.queryLatency.totalNanoseconds > 0);
+  REQUIRE(stats.hops >= (uint64_t)numVectors);
+  REQUIRE(stats.distanceComputations >= stats.hops);
+
+  index.resetStats();
+  stats = index.getStats();
+  REQUIRE(stats.numQueries == 0);
+  REQUIRE(stats.hops == 0);
+  REQUIRE(stats.queryLatency.getCount() == 0);
+
+  for (ShardingMode mode :
+       {ShardingMode::Partitioned, ShardingMode::Replicated}) {
+    ShardedIndex sharded(SpaceType::Euclidean, numDimensions, mode,
+                         /* numShards= */ 3);
+    sharded.addItems(inputData, {}, /* numThreads= */ 2);
+    sharded.query(inputData, 10, /* numThreads= */ 2, 50);
+    stats = sharded.getStats();
+    REQUIRE(stats.numInserts == (uint64_t)numVectors);
+    REQUIRE(stats.numQueries == (uint64_t)numVectors);
+    REQUIRE(stats.queryLatency.getCount() == (uint64_t)numVectors);
+  }
+}
+
+TEST_CASE("Test stats record the latency of every query") {
+  hnswlib::StatsCollector stats;
+  // Queries answered together each took the whole time:
+  stats.recordQueries(4, 8000);
+  stats.recordQuery(100);
+  hnswlib::IndexStats recorded = stats.getStats();
+  REQUIRE(recorded.numQueries == 5);
+  REQUIRE(recorded.queryLatency.totalNanoseconds == 4 * 8000 + 100);
+  REQUIRE(recorded.queryLatency.counts[0] == 1);
+  REQUIRE(recorded.queryLatency.counts[
+              hnswlib::LatencyHistogram::getBucket(8000)] == 4);
+
+  // Collectors may outlive (or be outlived by) the threads recording into
+  // them:
+  for (int i = 0; i < 100; i++) {
+    auto collector = std::make_unique<hnswlib::StatsCollector>();
+    std::thread([&]() { collector->recordQuery(1000); }).join();
+    collector->recordQuery(1000);
+    REQUIRE(collector->getStats().numQueries == 2);
+    std::thread([&]() { collector.reset(); }).join();
+  }
+}
+
+TEST_CASE("Test the query cache is only invalidated while enabled") {
+  QueryCache cache;
+  uint64_t generation = cache.getGeneration();
+  cache.invalidate();
+  REQUIRE(cache.getGeneration() == generation);
+
+  // Enabling the cache discards anything searched before it was enabled:
+  cache.setMaxEntries(16);
+  REQUIRE(cache.getGeneration() > generation);
+  generation = cache.getGeneration();
+  cache.invalidate();
+  REQUIRE(cache.getGeneration() == generation + 1);
+
+  // Batches of changes invalidate the cache once:
+  generation = cache.getGeneration();
+  {
+    QueryCache::ScopedInvalidation invalidation(cache);
+    REQUIRE(cache.getGeneration() == generation);
+  }
+  REQUIRE(cache.getGeneration() == generation + 1);
+}
+
+TEST_CASE("Test the query cache returns identical results until changed") {
+  int numDimensions = 16;
+  int numVectors = 1000;
+  int k = 10;
+  std::vector<std::vector<float>> inputData =
+      randomVectors(numVectors, numDimensions);
+  std::vector<std::vector<float>> evenRows;
+  for (int i = 0; i < numVectors; i += 2) {
+    evenRows.push_back(inputData[i]);
+  }
+
+  for (size_t rerankK : {0, 50}) {
+    CAPTURE(rerankK);
+    auto index = TypedIndex<float, E4M3>(SpaceType::Euclidean, numDimensions);
+    index.setStoreFullPrecisionVectors(true);
+    index.addItems(inputData);
+    auto expected = index.query(inputData, k, 4, 50, nullptr, rerankK);
+
+    index.setQueryCacheSize(10000);
+    REQUIRE(index.getQueryCacheSize() == 10000);
+    index.resetStats();
+
+    // Caching every other query leaves blocks that are only partly cached:
+    index.query(evenRows, k, 4, 50, nullptr, rerankK);
+    hnswlib::IndexStats stats = index.getStats();
+    REQUIRE(stats.queryCacheHits == 0);
+    REQUIRE(stats.queryCacheMisses == evenRows.size());
+
+    auto results = index.query(inputData, k, 4, 50, nullptr, rerankK);
+    REQUIRE(std::get<0>(results).data == std::get<0>(expected).data);
+    REQUIRE(std::get<1>(results).data == std::get<1>(expected).data);
+    stats = index.getStats();
+    REQUIRE(stats.queryCacheHits == evenRows.size());
+    REQUIRE(stats.queryCacheMisses == (uint64_t)numVectors);
+    REQUIRE(stats.numQueries == (uint64_t)numVectors + evenRows.size());
+
+    // Single queries share the cache with batches:
+    auto single = index.query(inputData[7], k, 50, nullptr, rerankK);
+    for (int j = 0; j < k; j++) {
+      REQUIRE(std::get<0>(single)[j] == std::get<0>(expected)[7][j]);
+    }
+    REQUIRE(index.getStats().queryCacheHits == evenRows.size() + 1);
+
+    // ...but only for queries with the same parameters:
+    index.query(inputData[7], k - 1, 50, nullptr, rerankK);
+    REQUIRE(index.getStats().queryCacheHits == evenRows.size() + 1);
+
+    // Deleting an element discards every cached result:
+    hnswlib::labeltype nearest = std::get<0>(expected)[7][0];
+    index.markDeleted(nearest);
+    single = index.query(inputData[7], k, 50, nullptr, rerankK);
+    REQUIRE(index.getStats().queryCacheHits == evenRows.size() + 1);
+    for (int j = 0; j < k; j++) {
+      REQUIRE(std::get<0>(single)[j] != nearest);
+    }
+
+    // ...as does adding one:
+    std::vector<float> newVector = randomVectors(1, numDimensions)[0];
+    index.query(newVector, k, 50, nullptr, rerankK);
+    index.addItem(newVector, 12345);
+    single = index.query(newVector, k, 50, nullptr, rerankK);
+    REQUIRE(std::get<0>(single)[0] == 12345);
+
+    index.setQueryCacheSize(0);
+    index.resetStats();
+    index.query(inputData, k, 4, 50, nullptr, rerankK);
+    REQUIRE(index.getStats().queryCacheHits == 0);
+    REQUIRE(index.getStats().queryCacheMisses == 0);
+  }
+
+  SUBCASE("Test PQ index") {
+    PQIndex index(SpaceType::Euclidean, numDimensions, /* numSubspaces= */ 8);
+    index.addItems(inputData);
+    auto expected = index.query(inputData, k, 4, 50);
+    index.setQueryCacheSize(10000);
+    index.query(inputData, k, 4, 50);
+    auto results = index.query(inputData, k, 4, 50);
+    REQUIRE(std::get<0>(results).data == std::get<0>(expected).data);
+    REQUIRE(index.getStats().queryCacheHits == (uint64_t)numVectors);
+  }
+}
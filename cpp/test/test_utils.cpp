@@ -39,3 +39,29 @@ std::vector<std::vector<float>> randomVectors(int numVectors, int dimensions) {
 
   return vectors;
 }
+
+// create `numClusters` tight clusters of `vectorsPerCluster` vectors each,
+// ordered cluster by cluster (as data sorted by some attribute would be)
+std::vector<std::vector<float>>
+clusteredVectors(int numClusters, int vectorsPerCluster, int dimensions) {
+  std::vector<std::vector<float>> centers =
+      randomVectors(numClusters, dimensions);
+  std::vector<std::vector<float>> vectors;
+  vectors.reserve(numClusters * vectorsPerCluster);
+
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::normal_distribution<float> noise(0, 0.05f);
+
+  for (const std::vector<float> &center : centers) {
+    for (int i = 0; i < vectorsPerCluster; ++i) {
+      std::vector<float> vector(center);
+      for (float &value : vector) {
+        value += noise(gen);
+      }
+      vectors.push_back(std::move(vector));
+    }
+  }
+
+  return vectors;
+}
@@ -23,11 +23,17 @@
 #include "JavaOutputStream.h"
 #include <Enums.h>
 #include <Index.h>
+#include <ShardedIndex.h>
 #include <TypedIndex.h>
 
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <mutex>
 #include <thread>
 #include <type_traits>
 #include <vector>
@@ -179,6 +185,22 @@ StorageDataType toStorageDataType(JNIEnv *env, jobject enumVal) {
     return StorageDataType::Float32;
   } else if (enumValueName == "E4M3") {
     return StorageDataType::E4M3;
+  } else if (enumValueName == "PQ") {
+    return StorageDataType::PQ;
+  } else {
+    throw std::runtime_error(
+        "Voyager C++ bindings received unknown enum value \"" + enumValueName +
+        "\".");
+  }
+}
+
+ShardingMode toShardingMode(JNIEnv *env, jobject enumVal) {
+  std::string enumValueName = toString(env, enumVal);
+
+  if (enumValueName == "Partitioned") {
+    return ShardingMode::Partitioned;
+  } else if (enumValueName == "Replicated") {
+    return ShardingMode::Replicated;
   } else {
     throw std::runtime_error(
         "Voyager C++ bindings received unknown enum value \"" + enumValueName +
@@ -207,6 +229,9 @@ jobject toStorageDataType(JNIEnv *env, StorageDataType enumVal) {
   case StorageDataType::E4M3:
     enumValueName = "E4M3";
     break;
+  case StorageDataType::PQ:
+    enumValueName = "PQ";
+    break;
   default:
     throw std::runtime_error(
         "Voyager C++ bindings received unknown enum value.");
@@ -277,13 +302,17 @@ NDArray<float, 2> toNDArray(JNIEnv *env, jobjectArray floatArrays) {
 }
 
 /**
- * Convert a Java float array to a std::vector<float>.
+ * Copy a Java float array into a buffer owned by the calling thread, which is
+ * reused (rather than reallocated) by every call on that thread. The returned
+ * buffer is only valid until the next call on the same thread.
  */
-std::vector<float> toStdVector(JNIEnv *env, jfloatArray floatArray) {
+const std::vector<float> &toScratchVector(JNIEnv *env,
+                                          jfloatArray floatArray) {
+  thread_local std::vector<float> scratch;
   jsize numElements = env->GetArrayLength(floatArray);
-  std::vector<float> input(numElements);
-  env->GetFloatArrayRegion(floatArray, 0, numElements, (float *)input.data());
-  return input;
+  scratch.resize(numElements);
+  env->GetFloatArrayRegion(floatArray, 0, numElements, scratch.data());
+  return scratch;
 }
 
 /**
@@ -307,6 +336,291 @@ std::vector<size_t> toUnsignedStdVector(JNIEnv *env, jlongArray longArray) {
   return input;
 }
 
+/**
+ * Convert a 2D NDArray to a Java nested array (array of float arrays).
+ */
+jobjectArray toJavaArray(JNIEnv *env, const NDArray<float, 2> &array) {
+  jclass floatArrayClass = env->FindClass("[F");
+  if (!floatArrayClass) {
+    throw std::runtime_error("C++ bindings failed to find float[] class.");
+  }
+
+  jobjectArray javaArray =
+      env->NewObjectArray(array.shape[0], floatArrayClass, NULL);
+
+  for (int i = 0; i < array.shape[0]; i++) {
+    jfloatArray row = env->NewFloatArray(array.shape[1]);
+    env->SetFloatArrayRegion(row, 0, array.shape[1], array[i]);
+    env->SetObjectArrayElement(javaArray, i, row);
+    env->DeleteLocalRef(row);
+  }
+
+  return javaArray;
+}
+
+/**
+ * Convert the labels and distances returned by a batch query into an array
+ * of Java QueryResults objects, one per query.
+ */
+jobjectArray toQueryResultsArray(
+    JNIEnv *env,
+    const std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+        &queryResults) {
+  int numQueries = std::get<0>(queryResults).shape[0];
+  int numNeighbors = std::get<0>(queryResults).shape[1];
+
+  jclass queryResultsClass =
+      env->FindClass("com/spotify/voyager/jni/Index$QueryResults");
+  if (!queryResultsClass) {
+    throw std::runtime_error("C++ bindings failed to find QueryResults class.");
+  }
+
+  jmethodID constructor =
+      env->GetMethodID(queryResultsClass, "<init>", "([J[F)V");
+
+  if (!constructor) {
+    throw std::runtime_error(
+        "C++ bindings failed to find QueryResults constructor.");
+  }
+
+  jobjectArray javaQueryResults =
+      env->NewObjectArray(numQueries, queryResultsClass, NULL);
+
+  for (int i = 0; i < numQueries; i++) {
+    // Allocate a Java long array for the indices, and a float array for the
+    // distances:
+    jlongArray labels = env->NewLongArray(numNeighbors);
+
+    // queryResults is a (size_t *), but labels is a signed (long *).
+    //  This may overflow if we have more than... 2^63 = 9.223372037e18
+    //  elements. We're probably safe doing this.
+    env->SetLongArrayRegion(labels, 0, numNeighbors,
+                            (jlong *)std::get<0>(queryResults)[i]);
+
+    jfloatArray distances = env->NewFloatArray(numNeighbors);
+    env->SetFloatArrayRegion(distances, 0, numNeighbors,
+                             std::get<1>(queryResults)[i]);
+
+    jobject result =
+        env->NewObject(queryResultsClass, constructor, labels, distances);
+    env->SetObjectArrayElement(javaQueryResults, i, result);
+    env->DeleteLocalRef(labels);
+    env->DeleteLocalRef(distances);
+    env->DeleteLocalRef(result);
+  }
+
+  return javaQueryResults;
+}
+
+/**
+ * Global references to the classes and methods needed to complete a
+ * CompletableFuture from a natively-attached thread (see
+ * QueryFutureCompleter). They're looked up on a Java thread, as FindClass on a
+ * natively-attached thread can only find system classes.
+ */
+struct AsyncQueryContext {
+  jclass queryResultsClass;
+  jmethodID queryResultsConstructor;
+  jclass recallExceptionClass;
+  jmethodID recallExceptionConstructor;
+  jclass runtimeExceptionClass;
+  jmethodID runtimeExceptionConstructor;
+  jmethodID complete;
+  jmethodID completeExceptionally;
+};
+
+jclass findGlobalClass(JNIEnv *env, const char *name) {
+  jclass localClass = env->FindClass(name);
+  if (!localClass) {
+    throw std::runtime_error(std::string("C++ bindings failed to find ") +
+                             name + " class.");
+  }
+  jclass globalClass = (jclass)env->NewGlobalRef(localClass);
+  env->DeleteLocalRef(localClass);
+  return globalClass;
+}
+
+jmethodID findMethod(JNIEnv *env, jclass c, const char *name,
+                     const char *signature) {
+  jmethodID method = env->GetMethodID(c, name, signature);
+  if (!method) {
+    throw std::runtime_error(std::string("C++ bindings failed to find ") +
+                             name + " method.");
+  }
+  return method;
+}
+
+const AsyncQueryContext &getAsyncQueryContext(JNIEnv *env) {
+  static AsyncQueryContext context;
+  static std::once_flag initialized;
+  std::call_once(initialized, [&] {
+    context.queryResultsClass =
+        findGlobalClass(env, "com/spotify/voyager/jni/Index$QueryResults");
+    context.queryResultsConstructor =
+        findMethod(env, context.queryResultsClass, "<init>", "([J[F)V");
+    context.recallExceptionClass = findGlobalClass(
+        env, "com/spotify/voyager/jni/exception/RecallException");
+    context.recallExceptionConstructor =
+        findMethod(env, context.recallExceptionClass, "<init>",
+                   "(Ljava/lang/String;)V");
+    context.runtimeExceptionClass =
+        findGlobalClass(env, "java/lang/RuntimeException");
+    context.runtimeExceptionConstructor =
+        findMethod(env, context.runtimeExceptionClass, "<init>",
+                   "(Ljava/lang/String;)V");
+
+    jclass futureClass =
+        env->FindClass("java/util/concurrent/CompletableFuture");
+    if (!futureClass) {
+      throw std::runtime_error(
+          "C++ bindings failed to find CompletableFuture class.");
+    }
+    context.complete =
+        findMethod(env, futureClass, "complete", "(Ljava/lang/Object;)Z");
+    context.completeExceptionally =
+        findMethod(env, futureClass, "completeExceptionally",
+                   "(Ljava/lang/Throwable;)Z");
+    env->DeleteLocalRef(futureClass);
+  });
+  return context;
+}
+
+/**
+ * Completes the CompletableFutures of asynchronous queries on a single thread
+ * attached to the JVM, so that the index's worker threads never need to be.
+ * The thread is started (and attached) when the first asynchronous query is
+ * submitted, so that a failure to attach fails that submission rather than
+ * leaving its future incomplete. It is never stopped, as futures may need
+ * completing until the JVM exits.
+ */
+class QueryFutureCompleter {
+public:
+  explicit QueryFutureCompleter(JavaVM *vm) {
+    std::promise<bool> attached;
+    std::future<bool> attachedFuture = attached.get_future();
+    thread = std::thread([this, vm, &attached] {
+      JNIEnv *env = nullptr;
+      // As a daemon thread, so that it doesn't keep the JVM alive:
+      if (vm->AttachCurrentThreadAsDaemon((void **)&env, nullptr) != JNI_OK) {
+        attached.set_value(false);
+        return;
+      }
+      attached.set_value(true);
+      run(env);
+    });
+
+    if (!attachedFuture.get()) {
+      thread.join();
+      throw std::runtime_error("C++ bindings failed to attach a thread to the "
+                               "JVM to complete asynchronous queries.");
+    }
+    thread.detach();
+  }
+
+  /**
+   * Run `completion` on the completer's thread, with that thread's JNIEnv.
+   */
+  void enqueue(std::function<void(JNIEnv *)> completion) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      completions.push_back(std::move(completion));
+    }
+    completionAvailable.notify_one();
+  }
+
+private:
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable completionAvailable;
+  std::deque<std::function<void(JNIEnv *)>> completions;
+
+  void run(JNIEnv *env) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      completionAvailable.wait(lock, [&] { return !completions.empty(); });
+      std::function<void(JNIEnv *)> completion =
+          std::move(completions.front());
+      completions.pop_front();
+      lock.unlock();
+      completion(env);
+      lock.lock();
+    }
+  }
+};
+
+/**
+ * Return the process's QueryFutureCompleter, starting it if this is the first
+ * asynchronous query (or if every earlier attempt to start it failed).
+ */
+QueryFutureCompleter &getQueryFutureCompleter(JNIEnv *env) {
+  static std::mutex startLock;
+  static QueryFutureCompleter *completer = nullptr;
+  std::unique_lock<std::mutex> lock(startLock);
+  if (!completer) {
+    JavaVM *vm = nullptr;
+    if (env->GetJavaVM(&vm) != JNI_OK) {
+      throw std::runtime_error("C++ bindings failed to find the JVM.");
+    }
+    // Deliberately never deleted; see QueryFutureCompleter.
+    completer = new QueryFutureCompleter(vm);
+  }
+  return *completer;
+}
+
+/**
+ * Complete (and release the global reference to) the CompletableFuture of
+ * an asynchronous query, on the QueryFutureCompleter's thread.
+ */
+void completeQueryFuture(JNIEnv *env, const AsyncQueryContext &context,
+                         jobject future,
+                         const std::vector<hnswlib::labeltype> &nativeLabels,
+                         const std::vector<float> &nativeDistances,
+                         std::exception_ptr error) {
+  // Natively-attached threads never return to Java, so every local reference
+  // made here must be deleted explicitly:
+  jobject value;
+  jmethodID completion;
+  if (error) {
+    jclass exceptionClass = context.runtimeExceptionClass;
+    jmethodID exceptionConstructor = context.runtimeExceptionConstructor;
+    std::string message = "Asynchronous query failed.";
+    try {
+      std::rethrow_exception(error);
+    } catch (RecallError const &e) {
+      exceptionClass = context.recallExceptionClass;
+      exceptionConstructor = context.recallExceptionConstructor;
+      message = e.what();
+    } catch (std::exception const &e) {
+      message = e.what();
+    } catch (...) {
+    }
+
+    jstring javaMessage = env->NewStringUTF(message.c_str());
+    value = env->NewObject(exceptionClass, exceptionConstructor, javaMessage);
+    env->DeleteLocalRef(javaMessage);
+    completion = context.completeExceptionally;
+  } else {
+    jlongArray labels = env->NewLongArray(nativeLabels.size());
+    env->SetLongArrayRegion(labels, 0, nativeLabels.size(),
+                            (jlong *)nativeLabels.data());
+    jfloatArray distances = env->NewFloatArray(nativeDistances.size());
+    env->SetFloatArrayRegion(distances, 0, nativeDistances.size(),
+                             nativeDistances.data());
+    value = env->NewObject(context.queryResultsClass,
+                           context.queryResultsConstructor, labels, distances);
+    env->DeleteLocalRef(labels);
+    env->DeleteLocalRef(distances);
+    completion = context.complete;
+  }
+
+  env->CallBooleanMethod(future, completion, value);
+  if (env->ExceptionCheck()) {
+    env->ExceptionClear();
+  }
+  env->DeleteLocalRef(value);
+  env->DeleteGlobalRef(future);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Index Construction and Indexing
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -335,7 +649,31 @@ void Java_com_spotify_voyager_jni_Index_nativeConstructor(
                            toSpaceType(env, spaceType), numDimensions, M,
                            efConstruction, randomSeed, maxElements));
       break;
+    case StorageDataType::PQ:
+      setHandle<Index>(env, self,
+                       new PQIndex(toSpaceType(env, spaceType), numDimensions,
+                                   0, M, efConstruction, randomSeed,
+                                   maxElements));
+      break;
+    }
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
     }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_nativeShardedConstructor(
+    JNIEnv *env, jobject self, jobject spaceType, jint numDimensions,
+    jobject shardingMode, jint numShards, jlong M, jlong efConstruction,
+    jlong randomSeed, jlong maxElements, jobject storageDataType) {
+  try {
+    setHandle<Index>(
+        env, self,
+        new ShardedIndex(toSpaceType(env, spaceType), numDimensions,
+                         toShardingMode(env, shardingMode), numShards, M,
+                         efConstruction, randomSeed, maxElements,
+                         toStorageDataType(env, storageDataType)));
   } catch (std::exception const &e) {
     if (!env->ExceptionCheck()) {
       env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
@@ -347,7 +685,8 @@ jlong Java_com_spotify_voyager_jni_Index_addItem___3F(JNIEnv *env, jobject self,
                                                       jfloatArray vector) {
   try {
     std::shared_ptr<Index> index = getHandle<Index>(env, self);
-    return index->addItem(toStdVector(env, vector), {});
+    const std::vector<float> &input = toScratchVector(env, vector);
+    return index->addItem(input.data(), input.size(), {});
   } catch (std::exception const &e) {
     if (!env->ExceptionCheck()) {
       env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
@@ -362,7 +701,8 @@ jlong Java_com_spotify_voyager_jni_Index_addItem___3FJ(JNIEnv *env,
                                                        jlong id) {
   try {
     std::shared_ptr<Index> index = getHandle<Index>(env, self);
-    return index->addItem(toStdVector(env, vector), {id});
+    const std::vector<float> &input = toScratchVector(env, vector);
+    return index->addItem(input.data(), input.size(), {id});
   } catch (std::exception const &e) {
     if (!env->ExceptionCheck()) {
       env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
@@ -418,6 +758,53 @@ jlongArray Java_com_spotify_voyager_jni_Index_addItems___3_3F_3JI(
   return nullptr;
 }
 
+jlongArray Java_com_spotify_voyager_jni_Index_bulkAddItems___3_3FI(
+    JNIEnv *env, jobject self, jobjectArray vectors, jint numThreads) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    std::vector<hnswlib::labeltype> nativeIds =
+        index->bulkAddItems(toNDArray(env, vectors), {}, numThreads);
+
+    // Allocate a Java long array for the IDs:
+    static_assert(
+        sizeof(hnswlib::labeltype) == sizeof(jlong),
+        "bulkAddItems expects hnswlib::labeltype to be a 64-bit integer.");
+    jlongArray javaIds = env->NewLongArray(nativeIds.size());
+    env->SetLongArrayRegion(javaIds, 0, nativeIds.size(),
+                            (jlong *)nativeIds.data());
+    return javaIds;
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+  return nullptr;
+}
+
+jlongArray Java_com_spotify_voyager_jni_Index_bulkAddItems___3_3F_3JI(
+    JNIEnv *env, jobject self, jobjectArray vectors, jlongArray ids,
+    jint numThreads) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    std::vector<hnswlib::labeltype> nativeIds = index->bulkAddItems(
+        toNDArray(env, vectors), toUnsignedStdVector(env, ids), numThreads);
+
+    // Allocate a Java long array for the IDs:
+    static_assert(
+        sizeof(hnswlib::labeltype) == sizeof(jlong),
+        "bulkAddItems expects hnswlib::labeltype to be a 64-bit integer.");
+    jlongArray javaIds = env->NewLongArray(nativeIds.size());
+    env->SetLongArrayRegion(javaIds, 0, nativeIds.size(),
+                            (jlong *)nativeIds.data());
+    return javaIds;
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+  return nullptr;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Querying
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -426,12 +813,38 @@ jobject Java_com_spotify_voyager_jni_Index_query___3FIJ(JNIEnv *env,
                                                         jfloatArray queryVector,
                                                         jint numNeighbors,
                                                         jlong queryEf) {
+  return Java_com_spotify_voyager_jni_Index_query___3FIJ_3J(
+      env, self, queryVector, numNeighbors, queryEf, nullptr);
+}
+
+jobject Java_com_spotify_voyager_jni_Index_query___3FIJ_3J(
+    JNIEnv *env, jobject self, jfloatArray queryVector, jint numNeighbors,
+    jlong queryEf, jlongArray allowedIds) {
+  return Java_com_spotify_voyager_jni_Index_query___3FIJ_3JI(
+      env, self, queryVector, numNeighbors, queryEf, allowedIds, 0);
+}
+
+jobject Java_com_spotify_voyager_jni_Index_query___3FIJ_3JI(
+    JNIEnv *env, jobject self, jfloatArray queryVector, jint numNeighbors,
+    jlong queryEf, jlongArray allowedIds, jint rerankK) {
   try {
     std::shared_ptr<Index> index = getHandle<Index>(env, self);
 
-    std::tuple<std::vector<hnswlib::labeltype>, std::vector<float>>
-        queryResults =
-            index->query(toStdVector(env, queryVector), numNeighbors, queryEf);
+    std::unique_ptr<hnswlib::AllowListFilter> filter;
+    if (allowedIds) {
+      filter = std::make_unique<hnswlib::AllowListFilter>(
+          toUnsignedStdVector(env, allowedIds));
+    }
+
+    // Results are written to buffers reused by every query on this thread:
+    thread_local std::vector<hnswlib::labeltype> nativeLabels;
+    thread_local std::vector<float> nativeDistances;
+    nativeLabels.resize(numNeighbors);
+    nativeDistances.resize(numNeighbors);
+    const std::vector<float> &query = toScratchVector(env, queryVector);
+    index->query(query.data(), query.size(), numNeighbors, nativeLabels.data(),
+                 nativeDistances.data(), queryEf, filter.get(),
+                 std::max<jint>(rerankK, 0));
 
     jclass queryResultsClass =
         env->FindClass("com/spotify/voyager/jni/Index$QueryResults");
@@ -451,15 +864,15 @@ jobject Java_com_spotify_voyager_jni_Index_query___3FIJ(JNIEnv *env,
     // Allocate a Java long array for the IDs:
     jlongArray labels = env->NewLongArray(numNeighbors);
 
-    // queryResults is a (size_t *), but labels is a signed (long *).
+    // nativeLabels is a (size_t *), but labels is a signed (long *).
     //  This may overflow if we have more than... 2^63 = 9.223372037e18
     //  elements. We're probably safe doing this.
     env->SetLongArrayRegion(labels, 0, numNeighbors,
-                            (jlong *)std::get<0>(queryResults).data());
+                            (jlong *)nativeLabels.data());
 
     jfloatArray distances = env->NewFloatArray(numNeighbors);
     env->SetFloatArrayRegion(distances, 0, numNeighbors,
-                             std::get<1>(queryResults).data());
+                             nativeDistances.data());
 
     return env->NewObject(queryResultsClass, constructor, labels, distances);
   } catch (RecallError const &e) {
@@ -477,60 +890,172 @@ jobject Java_com_spotify_voyager_jni_Index_query___3FIJ(JNIEnv *env,
   }
 }
 
+void Java_com_spotify_voyager_jni_Index_nativeQueryAsync(
+    JNIEnv *env, jobject self, jfloatArray queryVector, jint numNeighbors,
+    jlong queryEf, jint rerankK, jobject future) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    const AsyncQueryContext &context = getAsyncQueryContext(env);
+    QueryFutureCompleter &completer = getQueryFutureCompleter(env);
+    const std::vector<float> &query = toScratchVector(env, queryVector);
+
+    jobject futureRef = env->NewGlobalRef(future);
+    try {
+      index->queryAsync(
+          query,
+          [&context, &completer, futureRef](
+              std::vector<hnswlib::labeltype> labels,
+              std::vector<float> distances, std::exception_ptr error) {
+            completer.enqueue([&context, futureRef, labels, distances,
+                               error](JNIEnv *env) {
+              completeQueryFuture(env, context, futureRef, labels, distances,
+                                  error);
+            });
+          },
+          numNeighbors, queryEf, std::max<jint>(rerankK, 0));
+    } catch (...) {
+      env->DeleteGlobalRef(futureRef);
+      throw;
+    }
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
 jobjectArray Java_com_spotify_voyager_jni_Index_query___3_3FIIJ(
     JNIEnv *env, jobject self, jobjectArray queryVectors, jint numNeighbors,
     jint numThreads, jlong queryEf) {
+  return Java_com_spotify_voyager_jni_Index_query___3_3FIIJ_3J(
+      env, self, queryVectors, numNeighbors, numThreads, queryEf, nullptr);
+}
+
+jobjectArray Java_com_spotify_voyager_jni_Index_query___3_3FIIJ_3J(
+    JNIEnv *env, jobject self, jobjectArray queryVectors, jint numNeighbors,
+    jint numThreads, jlong queryEf, jlongArray allowedIds) {
+  return Java_com_spotify_voyager_jni_Index_query___3_3FIIJ_3JI(
+      env, self, queryVectors, numNeighbors, numThreads, queryEf, allowedIds,
+      0);
+}
+
+jobjectArray Java_com_spotify_voyager_jni_Index_query___3_3FIIJ_3JI(
+    JNIEnv *env, jobject self, jobjectArray queryVectors, jint numNeighbors,
+    jint numThreads, jlong queryEf, jlongArray allowedIds, jint rerankK) {
   try {
     std::shared_ptr<Index> index = getHandle<Index>(env, self);
 
-    int numQueries = env->GetArrayLength(queryVectors);
-
-    std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>> queryResults =
-        index->query(toNDArray(env, queryVectors), numNeighbors, numThreads,
-                     queryEf);
+    std::unique_ptr<hnswlib::AllowListFilter> filter;
+    if (allowedIds) {
+      filter = std::make_unique<hnswlib::AllowListFilter>(
+          toUnsignedStdVector(env, allowedIds));
+    }
 
-    jclass queryResultsClass =
-        env->FindClass("com/spotify/voyager/jni/Index$QueryResults");
-    if (!queryResultsClass) {
-      throw std::runtime_error(
-          "C++ bindings failed to find QueryResults class.");
+    return toQueryResultsArray(
+        env, index->query(toNDArray(env, queryVectors), numNeighbors,
+                          numThreads, queryEf, filter.get(),
+                          std::max<jint>(rerankK, 0)));
+  } catch (RecallError const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(
+          env->FindClass("com/spotify/voyager/jni/exception/RecallException"),
+          e.what());
     }
+    return nullptr;
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+    return nullptr;
+  }
+}
 
-    jmethodID constructor =
-        env->GetMethodID(queryResultsClass, "<init>", "([J[F)V");
+jobjectArray Java_com_spotify_voyager_jni_Index_bruteForceQuery(
+    JNIEnv *env, jobject self, jobjectArray queryVectors, jint numNeighbors,
+    jint numThreads, jlongArray allowedIds) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
 
-    if (!constructor) {
-      throw std::runtime_error(
-          "C++ bindings failed to find QueryResults constructor.");
+    std::unique_ptr<hnswlib::AllowListFilter> filter;
+    if (allowedIds) {
+      filter = std::make_unique<hnswlib::AllowListFilter>(
+          toUnsignedStdVector(env, allowedIds));
+    }
+
+    return toQueryResultsArray(
+        env, index->bruteForceQuery(toNDArray(env, queryVectors), numNeighbors,
+                                    numThreads, filter.get()));
+  } catch (RecallError const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(
+          env->FindClass("com/spotify/voyager/jni/exception/RecallException"),
+          e.what());
+    }
+    return nullptr;
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
     }
+    return nullptr;
+  }
+}
+
+jobject Java_com_spotify_voyager_jni_Index_groupedQuery___3FIJ_3J(
+    JNIEnv *env, jobject self, jfloatArray queryVector, jint numNeighbors,
+    jlong queryEf, jlongArray allowedIds) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
 
-    jobjectArray javaQueryResults =
-        env->NewObjectArray(numQueries, queryResultsClass, NULL);
+    std::unique_ptr<hnswlib::AllowListFilter> filter;
+    if (allowedIds) {
+      filter = std::make_unique<hnswlib::AllowListFilter>(
+          toUnsignedStdVector(env, allowedIds));
+    }
 
-    for (int i = 0; i < numQueries; i++) {
-      // Allocate a Java long array for the indices, and a float array for the
-      // distances:
-      jlongArray labels = env->NewLongArray(numNeighbors);
+    const std::vector<float> &query = toScratchVector(env, queryVector);
+    if (query.size() != (size_t)index->getNumDimensions()) {
+      throw std::runtime_error(
+          "Query vector expected to share dimensionality with index.");
+    }
 
-      // queryResults is a (size_t *), but labels is a signed (long *).
-      //  This may overflow if we have more than... 2^63 = 9.223372037e18
-      //  elements. We're probably safe doing this.
-      env->SetLongArrayRegion(labels, 0, numNeighbors,
-                              (jlong *)std::get<0>(queryResults)[i]);
+    // A single query is searched as a batch of one, so that its results can
+    // be converted in the same way:
+    NDArray<hnswlib::labeltype, 2> labels({1, numNeighbors});
+    NDArray<float, 2> distances({1, numNeighbors});
+    index->groupedQueryInto(query.data(), 1, numNeighbors, labels.data.data(),
+                            distances.data.data(), 1, queryEf, filter.get());
+    jobjectArray results = toQueryResultsArray(env, {labels, distances});
+    return env->GetObjectArrayElement(results, 0);
+  } catch (RecallError const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(
+          env->FindClass("com/spotify/voyager/jni/exception/RecallException"),
+          e.what());
+    }
+    return nullptr;
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+    return nullptr;
+  }
+}
 
-      jfloatArray distances = env->NewFloatArray(numNeighbors);
-      env->SetFloatArrayRegion(distances, 0, numNeighbors,
-                               std::get<1>(queryResults)[i]);
+jobjectArray Java_com_spotify_voyager_jni_Index_groupedQuery___3_3FIIJ_3J(
+    JNIEnv *env, jobject self, jobjectArray queryVectors, jint numNeighbors,
+    jint numThreads, jlong queryEf, jlongArray allowedIds) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
 
-      jobject queryResults =
-          env->NewObject(queryResultsClass, constructor, labels, distances);
-      env->SetObjectArrayElement(javaQueryResults, i, queryResults);
-      env->DeleteLocalRef(labels);
-      env->DeleteLocalRef(distances);
-      env->DeleteLocalRef(queryResults);
+    std::unique_ptr<hnswlib::AllowListFilter> filter;
+    if (allowedIds) {
+      filter = std::make_unique<hnswlib::AllowListFilter>(
+          toUnsignedStdVector(env, allowedIds));
     }
 
-    return javaQueryResults;
+    return toQueryResultsArray(
+        env, index->groupedQuery(toNDArray(env, queryVectors), numNeighbors,
+                                 numThreads, queryEf, filter.get()));
   } catch (RecallError const &e) {
     if (!env->ExceptionCheck()) {
       env->ThrowNew(
@@ -546,6 +1071,75 @@ jobjectArray Java_com_spotify_voyager_jni_Index_query___3_3FIIJ(
   }
 }
 
+jobjectArray Java_com_spotify_voyager_jni_Index_getDistances(
+    JNIEnv *env, jobject self, jobjectArray queries, jobjectArray targets,
+    jint numThreads) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    return toJavaArray(env, index->getDistances(toNDArray(env, queries),
+                                                toNDArray(env, targets),
+                                                numThreads));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+    return nullptr;
+  }
+}
+
+/**
+ * Returns a pointer to the value at `offset` in the given direct buffer, which
+ * must have room for at least `count` values from there onwards.
+ */
+template <typename T>
+T *getDirectBufferPointer(JNIEnv *env, jobject buffer, jint offset,
+                          size_t count, const char *name) {
+  T *address = (T *)env->GetDirectBufferAddress(buffer);
+  jlong capacity = env->GetDirectBufferCapacity(buffer);
+  if (!address || capacity < 0) {
+    throw std::invalid_argument(std::string(name) +
+                                " must be a direct buffer.");
+  }
+  if (offset < 0 || (size_t)capacity < offset + count) {
+    throw std::invalid_argument(std::string(name) + " is too small.");
+  }
+  return address + offset;
+}
+
+void Java_com_spotify_voyager_jni_Index_queryIntoBuffers(
+    JNIEnv *env, jobject self, jobject queryVectors, jint queryVectorsOffset,
+    jint numQueries, jint k, jint numThreads, jlong queryEf, jobject labels,
+    jint labelsOffset, jobject distances, jint distancesOffset) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    size_t numResults = (size_t)numQueries * k;
+
+    const float *queryPointer = getDirectBufferPointer<float>(
+        env, queryVectors, queryVectorsOffset,
+        (size_t)numQueries * index->getNumDimensions(), "queryVectors");
+    // Labels are (size_t)s, but the buffer holds signed (long)s.
+    static_assert(sizeof(hnswlib::labeltype) == sizeof(jlong));
+    hnswlib::labeltype *labelPointer =
+        getDirectBufferPointer<hnswlib::labeltype>(env, labels, labelsOffset,
+                                                   numResults, "labels");
+    float *distancePointer = getDirectBufferPointer<float>(
+        env, distances, distancesOffset, numResults, "distances");
+
+    index->queryInto(queryPointer, numQueries, k, labelPointer,
+                     distancePointer, numThreads, queryEf);
+  } catch (RecallError const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(
+          env->FindClass("com/spotify/voyager/jni/exception/RecallException"),
+          e.what());
+    }
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Property Methods
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -646,25 +1240,7 @@ jobjectArray Java_com_spotify_voyager_jni_Index_getVectors(JNIEnv *env,
                                                            jlongArray ids) {
   try {
     std::shared_ptr<Index> index = getHandle<Index>(env, self);
-    NDArray<float, 2> vectors =
-        index->getVectors(toUnsignedStdVector(env, ids));
-
-    jclass floatArrayClass = env->FindClass("[F");
-    if (!floatArrayClass) {
-      throw std::runtime_error("C++ bindings failed to find float[] class.");
-    }
-
-    jobjectArray javaVectors =
-        env->NewObjectArray(vectors.shape[0], floatArrayClass, NULL);
-
-    for (int i = 0; i < vectors.shape[0]; i++) {
-      jfloatArray vector = env->NewFloatArray(vectors.shape[1]);
-      env->SetFloatArrayRegion(vector, 0, vectors.shape[1], vectors[i]);
-      env->SetObjectArrayElement(javaVectors, i, vector);
-      env->DeleteLocalRef(vector);
-    }
-
-    return javaVectors;
+    return toJavaArray(env, index->getVectors(toUnsignedStdVector(env, ids)));
   } catch (std::exception const &e) {
     if (!env->ExceptionCheck()) {
       env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
@@ -725,6 +1301,129 @@ jint Java_com_spotify_voyager_jni_Index_getEf(JNIEnv *env, jobject self) {
   return 0;
 }
 
+void Java_com_spotify_voyager_jni_Index_setPrefetchDepth(JNIEnv *env,
+                                                         jobject self,
+                                                         jint depth) {
+  try {
+    if (depth < 0) {
+      throw std::invalid_argument("Prefetch depth must not be negative.");
+    }
+    getHandle<Index>(env, self)->setPrefetchDepth(depth);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+jint Java_com_spotify_voyager_jni_Index_getPrefetchDepth(JNIEnv *env,
+                                                         jobject self) {
+  try {
+    return getHandle<Index>(env, self)->getPrefetchDepth();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+  return 0;
+}
+
+void Java_com_spotify_voyager_jni_Index_setEarlyTerminationPatience(
+    JNIEnv *env, jobject self, jint patience) {
+  try {
+    if (patience < 0) {
+      throw std::invalid_argument(
+          "Early termination patience must not be negative.");
+    }
+    getHandle<Index>(env, self)->setEarlyTerminationPatience(patience);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+jint Java_com_spotify_voyager_jni_Index_getEarlyTerminationPatience(
+    JNIEnv *env, jobject self) {
+  try {
+    return getHandle<Index>(env, self)->getEarlyTerminationPatience();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+  return 0;
+}
+
+void Java_com_spotify_voyager_jni_Index_setQueryCacheSize(JNIEnv *env,
+                                                          jobject self,
+                                                          jint maxEntries) {
+  try {
+    if (maxEntries < 0) {
+      throw std::invalid_argument("Query cache size must not be negative.");
+    }
+    getHandle<Index>(env, self)->setQueryCacheSize(maxEntries);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+jint Java_com_spotify_voyager_jni_Index_getQueryCacheSize(JNIEnv *env,
+                                                          jobject self) {
+  try {
+    return getHandle<Index>(env, self)->getQueryCacheSize();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+  return 0;
+}
+
+void Java_com_spotify_voyager_jni_Index_setAsyncBatchWindowMicroseconds(
+    JNIEnv *env, jobject self, jlong microseconds) {
+  try {
+    if (microseconds < 0) {
+      throw std::invalid_argument("Batch window must not be negative.");
+    }
+    getHandle<Index>(env, self)->setAsyncBatchWindow(
+        std::chrono::microseconds(microseconds));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+jlong Java_com_spotify_voyager_jni_Index_getAsyncBatchWindowMicroseconds(
+    JNIEnv *env, jobject self) {
+  try {
+    return getHandle<Index>(env, self)->getAsyncBatchWindow().count();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+  return 0;
+}
+
+jint Java_com_spotify_voyager_jni_Index_calibrateEarlyTermination(
+    JNIEnv *env, jobject self, jobjectArray queryVectors, jint k,
+    jfloat targetRecall, jlong queryEf) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    return index->calibrateEarlyTermination(toNDArray(env, queryVectors), k,
+                                            targetRecall, queryEf);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+  return 0;
+}
+
 void Java_com_spotify_voyager_jni_Index_markDeleted(JNIEnv *env, jobject self,
                                                     jlong label) {
   try {
@@ -747,6 +1446,31 @@ void Java_com_spotify_voyager_jni_Index_unmarkDeleted(JNIEnv *env, jobject self,
   }
 }
 
+void Java_com_spotify_voyager_jni_Index_setGroups(JNIEnv *env, jobject self,
+                                                  jlongArray ids,
+                                                  jlongArray groups) {
+  try {
+    getHandle<Index>(env, self)->setGroups(toUnsignedStdVector(env, ids),
+                                           toUnsignedStdVector(env, groups));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+jlong Java_com_spotify_voyager_jni_Index_getGroup(JNIEnv *env, jobject self,
+                                                  jlong id) {
+  try {
+    return getHandle<Index>(env, self)->getGroup(id);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+    return 0;
+  }
+}
+
 void Java_com_spotify_voyager_jni_Index_resizeIndex(JNIEnv *env, jobject self,
                                                     jlong newSize) {
   try {
@@ -759,6 +1483,114 @@ void Java_com_spotify_voyager_jni_Index_resizeIndex(JNIEnv *env, jobject self,
   }
 }
 
+void Java_com_spotify_voyager_jni_Index_setStoreFullPrecisionVectors(
+    JNIEnv *env, jobject self, jboolean enabled) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->setStoreFullPrecisionVectors(enabled);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+jboolean
+Java_com_spotify_voyager_jni_Index_getStoreFullPrecisionVectors(JNIEnv *env,
+                                                                jobject self) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    return index->getStoreFullPrecisionVectors();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+    return false;
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_optimizeLayout(JNIEnv *env,
+                                                       jobject self) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->optimizeLayout();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+jlong Java_com_spotify_voyager_jni_Index_compact(JNIEnv *env, jobject self) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    return index->compact();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+    return 0;
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_packForSearch(JNIEnv *env,
+                                                      jobject self) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->packForSearch();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+jlongArray Java_com_spotify_voyager_jni_Index_nativeGetStats(JNIEnv *env,
+                                                            jobject self) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    hnswlib::IndexStats stats = index->getStats();
+
+    // This layout must match the constructor of Index.Stats in Java:
+    std::vector<jlong> values = {
+        (jlong)stats.numQueries,
+        (jlong)stats.numInserts,
+        (jlong)stats.distanceComputations,
+        (jlong)stats.hops,
+        (jlong)stats.visitedListResets,
+        (jlong)stats.lockWaitNanoseconds,
+        (jlong)stats.queryCacheHits,
+        (jlong)stats.queryCacheMisses,
+        (jlong)stats.queryLatency.totalNanoseconds,
+        (jlong)stats.insertLatency.totalNanoseconds,
+    };
+    for (uint64_t count : stats.queryLatency.counts)
+      values.push_back((jlong)count);
+    for (uint64_t count : stats.insertLatency.counts)
+      values.push_back((jlong)count);
+
+    jlongArray javaValues = env->NewLongArray(values.size());
+    env->SetLongArrayRegion(javaValues, 0, values.size(), values.data());
+    return javaValues;
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+    return nullptr;
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_resetStats(JNIEnv *env, jobject self) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->resetStats();
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Save Index
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -786,16 +1618,139 @@ void Java_com_spotify_voyager_jni_Index_saveIndex__Ljava_io_OutputStream_2(
   }
 }
 
+void Java_com_spotify_voyager_jni_Index_saveIndex__Ljava_lang_String_2I(
+    JNIEnv *env, jobject self, jstring filename, jint compressionLevel) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->saveCompressedIndex(toString(env, filename), compressionLevel);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_saveIndex__Ljava_io_OutputStream_2I(
+    JNIEnv *env, jobject self, jobject outputStream, jint compressionLevel) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->saveCompressedIndex(
+        std::make_shared<JavaOutputStream>(env, outputStream),
+        compressionLevel);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_savePackedIndex__Ljava_lang_String_2(
+    JNIEnv *env, jobject self, jstring filename) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->savePackedIndex(toString(env, filename));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_savePackedIndex__Ljava_io_OutputStream_2(
+    JNIEnv *env, jobject self, jobject outputStream) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->savePackedIndex(
+        std::make_shared<JavaOutputStream>(env, outputStream));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_saveFullPrecisionVectors(
+    JNIEnv *env, jobject self, jstring filename) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->saveFullPrecisionVectors(toString(env, filename));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_saveDelta__Ljava_lang_String_2(
+    JNIEnv *env, jobject self, jstring filename) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->saveDelta(toString(env, filename));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_saveDelta__Ljava_io_OutputStream_2(
+    JNIEnv *env, jobject self, jobject outputStream) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->saveDelta(std::make_shared<JavaOutputStream>(env, outputStream));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Load Index
 ////////////////////////////////////////////////////////////////////////////////////////////////////
+void Java_com_spotify_voyager_jni_Index_loadFullPrecisionVectors(
+    JNIEnv *env, jobject self, jstring filename, jboolean memoryMap) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->loadFullPrecisionVectors(toString(env, filename), memoryMap);
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_applyDelta__Ljava_lang_String_2(
+    JNIEnv *env, jobject self, jstring filename) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->applyDelta(toString(env, filename));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
+void Java_com_spotify_voyager_jni_Index_applyDelta__Ljava_io_InputStream_2(
+    JNIEnv *env, jobject self, jobject inputStream) {
+  try {
+    std::shared_ptr<Index> index = getHandle<Index>(env, self);
+    index->applyDelta(std::make_shared<JavaInputStream>(env, inputStream));
+  } catch (std::exception const &e) {
+    if (!env->ExceptionCheck()) {
+      env->ThrowNew(env->FindClass("java/lang/RuntimeException"), e.what());
+    }
+  }
+}
+
 // TODO: Convert these to static methods
 void Java_com_spotify_voyager_jni_Index_nativeLoadFromFileWithParameters(
     JNIEnv *env, jobject self, jstring filename, jobject spaceType,
     jint numDimensions, jobject storageDataType) {
   try {
-    auto inputStream =
-        std::make_shared<FileInputStream>(toString(env, filename));
+    std::shared_ptr<InputStream> inputStream = decompressIfNeeded(
+        std::make_shared<FileInputStream>(toString(env, filename)));
     std::unique_ptr<voyager::Metadata::V1> metadata =
         voyager::Metadata::loadFromStream(inputStream);
 
@@ -847,6 +1802,10 @@ void Java_com_spotify_voyager_jni_Index_nativeLoadFromFileWithParameters(
                                                    toSpaceType(env, spaceType),
                                                    numDimensions));
       break;
+    case StorageDataType::PQ:
+      throw std::domain_error(
+          "Product-quantized indices can only be loaded from files that "
+          "contain a metadata header.");
     }
   } catch (std::exception const &e) {
     if (!env->ExceptionCheck()) {
@@ -859,7 +1818,8 @@ void Java_com_spotify_voyager_jni_Index_nativeLoadFromInputStreamWithParameters(
     JNIEnv *env, jobject self, jobject jInputStream, jobject spaceType,
     jint numDimensions, jobject storageDataType) {
   try {
-    auto inputStream = std::make_shared<JavaInputStream>(env, jInputStream);
+    std::shared_ptr<InputStream> inputStream = decompressIfNeeded(
+        std::make_shared<JavaInputStream>(env, jInputStream));
     std::unique_ptr<voyager::Metadata::V1> metadata =
         voyager::Metadata::loadFromStream(inputStream);
 
@@ -911,6 +1871,10 @@ void Java_com_spotify_voyager_jni_Index_nativeLoadFromInputStreamWithParameters(
                                                    toSpaceType(env, spaceType),
                                                    numDimensions));
       break;
+    case StorageDataType::PQ:
+      throw std::domain_error(
+          "Product-quantized indices can only be loaded from files that "
+          "contain a metadata header.");
     }
   } catch (std::exception const &e) {
     if (!env->ExceptionCheck()) {
@@ -919,20 +1883,19 @@ void Java_com_spotify_voyager_jni_Index_nativeLoadFromInputStreamWithParameters(
   }
 }
 
-void Java_com_spotify_voyager_jni_Index_nativeLoadFromFile(JNIEnv *env,
-                                                           jobject self,
-                                                           jstring filename) {
+void Java_com_spotify_voyager_jni_Index_nativeLoadFromFile(
+    JNIEnv *env, jobject self, jstring filename, jboolean searchOnly) {
   try {
-    auto inputStream =
-        std::make_shared<FileInputStream>(toString(env, filename));
+    std::shared_ptr<InputStream> inputStream = decompressIfNeeded(
+        std::make_shared<FileInputStream>(toString(env, filename)));
     std::unique_ptr<voyager::Metadata::V1> metadata =
         voyager::Metadata::loadFromStream(inputStream);
 
     if (metadata) {
-      setHandle<Index>(
-          env, self,
-          loadTypedIndexFromMetadata(std::move(metadata), inputStream)
-              .release());
+      setHandle<Index>(env, self,
+                       loadTypedIndexFromMetadata(std::move(metadata),
+                                                  inputStream, searchOnly)
+                           .release());
     } else {
       throw std::domain_error(
           "Provided index file has no metadata and no index parameters were "
@@ -950,7 +1913,8 @@ void Java_com_spotify_voyager_jni_Index_nativeLoadFromFile(JNIEnv *env,
 void Java_com_spotify_voyager_jni_Index_nativeLoadFromInputStream(
     JNIEnv *env, jobject self, jobject jInputStream) {
   try {
-    auto inputStream = std::make_shared<JavaInputStream>(env, jInputStream);
+    std::shared_ptr<InputStream> inputStream = decompressIfNeeded(
+        std::make_shared<JavaInputStream>(env, jInputStream));
     std::unique_ptr<voyager::Metadata::V1> metadata =
         voyager::Metadata::loadFromStream(inputStream);
 
@@ -16,6 +16,17 @@ extern "C" {
 JNIEXPORT void JNICALL Java_com_spotify_voyager_jni_Index_nativeConstructor(
     JNIEnv *, jobject, jobject, jint, jlong, jlong, jlong, jlong, jobject);
 
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    nativeShardedConstructor
+ * Signature:
+ * (Lcom/spotify/voyager/jni/Index/SpaceType;ILcom/spotify/voyager/jni/Index/ShardingMode;IJJJJLcom/spotify/voyager/jni/Index/StorageDataType;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_nativeShardedConstructor(
+    JNIEnv *, jobject, jobject, jint, jobject, jint, jlong, jlong, jlong, jlong,
+    jobject);
+
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    nativeLoadFromFileWithParameters
@@ -29,10 +40,10 @@ Java_com_spotify_voyager_jni_Index_nativeLoadFromFileWithParameters(
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    nativeLoadFromFile
- * Signature: (Ljava/lang/String;)V
+ * Signature: (Ljava/lang/String;Z)V
  */
 JNIEXPORT void JNICALL Java_com_spotify_voyager_jni_Index_nativeLoadFromFile(
-    JNIEnv *, jobject, jstring);
+    JNIEnv *, jobject, jstring, jboolean);
 
 /*
  * Class:     com_spotify_voyager_jni_Index
@@ -61,6 +72,85 @@ Java_com_spotify_voyager_jni_Index_nativeLoadFromInputStream(JNIEnv *, jobject,
 JNIEXPORT void JNICALL
 Java_com_spotify_voyager_jni_Index_nativeDestructor(JNIEnv *, jobject);
 
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    setPrefetchDepth
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_setPrefetchDepth(JNIEnv *, jobject, jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    getPrefetchDepth
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL
+Java_com_spotify_voyager_jni_Index_getPrefetchDepth(JNIEnv *, jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    setEarlyTerminationPatience
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_setEarlyTerminationPatience(JNIEnv *,
+                                                               jobject, jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    getEarlyTerminationPatience
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL
+Java_com_spotify_voyager_jni_Index_getEarlyTerminationPatience(JNIEnv *,
+                                                               jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    setQueryCacheSize
+ * Signature: (I)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_setQueryCacheSize(JNIEnv *, jobject, jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    getQueryCacheSize
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL
+Java_com_spotify_voyager_jni_Index_getQueryCacheSize(JNIEnv *, jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    setAsyncBatchWindowMicroseconds
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_setAsyncBatchWindowMicroseconds(JNIEnv *,
+                                                                   jobject,
+                                                                   jlong);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    getAsyncBatchWindowMicroseconds
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL
+Java_com_spotify_voyager_jni_Index_getAsyncBatchWindowMicroseconds(JNIEnv *,
+                                                                   jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    calibrateEarlyTermination
+ * Signature: ([[FIFJ)I
+ */
+JNIEXPORT jint JNICALL
+Java_com_spotify_voyager_jni_Index_calibrateEarlyTermination(JNIEnv *, jobject,
+                                                             jobjectArray, jint,
+                                                             jfloat, jlong);
+
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    setEf
@@ -129,6 +219,26 @@ Java_com_spotify_voyager_jni_Index_saveIndex__Ljava_io_OutputStream_2(JNIEnv *,
                                                                       jobject,
                                                                       jobject);
 
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    saveIndex
+ * Signature: (Ljava/lang/String;I)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_saveIndex__Ljava_lang_String_2I(JNIEnv *,
+                                                                   jobject,
+                                                                   jstring,
+                                                                   jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    saveIndex
+ * Signature: (Ljava/io/OutputStream;I)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_saveIndex__Ljava_io_OutputStream_2I(
+    JNIEnv *, jobject, jobject, jint);
+
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    addItem
@@ -164,6 +274,25 @@ Java_com_spotify_voyager_jni_Index_addItems___3_3F_3JI(JNIEnv *, jobject,
                                                        jobjectArray, jlongArray,
                                                        jint);
 
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    bulkAddItems
+ * Signature: ([[FI)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_com_spotify_voyager_jni_Index_bulkAddItems___3_3FI(JNIEnv *, jobject,
+                                                        jobjectArray, jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    bulkAddItems
+ * Signature: ([[F[JI)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_com_spotify_voyager_jni_Index_bulkAddItems___3_3F_3JI(JNIEnv *, jobject,
+                                                           jobjectArray,
+                                                           jlongArray, jint);
+
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    getVector
@@ -196,6 +325,30 @@ JNIEXPORT jlongArray JNICALL Java_com_spotify_voyager_jni_Index_getIDs(JNIEnv *,
 JNIEXPORT jobject JNICALL Java_com_spotify_voyager_jni_Index_query___3FIJ(
     JNIEnv *, jobject, jfloatArray, jint, jlong);
 
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    query
+ * Signature: ([FIJ[J)Lcom/spotify/voyager/jni/Index/QueryResults;
+ */
+JNIEXPORT jobject JNICALL Java_com_spotify_voyager_jni_Index_query___3FIJ_3J(
+    JNIEnv *, jobject, jfloatArray, jint, jlong, jlongArray);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    query
+ * Signature: ([FIJ[JI)Lcom/spotify/voyager/jni/Index/QueryResults;
+ */
+JNIEXPORT jobject JNICALL Java_com_spotify_voyager_jni_Index_query___3FIJ_3JI(
+    JNIEnv *, jobject, jfloatArray, jint, jlong, jlongArray, jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    nativeQueryAsync
+ * Signature: ([FIJILjava/util/concurrent/CompletableFuture;)V
+ */
+JNIEXPORT void JNICALL Java_com_spotify_voyager_jni_Index_nativeQueryAsync(
+    JNIEnv *, jobject, jfloatArray, jint, jlong, jint, jobject);
+
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    query
@@ -206,6 +359,152 @@ Java_com_spotify_voyager_jni_Index_query___3_3FIIJ(JNIEnv *, jobject,
                                                    jobjectArray, jint, jint,
                                                    jlong);
 
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    query
+ * Signature: ([[FIIJ[J)[Lcom/spotify/voyager/jni/Index/QueryResults;
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_com_spotify_voyager_jni_Index_query___3_3FIIJ_3J(JNIEnv *, jobject,
+                                                      jobjectArray, jint, jint,
+                                                      jlong, jlongArray);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    query
+ * Signature: ([[FIIJ[JI)[Lcom/spotify/voyager/jni/Index/QueryResults;
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_com_spotify_voyager_jni_Index_query___3_3FIIJ_3JI(JNIEnv *, jobject,
+                                                       jobjectArray, jint, jint,
+                                                       jlong, jlongArray, jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    bruteForceQuery
+ * Signature: ([[FII[J)[Lcom/spotify/voyager/jni/Index/QueryResults;
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_com_spotify_voyager_jni_Index_bruteForceQuery(JNIEnv *, jobject,
+                                                   jobjectArray, jint, jint,
+                                                   jlongArray);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    groupedQuery
+ * Signature: ([FIJ[J)Lcom/spotify/voyager/jni/Index/QueryResults;
+ */
+JNIEXPORT jobject JNICALL
+Java_com_spotify_voyager_jni_Index_groupedQuery___3FIJ_3J(JNIEnv *, jobject,
+                                                          jfloatArray, jint,
+                                                          jlong, jlongArray);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    groupedQuery
+ * Signature: ([[FIIJ[J)[Lcom/spotify/voyager/jni/Index/QueryResults;
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_com_spotify_voyager_jni_Index_groupedQuery___3_3FIIJ_3J(JNIEnv *, jobject,
+                                                             jobjectArray, jint,
+                                                             jint, jlong,
+                                                             jlongArray);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    getDistances
+ * Signature: ([[F[[FI)[[F
+ */
+JNIEXPORT jobjectArray JNICALL Java_com_spotify_voyager_jni_Index_getDistances(
+    JNIEnv *, jobject, jobjectArray, jobjectArray, jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    queryIntoBuffers
+ * Signature:
+ * (Ljava/nio/FloatBuffer;IIIIJLjava/nio/LongBuffer;ILjava/nio/FloatBuffer;I)V
+ */
+JNIEXPORT void JNICALL Java_com_spotify_voyager_jni_Index_queryIntoBuffers(
+    JNIEnv *, jobject, jobject, jint, jint, jint, jint, jlong, jobject, jint,
+    jobject, jint);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    setStoreFullPrecisionVectors
+ * Signature: (Z)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_setStoreFullPrecisionVectors(JNIEnv *,
+                                                                jobject,
+                                                                jboolean);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    getStoreFullPrecisionVectors
+ * Signature: ()Z
+ */
+JNIEXPORT jboolean JNICALL
+Java_com_spotify_voyager_jni_Index_getStoreFullPrecisionVectors(JNIEnv *,
+                                                                jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    saveFullPrecisionVectors
+ * Signature: (Ljava/lang/String;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_saveFullPrecisionVectors(JNIEnv *, jobject,
+                                                            jstring);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    loadFullPrecisionVectors
+ * Signature: (Ljava/lang/String;Z)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_loadFullPrecisionVectors(JNIEnv *, jobject,
+                                                            jstring, jboolean);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    saveDelta
+ * Signature: (Ljava/lang/String;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_saveDelta__Ljava_lang_String_2(JNIEnv *,
+                                                                  jobject,
+                                                                  jstring);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    saveDelta
+ * Signature: (Ljava/io/OutputStream;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_saveDelta__Ljava_io_OutputStream_2(JNIEnv *,
+                                                                      jobject,
+                                                                      jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    applyDelta
+ * Signature: (Ljava/lang/String;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_applyDelta__Ljava_lang_String_2(JNIEnv *,
+                                                                   jobject,
+                                                                   jstring);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    applyDelta
+ * Signature: (Ljava/io/InputStream;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_applyDelta__Ljava_io_InputStream_2(JNIEnv *,
+                                                                      jobject,
+                                                                      jobject);
+
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    markDeleted
@@ -223,6 +522,25 @@ JNIEXPORT void JNICALL Java_com_spotify_voyager_jni_Index_markDeleted(JNIEnv *,
 JNIEXPORT void JNICALL
 Java_com_spotify_voyager_jni_Index_unmarkDeleted(JNIEnv *, jobject, jlong);
 
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    setGroups
+ * Signature: ([J[J)V
+ */
+JNIEXPORT void JNICALL Java_com_spotify_voyager_jni_Index_setGroups(JNIEnv *,
+                                                                   jobject,
+                                                                   jlongArray,
+                                                                   jlongArray);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    getGroup
+ * Signature: (J)J
+ */
+JNIEXPORT jlong JNICALL Java_com_spotify_voyager_jni_Index_getGroup(JNIEnv *,
+                                                                   jobject,
+                                                                   jlong);
+
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    resizeIndex
@@ -232,6 +550,64 @@ JNIEXPORT void JNICALL Java_com_spotify_voyager_jni_Index_resizeIndex(JNIEnv *,
                                                                       jobject,
                                                                       jlong);
 
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    optimizeLayout
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_optimizeLayout(JNIEnv *, jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    compact
+ * Signature: ()J
+ */
+JNIEXPORT jlong JNICALL Java_com_spotify_voyager_jni_Index_compact(JNIEnv *,
+                                                                  jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    packForSearch
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_packForSearch(JNIEnv *, jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    savePackedIndex
+ * Signature: (Ljava/lang/String;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_savePackedIndex__Ljava_lang_String_2(
+    JNIEnv *, jobject, jstring);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    savePackedIndex
+ * Signature: (Ljava/io/OutputStream;)V
+ */
+JNIEXPORT void JNICALL
+Java_com_spotify_voyager_jni_Index_savePackedIndex__Ljava_io_OutputStream_2(
+    JNIEnv *, jobject, jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    nativeGetStats
+ * Signature: ()[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_com_spotify_voyager_jni_Index_nativeGetStats(JNIEnv *, jobject);
+
+/*
+ * Class:     com_spotify_voyager_jni_Index
+ * Method:    resetStats
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_com_spotify_voyager_jni_Index_resetStats(JNIEnv *,
+                                                                    jobject);
+
 /*
  * Class:     com_spotify_voyager_jni_Index
  * Method:    getMaxElements
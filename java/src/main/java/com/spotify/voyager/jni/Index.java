@@ -27,7 +27,12 @@ import java.io.Closeable;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.nio.Buffer;
+import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
+import java.nio.LongBuffer;
 import java.util.Arrays;
+import java.util.concurrent.CompletableFuture;
 
 /**
  * A Voyager index, providing storage of floating-point vectors and the ability to efficiently
@@ -116,7 +121,30 @@ public class Index implements Closeable {
      * due to reduced floating-point precision. While confusing, the query results are still
      * correctly ordered.
      */
-    E4M3
+    E4M3,
+
+    /**
+     * Product quantization: each vector is split into equally-sized chunks of (roughly) four
+     * dimensions, each of which is stored as a one-byte index into a codebook learned from the
+     * first vectors added to the Index. Uses roughly 16x less memory than Float32, at the cost of
+     * reduced recall.
+     */
+    PQ
+  }
+
+  /** How an {@link Index} created by {@link Index#sharded} spreads its elements across shards. */
+  public enum ShardingMode {
+    /**
+     * Each element is stored in exactly one shard, chosen by its ID. Queries search every shard and
+     * merge their results.
+     */
+    Partitioned,
+
+    /**
+     * Every shard stores a full copy of the index, and each query is answered by a single replica
+     * (preferably one on the calling thread's NUMA node).
+     */
+    Replicated
   }
 
   /**
@@ -176,6 +204,101 @@ public class Index implements Closeable {
     }
   }
 
+  /**
+   * Counters describing the queries and insertions made on an {@link Index}, returned by {@link
+   * Index#getStats()}.
+   *
+   * <p>Latencies are recorded in histograms of {@link #NUM_LATENCY_BUCKETS} buckets: bucket 0
+   * counts latencies under one microsecond, bucket {@code i} counts latencies of at least {@code
+   * 2^(i-1)} and under {@code 2^i} microseconds, and the last bucket counts every latency too large
+   * for the others.
+   */
+  public static class Stats {
+    /** The number of buckets in each latency histogram. */
+    public static final int NUM_LATENCY_BUCKETS = 28;
+
+    /** The number of queries made on the index. */
+    public final long numQueries;
+
+    /** The number of vectors added to the index. */
+    public final long numInserts;
+
+    /** The number of distances computed while searching the graph (for queries or insertions). */
+    public final long distanceComputations;
+
+    /** The number of graph nodes whose neighbors were visited while searching the graph. */
+    public final long hops;
+
+    /** The number of times a search had to clear its list of visited nodes in full. */
+    public final long visitedListResets;
+
+    /** The total time spent waiting for locks held by other threads, in nanoseconds. */
+    public final long lockWaitNanoseconds;
+
+    /** The number of queries answered from the query cache. */
+    public final long queryCacheHits;
+
+    /** The number of queries looked up in the query cache without finding any results. */
+    public final long queryCacheMisses;
+
+    /** The total latency of every query, in nanoseconds. */
+    public final long queryLatencyNanoseconds;
+
+    /** The total latency of every insertion, in nanoseconds. */
+    public final long insertLatencyNanoseconds;
+
+    /** The number of queries whose latency fell into each histogram bucket. */
+    public final long[] queryLatencyCounts;
+
+    /** The number of insertions whose latency fell into each histogram bucket. */
+    public final long[] insertLatencyCounts;
+
+    /**
+     * Parse the stats returned from C++, which are laid out as: numQueries, numInserts,
+     * distanceComputations, hops, visitedListResets, lockWaitNanoseconds, queryCacheHits,
+     * queryCacheMisses, queryLatencyNanoseconds, insertLatencyNanoseconds, then each query latency
+     * bucket, then each insert latency bucket.
+     */
+    private Stats(long[] values) {
+      numQueries = values[0];
+      numInserts = values[1];
+      distanceComputations = values[2];
+      hops = values[3];
+      visitedListResets = values[4];
+      lockWaitNanoseconds = values[5];
+      queryCacheHits = values[6];
+      queryCacheMisses = values[7];
+      queryLatencyNanoseconds = values[8];
+      insertLatencyNanoseconds = values[9];
+      queryLatencyCounts = Arrays.copyOfRange(values, 10, 10 + NUM_LATENCY_BUCKETS);
+      insertLatencyCounts =
+          Arrays.copyOfRange(values, 10 + NUM_LATENCY_BUCKETS, 10 + 2 * NUM_LATENCY_BUCKETS);
+    }
+
+    /**
+     * The (exclusive) upper bound of the given latency histogram bucket, in microseconds, or {@link
+     * Long#MAX_VALUE} for the last bucket.
+     */
+    public static long getBucketUpperBoundMicroseconds(int bucket) {
+      if (bucket >= NUM_LATENCY_BUCKETS - 1) {
+        return Long.MAX_VALUE;
+      }
+      return 1L << bucket;
+    }
+
+    public String toString() {
+      return ("Stats(numQueries="
+          + numQueries
+          + ", numInserts="
+          + numInserts
+          + ", distanceComputations="
+          + distanceComputations
+          + ", hops="
+          + hops
+          + ")");
+    }
+  }
+
   static {
     System.load(JniLibExtractor.extractBinaries("voyager"));
   }
@@ -258,8 +381,30 @@ public class Index implements Closeable {
    *     additional arguments to be provided.
    */
   public static Index load(String filename) {
+    return load(filename, false);
+  }
+
+  /**
+   * Load a Voyager index file and create a new {@link Index} initialized with the data in that
+   * file, optionally in search-only mode.
+   *
+   * <p>Search-only indices cannot be modified, but are memory-mapped directly from the provided
+   * file where the platform supports it. This allows the index to be loaded almost instantly, to
+   * read pages from disk only as they are needed, and to share physical memory with other
+   * processes that load the same file. Search-only indices do not keep track of the IDs they
+   * contain, so only {@link #query} and related read-only methods are supported.
+   *
+   * @param filename A filename to load.
+   * @param searchOnly If true, load the index in read-only, memory-mapped mode.
+   * @return An {@link Index} whose contents have been initialized with the data provided by the
+   *     file.
+   * @throws RuntimeException if the index cannot be loaded from the file, the file contains invalid
+   *     data, or the file contains an older version of the Voyager file format that requires
+   *     additional arguments to be provided.
+   */
+  public static Index load(String filename, boolean searchOnly) {
     Index index = new Index();
-    index.nativeLoadFromFile(filename);
+    index.nativeLoadFromFile(filename, searchOnly);
     return index;
   }
 
@@ -306,6 +451,53 @@ public class Index implements Closeable {
     return index;
   }
 
+  /**
+   * Create a new, empty {@link Index} made up of {@code numShards} smaller indices ("shards"), each
+   * placed on one of this machine's NUMA nodes. Each shard's memory is bound to its node, and its
+   * work runs on threads pinned to that node's CPUs, so that queries avoid loading vectors from
+   * memory attached to another socket. On machines without NUMA, shards use the same memory and
+   * threads as any other {@link Index}.
+   *
+   * <p>The returned index supports the same methods as any other {@link Index}. Replicated indices
+   * are saved as (and can be loaded from) regular index files; partitioned indices cannot be saved.
+   *
+   * @param space The space type to use when storing and comparing vectors.
+   * @param numDimensions The number of dimensions per vector.
+   * @param mode Whether to partition elements across shards, or replicate every element to every
+   *     shard.
+   * @param numShards The number of shards to create, or zero to create one per NUMA node.
+   * @param indexM Controls the degree of interconnectedness between vectors in each shard.
+   * @param efConstruction Controls index quality, affecting the speed of {@code addItem} calls.
+   * @param randomSeed A random seed to use when initializing each shard's internal data structures.
+   * @param maxElements The expected number of elements in the whole index. Partitioned indices
+   *     divide this capacity among their shards.
+   * @param storageDataType The datatype each shard uses to store vectors.
+   * @return A new, empty sharded {@link Index}.
+   */
+  public static Index sharded(
+      SpaceType space,
+      int numDimensions,
+      ShardingMode mode,
+      int numShards,
+      long indexM,
+      long efConstruction,
+      long randomSeed,
+      long maxElements,
+      StorageDataType storageDataType) {
+    Index index = new Index();
+    index.nativeShardedConstructor(
+        space,
+        numDimensions,
+        mode,
+        numShards,
+        indexM,
+        efConstruction,
+        randomSeed,
+        maxElements,
+        storageDataType);
+    return index;
+  }
+
   /**
    * Close this {@link Index} and release any memory held by it. Note that this method must be
    * called to release the memory backing this {@link Index}; failing to do so may cause a memory
@@ -339,10 +531,21 @@ public class Index implements Closeable {
       long maxElements,
       StorageDataType storageDataType);
 
+  private native void nativeShardedConstructor(
+      SpaceType space,
+      int numDimensions,
+      ShardingMode mode,
+      int numShards,
+      long indexM,
+      long efConstruction,
+      long randomSeed,
+      long maxElements,
+      StorageDataType storageDataType);
+
   private native void nativeLoadFromFileWithParameters(
       String filename, SpaceType space, int numDimensions, StorageDataType storageDataType);
 
-  private native void nativeLoadFromFile(String filename);
+  private native void nativeLoadFromFile(String filename, boolean searchOnly);
 
   private native void nativeLoadFromInputStreamWithParameters(
       InputStream inputStream, SpaceType space, int numDimensions, StorageDataType storageDataType);
@@ -367,6 +570,95 @@ public class Index implements Closeable {
    */
   public native int getEf();
 
+  /**
+   * Set how many neighbors ahead of the one currently being compared have their vectors prefetched
+   * from memory while searching this {@link Index}. Larger values hide more memory latency on large
+   * indices, at the cost of some wasted memory bandwidth.
+   *
+   * @param depth The number of neighbors to prefetch, or 0 to disable prefetching.
+   */
+  public native void setPrefetchDepth(int depth);
+
+  /**
+   * Get how many neighbors ahead of the one currently being compared have their vectors prefetched
+   * from memory while searching this {@link Index}.
+   *
+   * @return The current prefetch depth.
+   */
+  public native int getPrefetchDepth();
+
+  /**
+   * Set how many nodes in a row a query may visit without finding a better candidate before it
+   * stops searching early, even if it has not yet used all of its EF budget. Easy queries converge
+   * quickly and stop early, while hard queries keep improving and use their whole budget.
+   *
+   * @param patience The number of nodes to visit without improvement, or 0 (the default) to disable
+   *     early termination.
+   * @see #calibrateEarlyTermination(float[][], int, float, long)
+   */
+  public native void setEarlyTerminationPatience(int patience);
+
+  /**
+   * Get how many nodes in a row a query may visit without finding a better candidate before it
+   * stops searching early.
+   *
+   * @return The current early termination patience, or 0 if early termination is disabled.
+   */
+  public native int getEarlyTerminationPatience();
+
+  /**
+   * Cache the results of up to {@code maxEntries} recent unfiltered queries, so that repeated
+   * queries for the same vector (with the same parameters) are answered without searching the
+   * index. Cached results are discarded whenever the index changes. Cache hits and misses are
+   * counted in {@link #getStats()}.
+   *
+   * @param maxEntries The maximum number of query results to cache, or 0 (the default) to disable
+   *     the cache.
+   */
+  public native void setQueryCacheSize(int maxEntries);
+
+  /**
+   * Get the maximum number of query results cached by this index.
+   *
+   * @return The maximum number of cached query results, or 0 if the query cache is disabled.
+   */
+  public native int getQueryCacheSize();
+
+  /**
+   * Set how long a query submitted with {@link #queryAsync} may wait for others to be searched
+   * along with it. Longer windows allow for larger batches (and higher throughput) at the expense
+   * of latency.
+   *
+   * @param microseconds The maximum time a query may wait before being searched, in microseconds.
+   *     Defaults to 100; 0 searches every query as soon as it is submitted.
+   */
+  public native void setAsyncBatchWindowMicroseconds(long microseconds);
+
+  /**
+   * Get how long a query submitted with {@link #queryAsync} may wait for others to be searched
+   * along with it.
+   *
+   * @return The maximum time a query may wait before being searched, in microseconds.
+   */
+  public native long getAsyncBatchWindowMicroseconds();
+
+  /**
+   * Choose and set the smallest early termination patience at which queries still find at least
+   * {@code targetRecall} of the neighbors they would find without early termination. Other
+   * queries may run on this {@link Index} while it is being calibrated.
+   *
+   * @param queryVectors A representative sample of the queries this {@link Index} will receive.
+   * @param k The number of neighbors that will be requested from each query.
+   * @param targetRecall The fraction (between 0 and 1) of each query's neighbors that must still be
+   *     found once early termination is enabled.
+   * @param queryEf The EF that will be passed to {@link #query(float[][], int, int, long)}, which
+   *     becomes the budget for the hardest queries, or -1 to use this index's default EF.
+   * @return The chosen patience, or 0 (disabling early termination) if {@code targetRecall} is
+   *     only reached by a patience that never stops a query early.
+   */
+  public native int calibrateEarlyTermination(
+      float[][] queryVectors, int k, float targetRecall, long queryEf);
+
   /**
    * Get the {@link Index.SpaceType} that this {@link Index} uses to store and compare vectors.
    *
@@ -420,6 +712,29 @@ public class Index implements Closeable {
    */
   public native void saveIndex(OutputStream outputStream);
 
+  /**
+   * Save this Index to a file at the provided filename, compressed with zstd at the given level
+   * (from 1 to 22). Compressed indices are decompressed automatically by {@code Index.load(...)},
+   * but can't be memory-mapped.
+   *
+   * @param pathToIndex The output filename to write to.
+   * @param compressionLevel The zstd compression level to use.
+   * @throws RuntimeException if this build of Voyager does not support compression.
+   */
+  public native void saveIndex(String pathToIndex, int compressionLevel);
+
+  /**
+   * Save this Index to the provided output stream, compressed with zstd at the given level (from 1
+   * to 22). The stream will not be closed automatically. The data written to the stream can be
+   * reloaded by using {@code Index.load(...)}.
+   *
+   * @param outputStream The output stream to write to. This stream will not be closed
+   *     automatically.
+   * @param compressionLevel The zstd compression level to use.
+   * @throws RuntimeException if this build of Voyager does not support compression.
+   */
+  public native void saveIndex(OutputStream outputStream, int compressionLevel);
+
   /**
    * Returns the contents of this index as an array of bytes. The resulting bytes will contain the
    * same data as if this index was serialized to disk and then read back into memory again.
@@ -486,6 +801,41 @@ public class Index implements Closeable {
    */
   public native long[] addItems(float[][] vectors, long[] ids, int numThreads);
 
+  /**
+   * Add a large batch of new items (vectors) to this {@link Index}, building the graph in bulk.
+   *
+   * <p>Unlike {@link #addItems(float[][], int)}, vectors are inserted in batches that are linked
+   * to the graph without any per-element locking. This scales to many more threads, and builds
+   * exactly the same graph regardless of the number of threads used. This index can't be queried
+   * while a bulk addition is in progress.
+   *
+   * @param vectors The vectors to add to the index.
+   * @param numThreads The number of threads to use when building the graph. If -1 (the default),
+   *     the number of CPUs available on the current machine will be used.
+   * @return The auto-generated {@link long} IDs that were assigned to the provided vectors, in the
+   *     same order as the provided vectors.
+   * @throws RuntimeException If any of the provided vectors do not contain exactly {@link
+   *     Index#getNumDimensions()} dimensions.
+   */
+  public native long[] bulkAddItems(float[][] vectors, int numThreads);
+
+  /**
+   * Add a large batch of new items (vectors) to this {@link Index} with the provided identifiers,
+   * building the graph in bulk. See {@link #bulkAddItems(float[][], int)}.
+   *
+   * @param vectors The vectors to add to the index.
+   * @param ids The 64-bit identifiers that correspond with each of the provided vectors. None of
+   *     these identifiers may already be present in the index.
+   * @param numThreads The number of threads to use when building the graph. If -1 (the default),
+   *     the number of CPUs available on the current machine will be used.
+   * @return The {@link long} IDs that were assigned to the provided vectors, in the same order as
+   *     the provided vectors.
+   * @throws RuntimeException If any of the provided vectors do not contain exactly {@link
+   *     Index#getNumDimensions()} dimensions, if the list of IDs does not have the same length as
+   *     the list of provided vectors, or if any ID is already present in the index.
+   */
+  public native long[] bulkAddItems(float[][] vectors, long[] ids, int numThreads);
+
   /**
    * Get the vector for the provided identifier.
    *
@@ -577,6 +927,441 @@ public class Index implements Closeable {
    */
   public native QueryResults[] query(float[][] queryVectors, int k, int numThreads, long queryEf);
 
+  /**
+   * Query this {@link Index} for approximate nearest neighbors of a single query vector, only
+   * returning items whose IDs are in the provided allow-list.
+   *
+   * <p>Items that are not in {@code allowedIds} are still traversed while searching, but are never
+   * returned. This is much more efficient than requesting extra neighbors and filtering the results
+   * afterwards.
+   *
+   * @param queryVector A query vector to use for searching.
+   * @param k The number of nearest neighbors to return.
+   * @param queryEf The per-query "ef" value to use. Larger values produce more accurate results at
+   *     the expense of query time.
+   * @param allowedIds The IDs of the items that may be returned, or {@code null} to allow all items.
+   * @return A {@link QueryResults} object, containing the neighbors found that are (approximately)
+   *     nearest to the query vector.
+   * @throws RecallException if fewer than {@code k} allowed results can be found in the index.
+   */
+  public native QueryResults query(float[] queryVector, int k, long queryEf, long[] allowedIds);
+
+  /**
+   * Query this {@link Index} for approximate nearest neighbors of multiple query vectors, only
+   * returning items whose IDs are in the provided allow-list.
+   *
+   * <p>Items that are not in {@code allowedIds} are still traversed while searching, but are never
+   * returned. This is much more efficient than requesting extra neighbors and filtering the results
+   * afterwards.
+   *
+   * @param queryVectors The query vectors to use for searching.
+   * @param k The number of nearest neighbors to return for each query vector
+   * @param numThreads The number of threads to use when searching. If -1, all available CPU cores
+   *     will be used.
+   * @param queryEf The per-query "ef" value to use. Larger values produce more accurate results at
+   *     the expense of query time.
+   * @param allowedIds The IDs of the items that may be returned, or {@code null} to allow all items.
+   * @return An array of {@link QueryResults} objects, each containing the neighbors found that are
+   *     (approximately) nearest to the corresponding query vector. The returned list of {@link
+   *     QueryResults} will contain the same number of elements as {@code queryVectors}.
+   * @throws RecallException if fewer than {@code k} allowed results can be found in the index for
+   *     one or more queries.
+   */
+  public native QueryResults[] query(
+      float[][] queryVectors, int k, int numThreads, long queryEf, long[] allowedIds);
+
+  /**
+   * Query this {@link Index} for approximate nearest neighbors of a single query vector,
+   * re-ranking the best {@code rerankK} candidates found against their full-precision vectors.
+   *
+   * <p>Re-ranking only has an effect if this {@link Index} stores full-precision vectors (see
+   * {@link #setStoreFullPrecisionVectors}) and {@code rerankK} is greater than {@code k}.
+   *
+   * @param queryVector A query vector to use for searching.
+   * @param k The number of nearest neighbors to return.
+   * @param queryEf The per-query "ef" value to use. Larger values produce more accurate results at
+   *     the expense of query time.
+   * @param allowedIds The IDs of the items that may be returned, or {@code null} to allow all items.
+   * @param rerankK The number of candidates to re-rank by their exact distance to the query.
+   * @return A {@link QueryResults} object, containing the neighbors found that are (approximately)
+   *     nearest to the query vector.
+   * @throws RecallException if fewer than {@code k} allowed results can be found in the index.
+   */
+  public native QueryResults query(
+      float[] queryVector, int k, long queryEf, long[] allowedIds, int rerankK);
+
+  /**
+   * Query this {@link Index} for approximate nearest neighbors of multiple query vectors,
+   * re-ranking the best {@code rerankK} candidates found for each against their full-precision
+   * vectors.
+   *
+   * <p>Re-ranking only has an effect if this {@link Index} stores full-precision vectors (see
+   * {@link #setStoreFullPrecisionVectors}) and {@code rerankK} is greater than {@code k}.
+   *
+   * @param queryVectors The query vectors to use for searching.
+   * @param k The number of nearest neighbors to return for each query vector
+   * @param numThreads The number of threads to use when searching. If -1, all available CPU cores
+   *     will be used.
+   * @param queryEf The per-query "ef" value to use. Larger values produce more accurate results at
+   *     the expense of query time.
+   * @param allowedIds The IDs of the items that may be returned, or {@code null} to allow all items.
+   * @param rerankK The number of candidates to re-rank by their exact distance to each query.
+   * @return An array of {@link QueryResults} objects, each containing the neighbors found that are
+   *     (approximately) nearest to the corresponding query vector.
+   * @throws RecallException if fewer than {@code k} allowed results can be found in the index for
+   *     one or more queries.
+   */
+  public native QueryResults[] query(
+      float[][] queryVectors,
+      int k,
+      int numThreads,
+      long queryEf,
+      long[] allowedIds,
+      int rerankK);
+
+  /**
+   * Query this {@link Index} for approximate nearest neighbors of a single query vector without
+   * blocking the calling thread.
+   *
+   * <p>Queries submitted at around the same time (within {@link
+   * #getAsyncBatchWindowMicroseconds()} of one another, from any number of threads) are searched
+   * together as one batch on this index's native worker threads, which is more efficient than
+   * searching each separately.
+   *
+   * <p>The returned future is completed on one of those worker threads, so any dependent stages
+   * that do significant work (or that close this index) should be run elsewhere with one of
+   * {@link CompletableFuture}'s {@code *Async} methods.
+   *
+   * @param queryVector A query vector to use for searching.
+   * @param k The number of nearest neighbors to return.
+   * @param queryEf The per-query "ef" value to use. Larger values produce more accurate results at
+   *     the expense of query time.
+   * @return A {@link CompletableFuture} of the {@link QueryResults} for this query, which
+   *     completes exceptionally with a {@link RecallException} if fewer than {@code k} results can
+   *     be found in the index.
+   */
+  public CompletableFuture<QueryResults> queryAsync(float[] queryVector, int k, long queryEf) {
+    return queryAsync(queryVector, k, queryEf, 0);
+  }
+
+  /**
+   * Query this {@link Index} for approximate nearest neighbors of a single query vector without
+   * blocking the calling thread, re-ranking the best {@code rerankK} candidates found against
+   * their full-precision vectors. See {@link #queryAsync(float[], int, long)}.
+   *
+   * @param queryVector A query vector to use for searching.
+   * @param k The number of nearest neighbors to return.
+   * @param queryEf The per-query "ef" value to use. Larger values produce more accurate results at
+   *     the expense of query time.
+   * @param rerankK The number of candidates to re-rank by their exact distance to the query.
+   * @return A {@link CompletableFuture} of the {@link QueryResults} for this query, which
+   *     completes exceptionally with a {@link RecallException} if fewer than {@code k} results can
+   *     be found in the index.
+   */
+  public CompletableFuture<QueryResults> queryAsync(
+      float[] queryVector, int k, long queryEf, int rerankK) {
+    CompletableFuture<QueryResults> future = new CompletableFuture<>();
+    nativeQueryAsync(queryVector, k, queryEf, rerankK, future);
+    return future;
+  }
+
+  private native void nativeQueryAsync(
+      float[] queryVector,
+      int k,
+      long queryEf,
+      int rerankK,
+      CompletableFuture<QueryResults> future);
+
+  /**
+   * Find the exact nearest neighbors of multiple query vectors, by comparing each of them against
+   * every vector in this {@link Index} rather than searching its graph.
+   *
+   * <p>Vectors are compared as stored in the index (i.e.: after any conversion to a
+   * lower-precision {@link StorageDataType}), so the results are those that {@link
+   * #query(float[][], int, int)} would return with perfect recall. This takes time proportional to
+   * the size of the index, so is best suited to small indices or to computing ground truth.
+   *
+   * @param queryVectors The query vectors to use for searching.
+   * @param k The number of nearest neighbors to return for each query vector
+   * @param numThreads The number of threads to use when searching. If -1, all available CPU cores
+   *     will be used.
+   * @return An array of {@link QueryResults} objects, each containing the neighbors nearest to the
+   *     corresponding query vector.
+   * @throws RecallException if the index contains fewer than {@code k} items.
+   */
+  public QueryResults[] bruteForceQuery(float[][] queryVectors, int k, int numThreads) {
+    return bruteForceQuery(queryVectors, k, numThreads, null);
+  }
+
+  /**
+   * Find the exact nearest neighbors of multiple query vectors that are among the given IDs. See
+   * {@link #bruteForceQuery(float[][], int, int)}.
+   *
+   * @param queryVectors The query vectors to use for searching.
+   * @param k The number of nearest neighbors to return for each query vector
+   * @param numThreads The number of threads to use when searching. If -1, all available CPU cores
+   *     will be used.
+   * @param allowedIds The IDs of the items that may be returned, or {@code null} to allow all items.
+   * @return An array of {@link QueryResults} objects, each containing the neighbors nearest to the
+   *     corresponding query vector.
+   * @throws RecallException if fewer than {@code k} allowed items exist in the index.
+   */
+  public native QueryResults[] bruteForceQuery(
+      float[][] queryVectors, int k, int numThreads, long[] allowedIds);
+
+  /**
+   * Query this {@link Index} for the approximate nearest groups (see {@link #setGroups}) to a
+   * single query vector, rather than its nearest neighbors. Each group is represented by the ID of
+   * (and distance to) its nearest item, so at most one ID from each group is returned.
+   *
+   * <p>Searches continue until {@code queryEf} distinct groups have been found, which is far
+   * cheaper than requesting extra neighbors and removing duplicates afterwards.
+   *
+   * @param queryVector A query vector to use for searching.
+   * @param k The number of groups to return.
+   * @param queryEf The number of distinct groups to search for, or -1 to use {@link #getEf()}.
+   * @return A {@link QueryResults} object, containing the nearest item of each of the groups found
+   *     that are (approximately) nearest to the query vector.
+   * @throws RecallException if fewer than {@code k} groups can be found in the index.
+   */
+  public QueryResults groupedQuery(float[] queryVector, int k, long queryEf) {
+    return groupedQuery(queryVector, k, queryEf, null);
+  }
+
+  /**
+   * Query this {@link Index} for the approximate nearest groups to a single query vector, only
+   * returning items whose IDs are in the provided allow-list. See {@link #groupedQuery(float[],
+   * int, long)}.
+   *
+   * @param queryVector A query vector to use for searching.
+   * @param k The number of groups to return.
+   * @param queryEf The number of distinct groups to search for, or -1 to use {@link #getEf()}.
+   * @param allowedIds The IDs of the items that may be returned, or {@code null} to allow all items.
+   * @return A {@link QueryResults} object, containing the nearest item of each of the groups found
+   *     that are (approximately) nearest to the query vector.
+   * @throws RecallException if fewer than {@code k} groups can be found in the index.
+   */
+  public native QueryResults groupedQuery(
+      float[] queryVector, int k, long queryEf, long[] allowedIds);
+
+  /**
+   * Query this {@link Index} for the approximate nearest groups to each of multiple query vectors.
+   * See {@link #groupedQuery(float[], int, long)}.
+   *
+   * @param queryVectors The query vectors to use for searching.
+   * @param k The number of groups to return for each query vector.
+   * @param numThreads The number of threads to use when searching. If -1, all available CPU cores
+   *     will be used.
+   * @param queryEf The number of distinct groups to search for, or -1 to use {@link #getEf()}.
+   * @return An array of {@link QueryResults} objects, one per query vector.
+   * @throws RecallException if fewer than {@code k} groups can be found for one or more queries.
+   */
+  public QueryResults[] groupedQuery(float[][] queryVectors, int k, int numThreads, long queryEf) {
+    return groupedQuery(queryVectors, k, numThreads, queryEf, null);
+  }
+
+  /**
+   * Query this {@link Index} for the approximate nearest groups to each of multiple query vectors,
+   * only returning items whose IDs are in the provided allow-list. See {@link
+   * #groupedQuery(float[], int, long)}.
+   *
+   * @param queryVectors The query vectors to use for searching.
+   * @param k The number of groups to return for each query vector.
+   * @param numThreads The number of threads to use when searching. If -1, all available CPU cores
+   *     will be used.
+   * @param queryEf The number of distinct groups to search for, or -1 to use {@link #getEf()}.
+   * @param allowedIds The IDs of the items that may be returned, or {@code null} to allow all items.
+   * @return An array of {@link QueryResults} objects, one per query vector.
+   * @throws RecallException if fewer than {@code k} groups can be found for one or more queries.
+   */
+  public native QueryResults[] groupedQuery(
+      float[][] queryVectors, int k, int numThreads, long queryEf, long[] allowedIds);
+
+  /**
+   * Compute the distance between every pair of the given query and target vectors, using this
+   * {@link Index}'s space and storage data type.
+   *
+   * @param queries The query vectors, which must share the dimensionality of this index.
+   * @param targets The target vectors, which must share the dimensionality of this index.
+   * @param numThreads The number of threads to use. If -1, all available CPU cores will be used.
+   * @return An array with one row per query, holding the distance from that query to each target.
+   */
+  public native float[][] getDistances(float[][] queries, float[][] targets, int numThreads);
+
+  /**
+   * Query this {@link Index} for approximate nearest neighbors of many query vectors at once,
+   * reading the queries from and writing the results to direct buffers. Unlike {@link
+   * #query(float[][], int, int, long)}, no data is copied between Java and native code and no
+   * objects are allocated per query, which makes this method much faster for large batches.
+   *
+   * <p>All buffers must be direct (i.e.: allocated with {@link
+   * java.nio.ByteBuffer#allocateDirect(int)}) and use the platform's native byte order. The
+   * queries are read from the remaining contents of {@code queryVectors}, stored one after another
+   * with {@link #getNumDimensions()} values each. The {@code k} results for the {@code i}th query
+   * are written, in ascending order of distance, starting {@code i * k} values after the current
+   * position of {@code labels} and {@code distances}. The positions of the buffers are not changed.
+   *
+   * @param queryVectors A direct buffer containing the query vectors to use for searching.
+   * @param k The number of nearest neighbors to return for each query vector.
+   * @param numThreads The number of threads to use when searching. If -1, all available CPU cores
+   *     will be used.
+   * @param queryEf The per-query "ef" value to use. Larger values produce more accurate results at
+   *     the expense of query time.
+   * @param labels A direct buffer with room for {@code k} labels per query vector.
+   * @param distances A direct buffer with room for {@code k} distances per query vector.
+   * @return The number of query vectors that were searched.
+   * @throws IllegalArgumentException if any buffer is not direct, is not in native byte order, or
+   *     is too small.
+   * @throws RecallException if fewer than {@code k} results can be found in the index for one or
+   *     more queries.
+   */
+  public int query(
+      FloatBuffer queryVectors,
+      int k,
+      int numThreads,
+      long queryEf,
+      LongBuffer labels,
+      FloatBuffer distances) {
+    checkDirectBuffer(queryVectors, queryVectors.order(), "queryVectors");
+    checkDirectBuffer(labels, labels.order(), "labels");
+    checkDirectBuffer(distances, distances.order(), "distances");
+
+    int numDimensions = getNumDimensions();
+    if (queryVectors.remaining() % numDimensions != 0) {
+      throw new IllegalArgumentException(
+          "queryVectors contains "
+              + queryVectors.remaining()
+              + " values, which is not a multiple of this index's "
+              + numDimensions
+              + " dimensions.");
+    }
+
+    int numQueries = queryVectors.remaining() / numDimensions;
+    long numResults = (long) numQueries * k;
+    if (labels.remaining() < numResults || distances.remaining() < numResults) {
+      throw new IllegalArgumentException(
+          "labels and distances must each have room for "
+              + numResults
+              + " results ("
+              + k
+              + " for each of "
+              + numQueries
+              + " queries).");
+    }
+
+    queryIntoBuffers(
+        queryVectors,
+        queryVectors.position(),
+        numQueries,
+        k,
+        numThreads,
+        queryEf,
+        labels,
+        labels.position(),
+        distances,
+        distances.position());
+    return numQueries;
+  }
+
+  private static void checkDirectBuffer(Buffer buffer, ByteOrder order, String name) {
+    if (!buffer.isDirect()) {
+      throw new IllegalArgumentException(name + " must be a direct buffer.");
+    }
+    if (order != ByteOrder.nativeOrder()) {
+      throw new IllegalArgumentException(
+          name + " must use the native byte order (" + ByteOrder.nativeOrder() + ").");
+    }
+  }
+
+  private native void queryIntoBuffers(
+      FloatBuffer queryVectors,
+      int queryVectorsOffset,
+      int numQueries,
+      int k,
+      int numThreads,
+      long queryEf,
+      LongBuffer labels,
+      int labelsOffset,
+      FloatBuffer distances,
+      int distancesOffset);
+
+  /**
+   * Keep a full-precision (32-bit float) copy of each vector added to this {@link Index} from now
+   * on, outside of the graph, so that queries can re-rank their best candidates by exact distance.
+   * These vectors are not written by {@link #saveIndex}; use {@link #saveFullPrecisionVectors}.
+   *
+   * @param enabled Whether to store full-precision copies of newly-added vectors.
+   */
+  public native void setStoreFullPrecisionVectors(boolean enabled);
+
+  /**
+   * Get whether full-precision copies of newly-added vectors are being stored.
+   *
+   * @return Whether full-precision copies of newly-added vectors are being stored.
+   */
+  public native boolean getStoreFullPrecisionVectors();
+
+  /**
+   * Save this {@link Index}'s full-precision vectors to a file at the provided filename, separately
+   * from the index itself.
+   *
+   * @param filename The output filename to write to.
+   */
+  public native void saveFullPrecisionVectors(String filename);
+
+  /**
+   * Load full-precision vectors previously saved with {@link #saveFullPrecisionVectors} into this
+   * {@link Index}, replacing any it already contains.
+   *
+   * @param filename The filename to read from.
+   * @param memoryMap If true, the vectors are memory-mapped rather than read into memory, and are
+   *     only paged in from disk as queries re-rank against them.
+   */
+  public native void loadFullPrecisionVectors(String filename, boolean memoryMap);
+
+  /**
+   * Save only the elements added, updated or deleted since this {@link Index} was last saved (or
+   * loaded) in full, to a file at the provided filename. Applying the result with {@link
+   * #applyDelta} to a copy of that full save brings the copy up to date with this index, while
+   * writing much less data than {@link #saveIndex} would.
+   *
+   * <p>Each delta contains every change since the last full save, so only the most recent delta
+   * needs to be applied. Compacting an index changes every element, and so makes its next delta as
+   * large as a full save. The full-precision vectors of changed elements are included, and are
+   * applied to copies that have loaded full-precision vectors of their own.
+   *
+   * @param pathToDelta The output filename to write to.
+   */
+  public native void saveDelta(String pathToDelta);
+
+  /**
+   * Save only the elements changed since this {@link Index} was last saved (or loaded) in full to
+   * the provided output stream. See {@link #saveDelta(String)}.
+   *
+   * @param outputStream The output stream to write to. This stream will not be closed
+   *     automatically.
+   */
+  public native void saveDelta(OutputStream outputStream);
+
+  /**
+   * Apply a delta written by {@link #saveDelta} to this {@link Index}, which must hold the contents
+   * of the full save that the delta was taken relative to. If applying the delta fails partway
+   * through, this index may be left partially updated and should be reloaded.
+   *
+   * @param pathToDelta The filename to read from.
+   * @throws RuntimeException If the delta was saved from an incompatible index.
+   */
+  public native void applyDelta(String pathToDelta);
+
+  /**
+   * Apply a delta written by {@link #saveDelta} from the provided input stream. See {@link
+   * #applyDelta(String)}.
+   *
+   * @param inputStream The input stream to read from. This stream will not be closed automatically.
+   * @throws RuntimeException If the delta was saved from an incompatible index.
+   */
+  public native void applyDelta(InputStream inputStream);
+
   /**
    * Mark an element of the index as deleted. Deleted elements will be skipped when querying, but
    * will still be present in the index.
@@ -594,6 +1379,26 @@ public class Index implements Closeable {
    */
   public native void unmarkDeleted(long label);
 
+  /**
+   * Assign each of the given IDs to the corresponding group (i.e.: the item that several of this
+   * index's vectors belong to), so that {@link #groupedQuery(float[], int, long)} returns at most
+   * one ID per group. IDs that have not been assigned a group are each in a group of their own.
+   *
+   * <p>Group assignments are saved along with this {@link Index}, and are included in deltas.
+   *
+   * @param ids The IDs of items in this index.
+   * @param groups The group of each ID, in the same order as {@code ids}.
+   */
+  public native void setGroups(long[] ids, long[] groups);
+
+  /**
+   * Get the group that an ID belongs to (see {@link #setGroups}).
+   *
+   * @param id The ID of an item in this index.
+   * @return The ID's group, or the ID itself if it has not been assigned a group.
+   */
+  public native long getGroup(long id);
+
   /**
    * Change the maximum number of elements currently storable by this {@link Index}. This operation
    * reallocates the memory used by the index and can be quite slow, so it may be useful to set the
@@ -603,6 +1408,76 @@ public class Index implements Closeable {
    */
   public native void resizeIndex(long newSize);
 
+  /**
+   * Reorder the elements of this {@link Index} in memory so that elements that are neighbors in
+   * the graph are stored close to one another, which reduces cache misses and can speed up queries
+   * on large indices. This does not change the results of any query, and the reordered index is
+   * saved in the usual format.
+   *
+   * @throws RuntimeException If this {@link Index} was loaded in search-only mode.
+   */
+  public native void optimizeLayout();
+
+  /**
+   * Permanently remove every element marked as deleted (with {@link #markDeleted(long)}) from this
+   * {@link Index}. Elements that were connected to deleted elements are reconnected to their
+   * surviving neighbors, and the space used by deleted elements is reused by elements added
+   * afterwards. Queries on indices with many deleted elements become faster after compaction.
+   *
+   * <p>Removed elements can no longer be restored with {@link #unmarkDeleted(long)}. Queries and
+   * additions are blocked while the index is being compacted.
+   *
+   * @return The number of elements removed from this {@link Index}.
+   * @throws RuntimeException If this {@link Index} was loaded in search-only mode.
+   */
+  public native long compact();
+
+  /**
+   * Store this {@link Index} in a smaller, read-only form for serving: each element's links are
+   * stored without padding, and its ID takes 4 bytes rather than 8 if every ID fits. Query results
+   * are unchanged and the index is saved in the usual format, but as in search-only mode, it can
+   * no longer be modified and its IDs can no longer be listed.
+   *
+   * <p>Best called right after loading an index with {@link #load(String, boolean)} in search-only
+   * mode, which also releases the memory mapping the index was loaded from. To skip packing at load
+   * time altogether, save the index with {@link #savePackedIndex(String)} instead.
+   */
+  public native void packForSearch();
+
+  /**
+   * Save this {@link Index} in the packed form used by {@link #packForSearch()}, whether or not it
+   * has been packed itself. Loading the result reads it straight into packed storage. Packed
+   * indices can only be loaded in search-only mode, with {@link #load(String, boolean)}.
+   *
+   * @param pathToIndex The output filename to write to.
+   */
+  public native void savePackedIndex(String pathToIndex);
+
+  /**
+   * Save this {@link Index} in packed form (see {@link #savePackedIndex(String)}) to the provided
+   * output stream. The stream will not be closed automatically.
+   *
+   * @param outputStream The output stream to write to.
+   */
+  public native void savePackedIndex(OutputStream outputStream);
+
+  /**
+   * Get counters describing the queries and insertions made on this {@link Index} since it was
+   * created (or since {@link #resetStats()} was last called), including histograms of their
+   * latencies. Stats are collected per-thread and are cheap enough to leave enabled, so this can be
+   * called at any time, even while other threads are querying the index.
+   *
+   * @return A snapshot of this {@link Index}'s stats.
+   */
+  public Stats getStats() {
+    return new Stats(nativeGetStats());
+  }
+
+  /** Reset every counter returned by {@link #getStats()} to zero. */
+  public native void resetStats();
+
+  private native long[] nativeGetStats();
+
   /**
    * Get the maximum number of elements currently storable by this {@link Index}. If more elements
    * are added than {@code getMaxElements()}, the index will be automatically (but slowly) resized.
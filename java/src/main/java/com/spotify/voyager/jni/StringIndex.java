@@ -29,6 +29,10 @@ import java.io.Closeable;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
+import java.nio.LongBuffer;
 import java.nio.file.Files;
 import java.nio.file.Path;
 import java.nio.file.Paths;
@@ -51,6 +55,10 @@ public class StringIndex implements Closeable {
   private static final String NAMES_LIST_FILE_NAME = "names.json";
   private static final int DEFAULT_BUFFER_SIZE = 1024 * 1024 * 100;
 
+  // Direct buffers are expensive to allocate, so each thread reuses (and grows as necessary) the
+  // buffer of labels written by query(FloatBuffer, ...):
+  private static final ThreadLocal<LongBuffer> LABEL_BUFFERS = new ThreadLocal<>();
+
   private final Index index;
   private final List<String> names;
 
@@ -338,24 +346,79 @@ public class StringIndex implements Closeable {
     return results;
   }
 
+  /**
+   * Query for many target vectors at once, reading them from a direct buffer and writing the
+   * results into caller-provided storage without allocating any objects per query.
+   *
+   * <p>The names of the {@code numNeighbors} results for the {@code i}th query are written to
+   * {@code names} starting at index {@code i * numNeighbors}, and their distances are written
+   * starting {@code i * numNeighbors} values after the current position of {@code distances}.
+   *
+   * @param queryVectors A direct, native-order buffer of query vectors, stored one after another
+   * @param numNeighbors Number of neighbors to get for each target
+   * @param numThreads Number of threads to use for the underlying index search. -1 uses all
+   *     available CPU cores
+   * @param ef Search depth in the graph
+   * @param names An array with room for {@code numNeighbors} names per query vector
+   * @param distances A direct, native-order buffer with room for {@code numNeighbors} distances per
+   *     query vector
+   * @return The number of query vectors that were searched
+   * @see Index#query(FloatBuffer, int, int, long, LongBuffer, FloatBuffer)
+   */
+  public int query(
+      FloatBuffer queryVectors,
+      int numNeighbors,
+      int numThreads,
+      int ef,
+      String[] names,
+      FloatBuffer distances) {
+    long numResults = (long) (queryVectors.remaining() / index.getNumDimensions()) * numNeighbors;
+    if (names.length < numResults) {
+      throw new IllegalArgumentException(
+          "names must have room for " + numResults + " results, but has length " + names.length);
+    }
+
+    LongBuffer labels = getLabelBuffer(Math.toIntExact(numResults));
+    int numQueries = index.query(queryVectors, numNeighbors, numThreads, ef, labels, distances);
+    for (int i = 0; i < numQueries * numNeighbors; i++) {
+      names[i] = getName(labels.get(i));
+    }
+    return numQueries;
+  }
+
+  private static LongBuffer getLabelBuffer(int numLabels) {
+    LongBuffer labels = LABEL_BUFFERS.get();
+    if (labels == null || labels.capacity() < numLabels) {
+      labels =
+          ByteBuffer.allocateDirect(Math.toIntExact((long) numLabels * Long.BYTES))
+              .order(ByteOrder.nativeOrder())
+              .asLongBuffer();
+      LABEL_BUFFERS.set(labels);
+    }
+    labels.clear();
+    labels.limit(numLabels);
+    return labels;
+  }
+
+  private String getName(long indexId) {
+    if (indexId > Integer.MAX_VALUE || indexId < Integer.MIN_VALUE) {
+      throw new ArrayIndexOutOfBoundsException(
+          "Voyager index returned a label ("
+              + indexId
+              + ") which is out of range for StringIndex. "
+              + "This index may not be compatible with Voyager's Java bindings, or the index file may be corrupt.");
+    }
+    return names.get((int) indexId);
+  }
+
   private QueryResults convertResult(Index.QueryResults idxResults) {
     int numResults = idxResults.distances.length;
     String[] resultNames = new String[numResults];
     float[] distances = new float[numResults];
 
     for (int i = 0; i < idxResults.getLabels().length; i++) {
-      long indexId = idxResults.getLabels()[i];
-      float dist = idxResults.getDistances()[i];
-      if (indexId > Integer.MAX_VALUE || indexId < Integer.MIN_VALUE) {
-        throw new ArrayIndexOutOfBoundsException(
-            "Voyager index returned a label ("
-                + indexId
-                + ") which is out of range for StringIndex. "
-                + "This index may not be compatible with Voyager's Java bindings, or the index file may be corrupt.");
-      }
-      String name = names.get((int) indexId);
-      resultNames[i] = name;
-      distances[i] = dist;
+      resultNames[i] = getName(idxResults.getLabels()[i]);
+      distances[i] = idxResults.getDistances()[i];
     }
 
     return new QueryResults(resultNames, distances);
@@ -377,6 +440,35 @@ public class StringIndex implements Closeable {
     index.resizeIndex(newSize);
   }
 
+  /**
+   * Reorder the vectors in this index in memory so that neighboring vectors are stored close
+   * together, which can speed up queries on large indices. Query results are unchanged.
+   *
+   * @see Index#optimizeLayout()
+   */
+  public void optimizeLayout() {
+    index.optimizeLayout();
+  }
+
+  /**
+   * Get counters describing the queries and insertions made on this index, including histograms of
+   * their latencies.
+   *
+   * @see Index#getStats()
+   */
+  public Index.Stats getStats() {
+    return index.getStats();
+  }
+
+  /**
+   * Reset every counter returned by {@link #getStats()} to zero.
+   *
+   * @see Index#resetStats()
+   */
+  public void resetStats() {
+    index.resetStats();
+  }
+
   /**
    * Get the maximum number of elements currently storable by this {@link Index}. If more elements
    * are added than {@code getMaxElements()}, the index will be automatically (but slowly) resized.
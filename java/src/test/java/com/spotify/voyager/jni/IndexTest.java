@@ -28,13 +28,26 @@ import static org.junit.Assert.assertEquals;
 import static org.junit.Assert.assertNotNull;
 import static org.junit.Assert.assertThrows;
 import static org.junit.Assert.assertTrue;
+import static org.junit.Assume.assumeNoException;
 
 import com.spotify.voyager.jni.Index.StorageDataType;
+import com.spotify.voyager.jni.exception.RecallException;
 import java.io.ByteArrayInputStream;
 import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
+import java.nio.LongBuffer;
+import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.HashMap;
+import java.util.HashSet;
+import java.util.List;
 import java.util.Map;
+import java.util.Set;
+import java.util.concurrent.CompletableFuture;
+import java.util.concurrent.ExecutionException;
 import org.junit.Test;
 
 public class IndexTest {
@@ -100,6 +113,425 @@ public class IndexTest {
     runTestWith(InnerProduct, 2000, StorageDataType.E4M3, true);
   }
 
+  @Test
+  public void testQueryWithAllowedIds() throws Exception {
+    final int numElements = 1000;
+    try (Index index = new Index(Euclidean, 32)) {
+      float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 32);
+      index.addItems(inputData, -1);
+
+      long[] allowedIds = new long[numElements / 3];
+      for (int i = 0; i < allowedIds.length; i++) {
+        allowedIds[i] = i * 3;
+      }
+
+      Index.QueryResults[] results = index.query(inputData, 10, -1, 50, allowedIds);
+      for (int i = 0; i < numElements; i++) {
+        for (long label : results[i].getLabels()) {
+          assertEquals(0, label % 3);
+        }
+
+        Index.QueryResults result = index.query(inputData[i], 10, 50, allowedIds);
+        for (long label : result.getLabels()) {
+          assertEquals(0, label % 3);
+        }
+      }
+
+      assertThrows(
+          RecallException.class, () -> index.query(inputData[0], 3, -1, new long[] {0, 1}));
+    }
+  }
+
+  @Test
+  public void testQueryWithDirectBuffers() throws Exception {
+    final int numElements = 1000;
+    final int numDimensions = 32;
+    final int k = 10;
+    try (Index index = new Index(Euclidean, numDimensions)) {
+      float[][] inputData = TestUtils.randomQuantizedVectors(numElements, numDimensions);
+      index.addItems(inputData, -1);
+
+      FloatBuffer queries = directBuffer(numElements * numDimensions * 4).asFloatBuffer();
+      for (float[] vector : inputData) {
+        queries.put(vector);
+      }
+      queries.flip();
+
+      // Results are written from each output buffer's current position onwards:
+      LongBuffer labels = directBuffer((numElements * k + 1) * 8).asLongBuffer();
+      FloatBuffer distances = directBuffer((numElements * k + 1) * 4).asFloatBuffer();
+      labels.position(1);
+      distances.position(1);
+
+      assertEquals(numElements, index.query(queries, k, -1, 50, labels, distances));
+      assertEquals(0, queries.position());
+      assertEquals(1, labels.position());
+
+      Index.QueryResults[] expected = index.query(inputData, k, -1, 50);
+      for (int i = 0; i < numElements; i++) {
+        for (int j = 0; j < k; j++) {
+          assertEquals(expected[i].getLabels()[j], labels.get(1 + i * k + j));
+          assertEquals(expected[i].getDistances()[j], distances.get(1 + i * k + j), 0.0f);
+        }
+      }
+
+      // Heap buffers, non-native byte orders and undersized buffers are rejected:
+      assertThrows(
+          IllegalArgumentException.class,
+          () -> index.query(FloatBuffer.wrap(inputData[0]), k, -1, 50, labels, distances));
+      assertThrows(
+          IllegalArgumentException.class,
+          () ->
+              index.query(
+                  ByteBuffer.allocateDirect(numDimensions * 4)
+                      .order(
+                          ByteOrder.nativeOrder() == ByteOrder.BIG_ENDIAN
+                              ? ByteOrder.LITTLE_ENDIAN
+                              : ByteOrder.BIG_ENDIAN)
+                      .asFloatBuffer(),
+                  k,
+                  -1,
+                  50,
+                  labels,
+                  distances));
+      assertThrows(
+          IllegalArgumentException.class,
+          () ->
+              index.query(
+                  queries,
+                  k,
+                  -1,
+                  50,
+                  directBuffer(8).asLongBuffer(),
+                  directBuffer(4).asFloatBuffer()));
+    }
+  }
+
+  @Test
+  public void testShardedIndices() throws Exception {
+    final int numElements = 1000;
+    for (Index.ShardingMode mode : Index.ShardingMode.values()) {
+      try (Index index =
+          Index.sharded(Euclidean, 32, mode, 3, 16, 200, 1, 1, StorageDataType.Float32)) {
+        float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 32);
+        index.addItems(inputData, -1);
+        assertEquals(numElements, index.getNumElements());
+        assertEquals(numElements, index.getIDs().length);
+
+        Index.QueryResults[] results = index.query(inputData, 10, -1, 50);
+        int matches = 0;
+        for (int i = 0; i < numElements; i++) {
+          if (results[i].getLabels()[0] == i) {
+            matches++;
+          }
+          float[] distances = results[i].getDistances();
+          for (int j = 1; j < distances.length; j++) {
+            assertTrue(distances[j - 1] <= distances[j]);
+          }
+        }
+        assertTrue(matches > numElements * 0.99);
+      }
+    }
+  }
+
+  @Test
+  public void testStats() throws Exception {
+    final int numElements = 500;
+    try (Index index = new Index(Euclidean, 32)) {
+      float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 32);
+      index.addItems(inputData, -1);
+      Index.Stats stats = index.getStats();
+      assertEquals(numElements, stats.numInserts);
+      assertEquals(0, stats.numQueries);
+      assertEquals(numElements, Arrays.stream(stats.insertLatencyCounts).sum());
+
+      index.resetStats();
+      index.query(inputData, 10, -1, 50);
+      stats = index.getStats();
+      assertEquals(0, stats.numInserts);
+      assertEquals(numElements, stats.numQueries);
+      assertEquals(Index.Stats.NUM_LATENCY_BUCKETS, stats.queryLatencyCounts.length);
+      assertEquals(numElements, Arrays.stream(stats.queryLatencyCounts).sum());
+      assertTrue(stats.hops >= numElements);
+      assertTrue(stats.distanceComputations >= stats.hops);
+
+      index.resetStats();
+      assertEquals(0, index.getStats().numQueries);
+    }
+  }
+
+  @Test
+  public void testEarlyTermination() throws Exception {
+    final int numElements = 1000;
+    try (Index index = new Index(Euclidean, 32)) {
+      float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 32);
+      index.addItems(inputData, -1);
+      assertEquals(0, index.getEarlyTerminationPatience());
+
+      int patience = index.calibrateEarlyTermination(inputData, 10, 0.9f, 200);
+      assertTrue(patience > 0);
+      assertTrue(patience <= 200);
+      assertEquals(patience, index.getEarlyTerminationPatience());
+
+      Index.QueryResults[] results = index.query(inputData, 1, -1, 200);
+      int matches = 0;
+      for (int i = 0; i < numElements; i++) {
+        if (results[i].getLabels()[0] == i) {
+          matches++;
+        }
+      }
+      assertTrue(matches > numElements * 0.9);
+
+      index.setEarlyTerminationPatience(0);
+      assertEquals(0, index.getEarlyTerminationPatience());
+      assertThrows(RuntimeException.class, () -> index.setEarlyTerminationPatience(-1));
+    }
+  }
+
+  @Test
+  public void testQueryCache() throws Exception {
+    final int numElements = 500;
+    try (Index index = new Index(Euclidean, 32)) {
+      float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 32);
+      index.addItems(inputData, -1);
+      Index.QueryResults[] expected = index.query(inputData, 5, -1, 50);
+      assertEquals(0, index.getQueryCacheSize());
+
+      index.setQueryCacheSize(1000);
+      assertEquals(1000, index.getQueryCacheSize());
+      index.resetStats();
+      index.query(inputData, 5, -1, 50);
+      Index.QueryResults[] results = index.query(inputData, 5, -1, 50);
+      for (int i = 0; i < numElements; i++) {
+        assertArrayEquals(expected[i].getLabels(), results[i].getLabels());
+      }
+      Index.Stats stats = index.getStats();
+      assertEquals(numElements, stats.queryCacheHits);
+      assertEquals(numElements, stats.queryCacheMisses);
+
+      // Any change to the index discards every cached result:
+      index.markDeleted(expected[0].getLabels()[0]);
+      index.query(inputData, 5, -1, 50);
+      assertEquals(numElements, index.getStats().queryCacheHits);
+      assertThrows(RuntimeException.class, () -> index.setQueryCacheSize(-1));
+    }
+  }
+
+  @Test
+  public void testQueryAsync() throws Exception {
+    final int numElements = 500;
+    try (Index index = new Index(Euclidean, 32)) {
+      float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 32);
+      index.addItems(inputData, -1);
+      Index.QueryResults[] expected = index.query(inputData, 5, -1, 50);
+
+      index.setAsyncBatchWindowMicroseconds(1000);
+      assertEquals(1000, index.getAsyncBatchWindowMicroseconds());
+      List<CompletableFuture<Index.QueryResults>> futures = new ArrayList<>();
+      for (float[] vector : inputData) {
+        futures.add(index.queryAsync(vector, 5, 50));
+      }
+      for (int i = 0; i < numElements; i++) {
+        Index.QueryResults results = futures.get(i).get();
+        assertArrayEquals(expected[i].getLabels(), results.getLabels());
+        assertArrayEquals(expected[i].getDistances(), results.getDistances(), 0.0f);
+      }
+
+      ExecutionException error =
+          assertThrows(
+              ExecutionException.class,
+              () -> index.queryAsync(inputData[0], numElements + 1, 50).get());
+      assertTrue(error.getCause() instanceof RecallException);
+      assertThrows(RuntimeException.class, () -> index.queryAsync(new float[31], 5, 50));
+      assertThrows(RuntimeException.class, () -> index.setAsyncBatchWindowMicroseconds(-1));
+    }
+  }
+
+  @Test
+  public void testPackForSearch() throws Exception {
+    final int numElements = 500;
+    try (Index index = new Index(Euclidean, 32)) {
+      float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 32);
+      index.addItems(inputData, -1);
+      Index.QueryResults[] expected = index.query(inputData, 5, -1, 50);
+
+      index.packForSearch();
+      Index.QueryResults[] results = index.query(inputData, 5, -1, 50);
+      for (int i = 0; i < numElements; i++) {
+        assertArrayEquals(expected[i].getLabels(), results[i].getLabels());
+        assertArrayEquals(expected[i].getDistances(), results[i].getDistances(), 0.0f);
+      }
+      assertThrows(RuntimeException.class, () -> index.addItem(inputData[0]));
+
+      ByteArrayOutputStream outputStream = new ByteArrayOutputStream();
+      index.saveIndex(outputStream);
+      try (Index reloaded = Index.load(new ByteArrayInputStream(outputStream.toByteArray()))) {
+        results = reloaded.query(inputData, 5, -1, 50);
+        for (int i = 0; i < numElements; i++) {
+          assertArrayEquals(expected[i].getLabels(), results[i].getLabels());
+        }
+      }
+
+      File packedFile = File.createTempFile("packed", ".voy");
+      packedFile.deleteOnExit();
+      index.savePackedIndex(packedFile.getAbsolutePath());
+      try (Index reloaded = Index.load(packedFile.getAbsolutePath(), true)) {
+        results = reloaded.query(inputData, 5, -1, 50);
+        for (int i = 0; i < numElements; i++) {
+          assertArrayEquals(expected[i].getLabels(), results[i].getLabels());
+        }
+      }
+      assertThrows(RuntimeException.class, () -> Index.load(packedFile.getAbsolutePath()));
+    }
+  }
+
+  @Test
+  public void testSaveCompressedIndex() throws Exception {
+    float[][] inputData = TestUtils.randomQuantizedVectors(1000, 16);
+    try (Index index = new Index(Euclidean, 16)) {
+      index.addItems(inputData, -1);
+      ByteArrayOutputStream compressed = new ByteArrayOutputStream();
+      try {
+        index.saveIndex(compressed, 5);
+      } catch (RuntimeException e) {
+        // This build of Voyager was compiled without compression support.
+        assumeNoException(e);
+      }
+
+      try (Index reloaded = Index.load(new ByteArrayInputStream(compressed.toByteArray()))) {
+        assertArrayEquals(index.asBytes(), reloaded.asBytes());
+      }
+    }
+  }
+
+  @Test
+  public void testApplyDelta() throws Exception {
+    float[][] inputData = TestUtils.randomQuantizedVectors(2010, 16);
+    try (Index index = new Index(Euclidean, 16)) {
+      index.addItems(Arrays.copyOfRange(inputData, 0, 2000), 1);
+      byte[] base = index.asBytes();
+
+      try (Index copy = Index.load(new ByteArrayInputStream(base))) {
+        index.addItems(Arrays.copyOfRange(inputData, 2000, 2010), 1);
+        index.markDeleted(5);
+        ByteArrayOutputStream delta = new ByteArrayOutputStream();
+        index.saveDelta(delta);
+        assertTrue(delta.size() < base.length / 2);
+
+        copy.applyDelta(new ByteArrayInputStream(delta.toByteArray()));
+        assertEquals(index.getNumElements(), copy.getNumElements());
+        assertEquals(2005, copy.query(inputData[2005], 1, 50).getLabels()[0]);
+        assertArrayEquals(index.asBytes(), copy.asBytes());
+
+        assertThrows(
+            RuntimeException.class, () -> copy.applyDelta(new ByteArrayInputStream(base)));
+      }
+    }
+  }
+
+  @Test
+  public void testBulkAddItems() throws Exception {
+    final int numElements = 1000;
+    float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 32);
+    try (Index index = new Index(Euclidean, 32);
+        Index singleThreaded = new Index(Euclidean, 32)) {
+      long[] ids = index.bulkAddItems(inputData, -1);
+      assertEquals(numElements, ids.length);
+      assertEquals(numElements, index.getNumElements());
+
+      Index.QueryResults[] results = index.query(inputData, 1, -1, 50);
+      int matches = 0;
+      for (int i = 0; i < numElements; i++) {
+        if (results[i].getLabels()[0] == ids[i]) {
+          matches++;
+        }
+      }
+      assertTrue(matches > numElements * 0.95);
+
+      singleThreaded.bulkAddItems(inputData, 1);
+      assertArrayEquals(index.asBytes(), singleThreaded.asBytes());
+
+      assertThrows(
+          RuntimeException.class,
+          () -> index.bulkAddItems(new float[][] {inputData[0]}, new long[] {ids[0]}, -1));
+    }
+  }
+
+  @Test
+  public void testBruteForceQuery() throws Exception {
+    final int numElements = 500;
+    float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 16);
+    float[][] queries = TestUtils.randomQuantizedVectors(10, 16);
+    try (Index index = new Index(Euclidean, 16)) {
+      index.addItems(inputData, -1);
+
+      float[][] distances = index.getDistances(queries, inputData, -1);
+      assertEquals(queries.length, distances.length);
+      assertEquals(numElements, distances[0].length);
+
+      Index.QueryResults[] results = index.bruteForceQuery(queries, 3, -1);
+      for (int q = 0; q < queries.length; q++) {
+        float[] sorted = distances[q].clone();
+        Arrays.sort(sorted);
+        float[] expected = Arrays.copyOf(sorted, 3);
+        assertArrayEquals(expected, results[q].getDistances(), 1e-5f);
+      }
+
+      long[] allowedIds = {results[0].getLabels()[2], 7};
+      Index.QueryResults[] filtered =
+          index.bruteForceQuery(new float[][] {queries[0]}, 2, -1, allowedIds);
+      assertEquals(2, filtered[0].getLabels().length);
+      assertThrows(
+          RecallException.class,
+          () -> index.bruteForceQuery(new float[][] {queries[0]}, 3, -1, allowedIds));
+    }
+  }
+
+  @Test
+  public void testGroupedQuery() throws Exception {
+    final int numElements = 500;
+    float[][] inputData = TestUtils.randomQuantizedVectors(numElements, 16);
+    try (Index index = new Index(Euclidean, 16)) {
+      long[] ids = index.addItems(inputData, -1);
+      long[] groups = new long[numElements];
+      for (int i = 0; i < numElements; i++) {
+        groups[i] = 1_000_000 + (i / 5);
+      }
+      assertEquals(7, index.getGroup(7));
+      index.setGroups(ids, groups);
+      assertEquals(groups[7], index.getGroup(7));
+
+      Index.QueryResults[] results = index.groupedQuery(inputData, 10, -1, 100);
+      for (Index.QueryResults result : results) {
+        Set<Long> resultGroups = new HashSet<>();
+        for (long label : result.getLabels()) {
+          resultGroups.add(index.getGroup(label));
+        }
+        assertEquals(10, resultGroups.size());
+      }
+
+      Index.QueryResults single = index.groupedQuery(inputData[0], 10, 100);
+      assertArrayEquals(results[0].getLabels(), single.getLabels());
+
+      // Group assignments are saved along with the index:
+      try (Index reloaded = Index.load(new ByteArrayInputStream(index.asBytes()))) {
+        assertEquals(groups[7], reloaded.getGroup(7));
+        assertArrayEquals(
+            single.getLabels(), reloaded.groupedQuery(inputData[0], 10, 100).getLabels());
+      }
+
+      // Only one of these allowed IDs' groups can be returned:
+      long[] allowedIds = {0, 1, 2};
+      assertEquals(1, index.groupedQuery(inputData[0], 1, 100, allowedIds).getLabels().length);
+      assertThrows(
+          RecallException.class, () -> index.groupedQuery(inputData[0], 2, 100, allowedIds));
+    }
+  }
+
+  private static ByteBuffer directBuffer(int numBytes) {
+    return ByteBuffer.allocateDirect(numBytes).order(ByteOrder.nativeOrder());
+  }
+
   /**
    * One large test method with variable parameters, to replicate the parametrized tests we get "for
    * free" in Python with PyTest.
@@ -29,6 +29,9 @@ import com.spotify.voyager.jni.Index.StorageDataType;
 import com.spotify.voyager.jni.StringIndex.QueryResults;
 import com.spotify.voyager.jni.TestUtils.Vector;
 import java.io.File;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.FloatBuffer;
 import java.nio.file.Files;
 import java.nio.file.Paths;
 import java.util.ArrayList;
@@ -112,6 +115,57 @@ public class StringIndexTest {
     }
   }
 
+  @Test
+  public void itFindsNeighborsFromDirectBuffers() throws Exception {
+    List<Vector> testVectors = TestUtils.getTestVectors();
+    int numDimensions = testVectors.get(0).vector.length;
+    try (final StringIndex index =
+        new StringIndex(
+            SpaceType.Cosine,
+            numDimensions,
+            20,
+            testVectors.size(),
+            0,
+            testVectors.size(),
+            StorageDataType.E4M3)) {
+      for (Vector v : testVectors) {
+        index.addItem(v.name, v.vector);
+      }
+
+      float[][] targetVectors = TestUtils.randomVectors(() -> new Random(0), 2, numDimensions);
+      FloatBuffer queries =
+          ByteBuffer.allocateDirect(2 * numDimensions * 4)
+              .order(ByteOrder.nativeOrder())
+              .asFloatBuffer();
+      for (float[] vector : targetVectors) {
+        queries.put(vector);
+      }
+      queries.flip();
+
+      String[] names = new String[4];
+      FloatBuffer distances =
+          ByteBuffer.allocateDirect(4 * 4).order(ByteOrder.nativeOrder()).asFloatBuffer();
+      assertEquals(2, index.query(queries, 2, 1, testVectors.size(), names, distances));
+
+      QueryResults[] expected = index.query(targetVectors, 2, 1, testVectors.size());
+      for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+          assertEquals(expected[i].getName(j), names[i * 2 + j]);
+          assertEquals(expected[i].getDistance(j), distances.get(i * 2 + j), 0.0f);
+        }
+      }
+
+      // Later queries (which reuse this thread's buffer of labels) must not see earlier results:
+      queries.limit(numDimensions);
+      String[] singleName = new String[1];
+      assertEquals(1, index.query(queries, 1, 1, testVectors.size(), singleName, distances));
+      assertEquals(expected[0].getName(0), singleName[0]);
+      queries.limit(2 * numDimensions);
+      assertEquals(2, index.query(queries, 2, 1, testVectors.size(), names, distances));
+      assertEquals(expected[1].getName(1), names[3]);
+    }
+  }
+
   @Test
   public void itAddsItemsInBatch() throws Exception {
     List<Vector> testVectors = TestUtils.getTestVectors();
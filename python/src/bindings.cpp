@@ -15,6 +15,7 @@
 #include <assert.h>
 #include <atomic>
 #include <bitset>
+#include <chrono>
 #include <cstring>
 #include <iostream>
 #include <mutex>
@@ -35,6 +36,7 @@
 
 #include "PythonInputStream.h"
 #include "PythonOutputStream.h"
+#include "cpp/src/ShardedIndex.h"
 #include "cpp/src/TypedIndex.h"
 
 namespace nb = nanobind;
@@ -107,6 +109,29 @@ template <typename T> std::vector<T> pyArrayToVector(nb::ndarray<T> &input) {
   return output;
 };
 
+/**
+ * Get a pointer to the data in a one-dimensional PyArray (i.e.:
+ * numpy.ndarray), which C++ code can read in place rather than copying.
+ */
+template <typename T> const T *pyArrayToPointer(nb::ndarray<T> &input) {
+  if (input.ndim() != 1) {
+    throw std::domain_error(
+        "Input array was expected to have one dimension, but had " +
+        std::to_string(input.ndim()) + " dimensions.");
+  }
+  return static_cast<const T *>(input.data());
+}
+
+/**
+ * Allocate an uninitialized one-dimensional PyArray (i.e.: numpy.ndarray) of
+ * `size` elements, which C++ code can write into directly.
+ */
+template <typename T> nb::ndarray<T, nb::numpy> allocatePyArray(size_t size) {
+  T *data = new T[size];
+  nb::capsule owner(data, [](void *p) noexcept { delete[] (T *)p; });
+  return nb::ndarray<T, nb::numpy>(data, {size}, owner);
+}
+
 /**
  * Convert a C++ std::vector into a PyArray (i.e.: numpy.ndarray).
  * This function copies the data, but may not have to.
@@ -115,7 +140,7 @@ template <typename T>
 nb::ndarray<T, nb::numpy> vectorToPyArray(std::vector<T> input) {
   T *data = new T[input.size()];
   std::copy(input.begin(), input.end(), data);
-  nb::capsule owner(data, [](void *p) noexcept { delete[] (float *)p; });
+  nb::capsule owner(data, [](void *p) noexcept { delete[] (T *)p; });
   return nb::ndarray<T, nb::numpy>(data, {input.size()}, owner);
 };
 
@@ -190,7 +215,7 @@ inline void register_index_class(nb::module_ &m, std::string className,
               const int num_dimensions, const size_t M,
               const size_t ef_construction, const size_t random_seed,
               const size_t max_elements,
-              const StorageDataType storageDataType) {
+              const StorageDataType storageDataType, const int num_subspaces) {
             // new (self) TypedIndex<dist_t, data_t, scalefactor>(
             //     space, num_dimensions, M, ef_construction, random_seed,
             //     max_elements);
@@ -199,7 +224,7 @@ inline void register_index_class(nb::module_ &m, std::string className,
           nb::arg("ef_construction") = 200, nb::arg("random_seed") = 1,
           nb::arg("max_elements") = 1,
           nb::arg("storage_data_type") = StorageDataType::Float32,
-          "Create a new, empty index.")
+          nb::arg("num_subspaces") = 0, "Create a new, empty index.")
       .def("__repr__", [className](const Index &index) {
         return "<voyager." + className + " space=" + index.getSpaceName() +
                " num_dimensions=" + std::to_string(index.getNumDimensions()) +
@@ -207,8 +232,47 @@ inline void register_index_class(nb::module_ &m, std::string className,
       });
 };
 
+// Borrowed from the voyager_ext module, which outlives every index:
+static nb::handle recallErrorType;
+
+/**
+ * Convert an exception thrown by an asynchronous query into a Python
+ * exception object, matching the types nanobind would have raised had the
+ * query been run synchronously.
+ */
+nb::object toPythonException(std::exception_ptr error) {
+  try {
+    std::rethrow_exception(error);
+  } catch (const RecallError &e) {
+    return recallErrorType(e.what());
+  } catch (const std::invalid_argument &e) {
+    return nb::handle(PyExc_ValueError)(e.what());
+  } catch (const std::domain_error &e) {
+    return nb::handle(PyExc_ValueError)(e.what());
+  } catch (const std::exception &e) {
+    return nb::handle(PyExc_RuntimeError)(e.what());
+  } catch (...) {
+    return nb::handle(PyExc_RuntimeError)("Asynchronous query failed.");
+  }
+}
+
+/**
+ * Resolve an asyncio future with the results of an asynchronous query. Runs
+ * on the future's event loop, as futures aren't thread-safe. `index` is only
+ * passed along to keep the queried index alive until the query completes.
+ */
+void resolveQueryFuture(nb::object future, nb::object value, bool isError,
+                        nb::object index) {
+  // The future may have been cancelled while the query was running:
+  if (nb::cast<bool>(future.attr("done")())) {
+    return;
+  }
+  future.attr(isError ? "set_exception" : "set_result")(value);
+}
+
 NB_MODULE(voyager_ext, m) {
   nb::exception<RecallError>(m, "RecallError");
+  recallErrorType = m.attr("RecallError");
 
   m.attr("version") = nb::make_tuple(2, 1, 0);
 
@@ -247,6 +311,13 @@ memory usage and index size by a factor of 4 compared to :py:class:`Float32`.
              "negative distances due to the reduced floating-point precision. "
              "While confusing, these negative distances still result in a "
              "correct ordering between results.")
+      .value("PQ", StorageDataType::PQ,
+             "Product quantization: each vector is split into "
+             "``num_subspaces`` equally-sized chunks, each stored as a "
+             "one-byte index into a codebook learned from the first vectors "
+             "added to the index. Uses ``num_subspaces`` bytes per vector, "
+             "regardless of its number of dimensions, at the cost of reduced "
+             "recall.")
       .export_values();
 
   nb::class_<E4M3>(
@@ -313,6 +384,90 @@ memory usage and index size by a factor of 4 compared to :py:class:`Float32`.
           "The number of bytes used to represent this (C++) instance in "
           "memory.");
 
+  nb::class_<hnswlib::LatencyHistogram>(
+      m, "LatencyHistogram",
+      "A histogram of latencies, with buckets whose upper bounds are powers of "
+      "two microseconds. Returned as part of :py:class:`IndexStats`.")
+      .def_prop_ro(
+          "counts",
+          [](const hnswlib::LatencyHistogram &self) {
+            return std::vector<uint64_t>(self.counts.begin(),
+                                         self.counts.end());
+          },
+          "The number of latencies that fell into each bucket.")
+      .def_prop_ro(
+          "bucket_upper_bounds",
+          [](const hnswlib::LatencyHistogram &) {
+            std::vector<double> bounds(hnswlib::LatencyHistogram::NUM_BUCKETS);
+            for (size_t i = 0; i < bounds.size(); i++) {
+              bounds[i] = hnswlib::LatencyHistogram::getBucketUpperBound(i);
+            }
+            return bounds;
+          },
+          "The (exclusive) upper bound of each bucket, in seconds. The last "
+          "bucket has no upper bound, and is reported as ``inf``.")
+      .def_prop_ro("count", &hnswlib::LatencyHistogram::getCount,
+                   "The total number of latencies recorded in this histogram.")
+      .def_prop_ro(
+          "total_seconds",
+          [](const hnswlib::LatencyHistogram &self) {
+            return self.totalNanoseconds / 1e9;
+          },
+          "The sum of every latency recorded in this histogram, in seconds.");
+
+  nb::class_<hnswlib::IndexStats>(m, "IndexStats", R"(
+Counters describing the queries and insertions made on an :py:class:`Index`,
+returned by :py:meth:`Index.get_stats`.
+
+Each query in a batch passed to :py:meth:`Index.query` is counted separately,
+and is recorded in :py:attr:`query_latency` with the average latency of the
+queries it was searched alongside.
+)")
+      .def_ro("num_queries", &hnswlib::IndexStats::numQueries,
+              "The number of queries made on this index.")
+      .def_ro("num_inserts", &hnswlib::IndexStats::numInserts,
+              "The number of vectors added to this index.")
+      .def_ro("distance_computations",
+              &hnswlib::IndexStats::distanceComputations,
+              "The number of distances computed while searching the graph, "
+              "during both queries and insertions.")
+      .def_ro("hops", &hnswlib::IndexStats::hops,
+              "The number of graph nodes whose neighbors were visited while "
+              "searching the graph, during both queries and insertions.")
+      .def_ro("visited_list_resets", &hnswlib::IndexStats::visitedListResets,
+              "The number of times a search had to clear its list of visited "
+              "nodes in full before it could start.")
+      .def_prop_ro(
+          "lock_wait_seconds",
+          [](const hnswlib::IndexStats &self) {
+            return self.lockWaitNanoseconds / 1e9;
+          },
+          "The total time spent waiting for locks held by other threads, in "
+          "seconds.")
+      .def_ro("query_cache_hits", &hnswlib::IndexStats::queryCacheHits,
+              "The number of queries answered from the query cache.")
+      .def_ro("query_cache_misses", &hnswlib::IndexStats::queryCacheMisses,
+              "The number of queries looked up in the query cache without "
+              "finding any results.")
+      .def_ro("query_latency", &hnswlib::IndexStats::queryLatency,
+              "A histogram of the latency of each query.")
+      .def_ro("insert_latency", &hnswlib::IndexStats::insertLatency,
+              "A histogram of the latency of each insertion.")
+      .def("__repr__", [](const hnswlib::IndexStats &self) {
+        std::ostringstream ss;
+        ss << "<voyager.IndexStats";
+        ss << " num_queries=" << self.numQueries;
+        ss << " num_inserts=" << self.numInserts;
+        ss << " distance_computations=" << self.distanceComputations;
+        ss << " hops=" << self.hops;
+        if (self.queryCacheHits || self.queryCacheMisses) {
+          ss << " query_cache_hits=" << self.queryCacheHits;
+          ss << " query_cache_misses=" << self.queryCacheMisses;
+        }
+        ss << ">";
+        return ss.str();
+      });
+
   auto index = nb::class_<Index>(m, "Index",
                                  R"(
 A nearest-neighbor search index containing vector data (i.e. lists of 
@@ -346,6 +501,7 @@ of three classes:
 - :py:class:`FloatIndex`, which uses 32-bit precision for all data
 - :py:class:`Float8Index`, which uses 8-bit fixed-point precision and requires all vectors to be within the bounds [-1, 1]
 - :py:class:`E4M3Index`, which uses 8-bit floating-point precision and requires all vectors to be within the bounds [-448, 448]
+- :py:class:`PQIndex`, which stores product-quantized codes of ``num_subspaces`` bytes per vector
 
 Args:
     space:
@@ -382,6 +538,15 @@ Args:
         (and are automatically resized when :py:meth:`add_item` or
         :py:meth:`add_items` is called) so this value is only useful if the exact
         number of elements that will be added to this index is known in advance.
+
+    storage_data_type:
+        The :py:class:`StorageDataType` used to store vectors in this index.
+
+    num_subspaces:
+        Only used with :py:class:`StorageDataType.PQ`: the number of bytes used
+        to store each vector. Must evenly divide ``num_dimensions``. If ``0``
+        (the default), uses one byte per four dimensions (or as close as
+        possible).
 )");
 
   index.def(
@@ -389,13 +554,16 @@ Args:
       [](Index &index,
          std::variant<nb::ndarray<float>, std::vector<float>> vector,
          std::optional<size_t> _id) {
-        std::vector<float> stdArray;
-        if (std::holds_alternative<nb::ndarray<float>>(vector)) {
-          stdArray =
-              pyArrayToVector<float>(std::get<nb::ndarray<float>>(vector));
-        } else {
-          stdArray = std::get<std::vector<float>>(vector);
+        // NumPy arrays are read in place, rather than copied:
+        if (auto *array = std::get_if<nb::ndarray<float>>(&vector)) {
+          const float *data = pyArrayToPointer<float>(*array);
+          size_t numDimensions = array->shape(0);
+          nb::gil_scoped_release release;
+          return index.addItem(data, numDimensions, _id);
         }
+
+        const std::vector<float> &stdArray =
+            std::get<std::vector<float>>(vector);
         nb::gil_scoped_release release;
         return index.addItem(stdArray, _id);
       },
@@ -461,6 +629,46 @@ Returns:
     same order as the provided vectors.
 )");
 
+  index.def(
+      "bulk_add_items",
+      [](Index &index, nb::ndarray<float> vectors,
+         std::optional<std::vector<size_t>> _ids, int num_threads) {
+        std::vector<size_t> empty;
+        auto ndArray = pyArrayToNDArray<float, 2>(vectors);
+
+        nb::gil_scoped_release release;
+        return index.bulkAddItems(ndArray, (_ids ? *_ids : empty),
+                                  num_threads);
+      },
+      nb::arg("vectors"), nb::arg("ids") = nb::none(),
+      nb::arg("num_threads") = -1,
+      R"(
+Add a large batch of new vectors to this index, building the graph in bulk.
+
+Unlike :py:meth:`add_items`, vectors are inserted in batches: each batch is linked to the graph
+built so far without taking any per-element locks, and then the batch's links are added to the
+graph all at once. This scales to many more threads than :py:meth:`add_items`, and builds exactly
+the same graph regardless of the value of ``num_threads``.
+
+This index can't be queried (or modified) while a bulk addition is in progress, and the IDs of
+the provided vectors must not already be present in the index.
+
+Args:
+    vectors: A 32-bit floating-point NumPy array, with shape ``(num_vectors, num_dimensions)``.
+        These vectors are normalized and converted exactly as in :py:meth:`add_items`.
+
+    ids: An optional list of new IDs to assign to these vectors.
+        If provided, this list must be identical in length to the first dimension of ``vectors``.
+        If not provided, each vector's ID will automatically be generated based on the
+        number of elements already in this index.
+
+    num_threads: Up to ``num_threads`` will be used to build the graph in parallel.
+                 By default, one thread will be used per CPU core.
+Returns:
+    The IDs that were assigned to the provided vectors (either auto-generated or provided), in the
+    same order as the provided vectors.
+)");
+
   ////////////////////////////////////////////////////////////////////////////////////////////////////
   // Querying
   ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -468,18 +676,30 @@ Returns:
       "query",
       [](Index &index,
          std::variant<nb::ndarray<float>, std::vector<float>> &_input,
-         size_t k = 1, int num_threads = -1, long queryEf = -1) {
-        // Treat a single vector as a 1D array:
-        if (std::holds_alternative<std::vector<float>>(_input)) {
-          std::vector<float> stdArray = std::get<std::vector<float>>(_input);
+         size_t k = 1, int num_threads = -1, long queryEf = -1,
+         std::optional<std::vector<hnswlib::labeltype>> allowedIds = {},
+         size_t rerankK = 0) {
+        std::unique_ptr<hnswlib::AllowListFilter> filter;
+        if (allowedIds) {
+          filter = std::make_unique<hnswlib::AllowListFilter>(*allowedIds);
+        }
 
-          auto idsAndDistances = index.query(stdArray, k, queryEf);
-          std::tuple<nb::ndarray<hnswlib::labeltype, nb::numpy>,
-                     nb::ndarray<float, nb::numpy>>
-              output = {vectorToPyArray<hnswlib::labeltype>(
-                            std::get<0>(idsAndDistances)),
-                        vectorToPyArray<float>(std::get<1>(idsAndDistances))};
-          return output;
+        // Single queries are read in place, and their results written
+        // straight into the returned arrays:
+        auto querySingle = [&](const float *vector, size_t numDimensions) {
+          auto labels = allocatePyArray<hnswlib::labeltype>(k);
+          auto distances = allocatePyArray<float>(k);
+          {
+            nb::gil_scoped_release release;
+            index.query(vector, numDimensions, k, labels.data(),
+                        distances.data(), queryEf, filter.get(), rerankK);
+          }
+          return std::make_tuple(labels, distances);
+        };
+
+        // Treat a single vector as a 1D array:
+        if (auto *stdArray = std::get_if<std::vector<float>>(&_input)) {
+          return querySingle(stdArray->data(), stdArray->size());
         }
 
         nb::ndarray<float> input = std::get<nb::ndarray<float>>(_input);
@@ -487,18 +707,12 @@ Returns:
         int inputNDim = input.ndim();
         switch (inputNDim) {
         case 1: {
-          auto idsAndDistances =
-              index.query(pyArrayToVector<float>(input), k, queryEf);
-          std::tuple<nb::ndarray<hnswlib::labeltype, nb::numpy>,
-                     nb::ndarray<float, nb::numpy>>
-              output = {vectorToPyArray<hnswlib::labeltype>(
-                            std::get<0>(idsAndDistances)),
-                        vectorToPyArray<float>(std::get<1>(idsAndDistances))};
-          return output;
+          return querySingle(pyArrayToPointer<float>(input), input.shape(0));
         }
         case 2: {
-          auto idsAndDistances = index.query(pyArrayToNDArray<float, 2>(input),
-                                             k, num_threads, queryEf);
+          auto idsAndDistances =
+              index.query(pyArrayToNDArray<float, 2>(input), k, num_threads,
+                          queryEf, filter.get(), rerankK);
           std::tuple<nb::ndarray<hnswlib::labeltype, nb::numpy>,
                      nb::ndarray<float, nb::numpy>>
               output = {
@@ -515,7 +729,8 @@ Returns:
         }
       },
       nb::arg("vectors"), nb::arg("k") = 1, nb::arg("num_threads") = -1,
-      nb::arg("query_ef") = -1, R"(
+      nb::arg("query_ef") = -1, nb::arg("allowed_ids") = nb::none(),
+      nb::arg("rerank_k") = 0, R"(
 Query this index to retrieve the ``k`` nearest neighbors of the provided vectors.
 
 Args:
@@ -534,6 +749,17 @@ Args:
               candidates will be searched through to try to find up the ``k``
               nearest neighbors per query vector.
 
+    allowed_ids: If provided, only the IDs in this list will be returned from this
+                 query. Other items in the index are still traversed during search,
+                 but never returned. This is much more efficient than requesting
+                 extra neighbors and filtering the results afterwards.
+
+    rerank_k: If greater than ``k``, the best ``rerank_k`` candidates found in the
+              index are re-scored against their full-precision vectors, and the
+              best ``k`` of those are returned. Only has an effect if this index
+              has :py:attr:`store_full_precision_vectors` enabled (or has loaded
+              full-precision vectors with :py:meth:`load_full_precision_vectors`).
+
 Returns:
     A tuple of ``(neighbor_ids, distances)``. If a single query vector was provided,
     both ``neighbor_ids`` and ``distances`` will be of shape ``(k,)``.
@@ -571,6 +797,11 @@ Query with multiple vectors simultaneously::
         for i, (neighbor_ids, distances) in enumerate(query_neighbor_ids, query_distances):
             print(f"\t{i}-th closest neighbor is {neighbor_id}, {distance} away")
 
+Query for neighbors from a subset of the index::
+
+    neighbor_ids, distances = index.query(query_vector, k=2, allowed_ids=[1, 2, 3])
+    # neighbor_ids will only contain IDs 1, 2, or 3.
+
 .. warning::
 
     If using E4M3 storage with the Cosine :py:class:`Space`, some queries may return
@@ -578,6 +809,223 @@ Query with multiple vectors simultaneously::
     data type. While confusing, these negative distances still result in a correct
     ordering between results.
 
+)");
+
+  index.def(
+      "query_async",
+      [](Index &index, std::vector<float> vector, int k, long queryEf,
+         size_t rerankK) {
+        nb::object loop =
+            nb::module_::import_("asyncio").attr("get_running_loop")();
+        nb::object future = loop.attr("create_future")();
+
+        // The callback runs on one of the index's worker threads, and takes
+        // these references once it holds the GIL. The index itself is kept
+        // alive until then, as destroying it waits for every pending query:
+        PyObject *loopRef = loop.inc_ref().ptr();
+        PyObject *futureRef = future.inc_ref().ptr();
+        PyObject *indexRef = nb::find(index).release().ptr();
+
+        auto callback = [loopRef, futureRef, indexRef](
+                            std::vector<hnswlib::labeltype> labels,
+                            std::vector<float> distances,
+                            std::exception_ptr error) {
+          nb::gil_scoped_acquire acquire;
+          nb::object loop = nb::steal(loopRef);
+          nb::object future = nb::steal(futureRef);
+          nb::object indexObject = nb::steal(indexRef);
+
+          nb::object value;
+          if (error) {
+            value = toPythonException(error);
+          } else {
+            value = nb::make_tuple(vectorToPyArray(std::move(labels)),
+                                   vectorToPyArray(std::move(distances)));
+          }
+
+          try {
+            loop.attr("call_soon_threadsafe")(
+                nb::cpp_function(resolveQueryFuture), future, value,
+                (bool)error, indexObject);
+          } catch (nb::python_error &e) {
+            // The event loop has been closed, so nobody can await this
+            // result. Our reference to the index may be the last one, so
+            // drop it on the main thread rather than on the index's own
+            // worker thread:
+            Py_AddPendingCall(
+                [](void *ref) {
+                  Py_DECREF((PyObject *)ref);
+                  return 0;
+                },
+                indexObject.release().ptr());
+          }
+        };
+
+        try {
+          index.queryAsync(std::move(vector), callback, k, queryEf, rerankK);
+        } catch (...) {
+          nb::handle(loopRef).dec_ref();
+          nb::handle(futureRef).dec_ref();
+          nb::handle(indexRef).dec_ref();
+          throw;
+        }
+        return future;
+      },
+      nb::arg("vector"), nb::arg("k") = 1, nb::arg("query_ef") = -1,
+      nb::arg("rerank_k") = 0, R"(
+Query this index for the ``k`` nearest neighbors of a single vector without blocking, returning an
+:py:class:`asyncio.Future` that resolves to a tuple of ``(neighbor_ids, distances)``, each of shape
+``(k,)``. Must be called from a coroutine (or otherwise from within a running event loop).
+
+Queries submitted at around the same time (within :py:attr:`async_batch_window` of one another,
+by any number of coroutines or threads) are searched together as one batch, on this index's
+worker threads rather than on the event loop's thread.
+
+Args:
+    vector: A 32-bit floating-point NumPy array, with shape ``(num_dimensions,)``.
+
+    k: The number of neighbors to return.
+
+    query_ef: The depth of search to perform for this query, as in :py:meth:`query`.
+
+    rerank_k: The number of candidates to re-score against their full-precision vectors, as in
+              :py:meth:`query`.
+
+Example::
+
+    async def find_neighbors(index, vectors):
+        return await asyncio.gather(*(index.query_async(v, k=10) for v in vectors))
+
+)");
+
+  index.def(
+      "brute_force_query",
+      [](Index &index, nb::ndarray<float> vectors, int k, int num_threads,
+         std::optional<std::vector<hnswlib::labeltype>> allowedIds) {
+        std::unique_ptr<hnswlib::AllowListFilter> filter;
+        if (allowedIds) {
+          filter = std::make_unique<hnswlib::AllowListFilter>(*allowedIds);
+        }
+        auto ndArray = pyArrayToNDArray<float, 2>(vectors);
+
+        std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+            idsAndDistances = [&] {
+              nb::gil_scoped_release release;
+              return index.bruteForceQuery(ndArray, k, num_threads,
+                                           filter.get());
+            }();
+        std::tuple<nb::ndarray<hnswlib::labeltype, nb::numpy>,
+                   nb::ndarray<float, nb::numpy>>
+            output = {ndArrayToPyArray<hnswlib::labeltype, 2>(
+                          std::get<0>(idsAndDistances)),
+                      ndArrayToPyArray<float, 2>(std::get<1>(idsAndDistances))};
+        return output;
+      },
+      nb::arg("vectors"), nb::arg("k") = 1, nb::arg("num_threads") = -1,
+      nb::arg("allowed_ids") = nb::none(), R"(
+Find the exact ``k`` nearest neighbors of the provided vectors, by comparing each of them against
+every vector in this index rather than searching the index's graph.
+
+Vectors are compared as stored in the index (i.e.: after any conversion to a lower-precision
+:py:class:`StorageDataType`), so the results are those that :py:meth:`query` would return with
+perfect recall. Brute-force queries take time proportional to the size of the index, so are best
+suited to small indices, or to computing the ground truth when measuring recall.
+
+Args:
+    vectors: A 32-bit floating-point NumPy array, with shape ``(num_queries, num_dimensions)``.
+
+    k: The number of neighbors to return.
+
+    num_threads: Up to ``num_threads`` will be used to perform queries in parallel.
+                 Defaults to using one thread per CPU core.
+
+    allowed_ids: If provided, only the IDs in this list will be returned from this query.
+
+Returns:
+    A tuple of ``(neighbor_ids, distances)``, both of shape ``(num_queries, k)``, as returned
+    by :py:meth:`query`.
+)");
+
+  index.def(
+      "grouped_query",
+      [](Index &index, nb::ndarray<float> input, size_t k = 1,
+         int num_threads = -1, long queryEf = -1,
+         std::optional<std::vector<hnswlib::labeltype>> allowedIds = {}) {
+        std::unique_ptr<hnswlib::AllowListFilter> filter;
+        if (allowedIds) {
+          filter = std::make_unique<hnswlib::AllowListFilter>(*allowedIds);
+        }
+
+        int inputNDim = input.ndim();
+        switch (inputNDim) {
+        case 1: {
+          if (input.shape(0) != (size_t)index.getNumDimensions()) {
+            throw std::runtime_error(
+                "Query vector expected to share dimensionality with index.");
+          }
+          auto labels = allocatePyArray<hnswlib::labeltype>(k);
+          auto distances = allocatePyArray<float>(k);
+          const float *vector = pyArrayToPointer<float>(input);
+          {
+            nb::gil_scoped_release release;
+            index.groupedQueryInto(vector, 1, k, labels.data(),
+                                   distances.data(), 1, queryEf, filter.get());
+          }
+          return std::make_tuple(labels, distances);
+        }
+        case 2: {
+          auto ndArray = pyArrayToNDArray<float, 2>(input);
+          std::tuple<NDArray<hnswlib::labeltype, 2>, NDArray<float, 2>>
+              idsAndDistances = [&] {
+                nb::gil_scoped_release release;
+                return index.groupedQuery(ndArray, k, num_threads, queryEf,
+                                          filter.get());
+              }();
+          std::tuple<nb::ndarray<hnswlib::labeltype, nb::numpy>,
+                     nb::ndarray<float, nb::numpy>>
+              output = {
+                  ndArrayToPyArray<hnswlib::labeltype, 2>(
+                      std::get<0>(idsAndDistances)),
+                  ndArrayToPyArray<float, 2>(std::get<1>(idsAndDistances))};
+          return output;
+        }
+        default:
+          throw std::domain_error(
+              "grouped_query(...) expected one- or two-dimensional input data "
+              "(either a single query vector or multiple query vectors) but "
+              "got " +
+              std::to_string(inputNDim) + " dimensions.");
+        }
+      },
+      nb::arg("vectors"), nb::arg("k") = 1, nb::arg("num_threads") = -1,
+      nb::arg("query_ef") = -1, nb::arg("allowed_ids") = nb::none(), R"(
+Query this index to retrieve the ``k`` nearest *groups* (see :py:meth:`set_groups`) to the provided
+vectors, rather than the ``k`` nearest neighbors. Each group is represented by the ID of (and
+distance to) its nearest element, so at most one ID from each group is returned.
+
+This is useful when several vectors are stored for each item (i.e.: one per segment of a track),
+and the nearest distinct items are wanted. Searches continue until ``query_ef`` distinct groups
+have been found, which is far cheaper than requesting extra neighbors and removing duplicates.
+
+Args:
+    vectors: A 32-bit floating-point NumPy array, with shape ``(num_dimensions,)``
+             *or* ``(num_queries, num_dimensions)``.
+
+    k: The number of groups to return.
+
+    num_threads: If ``vectors`` contains more than one query vector, up to ``num_threads``
+                 will be used to perform queries in parallel. Defaults to using one
+                 thread per CPU core.
+
+    query_ef: The number of distinct groups to search for. Defaults to :py:attr:`ef`.
+
+    allowed_ids: If provided, only the IDs in this list will be returned from this query.
+
+Returns:
+    A tuple of ``(neighbor_ids, distances)``, shaped as returned by :py:meth:`query`.
+
+Raises:
+    RecallError: If fewer than ``k`` groups were found.
 )");
 
   ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -713,6 +1161,36 @@ Get the distance between two provided vectors. The vectors must share the dimens
 )",
       nb::arg("a"), nb::arg("b"));
 
+  index.def(
+      "get_distances",
+      [](Index &index, nb::ndarray<float> queries, nb::ndarray<float> targets,
+         int num_threads) {
+        auto queriesArray = pyArrayToNDArray<float, 2>(queries);
+        auto targetsArray = pyArrayToNDArray<float, 2>(targets);
+
+        NDArray<float, 2> distances = [&] {
+          nb::gil_scoped_release release;
+          return index.getDistances(queriesArray, targetsArray, num_threads);
+        }();
+        return ndArrayToPyArray<float, 2>(distances);
+      },
+      nb::arg("queries"), nb::arg("targets"), nb::arg("num_threads") = -1, R"(
+Get the distance between every pair of the provided query and target vectors, as computed by
+:py:meth:`get_distance`, without the memory overhead of computing them in NumPy.
+
+Args:
+    queries: A 32-bit floating-point NumPy array, with shape ``(num_queries, num_dimensions)``.
+
+    targets: A 32-bit floating-point NumPy array, with shape ``(num_targets, num_dimensions)``.
+
+    num_threads: Up to ``num_threads`` will be used to compute distances in parallel.
+                 Defaults to using one thread per CPU core.
+
+Returns:
+    A 32-bit floating-point NumPy array of shape ``(num_queries, num_targets)``, whose ``[i, j]``-th
+    element is the distance between the ``i``-th query and the ``j``-th target.
+)");
+
   ////////////////////////////////////////////////////////////////////////////////////////////////////
   // Index Modifier Methods/Attributes
   ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -729,6 +1207,110 @@ Higher values make queries slower, but give better recall.
   by passing the ``query_ef`` parameter, allowing finer-grained control over query
   speed and recall.
 
+)");
+
+  index.def_prop_rw("prefetch_depth", &Index::getPrefetchDepth,
+                    &Index::setPrefetchDepth, R"(
+The number of neighbors ahead of the one currently being compared whose
+vectors are prefetched from memory while searching the index.
+
+Prefetching hides memory latency on large indices, at the cost of some
+wasted memory bandwidth when prefetched neighbors turn out to have already
+been visited. Set to ``0`` to disable prefetching.
+)");
+
+  index.def_prop_rw("early_termination_patience",
+                    &Index::getEarlyTerminationPatience,
+                    &Index::setEarlyTerminationPatience, R"(
+The number of nodes in a row that a query may visit without finding a better
+candidate before it stops searching early, even if it has not yet used all of
+its ``ef`` (or ``query_ef``) budget.
+
+Most queries converge quickly and can stop long before exhausting a large
+``ef``, while harder queries keep finding better candidates and use all of it.
+Enabling early termination lets ``ef`` act as a budget for the hardest
+queries, rather than a cost paid by every query. Defaults to ``0``, which
+disables early termination; use :py:meth:`calibrate_early_termination` to
+choose a value for a target recall.
+)");
+
+  index.def_prop_rw("query_cache_size", &Index::getQueryCacheSize,
+                    &Index::setQueryCacheSize, R"(
+The maximum number of recent query results to cache, so that repeated queries
+for the same vector (with the same ``k``, ``query_ef`` and ``rerank_k``) are
+answered without searching the index again. Queries with ``allowed_ids`` are
+never cached, and every cached result is discarded whenever this index changes
+(i.e.: when items are added or marked as deleted).
+
+Defaults to ``0``, which disables the cache. Cache hits and misses are counted
+in :py:meth:`get_stats`.
+)");
+
+  index.def_prop_rw(
+      "async_batch_window",
+      [](const Index &index) {
+        return index.getAsyncBatchWindow().count() / 1e6;
+      },
+      [](Index &index, double seconds) {
+        index.setAsyncBatchWindow(
+            std::chrono::microseconds((long long)(seconds * 1e6)));
+      },
+      R"(
+The maximum time, in seconds, that a query submitted with :py:meth:`query_async` may wait for
+others to be searched along with it. Longer windows allow for larger batches (and higher
+throughput) at the expense of latency. Defaults to ``0.0001`` (100 microseconds); ``0`` searches
+every query as soon as it is submitted.
+)");
+
+  index.def(
+      "calibrate_early_termination",
+      [](Index &index, nb::ndarray<float> queries, int k, float target_recall,
+         long query_ef, int num_threads) {
+        auto ndArray = pyArrayToNDArray<float, 2>(queries);
+
+        nb::gil_scoped_release release;
+        return index.calibrateEarlyTermination(ndArray, k, target_recall,
+                                               query_ef, num_threads);
+      },
+      nb::arg("queries"), nb::arg("k") = 1, nb::arg("target_recall") = 0.95,
+      nb::arg("query_ef") = -1, nb::arg("num_threads") = -1,
+      R"(
+Choose and set the smallest :py:attr:`early_termination_patience` at which
+queries still find at least ``target_recall`` of the neighbors they would find
+without early termination, and return it.
+
+Args:
+    queries: A 32-bit floating-point NumPy array of shape ``(num_queries, num_dimensions)``
+        containing a representative sample of the queries this index will receive.
+
+    k: The number of neighbors that will be requested from each query.
+
+    target_recall: The fraction (between 0 and 1) of each query's neighbors that must still be
+        found once early termination is enabled.
+
+    query_ef: The ``query_ef`` that will be passed to :py:meth:`query`, which becomes the budget
+        for the hardest queries. If not provided, the index's :py:attr:`ef` is used.
+
+    num_threads: The number of threads to run the sample queries on.
+
+Returns:
+    The chosen patience, or ``0`` (disabling early termination) if ``target_recall`` is only
+    reached by a patience that never stops a query early. Other queries may run on this index
+    while it is being calibrated.
+)");
+
+  index.def_prop_rw("store_full_precision_vectors",
+                    &Index::getStoreFullPrecisionVectors,
+                    &Index::setStoreFullPrecisionVectors, R"(
+Whether to keep a full-precision (32-bit float) copy of each vector added to
+this index from now on, outside of the index's graph.
+
+When enabled, passing ``rerank_k`` to :py:meth:`query` re-scores the best
+``rerank_k`` candidates against these vectors, giving ``Float32``-quality
+results while searching the graph with a compact :py:class:`StorageDataType`.
+
+These vectors are not saved by :py:meth:`save`; use
+:py:meth:`save_full_precision_vectors` to save them separately.
 )");
 
   index.def("mark_deleted", &Index::markDeleted, nb::arg("id"), R"(
@@ -770,6 +1352,24 @@ Unmark an ID in this index as deleted.
 
 Once unmarked as deleted, an existing ID will show up in the results of
 calls to :py:meth:`query` again.
+)");
+
+  index.def("set_groups", &Index::setGroups, nb::arg("ids"), nb::arg("groups"),
+            R"(
+Assign each of the provided IDs to the corresponding group (i.e.: the item that several of this
+index's vectors belong to), so that :py:meth:`grouped_query` returns at most one ID per group.
+
+IDs that have not been assigned a group are each in a group of their own. Group assignments are
+saved along with the index by :py:meth:`save`, and are included in deltas.
+
+Args:
+    ids: A list of IDs in this index.
+    groups: A list of group IDs, the same length as ``ids``.
+)");
+
+  index.def("get_group", &Index::getGroup, nb::arg("id"), R"(
+Return the group that the provided ID belongs to (see :py:meth:`set_groups`), which is the ID
+itself if it has not been assigned a group.
 )");
 
   index.def("resize", &Index::resizeIndex, nb::arg("new_size"), R"(
@@ -788,6 +1388,102 @@ Calling :py:meth:`resize` *once* before adding vectors to the
 index will speed up index creation if the number of elements is known
 in advance, as subsequent calls to :py:meth:`add_items` will not need
 to resize the index on-the-fly.
+)");
+
+  index.def(
+      "optimize_layout",
+      [](Index &index) {
+        nb::gil_scoped_release release;
+        index.optimizeLayout();
+      },
+      R"(
+Reorder the elements of this index in memory so that elements that are
+neighbors in the graph are stored close to one another. This reduces cache
+misses during search, and can noticeably speed up queries on large indices.
+
+This does not change the results of any query, and the reordered index is
+saved in the usual format, so this can be called once after building an
+index offline and before calling :py:meth:`save`. Queries and additions
+are blocked while the layout is being optimized.
+)");
+
+  index.def(
+      "compact",
+      [](Index &index) {
+        nb::gil_scoped_release release;
+        return index.compact();
+      },
+      R"(
+Permanently remove every element marked as deleted (with
+:py:meth:`mark_deleted`) from this index, and return the number of elements
+removed.
+
+Elements that were connected to deleted elements are reconnected to their
+surviving neighbors, and the space used by deleted elements is reused by
+elements added afterwards. Queries on indices with many deleted elements
+become faster after compaction, as they no longer need to step over the
+deleted elements.
+
+Removed elements can no longer be restored with :py:meth:`unmark_deleted`.
+Queries and additions are blocked while the index is being compacted.
+)");
+
+  index.def(
+      "pack_for_search",
+      [](Index &index) {
+        nb::gil_scoped_release release;
+        index.packForSearch();
+      },
+      R"(
+Store this index in a smaller, read-only form for serving: each element's
+links are stored without padding, and its ID takes 4 bytes rather than 8 if
+every ID fits.
+
+Query results are unchanged and the index is saved in the usual format, but
+as with indices loaded with ``search_only=True``, it can no longer be
+modified and its IDs can no longer be listed. Best called right after
+loading an index with ``search_only=True``, which also releases the memory
+mapping the index was loaded from. To skip packing at load time altogether,
+save the index with :py:meth:`save_packed` instead.
+)");
+
+  static constexpr const char *SAVE_PACKED_DOCSTRING = R"(
+Save this index in the packed form used by :py:meth:`pack_for_search` to the
+provided file path or file-like object, whether or not this index has been
+packed itself. Loading the result reads it straight into packed storage.
+
+Packed indices can only be loaded with ``search_only=True``; loading one
+otherwise raises a :py:class:`ValueError`.
+  )";
+  index.def(
+      "save_packed",
+      [](Index &index, std::string filePath) {
+        nb::gil_scoped_release release;
+        index.savePackedIndex(filePath);
+      },
+      nb::arg("output_path"), SAVE_PACKED_DOCSTRING);
+
+  index.def(
+      "save_packed",
+      [](Index &index, nb::object filelike) {
+        auto outputStream = std::make_shared<PythonOutputStream>(filelike);
+
+        nb::gil_scoped_release release;
+        index.savePackedIndex(outputStream);
+      },
+      nb::arg("file_like"), SAVE_PACKED_DOCSTRING);
+
+  index.def("get_stats", &Index::getStats, R"(
+Return an :py:class:`IndexStats` object counting the queries and insertions
+made on this index since it was created (or since :py:meth:`reset_stats` was
+last called), including histograms of their latencies.
+
+Stats are collected per-thread and are cheap enough to leave enabled, so this
+can be called at any time, even while other threads are querying the index.
+)");
+
+  index.def("reset_stats", &Index::resetStats, R"(
+Reset every counter returned by :py:meth:`get_stats` to zero.
 )");
 
   ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -801,24 +1497,42 @@ and will write to the provided file.
 
 If provided a file-like object, Voyager will *not* release the GIL, but will pass
 one or more chunks of data (of up to 100MB each) to the provided object for writing.
+
+If ``compression_level`` is provided, the index will be compressed with zstd
+at that level (from 1 to 22) as it is written. Compressed indices are
+decompressed automatically by :py:meth:`load`, but can't be memory-mapped.
+Compression is only available if Voyager was built with support for it;
+otherwise, a :py:class:`ValueError` will be raised.
   )";
   index.def(
       "save",
-      [](Index &index, std::string filePath) {
+      [](Index &index, std::string filePath,
+         std::optional<int> compressionLevel) {
         nb::gil_scoped_release release;
-        index.saveIndex(filePath);
+        if (compressionLevel) {
+          index.saveCompressedIndex(filePath, *compressionLevel);
+        } else {
+          index.saveIndex(filePath);
+        }
       },
-      nb::arg("output_path"), SAVE_DOCSTRING);
+      nb::arg("output_path"), nb::arg("compression_level") = nb::none(),
+      SAVE_DOCSTRING);
 
   index.def(
       "save",
-      [](Index &index, nb::object filelike) {
+      [](Index &index, nb::object filelike,
+         std::optional<int> compressionLevel) {
         auto outputStream = std::make_shared<PythonOutputStream>(filelike);
 
         nb::gil_scoped_release release;
-        index.saveIndex(outputStream);
+        if (compressionLevel) {
+          index.saveCompressedIndex(outputStream, *compressionLevel);
+        } else {
+          index.saveIndex(outputStream);
+        }
       },
-      nb::arg("file_like"), SAVE_DOCSTRING);
+      nb::arg("file_like"), nb::arg("compression_level") = nb::none(),
+      SAVE_DOCSTRING);
 
   index.def(
       "as_bytes",
@@ -850,6 +1564,115 @@ into memory again.
 
 )");
 
+  static constexpr const char *SAVE_FULL_PRECISION_DOCSTRING = R"(
+Save this index's full-precision vectors (see
+:py:attr:`store_full_precision_vectors`) to the provided file path or
+file-like object, separately from the index itself.
+  )";
+  index.def(
+      "save_full_precision_vectors",
+      [](Index &index, std::string filePath) {
+        nb::gil_scoped_release release;
+        index.saveFullPrecisionVectors(filePath);
+      },
+      nb::arg("output_path"), SAVE_FULL_PRECISION_DOCSTRING);
+
+  index.def(
+      "save_full_precision_vectors",
+      [](Index &index, nb::object filelike) {
+        auto outputStream = std::make_shared<PythonOutputStream>(filelike);
+
+        nb::gil_scoped_release release;
+        index.saveFullPrecisionVectors(outputStream);
+      },
+      nb::arg("file_like"), SAVE_FULL_PRECISION_DOCSTRING);
+
+  static constexpr const char *LOAD_FULL_PRECISION_DOCSTRING = R"(
+Load full-precision vectors previously saved with
+:py:meth:`save_full_precision_vectors` into this index, replacing any
+full-precision vectors it already contains.
+
+If ``memory_map`` is ``True`` and a file path is provided, the vectors are
+memory-mapped rather than read into memory, and are only paged in from disk
+as queries re-rank against them.
+  )";
+  index.def(
+      "load_full_precision_vectors",
+      [](Index &index, std::string filePath, bool memoryMap) {
+        nb::gil_scoped_release release;
+        index.loadFullPrecisionVectors(filePath, memoryMap);
+      },
+      nb::arg("input_path"), nb::arg("memory_map") = false,
+      LOAD_FULL_PRECISION_DOCSTRING);
+
+  index.def(
+      "load_full_precision_vectors",
+      [](Index &index, nb::object filelike) {
+        auto inputStream = std::make_shared<PythonInputStream>(filelike);
+
+        nb::gil_scoped_release release;
+        index.loadFullPrecisionVectors(inputStream);
+      },
+      nb::arg("file_like"), LOAD_FULL_PRECISION_DOCSTRING);
+
+  static constexpr const char *SAVE_DELTA_DOCSTRING = R"(
+Save only the elements added, updated or deleted since this index was last
+saved (or loaded) in full, to a file path or file-like object.
+
+Applying the result with :py:meth:`apply_delta` to a copy of that full save
+brings the copy up to date with this index, while writing much less data than
+:py:meth:`save` would. Each delta contains every change since the last full
+save, so only the most recent delta needs to be applied. Compacting an index
+changes every element, and so makes its next delta as large as a full save.
+
+.. note::
+    The full-precision vectors of changed elements are included in deltas, and
+    are applied to copies that have loaded full-precision vectors of their own.
+  )";
+  index.def(
+      "save_delta",
+      [](Index &index, std::string filePath) {
+        nb::gil_scoped_release release;
+        index.saveDelta(filePath);
+      },
+      nb::arg("output_path"), SAVE_DELTA_DOCSTRING);
+
+  index.def(
+      "save_delta",
+      [](Index &index, nb::object filelike) {
+        auto outputStream = std::make_shared<PythonOutputStream>(filelike);
+
+        nb::gil_scoped_release release;
+        index.saveDelta(outputStream);
+      },
+      nb::arg("file_like"), SAVE_DELTA_DOCSTRING);
+
+  static constexpr const char *APPLY_DELTA_DOCSTRING = R"(
+Apply a delta written by :py:meth:`save_delta` to this index, which must hold
+the contents of the full save that the delta was taken relative to.
+
+Raises a :py:class:`ValueError` if the delta was saved from an incompatible
+index. If applying the delta fails partway through, this index may be left
+partially updated and should be reloaded.
+  )";
+  index.def(
+      "apply_delta",
+      [](Index &index, std::string filePath) {
+        nb::gil_scoped_release release;
+        index.applyDelta(filePath);
+      },
+      nb::arg("input_path"), APPLY_DELTA_DOCSTRING);
+
+  index.def(
+      "apply_delta",
+      [](Index &index, nb::object filelike) {
+        auto inputStream = std::make_shared<PythonInputStream>(filelike);
+
+        nb::gil_scoped_release release;
+        index.applyDelta(inputStream);
+      },
+      nb::arg("file_like"), APPLY_DELTA_DOCSTRING);
+
   ////////////////////////////////////////////////////////////////////////////////////////////////////
   // Python Builtin Supports
   ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -901,14 +1724,147 @@ Use the ``len`` operator to call this method::
       m, "E4M3Index",
       "An :py:class:`Index` that uses floating-point 8-bit storage.");
 
+  nb::class_<PQIndex, Index>(
+      m, "PQIndex",
+      "An :py:class:`Index` that stores product-quantized codes rather than "
+      "vectors.")
+      .def(
+          "__init__",
+          [](const nb::object *self, const SpaceType space,
+             const int num_dimensions, const size_t M,
+             const size_t ef_construction, const size_t random_seed,
+             const size_t max_elements, const StorageDataType storageDataType,
+             const int num_subspaces) {
+            // Construction is handled by Index.__new__.
+          },
+          nb::arg("space"), nb::arg("num_dimensions"), nb::arg("M") = 16,
+          nb::arg("ef_construction") = 200, nb::arg("random_seed") = 1,
+          nb::arg("max_elements") = 1,
+          nb::arg("storage_data_type") = StorageDataType::PQ,
+          nb::arg("num_subspaces") = 0, "Create a new, empty index.")
+      .def(
+          "train",
+          [](PQIndex &index, nb::ndarray<float> vectors) {
+            auto sample = pyArrayToNDArray<float, 2>(vectors);
+            nb::gil_scoped_release release;
+            index.train(sample);
+          },
+          nb::arg("vectors"), R"(
+Learn this index's product quantizer codebooks from the provided 2D array of
+vectors, rather than from the first vectors passed to :py:meth:`add_items`.
+Must be called before any vectors are added.
+)")
+      .def_prop_ro("num_subspaces", &PQIndex::getNumSubspaces,
+                   "The number of bytes used to store each vector.")
+      .def_prop_ro("is_trained", &PQIndex::isTrained,
+                   "Whether this index's codebooks have been learned yet.")
+      .def("__repr__", [](const Index &index) {
+        return "<voyager.PQIndex space=" + index.getSpaceName() +
+               " num_dimensions=" + std::to_string(index.getNumDimensions()) +
+               " storage_data_type=" + index.getStorageDataTypeName() + ">";
+      });
+
+  nb::enum_<ShardingMode>(
+      m, "ShardingMode",
+      "How a :py:class:`ShardedIndex` spreads its elements across its shards.")
+      .value("Partitioned", ShardingMode::Partitioned,
+             "Each element is stored in exactly one shard, chosen by its ID. "
+             "Queries search every shard and merge their results.")
+      .value("Replicated", ShardingMode::Replicated,
+             "Every shard stores a full copy of the index, and each query is "
+             "answered by a single replica (preferably one on the calling "
+             "thread's NUMA node).")
+      .export_values();
+
+  nb::class_<ShardedIndex, Index>(m, "ShardedIndex", R"(
+An :py:class:`Index` made up of several smaller indices ("shards"), each placed
+on one of this machine's NUMA nodes. Each shard's memory is bound to its node, and
+its work runs on threads pinned to that node's CPUs, so that queries avoid loading
+vectors from memory attached to another socket.
+
+By default, one shard is created per NUMA node. On machines without NUMA, shards
+use the same memory and threads as any other :py:class:`Index`.
+
+Replicated indices are saved as (and can be loaded from) regular index files.
+The shards of a partitioned index must be saved individually.
+)")
+      .def_static(
+          "__new__",
+          [](const nb::object *, const SpaceType space,
+             const int num_dimensions, const ShardingMode mode,
+             const size_t num_shards, const size_t M,
+             const size_t ef_construction, const size_t random_seed,
+             const size_t max_elements, const StorageDataType storageDataType,
+             const int num_subspaces) -> std::shared_ptr<Index> {
+            nb::gil_scoped_release release;
+            return std::make_shared<ShardedIndex>(
+                space, num_dimensions, mode, num_shards, M, ef_construction,
+                random_seed, max_elements, storageDataType, num_subspaces);
+          },
+          nb::arg("cls"), nb::arg("space"), nb::arg("num_dimensions"),
+          nb::arg("mode") = ShardingMode::Partitioned,
+          nb::arg("num_shards") = 0, nb::arg("M") = 12,
+          nb::arg("ef_construction") = 200, nb::arg("random_seed") = 1,
+          nb::arg("max_elements") = 1,
+          nb::arg("storage_data_type") = StorageDataType::Float32,
+          nb::arg("num_subspaces") = 0)
+      .def(
+          "__init__",
+          [](const nb::object *self, const SpaceType space,
+             const int num_dimensions, const ShardingMode mode,
+             const size_t num_shards, const size_t M,
+             const size_t ef_construction, const size_t random_seed,
+             const size_t max_elements, const StorageDataType storageDataType,
+             const int num_subspaces) {
+            // Construction is handled by ShardedIndex.__new__.
+          },
+          nb::arg("space"), nb::arg("num_dimensions"),
+          nb::arg("mode") = ShardingMode::Partitioned,
+          nb::arg("num_shards") = 0, nb::arg("M") = 12,
+          nb::arg("ef_construction") = 200, nb::arg("random_seed") = 1,
+          nb::arg("max_elements") = 1,
+          nb::arg("storage_data_type") = StorageDataType::Float32,
+          nb::arg("num_subspaces") = 0, R"(
+Create a new, empty sharded index.
+
+``num_shards`` defaults to one shard per NUMA node. ``max_elements`` is the
+expected size of the whole index, and is divided among the shards of a partitioned
+index. All other arguments are passed to each shard, as in :py:meth:`Index.__new__`.
+)")
+      .def_prop_ro("num_shards", &ShardedIndex::getNumShards,
+                   "The number of shards in this index.")
+      .def_prop_ro("mode", &ShardedIndex::getShardingMode,
+                   "How this index spreads its elements across its shards.")
+      .def(
+          "get_shard",
+          [](ShardedIndex &index, size_t shard) {
+            return index.getShard(shard);
+          },
+          nb::arg("shard"), R"(
+Return the :py:class:`Index` that holds one shard of this index. Modifying the
+returned index directly (i.e.: adding items to it) may cause queries on this index
+to return incorrect results.
+)")
+      .def("__repr__", [](const ShardedIndex &index) {
+        return "<voyager.ShardedIndex space=" + index.getSpaceName() +
+               " num_dimensions=" + std::to_string(index.getNumDimensions()) +
+               " storage_data_type=" + index.getStorageDataTypeName() +
+               " mode=" + toString(index.getShardingMode()) +
+               " num_shards=" + std::to_string(index.getNumShards()) + ">";
+      });
+
   index.def_static(
       "__new__",
       [](const nb::object *, const SpaceType space, const int num_dimensions,
          const size_t M, const size_t ef_construction, const size_t random_seed,
-         const size_t max_elements,
-         const StorageDataType storageDataType) -> std::shared_ptr<Index> {
+         const size_t max_elements, const StorageDataType storageDataType,
+         const int num_subspaces) -> std::shared_ptr<Index> {
         nb::gil_scoped_release release;
         switch (storageDataType) {
+        case StorageDataType::PQ:
+          return std::make_shared<PQIndex>(space, num_dimensions, num_subspaces,
+                                           M, ef_construction, random_seed,
+                                           max_elements);
         case StorageDataType::E4M3:
           return std::make_shared<TypedIndex<float, E4M3>>(
               space, num_dimensions, M, ef_construction, random_seed,
@@ -930,6 +1886,7 @@ Use the ``len`` operator to call this method::
       nb::arg("M") = 12, nb::arg("ef_construction") = 200,
       nb::arg("random_seed") = 1, nb::arg("max_elements") = 1,
       nb::arg("storage_data_type") = StorageDataType::Float32,
+      nb::arg("num_subspaces") = 0,
       R"(
 Create a new Voyager nearest-neighbor search index with the provided arguments.
 
@@ -952,20 +1909,31 @@ The additional arguments for :py:class:`Space`, ``num_dimensions``, and
 :py:class:`StorageDataType` allow for loading of index files created with versions
 of Voyager prior to v1.3.
 
+If ``search_only`` is ``True`` (only supported when loading from a filename), the
+returned index will be read-only and will be memory-mapped directly from the file
+where the platform supports it. Memory-mapped indices load almost instantly, only
+read pages of the file from disk as they are needed, and share physical memory
+with any other processes that load the same file.
+
 .. warning::
     Loading an index from a file-like object will not release the GIL.
     However, chunks of data of up to 100MB in size will be read from the file-like
     object at once, hopefully reducing the impact of the GIL.
+
+.. warning::
+    Search-only indices cannot be modified, and do not keep track of the IDs they
+    contain: only :py:meth:`Index.query` and related read-only methods are supported.
 )";
 
   index.def_static(
       "load",
       [](const std::string filename, const SpaceType space,
-         const int num_dimensions,
-         const StorageDataType storageDataType) -> std::shared_ptr<Index> {
+         const int num_dimensions, const StorageDataType storageDataType,
+         const bool searchOnly) -> std::shared_ptr<Index> {
         nb::gil_scoped_release release;
 
-        auto inputStream = std::make_shared<FileInputStream>(filename);
+        std::shared_ptr<InputStream> inputStream =
+            decompressIfNeeded(std::make_shared<FileInputStream>(filename));
         std::unique_ptr<voyager::Metadata::V1> metadata =
             voyager::Metadata::loadFromStream(inputStream);
 
@@ -991,36 +1959,39 @@ of Voyager prior to v1.3.
                 std::to_string(metadata->getNumDimensions()) + ").");
           }
 
-          return loadTypedIndexFromMetadata(std::move(metadata), inputStream);
+          return loadTypedIndexFromMetadata(std::move(metadata), inputStream,
+                                            searchOnly);
         }
 
         switch (storageDataType) {
         case StorageDataType::E4M3:
-          return std::make_shared<TypedIndex<float, E4M3>>(inputStream, space,
-                                                           num_dimensions);
+          return std::make_shared<TypedIndex<float, E4M3>>(
+              inputStream, space, num_dimensions, searchOnly);
         case StorageDataType::Float8:
           return std::make_shared<
-              TypedIndex<float, int8_t, std::ratio<1, 127>>>(inputStream, space,
-                                                             num_dimensions);
+              TypedIndex<float, int8_t, std::ratio<1, 127>>>(
+              inputStream, space, num_dimensions, searchOnly);
         case StorageDataType::Float32:
-          return std::make_shared<TypedIndex<float>>(inputStream, space,
-                                                     num_dimensions);
+          return std::make_shared<TypedIndex<float>>(
+              inputStream, space, num_dimensions, searchOnly);
         default:
           throw std::runtime_error("Unknown storage data type received!");
         }
       },
       nb::arg("filename"), nb::arg("space"), nb::arg("num_dimensions"),
-      nb::arg("storage_data_type") = StorageDataType::Float32, LOAD_DOCSTRING);
+      nb::arg("storage_data_type") = StorageDataType::Float32,
+      nb::arg("search_only") = false, LOAD_DOCSTRING);
 
   index.def_static(
       "load",
-      [](const std::string filename) -> std::shared_ptr<Index> {
+      [](const std::string filename,
+         const bool searchOnly) -> std::shared_ptr<Index> {
         nb::gil_scoped_release release;
 
         return loadTypedIndexFromStream(
-            std::make_shared<FileInputStream>(filename));
+            std::make_shared<FileInputStream>(filename), searchOnly);
       },
-      nb::arg("filename"), LOAD_DOCSTRING);
+      nb::arg("filename"), nb::arg("search_only") = false, LOAD_DOCSTRING);
 
   index.def_static(
       "load",
@@ -1035,9 +2006,11 @@ of Voyager prior to v1.3.
                   .c_str());
         }
 
-        auto inputStream = std::make_shared<PythonInputStream>(filelike);
+        std::shared_ptr<InputStream> inputStream =
+            std::make_shared<PythonInputStream>(filelike);
         nb::gil_scoped_release release;
 
+        inputStream = decompressIfNeeded(inputStream);
         std::unique_ptr<voyager::Metadata::V1> metadata =
             voyager::Metadata::loadFromStream(inputStream);
 
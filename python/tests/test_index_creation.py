@@ -14,6 +14,7 @@
 # See the License for the specific language governing permissions and
 # limitations under the License.
 
+import asyncio
 from io import BytesIO
 
 import pytest
@@ -392,3 +393,447 @@ def test_accuracy_for_inner_product():
     neighbors, distances = index.query(query, k=3, query_ef=10)
     assert neighbors[0] == np.argmax(expected_distances)
     assert abs(distances[0] - (1.0 - np.amax(expected_distances))) < 0.01
+
+
+@pytest.mark.parametrize("space", [voyager.Space.Euclidean, voyager.Space.Cosine])
+@pytest.mark.parametrize("id_multiplier", [1, 1_000_000_000])
+def test_query_with_allowed_ids(space: voyager.Space, id_multiplier: int):
+    np.random.seed(123)
+    num_dimensions = 16
+    num_elements = 1_000
+    input_data = np.random.random((num_elements, num_dimensions)).astype(np.float32) * 2 - 1
+    ids = [i * id_multiplier for i in range(num_elements)]
+
+    index = voyager.Index(space=space, num_dimensions=num_dimensions)
+    index.add_items(input_data, ids)
+
+    allowed_ids = ids[::3]
+    labels, _ = index.query(input_data, k=10, query_ef=50, allowed_ids=allowed_ids)
+    assert set(labels.flatten()) <= set(allowed_ids)
+
+    for i, vector in enumerate(input_data):
+        single_labels, _ = index.query(vector, k=10, query_ef=50, allowed_ids=allowed_ids)
+        assert set(single_labels) <= set(allowed_ids)
+        if ids[i] in allowed_ids:
+            assert single_labels[0] == ids[i]
+
+    with pytest.raises(voyager.RecallError):
+        index.query(input_data[0], k=3, allowed_ids=ids[:2])
+
+
+@pytest.mark.parametrize("space", [voyager.Space.Euclidean, voyager.Space.InnerProduct])
+def test_optimize_layout_preserves_query_results(space: voyager.Space):
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(space=space, num_dimensions=num_dimensions)
+    index.add_items(input_data)
+    expected_labels, expected_distances = index.query(input_data, k=10, num_threads=1, query_ef=50)
+
+    index.optimize_layout()
+    labels, distances = index.query(input_data, k=10, num_threads=1, query_ef=50)
+    np.testing.assert_array_equal(labels, expected_labels)
+    np.testing.assert_array_equal(distances, expected_distances)
+
+    reloaded = voyager.Index.load(BytesIO(index.as_bytes()))
+    reloaded_labels, _ = reloaded.query(input_data, k=10, num_threads=1, query_ef=50)
+    np.testing.assert_array_equal(reloaded_labels, expected_labels)
+
+
+def test_compact_removes_deleted_elements():
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(space=voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    ids = index.add_items(input_data)
+    assert index.compact() == 0
+
+    deleted_ids = ids[::4]
+    for id in deleted_ids:
+        index.mark_deleted(id)
+    assert index.compact() == len(deleted_ids)
+    assert len(index) == len(ids) - len(deleted_ids)
+    assert set(index.ids) == set(ids) - set(deleted_ids)
+
+    remaining = [i for i in range(len(ids)) if ids[i] not in set(deleted_ids)]
+    labels, _ = index.query(input_data[remaining], k=1, query_ef=50)
+    recall = np.mean(labels[:, 0] == np.array(ids)[remaining])
+    assert recall > 0.99
+
+
+@pytest.mark.parametrize("space", [voyager.Space.Euclidean, voyager.Space.Cosine])
+def test_product_quantized_index(space: voyager.Space):
+    np.random.seed(123)
+    num_dimensions = 32
+    input_data = np.random.random((2_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(
+        space=space,
+        num_dimensions=num_dimensions,
+        storage_data_type=voyager.StorageDataType.PQ,
+        num_subspaces=16,
+    )
+    assert isinstance(index, voyager.PQIndex)
+    assert index.num_subspaces == 16
+    assert not index.is_trained
+
+    index.add_items(input_data)
+    assert index.is_trained
+    assert len(index) == len(input_data)
+
+    labels, _ = index.query(input_data, k=1, query_ef=100)
+    assert np.mean(labels.flatten() == np.arange(len(input_data))) > 0.3
+
+    reloaded = voyager.Index.load(BytesIO(index.as_bytes()))
+    assert isinstance(reloaded, voyager.PQIndex)
+    reloaded_labels, _ = reloaded.query(input_data, k=1, query_ef=100)
+    np.testing.assert_array_equal(reloaded_labels, labels)
+
+
+@pytest.mark.parametrize("space", [voyager.Space.Euclidean, voyager.Space.Cosine])
+def test_rerank_with_full_precision_vectors(space: voyager.Space):
+    np.random.seed(123)
+    num_dimensions = 32
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    reference = voyager.Index(space=space, num_dimensions=num_dimensions)
+    reference.add_items(input_data)
+    exact_labels, exact_distances = reference.query(input_data, k=1, query_ef=100)
+
+    index = voyager.Index(
+        space=space,
+        num_dimensions=num_dimensions,
+        storage_data_type=voyager.StorageDataType.E4M3,
+    )
+    index.store_full_precision_vectors = True
+    index.add_items(input_data)
+
+    labels, distances = index.query(input_data, k=1, query_ef=100, rerank_k=20)
+    np.testing.assert_array_equal(labels, exact_labels)
+    np.testing.assert_allclose(distances, exact_distances, atol=1e-4)
+
+    full_precision_vectors = BytesIO()
+    index.save_full_precision_vectors(full_precision_vectors)
+    reloaded = voyager.Index.load(BytesIO(index.as_bytes()))
+    reloaded.load_full_precision_vectors(BytesIO(full_precision_vectors.getvalue()))
+    reloaded_labels, _ = reloaded.query(input_data, k=1, query_ef=100, rerank_k=20)
+    np.testing.assert_array_equal(reloaded_labels, labels)
+
+
+@pytest.mark.parametrize("mode", [voyager.ShardingMode.Partitioned, voyager.ShardingMode.Replicated])
+def test_sharded_index(mode: voyager.ShardingMode):
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.ShardedIndex(
+        space=voyager.Space.Euclidean,
+        num_dimensions=num_dimensions,
+        mode=mode,
+        num_shards=3,
+    )
+    assert isinstance(index, voyager.Index)
+    assert index.num_shards == 3
+    assert index.mode == mode
+
+    ids = index.add_items(input_data)
+    assert len(index) == len(input_data)
+    assert set(index.ids) == set(ids)
+    np.testing.assert_allclose(index.get_vector(ids[7]), input_data[7])
+
+    labels, distances = index.query(input_data, k=10, query_ef=50)
+    assert np.mean(labels[:, 0] == np.array(ids)) > 0.99
+    assert np.all(np.diff(distances, axis=1) >= 0)
+
+    if mode == voyager.ShardingMode.Replicated:
+        reloaded = voyager.Index.load(BytesIO(index.as_bytes()))
+        reloaded_labels, _ = reloaded.query(input_data, k=10, query_ef=50)
+        np.testing.assert_array_equal(reloaded_labels, labels)
+    else:
+        shard_sizes = [len(index.get_shard(i)) for i in range(index.num_shards)]
+        assert sum(shard_sizes) == len(input_data)
+
+
+def test_index_stats():
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((500, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    index.add_items(input_data)
+    stats = index.get_stats()
+    assert stats.num_inserts == len(input_data)
+    assert stats.insert_latency.count == len(input_data)
+    assert stats.num_queries == 0
+
+    index.reset_stats()
+    index.query(input_data, k=10, query_ef=50)
+    index.query(input_data[0], k=10, query_ef=50)
+    stats = index.get_stats()
+    assert stats.num_inserts == 0
+    assert stats.num_queries == len(input_data) + 1
+    assert stats.hops >= stats.num_queries
+    assert stats.distance_computations >= stats.hops
+    assert stats.lock_wait_seconds >= 0
+
+    latency = stats.query_latency
+    assert sum(latency.counts) == latency.count == stats.num_queries
+    assert len(latency.bucket_upper_bounds) == len(latency.counts)
+    assert latency.bucket_upper_bounds[-1] == float("inf")
+    assert latency.total_seconds > 0
+
+    index.reset_stats()
+    assert index.get_stats().num_queries == 0
+    assert index.get_stats().query_latency.count == 0
+
+
+def test_early_termination():
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((2_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    index.add_items(input_data)
+    assert index.early_termination_patience == 0
+    expected, _ = index.query(input_data, k=10, query_ef=200)
+    index.reset_stats()
+    index.query(input_data, k=10, query_ef=200)
+    full_search_hops = index.get_stats().hops
+
+    patience = index.calibrate_early_termination(input_data, k=10, target_recall=0.9, query_ef=200)
+    assert 0 < patience <= 200
+    assert index.early_termination_patience == patience
+
+    index.reset_stats()
+    actual, _ = index.query(input_data, k=10, query_ef=200)
+    assert index.get_stats().hops < full_search_hops
+    recall = np.mean([len(set(a) & set(e)) / 10 for a, e in zip(actual, expected)])
+    assert recall >= 0.9
+
+    index.early_termination_patience = 0
+    np.testing.assert_array_equal(index.query(input_data, k=10, query_ef=200)[0], expected)
+
+
+def test_bulk_add_items():
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((2_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    ids = index.bulk_add_items(input_data, num_threads=8)
+    assert list(ids) == list(range(len(input_data)))
+    assert len(index) == len(input_data)
+    labels, _ = index.query(input_data, k=1, query_ef=50)
+    assert np.mean(labels[:, 0] == np.arange(len(input_data))) > 0.95
+
+    single_threaded = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    single_threaded.bulk_add_items(input_data, num_threads=1)
+    assert single_threaded.as_bytes() == index.as_bytes()
+
+    with pytest.raises(ValueError):
+        index.bulk_add_items(input_data[:1], ids=[3])
+    assert len(index) == len(input_data)
+
+
+@pytest.mark.parametrize("space", [voyager.Space.Euclidean, voyager.Space.Cosine])
+def test_brute_force_query(space):
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+    queries = np.random.random((20, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(space, num_dimensions=num_dimensions)
+    index.add_items(input_data)
+
+    distances = index.get_distances(queries, input_data)
+    assert distances.shape == (len(queries), len(input_data))
+    np.testing.assert_allclose(
+        distances[3, 4], index.get_distance(queries[3], input_data[4]), rtol=1e-4
+    )
+
+    labels, label_distances = index.brute_force_query(queries, k=5)
+    np.testing.assert_array_equal(labels, np.argsort(distances, axis=1)[:, :5])
+    np.testing.assert_allclose(label_distances, np.sort(distances, axis=1)[:, :5], rtol=1e-4)
+
+    allowed_ids = [int(labels[0, 4]), 7]
+    filtered, _ = index.brute_force_query(queries[:1], k=2, allowed_ids=allowed_ids)
+    assert set(filtered[0]) == set(allowed_ids)
+
+
+def test_grouped_query():
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+    groups = [1_000_000 + (i // 5) for i in range(len(input_data))]
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    ids = index.add_items(input_data)
+    assert index.get_group(7) == 7
+    index.set_groups(ids, groups)
+    assert index.get_group(7) == groups[7]
+
+    labels, distances = index.grouped_query(input_data[:20], k=10, query_ef=100)
+    assert labels.shape == (20, 10)
+    assert distances.shape == (20, 10)
+    for row, distance_row in zip(labels, distances):
+        assert len({groups[label] for label in row}) == 10
+        assert list(distance_row) == sorted(distance_row)
+
+    single_labels, _ = index.grouped_query(input_data[0], k=10, query_ef=100)
+    np.testing.assert_array_equal(single_labels, labels[0])
+
+    # Group assignments are saved along with the index:
+    reloaded = voyager.Index.load(BytesIO(index.as_bytes()))
+    assert reloaded.get_group(7) == groups[7]
+    reloaded_labels, _ = reloaded.grouped_query(input_data[:20], k=10, query_ef=100)
+    np.testing.assert_array_equal(reloaded_labels, labels)
+
+    # Only one of these allowed IDs' groups can be returned:
+    with pytest.raises(voyager.RecallError):
+        index.grouped_query(input_data[0], k=2, allowed_ids=[0, 1, 2])
+
+
+def test_query_cache():
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    index.add_items(input_data)
+    expected_labels, expected_distances = index.query(input_data, k=5)
+    assert index.query_cache_size == 0
+
+    index.query_cache_size = 10_000
+    index.reset_stats()
+    index.query(input_data, k=5)
+    labels, distances = index.query(input_data, k=5)
+    np.testing.assert_array_equal(labels, expected_labels)
+    np.testing.assert_array_equal(distances, expected_distances)
+    stats = index.get_stats()
+    assert stats.query_cache_hits == len(input_data)
+    assert stats.query_cache_misses == len(input_data)
+
+    # Marking an item as deleted discards every cached result:
+    index.mark_deleted(int(expected_labels[0, 0]))
+    labels, _ = index.query(input_data[0], k=5)
+    assert expected_labels[0, 0] not in labels
+    assert index.get_stats().query_cache_hits == len(input_data)
+
+
+def test_query_async():
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    index.add_items(input_data)
+    expected_labels, expected_distances = index.query(input_data, k=5)
+
+    index.async_batch_window = 0.001
+    assert index.async_batch_window == pytest.approx(0.001)
+
+    async def query_all():
+        return await asyncio.gather(*(index.query_async(vector, k=5) for vector in input_data))
+
+    for i, (labels, distances) in enumerate(asyncio.run(query_all())):
+        np.testing.assert_array_equal(labels, expected_labels[i])
+        np.testing.assert_array_equal(distances, expected_distances[i])
+
+    async def query_too_many():
+        return await index.query_async(input_data[0], k=len(input_data) + 1)
+
+    with pytest.raises(voyager.RecallError):
+        asyncio.run(query_too_many())
+
+    # Must be called from within a running event loop:
+    with pytest.raises(RuntimeError):
+        index.query_async(input_data[0])
+
+
+def test_pack_for_search(tmp_path):
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions, M=32)
+    index.add_items(input_data)
+    expected_labels, expected_distances = index.query(input_data, k=5)
+    index.save(str(tmp_path / "index.voy"))
+
+    packed = voyager.Index.load(str(tmp_path / "index.voy"), search_only=True)
+    packed.pack_for_search()
+    labels, distances = packed.query(input_data, k=5)
+    np.testing.assert_array_equal(labels, expected_labels)
+    np.testing.assert_array_equal(distances, expected_distances)
+
+    with pytest.raises(RuntimeError):
+        packed.add_item(input_data[0])
+
+    # Packed indices are saved in the usual format:
+    reloaded = voyager.Index.load(BytesIO(packed.as_bytes()))
+    labels, _ = reloaded.query(input_data, k=5)
+    np.testing.assert_array_equal(labels, expected_labels)
+
+    # ...unless saved packed, which loads straight into packed storage:
+    index.save_packed(str(tmp_path / "packed.voy"))
+    reloaded = voyager.Index.load(str(tmp_path / "packed.voy"), search_only=True)
+    labels, distances = reloaded.query(input_data, k=5)
+    np.testing.assert_array_equal(labels, expected_labels)
+    np.testing.assert_array_equal(distances, expected_distances)
+    with pytest.raises(ValueError):
+        voyager.Index.load(str(tmp_path / "packed.voy"))
+
+
+def test_apply_delta(tmp_path):
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((2_100, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    index.add_items(input_data[:2_000], num_threads=1)
+    base = index.as_bytes()
+    copy = voyager.Index.load(BytesIO(base))
+
+    index.add_items(input_data[2_000:2_010], num_threads=1)
+    index.mark_deleted(5)
+    delta = BytesIO()
+    index.save_delta(delta)
+    assert len(delta.getvalue()) < len(base) / 2
+
+    copy.apply_delta(BytesIO(delta.getvalue()))
+    assert len(copy) == len(index)
+    assert copy.query(input_data[5], k=1)[0][0] != 5
+    labels, _ = copy.query(input_data[2_000:2_010], k=1)
+    np.testing.assert_array_equal(labels[:, 0], np.arange(2_000, 2_010))
+
+    index.compact()
+    index.save_delta(str(tmp_path / "index.delta"))
+    copy.apply_delta(str(tmp_path / "index.delta"))
+    assert copy.as_bytes() == index.as_bytes()
+
+    with pytest.raises(ValueError):
+        copy.apply_delta(BytesIO(base))
+
+
+def test_save_compressed(tmp_path):
+    np.random.seed(123)
+    num_dimensions = 16
+    input_data = np.random.random((1_000, num_dimensions)).astype(np.float32) * 2 - 1
+
+    index = voyager.Index(voyager.Space.Euclidean, num_dimensions=num_dimensions)
+    index.add_items(input_data)
+    compressed = BytesIO()
+    try:
+        index.save(compressed, compression_level=5)
+    except ValueError:
+        pytest.skip("Voyager was built without compression support.")
+
+    assert compressed.getvalue()[:4] == b"VYZS"
+    reloaded = voyager.Index.load(BytesIO(compressed.getvalue()))
+    assert reloaded.as_bytes() == index.as_bytes()
+
+    index.save(str(tmp_path / "index.voy.zst"), compression_level=5)
+    reloaded = voyager.Index.load(str(tmp_path / "index.voy.zst"))
+    assert reloaded.as_bytes() == index.as_bytes()
@@ -137,6 +137,25 @@ def test_v1_indices_must_have_no_parameters_or_must_match(load_from_stream: bool
     assert f"({num_dimensions + 1})" in repr(exception)
 
 
+@pytest.mark.parametrize("index_filename", glob(os.path.join(INDEX_FIXTURE_DIR, "v1", "*.hnsw")))
+def test_load_v1_indices_search_only(index_filename: str):
+    index = Index.load(index_filename)
+    search_only_index = Index.load(index_filename, search_only=True)
+
+    assert search_only_index.num_dimensions == index.num_dimensions
+    assert search_only_index.space == index.space
+    assert search_only_index.storage_data_type == index.storage_data_type
+
+    vectors = np.array([index[_id] for _id in sorted(index.ids)])
+    expected_labels, expected_distances = index.query(vectors, k=len(vectors))
+    labels, distances = search_only_index.query(vectors, k=len(vectors))
+    np.testing.assert_array_equal(labels, expected_labels)
+    np.testing.assert_allclose(distances, expected_distances)
+
+    with pytest.raises(RuntimeError):
+        search_only_index.add_item(vectors[0])
+
+
 @pytest.mark.parametrize(
     "data,should_pass",
     [
@@ -293,3 +312,24 @@ def test_fuzz(seed: int, with_valid_header: bool, offset_level_0: int):
     random_data.seek(0)
     with pytest.raises(Exception):
         Index.load(random_data)
+
+
+@pytest.mark.parametrize("seed", range(100))
+def test_fuzz_search_only(tmp_path, seed: int):
+    """
+    Ensure that memory-mapping randomly-generated indices doesn't crash the process
+    """
+    np.random.seed(seed)
+    num_bytes = np.random.randint(1_000_000)
+    filename = str(tmp_path / "random.hnsw")
+    with open(filename, "wb") as f:
+        f.write(
+            b"VOYA"  # Header
+            b"\x01\x00\x00\x00"  # File version
+            b"\x0a\x00\x00\x00"  # Number of dimensions (10)
+            b"\x00"  # Space type
+            b"\x20"  # Storage data type
+        )
+        f.write((np.random.rand(num_bytes) * 255).astype(np.uint8).tobytes())
+    with pytest.raises(Exception):
+        Index.load(filename, search_only=True)